@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+
+// Adaptive sample rate of one channel.
+//
+// The rate is the channel's base rate divided by 2^shift. Every new value
+// feeds two exponential averages with time constants in seconds, so they mean
+// the same at any rate: their difference is the rate of change, and the
+// spread of the values around the fast one is the rolling variance. A channel
+// that moves or gets noisy goes straight back to the fastest rate; one that
+// has been quiet for hold_s steps down one halving at a time. The filters keep
+// their sample count, so a slower rate also widens their window in time.
+
+struct AdaptiveRateConfig
+{
+    uint8_t min_shift;   // Fastest rate, base rate / 2^min_shift
+    uint8_t max_shift;   // Slowest rate
+    float fast_s;        // Time constant of the fast average
+    float slow_s;        // Time constant of the slow average and the variance
+    float quiet_sd;      // Below this standard deviation and quiet_slope the channel is quiet
+    float busy_sd;       // Above this standard deviation or busy_slope it is busy
+    float quiet_slope;   // Change per second
+    float busy_slope;
+    float hold_s;        // Quiet time before the next halving
+};
+
+class AdaptiveRate
+{
+public:
+    AdaptiveRate();
+
+    // Set the bounds and thresholds and start over at the fastest rate
+    void configure(const AdaptiveRateConfig &config);
+
+    // A new value, returns the shift to sample at from now on
+    uint8_t update(float value, uint32_t now_us);
+
+    // Back to the fastest rate, e.g. when a dose goes in
+    void boost();
+
+    uint8_t shift() const { return current; }
+    float slope() const { return change_per_s; }
+    float deviation() const;
+
+    const AdaptiveRateConfig &config() const { return settings; }
+
+private:
+    AdaptiveRateConfig settings;
+    uint8_t current;        // Shift in use
+    bool started;           // The averages hold a value
+    uint32_t last_us;       // Time of the last value
+    float fast;             // Fast and slow averages
+    float slow;
+    float variance;         // Of the values around the fast average
+    float change_per_s;     // Rate of change from the two averages
+    float quiet_for_s;      // Time the channel has been quiet
+};
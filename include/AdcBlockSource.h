@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+// Samples per block handed from a continuous ADC source to the filters
+#ifndef ADC_BLOCK_SIZE
+#define ADC_BLOCK_SIZE 32
+#endif
+
+// One block of consecutive raw samples from a single channel
+struct AdcBlock
+{
+    uint32_t timestamp_us;            // Clock value of the first sample
+    uint16_t count;                   // Number of valid samples
+    uint16_t samples[ADC_BLOCK_SIZE]; // Raw ADC counts in sampling order
+};
+
+// Continuous ADC sampling at a fixed rate, delivered in whole blocks.
+// On the board a hardware timer paces the conversions, on the host a
+// simulated ADC implements the same interface against the fake clock.
+class AdcBlockSource
+{
+public:
+    static const uint8_t MAX_CHANNELS = 4; // Pins sampled together
+
+    virtual ~AdcBlockSource() {}
+
+    // Start sampling every pin at sample_rate_hz, channel numbers follow the order of pins
+    virtual bool begin(const uint8_t *pins, uint8_t channel_count, uint32_t sample_rate_hz) = 0;
+
+    // Take the oldest completed block of a channel, returns false if none is ready
+    virtual bool readBlock(uint8_t channel, AdcBlock &block) = 0;
+
+    // Convert a channel only on every 2^shift-th tick of the sample clock, from its next block on.
+    // A slower channel fills its blocks more slowly, the other channels are not affected
+    virtual bool setRateShift(uint8_t channel, uint8_t shift) = 0;
+
+    // Blocks that were lost because the consumer did not keep up
+    virtual uint32_t overflows() const = 0;
+
+    // Stop the sample clock before the chip sleeps and restart it after, the partly filled blocks are dropped
+    virtual void pause() = 0;
+    virtual void resume() = 0;
+};
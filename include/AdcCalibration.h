@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+// Largest raw reading of the 12-bit ESP32 ADC
+#define ADC_RAW_MAX 4095
+
+// Raw count to millivolt conversion for one ADC unit.
+//
+// The ESP32 ADC is 12-bit, non-linear and differs from chip to chip, so the
+// old "* 5.0 / 1024" was wrong twice over. The curve is evaluated once for
+// every possible raw value at boot (from the eFuse characterisation on the
+// board) and kept in a 4096 entry table, so converting a reading on the hot
+// path is a single array lookup with no float math.
+class AdcCalibration
+{
+public:
+    // Calibration curve, returns millivolts for a raw reading
+    typedef uint32_t (*Curve)(uint16_t raw, const void *context);
+
+    AdcCalibration() : built(false) {}
+
+    // Evaluate the curve for every raw value, context is handed through to it
+    void build(Curve curve, const void *context);
+
+    // The table has been built
+    bool ready() const { return built; }
+
+    // Millivolts for a raw reading, out of range readings clamp to full scale
+    uint16_t millivolts(uint16_t raw) const { return table[raw > ADC_RAW_MAX ? ADC_RAW_MAX : raw]; }
+
+    // Volts for a raw reading
+    float volts(uint16_t raw) const { return millivolts(raw) * 0.001f; }
+
+    // Millivolts for a reading with fraction_bits below the count, e.g. a decimated average. The entries are whole
+    // millivolts and neighbours repeat, so rather than between two of them this goes linearly between the table
+    // averaged over SMOOTHING entries either side, which keeps what the average gained below a count
+    float millivolts(uint32_t raw, uint8_t fraction_bits) const;
+    float volts(uint32_t raw, uint8_t fraction_bits) const { return millivolts(raw, fraction_bits) * 0.001f; }
+
+private:
+    static const uint16_t SMOOTHING = 16;
+
+    uint16_t table[ADC_RAW_MAX + 1]; // Millivolts indexed by raw count
+    bool built;                      // build() has run
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include "AdcBlockSource.h"
+#include "I2cBus.h"
+#include "SpscRing.h"
+
+// Chain size, the ADDR pin selects one of four addresses
+#define ADS1X15_MAX_DEVICES 4
+#define ADS1X15_INPUTS 4 // Single-ended inputs per device
+#define ADS1X15_MAX_CHANNELS (ADS1X15_MAX_DEVICES * ADS1X15_INPUTS)
+
+// I2C clock of the chain, the data rate is capped so one round of the bus fits in a conversion. Override with -D build flags
+#ifndef ADS1X15_BUS_HZ
+#define ADS1X15_BUS_HZ 400000
+#endif
+
+// Chain input of a device, what begin() takes as a pin
+#define ADS1X15_INPUT(device, input) ((device) * ADS1X15_INPUTS + (input))
+
+enum Ads1x15Model : uint8_t
+{
+    ADS1115, // 16 bits, 8 to 860 conversions per second
+    ADS1015, // 12 bits, 128 to 3300 conversions per second
+};
+
+// Counters of the chain
+struct Ads1x15Stats
+{
+    uint32_t rounds;        // Rounds serviced, one conversion of every device each
+    uint32_t conversions;   // Samples taken
+    uint32_t transactions;  // I2C transactions
+    uint32_t bus_errors;    // Transactions that failed, their samples are lost
+    uint32_t missed;        // Conversions that finished before the last round was serviced
+};
+
+// Continuous sampling from a chain of ADS1115 / ADS1015 converters.
+//
+// Every device runs in continuous conversion mode with its ALERT/RDY pin set
+// up as a conversion ready signal, so no one polls for a result. Once every
+// device of the chain has signalled, one I2C transaction reads all the
+// results and switches each device's multiplexer to its next input, which
+// starts the next conversion. The devices convert in parallel: a round takes
+// one conversion time plus the transaction, whatever the number of devices,
+// and scanning N inputs spread over D devices takes N / D rounds.
+//
+// Samples are scaled to whole millivolts (±4.096 V range, negative inputs
+// read 0), so the filters and the calibration tables work as they do for
+// the on-chip ADC; ads1x15Millivolts() is the matching calibration curve.
+// A rate shift skips an input in the scan, the device gives that time to
+// its other inputs.
+class Ads1x15Source : public AdcBlockSource
+{
+public:
+    static const uint8_t BLOCKS_PER_CHANNEL = 4; // Finished blocks buffered per channel, power of two
+
+    // addresses of the devices, 0x48 to 0x4B
+    Ads1x15Source(I2cBus &bus, const uint8_t *addresses, uint8_t device_count, Ads1x15Model model);
+
+    // Pins are chain inputs (ADS1X15_INPUT). The data rate is the slowest that gives every input sample_rate_hz,
+    // or the fastest the bus keeps up with
+    bool begin(const uint8_t *pins, uint8_t channel_count, uint32_t sample_rate_hz) override;
+    bool readBlock(uint8_t channel, AdcBlock &block) override;
+    bool setRateShift(uint8_t channel, uint8_t shift) override;
+    uint32_t overflows() const override { return overflow_count; }
+    void pause() override;
+    void resume() override;
+
+    // ALERT/RDY of a device fell, called from its pin interrupt. True once every device of the round is ready.
+    // Forced inline so it lands in the IRAM of the interrupt handler, with a word sized atomic that the ESP32
+    // does in place instead of calling a library routine in flash
+    __attribute__((always_inline)) bool ready(uint8_t device)
+    {
+        // A device that signals twice was not serviced within one conversion, its newer result replaces the older.
+        // The last conversions before a pause still signal, they must not start the chain again
+        if (!running)
+            return false;
+        uint32_t bit = 1U << device;
+        uint32_t before = ready_mask.fetch_or(bit);
+        if (before & bit)
+            counters.missed++;
+        return ((before | bit) & active_mask) == active_mask;
+    }
+
+    // Take the round: read every result and start the next conversions in one transaction, from the sampling task
+    bool service(uint32_t now_us);
+
+    // Conversions per second of each device
+    uint16_t dataRate() const { return data_rate; }
+
+    // Devices with at least one input in use
+    uint8_t activeMask() const { return active_mask; }
+
+    uint32_t missedTicks() const { return counters.missed; }
+    const Ads1x15Stats &stats() const { return counters; }
+
+private:
+    // Config register of a device converting an input
+    uint16_t config(uint8_t input, bool continuous) const;
+
+    // The next input a device converts, skipping the ones a rate shift holds back
+    uint8_t nextChannel(uint8_t device);
+
+    // Write the config of every device, starting or stopping the conversions
+    bool start(bool continuous);
+
+    // Scale a conversion result to millivolts
+    uint16_t millivolts(int16_t raw) const;
+
+    I2cBus &bus;
+    uint8_t addresses[ADS1X15_MAX_DEVICES];
+    uint8_t device_count;
+    Ads1x15Model model;
+    uint8_t rate_code;                                  // DR bits of the config register
+    uint16_t data_rate;
+
+    uint8_t channel_count;
+    uint8_t inputs[ADS1X15_MAX_CHANNELS];              // Device input of every channel
+    uint8_t scan[ADS1X15_MAX_DEVICES][ADS1X15_INPUTS];  // Channels of every device in scan order
+    uint8_t scan_count[ADS1X15_MAX_DEVICES];
+    uint8_t scan_position[ADS1X15_MAX_DEVICES];
+    uint16_t scan_pass[ADS1X15_MAX_DEVICES];            // Complete scans of the device so far
+    uint8_t converting[ADS1X15_MAX_DEVICES];            // Channel of the running conversion
+    uint8_t active_mask;
+
+    std::atomic<uint32_t> ready_mask;                   // Devices that signalled since the last round
+    volatile bool running;                              // Converting, off between pause() and resume()
+    AdcBlock filling[ADS1X15_MAX_CHANNELS];
+    volatile uint8_t requested_shift[ADS1X15_MAX_CHANNELS];
+    SpscRing<AdcBlock, BLOCKS_PER_CHANNEL> finished[ADS1X15_MAX_CHANNELS];
+    volatile uint32_t overflow_count;
+    Ads1x15Stats counters;
+};
+
+// Calibration curve for the chain's samples, they are millivolts already
+uint32_t ads1x15Millivolts(uint16_t raw, const void *context);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Little-endian helpers for the serialised formats (telemetry frames, flash
+// log), the layout does not depend on the struct padding of either side.
+// The put functions return the position after the written value.
+
+inline uint8_t *put16(uint8_t *p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    return p + 2;
+}
+
+inline uint8_t *put32(uint8_t *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+    return p + 4;
+}
+
+inline uint8_t *putFloat(uint8_t *p, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return put32(p, bits);
+}
+
+inline uint16_t get16(const uint8_t *p) { return p[0] | (uint16_t)p[1] << 8; }
+
+inline uint32_t get32(const uint8_t *p) { return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24; }
+
+inline float getFloat(const uint8_t *p)
+{
+    uint32_t bits = get32(p);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "SensorMath.h"
+
+// Per-probe pH and TDS calibration.
+//
+// Buffer points are captured over the console and fitted in float, once:
+// - pH: 1 point moves the built-in line, 2 points give a new line, 3 points
+//   give two lines that meet at the middle buffer, so a probe that is less
+//   steep on the alkaline side is still right at both ends
+// - TDS: 1 to 3 standards give a piecewise-linear correction of the ppm the
+//   probe's cubic reports, through 0 and extended with the last segment
+// The fitted coefficients are what is stored, as a versioned blob with a
+// CRC. At boot they are loaded once into a CalibrationCurves: pH keeps its
+// two lines in SensorNum, TDS becomes a table of the cubic and the correction
+// combined over the compensated voltage. pH stays one compare and one
+// multiply-add, TDS becomes a table lookup and two multiplies instead of four.
+
+#define CALIBRATION_MAX_POINTS 3      // Buffer or standard solutions per fit
+#define CALIBRATION_VERSION 1         // Layout of the stored blob
+#define CALIBRATION_BLOB_SIZE 54      // Bytes of the stored blob
+
+// TDS table over the compensated voltage, 1/32 V per segment up to 4 V. A cold reservoir compensates
+// the 3.3 V ADC maximum above 3.3 V, readings beyond the table extend the last segment
+#define CALIBRATION_TDS_SEGMENTS 128
+#define CALIBRATION_TDS_SEGMENTS_PER_VOLT 32
+
+// One captured point: what the probe gave and what the solution is
+struct CalibrationPoint
+{
+    float measured; // pH: probe volts, TDS: uncorrected ppm from the cubic
+    float actual;   // pH of the buffer, ppm of the standard
+};
+
+// Everything a calibration stores, in float
+struct CalibrationCoefficients
+{
+    uint8_t ph_points;                            // Points of the pH fit, 0 for the built-in line
+    float ph_break_volts;                         // Below it the first line applies, from it the second
+    float ph_slope[2];                            // pH per volt of each line
+    float ph_offset[2];                           // pH at 0 V of each line
+    uint8_t tds_points;                           // Standards of the TDS fit, 0 for the cubic alone
+    float tds_measured[CALIBRATION_MAX_POINTS];   // Uncorrected ppm, ascending
+    float tds_actual[CALIBRATION_MAX_POINTS];     // True ppm at each of them
+};
+
+enum CalibrationFit : uint8_t
+{
+    CALIBRATION_FIT_OK,
+    CALIBRATION_FIT_NO_POINTS,  // Nothing captured, or more points than a fit takes
+    CALIBRATION_FIT_TOO_CLOSE,  // Two points at (almost) the same reading
+    CALIBRATION_FIT_OUT_OF_RANGE // Slope or gain no working probe has, e.g. a buffer captured in the wrong solution
+};
+
+enum CalibrationLoad : uint8_t
+{
+    CALIBRATION_LOADED,
+    CALIBRATION_EMPTY,          // Nothing stored
+    CALIBRATION_CORRUPT,        // Wrong size, magic or CRC
+    CALIBRATION_UNKNOWN_VERSION // Stored by another firmware
+};
+
+// The built-in line and cubic, what a board without calibration uses
+void calibrationDefaults(CalibrationCoefficients &coefficients);
+
+// Fit the pH or the TDS part from the captured points, the other part is left as it is. Nothing changes on failure
+CalibrationFit calibrationFitPh(const CalibrationPoint *points, uint8_t count, CalibrationCoefficients &coefficients);
+CalibrationFit calibrationFitTds(const CalibrationPoint *points, uint8_t count, CalibrationCoefficients &coefficients);
+
+// Reference conversions in float, straight from the coefficients
+float calibrationPh(const CalibrationCoefficients &coefficients, float volts);
+float calibrationTdsCorrect(const CalibrationCoefficients &coefficients, float ppm);
+
+// Serialise into CALIBRATION_BLOB_SIZE bytes, returns the size written
+size_t calibrationEncode(const CalibrationCoefficients &coefficients, uint8_t *blob);
+
+// Read a stored blob, anything but CALIBRATION_LOADED leaves the defaults in coefficients
+CalibrationLoad calibrationDecode(const uint8_t *blob, size_t length, CalibrationCoefficients &coefficients);
+
+const char *calibrationFitName(CalibrationFit fit);
+const char *calibrationLoadName(CalibrationLoad load);
+
+// Where the blob lives: NVS on the board, memory on the host
+class CalibrationStore
+{
+public:
+    virtual ~CalibrationStore() {}
+
+    // Size of the stored blob, 0 if there is none. It is copied into data only if it fits
+    virtual size_t read(uint8_t *data, size_t capacity) = 0;
+
+    // Replace the stored blob
+    virtual bool write(const uint8_t *data, size_t length) = 0;
+
+    // Remove the blob
+    virtual bool erase() = 0;
+};
+
+// Load and decode in one go, the defaults on any failure
+CalibrationLoad calibrationLoad(CalibrationStore &store, CalibrationCoefficients &coefficients);
+bool calibrationSave(CalibrationStore &store, const CalibrationCoefficients &coefficients);
+
+// The coefficients precomputed for the acquisition task
+class CalibrationCurves
+{
+public:
+    CalibrationCurves();
+
+    // Precompute everything, runs once at boot and after a new calibration
+    void build(const CalibrationCoefficients &coefficients);
+
+    // pH from the probe voltage
+    SensorNum ph(SensorNum volts) const
+    {
+        uint8_t line = volts < ph_break ? 0 : 1;
+        return ph_slope[line] * volts + ph_offset[line];
+    }
+
+    // Corrected TDS in ppm from the compensated voltage
+    SensorNum tdsPpm(SensorNum volts) const
+    {
+        SensorNum position = volts * SensorNum(CALIBRATION_TDS_SEGMENTS_PER_VOLT);
+        int32_t segment = SensorNumTraits<SensorNum>::floor(position);
+        if (segment < 0)
+            segment = 0;
+        else if (segment >= CALIBRATION_TDS_SEGMENTS)
+            segment = CALIBRATION_TDS_SEGMENTS - 1;
+        return tds_base[segment] + tds_step[segment] * (position - SensorNumTraits<SensorNum>::fromInt(segment));
+    }
+
+private:
+    SensorNum ph_break;
+    SensorNum ph_slope[2];
+    SensorNum ph_offset[2];
+    SensorNum tds_base[CALIBRATION_TDS_SEGMENTS];   // ppm at the start of each segment
+    SensorNum tds_step[CALIBRATION_TDS_SEGMENTS];   // ppm across each segment
+};
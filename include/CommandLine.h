@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+// Line based command console.
+//
+// Characters are fed in one at a time (from Serial on the board), and when a
+// line is complete its first word is looked up in a fixed command table and
+// the handler gets the rest of the line. The line buffer is static, so the
+// console never allocates, and overlong lines are discarded whole.
+
+// Handler of one command, args points at the text after the command word (may be empty)
+typedef void (*CommandHandler)(const char *args);
+
+struct Command
+{
+    const char *name;       // First word of the line
+    CommandHandler handler; // Called with the rest of the line
+    const char *help;       // One line of help
+};
+
+class CommandLine
+{
+public:
+    static const uint8_t LINE_SIZE = 64; // Longest accepted line including the terminator
+
+    CommandLine(const Command *commands, uint8_t command_count);
+
+    // Feed one received character, returns true if it completed a line that was dispatched
+    bool feed(char c);
+
+    // Look a whole line up and run it, returns false if no command matched
+    bool execute(char *line);
+
+    // Access to the table, e.g. for a help command
+    uint8_t commandCount() const { return command_count; }
+    const Command &command(uint8_t index) const { return commands[index]; }
+
+private:
+    const Command *commands;  // Command table
+    uint8_t command_count;    // Entries in the table
+    char line[LINE_SIZE];     // Line being received
+    uint8_t length;           // Characters in line
+    bool overflowed;          // The current line was too long and is being skipped
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+// Timing of a fixed-rate control loop.
+//
+// Every tick records how late it started against its ideal time on the
+// period grid, how long the step ran and how many ticks were missed while
+// the previous step was still running. Besides min / mean / max the lateness
+// goes into a histogram with power-of-two bucket edges, so percentiles can be
+// read off without keeping the samples.
+
+#define CONTROL_JITTER_BUCKETS 16 // Bucket i holds lateness below 2^i us, the last one everything above
+
+struct ControlTimingStats
+{
+    uint32_t ticks;            // Steps run
+    uint32_t missed;           // Ticks skipped because a step overran
+    uint32_t lateness_min_us;  // Earliest start after the ideal tick time
+    uint32_t lateness_max_us;  // Latest start
+    uint64_t lateness_sum_us;  // Divide by ticks for the mean
+    uint32_t run_max_us;       // Longest step
+    uint32_t histogram[CONTROL_JITTER_BUCKETS];
+};
+
+class ControlTiming
+{
+public:
+    ControlTiming() { reset(); }
+
+    // One tick started lateness_us after its ideal time, ran for run_us and followed missed skipped ticks
+    void record(uint32_t lateness_us, uint32_t run_us, uint32_t missed);
+
+    // Lateness that the given percentage of ticks stayed below, as the upper edge of its bucket
+    uint32_t percentile(uint8_t percent) const;
+
+    const ControlTimingStats &stats() const { return totals; }
+    void reset();
+
+private:
+    ControlTimingStats totals;
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <DallasTemperature.h>
+#include "TemperatureBus.h"
+
+// TemperatureBus on top of the DallasTemperature library, used on the board
+class DallasTemperatureBus : public TemperatureBus
+{
+public:
+    explicit DallasTemperatureBus(DallasTemperature &sensors) : sensors(sensors) {}
+
+    uint8_t scan() override;
+    bool address(uint8_t index, ProbeAddress address) override;
+    bool setResolution(const ProbeAddress address, uint8_t bits) override;
+    bool startConversion(const ProbeAddress address) override;
+    float readCelsius(const ProbeAddress address) override;
+
+private:
+    DallasTemperature &sensors; // Library instance bound to the OneWire pin
+};
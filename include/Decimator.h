@@ -0,0 +1,257 @@
+#pragma once
+
+#include <stdint.h>
+
+// Oversampling and decimation for extra ADC resolution.
+//
+// Averaging N samples of a noisy converter shrinks the noise by sqrt(N), so
+// sampling a slow signal far faster than it is reported and filtering the
+// excess rate away buys effective bits. The chain here is a cascaded
+// integrator-comb (CIC) decimator that does the heavy lifting with a few
+// additions per input sample, then a short symmetric FIR that cuts the band
+// the CIC lets alias back and drops the rate the rest of the way. The result
+// keeps DECIMATOR_FRACTION_BITS below the ADC count.
+//
+// Everything is integer and sized by template arguments. The loops that run
+// per input sample keep their state in locals and are unrolled by hand, the
+// ESP32 builds with -Os and its Xtensa core has no SIMD, so what it gets is
+// what is written here: the CIC integrators stay in registers for a whole
+// block, the FIR folds its symmetric taps and does four of them per pass.
+
+#define DECIMATOR_FRACTION_BITS 8 // Bits below the ADC count the output keeps
+
+// Integer log2 of a power of two, for the template checks
+constexpr uint8_t decimatorLog2(uint32_t value) { return value <= 1 ? 0 : 1 + decimatorLog2(value >> 1); }
+
+// Stages integrators at the input rate, Stages combs at the output rate. The
+// gain is Ratio^Stages, wrapping 32-bit arithmetic is exact as long as the
+// output fits, which the check below holds it to for 12-bit input.
+template <uint8_t Stages, uint16_t Ratio>
+class CicDecimator
+{
+    static_assert(Stages >= 1 && Stages <= 4, "CicDecimator has one to four stages");
+    static_assert(Ratio >= 2 && (Ratio & (Ratio - 1)) == 0, "CicDecimator needs a power of two ratio");
+
+public:
+    static const uint8_t GAIN_BITS = Stages * decimatorLog2(Ratio); // Output is the input << GAIN_BITS
+    static_assert(GAIN_BITS + 12 <= 31, "CicDecimator output would overflow for 12-bit input");
+
+    CicDecimator() { reset(); }
+
+    void reset()
+    {
+        for (uint8_t i = 0; i < 4; i++)
+            integrator[i] = comb[i] = 0;
+        phase = 0;
+    }
+
+    // Feed count samples, writes one output per Ratio of them into out and returns how many it wrote
+    uint16_t push(const uint16_t *samples, uint16_t count, int32_t *out)
+    {
+        uint32_t i0 = integrator[0], i1 = integrator[1], i2 = integrator[2], i3 = integrator[3];
+        uint16_t written = 0;
+        uint16_t position = 0;
+        while (position < count)
+        {
+            // Run the integrators up to the next output or the end of the block, two samples a pass
+            uint16_t run = Ratio - phase;
+            if (run > count - position)
+                run = count - position;
+            const uint16_t *in = samples + position;
+            uint16_t n = 0;
+            for (; n + 2 <= run; n += 2)
+            {
+                i0 += in[n];
+                if (Stages > 1) i1 += i0;
+                if (Stages > 2) i2 += i1;
+                if (Stages > 3) i3 += i2;
+                i0 += in[n + 1];
+                if (Stages > 1) i1 += i0;
+                if (Stages > 2) i2 += i1;
+                if (Stages > 3) i3 += i2;
+            }
+            if (n < run)
+            {
+                i0 += in[n];
+                if (Stages > 1) i1 += i0;
+                if (Stages > 2) i2 += i1;
+                if (Stages > 3) i3 += i2;
+            }
+            position += run;
+            phase += run;
+            if (phase < Ratio)
+                break;
+
+            // Combs at the output rate
+            phase = 0;
+            uint32_t value = Stages == 1 ? i0 : Stages == 2 ? i1 : Stages == 3 ? i2 : i3;
+            for (uint8_t s = 0; s < Stages; s++)
+            {
+                uint32_t delayed = comb[s];
+                comb[s] = value;
+                value -= delayed;
+            }
+            out[written++] = (int32_t)value;
+        }
+        integrator[0] = i0;
+        integrator[1] = i1;
+        integrator[2] = i2;
+        integrator[3] = i3;
+        return written;
+    }
+
+private:
+    uint32_t integrator[4]; // Running sums, wrapping
+    uint32_t comb[4];       // Previous input of every comb
+    uint16_t phase;         // Inputs since the last output
+};
+
+// Lowpass taps for a FirDecimator: windowed sinc at cutoff cycles per input sample, Q15 and summing to exactly
+// 32768 so a constant goes through unchanged. Taps must be even, the result is symmetric
+void decimatorLowpass(int16_t *coefficients, uint8_t taps, float cutoff);
+
+// Symmetric FIR that keeps one output of every Ratio inputs. The window is
+// stored twice over so the taps always read it as one straight run, and only
+// the outputs that are kept get computed.
+template <uint8_t Taps, uint8_t Ratio>
+class FirDecimator
+{
+    static_assert(Taps % 8 == 0, "FirDecimator folds its taps in half and does four per pass");
+
+public:
+    FirDecimator()
+    {
+        for (uint8_t i = 0; i < Taps / 2; i++)
+            half[i] = 0;
+        reset();
+    }
+
+    // Taps from decimatorLowpass(), only the first half is read
+    void setCoefficients(const int16_t *coefficients)
+    {
+        for (uint8_t i = 0; i < Taps / 2; i++)
+            half[i] = coefficients[i];
+    }
+
+    void reset()
+    {
+        for (uint8_t i = 0; i < 2 * Taps; i++)
+            history[i] = 0;
+        head = 0;
+        phase = 0;
+    }
+
+    // Feed one sample, true when it completed an output
+    bool push(int32_t sample, int64_t &out)
+    {
+        history[head] = history[head + Taps] = sample;
+        head = head + 1 == Taps ? 0 : head + 1;
+        if (++phase < Ratio)
+            return false;
+        phase = 0;
+
+        // history[head] is the oldest sample, the newest sits Taps - 1 further on
+        const int32_t *x = &history[head];
+        const int32_t *y = &history[head + Taps - 1];
+        int64_t sum = 0;
+        for (uint8_t i = 0; i < Taps / 2; i += 4)
+        {
+            sum += (int64_t)half[i] * (x[i] + y[-i]);
+            sum += (int64_t)half[i + 1] * (x[i + 1] + y[-i - 1]);
+            sum += (int64_t)half[i + 2] * (x[i + 2] + y[-i - 2]);
+            sum += (int64_t)half[i + 3] * (x[i + 3] + y[-i - 3]);
+        }
+        out = sum;
+        return true;
+    }
+
+private:
+    int32_t history[2 * Taps]; // Last Taps inputs, twice
+    int16_t half[Taps / 2];    // First half of the symmetric taps, Q15
+    uint8_t head;              // Where the next input goes
+    uint8_t phase;             // Inputs since the last output
+};
+
+// The whole chain for raw ADC counts: CIC by CicRatio, then FIR by FirRatio. The FIR cuts at the output's
+// Nyquist frequency, so a tone above it does not fold back into the band
+template <uint8_t Stages, uint16_t CicRatio, uint8_t Taps, uint8_t FirRatio>
+class Decimator
+{
+public:
+    typedef CicDecimator<Stages, CicRatio> Cic;
+    static const uint8_t STAGES = Stages;
+    static const uint16_t CIC_RATIO = CicRatio;
+    static const uint8_t TAPS = Taps;
+    static const uint8_t FIR_RATIO = FirRatio;
+    static const uint32_t RATIO = (uint32_t)CicRatio * FirRatio; // Input samples per output
+    static const uint8_t FRACTION_BITS = DECIMATOR_FRACTION_BITS;
+    static const uint8_t GAIN_BITS = CicDecimator<Stages, CicRatio>::GAIN_BITS;
+    static_assert(GAIN_BITS >= FRACTION_BITS, "The CIC has to gain at least the fraction bits");
+    static_assert(GAIN_BITS + 12 + 1 <= 31, "The FIR adds two CIC outputs before it multiplies");
+
+    Decimator() : latest(0), outputs(0), cic_outputs(0)
+    {
+        int16_t taps[Taps];
+        decimatorLowpass(taps, Taps, 0.5f / FirRatio);
+        fir.setCoefficients(taps);
+    }
+
+    void reset()
+    {
+        cic.reset();
+        fir.reset();
+        latest = 0;
+        outputs = 0;
+        cic_outputs = 0;
+    }
+
+    // Feed a block of raw counts, true when at least one new output came out of it
+    bool pushBlock(const uint16_t *samples, uint16_t count)
+    {
+        bool fresh = false;
+        while (count > 0)
+        {
+            // A chunk of at most MAX_CHUNK CIC outputs at a time, the buffer stays on the stack
+            uint16_t chunk = count > CicRatio * MAX_CHUNK ? CicRatio * MAX_CHUNK : count;
+            int32_t cic_out[MAX_CHUNK];
+            uint16_t produced = cic.push(samples, chunk, cic_out);
+            samples += chunk;
+            count -= chunk;
+            if (cic_outputs < SETTLED)
+                cic_outputs += produced;
+            for (uint16_t i = 0; i < produced; i++)
+            {
+                int64_t sum;
+                if (!fir.push(cic_out[i], sum))
+                    continue;
+                // CIC gain and the Q15 taps out, the fraction bits stay, rounded to nearest
+                const uint8_t shift = GAIN_BITS - FRACTION_BITS + 15;
+                int64_t value = (sum + ((int64_t)1 << (shift - 1))) >> shift;
+                latest = value < 0 ? 0 : (uint32_t)value;
+                if (outputs < UINT32_MAX)
+                    outputs++;
+                fresh = true;
+            }
+        }
+        return fresh;
+    }
+
+    // Latest output, raw counts << FRACTION_BITS
+    uint32_t value() const { return latest; }
+
+    // Outputs since the last reset
+    uint32_t count() const { return outputs; }
+
+    // The FIR window holds no CIC output from before the CIC had a whole impulse response of real samples
+    bool settled() const { return cic_outputs >= SETTLED; }
+
+private:
+    static const uint16_t MAX_CHUNK = 8;
+    static const uint32_t SETTLED = Taps + Stages - 1; // CIC outputs until the FIR window is clean
+
+    Cic cic;
+    FirDecimator<Taps, FirRatio> fir;
+    uint32_t latest;  // Latest output
+    uint32_t outputs; // Outputs since reset
+    uint32_t cic_outputs; // CIC outputs since reset, counted up to SETTLED
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdint.h>
+
+// Closed-loop dosing of one peristaltic pump.
+//
+// A reservoir reacts to a dose only after it has mixed in, so the loop does
+// not run continuously: it evaluates once per period, doses, and then holds
+// for the mixing delay before it trusts the sensor again. The PID works in
+// millilitres: the error is turned into the dose that would close it using
+// the response of the reservoir per mL, so the gains carry over between
+// reservoirs of different size. The pump can only add, pH down acid or
+// nutrient concentrate; overshoot is never corrected by the other side.
+//
+// - Integral: only while the output is not saturated in the direction the
+//   error pushes (conditional integration), and never during the mixing hold
+// - Derivative: on the measurement, so setpoint changes do not kick
+// - Feed-forward: the drift seen between evaluations with the doses taken
+//   out (plant uptake, evaporation), dosed ahead instead of waiting for it to
+//   show up as error
+// - Rate limit: a token bucket of mL per hour on top of the largest dose
+//
+// Portable, the caller drives tick() from a fixed-rate loop and switches the
+// pump from its return value. Nothing is locked: a caller that measures from
+// another task than the one that ticks must keep the two apart.
+
+struct DosingConfig
+{
+    float setpoint;          // Target of the measured value
+    float deadband;          // No dosing while the error is inside +- this
+    float kp;                // Proportional gain, 1 doses the whole error at once
+    float ki;                // Integral gain per second
+    float kd;                // Derivative gain in seconds
+    float kff;               // Share of the observed drift fed forward, 0 turns it off
+    float response_per_ml;   // Change of the measured value per mL once mixed, negative for acid
+    float max_dose_ml;       // Largest single dose
+    float max_ml_per_hour;   // Rate limit over all doses
+    float pump_ml_per_s;     // Pump flow
+    uint32_t period_ms;      // Time between two evaluations
+    uint32_t mixing_ms;      // Hold after a dose before the reading counts again
+    uint32_t max_age_ms;     // A measurement older than this is stale, nothing is dosed
+    bool anti_windup;        // Conditional integration, off only to compare
+};
+
+struct DosingStats
+{
+    uint32_t evaluations;    // PID runs
+    uint32_t doses;          // Doses given
+    uint32_t held;           // Evaluations skipped while a dose mixed in
+    uint32_t stale;          // Evaluations skipped for lack of a fresh measurement
+    uint32_t saturated;      // Doses cut to max_dose_ml
+    uint32_t rate_limited;   // Doses cut by the rate limit
+    float dosed_ml;          // Total volume pumped
+};
+
+class DosingController
+{
+public:
+    explicit DosingController(const DosingConfig &config);
+
+    // Latest measurement and when it was taken
+    void measure(float value, uint32_t now_ms);
+
+    // Advance to now, call at a fixed rate well below the period. Returns whether the pump must run
+    bool tick(uint32_t now_ms);
+
+    // Switch dosing on or off, off stops the pump and clears the loop state
+    void enable(bool on);
+    bool enabled() const { return active; }
+
+    // Stop a running dose, e.g. before the chip sleeps
+    void stop() { pumping = false; }
+
+    void setSetpoint(float setpoint) { settings.setpoint = setpoint; }
+    const DosingConfig &config() const { return settings; }
+
+    // Loop terms of the last evaluation, in mL
+    float integral() const { return integral_ml; }
+    float drift() const { return drift_per_s; }
+    float lastDose() const { return last_dose_ml; }
+
+    const DosingStats &stats() const { return totals; }
+    void resetStats() { totals = DosingStats(); }
+
+private:
+    // One PID evaluation, returns the dose in mL
+    float evaluate(uint32_t now_ms);
+
+    DosingConfig settings;
+    bool active;
+    bool pumping;             // A dose is running until pump_until_ms
+    uint32_t pump_until_ms;
+    bool scheduled;           // next_ms is set, the first tick after enabling sets it
+    uint32_t next_ms;         // Next evaluation
+    bool holding;             // A dose is mixing in until hold_until_ms
+    uint32_t hold_until_ms;
+    bool have_measurement;
+    float measured;
+    uint32_t measured_ms;
+    bool have_previous;       // previous_* hold the last evaluation
+    float previous_value;
+    uint32_t previous_ms;
+    float integral_ml;
+    float drift_per_s;        // Filtered change per second not explained by the doses
+    float last_dose_ml;
+    float pending_effect;     // Expected change of the doses since the last evaluation
+    float budget_ml;          // Rate limit tokens
+    uint32_t budget_ms;       // Last refill of the tokens
+    DosingStats totals;
+};
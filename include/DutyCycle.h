@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include "Reading.h"
+
+// Acquisition windows for the power-managed modes.
+//
+// Instead of running forever the chip wakes once per period, stays awake
+// until TDS, pH and the compensation probe have each produced a reading (or
+// the window times out), and sleeps for the rest of the period. The policy is
+// portable; putting the chip to sleep is left to the caller. For every wake
+// it records how long each channel took to deliver its first reading.
+
+// How the chip spends the time between acquisition windows
+enum PowerMode : uint8_t
+{
+    POWER_ALWAYS_ON,   // Sample continuously, the original behaviour
+    POWER_LIGHT_SLEEP, // Light sleep between windows, RAM and the tasks are kept
+    POWER_DEEP_SLEEP,  // Deep sleep between windows, the state survives in RTC memory
+};
+
+// Channels a window waits for, indexed by ReadingChannel
+#define DUTY_CHANNELS (READING_TEMPERATURE + 1)
+
+// Wake to first reading latency of one channel
+struct WakeLatency
+{
+    uint32_t count;   // Wakes that produced a reading
+    uint32_t last_us; // Latency of the latest wake
+    uint32_t min_us;  // Fastest wake
+    uint32_t max_us;  // Slowest wake
+    uint64_t sum_us;  // Sum of all latencies, divide by count for the mean
+};
+
+// Totals over all windows, kept in RTC memory through deep sleep
+struct DutyCycleStats
+{
+    uint32_t windows;                     // Windows closed
+    uint32_t timeouts;                    // Windows closed before every channel had a reading
+    uint64_t awake_us;                    // Time spent in windows
+    uint64_t asleep_us;                   // Time requested for sleeping
+    WakeLatency latency[DUTY_CHANNELS];   // Per channel wake latency
+};
+
+class DutyCycle
+{
+public:
+    DutyCycle(uint32_t period_ms, uint32_t window_ms);
+
+    // A window starts, now_us is the moment the chip woke
+    void wake(uint32_t now_us);
+
+    // A reading arrived, the first one of each channel after a wake sets its latency
+    void reading(ReadingChannel channel, uint8_t index, uint32_t now_us);
+
+    // Every channel delivered, or the window ran out of time
+    bool windowDone(uint32_t now_us) const;
+
+    // Close the window and return how long to sleep so the next window starts one period after this one
+    uint32_t sleepUs(uint32_t now_us);
+
+    const DutyCycleStats &stats() const { return totals; }
+    void restoreStats(const DutyCycleStats &stats) { totals = stats; }
+    void resetStats();
+
+private:
+    uint32_t period_us;   // Time between the starts of two windows
+    uint32_t window_us;   // Longest window
+    uint32_t wake_us;     // Start of the current window
+    uint8_t seen;         // Bit per channel that delivered in this window
+    DutyCycleStats totals;
+};
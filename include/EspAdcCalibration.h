@@ -0,0 +1,15 @@
+#pragma once
+
+#include <esp_adc_cal.h>
+#include "AdcCalibration.h"
+
+// Nominal ADC reference used when the chip has no calibration burned into eFuse
+#define ADC_DEFAULT_VREF_MV 1100
+
+// Build the lookup table of one ADC unit from the chip's eFuse characterisation
+// (two point values or the measured Vref, falling back to the default Vref) for
+// 11 dB attenuation and 12-bit width. Returns which characterisation was used.
+esp_adc_cal_value_t calibrateAdc(AdcCalibration &calibration, adc_unit_t unit);
+
+// Readable name of a characterisation source, for the boot log
+const char *adcCalibrationName(esp_adc_cal_value_t source);
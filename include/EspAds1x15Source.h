@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Arduino.h>
+#include "Ads1x15Source.h"
+
+// ADS1x15 chain on the board: the ALERT/RDY pin of every device on a GPIO
+// interrupt, and a high priority sampling task that takes a round once all
+// of them have fired. Between rounds the task sleeps on its notification,
+// the CPU does nothing for the converters.
+class EspAds1x15Source : public Ads1x15Source
+{
+public:
+    // alert_pins of the devices in address order, core the core the sampling task runs on
+    EspAds1x15Source(I2cBus &bus, const uint8_t *addresses, const uint8_t *alert_pins, uint8_t device_count, Ads1x15Model model,
+                     uint8_t core = 0);
+
+    bool begin(const uint8_t *pins, uint8_t channel_count, uint32_t sample_rate_hz) override;
+
+private:
+    // Context of one pin interrupt
+    struct Alert
+    {
+        EspAds1x15Source *source;
+        uint8_t device;
+    };
+
+    static void IRAM_ATTR onAlert(void *context); // ALERT/RDY fell, wakes the task once the round is complete
+    static void samplingTask(void *context);       // Services the rounds
+
+    uint8_t alert_pins[ADS1X15_MAX_DEVICES];
+    Alert alerts[ADS1X15_MAX_DEVICES];
+    uint8_t core;
+    TaskHandle_t task;
+};
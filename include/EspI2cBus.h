@@ -0,0 +1,30 @@
+#pragma once
+
+#include <Arduino.h>
+#include <driver/i2c.h>
+#include "I2cBus.h"
+
+// Longest batch the command list has room for, one ADS1x15 round of a full chain
+#define ESP_I2C_MAX_TRANSFERS 8
+
+// I2C master on one of the ESP32's controllers through the ESP-IDF driver.
+//
+// A batch becomes one command list: a start and the address for every write
+// and every read, a stop at the very end. The driver runs the list from the
+// controller's interrupt while the calling task blocks on it, so a round of
+// the whole chain costs one task switch instead of a busy wait per byte. The
+// list lives in a static buffer, nothing is allocated per transaction.
+class EspI2cBus : public I2cBus
+{
+public:
+    explicit EspI2cBus(i2c_port_t port = I2C_NUM_0);
+
+    // Install the driver on the pins, frequency_hz up to 400 kHz for the ADS1x15's fast mode
+    bool begin(uint8_t sda_pin, uint8_t scl_pin, uint32_t frequency_hz);
+
+    bool transfer(const I2cTransfer *transfers, uint8_t count) override;
+
+private:
+    i2c_port_t port;
+    uint8_t link[I2C_LINK_RECOMMENDED_SIZE(2 * ESP_I2C_MAX_TRANSFERS)]; // Command list storage
+};
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Streaming filters with compile-time window sizes.
+//
+// The old code copied the window and re-sorted it for every result (an
+// exchange sort for pH, a bubble sort inside the copy loop for TDS). These
+// filters keep the window sorted as samples arrive instead: each push removes
+// the oldest sample and inserts the new one with a binary search and a
+// memmove. The memmove is still O(N), it shifts up to N - 1 samples, but for
+// the window sizes used here (10 to 101 ints) that is one short block copy
+// and beats the O(log N) trees or skip lists that would need per-node
+// pointers and more than twice the RAM. Results are O(1): the median is read
+// straight off the sorted array and the trimmed mean comes from a running sum
+// that each push corrects at the trim boundaries. All storage is static,
+// nothing touches the heap.
+
+// Window of the last N samples kept both in arrival order and in sorted order,
+// with a running sum over all but the Trim smallest and Trim largest of them
+template <typename T, uint16_t N, uint16_t Trim = 0>
+class SortedWindow
+{
+    static_assert(N > 0, "SortedWindow needs at least one sample");
+    static_assert(2 * Trim < N, "Trimming would discard the whole window");
+
+public:
+    SortedWindow() { reset(); }
+
+    // Forget every sample
+    void reset()
+    {
+        count = 0;
+        oldest = 0;
+        kept_sum = 0;
+    }
+
+    // Add a sample, dropping the oldest one once the window is full
+    void push(T sample)
+    {
+        if (count == N)
+        {
+            // Take the oldest sample out of the sorted array, then overwrite it in the ring
+            T removed = ring[oldest];
+            uint16_t pos = find(removed);
+            memmove(&sorted[pos], &sorted[pos + 1], (count - pos - 1) * sizeof(T));
+            count--;
+            // Ranks behind pos moved down by one, so one sample crosses a trim boundary or the removed one was kept
+            if (count <= 2 * Trim)
+                kept_sum = 0;
+            else if (pos < Trim)
+                kept_sum -= sorted[Trim - 1];
+            else if (pos >= count + 1 - Trim)
+                kept_sum -= sorted[count - Trim];
+            else
+                kept_sum -= removed;
+            ring[oldest] = sample;
+            oldest = (oldest + 1) % N;
+        }
+        else
+        {
+            ring[(oldest + count) % N] = sample;
+        }
+
+        // Insert the new sample behind any equal ones
+        uint16_t pos = upperBound(sample);
+        memmove(&sorted[pos + 1], &sorted[pos], (count - pos) * sizeof(T));
+        sorted[pos] = sample;
+        count++;
+        // Ranks behind pos moved up by one, so either the sample is kept or one crosses into the kept range
+        if (count <= 2 * Trim)
+            kept_sum = 0;
+        else if (pos < Trim)
+            kept_sum += sorted[Trim];
+        else if (pos >= count - Trim)
+            kept_sum += sorted[count - Trim - 1];
+        else
+            kept_sum += sample;
+    }
+
+    // Add a whole block of samples, e.g. one AdcBlock from a continuous source
+    template <typename S>
+    void pushBlock(const S *samples, uint16_t length)
+    {
+        // Only the last N samples can survive, skip the ones that would be pushed straight out again
+        if (length > N)
+        {
+            samples += length - N;
+            length = N;
+        }
+        for (uint16_t i = 0; i < length; i++)
+            push(samples[i]);
+    }
+
+    // Copy the samples oldest first, e.g. to keep the window through a deep sleep; pushBlock() puts them back.
+    // Returns the number of samples
+    template <typename S>
+    uint16_t copyTo(S *samples) const
+    {
+        for (uint16_t i = 0; i < count; i++)
+            samples[i] = ring[(oldest + i) % N];
+        return count;
+    }
+
+    uint16_t size() const { return count; }
+    bool full() const { return count == N; }
+    static constexpr uint16_t capacity() { return N; }
+
+    // Sample with the given rank, 0 is the smallest
+    T rank(uint16_t index) const { return sorted[index]; }
+
+    // Sum of the samples left after dropping the Trim smallest and Trim largest ones, exact for integer types
+    int64_t trimmedSum() const { return kept_sum; }
+
+    // Number of samples in trimmedSum()
+    uint16_t keptCount() const { return count > 2 * Trim ? count - 2 * Trim : 0; }
+
+protected:
+    // Position of a sample that is known to be in the sorted array
+    uint16_t find(T sample) const
+    {
+        uint16_t low = 0, high = count;
+        while (low < high)
+        {
+            uint16_t mid = (low + high) / 2;
+            if (sorted[mid] < sample)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        return low;
+    }
+
+    // First position holding a value greater than the sample
+    uint16_t upperBound(T sample) const
+    {
+        uint16_t low = 0, high = count;
+        while (low < high)
+        {
+            uint16_t mid = (low + high) / 2;
+            if (sample < sorted[mid])
+                high = mid;
+            else
+                low = mid + 1;
+        }
+        return low;
+    }
+
+    T ring[N];       // Samples in arrival order
+    T sorted[N];     // The same samples in ascending order
+    uint16_t count;  // Number of samples in the window
+    uint16_t oldest; // Ring index of the oldest sample
+    int64_t kept_sum; // Sum of the ranks Trim to count - Trim - 1
+};
+
+// Rolling median over the last N samples, matches getMedianNum() for a full window
+template <typename T, uint16_t N>
+class RollingMedian : public SortedWindow<T, N>
+{
+public:
+    // Median of the samples in the window, the mean of the two middle ones for an even count
+    T value() const
+    {
+        uint16_t n = this->count;
+        if (n == 0)
+            return T();
+        if (n & 1)
+            return this->sorted[(n - 1) / 2];
+        return (this->sorted[n / 2] + this->sorted[n / 2 - 1]) / 2;
+    }
+};
+
+// Rolling mean of the last N samples after dropping the Trim smallest and Trim largest ones,
+// RollingTrimmedMean<int, 10, 2> is the old pH "sort and average the middle 6" filter
+template <typename T, uint16_t N, uint16_t Trim>
+class RollingTrimmedMean : public SortedWindow<T, N, Trim>
+{
+public:
+    // Trimmed mean as a float
+    float value() const
+    {
+        uint16_t kept = this->keptCount();
+        return kept > 0 ? (float)this->trimmedSum() / kept : 0.0f;
+    }
+};
+
+// Exponential moving average with a smoothing factor of 1 / 2^Shift.
+// Integer only: the state keeps 16 fraction bits so small steps are not lost.
+template <uint8_t Shift>
+class Ema
+{
+    static_assert(Shift < 16, "Ema shift must leave room for the fraction bits");
+
+public:
+    Ema() : state(0), primed(false) {}
+
+    // Forget the history, the next sample seeds the average
+    void reset() { primed = false; }
+
+    // Add a sample
+    void push(int32_t sample)
+    {
+        int64_t scaled = (int64_t)sample << 16;
+        if (!primed)
+        {
+            state = scaled;
+            primed = true;
+            return;
+        }
+        state += (scaled - state) >> Shift;
+    }
+
+    // Add a whole block of samples
+    template <typename S>
+    void pushBlock(const S *samples, uint16_t length)
+    {
+        for (uint16_t i = 0; i < length; i++)
+            push(samples[i]);
+    }
+
+    // Current average rounded to the nearest integer, and with the fraction bits kept
+    int32_t value() const { return (int32_t)((state + (1 << 15)) >> 16); }
+    float valueFloat() const { return (float)state / 65536.0f; }
+
+private:
+    int64_t state; // Average scaled by 2^16
+    bool primed;   // At least one sample has been seen
+};
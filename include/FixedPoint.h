@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+
+// Signed Q(31-Frac).Frac fixed-point number in an int32_t.
+//
+// The ESP32 has a single-precision FPU only, double math is emulated in
+// software. Multiplication widens to 64 bits and shifts back, division
+// pre-shifts the dividend, so everything stays in integer instructions.
+// The double constructor is meant for constants: it is constexpr, so a
+// coefficient written as Fixed<16>(133.42) is converted by the compiler.
+// Use fromFloat() for values that are only known at runtime.
+template <int Frac>
+class Fixed
+{
+    static_assert(Frac > 0 && Frac < 31, "Fixed needs at least one integer and one fraction bit");
+
+public:
+    static constexpr int FRAC_BITS = Frac;
+    static constexpr int32_t ONE = (int32_t)1 << Frac;
+
+    constexpr Fixed() : raw(0) {}
+    constexpr explicit Fixed(double value) : raw((int32_t)(value * ONE + (value >= 0 ? 0.5 : -0.5))) {}
+
+    // Conversions at runtime
+    static constexpr Fixed fromRaw(int32_t raw) { return Fixed(raw, RawTag()); }
+    static constexpr Fixed fromInt(int32_t value) { return Fixed(value * ONE, RawTag()); }
+    static constexpr Fixed fromRatio(int32_t numerator, int32_t denominator) { return Fixed((int32_t)roundedDivide((int64_t)numerator * ONE, denominator), RawTag()); }
+    static Fixed fromFloat(float value) { return Fixed((int32_t)(value * (float)ONE + (value >= 0 ? 0.5f : -0.5f)), RawTag()); }
+    float toFloat() const { return (float)raw / (float)ONE; }
+    int32_t toInt() const { return (raw + (ONE >> 1)) >> Frac; } // Rounded to nearest
+
+    // Arithmetic
+    constexpr Fixed operator+(Fixed other) const { return Fixed(raw + other.raw, RawTag()); }
+    constexpr Fixed operator-(Fixed other) const { return Fixed(raw - other.raw, RawTag()); }
+    constexpr Fixed operator-() const { return Fixed(-raw, RawTag()); }
+    constexpr Fixed operator*(Fixed other) const { return Fixed((int32_t)(((int64_t)raw * other.raw + (ONE >> 1)) >> Frac), RawTag()); }
+    constexpr Fixed operator/(Fixed other) const { return Fixed((int32_t)roundedDivide((int64_t)raw * ONE, other.raw), RawTag()); }
+    Fixed &operator+=(Fixed other) { raw += other.raw; return *this; }
+    Fixed &operator-=(Fixed other) { raw -= other.raw; return *this; }
+
+    // Comparison
+    constexpr bool operator<(Fixed other) const { return raw < other.raw; }
+    constexpr bool operator>(Fixed other) const { return raw > other.raw; }
+    constexpr bool operator==(Fixed other) const { return raw == other.raw; }
+    constexpr bool operator!=(Fixed other) const { return raw != other.raw; }
+
+    int32_t raw; // Value scaled by 2^Frac
+
+private:
+    struct RawTag
+    {
+    };
+    constexpr Fixed(int32_t raw, RawTag) : raw(raw) {}
+
+    // Integer division rounded to nearest instead of towards zero
+    static constexpr int64_t roundedDivide(int64_t numerator, int64_t denominator)
+    {
+        return ((numerator < 0) == (denominator < 0) ? numerator + denominator / 2 : numerator - denominator / 2) / denominator;
+    }
+};
+
+// Q16.16, enough range for ppm values into the tens of thousands with 1/65536 resolution
+typedef Fixed<16> Q16;
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+#include "FlashStore.h"
+#include "Telemetry.h"
+#include "SeriesCodec.h"
+
+// On-device history of the report records.
+//
+// Records are compressed into a RAM buffer as they come (SeriesCodec) and
+// written to flash a whole chunk at a time, so the flash sees one large
+// append per FLASH_LOG_CHUNK_BYTES of compressed records instead of a small
+// write per reading. Chunks are appended to
+// segments, one segment per FlashStore slot. A full segment rotates to the
+// next slot round-robin, which erases the oldest history and spreads the
+// erases evenly; every segment header carries the erase count of its slot.
+//
+// Segment: header (magic, version, generation, erase count, CRC), then chunks
+// Chunk:   header (magic, record count, payload length, first and last
+//          timestamp, payload CRC, header CRC), then one compressed block
+//
+// A power cut can only tear the last chunk of the newest segment. Mounting
+// walks every segment up to its first chunk that fails a CRC, so the torn
+// tail is never returned, and appending continues in a fresh segment.
+//
+// Timestamps are log time: milliseconds of uptime continued from the last
+// record found at boot, so they only ever increase across reboots. The board
+// has no RTC, this is the order we can trust. Log time wraps after 49 days,
+// the log spans hours, so times are compared by signed difference. The RAM index of the segments'
+// time ranges and the chunk headers let a range scan skip straight to the
+// records it wants.
+
+// Compressed records buffered in RAM and written as one chunk, override with -D build flags
+#ifndef FLASH_LOG_CHUNK_BYTES
+#define FLASH_LOG_CHUNK_BYTES 512
+#endif
+
+#define FLASH_LOG_VERSION 2    // 1 stored the records uncompressed, such segments are reused as unused ones
+#define FLASH_LOG_SEGMENT_HEADER_SIZE 16
+#define FLASH_LOG_CHUNK_HEADER_SIZE 18
+
+// Called for every record of a scan, return false to stop early
+typedef bool (*FlashLogVisitor)(const TelemetryRecord &record, void *context);
+
+class FlashLog
+{
+public:
+    static const uint8_t MAX_SEGMENTS = 16; // Segments are tracked in a fixed table
+
+    // Index entry of one segment, rebuilt from flash at mount
+    struct Segment
+    {
+        uint32_t generation;   // Increases with every rotation, 0 for an unused slot
+        uint32_t wear;         // Times the slot was erased
+        uint32_t end;          // Offset behind the last valid chunk
+        uint32_t records;      // Valid records in the segment
+        uint32_t first_ms;     // Timestamp of the first record
+        uint32_t last_ms;      // Timestamp of the last record
+    };
+
+    FlashLog(FlashStore &store, uint8_t segment_count, uint32_t segment_size);
+
+    // Mount: rebuild the index from flash and continue the log time. False if the geometry is unusable
+    bool begin(uint32_t uptime_ms);
+
+    // Log time of an uptime, the timestamps append() stores and scan() takes
+    uint32_t logTime(uint32_t uptime_ms) const { return time_base + uptime_ms; }
+
+    // Buffer a record stamped with the log time of uptime_ms, writes a chunk once the next record does not fit.
+    // False if that write failed, the buffered records are kept for the next attempt
+    bool append(const TelemetryRecord &record, uint32_t uptime_ms);
+
+    // Write whatever is buffered as one chunk
+    bool flush();
+
+    // Visit every record with from_ms <= timestamp <= to_ms in time order, flash first, then the buffer.
+    // Returns the number of records visited
+    uint32_t scan(uint32_t from_ms, uint32_t to_ms, FlashLogVisitor visitor, void *context);
+
+    // Statistics
+    uint8_t segmentCount() const { return segment_count; }
+    const Segment &segment(uint8_t slot) const { return segments[slot]; }
+    uint32_t storedRecords() const;          // Records on flash
+    uint16_t bufferedRecords() const { return encoder.count(); }
+    uint32_t bufferedBytes() const { return encoder.size(); }
+    uint32_t chunksWritten() const { return chunks_written; }
+    uint32_t bytesWritten() const { return bytes_written; }
+    uint32_t writeFailures() const { return write_failures; }
+    uint32_t droppedRecords() const { return dropped_records; }
+
+private:
+    void mountSegment(uint8_t slot);
+    bool readChunkHeader(uint8_t slot, uint32_t offset, uint16_t &count, uint16_t &length, uint32_t &first_ms,
+                         uint32_t &last_ms, uint16_t &payload_crc);
+
+    // Visit the records of one block in the range, false once the scan is done
+    bool scanBlock(const uint8_t *block, uint16_t length, uint16_t count, uint32_t from_ms, uint32_t to_ms,
+                   FlashLogVisitor visitor, void *context, uint32_t &visited);
+    bool rotate();
+
+    FlashStore &store;
+    uint8_t segment_count;                  // Slots in use
+    uint32_t segment_size;                  // Largest size of one segment in bytes
+    Segment segments[MAX_SEGMENTS];         // Index of every slot
+    int8_t active;                          // Slot the next chunk goes to, -1 before the first rotation
+    bool active_torn;                       // The active segment ends in a torn chunk, start a new one
+    uint32_t time_base;                     // Log time at uptime 0
+
+    SeriesEncoder encoder;                                           // Compresses into the chunk behind its header
+    uint8_t chunk[FLASH_LOG_CHUNK_HEADER_SIZE + FLASH_LOG_CHUNK_BYTES];  // Records not written yet
+    uint8_t scan_block[FLASH_LOG_CHUNK_BYTES];                        // Chunk payload being scanned
+
+    uint32_t chunks_written;   // Chunks appended since boot
+    uint32_t bytes_written;    // Bytes appended since boot, headers included
+    uint32_t write_failures;   // Chunks that could not be written
+    uint32_t dropped_records;  // Records lost because the buffer was full and could not be written
+};
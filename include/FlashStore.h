@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Append-only storage slots for the flash log.
+//
+// A slot is one file that only ever grows until it is erased as a whole, so
+// the store never rewrites data in place. On the board every slot is a file
+// on LittleFS, on the host a file-backed emulator stands in for the flash and
+// can cut the power in the middle of a write.
+class FlashStore
+{
+public:
+    virtual ~FlashStore() {}
+
+    // Bytes currently stored in a slot, 0 for an empty or missing slot
+    virtual uint32_t size(uint8_t slot) = 0;
+
+    // Read up to length bytes from offset, returns the number of bytes read
+    virtual size_t read(uint8_t slot, uint32_t offset, uint8_t *data, size_t length) = 0;
+
+    // Add bytes at the end of a slot, false if they were not all written
+    virtual bool append(uint8_t slot, const uint8_t *data, size_t length) = 0;
+
+    // Empty a slot
+    virtual bool erase(uint8_t slot) = 0;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+// Hardware abstraction layer.
+//
+// Portable code never calls the Arduino core directly. Time, delays and
+// single analog reads go through these functions, the OneWire bus through
+// TemperatureBus and continuous sampling through AdcBlockSource. On the
+// board src/esp32/ArduinoHal.cpp maps them onto the Arduino core, in the
+// native build src/native/NativeHal.cpp maps them onto the fake clock and
+// the simulated sensors, so the whole sensor pipeline runs on Linux.
+
+// Free running microsecond counter (wraps at 2^32), has the SchedulerClock signature. In IRAM on the board, interrupt
+// handlers may read it
+uint32_t halMicros();
+
+// Free running millisecond counter
+uint32_t halMillis();
+
+// Raw 12-bit reading of an analog pin
+uint16_t halAnalogRead(uint8_t pin);
+
+// Free running cycle counter for profiling (wraps at 2^32): the CPU cycle counter of the calling core on the
+// board, a nanosecond clock on the host. Unlike halMicros() it is real time on the host too
+uint32_t halCycles();
+
+// halCycles() counts per microsecond
+uint32_t halCyclesPerUs();
+
+// Wait for the given number of milliseconds, only for setup code, tasks must never block
+void halDelay(uint32_t ms);
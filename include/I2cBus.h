@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+// One part of an I2C transaction: write bytes to a device, then read bytes
+// back from it after a repeated start. Either length may be 0
+struct I2cTransfer
+{
+    uint8_t address;        // 7-bit device address
+    const uint8_t *write;
+    uint8_t write_length;
+    uint8_t *read;
+    uint8_t read_length;
+};
+
+// An I2C master that runs a whole batch of transfers as one transaction,
+// with repeated starts between them and a single stop at the end. On the
+// board the I2C driver queues the batch as one command list and the calling
+// task sleeps until the controller's interrupt says it is done, so the CPU
+// never spins on the bus. On the host a mock bus with ADS1x15 devices
+// stands in and accounts the bus time.
+class I2cBus
+{
+public:
+    virtual ~I2cBus() {}
+
+    // Run the transfers, false if any device did not acknowledge or the bus failed
+    virtual bool transfer(const I2cTransfer *transfers, uint8_t count) = 0;
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+
+// Kalman filter with a fixed number of states.
+//
+// The state and its covariance are plain arrays sized by the template
+// argument, nothing is allocated. Measurements come one scalar at a time: a
+// row of the measurement matrix, the innovation and its noise variance. For
+// a non-linear measurement the caller passes the Jacobian row and the
+// innovation against the non-linear prediction, which makes it an extended
+// Kalman filter. One scalar at a time needs no matrix inverse, the gain is a
+// division by the innovation variance, so an update is O(N^2) on the FPU.
+template <uint8_t N>
+class KalmanFilter
+{
+public:
+    typedef float Matrix[N][N];
+    typedef float Vector[N];
+
+    KalmanFilter() { reset(); }
+
+    // Zero state, no knowledge of it
+    void reset()
+    {
+        for (uint8_t i = 0; i < N; i++)
+        {
+            x[i] = 0;
+            for (uint8_t j = 0; j < N; j++)
+                P[i][j] = 0;
+        }
+    }
+
+    // x = F x, P = F P F' + Q
+    void predict(const Matrix &F, const Matrix &Q)
+    {
+        Vector fx;
+        Matrix fp;
+        for (uint8_t i = 0; i < N; i++)
+        {
+            fx[i] = 0;
+            for (uint8_t k = 0; k < N; k++)
+                fx[i] += F[i][k] * x[k];
+            for (uint8_t j = 0; j < N; j++)
+            {
+                fp[i][j] = 0;
+                for (uint8_t k = 0; k < N; k++)
+                    fp[i][j] += F[i][k] * P[k][j];
+            }
+        }
+        for (uint8_t i = 0; i < N; i++)
+        {
+            x[i] = fx[i];
+            for (uint8_t j = 0; j <= i; j++)
+            {
+                float sum = Q[i][j];
+                for (uint8_t k = 0; k < N; k++)
+                    sum += fp[i][k] * F[j][k];
+                P[i][j] = P[j][i] = sum;
+            }
+        }
+    }
+
+    // Variance of the innovation of a measurement with Jacobian row h and noise variance r
+    float innovationVariance(const Vector &h, float r) const
+    {
+        float s = r;
+        for (uint8_t i = 0; i < N; i++)
+            for (uint8_t j = 0; j < N; j++)
+                s += h[i] * P[i][j] * h[j];
+        return s;
+    }
+
+    // Fold in one scalar measurement, innovation is the measurement minus its prediction. False, and nothing
+    // changes, when innovation^2 is more than gate times its variance, e.g. a spike the filters let through
+    bool update(const Vector &h, float innovation, float r, float gate)
+    {
+        float s = innovationVariance(h, r);
+        if (s <= 0 || innovation * innovation > gate * s)
+            return false;
+
+        // K = P h' / s, x += K y, P -= K h P. P stays symmetric by writing both halves from the lower one
+        Vector ph;
+        for (uint8_t i = 0; i < N; i++)
+        {
+            ph[i] = 0;
+            for (uint8_t j = 0; j < N; j++)
+                ph[i] += P[i][j] * h[j];
+        }
+        for (uint8_t i = 0; i < N; i++)
+        {
+            x[i] += ph[i] / s * innovation;
+            for (uint8_t j = 0; j <= i; j++)
+                P[i][j] = P[j][i] = P[i][j] - ph[i] * ph[j] / s;
+        }
+        return true;
+    }
+
+    Vector x; // State
+    Matrix P; // Covariance of the state
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <LittleFS.h>
+#include "FlashStore.h"
+
+// FlashStore on LittleFS, every slot is one file in a directory.
+// LittleFS commits a file write on close, so an append either lands as a
+// whole or leaves the file as it was; the flash log copes with both.
+class LittleFsFlashStore : public FlashStore
+{
+public:
+    explicit LittleFsFlashStore(const char *directory = "/log") : directory(directory), reading_slot(-1) {}
+
+    // Mount the file system (formatting it on first use) and create the directory
+    bool begin();
+
+    uint32_t size(uint8_t slot) override;
+    size_t read(uint8_t slot, uint32_t offset, uint8_t *data, size_t length) override;
+    bool append(uint8_t slot, const uint8_t *data, size_t length) override;
+    bool erase(uint8_t slot) override;
+
+private:
+    void path(uint8_t slot, char *buffer, size_t size) const;
+    File &openForReading(uint8_t slot);
+    void closeReading();
+
+    const char *directory;
+    File reading;          // Kept open between reads, mounting the log reads every chunk header
+    int8_t reading_slot;   // Slot of the open file, -1 for none
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "NetworkTransport.h"
+#include "SeriesCodec.h"
+#include "Telemetry.h"
+
+// Batched MQTT telemetry with an offline queue.
+//
+// Report records are collected into a compressed block (SeriesCodec) and
+// sealed into one message once the batch has enough records, the block is
+// full or its oldest record has waited long enough. The payload is a
+// telemetry batch frame, so "decode" reads a capture of the topic as it is.
+// Sealed messages wait in a ring of fixed size until the broker has
+// acknowledged them (QoS 1); while the link is down the ring fills up and,
+// once full, the oldest message makes room for the newest. After a
+// reconnect the unacknowledged ones are sent again, a message can therefore
+// arrive twice but none is lost while it fits the queue.
+//
+// The connection is a state machine moved on by poll(): start a connect,
+// wait for it, send CONNECT, wait for CONNACK, then publish with a few
+// messages in flight and PINGREQ when idle. Every step only does what is
+// possible without waiting, a stalled network costs a few microseconds per
+// poll and never holds up the caller. A failed attempt or a dead session
+// closes the transport and retries after a delay that doubles up to a limit.
+
+// Compressed bytes per message, override with -D build flags
+#ifndef MQTT_BATCH_BYTES
+#define MQTT_BATCH_BYTES 128
+#endif
+
+// Sealed messages kept while the broker is unreachable
+#ifndef MQTT_QUEUE_MESSAGES
+#define MQTT_QUEUE_MESSAGES 64
+#endif
+
+#define MQTT_INFLIGHT 4        // Messages sent ahead of their acknowledgement
+#define MQTT_TOPIC_MAX 64      // Longest topic
+#define MQTT_CLIENT_ID_MAX 32  // Longest client id
+
+// Payload of the largest message, a batch frame around a full block
+#define MQTT_MESSAGE_MAX (1 + 2 + MQTT_BATCH_BYTES + 2 + (1 + 2 + MQTT_BATCH_BYTES + 2) / 254 + 1 + 2)
+
+// Settings of a publisher
+struct MqttConfig
+{
+    const char *host;             // Numeric broker address
+    uint16_t port;
+    const char *client_id;
+    const char *topic;
+    uint16_t keepalive_s;         // Ping after this long without sending, give up after as long without an answer
+    uint16_t batch_records;       // Records per message
+    uint32_t batch_age_ms;        // Longest a record waits for its batch to fill
+    uint32_t connect_timeout_ms;  // TCP connect plus CONNACK
+    uint32_t retry_min_ms;        // First reconnect delay, doubled after every failure
+    uint32_t retry_max_ms;
+};
+
+enum MqttState : uint8_t
+{
+    MQTT_DISCONNECTED, // Waiting for the next attempt
+    MQTT_CONNECTING,   // Transport connect in progress
+    MQTT_HANDSHAKE,    // CONNECT sent, waiting for CONNACK
+    MQTT_CONNECTED,
+};
+
+// Counters since start
+struct MqttStats
+{
+    uint32_t records;          // Records added
+    uint32_t messages;         // Messages sealed
+    uint32_t published;        // Messages acknowledged by the broker
+    uint32_t resent;           // Messages sent again after a reconnect
+    uint32_t dropped;          // Messages pushed out of the full queue
+    uint32_t dropped_records;  // Records in them
+    uint32_t connects;         // Sessions established
+    uint32_t failures;         // Attempts and sessions that failed
+    uint32_t bytes;            // Bytes handed to the transport
+    uint16_t queue_max;        // Deepest the queue got
+};
+
+class MqttPublisher
+{
+public:
+    MqttPublisher(NetworkTransport &transport, const MqttConfig &config);
+
+    // Add a record to the open batch, seals it when it is complete
+    void add(const TelemetryRecord &record, uint32_t now_ms);
+
+    // Seal the open batch now
+    void flush();
+
+    // Move the connection on and send what it can, never waits
+    void poll(uint32_t now_ms);
+
+    MqttState state() const { return current; }
+    uint16_t queued() const { return count; }       // Sealed messages not acknowledged yet
+    uint16_t batched() const { return encoder.count(); }
+    const MqttStats &stats() const { return counters; }
+
+private:
+    // A sealed message
+    struct Message
+    {
+        uint16_t packet_id;
+        uint16_t records;
+        uint16_t length;
+        bool sent;             // Sent at least once, a repeat carries the DUP flag
+        uint8_t payload[MQTT_MESSAGE_MAX];
+    };
+
+    void seal();
+    void fail(uint32_t now_ms);
+    void online(uint32_t now_ms);
+    bool sendPending(uint32_t now_ms);
+    void receive(uint8_t byte, uint32_t now_ms);
+    void handlePacket(uint8_t type, const uint8_t *body, size_t length, uint32_t now_ms);
+    size_t putHeader(uint8_t type, size_t remaining);
+    void queuePublish(Message &message);
+    void queueConnect();
+    void queueControl(uint8_t type);
+
+    NetworkTransport &transport;
+    MqttConfig config;
+    MqttState current;
+    MqttStats counters;
+
+    // Open batch
+    SeriesEncoder encoder;
+    uint8_t block[MQTT_BATCH_BYTES];
+    uint32_t batch_start_ms;
+
+    // Sealed messages, oldest at head. The first inflight of them have been sent in this session
+    Message queue[MQTT_QUEUE_MESSAGES];
+    uint16_t head;
+    uint16_t count;
+    uint16_t inflight;
+    uint16_t next_packet_id;
+
+    // Timing of the connection
+    uint32_t since_ms;         // Entered the current state
+    uint32_t retry_ms;         // Next attempt
+    uint32_t retry_delay_ms;
+    bool backoff;              // A failure waits for retry_ms, the first attempt does not
+    uint32_t sent_ms;          // Last packet sent
+    uint32_t waiting_ms;       // An answer has been outstanding since, reset by every answer
+    bool ping_pending;
+
+    // One outgoing packet at a time, written out over as many polls as the transport needs
+    uint8_t tx[1 + 4 + 2 + MQTT_TOPIC_MAX + 2 + MQTT_MESSAGE_MAX];
+    size_t tx_length;
+    size_t tx_done;
+
+    // Incoming packet, only the first bytes of a body are kept (the acknowledgements have two)
+    uint8_t rx_stage;          // 0 packet type, 1 remaining length, 2 body
+    uint8_t rx_type;
+    uint8_t rx_shift;          // Bits of the remaining length read
+    uint32_t rx_remaining;
+    uint32_t rx_read;          // Body bytes read
+    uint8_t rx_body[4];
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Where a transport connection stands
+enum TransportState : uint8_t
+{
+    TRANSPORT_CLOSED,     // Never opened, failed or closed by the peer
+    TRANSPORT_CONNECTING, // Connect started, not finished yet
+    TRANSPORT_OPEN,
+};
+
+// A byte stream to a server, the little the MQTT publisher needs.
+// On the board and on the host SocketTransport runs it on a non-blocking TCP
+// socket, the host benches also put an in-process broker behind it. No call
+// may wait for the network: a connect only starts, a write takes what fits
+// into the send buffer and a read what has already arrived.
+class NetworkTransport
+{
+public:
+    virtual ~NetworkTransport() {}
+
+    // Start connecting to a numeric IPv4 address, false if it failed straight away
+    virtual bool connect(const char *host, uint16_t port) = 0;
+
+    // Current state, moves a pending connect on
+    virtual TransportState state() = 0;
+
+    // Returns the number of bytes taken, 0 if the send buffer is full or the connection is not open
+    virtual size_t write(const uint8_t *data, size_t length) = 0;
+
+    // Returns the number of bytes read, 0 if nothing arrived
+    virtual size_t read(uint8_t *data, size_t length) = 0;
+
+    virtual void close() = 0;
+};
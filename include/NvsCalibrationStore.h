@@ -0,0 +1,25 @@
+#pragma once
+
+#include <Preferences.h>
+#include "Calibration.h"
+
+// CalibrationStore in the NVS partition, the blob is one key of a namespace.
+// NVS writes a new copy of an entry before it drops the old one, so a reset
+// during a save leaves either calibration, never a mix of both.
+class NvsCalibrationStore : public CalibrationStore
+{
+public:
+    explicit NvsCalibrationStore(const char *name = "calib") : name(name), ready(false) {}
+
+    // Open the namespace, false if NVS is not usable (the calibration then stays at its defaults)
+    bool begin();
+
+    size_t read(uint8_t *data, size_t capacity) override;
+    bool write(const uint8_t *data, size_t length) override;
+    bool erase() override;
+
+private:
+    const char *name;
+    bool ready;
+    Preferences preferences;
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <stdint.h>
+#include "Reading.h"
+#include "Filters.h"
+#include "AdcBlockSource.h"
+#include "Ads1x15Source.h"
+
+// Compile-time description of the analog probes.
+//
+// A layout lists the probes in ADC channel order: the TDS and pH pair the
+// pipeline converts first, then any extra probes. Each one names its kind,
+// which picks its filter chain and conversion, and where its samples come
+// from. Everything is constexpr, so the pin list handed to the ADC source is
+// built by the compiler, and the checks below reject a layout in a
+// static_assert before it reaches a board. The filters are sized by template
+// arguments and live inside the pipeline, nothing is allocated at runtime.
+
+enum ChannelSource : uint8_t
+{
+    SOURCE_GPIO,    // On-chip ADC, pin is the GPIO
+    SOURCE_ADS1X15, // External chain, pin is ADS1X15_INPUT(device, input)
+};
+
+enum ChannelFilterKind : uint8_t
+{
+    FILTER_TRIMMED_MEAN, // Mean of what is left after dropping trim samples at either end
+    FILTER_MEDIAN,
+};
+
+// Filter chain of a kind of probe
+struct ChannelFilterSpec
+{
+    ChannelFilterKind kind;
+    uint16_t window; // Samples the filter covers
+    uint16_t trim;   // Samples a trimmed mean drops at either end
+};
+
+template <ChannelFilterKind Kind, uint16_t Window, uint16_t Trim>
+struct ChannelFilterOf;
+
+template <uint16_t Window, uint16_t Trim>
+struct ChannelFilterOf<FILTER_TRIMMED_MEAN, Window, Trim>
+{
+    typedef RollingTrimmedMean<int, Window, Trim> type;
+};
+
+template <uint16_t Window, uint16_t Trim>
+struct ChannelFilterOf<FILTER_MEDIAN, Window, Trim>
+{
+    static_assert(Trim == 0, "A median does not trim");
+    typedef RollingMedian<int, Window> type;
+};
+
+// Filter object of a spec
+template <const ChannelFilterSpec &Spec>
+using ChannelFilter = typename ChannelFilterOf<Spec.kind, Spec.window, Spec.trim>::type;
+
+// One analog probe
+struct ChannelSpec
+{
+    ReadingChannel kind;  // READING_TDS or READING_PH
+    ChannelSource source;
+    uint8_t pin;
+};
+
+template <uint8_t N>
+struct PipelineLayout
+{
+    static_assert(N >= 2, "A layout starts with the TDS and pH pair");
+    static const uint8_t COUNT = N;
+
+    // Pin list in channel order, what AdcBlockSource::begin() takes
+    struct Pins
+    {
+        uint8_t pin[N];
+    };
+
+    ChannelSpec channels[N];
+
+    constexpr Pins pins() const
+    {
+        Pins list = {};
+        for (uint8_t i = 0; i < N; i++)
+            list.pin[i] = channels[i].pin;
+        return list;
+    }
+};
+
+// GPIOs of the on-chip converters
+constexpr bool esp32Adc1Pin(uint8_t gpio) { return gpio >= 32 && gpio <= 39; }
+constexpr bool esp32Adc2Pin(uint8_t gpio)
+{
+    return gpio == 0 || gpio == 2 || gpio == 4 || (gpio >= 12 && gpio <= 15) || (gpio >= 25 && gpio <= 27);
+}
+
+// TDS on channel 0 and pH on channel 1 (ADC_CHANNEL_TDS, ADC_CHANNEL_PH), then up to PIPELINE_MAX_PROBES extra
+// probes of either kind, all from one source
+template <uint8_t N>
+constexpr bool layoutFitsPipeline(const PipelineLayout<N> &layout, uint8_t max_extra)
+{
+    if (layout.channels[0].kind != READING_TDS || layout.channels[1].kind != READING_PH || N - 2 > max_extra)
+        return false;
+    for (uint8_t i = 0; i < N; i++)
+    {
+        const ChannelSpec &channel = layout.channels[i];
+        if ((channel.kind != READING_TDS && channel.kind != READING_PH) || channel.source != layout.channels[0].source)
+            return false;
+    }
+    return true;
+}
+
+// Every pin exists on its source and no two probes share one. The chain has ads_devices devices
+template <uint8_t N>
+constexpr bool layoutPinsValid(const PipelineLayout<N> &layout, uint8_t ads_devices)
+{
+    uint8_t gpio_count = 0;
+    for (uint8_t i = 0; i < N; i++)
+    {
+        const ChannelSpec &channel = layout.channels[i];
+        if (channel.source == SOURCE_GPIO && !esp32Adc1Pin(channel.pin) && !esp32Adc2Pin(channel.pin))
+            return false;
+        if (channel.source == SOURCE_ADS1X15 && channel.pin >= ads_devices * ADS1X15_INPUTS)
+            return false;
+        gpio_count += channel.source == SOURCE_GPIO;
+        for (uint8_t j = 0; j < i; j++)
+        {
+            if (layout.channels[j].source == channel.source && layout.channels[j].pin == channel.pin)
+                return false;
+        }
+    }
+    return gpio_count <= AdcBlockSource::MAX_CHANNELS && ads_devices <= ADS1X15_MAX_DEVICES;
+}
+
+// The WiFi driver owns ADC2 while it runs, no probe may sit on an ADC2 pin then
+template <uint8_t N>
+constexpr bool layoutFitsWifi(const PipelineLayout<N> &layout, bool wifi)
+{
+    for (uint8_t i = 0; i < N && wifi; i++)
+    {
+        if (layout.channels[i].source == SOURCE_GPIO && esp32Adc2Pin(layout.channels[i].pin))
+            return false;
+    }
+    return true;
+}
+
+// No probe on a GPIO something else drives, e.g. the OneWire bus or a pump
+template <uint8_t N>
+constexpr bool layoutLeavesFree(const PipelineLayout<N> &layout, uint8_t gpio)
+{
+    for (uint8_t i = 0; i < N; i++)
+    {
+        if (layout.channels[i].source == SOURCE_GPIO && layout.channels[i].pin == gpio)
+            return false;
+    }
+    return true;
+}
+
+// The pair and the extra probes round the devices of a chain, so consecutive channels convert in parallel
+template <uint8_t N>
+constexpr PipelineLayout<N> ads1x15Layout(uint8_t devices, uint8_t extra_ph)
+{
+    PipelineLayout<N> layout = {};
+    for (uint8_t i = 0; i < N; i++)
+    {
+        ReadingChannel kind = i == 0 ? READING_TDS : i == 1 ? READING_PH : i < 2 + extra_ph ? READING_PH : READING_TDS;
+        layout.channels[i] = {kind, SOURCE_ADS1X15, (uint8_t)ADS1X15_INPUT(i % devices, i / devices)};
+    }
+    return layout;
+}
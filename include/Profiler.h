@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Hal.h"
+
+// Hot path profiling with scoped cycle timers.
+//
+// A stage is a named global that collects durations, a PROFILE_SCOPE at the
+// top of a block times the rest of the block with halCycles(): the CPU cycle
+// counter on the board, a std::chrono nanosecond clock on the host, so the
+// same stages show up in the simulation and the benchmarks. Every duration
+// goes into a fixed histogram with four buckets per power of two, percentiles
+// come out within 25 % without keeping the samples. A stage must be recorded
+// by one task only, and the cycle counter is per core.
+//
+// Built with -D PROFILING=0 the stages and scopes are not compiled at all.
+
+#ifndef PROFILING
+#define PROFILING 1
+#endif
+
+#define PROFILE_SUB_BUCKETS 4   // Buckets per power of two, bucket() splits on the two bits below the top one
+#define PROFILE_BUCKETS 112     // Up to 2^29 cycles, about 2 s at 240 MHz, the last bucket holds everything above
+
+#if PROFILING
+
+class ProfileStage
+{
+public:
+    // Stages are globals, every one links itself into the list at startup
+    explicit ProfileStage(const char *name);
+
+    void record(uint32_t cycles)
+    {
+        if (reset_requested)
+            clear();
+        runs++;
+        total += cycles;
+        if (cycles > longest)
+            longest = cycles;
+        histogram[bucket(cycles)]++;
+    }
+
+    // Duration the given percentage of runs stayed below, as the upper edge of its bucket
+    uint32_t percentile(uint8_t percent) const;
+
+    const char *name() const { return label; }
+    uint32_t count() const { return runs; }
+    uint32_t maximum() const { return longest; }
+    uint64_t sum() const { return total; }
+
+    // Ask the recording task to clear the stage before its next record
+    void reset() { reset_requested = true; }
+
+    // All stages in the order they were constructed
+    static ProfileStage *first() { return stages; }
+    ProfileStage *next() const { return following; }
+
+    // Bucket of a duration and the first duration past it
+    static uint8_t bucket(uint32_t cycles);
+    static uint32_t bucketEnd(uint8_t index);
+
+private:
+    void clear();
+
+    static ProfileStage *stages;       // Head of the list
+
+    const char *label;
+    ProfileStage *following;           // Next stage in the list
+    volatile bool reset_requested;     // Set by reset()
+    uint32_t runs;
+    uint32_t longest;
+    uint64_t total;
+    uint32_t histogram[PROFILE_BUCKETS];
+};
+
+// Times its own lifetime into a stage
+class ProfileScope
+{
+public:
+    explicit ProfileScope(ProfileStage &stage) : stage(stage), start(halCycles()) {}
+    ~ProfileScope() { stage.record(halCycles() - start); }
+
+private:
+    ProfileStage &stage;
+    uint32_t start;
+};
+
+// One line with the runs, mean, p50, p99 and max of a stage in microseconds
+size_t profileFormat(const ProfileStage &stage, char *buffer, size_t size);
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+// Define a stage at namespace scope
+#define PROFILE_STAGE(variable, name) ProfileStage variable(name)
+
+// Time the rest of the enclosing block
+#define PROFILE_SCOPE(variable) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(variable)
+
+#else
+
+#define PROFILE_STAGE(variable, name)
+#define PROFILE_SCOPE(variable)
+
+#endif
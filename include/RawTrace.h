@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "AdcBlockSource.h"
+#include "Reading.h"
+#include "SpscRing.h"
+#include "Telemetry.h"
+
+// Traces of the raw sensor input.
+//
+// A trace holds what the pipeline took in: every ADC block of every channel
+// as raw counts, every DS18B20 read (or the probe not answering) and the
+// reference values typed in from a handheld meter, each with its time. The
+// host replays it through the same pipeline as fast as it goes and compares
+// the output against the references (see "bench-replay").
+//
+// A trace is cut into chunks of up to TELEMETRY_BATCH_MAX bytes that travel
+// as trace frames, so a capture of the serial port is a trace file, with the
+// report frames in between skipped. A chunk stands on its own: the first
+// event has its full time, every other one the signed change from the event
+// before. Samples are the zigzag delta to the previous sample in a varint,
+// so noise of a few counts costs one byte a sample. Temperatures are the
+// DS18B20's 1/16 C steps, references a float.
+
+#define RAW_TRACE_FLUSH_US 1000000UL // A chunk goes out at the latest a second after its first event
+#define RAW_TRACE_EVENT_MAX (1 + 5 + 1 + 3 * ADC_BLOCK_SIZE) // Longest event, an ADC block of far apart samples
+
+enum RawTraceEventType : uint8_t
+{
+    TRACE_ADC_BLOCK,           // An ADC block, channel is the ADC channel
+    TRACE_TEMPERATURE,         // A DS18B20 read, channel is the probe
+    TRACE_TEMPERATURE_MISSING, // The probe did not answer
+    TRACE_REFERENCE,           // A reference value, channel is its ReadingChannel
+};
+
+struct RawTraceEvent
+{
+    RawTraceEventType type;
+    uint8_t channel;
+    uint32_t time_us;  // For a block the time of its first sample
+    float value;       // Celsius or the reference value
+    AdcBlock block;    // Samples of an ADC block
+};
+
+class RawTraceEncoder
+{
+public:
+    RawTraceEncoder();
+
+    // Start a new chunk in buffer
+    void begin(uint8_t *buffer, size_t capacity);
+
+    // Add an event, false if it does not fit in the rest of the chunk
+    bool append(const RawTraceEvent &event);
+
+    size_t size() const { return length; }
+    uint16_t count() const { return events; }
+    uint32_t firstUs() const { return first_us; }
+
+private:
+    uint8_t *buffer;
+    size_t capacity;
+    size_t length;
+    uint16_t events;
+    uint32_t first_us;
+    uint32_t previous_us;
+};
+
+class RawTraceDecoder
+{
+public:
+    // Read count events from a chunk
+    RawTraceDecoder(const uint8_t *data, size_t length, uint16_t count);
+
+    // The next event, false at the end or on a damaged chunk
+    bool next(RawTraceEvent &event);
+
+    uint16_t remaining() const { return count; }
+
+private:
+    const uint8_t *data;
+    size_t length;
+    size_t position;
+    uint16_t count;
+    bool first;
+    uint32_t previous_us;
+};
+
+// A finished chunk on its way out
+struct RawTraceChunk
+{
+    uint16_t count;
+    uint16_t length;
+    uint8_t data[TELEMETRY_BATCH_MAX];
+};
+
+// Capture on the board. The acquisition task hands every block and read to
+// it as the pipeline takes them, the loop task switches the capture and
+// sends the finished chunks. Off, a block costs one test of a flag.
+class RawTraceRecorder
+{
+public:
+    static const uint8_t CHUNKS = 8;     // Finished chunks buffered, power of two
+    static const uint8_t REFERENCES = 4; // References waiting for the acquisition task, power of two
+
+    RawTraceRecorder();
+
+    // Loop task: switch the capture, the chunk in progress goes out with the next event after a stop
+    void start() { recording = true; }
+    void stop() { recording = false; }
+    bool active() const { return recording; }
+
+    // Loop task: a reference value, written into the trace by the acquisition task. False while off or full
+    bool reference(ReadingChannel channel, float value, uint32_t now_us);
+
+    // Loop task: take the oldest finished chunk
+    bool take(RawTraceChunk &chunk) { return finished.pop(chunk); }
+
+    // Acquisition task: the inputs of the pipeline
+    void block(uint8_t channel, const AdcBlock &block);
+    void temperature(uint8_t probe, float celsius, bool valid, uint32_t now_us);
+
+    uint32_t events() const { return event_count; }
+    uint32_t dropped() const { return dropped_chunks; } // Chunks lost because the loop task did not keep up
+
+private:
+    struct Reference
+    {
+        ReadingChannel channel;
+        float value;
+        uint32_t time_us;
+    };
+
+    void record(const RawTraceEvent &event);
+    void finish();
+
+    volatile bool recording;
+    RawTraceEncoder encoder;
+    RawTraceChunk filling;
+    SpscRing<RawTraceChunk, CHUNKS> finished;
+    SpscRing<Reference, REFERENCES> references;
+    volatile uint32_t event_count;
+    volatile uint32_t dropped_chunks;
+};
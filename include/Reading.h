@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include "SensorState.h"
+
+// Which measurement a Reading carries
+enum ReadingChannel : uint8_t
+{
+    READING_TDS,         // Temperature adjusted TDS
+    READING_PH,          // pH
+    READING_TEMPERATURE, // Water temperature in C, index selects the probe
+    READING_EC           // Electrical conductivity in uS/cm, derived from TDS
+};
+
+// One timestamped measurement handed from the acquisition task to the reporting side
+struct Reading
+{
+    uint32_t timestamp_us;  // Clock value when the measurement was completed
+    ReadingChannel channel; // What was measured
+    uint8_t index;          // Probe number for channels with several probes
+    SensorQuality quality;  // Trust in the value, FAULT carries the last value of a faulty probe
+    float value;            // Measured value
+};
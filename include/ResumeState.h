@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include "TemperatureEngine.h"
+#include "SensorPipeline.h"
+#include "DutyCycle.h"
+
+// Everything that survives a deep sleep in RTC memory.
+//
+// On the board the struct lives in RTC_DATA_ATTR memory, which keeps its
+// contents through deep sleep but not through a power cycle or a flash. The
+// CRC tells a real resume from garbage, anything that fails it (or comes
+// from another firmware layout) means a cold boot with a bus scan.
+
+#define RESUME_STATE_VERSION 1
+
+struct ResumeState
+{
+    uint32_t magic;                              // RESUME_STATE_MAGIC once sealed
+    uint16_t version;                            // RESUME_STATE_VERSION of the firmware that wrote it
+    uint16_t crc;                                // CRC-16/CCITT of everything after this field
+    uint8_t power_mode;                          // PowerMode to go on with
+    uint32_t wakes;                              // Wakes from deep sleep since the cold boot
+    TemperatureEngine::Snapshot temperatures;    // Probe addresses, no bus scan needed
+    SensorPipeline::Snapshot pipeline;           // Filter windows, no re-priming needed
+    DutyCycleStats duty;                         // Window and latency statistics
+};
+
+// Fill in the magic, version and CRC after the fields were written
+void resumeStateSeal(ResumeState &state);
+
+// The state was sealed by this firmware and has not been damaged since
+bool resumeStateValid(const ResumeState &state);
+
+// Forget the state, the next boot is a cold one
+void resumeStateClear(ResumeState &state);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+
+// Cooperative scheduler for the sensor state machines.
+//
+// Every task is a small state machine: its step function does one bounded
+// piece of work (one ADC read, one OneWire command, one line of output) and
+// returns how many microseconds it wants to sleep before it runs again. No
+// task is allowed to block, so ADC bursts, DS18B20 conversions and serial
+// output of different sensors interleave instead of running back to back.
+//
+// Time comes from an injected clock so the same code runs against micros()
+// on the ESP32 and against a fake clock in the native build.
+
+// Clock source returning a free running microsecond counter (wraps at 2^32)
+typedef uint32_t (*SchedulerClock)();
+
+// Task step function, returns the delay in microseconds until the next step
+typedef uint32_t (*SchedulerStep)(void *context, uint32_t now_us);
+
+// Timing statistics for a single task
+struct SchedulerTaskStats
+{
+    uint32_t runs;             // Number of times the step function was called
+    uint32_t lateness_min_us;  // Smallest delay between due time and actual start
+    uint32_t lateness_max_us;  // Largest delay between due time and actual start (worst jitter)
+    uint64_t lateness_sum_us;  // Sum of all start delays, divide by runs for the mean
+    uint32_t run_time_max_us;  // Longest single step
+    uint64_t run_time_sum_us;  // Sum of all step durations, divide by runs for the mean
+};
+
+// Timing statistics for the scheduler passes that executed at least one task
+struct SchedulerCycleStats
+{
+    uint32_t cycles;          // Number of passes that ran at least one task
+    uint32_t cycle_min_us;    // Shortest pass
+    uint32_t cycle_max_us;    // Longest pass
+    uint64_t cycle_sum_us;    // Sum of all pass durations, divide by cycles for the mean
+};
+
+class Scheduler
+{
+public:
+    static const uint8_t MAX_TASKS = 8; // Tasks are stored in a fixed table, no heap use
+
+    explicit Scheduler(SchedulerClock clock);
+
+    // Register a task, it first runs first_delay_us after now. Returns the task index or -1 if the table is full
+    int8_t addTask(const char *name, SchedulerStep step, void *context, uint32_t first_delay_us = 0);
+
+    // Run every task that is due once and return the number of microseconds until the next one is due
+    uint32_t runOnce();
+
+    // Accessors for the task table and the statistics
+    uint8_t taskCount() const { return task_count; }
+    const char *taskName(uint8_t index) const { return tasks[index].name; }
+    const SchedulerTaskStats &taskStats(uint8_t index) const { return tasks[index].stats; }
+    const SchedulerCycleStats &cycleStats() const { return cycle_stats; }
+
+    // Clear all statistics, e.g. after printing a report
+    void resetStats();
+
+private:
+    struct Task
+    {
+        const char *name;         // Name used in reports
+        SchedulerStep step;       // State machine step function
+        void *context;            // Opaque pointer handed back to the step function
+        uint32_t due_us;          // Clock value at which the task should run next
+        SchedulerTaskStats stats; // Timing statistics for this task
+    };
+
+    SchedulerClock clock;              // Microsecond clock
+    Task tasks[MAX_TASKS];             // Task table
+    uint8_t task_count;                // Number of registered tasks
+    SchedulerCycleStats cycle_stats;   // Per pass statistics
+};
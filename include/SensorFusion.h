@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+#include "Kalman.h"
+
+// Kalman fusion of the temperature, pH and TDS streams.
+//
+// The filters give one value per block, each with the noise of one block,
+// and the report takes the latest of them. The fusion keeps one state for the
+// reservoir instead: the temperature and its rate of change, the pH, and the
+// TDS probe voltage compensated to 25 C. Between two measurements the state
+// is carried forward by a model of how a tank moves (the temperature ramps,
+// pH and TDS drift) and its uncertainty grows; every measurement is weighed
+// against that by its own noise. What comes out is smoothed over as many
+// blocks as the model allows, with a standard deviation at every step.
+//
+// The TDS probe reads the compensated voltage times 1 + (T - 25) / 50, so a
+// TDS measurement is a non-linear function of two states and goes in as an
+// extended Kalman update. Its gain splits the innovation between the two by
+// their uncertainty: with a shaky temperature the TDS reading corrects the
+// temperature as well, with a settled one it corrects the TDS alone.
+//
+// A measurement too far from the prediction for its variance is rejected as
+// an outlier. After max_rejects in a row the model is the thing that is wrong,
+// e.g. a dose stepped the value, and that state restarts from the measurement.
+
+// Noise of the model and of the measurements, standard deviations
+struct SensorFusionConfig
+{
+    float temp_accel;    // Temperature acceleration, C / s^2 over one second
+    float temp_rate;     // Rate of change when the temperature starts, C / s
+    float ph_walk;       // Drift over one second, pH
+    float tds_walk;      // Drift over one second, compensated volts
+    float temp_sd;       // One probe read, C
+    float ph_sd;         // One pH value of the filters
+    float tds_sd;        // One TDS voltage of the filters, volts
+    float gate_sd;       // Innovations further out than this are outliers
+    uint8_t max_rejects; // Outliers in a row before a state restarts from the measurement
+};
+
+// An estimate and its standard deviation, not valid before the first measurement
+struct FusedValue
+{
+    float value;
+    float sigma;
+    bool valid;
+};
+
+class SensorFusion
+{
+public:
+    enum State : uint8_t
+    {
+        FUSION_TEMPERATURE,      // C
+        FUSION_TEMPERATURE_RATE, // C per second
+        FUSION_PH,               // pH
+        FUSION_TDS_VOLTS,        // Probe voltage at 25 C
+        FUSION_STATES
+    };
+
+    SensorFusion();
+
+    // Set the noise and start over
+    void configure(const SensorFusionConfig &config);
+    const SensorFusionConfig &config() const { return settings; }
+
+    // Forget the state, the next measurement of each kind starts it again
+    void reset();
+
+    // A measurement taken at time_us. The state is carried forward to it first, a measurement older than the last
+    // one is taken as if it were made at the same time. False if it was rejected as an outlier
+    bool temperature(float celsius, uint32_t time_us);
+    bool ph(float ph, uint32_t time_us);
+    bool tdsVolts(float volts, uint32_t time_us); // Probe voltage as measured, not compensated
+
+    // Estimate of a state as of the last measurement
+    FusedValue estimate(State state) const;
+
+    uint32_t updates() const { return update_count; }
+    uint32_t rejects() const { return reject_count; }
+
+private:
+    enum Measurement : uint8_t { MEASURE_TEMPERATURE, MEASURE_PH, MEASURE_TDS, MEASUREMENTS };
+
+    // Carry the state forward to time_us
+    void predict(uint32_t time_us);
+
+    // Gate and fold in one measurement, restarting its state after too many outliers
+    bool update(Measurement measurement, const KalmanFilter<FUSION_STATES>::Vector &h, float innovation, float sd);
+
+    // Set a state from a measurement and forget what it had to do with the others
+    void restart(State state, float value, float variance);
+
+    // TDS probe voltage over the compensated one at the estimated temperature
+    float tdsCoefficient() const;
+
+    KalmanFilter<FUSION_STATES> filter;
+    SensorFusionConfig settings;
+    bool started;                          // last_us holds the time of a measurement
+    uint32_t last_us;                      // Time the state is at
+    bool measured[MEASUREMENTS];           // The state of each kind has been started
+    uint8_t outliers[MEASUREMENTS];        // Rejected in a row
+    uint32_t update_count;                 // Measurements folded in
+    uint32_t reject_count;                 // Measurements rejected
+};
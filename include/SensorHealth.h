@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include "SensorState.h"
+
+// Probe fault detection.
+//
+// One monitor per probe looks at what the filters already have: the sorted
+// raw window of an analog input and the value that comes out of it. The
+// quartiles of the window tell a floating input (the spread is the whole
+// range) and an input stuck at a rail; the value itself is checked against a
+// plausible range, for a slew no reservoir can do, and for a value that has
+// not moved at all for far too long. Failed reads of a probe that answers on
+// its own (the DS18B20) are counted and mean disconnected after a few.
+//
+// The result is a quality for every value: GOOD, SUSPECT while a jump is not
+// confirmed yet, FAULT while a fault holds. A fault only clears after a run
+// of clean values, so a probe on the edge does not flap.
+
+// What is wrong with a probe
+enum SensorFault : uint8_t
+{
+    FAULT_NONE,
+    FAULT_DISCONNECTED, // No answer, an input at the low rail or a floating one
+    FAULT_STUCK,        // The value has not changed for too long
+    FAULT_SATURATED,    // The input is at the high rail or the value is outside the plausible range
+    FAULT_SLEW,         // The value jumped faster than it can, suspect until it holds
+    FAULT_COUNT
+};
+
+struct SensorHealthConfig
+{
+    uint16_t rail_low;         // Raw median at or below this is the low rail, analog inputs only
+    uint16_t rail_high;        // Raw median at or above this is the high rail
+    uint16_t floating_spread;  // Raw interquartile range above this is a floating input, if the median is well inside it
+    float min_value;           // Plausible range of the value
+    float max_value;
+    float slew_per_s;          // Fastest believable change per second
+    float slew_floor;          // A change up to this always passes, noise and quantisation
+    uint8_t slew_confirm;      // Values without a jump before a new level is believed
+    uint8_t missing_limit;     // Failed reads in a row that mean disconnected
+    uint8_t clear_count;       // Clean values in a row before a fault clears
+    uint32_t stuck_s;          // An unchanged value for this many seconds is stuck, 0 never
+};
+
+struct SensorHealthStats
+{
+    uint32_t evaluations;              // Values checked
+    uint32_t missing;                  // Failed reads
+    uint32_t detections[FAULT_COUNT];  // Times each fault was raised
+    uint32_t suspect;                  // Values that came out SUSPECT
+    uint32_t faulted;                  // Values that came out FAULT
+};
+
+class SensorHealth
+{
+public:
+    SensorHealth();
+
+    // Set the limits and forget the history
+    void configure(const SensorHealthConfig &config);
+
+    // Raw window of an analog input, checked before the value that comes out of it
+    template <typename Window>
+    void window(const Window &samples)
+    {
+        uint16_t count = samples.size();
+        if (count > 0)
+            checkWindow(samples.rank(count / 4), samples.rank(count / 2), samples.rank(count * 3 / 4));
+    }
+
+    // A new value, returns its quality
+    SensorQuality update(float value, uint32_t now_us);
+
+    // A read that returned nothing, returns the quality of the last value
+    SensorQuality missing();
+
+    SensorFault fault() const { return current; }
+    SensorQuality quality() const;
+
+    const SensorHealthConfig &config() const { return settings; }
+    const SensorHealthStats &stats() const { return totals; }
+
+private:
+    void checkWindow(uint16_t lower_quartile, uint16_t median, uint16_t upper_quartile);
+
+    // Enter a fault, or stay in it
+    void raise(SensorFault fault);
+
+    SensorHealthConfig settings;
+    SensorHealthStats totals;
+    SensorFault current;       // Fault being reported
+    SensorFault window_fault;  // Found by the last window(), taken by the next update()
+    uint8_t clean;             // Clean values in a row while a fault holds
+    uint8_t steady;            // Values without a jump since the last one
+    uint8_t misses;            // Failed reads in a row
+    bool have_previous;        // previous_value is a reference for the next jump
+    float previous_value;
+    uint32_t previous_us;      // Time of the last value
+    float unchanged_value;     // Value that has not moved for unchanged_us, longer than the clock wraps
+    uint64_t unchanged_us;
+};
+
+const char *sensorFaultName(SensorFault fault);
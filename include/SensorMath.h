@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include "FixedPoint.h"
+
+// Sensor conversion math, written once and instantiated for a number type.
+//
+// SensorMathPolicy<float> is the single-precision reference, and
+// SensorMathPolicy<Q16> runs the same formulas in fixed point. The coefficients
+// are static constexpr members, so for Q16 they are converted at compile time
+// and the hot path never touches double. SENSOR_MATH_FIXED picks the policy
+// the firmware uses.
+
+#ifndef SENSOR_MATH_FIXED
+#define SENSOR_MATH_FIXED 1
+#endif
+
+// Conversions between a number type and the outside world
+template <typename Num>
+struct SensorNumTraits;
+
+template <>
+struct SensorNumTraits<float>
+{
+    static float fromFloat(float value) { return value; }
+    static float fromMillivolts(uint16_t millivolts) { return millivolts * 0.001f; }
+    static float toFloat(float value) { return value; }
+    static float fromInt(int32_t value) { return (float)value; }
+    static int32_t floor(float value) { return (int32_t)floorf(value); }
+};
+
+template <int Frac>
+struct SensorNumTraits<Fixed<Frac>>
+{
+    static Fixed<Frac> fromFloat(float value) { return Fixed<Frac>::fromFloat(value); }
+    static Fixed<Frac> fromMillivolts(uint16_t millivolts) { return Fixed<Frac>::fromRatio(millivolts, 1000); }
+    static float toFloat(Fixed<Frac> value) { return value.toFloat(); }
+    static Fixed<Frac> fromInt(int32_t value) { return Fixed<Frac>::fromInt(value); }
+    static int32_t floor(Fixed<Frac> value) { return value.raw >> Frac; }
+};
+
+template <typename Num>
+struct SensorMathPolicy
+{
+    typedef Num value_type;
+    typedef SensorNumTraits<Num> Traits;
+
+    // TDS - temperature compensation, 0.02 / C is the commonly used coefficient around 25 C.
+    // Kept as its reciprocal: 0.02 is not exact in Q16 and the error is multiplied by the temperature offset
+    static constexpr Num TDS_TEMPERATURE_SPAN = Num(50.0);
+    static constexpr Num TDS_REFERENCE_TEMPERATURE = Num(25.0);
+
+    // TDS - cubic of the probe, ppm = (133.42 V^3 - 255.86 V^2 + 857.39 V) * 0.5
+    static constexpr Num TDS_CUBIC_A = Num(133.42);
+    static constexpr Num TDS_CUBIC_B = Num(255.86);
+    static constexpr Num TDS_CUBIC_C = Num(857.39);
+    static constexpr Num TDS_SCALE = Num(0.5);
+
+    // TDS - the probe board tops out at 2.3 V, 5.75 V once compensated for water at -5 C. The cubic stops here,
+    // a little above it, because in Q16 it overflows from 6.6 V on
+    static constexpr Num TDS_VOLTS_MAX = Num(6.0);
+
+    // PH - slope of the linear model in pH per volt
+    static constexpr Num PH_SLOPE = Num(-5.70);
+
+    static constexpr Num ONE = Num(1.0);
+
+    // Voltage from a calibrated millivolt reading
+    static Num volts(uint16_t millivolts) { return Traits::fromMillivolts(millivolts); }
+
+    // Runtime value, e.g. a temperature or a calibration constant
+    static Num value(float value) { return Traits::fromFloat(value); }
+
+    static float toFloat(Num value) { return Traits::toFloat(value); }
+
+    // Voltage the probe would read at the reference temperature
+    static Num tdsCompensate(Num volts, Num celsius)
+    {
+        Num coefficient = ONE + (celsius - TDS_REFERENCE_TEMPERATURE) / TDS_TEMPERATURE_SPAN;
+        return volts / coefficient;
+    }
+
+    // TDS in ppm from a compensated voltage, in Horner form: three multiplies instead of six
+    static Num tdsPpm(Num volts)
+    {
+        if (volts > TDS_VOLTS_MAX)
+            volts = TDS_VOLTS_MAX;
+        return ((TDS_CUBIC_A * volts - TDS_CUBIC_B) * volts + TDS_CUBIC_C) * volts * TDS_SCALE;
+    }
+
+    // pH from the probe voltage and the calibration offset
+    static Num ph(Num volts, Num offset)
+    {
+        return PH_SLOPE * volts + offset;
+    }
+};
+
+// The policy the firmware runs
+#if SENSOR_MATH_FIXED
+typedef SensorMathPolicy<Q16> SensorMath;
+#else
+typedef SensorMathPolicy<float> SensorMath;
+#endif
+typedef SensorMath::value_type SensorNum;
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <stdint.h>
+#include "Scheduler.h"
+#include "TemperatureEngine.h"
+#include "AdcBlockSource.h"
+#include "AdcCalibration.h"
+#include "Filters.h"
+#include "SensorState.h"
+#include "SensorHealth.h"
+#include "AdaptiveRate.h"
+#include "Calibration.h"
+#include "Reading.h"
+#include "RawTrace.h"
+#include "PipelineLayout.h"
+#include "Decimator.h"
+#include "SensorFusion.h"
+
+// Sensor pipeline settings, override with -D build flags
+#ifndef SCOUNT
+#define SCOUNT 30              // sum of sample point for the TDS median
+#endif
+#ifndef TDS_EC_FACTOR
+#define TDS_EC_FACTOR 0.5f     // ppm per uS/cm, the same 0.5 the TDS cubic is scaled by
+#endif
+#ifndef TDS_TEMP_PROBE
+#define TDS_TEMP_PROBE 0       // Probe whose temperature compensates the TDS reading
+#endif
+#ifndef PIPELINE_MAX_PROBES
+#define PIPELINE_MAX_PROBES 14 // Extra pH and TDS probes next to the first pair, e.g. on an ADS1x15 chain
+#endif
+#ifndef PH_CIC_RATIO
+#define PH_CIC_RATIO 64        // pH decimation when oversampling: a third order CIC by 64
+#endif
+#ifndef PH_FIR_RATIO
+#define PH_FIR_RATIO 8         // then a 32 tap FIR by 8, one pH value per 512 samples
+#endif
+#define ADC_CHANNEL_TDS 0      // Channel of the TDS pin in the sampled pin list
+#define ADC_CHANNEL_PH 1       // Channel of the pH pin in the sampled pin list
+
+// Filter chains of the probe kinds
+inline constexpr ChannelFilterSpec PIPELINE_PH_FILTER = {FILTER_TRIMMED_MEAN, ADC_BLOCK_SIZE, ADC_BLOCK_SIZE / 5}; // Middle 60% of the last block
+inline constexpr ChannelFilterSpec PIPELINE_TDS_FILTER = {FILTER_MEDIAN, SCOUNT, 0};                                // Median of the last SCOUNT samples
+inline constexpr ChannelFilterSpec PIPELINE_PROBE_FILTER = PIPELINE_PH_FILTER;                                     // Extra probes of both kinds
+typedef Decimator<3, PH_CIC_RATIO, 32, PH_FIR_RATIO> PhDecimator;                                                  // pH when oversampling
+
+// Everything between the raw inputs and the published readings.
+//
+// The pipeline owns the filters and the sensor state and registers three
+// state machines on a scheduler: temperature (drives the TemperatureEngine),
+// pH (trimmed mean of the ADC blocks) and TDS (median, compensated through
+// the state). It only talks to hardware through AdcBlockSource and
+// TemperatureBus, so the firmware and the native simulation run exactly the
+// same code. Results leave through the sink, one call per new value, each
+// with the quality its probe's SensorHealth gave it.
+//
+// With adaptive sampling on, every channel has an AdaptiveRate that slows
+// its ADC channel or probe period down while the value is quiet and speeds
+// it up again when it moves.
+//
+// More pH and TDS probes can sit on further ADC channels. They go through
+// the same conversion math and calibration as the first pair, one more
+// state machine converts all of them, and they are published with index 1,
+// 2, ... of their kind. They have no fault detection or adaptive rate.
+//
+// With oversampling the sample clock runs 2^n times the base rate. pH takes
+// every sample into a decimator and converts its output with the fraction
+// below the ADC count, its health window every 2^n-th. TDS and the extra
+// probes keep the base rate through a rate shift on their channels. pH then
+// stays at the oversampled rate, adaptive sampling only slows TDS down.
+//
+// With a SensorFusion attached every pH value, raw TDS voltage and read of
+// the compensating temperature probe also goes into it, as long as its probe
+// is not faulty. fused() turns its state into readings with bounds.
+
+// Work done by the sampling against what the base rates would have done in the same time
+struct SamplingStats
+{
+    uint64_t adc_conversions;   // ADC conversions the filters received
+    uint64_t adc_fixed;         // At the base sample rate
+    uint32_t onewire;           // OneWire transactions, a start and a read per temperature
+    uint32_t onewire_fixed;     // At the configured probe periods
+};
+
+// The fused state as readings, each with its standard deviation
+struct FusedReadings
+{
+    FusedValue temperature; // C
+    FusedValue ph;
+    FusedValue tds_ppm;     // Compensated and calibrated
+    FusedValue ec;          // uS/cm
+};
+
+class SensorPipeline
+{
+public:
+    // Receives every new value, e.g. pushes it into the ring towards the report side
+    typedef void (*ReadingSink)(ReadingChannel channel, uint8_t index, float value, SensorQuality quality);
+
+    // Filter windows that survive a deep sleep, raw counts oldest first
+    struct Snapshot
+    {
+        uint16_t ph_samples[PIPELINE_PH_FILTER.window];
+        uint16_t ph_count;
+        uint16_t tds_samples[PIPELINE_TDS_FILTER.window];
+        uint16_t tds_count;
+    };
+
+    SensorPipeline(AdcBlockSource &adc, TemperatureEngine &temperatures,
+                   const AdcCalibration &tds_calibration, const AdcCalibration &ph_calibration);
+
+    // Set up the state and register the sensor tasks. The ADC and the temperature engine must already be started
+    void begin(Scheduler &scheduler, ReadingSink sink, uint32_t block_period_us, uint32_t temp_max_age_us);
+
+    // Keep the filter windows, and refill them after a wake so the first result covers a whole window
+    void save(Snapshot &snapshot) const;
+    void resume(const Snapshot &snapshot);
+
+    // Calibration of the probes, it may vary for different sensors. Called from any task, the acquisition
+    // task precomputes and switches to it before its next conversion. False while the previous one is pending
+    bool setCalibration(const CalibrationCoefficients &coefficients);
+
+    // Fault limits of a channel, for temperature every probe's. Call before begin()
+    void configureHealth(ReadingChannel channel, const SensorHealthConfig &config);
+
+    // Fault state of a probe, TDS and pH have one
+    const SensorHealth &health(ReadingChannel channel, uint8_t index = 0) const;
+
+    // Adapt the sample rates to the signals, off samples at the base rates. Called from any task
+    void setAdaptive(bool on) { adaptive = on; }
+    bool adaptiveSampling() const { return adaptive; }
+
+    // Everything back to the fastest rate, e.g. when a dose goes in. Called from any task
+    void boost() { boost_requested = true; }
+
+    // Rate limits of a channel, for temperature every probe's. Call before begin()
+    void configureRate(ReadingChannel channel, const AdaptiveRateConfig &config);
+
+    // Adaptive rate of a probe, TDS and pH have one
+    const AdaptiveRate &rate(ReadingChannel channel, uint8_t index = 0) const;
+
+    const SamplingStats &samplingStats() const { return sampling; }
+
+    // The sample clock runs 2^shift times the base rate, pH is decimated and the other channels slowed down to the
+    // base rate. Call before begin(), 0 for none
+    void setOversampling(uint8_t shift) { oversampling = shift; }
+    uint8_t oversamplingShift() const { return oversampling; }
+
+    // Hand every ADC block and temperature read the pipeline takes to a trace capture, NULL for none. Call before begin()
+    void setRecorder(RawTraceRecorder *recorder) { this->recorder = recorder; }
+
+    // Feed the measurements into a Kalman fusion as well, NULL for none. Call before begin()
+    void setFusion(SensorFusion *fusion) { this->fusion = fusion; }
+
+    // The fusion's estimates through the calibration, false without a fusion. Called from the acquisition task
+    bool fused(FusedReadings &readings) const;
+
+    // An extra pH or TDS probe on an ADC channel after the first two. Call before begin(), false if there is no room
+    bool addProbe(ReadingChannel kind, uint8_t adc_channel);
+    uint8_t probeCount() const { return probe_count; }
+
+    // The extra probes of a layout, every channel after the first pair. Call before begin()
+    template <uint8_t N>
+    bool addProbes(const PipelineLayout<N> &layout)
+    {
+        for (uint8_t i = 2; i < N; i++)
+        {
+            if (!addProbe(layout.channels[i].kind, i))
+                return false;
+        }
+        return true;
+    }
+
+    // Latest pH probe voltage and compensated TDS voltage, what a calibration point captures
+    float phVolts() const { return ph_volts; }
+    float tdsVolts() const { return tds_volts; }
+
+    // State machine steps, each returns the delay until it wants to run again
+    uint32_t temperatureStep(uint32_t now_us);
+    uint32_t phStep(uint32_t now_us);
+    uint32_t tdsStep(uint32_t now_us);
+    uint32_t probeStep(uint32_t now_us);
+
+    const SensorState &state() const { return sensor_state; }
+
+private:
+    static uint32_t temperatureTask(void *context, uint32_t now_us);
+    static uint32_t phTask(void *context, uint32_t now_us);
+    static uint32_t tdsTask(void *context, uint32_t now_us);
+    static uint32_t probeTask(void *context, uint32_t now_us);
+    static float deriveTdsPpm(const SensorValue *const *inputs, void *context);
+    static float deriveEc(const SensorValue *const *inputs, void *context);
+
+    // Switch to a calibration set by setCalibration()
+    void applyCalibration();
+
+    // Apply a boost() asked for by another task
+    void applyBoost();
+
+    // The next block of a channel, into the capture as well when there is one
+    bool takeBlock(uint8_t channel, AdcBlock &block);
+
+    // Feed the rate of a channel, returns the shift to sample at
+    uint8_t adapt(AdaptiveRate &rate, float value, uint32_t now_us);
+
+    // Recompute whatever depends on a changed input and pass every new derived measurement on, changed or not
+    void refreshDerived(uint32_t now_us);
+
+    AdcBlockSource &adc;                    // Continuous TDS and pH samples
+    TemperatureEngine &temperatures;        // Asynchronous DS18B20 conversions
+    const AdcCalibration &tds_calibration;  // Raw to millivolt table of the TDS pin (ADC1)
+    const AdcCalibration &ph_calibration;   // Raw to millivolt table of the pH pin (ADC2)
+    ReadingSink sink;                       // Where new values go
+    RawTraceRecorder *recorder;             // Capture of the raw input, or NULL
+    SensorFusion *fusion;                   // Kalman fusion of the measurements, or NULL
+    uint32_t block_period_us;               // Time to fill one ADC block
+
+    CalibrationCurves curves;                            // Precomputed pH lines and TDS table
+    CalibrationCoefficients pending_coefficients;        // Handed over by setCalibration()
+    volatile bool calibration_pending;                   // pending_coefficients waits for the acquisition task
+    volatile float ph_volts;                             // Latest pH probe voltage
+    volatile float tds_volts;                            // Latest compensated TDS voltage
+    ChannelFilter<PIPELINE_PH_FILTER> ph_filter;
+    ChannelFilter<PIPELINE_TDS_FILTER> tds_filter;
+    PhDecimator ph_decimator;                            // pH when oversampling, ph_filter then only feeds the health
+
+    SensorHealth ph_health;                                  // Fault detection of every probe
+    SensorHealth tds_health;
+    SensorHealth temp_health[TemperatureEngine::MAX_PROBES];
+
+    AdaptiveRate ph_rate;                                    // Sample rate of every probe
+    AdaptiveRate tds_rate;
+    AdaptiveRate temp_rate[TemperatureEngine::MAX_PROBES];
+    uint8_t ph_shift;                                        // Rate shifts the ADC channels sample at
+    uint8_t tds_shift;
+    uint8_t oversampling;                                    // Sample clock over the base rate, as a shift
+    volatile bool adaptive;                                  // Set by setAdaptive()
+    volatile bool boost_requested;                           // Set by boost(), taken by the next step
+    SamplingStats sampling;
+
+    // An extra probe
+    struct Probe
+    {
+        ReadingChannel kind;
+        uint8_t adc_channel;
+        uint8_t index;      // Published index, 1 for the second probe of its kind
+        ChannelFilter<PIPELINE_PROBE_FILTER> filter;
+    };
+    Probe probes[PIPELINE_MAX_PROBES];
+    uint8_t probe_count;
+
+    SensorState sensor_state;       // Latest measured values and the TDS / EC derived from them
+    uint32_t tds_published_updates; // Updates of the derived values that were last handed to the sink
+    uint32_t ec_published_updates;
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdint.h>
+
+// Central store of the latest value of every measured and derived quantity.
+//
+// Producers publish measured values with a timestamp and a quality flag.
+// Every change bumps that entry's version. Derived quantities (compensated
+// TDS, EC) are registered with the entries they depend on, and refresh()
+// recomputes a derived entry only when the version of one of its inputs has
+// moved since it was last computed. A new TDS voltage with an unchanged
+// temperature therefore recomputes TDS and EC once, and a temperature that
+// arrives while nothing else changed costs no conversion work at all.
+//
+// The version alone cannot tell a steady value from a dead probe, so every
+// publish also counts as an update. A derived entry whose inputs were
+// updated without changing keeps its value and only takes over the newer
+// timestamp and counts an update of its own, which lets consumers that need
+// fresh measurements (the dosing loop) follow updates while reports that
+// only care about changes follow the version.
+//
+// The store is owned by the acquisition task and is not locked.
+
+// Everything the store keeps, measured values first, then derived ones
+enum SensorKey : uint8_t
+{
+    SENSOR_TEMPERATURE,  // Water temperature in C from the compensation probe
+    SENSOR_TDS_MV,       // Calibrated TDS probe voltage in millivolts
+    SENSOR_PH,           // pH
+    SENSOR_TDS_PPM,      // Derived: temperature compensated TDS in ppm
+    SENSOR_EC,           // Derived: electrical conductivity in uS/cm
+    SENSOR_KEY_COUNT
+};
+
+// How far a value can be trusted, ordered from best to worst
+enum SensorQuality : uint8_t
+{
+    QUALITY_GOOD,    // Fresh measurement
+    QUALITY_SUSPECT, // Fresh, but a jump the probe has not confirmed yet
+    QUALITY_STALE,   // Older than the entry's maximum age
+    QUALITY_FAULT,   // The probe is faulty, the value is the last one it gave
+    QUALITY_NONE     // Never measured
+};
+
+// Latest state of one entry
+struct SensorValue
+{
+    float value;           // Latest value
+    uint32_t timestamp_us; // When it was measured (for derived values: the newest input)
+    uint32_t version;      // Increments whenever value or quality changes, 0 means never set
+    uint32_t updates;      // Increments with every new measurement, changed or not
+    SensorQuality quality; // Trust in the value
+};
+
+// Computes a derived value from its inputs, in the order they were registered
+typedef float (*SensorDerive)(const SensorValue *const *inputs, void *context);
+
+class SensorState
+{
+public:
+    static const uint8_t MAX_INPUTS = 2;  // Inputs of one derived entry
+    static const uint8_t MAX_DERIVED = 4; // Derived entries
+
+    SensorState();
+
+    // Store a measured value, the version only moves if value or quality changed
+    void publish(SensorKey key, float value, uint32_t timestamp_us, SensorQuality quality = QUALITY_GOOD);
+
+    // Values older than max_age_us are marked stale by refresh(), 0 never expires
+    void setMaxAge(SensorKey key, uint32_t max_age_us) { max_age[key] = max_age_us; }
+
+    // Register a derived entry, entries are refreshed in registration order so register inputs first.
+    // The context is passed to every call of derive
+    bool addDerived(SensorKey key, SensorDerive derive, void *context, SensorKey input_a, SensorKey input_b);
+    bool addDerived(SensorKey key, SensorDerive derive, void *context, SensorKey input);
+
+    // Have everything derived from key recomputed by the next refresh, e.g. after the conversion changed
+    void invalidate(SensorKey key);
+
+    // Age out stale inputs, recompute every derived entry whose inputs changed and move the timestamp of those whose
+    // inputs were only updated. Returns the number recomputed
+    uint8_t refresh(uint32_t now_us);
+
+    const SensorValue &get(SensorKey key) const { return values[key]; }
+
+    // Counters of derived computations done and avoided
+    uint32_t recomputed() const { return recompute_count; }
+    uint32_t skipped() const { return skip_count; }
+
+private:
+    struct Derived
+    {
+        SensorKey key;                  // Entry written
+        SensorDerive derive;            // How to compute it
+        void *context;                  // Passed to derive
+        uint8_t input_count;            // Number of inputs
+        SensorKey inputs[MAX_INPUTS];   // Entries read
+        uint32_t seen[MAX_INPUTS];      // Input versions used for the current value
+        uint32_t touched[MAX_INPUTS];   // Input updates behind the current timestamp
+    };
+
+    void store(SensorKey key, float value, uint32_t timestamp_us, SensorQuality quality);
+
+    SensorValue values[SENSOR_KEY_COUNT]; // Current state of every entry
+    uint32_t max_age[SENSOR_KEY_COUNT];   // Staleness limit per entry
+    Derived derived[MAX_DERIVED];         // Derived entries in refresh order
+    uint8_t derived_count;                // Entries in derived
+    uint32_t recompute_count;             // Derived values computed
+    uint32_t skip_count;                  // Derived values whose inputs had not changed, updated or not
+};
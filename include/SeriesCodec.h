@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Telemetry.h"
+
+// Compressed blocks of report records (Gorilla style).
+//
+// A block is one bit stream. The first record is stored in full, every
+// following one only as its difference to the one before: the timestamp as
+// the change of its delta (delta-of-delta, a steady report period costs one
+// bit), the sequence and the status as a single bit while they do what they
+// are expected to, and each value as the delta of its quantised integer.
+// Deltas are zigzag coded and go into the smallest of a few bit widths, each
+// behind a short prefix, so an unchanged value is one bit and sensor noise a
+// byte or two. XOR of the raw floats (Gorilla's value coding) was tried
+// first; sensor noise reaches far down the mantissa and it saved much less
+// (see "bench-series").
+//
+// Values are quantised to the steps "history" prints them with, 0.01 ppm,
+// 0.001 pH and 0.001 C, so a decoded record prints the same. A value that is
+// not a number is kept as such.
+//
+// The encoder works on a caller supplied buffer and only ever writes whole
+// records: a record that does not fit leaves the block as it was.
+
+#define SERIES_TDS_SCALE 100      // Steps per ppm
+#define SERIES_PH_SCALE 1000      // Steps per pH
+#define SERIES_TEMP_SCALE 1000    // Steps per C
+#define SERIES_RECORD_SIZE 20     // Serialised record without compression, for comparison
+
+// Quantise a value to steps of 1 / scale and back
+int32_t seriesQuantise(float value, int32_t scale);
+float seriesValue(int32_t steps, int32_t scale);
+
+class SeriesEncoder
+{
+public:
+    SeriesEncoder();
+
+    // Start a new block in buffer
+    void begin(uint8_t *buffer, size_t capacity);
+
+    // Add a record, false if it does not fit in the rest of the block
+    bool append(const TelemetryRecord &record);
+
+    size_t size() const { return (bits + 7) / 8; }   // Bytes used, the last one partly
+    uint16_t count() const { return records; }
+    uint32_t firstMs() const { return first_ms; }
+    uint32_t lastMs() const { return previous.timestamp_ms; }
+
+private:
+    // Where the stream stands after a record, restored when the next one does not fit
+    struct State
+    {
+        uint16_t sequence;
+        uint32_t timestamp_ms;
+        uint32_t delta_ms;
+        int32_t values[3];
+        uint16_t status;
+    };
+
+    void put(uint32_t value, uint8_t width);
+    void putDelta(uint32_t zigzag, const uint8_t *widths);
+
+    uint8_t *buffer;
+    size_t capacity;       // Bytes
+    size_t bits;           // Bits written
+    bool overflow;         // A write went past the end
+    uint16_t records;
+    uint32_t first_ms;
+    State previous;
+};
+
+class SeriesDecoder
+{
+public:
+    // Read count records from a block
+    SeriesDecoder(const uint8_t *data, size_t length, uint16_t count);
+
+    // The next record, false at the end of the block or if it is malformed
+    bool next(TelemetryRecord &record);
+
+    uint16_t remaining() const { return count - records; }
+
+private:
+    uint32_t get(uint8_t width);
+    uint32_t getDelta(const uint8_t *widths);
+
+    const uint8_t *data;
+    size_t length;         // Bytes
+    size_t bits;           // Bits read
+    bool overflow;         // A read went past the end
+    uint16_t count;
+    uint16_t records;
+    uint16_t sequence;
+    uint32_t timestamp_ms;
+    uint32_t delta_ms;
+    int32_t values[3];
+    uint16_t status;
+};
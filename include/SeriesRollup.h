@@ -0,0 +1,160 @@
+#pragma once
+
+#include <stdint.h>
+#include "Telemetry.h"
+
+// Per-minute and per-hour summaries of the report records.
+//
+// Every tier keeps the min, max and mean of TDS, pH and temperature over
+// its period in a ring of fixed size, so a day of minutes and a month of
+// hours take a known amount of RAM next to the raw history on flash. Both
+// tiers are fed from the records themselves, an hour is not built from
+// rounded minutes. Only values that are valid and not from a faulty probe
+// count; a bucket keeps the status flags of all its records, with the valid
+// flag of a channel set only if it has a value for it.
+//
+// Buckets start at multiples of the period in log time, a period without
+// any record leaves no bucket. The summaries are stored in small steps
+// (0.1 ppm, 0.001 pH, 0.01 C) to keep a bucket at 28 bytes.
+
+// Buckets kept per tier, override with -D build flags
+#ifndef ROLLUP_MINUTES
+#define ROLLUP_MINUTES 1440    // A day
+#endif
+#ifndef ROLLUP_HOURS
+#define ROLLUP_HOURS 720       // 30 days
+#endif
+
+#define ROLLUP_TDS_SCALE 10
+#define ROLLUP_PH_SCALE 1000
+#define ROLLUP_TEMP_SCALE 100
+
+// Channels of a bucket
+enum RollupChannel : uint8_t
+{
+    ROLLUP_TDS,
+    ROLLUP_PH,
+    ROLLUP_TEMPERATURE,
+    ROLLUP_CHANNELS
+};
+
+// One period of one tier
+struct RollupBucket
+{
+    uint32_t start_ms;                 // Log time the period starts at
+    uint16_t count;                    // Records in it
+    uint16_t status;                   // TELEMETRY_* flags of all of them
+    int16_t min[ROLLUP_CHANNELS];      // In the steps of the channel
+    int16_t max[ROLLUP_CHANNELS];
+    int16_t mean[ROLLUP_CHANNELS];
+
+    // Values in their units
+    float minimum(RollupChannel channel) const;
+    float maximum(RollupChannel channel) const;
+    float average(RollupChannel channel) const;
+};
+
+// The period being collected
+class RollupAccumulator
+{
+public:
+    RollupAccumulator() { reset(0); }
+
+    // Start a new period
+    void reset(uint32_t start_ms);
+
+    void add(const TelemetryRecord &record);
+
+    bool empty() const { return records == 0; }
+    uint32_t start() const { return start_ms; }
+
+    // Summary of what was added so far
+    void summarise(RollupBucket &bucket) const;
+
+private:
+    uint32_t start_ms;
+    uint16_t records;
+    uint16_t status;
+    uint16_t counts[ROLLUP_CHANNELS];   // Values that counted
+    float min[ROLLUP_CHANNELS];
+    float max[ROLLUP_CHANNELS];
+    float sum[ROLLUP_CHANNELS];         // Of the differences to base
+    float base[ROLLUP_CHANNELS];        // First value that counted
+};
+
+// One tier: the open period and a ring of the completed ones
+template <uint16_t Buckets>
+class RollupTier
+{
+public:
+    explicit RollupTier(uint32_t period_ms) : period_ms(period_ms), next(0), stored(0) {}
+
+    // Add a record, a record of a later period completes the open one first. Returns true if one was completed
+    bool add(const TelemetryRecord &record)
+    {
+        uint32_t start_ms = record.timestamp_ms - record.timestamp_ms % period_ms;
+        bool completed = false;
+        if (!open.empty() && start_ms != open.start())
+        {
+            open.summarise(ring[next]);
+            next = (next + 1) % Buckets;
+            if (stored < Buckets)
+                stored++;
+            completed = true;
+        }
+        if (open.empty() || completed)
+            open.reset(start_ms);
+        open.add(record);
+        return completed;
+    }
+
+    void clear()
+    {
+        next = 0;
+        stored = 0;
+        open.reset(0);
+    }
+
+    // Completed buckets, age 0 is the newest
+    uint16_t size() const { return stored; }
+    const RollupBucket &bucket(uint16_t age) const { return ring[(next + Buckets - 1 - age) % Buckets]; }
+
+    // The period still being collected, false if it has no record yet
+    bool current(RollupBucket &bucket) const
+    {
+        if (open.empty())
+            return false;
+        open.summarise(bucket);
+        return true;
+    }
+
+    uint32_t period() const { return period_ms; }
+
+private:
+    uint32_t period_ms;
+    RollupBucket ring[Buckets];
+    uint16_t next;       // Slot of the next completed bucket
+    uint16_t stored;
+    RollupAccumulator open;
+};
+
+// The tiers of the history
+struct SeriesRollup
+{
+    RollupTier<ROLLUP_MINUTES> minutes;
+    RollupTier<ROLLUP_HOURS> hours;
+
+    SeriesRollup() : minutes(60000UL), hours(3600000UL) {}
+
+    void add(const TelemetryRecord &record)
+    {
+        minutes.add(record);
+        hours.add(record);
+    }
+
+    void clear()
+    {
+        minutes.clear();
+        hours.clear();
+    }
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "NetworkTransport.h"
+
+// NetworkTransport on a non-blocking TCP socket.
+//
+// The BSD socket calls are the same in lwIP on the board and on Linux, so
+// one implementation serves both. The host name has to be a numeric address,
+// a DNS lookup would block.
+class SocketTransport : public NetworkTransport
+{
+public:
+    SocketTransport() : fd(-1), current(TRANSPORT_CLOSED) {}
+    ~SocketTransport() override { close(); }
+
+    bool connect(const char *host, uint16_t port) override;
+    TransportState state() override;
+    size_t write(const uint8_t *data, size_t length) override;
+    size_t read(uint8_t *data, size_t length) override;
+    void close() override;
+
+private:
+    int fd;
+    TransportState current;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Lock-free single producer / single consumer ring buffer.
+//
+// Exactly one thread may call push() and exactly one other thread may call
+// pop(). The producer owns head, the consumer owns tail, and each side only
+// reads the other index, so no locks or read-modify-write atomics are needed.
+// Capacity must be a power of two; indices run freely and are masked on use.
+// Header only and free of Arduino dependencies so it builds on the host too.
+template <typename T, uint32_t Capacity>
+class SpscRing
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+    SpscRing() : head(0), tail(0) {}
+
+    // Producer side: copy an item in, returns false if the ring is full
+    bool push(const T &item)
+    {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= Capacity)
+        {
+            return false;
+        }
+        items[h & (Capacity - 1)] = item;
+        head.store(h + 1, std::memory_order_release); // Publish the item after it is written
+        return true;
+    }
+
+    // Consumer side: copy the oldest item out, returns false if the ring is empty
+    bool pop(T &item)
+    {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (head.load(std::memory_order_acquire) == t)
+        {
+            return false;
+        }
+        item = items[t & (Capacity - 1)];
+        tail.store(t + 1, std::memory_order_release); // Hand the slot back after it is read
+        return true;
+    }
+
+    // Number of items waiting, exact on either side, a snapshot anywhere else
+    uint32_t size() const
+    {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    static constexpr uint32_t capacity() { return Capacity; }
+
+private:
+    // Keep the two indices on separate cache lines so the cores do not fight over one line
+    alignas(64) std::atomic<uint32_t> head; // Next slot to write, only the producer stores it
+    alignas(64) std::atomic<uint32_t> tail; // Next slot to read, only the consumer stores it
+    alignas(64) T items[Capacity];          // Storage, a slot is owned by whoever the indices say
+};
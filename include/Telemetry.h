@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Compact binary telemetry.
+//
+// A record is serialised into a fixed little-endian layout, followed by a
+// CRC-16/CCITT of those bytes, COBS encoded so the payload never contains a
+// zero byte, and wrapped in zero delimiters. A receiver can therefore drop in
+// at any point, resynchronise on the next zero and reject anything that fails
+// the CRC (including stray text lines). Everything works on caller supplied
+// buffers, nothing is allocated.
+//
+// A batch frame carries many records at once for a bulk export of the
+// history: the same framing around a version byte of its own, the record
+// count and one compressed block (SeriesCodec). A trace frame is built the
+// same way around a chunk of raw sensor input (RawTrace).
+
+#define TELEMETRY_VERSION 1
+
+// Serialised record: version, sequence, timestamp, tds, ph, temperature, status
+#define TELEMETRY_PAYLOAD_SIZE (1 + 2 + 4 + 4 + 4 + 4 + 2)
+
+// Payload plus CRC
+#define TELEMETRY_RAW_SIZE (TELEMETRY_PAYLOAD_SIZE + 2)
+
+// COBS adds one byte per 254, plus the leading and trailing delimiters
+#define TELEMETRY_FRAME_SIZE (TELEMETRY_RAW_SIZE + TELEMETRY_RAW_SIZE / 254 + 1 + 2)
+
+// Batch frame: version, record count, compressed block of up to TELEMETRY_BATCH_MAX bytes
+#define TELEMETRY_BATCH_VERSION 0x81
+#define TELEMETRY_BATCH_MAX 512
+#define TELEMETRY_BATCH_RAW_SIZE (1 + 2 + TELEMETRY_BATCH_MAX + 2)
+#define TELEMETRY_BATCH_FRAME_SIZE (TELEMETRY_BATCH_RAW_SIZE + TELEMETRY_BATCH_RAW_SIZE / 254 + 1 + 2)
+
+// Trace frame: version, event count, trace chunk, the sizes of a batch frame
+#define TELEMETRY_TRACE_VERSION 0x82
+
+// Status flags
+#define TELEMETRY_TDS_VALID 0x0001   // tds_ppm holds a reading
+#define TELEMETRY_PH_VALID 0x0002    // ph holds a reading
+#define TELEMETRY_TEMP_VALID 0x0004  // temperature_c holds a reading
+#define TELEMETRY_TDS_FAULT 0x0010   // tds_ppm is the last value of a faulty probe
+#define TELEMETRY_PH_FAULT 0x0020    // ph is the last value of a faulty probe
+#define TELEMETRY_TEMP_FAULT 0x0040  // temperature_c is the last value of a faulty probe
+#define TELEMETRY_RING_DROPS 0x0100  // Readings were dropped between the cores since the last record
+#define TELEMETRY_ADC_OVERFLOW 0x0200 // ADC blocks were lost since the last record
+
+// One reporting period worth of measurements
+struct TelemetryRecord
+{
+    uint16_t sequence;     // Increments with every record, gaps mean lost frames
+    uint32_t timestamp_ms; // Milliseconds since boot
+    float tds_ppm;         // Temperature compensated TDS
+    float ph;              // pH
+    float temperature_c;   // Water temperature of the first probe
+    uint16_t status;       // TELEMETRY_* flags
+};
+
+// CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF)
+uint16_t crc16Ccitt(const uint8_t *data, size_t length, uint16_t crc = 0xFFFF);
+
+// COBS encode length bytes, out needs length + length / 254 + 1 bytes. Returns the encoded length
+size_t cobsEncode(const uint8_t *in, size_t length, uint8_t *out);
+
+// COBS decode one frame without delimiters, out needs length bytes. Returns the decoded length, 0 on malformed input
+size_t cobsDecode(const uint8_t *in, size_t length, uint8_t *out);
+
+// Build a complete delimited frame for a record, returns the frame length or 0 if capacity is too small
+size_t telemetryEncode(const TelemetryRecord &record, uint8_t *frame, size_t capacity);
+
+// Decode the bytes between two delimiters, false if the frame is malformed, fails the CRC or has another version
+bool telemetryDecode(const uint8_t *frame, size_t length, TelemetryRecord &record);
+
+// Longest batch frame around a block of length bytes
+inline size_t telemetryBatchFrameSize(size_t length) { return 1 + 2 + length + 2 + (1 + 2 + length + 2) / 254 + 1 + 2; }
+
+// Build a batch frame around a compressed block of count records, returns the frame length or 0 if it does not fit
+size_t telemetryEncodeBatch(const uint8_t *block, size_t length, uint16_t count, uint8_t *frame, size_t capacity);
+
+// Decode a batch frame into block (TELEMETRY_BATCH_MAX bytes), false if it is not a valid one
+bool telemetryDecodeBatch(const uint8_t *frame, size_t length, uint8_t *block, size_t &block_length, uint16_t &count);
+
+// Build a trace frame around a chunk of count events, returns the frame length or 0 if it does not fit
+size_t telemetryEncodeTrace(const uint8_t *chunk, size_t length, uint16_t count, uint8_t *frame, size_t capacity);
+
+// Decode a trace frame into chunk (TELEMETRY_BATCH_MAX bytes), false if it is not a valid one
+bool telemetryDecodeTrace(const uint8_t *frame, size_t length, uint8_t *chunk, size_t &chunk_length, uint16_t &count);
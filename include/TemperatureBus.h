@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+// ROM address of a probe on the OneWire bus (family code, serial, CRC)
+typedef uint8_t ProbeAddress[8];
+
+// Value the DS18B20 driver reports for a probe that did not answer
+#define PROBE_DISCONNECTED_C -127.0f
+
+// The handful of OneWire/DS18B20 operations the temperature engine needs.
+// On the board this wraps DallasTemperature, on the host a mock bus stands in.
+// Every call is expected to return after the bus transaction itself, none of
+// them may wait for a conversion to finish.
+class TemperatureBus
+{
+public:
+    virtual ~TemperatureBus() {}
+
+    // Scan the bus, returns the number of probes found
+    virtual uint8_t scan() = 0;
+
+    // Copy the ROM address of the probe found at index during the scan
+    virtual bool address(uint8_t index, ProbeAddress address) = 0;
+
+    // Set the conversion resolution (9 to 12 bits) of one probe
+    virtual bool setResolution(const ProbeAddress address, uint8_t bits) = 0;
+
+    // Start a conversion on one probe and return without waiting for it
+    virtual bool startConversion(const ProbeAddress address) = 0;
+
+    // Read the scratchpad of one probe, returns PROBE_DISCONNECTED_C if it did not answer
+    virtual float readCelsius(const ProbeAddress address) = 0;
+};
+
+// Worst case DS18B20 conversion time in microseconds for a resolution
+inline uint32_t probeConversionTimeUs(uint8_t bits)
+{
+    // 93.75 ms at 9 bits, doubling with every extra bit up to 750 ms at 12 bits
+    if (bits < 9)
+        bits = 9;
+    if (bits > 12)
+        bits = 12;
+    return 93750UL << (bits - 9);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include "TemperatureBus.h"
+#include "Scheduler.h"
+
+// Asynchronous DS18B20 engine.
+//
+// The bus is scanned once and the ROM addresses are cached, after that every
+// probe is addressed directly instead of being looked up by index. Each probe
+// has its own resolution and period and runs its own request -> wait -> read
+// cycle, so several conversions overlap and nothing ever waits on the bus.
+// A probe that does not answer is retried after one period, then after twice
+// as long for every further failure up to a limit, so a dead probe costs
+// almost no bus time; its first good read puts it back on its own period.
+class TemperatureEngine
+{
+public:
+    static const uint8_t MAX_PROBES = 4;                 // Probes are kept in a fixed table
+    static const uint8_t BACKOFF_DOUBLINGS = 6;          // A failing probe is retried at most 2^6 periods apart
+    static const uint32_t BACKOFF_MAX_US = 60000000UL;   // and never more than a minute, unless its period is longer
+
+    // Latest state of one probe
+    struct Probe
+    {
+        ProbeAddress address;   // Cached ROM address
+        uint8_t resolution;     // Conversion resolution in bits (9 to 12)
+        uint32_t period_us;     // Time between the starts of two conversions
+        uint8_t period_shift;   // The period is stretched by 2^shift while the temperature is quiet
+        bool converting;        // A conversion is running
+        uint32_t due_us;        // Next conversion start, or when the running conversion is done
+        uint32_t started_us;    // Start of the running or last conversion
+        float celsius;          // Latest reading
+        uint32_t timestamp_us;  // When the latest reading was taken
+        bool valid;             // The latest read returned a value
+        uint32_t reads;         // Number of completed reads
+        uint32_t failures;      // Number of reads where the probe did not answer
+        uint8_t missed;         // Failures since the last good read, sets the retry backoff
+    };
+
+    // Probe table that survives a deep sleep, enough to resume without scanning the bus
+    struct Snapshot
+    {
+        uint8_t probe_count;                  // Probes in use
+        ProbeAddress addresses[MAX_PROBES];   // Cached ROM addresses
+        uint8_t resolutions[MAX_PROBES];      // Resolution of every probe
+        uint32_t periods_us[MAX_PROBES];      // Period of every probe
+    };
+
+    TemperatureEngine(TemperatureBus &bus, SchedulerClock clock);
+
+    // Scan the bus, cache the addresses and apply the default resolution and period. Returns the probe count
+    uint8_t begin(uint32_t now_us, uint8_t resolution = 12, uint32_t period_ms = 1000);
+
+    // Change the resolution and period of one probe
+    bool configureProbe(uint8_t index, uint8_t resolution, uint32_t period_ms);
+
+    // Stretch the period of one probe by 2^shift, a shorter one applies to the conversion already waiting
+    bool setPeriodShift(uint8_t index, uint8_t shift);
+
+    // Keep the probe table, and take it back after a wake instead of calling begin(). Returns the probe count
+    void save(Snapshot &snapshot) const;
+    uint8_t resume(const Snapshot &snapshot, uint32_t now_us);
+
+    // Start and collect conversions that are due, returns microseconds until the next event
+    uint32_t step(uint32_t now_us);
+
+    // Scheduler step function, context is the engine
+    static uint32_t schedulerStep(void *context, uint32_t now_us);
+
+    uint8_t probeCount() const { return probe_count; }
+    const Probe &probe(uint8_t index) const { return probes[index]; }
+
+private:
+    // A start or read went unanswered, schedule the retry
+    void failed(Probe &probe, uint32_t now_us);
+
+    TemperatureBus &bus;        // Bus the probes live on
+    SchedulerClock clock;       // Used to time conversions from the end of the start command
+    Probe probes[MAX_PROBES];   // Cached probe table
+    uint8_t probe_count;        // Number of probes found by begin()
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Arduino.h>
+#include "AdcBlockSource.h"
+#include "SpscRing.h"
+
+// Continuous ADC sampling paced by a hardware timer.
+//
+// The timer interrupt only wakes a high priority sampling task, which reads
+// every configured pin once per tick and appends the result to that channel's
+// current block. Finished blocks are handed to the consumer through a lock-free
+// ring per channel. This works for ADC1 (GPIO34) and ADC2 (GPIO25) alike; the
+// ESP32's I2S DMA path can only scan ADC1, and ADC2 can not be read from an ISR.
+class TimerAdcSource : public AdcBlockSource
+{
+public:
+    static const uint8_t BLOCKS_PER_CHANNEL = 4; // Finished blocks buffered per channel, power of two
+
+    // timer_index picks one of the four hardware timers, core the core the sampling task runs on
+    explicit TimerAdcSource(uint8_t timer_index = 0, uint8_t core = 0);
+
+    bool begin(const uint8_t *pins, uint8_t channel_count, uint32_t sample_rate_hz) override;
+    bool readBlock(uint8_t channel, AdcBlock &block) override;
+    bool setRateShift(uint8_t channel, uint8_t shift) override;
+    uint32_t overflows() const override { return overflow_count; }
+    void pause() override;
+    void resume() override;
+
+    // Timer ticks the sampling task had not caught up with (missed samples)
+    uint32_t missedTicks() const { return missed_ticks; }
+
+private:
+    static void IRAM_ATTR onTimer();          // Timer interrupt, wakes the sampling task
+    static void samplingTask(void *context);  // Reads the pins once per tick
+    void sampleOnce();                        // One conversion per channel
+
+    static TimerAdcSource *active;            // Instance the interrupt belongs to
+
+    uint8_t timer_index;                      // Hardware timer used for pacing
+    uint8_t core;                             // Core of the sampling task
+    hw_timer_t *timer;                        // Timer handle
+    TaskHandle_t task;                        // Sampling task handle
+    uint8_t pins[MAX_CHANNELS];               // Pin of every channel
+    uint8_t channel_count;                    // Number of channels sampled
+    AdcBlock filling[MAX_CHANNELS];           // Block being filled per channel
+    volatile uint8_t requested_shift[MAX_CHANNELS]; // Rate shift set by setRateShift()
+    uint8_t block_shift[MAX_CHANNELS];        // Rate shift of the block being filled
+    uint32_t tick;                            // Sample clock ticks so far
+    SpscRing<AdcBlock, BLOCKS_PER_CHANNEL> finished[MAX_CHANNELS]; // Finished blocks per channel
+    volatile uint32_t overflow_count;         // Blocks dropped on a full ring
+    volatile uint32_t missed_ticks;           // Ticks that arrived while the task was still busy
+};
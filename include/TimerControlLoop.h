@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Arduino.h>
+#include "ControlTiming.h"
+
+// Fixed-rate control task paced by a hardware timer.
+//
+// Same pattern as TimerAdcSource: the timer interrupt only notifies a task,
+// here one of the highest priority on the loop core. Whatever the report,
+// the console or a flash write are doing on that core, the step preempts
+// them on the next tick, and the sensor I/O runs on the other core. Every
+// tick's lateness against the period grid, its run time and any missed ticks
+// go into a ControlTiming.
+typedef void (*ControlStep)(void *context, uint32_t now_us);
+
+class TimerControlLoop
+{
+public:
+    // timer_index picks one of the four hardware timers, core the core the control task runs on
+    TimerControlLoop(uint8_t timer_index, uint8_t core);
+
+    bool begin(uint32_t period_us, ControlStep step, void *context);
+
+    // Stop and restart the ticks, e.g. around a light sleep. A step in progress always finishes first
+    void pause();
+    void resume();
+
+    // Timing since the last reset, only written by the control task
+    const ControlTiming &timing() const { return ticks; }
+
+    // Ask the control task to clear the timing before its next step
+    void resetTiming() { reset_requested = true; }
+
+private:
+    static void IRAM_ATTR onTimer();          // Timer interrupt, wakes the control task
+    static void controlTask(void *context);   // Runs the step once per tick
+
+    static TimerControlLoop *active;          // Instance the interrupt belongs to
+
+    uint8_t timer_index;                      // Hardware timer used for pacing
+    uint8_t core;                             // Core of the control task
+    hw_timer_t *timer;                        // Timer handle
+    TaskHandle_t task;                        // Control task handle
+    uint32_t period_us;                       // Tick period
+    ControlStep step;                         // Step run on every tick
+    void *context;                            // Passed to the step
+    volatile uint32_t tick_us;                // Time of the latest interrupt
+    volatile bool reset_requested;            // Set by resetTiming()
+    bool restarted;                           // The next tick starts a new period grid
+    ControlTiming ticks;
+};
@@ -0,0 +1,79 @@
+#include "AdaptiveRate.h"
+#include <math.h>
+
+AdaptiveRate::AdaptiveRate()
+{
+    configure(AdaptiveRateConfig());
+}
+
+void AdaptiveRate::configure(const AdaptiveRateConfig &config)
+{
+    settings = config;
+    current = config.min_shift;
+    started = false;
+    last_us = 0;
+    fast = 0;
+    slow = 0;
+    variance = 0;
+    change_per_s = 0;
+    quiet_for_s = 0;
+}
+
+uint8_t AdaptiveRate::update(float value, uint32_t now_us)
+{
+    if (!started)
+    {
+        started = true;
+        last_us = now_us;
+        fast = slow = value;
+        return current;
+    }
+
+    // Weights from the time since the last value, so a slower rate does not slow the averages down
+    float dt = (int32_t)(now_us - last_us) / 1e6f;
+    last_us = now_us;
+    if (dt <= 0)
+        return current;
+    float fast_weight = 1.0f - expf(-dt / settings.fast_s);
+    float slow_weight = 1.0f - expf(-dt / settings.slow_s);
+    float offset = value - fast;
+    fast += fast_weight * offset;
+    slow += slow_weight * (value - slow);
+    variance += slow_weight * (offset * offset - variance);
+
+    // On a ramp the averages lag by slope times their time constant, the difference of the lags is the slope
+    change_per_s = (fast - slow) / (settings.slow_s - settings.fast_s);
+
+    float spread = deviation();
+    float change = fabsf(change_per_s);
+    if (spread > settings.busy_sd || change > settings.busy_slope)
+    {
+        current = settings.min_shift;
+        quiet_for_s = 0;
+    }
+    else if (spread < settings.quiet_sd && change < settings.quiet_slope)
+    {
+        quiet_for_s += dt;
+        if (quiet_for_s >= settings.hold_s && current < settings.max_shift)
+        {
+            current++;
+            quiet_for_s = 0;
+        }
+    }
+    else
+    {
+        quiet_for_s = 0;
+    }
+    return current;
+}
+
+void AdaptiveRate::boost()
+{
+    current = settings.min_shift;
+    quiet_for_s = 0;
+}
+
+float AdaptiveRate::deviation() const
+{
+    return sqrtf(variance);
+}
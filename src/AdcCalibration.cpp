@@ -0,0 +1,32 @@
+#include "AdcCalibration.h"
+
+void AdcCalibration::build(Curve curve, const void *context)
+{
+    for (uint16_t raw = 0; raw <= ADC_RAW_MAX; raw++)
+    {
+        uint32_t mv = curve(raw, context);
+        table[raw] = mv > UINT16_MAX ? UINT16_MAX : mv;
+    }
+    built = true;
+}
+
+float AdcCalibration::millivolts(uint32_t raw, uint8_t fraction_bits) const
+{
+    // The mean over [count - SMOOTHING, count + SMOOTHING] steps by exactly the slope below when count does, so
+    // the result is continuous. Near the ends the window stays inside the table and the line carries on
+    float position = raw * (1.0f / (1UL << fraction_bits));
+    if (position > ADC_RAW_MAX)
+        position = ADC_RAW_MAX;
+    int32_t count = (int32_t)position;
+    if (count < SMOOTHING)
+        count = SMOOTHING;
+    if (count > ADC_RAW_MAX - SMOOTHING - 1)
+        count = ADC_RAW_MAX - SMOOTHING - 1;
+
+    uint32_t sum = 0;
+    for (int32_t i = count - SMOOTHING; i <= count + SMOOTHING; i++)
+        sum += table[i];
+    const float width = 2 * SMOOTHING + 1;
+    float slope = ((int32_t)table[count + SMOOTHING + 1] - (int32_t)table[count - SMOOTHING]) / width;
+    return sum / width + slope * (position - count);
+}
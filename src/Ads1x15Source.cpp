@@ -0,0 +1,245 @@
+#include "Ads1x15Source.h"
+#include "AdcCalibration.h"
+#include "Profiler.h"
+
+// Registers
+#define ADS1X15_CONVERSION 0x00
+#define ADS1X15_CONFIG 0x01
+#define ADS1X15_LO_THRESH 0x02
+#define ADS1X15_HI_THRESH 0x03
+
+// Config register: single-ended input, ±4.096 V, comparator asserting ALERT/RDY low after every conversion
+#define ADS1X15_MUX_SINGLE 0x4000   // AINx against GND, plus the input << 12
+#define ADS1X15_PGA_4V096 0x0200
+#define ADS1X15_MODE_SINGLE 0x0100  // Single-shot, the device powers down after it
+#define ADS1X15_RATE_SHIFT 5
+#define ADS1X15_LONGEST_SHIFT 4     // A skipped input still gets a sixteenth of the scans
+#define ADS1X15_ROUND_BYTES 9       // Bytes on the bus per device and round, addresses included
+
+// Profiling - One round: the results of every device and their next conversions in one transaction
+PROFILE_STAGE(profile_ads, "ads1x15");
+
+// Conversions per second of the eight DR codes
+static const uint16_t ADS1115_RATES[8] = {8, 16, 32, 64, 128, 250, 475, 860};
+static const uint16_t ADS1015_RATES[8] = {128, 250, 490, 920, 1600, 2400, 3300, 3300};
+
+uint32_t ads1x15Millivolts(uint16_t raw, const void *context)
+{
+    return raw;
+}
+
+Ads1x15Source::Ads1x15Source(I2cBus &bus, const uint8_t *addresses, uint8_t device_count, Ads1x15Model model)
+    : bus(bus), device_count(device_count > ADS1X15_MAX_DEVICES ? ADS1X15_MAX_DEVICES : device_count), model(model),
+      rate_code(0), data_rate(0), channel_count(0), active_mask(0), ready_mask(0), running(false), overflow_count(0), counters()
+{
+    for (uint8_t i = 0; i < this->device_count; i++)
+        this->addresses[i] = addresses[i];
+}
+
+bool Ads1x15Source::begin(const uint8_t *pins, uint8_t channel_count, uint32_t sample_rate_hz)
+{
+    if (channel_count == 0 || channel_count > ADS1X15_MAX_CHANNELS || sample_rate_hz == 0)
+        return false;
+
+    // Spread the channels over their devices, the busiest device sets the data rate
+    uint8_t busiest = 0;
+    active_mask = 0;
+    for (uint8_t device = 0; device < ADS1X15_MAX_DEVICES; device++)
+    {
+        scan_count[device] = 0;
+        scan_position[device] = 0;
+        scan_pass[device] = 0;
+    }
+    for (uint8_t i = 0; i < channel_count; i++)
+    {
+        uint8_t device = pins[i] / ADS1X15_INPUTS;
+        if (device >= device_count || scan_count[device] == ADS1X15_INPUTS)
+            return false;
+        inputs[i] = pins[i] % ADS1X15_INPUTS;
+        scan[device][scan_count[device]++] = i;
+        if (scan_count[device] > busiest)
+            busiest = scan_count[device];
+        active_mask |= 1 << device;
+        filling[i].count = 0;
+        requested_shift[i] = 0;
+    }
+    this->channel_count = channel_count;
+
+    // A round moves nine bytes per device: pointer and result, then the next config. A conversion shorter than
+    // that would finish again before it is read and only load the bus
+    uint8_t devices = 0;
+    for (uint8_t device = 0; device < ADS1X15_MAX_DEVICES; device++)
+        devices += (active_mask >> device) & 1;
+    uint32_t round_us = (uint32_t)(ADS1X15_ROUND_BYTES * 9 * 1000000ULL * devices / ADS1X15_BUS_HZ);
+
+    const uint16_t *rates = model == ADS1115 ? ADS1115_RATES : ADS1015_RATES;
+    rate_code = 0;
+    for (uint8_t code = 1; code < 8; code++)
+    {
+        if (rates[code - 1] >= sample_rate_hz * busiest || 1000000UL / rates[code] < round_us)
+            break;
+        rate_code = code;
+    }
+    data_rate = rates[rate_code];
+
+    // Thresholds with the high MSB set and the low one clear turn ALERT/RDY into a conversion ready pulse
+    for (uint8_t device = 0; device < device_count; device++)
+    {
+        if (!(active_mask & (1 << device)))
+            continue;
+        const uint8_t lo[] = {ADS1X15_LO_THRESH, 0x00, 0x00};
+        const uint8_t hi[] = {ADS1X15_HI_THRESH, 0x80, 0x00};
+        const I2cTransfer thresholds[] = {{addresses[device], lo, sizeof(lo), NULL, 0}, {addresses[device], hi, sizeof(hi), NULL, 0}};
+        counters.transactions++;
+        if (!bus.transfer(thresholds, 2))
+            return false;
+    }
+    return start(true);
+}
+
+uint16_t Ads1x15Source::config(uint8_t input, bool continuous) const
+{
+    return ADS1X15_MUX_SINGLE | input << 12 | ADS1X15_PGA_4V096 | (continuous ? 0 : ADS1X15_MODE_SINGLE) |
+           rate_code << ADS1X15_RATE_SHIFT;
+}
+
+bool Ads1x15Source::start(bool continuous)
+{
+    // All devices in one transaction, so they start converting within a few bytes of each other
+    uint8_t writes[ADS1X15_MAX_DEVICES][3];
+    I2cTransfer transfers[ADS1X15_MAX_DEVICES];
+    uint8_t count = 0;
+    for (uint8_t device = 0; device < device_count; device++)
+    {
+        if (!(active_mask & (1 << device)))
+            continue;
+        if (continuous)
+            converting[device] = nextChannel(device);
+        uint16_t value = config(inputs[converting[device]], continuous);
+        writes[device][0] = ADS1X15_CONFIG;
+        writes[device][1] = value >> 8;
+        writes[device][2] = value & 0xFF;
+        transfers[count++] = {addresses[device], writes[device], 3, NULL, 0};
+    }
+    ready_mask = 0;
+    running = continuous;
+    counters.transactions++;
+    if (bus.transfer(transfers, count))
+        return true;
+    counters.bus_errors++;
+    return false;
+}
+
+uint8_t Ads1x15Source::nextChannel(uint8_t device)
+{
+    // Round robin over the device's inputs, an input with a shift only takes part in every 2^shift-th scan
+    uint8_t count = scan_count[device];
+    uint8_t channel = scan[device][0];
+    for (uint8_t tries = 0; tries < count << ADS1X15_LONGEST_SHIFT; tries++)
+    {
+        channel = scan[device][scan_position[device]];
+        uint16_t pass = scan_pass[device];
+        if (++scan_position[device] == count)
+        {
+            scan_position[device] = 0;
+            scan_pass[device]++;
+        }
+        uint8_t shift = requested_shift[channel] < ADS1X15_LONGEST_SHIFT ? requested_shift[channel] : ADS1X15_LONGEST_SHIFT;
+        if ((pass & ((1U << shift) - 1)) == 0)
+            break;
+    }
+    return channel;
+}
+
+bool Ads1x15Source::service(uint32_t now_us)
+{
+    PROFILE_SCOPE(profile_ads);
+    if (!running)
+        return false;
+    ready_mask = 0;
+
+    // Per device: point at the conversion register and read it, then write the config of the next input
+    static const uint8_t pointer[] = {ADS1X15_CONVERSION};
+    uint8_t results[ADS1X15_MAX_DEVICES][2];
+    uint8_t writes[ADS1X15_MAX_DEVICES][3];
+    uint8_t next[ADS1X15_MAX_DEVICES];
+    I2cTransfer transfers[2 * ADS1X15_MAX_DEVICES];
+    uint8_t count = 0;
+    for (uint8_t device = 0; device < device_count; device++)
+    {
+        if (!(active_mask & (1 << device)))
+            continue;
+        next[device] = nextChannel(device);
+        uint16_t value = config(inputs[next[device]], true);
+        writes[device][0] = ADS1X15_CONFIG;
+        writes[device][1] = value >> 8;
+        writes[device][2] = value & 0xFF;
+        transfers[count++] = {addresses[device], pointer, 1, results[device], 2};
+        transfers[count++] = {addresses[device], writes[device], 3, NULL, 0};
+    }
+    counters.rounds++;
+    counters.transactions++;
+    bool ok = bus.transfer(transfers, count);
+    if (!ok)
+        counters.bus_errors++;
+
+    for (uint8_t device = 0; device < device_count; device++)
+    {
+        if (!(active_mask & (1 << device)))
+            continue;
+        uint8_t channel = converting[device];
+        converting[device] = next[device];
+        if (!ok)
+            continue;
+
+        AdcBlock &block = filling[channel];
+        if (block.count == 0)
+            block.timestamp_us = now_us;
+        block.samples[block.count++] = millivolts((int16_t)(results[device][0] << 8 | results[device][1]));
+        counters.conversions++;
+        if (block.count == ADC_BLOCK_SIZE)
+        {
+            if (!finished[channel].push(block))
+                overflow_count++;
+            block.count = 0;
+        }
+    }
+    return ok;
+}
+
+uint16_t Ads1x15Source::millivolts(int16_t raw) const
+{
+    // 0.125 mV per count for the ADS1115, the ADS1015 has 2 mV steps in the upper twelve bits
+    int32_t millivolts = model == ADS1115 ? (raw + 4) >> 3 : (raw >> 4) * 2;
+    if (millivolts < 0)
+        return 0;
+    return millivolts > ADC_RAW_MAX ? ADC_RAW_MAX : millivolts;
+}
+
+bool Ads1x15Source::readBlock(uint8_t channel, AdcBlock &block)
+{
+    if (channel >= channel_count)
+        return false;
+    return finished[channel].pop(block);
+}
+
+bool Ads1x15Source::setRateShift(uint8_t channel, uint8_t shift)
+{
+    if (channel >= channel_count || shift > 15)
+        return false;
+    requested_shift[channel] = shift;
+    return true;
+}
+
+void Ads1x15Source::pause()
+{
+    // Single-shot mode without a start bit powers the devices down after the running conversion
+    start(false);
+}
+
+void Ads1x15Source::resume()
+{
+    for (uint8_t i = 0; i < channel_count; i++)
+        filling[i].count = 0;
+    start(true);
+}
@@ -0,0 +1,309 @@
+#include "Calibration.h"
+#include "ByteOrder.h"
+#include "Telemetry.h"
+#include <math.h>
+
+#define CALIBRATION_MAGIC 0x424C4143UL // "CALB"
+
+// Limits of a believable fit, the probe nominally gives -5.70 pH/V
+#define CALIBRATION_PH_SLOPE_MIN -9.0f
+#define CALIBRATION_PH_SLOPE_MAX -3.0f
+#define CALIBRATION_PH_MIN_VOLTS 0.01f  // Closest two buffers may read
+#define CALIBRATION_TDS_GAIN_MIN 0.5f
+#define CALIBRATION_TDS_GAIN_MAX 2.0f
+#define CALIBRATION_TDS_MIN_PPM 10.0f   // Closest two standards may read
+
+// Built-in probe line
+#define CALIBRATION_PH_SLOPE -5.70f
+#define CALIBRATION_PH_OFFSET 21.34f
+
+// Blob layout, little-endian, the CRC covers everything before it
+#define BLOB_MAGIC 0
+#define BLOB_VERSION 4
+#define BLOB_PH_POINTS 6
+#define BLOB_TDS_POINTS 7
+#define BLOB_PH_BREAK 8
+#define BLOB_PH_SLOPE 12
+#define BLOB_PH_OFFSET 20
+#define BLOB_TDS_MEASURED 28
+#define BLOB_TDS_ACTUAL 40
+#define BLOB_CRC 52
+
+// Points sorted by their reading, at most CALIBRATION_MAX_POINTS
+static void sortPoints(const CalibrationPoint *points, uint8_t count, CalibrationPoint *sorted)
+{
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint8_t j = i;
+        for (; j > 0 && sorted[j - 1].measured > points[i].measured; j--)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = points[i];
+    }
+}
+
+static bool phSlopeValid(float slope)
+{
+    return slope >= CALIBRATION_PH_SLOPE_MIN && slope <= CALIBRATION_PH_SLOPE_MAX;
+}
+
+static bool tdsGainValid(float gain)
+{
+    return gain >= CALIBRATION_TDS_GAIN_MIN && gain <= CALIBRATION_TDS_GAIN_MAX;
+}
+
+void calibrationDefaults(CalibrationCoefficients &coefficients)
+{
+    coefficients = CalibrationCoefficients();
+    coefficients.ph_slope[0] = coefficients.ph_slope[1] = CALIBRATION_PH_SLOPE;
+    coefficients.ph_offset[0] = coefficients.ph_offset[1] = CALIBRATION_PH_OFFSET;
+}
+
+CalibrationFit calibrationFitPh(const CalibrationPoint *points, uint8_t count, CalibrationCoefficients &coefficients)
+{
+    if (count == 0 || count > CALIBRATION_MAX_POINTS)
+        return CALIBRATION_FIT_NO_POINTS;
+    CalibrationPoint sorted[CALIBRATION_MAX_POINTS];
+    sortPoints(points, count, sorted);
+
+    // One buffer only moves the line, two or three give a line through each neighbouring pair
+    float slope[2];
+    float offset[2];
+    if (count == 1)
+    {
+        slope[0] = slope[1] = CALIBRATION_PH_SLOPE;
+    }
+    else
+    {
+        for (uint8_t line = 0; line + 1 < count; line++)
+        {
+            float span = sorted[line + 1].measured - sorted[line].measured;
+            if (span < CALIBRATION_PH_MIN_VOLTS)
+                return CALIBRATION_FIT_TOO_CLOSE;
+            slope[line] = (sorted[line + 1].actual - sorted[line].actual) / span;
+            if (!phSlopeValid(slope[line]))
+                return CALIBRATION_FIT_OUT_OF_RANGE;
+        }
+        if (count == 2)
+            slope[1] = slope[0];
+    }
+    offset[0] = sorted[0].actual - slope[0] * sorted[0].measured;
+    offset[1] = sorted[count - 1].actual - slope[1] * sorted[count - 1].measured;
+
+    coefficients.ph_points = count;
+    coefficients.ph_break_volts = count == 3 ? sorted[1].measured : 0;
+    for (uint8_t line = 0; line < 2; line++)
+    {
+        coefficients.ph_slope[line] = slope[line];
+        coefficients.ph_offset[line] = offset[line];
+    }
+    return CALIBRATION_FIT_OK;
+}
+
+CalibrationFit calibrationFitTds(const CalibrationPoint *points, uint8_t count, CalibrationCoefficients &coefficients)
+{
+    if (count == 0 || count > CALIBRATION_MAX_POINTS)
+        return CALIBRATION_FIT_NO_POINTS;
+    CalibrationPoint sorted[CALIBRATION_MAX_POINTS];
+    sortPoints(points, count, sorted);
+
+    // Every segment from 0 through the standards must have a believable gain
+    CalibrationPoint previous = {0, 0};
+    for (uint8_t i = 0; i < count; i++)
+    {
+        float span = sorted[i].measured - previous.measured;
+        if (span < CALIBRATION_TDS_MIN_PPM)
+            return CALIBRATION_FIT_TOO_CLOSE;
+        if (!tdsGainValid((sorted[i].actual - previous.actual) / span))
+            return CALIBRATION_FIT_OUT_OF_RANGE;
+        previous = sorted[i];
+    }
+
+    coefficients.tds_points = count;
+    for (uint8_t i = 0; i < CALIBRATION_MAX_POINTS; i++)
+    {
+        coefficients.tds_measured[i] = i < count ? sorted[i].measured : 0;
+        coefficients.tds_actual[i] = i < count ? sorted[i].actual : 0;
+    }
+    return CALIBRATION_FIT_OK;
+}
+
+float calibrationPh(const CalibrationCoefficients &coefficients, float volts)
+{
+    uint8_t line = volts < coefficients.ph_break_volts ? 0 : 1;
+    return coefficients.ph_slope[line] * volts + coefficients.ph_offset[line];
+}
+
+float calibrationTdsCorrect(const CalibrationCoefficients &coefficients, float ppm)
+{
+    // Interpolate between the standards, the last segment also covers everything above them
+    float from_measured = 0, from_actual = 0;
+    for (uint8_t i = 0; i < coefficients.tds_points; i++)
+    {
+        float to_measured = coefficients.tds_measured[i];
+        float to_actual = coefficients.tds_actual[i];
+        if (ppm < to_measured || i + 1 == coefficients.tds_points)
+            return from_actual + (ppm - from_measured) * (to_actual - from_actual) / (to_measured - from_measured);
+        from_measured = to_measured;
+        from_actual = to_actual;
+    }
+    return ppm;
+}
+
+size_t calibrationEncode(const CalibrationCoefficients &coefficients, uint8_t *blob)
+{
+    put32(blob + BLOB_MAGIC, CALIBRATION_MAGIC);
+    put16(blob + BLOB_VERSION, CALIBRATION_VERSION);
+    blob[BLOB_PH_POINTS] = coefficients.ph_points;
+    blob[BLOB_TDS_POINTS] = coefficients.tds_points;
+    putFloat(blob + BLOB_PH_BREAK, coefficients.ph_break_volts);
+    for (uint8_t line = 0; line < 2; line++)
+    {
+        putFloat(blob + BLOB_PH_SLOPE + 4 * line, coefficients.ph_slope[line]);
+        putFloat(blob + BLOB_PH_OFFSET + 4 * line, coefficients.ph_offset[line]);
+    }
+    for (uint8_t i = 0; i < CALIBRATION_MAX_POINTS; i++)
+    {
+        putFloat(blob + BLOB_TDS_MEASURED + 4 * i, coefficients.tds_measured[i]);
+        putFloat(blob + BLOB_TDS_ACTUAL + 4 * i, coefficients.tds_actual[i]);
+    }
+    put16(blob + BLOB_CRC, crc16Ccitt(blob, BLOB_CRC));
+    return CALIBRATION_BLOB_SIZE;
+}
+
+// A blob that passed its CRC still has to describe a calibration the fits could have produced
+static bool coefficientsValid(const CalibrationCoefficients &coefficients)
+{
+    if (coefficients.ph_points > CALIBRATION_MAX_POINTS || coefficients.tds_points > CALIBRATION_MAX_POINTS)
+        return false;
+    for (uint8_t line = 0; line < 2; line++)
+    {
+        if (!phSlopeValid(coefficients.ph_slope[line]) || !isfinite(coefficients.ph_offset[line]))
+            return false;
+    }
+    if (!isfinite(coefficients.ph_break_volts))
+        return false;
+    float previous_measured = 0, previous_actual = 0;
+    for (uint8_t i = 0; i < coefficients.tds_points; i++)
+    {
+        float span = coefficients.tds_measured[i] - previous_measured;
+        if (!(span >= CALIBRATION_TDS_MIN_PPM) || !tdsGainValid((coefficients.tds_actual[i] - previous_actual) / span))
+            return false;
+        previous_measured = coefficients.tds_measured[i];
+        previous_actual = coefficients.tds_actual[i];
+    }
+    return true;
+}
+
+CalibrationLoad calibrationDecode(const uint8_t *blob, size_t length, CalibrationCoefficients &coefficients)
+{
+    calibrationDefaults(coefficients);
+    if (length == 0)
+        return CALIBRATION_EMPTY;
+
+    // The version is checked before the size, a later firmware may store a longer blob
+    if (length < BLOB_PH_POINTS || get32(blob + BLOB_MAGIC) != CALIBRATION_MAGIC)
+        return CALIBRATION_CORRUPT;
+    if (get16(blob + BLOB_VERSION) != CALIBRATION_VERSION)
+        return CALIBRATION_UNKNOWN_VERSION;
+    if (length != CALIBRATION_BLOB_SIZE || get16(blob + BLOB_CRC) != crc16Ccitt(blob, BLOB_CRC))
+        return CALIBRATION_CORRUPT;
+
+    CalibrationCoefficients stored;
+    stored.ph_points = blob[BLOB_PH_POINTS];
+    stored.tds_points = blob[BLOB_TDS_POINTS];
+    stored.ph_break_volts = getFloat(blob + BLOB_PH_BREAK);
+    for (uint8_t line = 0; line < 2; line++)
+    {
+        stored.ph_slope[line] = getFloat(blob + BLOB_PH_SLOPE + 4 * line);
+        stored.ph_offset[line] = getFloat(blob + BLOB_PH_OFFSET + 4 * line);
+    }
+    for (uint8_t i = 0; i < CALIBRATION_MAX_POINTS; i++)
+    {
+        stored.tds_measured[i] = getFloat(blob + BLOB_TDS_MEASURED + 4 * i);
+        stored.tds_actual[i] = getFloat(blob + BLOB_TDS_ACTUAL + 4 * i);
+    }
+    if (!coefficientsValid(stored))
+        return CALIBRATION_CORRUPT;
+    coefficients = stored;
+    return CALIBRATION_LOADED;
+}
+
+const char *calibrationFitName(CalibrationFit fit)
+{
+    switch (fit)
+    {
+    case CALIBRATION_FIT_OK:
+        return "ok";
+    case CALIBRATION_FIT_NO_POINTS:
+        return "no points";
+    case CALIBRATION_FIT_TOO_CLOSE:
+        return "points too close";
+    case CALIBRATION_FIT_OUT_OF_RANGE:
+        return "slope out of range";
+    }
+    return "unknown";
+}
+
+const char *calibrationLoadName(CalibrationLoad load)
+{
+    switch (load)
+    {
+    case CALIBRATION_LOADED:
+        return "loaded";
+    case CALIBRATION_EMPTY:
+        return "none stored";
+    case CALIBRATION_CORRUPT:
+        return "corrupt";
+    case CALIBRATION_UNKNOWN_VERSION:
+        return "unknown version";
+    }
+    return "unknown";
+}
+
+CalibrationLoad calibrationLoad(CalibrationStore &store, CalibrationCoefficients &coefficients)
+{
+    // Room for the header of a longer blob from a later version
+    uint8_t blob[CALIBRATION_BLOB_SIZE * 2];
+    size_t length = store.read(blob, sizeof(blob));
+    if (length > sizeof(blob))
+    {
+        calibrationDefaults(coefficients);
+        return CALIBRATION_CORRUPT;
+    }
+    return calibrationDecode(blob, length, coefficients);
+}
+
+bool calibrationSave(CalibrationStore &store, const CalibrationCoefficients &coefficients)
+{
+    uint8_t blob[CALIBRATION_BLOB_SIZE];
+    return store.write(blob, calibrationEncode(coefficients, blob));
+}
+
+CalibrationCurves::CalibrationCurves()
+{
+    CalibrationCoefficients coefficients;
+    calibrationDefaults(coefficients);
+    build(coefficients);
+}
+
+void CalibrationCurves::build(const CalibrationCoefficients &coefficients)
+{
+    typedef SensorNumTraits<SensorNum> Traits;
+    ph_break = Traits::fromFloat(coefficients.ph_break_volts);
+    for (uint8_t line = 0; line < 2; line++)
+    {
+        ph_slope[line] = Traits::fromFloat(coefficients.ph_slope[line]);
+        ph_offset[line] = Traits::fromFloat(coefficients.ph_offset[line]);
+    }
+
+    // Sample the cubic and the correction in float at every segment boundary
+    const float volts_per_segment = 1.0f / CALIBRATION_TDS_SEGMENTS_PER_VOLT;
+    float start = 0;
+    for (uint8_t segment = 0; segment < CALIBRATION_TDS_SEGMENTS; segment++)
+    {
+        float end = calibrationTdsCorrect(coefficients, SensorMathPolicy<float>::tdsPpm((segment + 1) * volts_per_segment));
+        tds_base[segment] = Traits::fromFloat(start);
+        tds_step[segment] = Traits::fromFloat(end - start);
+        start = end;
+    }
+}
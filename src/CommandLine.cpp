@@ -0,0 +1,54 @@
+#include "CommandLine.h"
+#include <string.h>
+
+CommandLine::CommandLine(const Command *commands, uint8_t command_count)
+    : commands(commands), command_count(command_count), length(0), overflowed(false)
+{
+}
+
+bool CommandLine::feed(char c)
+{
+    if (c == '\r' || c == '\n')
+    {
+        // Either line ending completes the line, the second half of CR LF is an empty line and ignored
+        bool dispatched = false;
+        if (length > 0 && !overflowed)
+        {
+            line[length] = 0;
+            dispatched = execute(line);
+        }
+        length = 0;
+        overflowed = false;
+        return dispatched;
+    }
+
+    if (length < LINE_SIZE - 1)
+        line[length++] = c;
+    else
+        overflowed = true;
+    return false;
+}
+
+bool CommandLine::execute(char *text)
+{
+    // Split off the first word
+    while (*text == ' ')
+        text++;
+    char *args = text;
+    while (*args && *args != ' ')
+        args++;
+    if (*args)
+        *args++ = 0;
+    while (*args == ' ')
+        args++;
+
+    for (uint8_t i = 0; i < command_count; i++)
+    {
+        if (strcmp(commands[i].name, text) == 0)
+        {
+            commands[i].handler(args);
+            return true;
+        }
+    }
+    return false;
+}
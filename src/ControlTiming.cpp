@@ -0,0 +1,41 @@
+#include "ControlTiming.h"
+
+void ControlTiming::reset()
+{
+    totals = ControlTimingStats();
+    totals.lateness_min_us = UINT32_MAX;
+}
+
+void ControlTiming::record(uint32_t lateness_us, uint32_t run_us, uint32_t missed)
+{
+    totals.ticks++;
+    totals.missed += missed;
+    if (lateness_us < totals.lateness_min_us)
+        totals.lateness_min_us = lateness_us;
+    if (lateness_us > totals.lateness_max_us)
+        totals.lateness_max_us = lateness_us;
+    totals.lateness_sum_us += lateness_us;
+    if (run_us > totals.run_max_us)
+        totals.run_max_us = run_us;
+
+    // Bucket of the highest set bit, 0 us goes into the first one
+    uint8_t bucket = 0;
+    while (bucket < CONTROL_JITTER_BUCKETS - 1 && (lateness_us >> bucket) != 0)
+        bucket++;
+    totals.histogram[bucket]++;
+}
+
+uint32_t ControlTiming::percentile(uint8_t percent) const
+{
+    if (totals.ticks == 0)
+        return 0;
+    uint64_t wanted = ((uint64_t)totals.ticks * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (uint8_t bucket = 0; bucket < CONTROL_JITTER_BUCKETS - 1; bucket++)
+    {
+        seen += totals.histogram[bucket];
+        if (seen >= wanted)
+            return 1UL << bucket;
+    }
+    return totals.lateness_max_us;
+}
@@ -0,0 +1,30 @@
+#include "Decimator.h"
+#include <math.h>
+
+void decimatorLowpass(int16_t *coefficients, uint8_t taps, float cutoff)
+{
+    // Blackman windowed sinc, evaluated once when the decimator is built. Only the first half is computed and
+    // mirrored, so the taps are symmetric to the bit
+    float real[128];
+    float total = 0;
+    float middle = (taps - 1) * 0.5f;
+    for (uint8_t i = 0; i < taps / 2; i++)
+    {
+        float t = i - middle;
+        float sinc = 2 * cutoff * (t == 0 ? 1.0f : sinf(2 * (float)M_PI * cutoff * t) / (2 * (float)M_PI * cutoff * t));
+        float phase = 2 * (float)M_PI * i / (taps - 1);
+        real[i] = sinc * (0.42f - 0.5f * cosf(phase) + 0.08f * cosf(2 * phase));
+        total += real[i];
+    }
+
+    // Q15 with a DC gain of exactly one, each half sums to 16384 and the rounding error goes to the middle taps
+    int32_t sum = 0;
+    for (uint8_t i = 0; i < taps / 2; i++)
+    {
+        coefficients[i] = (int16_t)lroundf(real[i] / total * 16384);
+        sum += coefficients[i];
+    }
+    coefficients[taps / 2 - 1] += 16384 - sum;
+    for (uint8_t i = 0; i < taps / 2; i++)
+        coefficients[taps - 1 - i] = coefficients[i];
+}
@@ -0,0 +1,164 @@
+#include "DosingController.h"
+#include <math.h>
+
+// Doses shorter than this much pump time are not worth starting the motor for
+#define DOSING_MIN_PUMP_MS 20
+
+// Weight of the newest drift observation. The drift is a few percent of the probe noise per evaluation,
+// so the estimate averages over about fifty evaluations
+#define DOSING_DRIFT_WEIGHT 0.02f
+
+DosingController::DosingController(const DosingConfig &config) : settings(config)
+{
+    enable(false);
+    resetStats();
+}
+
+void DosingController::enable(bool on)
+{
+    active = on;
+    pumping = false;
+    scheduled = false;
+    holding = false;
+    have_measurement = false;
+    have_previous = false;
+    integral_ml = 0;
+    drift_per_s = 0;
+    last_dose_ml = 0;
+    pending_effect = 0;
+    budget_ml = settings.max_dose_ml;
+    budget_ms = 0;
+}
+
+void DosingController::measure(float value, uint32_t now_ms)
+{
+    measured = value;
+    measured_ms = now_ms;
+    have_measurement = true;
+}
+
+bool DosingController::tick(uint32_t now_ms)
+{
+    if (!active)
+        return false;
+
+    // Finish the running dose first, nothing is evaluated while the pump runs
+    if (pumping)
+    {
+        if ((int32_t)(now_ms - pump_until_ms) < 0)
+            return true;
+        pumping = false;
+    }
+
+    if (!scheduled)
+    {
+        next_ms = now_ms;
+        budget_ms = now_ms;
+        scheduled = true;
+    }
+    if ((int32_t)(now_ms - next_ms) < 0)
+        return false;
+
+    // Stay on the period grid, resynchronise after a stall
+    next_ms += settings.period_ms;
+    if ((int32_t)(now_ms - next_ms) >= 0)
+        next_ms = now_ms + settings.period_ms;
+
+    float dose_ml = evaluate(now_ms);
+    if (dose_ml <= 0)
+        return false;
+    pumping = true;
+    pump_until_ms = now_ms + (uint32_t)(dose_ml / settings.pump_ml_per_s * 1000.0f);
+    return true;
+}
+
+float DosingController::evaluate(uint32_t now_ms)
+{
+    // Rate limit tokens accrue all the time, up to one full dose
+    budget_ml += (now_ms - budget_ms) * (settings.max_ml_per_hour / 3600000.0f);
+    if (budget_ml > settings.max_dose_ml)
+        budget_ml = settings.max_dose_ml;
+    budget_ms = now_ms;
+
+    if (!have_measurement || now_ms - measured_ms > settings.max_age_ms)
+    {
+        totals.stale++;
+        have_previous = false;
+        return 0;
+    }
+    if (holding)
+    {
+        if ((int32_t)(now_ms - hold_until_ms) < 0)
+        {
+            totals.held++;
+            return 0;
+        }
+        holding = false;
+    }
+    totals.evaluations++;
+
+    // Error as the dose that would close it once mixed in
+    float response = settings.response_per_ml;
+    float error = settings.setpoint - measured;
+    if (fabsf(error) < settings.deadband)
+        error = 0;
+    float error_ml = error / response;
+
+    // Change since the previous evaluation: the derivative, and with the doses taken out the drift
+    float derivative_ml = 0;
+    if (have_previous)
+    {
+        float elapsed_s = (now_ms - previous_ms) / 1000.0f;
+        float change = measured - previous_value;
+        float drift = (change - pending_effect) / elapsed_s;
+        drift_per_s += DOSING_DRIFT_WEIGHT * (drift - drift_per_s);
+        derivative_ml = -change / response / elapsed_s;
+    }
+    previous_value = measured;
+    previous_ms = now_ms;
+    have_previous = true;
+    pending_effect = 0;
+
+    // Feed-forward the drift expected until the next evaluation after a dose has mixed in
+    float horizon_s = (settings.period_ms + settings.mixing_ms) / 1000.0f;
+    float feed_forward_ml = -settings.kff * drift_per_s * horizon_s / response;
+
+    float proportional_ml = settings.kp * error_ml;
+    float damping_ml = settings.kd * derivative_ml;
+    float candidate_ml = integral_ml + settings.ki * error_ml * (settings.period_ms / 1000.0f);
+    float output_ml = proportional_ml + candidate_ml + damping_ml + feed_forward_ml;
+
+    // Anti-windup: drop the new integral if the output is already against the limit the error pushes it to.
+    // The rate limit counts as a limit too, it is what holds the output down during a long correction
+    float limit_ml = budget_ml < settings.max_dose_ml ? budget_ml : settings.max_dose_ml;
+    bool pinned = (output_ml > limit_ml && error_ml > 0) || (output_ml < 0 && error_ml < 0);
+    if (!settings.anti_windup || !pinned)
+        integral_ml = candidate_ml;
+    output_ml = proportional_ml + integral_ml + damping_ml + feed_forward_ml;
+
+    if (output_ml > settings.max_dose_ml)
+    {
+        output_ml = settings.max_dose_ml;
+        totals.saturated++;
+    }
+    if (output_ml > budget_ml)
+    {
+        output_ml = budget_ml;
+        totals.rate_limited++;
+    }
+    if (output_ml * 1000.0f < DOSING_MIN_PUMP_MS * settings.pump_ml_per_s)
+    {
+        last_dose_ml = 0;
+        return 0;
+    }
+
+    // Dose, and hold until it has mixed in
+    budget_ml -= output_ml;
+    pending_effect = output_ml * response;
+    last_dose_ml = output_ml;
+    totals.doses++;
+    totals.dosed_ml += output_ml;
+    holding = true;
+    hold_until_ms = now_ms + (uint32_t)(output_ml / settings.pump_ml_per_s * 1000.0f) + settings.mixing_ms;
+    return output_ml;
+}
@@ -0,0 +1,60 @@
+#include "DutyCycle.h"
+
+// Every channel the window waits for
+#define DUTY_ALL_CHANNELS ((1 << DUTY_CHANNELS) - 1)
+
+DutyCycle::DutyCycle(uint32_t period_ms, uint32_t window_ms)
+    : period_us(period_ms * 1000UL), window_us(window_ms * 1000UL), wake_us(0), seen(0)
+{
+    resetStats();
+}
+
+void DutyCycle::resetStats()
+{
+    totals = DutyCycleStats();
+    for (uint8_t i = 0; i < DUTY_CHANNELS; i++)
+        totals.latency[i].min_us = UINT32_MAX;
+}
+
+void DutyCycle::wake(uint32_t now_us)
+{
+    wake_us = now_us;
+    seen = 0;
+}
+
+void DutyCycle::reading(ReadingChannel channel, uint8_t index, uint32_t now_us)
+{
+    // Only the compensation probe counts for the temperature
+    if (channel >= DUTY_CHANNELS || index != 0 || (seen & (1 << channel)))
+        return;
+    seen |= 1 << channel;
+
+    uint32_t latency_us = now_us - wake_us;
+    WakeLatency &latency = totals.latency[channel];
+    latency.count++;
+    latency.last_us = latency_us;
+    if (latency_us < latency.min_us)
+        latency.min_us = latency_us;
+    if (latency_us > latency.max_us)
+        latency.max_us = latency_us;
+    latency.sum_us += latency_us;
+}
+
+bool DutyCycle::windowDone(uint32_t now_us) const
+{
+    return seen == DUTY_ALL_CHANNELS || now_us - wake_us >= window_us;
+}
+
+uint32_t DutyCycle::sleepUs(uint32_t now_us)
+{
+    uint32_t awake_us = now_us - wake_us;
+    totals.windows++;
+    if (seen != DUTY_ALL_CHANNELS)
+        totals.timeouts++;
+    totals.awake_us += awake_us;
+
+    // A window that overran its period still sleeps a little, otherwise the chip never rests
+    uint32_t sleep_us = awake_us + 1000UL < period_us ? period_us - awake_us : 1000UL;
+    totals.asleep_us += sleep_us;
+    return sleep_us;
+}
@@ -0,0 +1,256 @@
+#include "FlashLog.h"
+#include "ByteOrder.h"
+
+#define SEGMENT_MAGIC 0x474F4C48UL // "HLOG"
+#define CHUNK_MAGIC 0xC0DA
+
+// Log time wraps after 49 days, the log only ever spans hours, so compare with a signed difference
+static inline bool before(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+
+FlashLog::FlashLog(FlashStore &store, uint8_t segment_count, uint32_t segment_size)
+    : store(store), segment_count(segment_count), segment_size(segment_size), active(-1), active_torn(false), time_base(0),
+      chunks_written(0), bytes_written(0), write_failures(0), dropped_records(0)
+{
+}
+
+bool FlashLog::begin(uint32_t uptime_ms)
+{
+    // Every segment must hold its header and at least one full chunk
+    if (segment_count == 0 || segment_count > MAX_SEGMENTS || segment_size < FLASH_LOG_SEGMENT_HEADER_SIZE + sizeof(chunk))
+        return false;
+    encoder.begin(chunk + FLASH_LOG_CHUNK_HEADER_SIZE, FLASH_LOG_CHUNK_BYTES);
+
+    // The newest generation is where the log continues, the latest timestamp is where the log time continues
+    active = -1;
+    uint32_t newest_ms = 0;
+    bool have_records = false;
+    for (uint8_t slot = 0; slot < segment_count; slot++)
+    {
+        mountSegment(slot);
+        const Segment &segment = segments[slot];
+        if (segment.generation != 0 && (active < 0 || segment.generation > segments[active].generation))
+            active = slot;
+        if (segment.records > 0 && (!have_records || before(newest_ms, segment.last_ms)))
+        {
+            newest_ms = segment.last_ms;
+            have_records = true;
+        }
+    }
+
+    // Anything behind the last valid chunk is a torn write, never append behind it
+    active_torn = active >= 0 && segments[active].end < store.size(active);
+    time_base = have_records ? newest_ms + 1 - uptime_ms : 0;
+    return true;
+}
+
+void FlashLog::mountSegment(uint8_t slot)
+{
+    Segment &segment = segments[slot];
+    segment = Segment();
+
+    // A slot without a valid header is unused
+    uint8_t header[FLASH_LOG_SEGMENT_HEADER_SIZE];
+    if (store.read(slot, 0, header, sizeof(header)) != sizeof(header) || get32(header) != SEGMENT_MAGIC ||
+        header[4] != FLASH_LOG_VERSION || get16(header + 14) != crc16Ccitt(header, 14))
+        return;
+    segment.generation = get32(header + 6);
+    segment.wear = get32(header + 10);
+    segment.end = FLASH_LOG_SEGMENT_HEADER_SIZE;
+
+    // Walk the chunk headers. Appends only ever go to the end of a slot, so a torn chunk is the
+    // last thing in it and is shorter than its header says; payload CRCs are checked when scanning
+    uint32_t size = store.size(slot);
+    uint16_t count, payload, payload_crc;
+    uint32_t first_ms, last_ms;
+    while (readChunkHeader(slot, segment.end, count, payload, first_ms, last_ms, payload_crc))
+    {
+        uint32_t length = FLASH_LOG_CHUNK_HEADER_SIZE + payload;
+        if (segment.end + length > size)
+            break;
+        if (segment.records == 0)
+            segment.first_ms = first_ms;
+        segment.last_ms = last_ms;
+        segment.records += count;
+        segment.end += length;
+    }
+}
+
+bool FlashLog::readChunkHeader(uint8_t slot, uint32_t offset, uint16_t &count, uint16_t &length, uint32_t &first_ms,
+                               uint32_t &last_ms, uint16_t &payload_crc)
+{
+    uint8_t header[FLASH_LOG_CHUNK_HEADER_SIZE];
+    if (store.read(slot, offset, header, sizeof(header)) != sizeof(header))
+        return false;
+    if (get16(header) != CHUNK_MAGIC || get16(header + 16) != crc16Ccitt(header, 16))
+        return false;
+    count = get16(header + 2);
+    length = get16(header + 4);
+    first_ms = get32(header + 6);
+    last_ms = get32(header + 10);
+    payload_crc = get16(header + 14);
+    return count > 0 && length > 0 && length <= FLASH_LOG_CHUNK_BYTES;
+}
+
+bool FlashLog::append(const TelemetryRecord &record, uint32_t uptime_ms)
+{
+    TelemetryRecord stamped = record;
+    stamped.timestamp_ms = logTime(uptime_ms);
+    if (encoder.append(stamped))
+        return true;
+
+    // The chunk is full: write it and start the next one with this record. The chunk only
+    // stays full when writing failed, then the newest record is the one we lose
+    if (!flush())
+    {
+        dropped_records++;
+        return false;
+    }
+    return encoder.append(stamped);
+}
+
+bool FlashLog::flush()
+{
+    uint16_t count = encoder.count();
+    if (count == 0)
+        return true;
+
+    // Start a new segment when there is none yet, the last one is torn or the chunk does not fit
+    uint16_t payload = encoder.size();
+    uint32_t length = FLASH_LOG_CHUNK_HEADER_SIZE + payload;
+    if ((active < 0 || active_torn || segments[active].end + length > segment_size) && !rotate())
+    {
+        write_failures++;
+        return false;
+    }
+
+    // The records are already compressed behind the header space
+    uint32_t first_ms = encoder.firstMs();
+    uint32_t last_ms = encoder.lastMs();
+    uint8_t *p = put16(chunk, CHUNK_MAGIC);
+    p = put16(p, count);
+    p = put16(p, payload);
+    p = put32(p, first_ms);
+    p = put32(p, last_ms);
+    p = put16(p, crc16Ccitt(chunk + FLASH_LOG_CHUNK_HEADER_SIZE, payload));
+    put16(p, crc16Ccitt(chunk, 16));
+
+    // One append per chunk, a failure may have left part of it behind so the segment is done
+    if (!store.append(active, chunk, length))
+    {
+        active_torn = true;
+        write_failures++;
+        return false;
+    }
+
+    Segment &segment = segments[active];
+    if (segment.records == 0)
+        segment.first_ms = first_ms;
+    segment.last_ms = last_ms;
+    segment.records += count;
+    segment.end += length;
+    chunks_written++;
+    bytes_written += length;
+    encoder.begin(chunk + FLASH_LOG_CHUNK_HEADER_SIZE, FLASH_LOG_CHUNK_BYTES);
+    return true;
+}
+
+bool FlashLog::rotate()
+{
+    // Round-robin over the slots, the next one holds the oldest history
+    uint8_t next = active < 0 ? 0 : (active + 1) % segment_count;
+    uint32_t generation = active < 0 ? 1 : segments[active].generation + 1;
+    Segment &segment = segments[next];
+    uint32_t wear = segment.wear + 1;
+
+    if (!store.erase(next))
+        return false;
+    segment = Segment();
+    segment.wear = wear;
+
+    uint8_t header[FLASH_LOG_SEGMENT_HEADER_SIZE];
+    uint8_t *p = put32(header, SEGMENT_MAGIC);
+    *p++ = FLASH_LOG_VERSION;
+    *p++ = 0;
+    p = put32(p, generation);
+    p = put32(p, wear);
+    put16(p, crc16Ccitt(header, 14));
+    if (!store.append(next, header, sizeof(header)))
+        return false;
+
+    segment.generation = generation;
+    segment.end = sizeof(header);
+    active = next;
+    active_torn = false;
+    bytes_written += sizeof(header);
+    return true;
+}
+
+uint32_t FlashLog::scan(uint32_t from_ms, uint32_t to_ms, FlashLogVisitor visitor, void *context)
+{
+    uint32_t visited = 0;
+
+    // The slot after the active one is the oldest, segments rotate round-robin
+    for (uint8_t i = 1; active >= 0 && i <= segment_count; i++)
+    {
+        uint8_t slot = (active + i) % segment_count;
+        const Segment &segment = segments[slot];
+        if (segment.records == 0 || before(segment.last_ms, from_ms))
+            continue;
+        if (before(to_ms, segment.first_ms))
+            return visited;
+
+        uint32_t offset = FLASH_LOG_SEGMENT_HEADER_SIZE;
+        uint16_t count, payload, payload_crc;
+        uint32_t first_ms, last_ms;
+        while (offset < segment.end && readChunkHeader(slot, offset, count, payload, first_ms, last_ms, payload_crc))
+        {
+            // Skip whole chunks before the range, stop at the first one after it
+            uint32_t length = FLASH_LOG_CHUNK_HEADER_SIZE + payload;
+            if (before(last_ms, from_ms))
+            {
+                offset += length;
+                continue;
+            }
+            if (before(to_ms, first_ms))
+                return visited;
+
+            // Only records whose payload passes the CRC are handed out
+            if (store.read(slot, offset + FLASH_LOG_CHUNK_HEADER_SIZE, scan_block, payload) != payload ||
+                payload_crc != crc16Ccitt(scan_block, payload))
+                break;
+            if (!scanBlock(scan_block, payload, count, from_ms, to_ms, visitor, context, visited))
+                return visited;
+            offset += length;
+        }
+    }
+
+    // Then whatever is still waiting in RAM
+    scanBlock(chunk + FLASH_LOG_CHUNK_HEADER_SIZE, encoder.size(), encoder.count(), from_ms, to_ms, visitor, context, visited);
+    return visited;
+}
+
+bool FlashLog::scanBlock(const uint8_t *block, uint16_t length, uint16_t count, uint32_t from_ms, uint32_t to_ms,
+                         FlashLogVisitor visitor, void *context, uint32_t &visited)
+{
+    SeriesDecoder decoder(block, length, count);
+    TelemetryRecord record;
+    while (decoder.next(record))
+    {
+        if (before(record.timestamp_ms, from_ms))
+            continue;
+        if (before(to_ms, record.timestamp_ms))
+            return false;
+        visited++;
+        if (!visitor(record, context))
+            return false;
+    }
+    return true;
+}
+
+uint32_t FlashLog::storedRecords() const
+{
+    uint32_t records = 0;
+    for (uint8_t slot = 0; slot < segment_count; slot++)
+        records += segments[slot].records;
+    return records;
+}
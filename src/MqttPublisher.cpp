@@ -0,0 +1,332 @@
+#include "MqttPublisher.h"
+#include <string.h>
+
+// Control packet types, the high nibble of the fixed header
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+
+// Flags of a PUBLISH
+#define MQTT_DUP 0x08
+#define MQTT_QOS1 0x02
+
+// Protocol name, level 4 (3.1.1) and clean session
+static const uint8_t MQTT_CONNECT_HEADER[] = {0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02};
+
+MqttPublisher::MqttPublisher(NetworkTransport &transport, const MqttConfig &config)
+    : transport(transport), config(config), current(MQTT_DISCONNECTED), counters(), batch_start_ms(0), head(0), count(0),
+      inflight(0), next_packet_id(1), since_ms(0), retry_ms(0), retry_delay_ms(config.retry_min_ms), backoff(false),
+      sent_ms(0), waiting_ms(0), ping_pending(false), tx_length(0), tx_done(0), rx_stage(0), rx_type(0), rx_shift(0),
+      rx_remaining(0), rx_read(0)
+{
+    encoder.begin(block, sizeof(block));
+}
+
+void MqttPublisher::add(const TelemetryRecord &record, uint32_t now_ms)
+{
+    counters.records++;
+    if (encoder.count() == 0)
+        batch_start_ms = now_ms;
+
+    // A full block is sealed and the record opens the next one
+    if (!encoder.append(record))
+    {
+        seal();
+        batch_start_ms = now_ms;
+        encoder.append(record);
+    }
+    if (encoder.count() >= config.batch_records)
+        seal();
+}
+
+void MqttPublisher::flush()
+{
+    seal();
+}
+
+void MqttPublisher::seal()
+{
+    if (encoder.count() == 0)
+        return;
+
+    // A full queue gives up its oldest message, also one in flight: its late acknowledgement then matches nothing
+    if (count == MQTT_QUEUE_MESSAGES)
+    {
+        counters.dropped++;
+        counters.dropped_records += queue[head].records;
+        head = (head + 1) % MQTT_QUEUE_MESSAGES;
+        count--;
+        if (inflight > 0)
+            inflight--;
+    }
+
+    Message &message = queue[(head + count) % MQTT_QUEUE_MESSAGES];
+    message.packet_id = next_packet_id;
+    next_packet_id = next_packet_id == UINT16_MAX ? 1 : next_packet_id + 1;
+    message.records = encoder.count();
+    message.sent = false;
+    message.length = telemetryEncodeBatch(block, encoder.size(), encoder.count(), message.payload, sizeof(message.payload));
+    count++;
+    counters.messages++;
+    if (count > counters.queue_max)
+        counters.queue_max = count;
+    encoder.begin(block, sizeof(block));
+}
+
+void MqttPublisher::poll(uint32_t now_ms)
+{
+    if (encoder.count() > 0 && (int32_t)(now_ms - batch_start_ms) >= (int32_t)config.batch_age_ms)
+        seal();
+
+    if (current == MQTT_DISCONNECTED)
+    {
+        if (backoff && (int32_t)(now_ms - retry_ms) < 0)
+            return;
+        if (!transport.connect(config.host, config.port))
+        {
+            fail(now_ms);
+            return;
+        }
+        current = MQTT_CONNECTING;
+        since_ms = now_ms;
+    }
+
+    // The connect timeout covers the TCP connect and the CONNACK together
+    if (current == MQTT_CONNECTING || current == MQTT_HANDSHAKE)
+    {
+        if (now_ms - since_ms > config.connect_timeout_ms)
+        {
+            fail(now_ms);
+            return;
+        }
+    }
+    if (current == MQTT_CONNECTING)
+    {
+        TransportState state = transport.state();
+        if (state == TRANSPORT_CONNECTING)
+            return;
+        if (state == TRANSPORT_CLOSED)
+        {
+            fail(now_ms);
+            return;
+        }
+        queueConnect();
+        current = MQTT_HANDSHAKE;
+    }
+
+    // Whatever arrived, a CONNACK moves the handshake on, a refusal ends it
+    uint8_t buffer[32];
+    size_t length;
+    while (current >= MQTT_HANDSHAKE && (length = transport.read(buffer, sizeof(buffer))) > 0)
+    {
+        for (size_t i = 0; i < length && current >= MQTT_HANDSHAKE; i++)
+            receive(buffer[i], now_ms);
+    }
+    if (current < MQTT_HANDSHAKE)
+        return;
+    if (transport.state() == TRANSPORT_CLOSED)
+    {
+        fail(now_ms);
+        return;
+    }
+    if (current == MQTT_HANDSHAKE)
+    {
+        sendPending(now_ms);
+        return;
+    }
+
+    // A broker that stopped answering is only noticed here, the TCP connection may still look fine
+    uint32_t keepalive_ms = config.keepalive_s * 1000UL;
+    if ((inflight > 0 || ping_pending) && now_ms - waiting_ms > keepalive_ms)
+    {
+        fail(now_ms);
+        return;
+    }
+
+    // Fill the window of unacknowledged messages, ping when there was nothing to send for a while
+    while (sendPending(now_ms))
+    {
+        bool idle = inflight == 0 && !ping_pending;
+        if (inflight < count && inflight < MQTT_INFLIGHT)
+        {
+            queuePublish(queue[(head + inflight) % MQTT_QUEUE_MESSAGES]);
+            inflight++;
+        }
+        else if (!ping_pending && now_ms - sent_ms >= keepalive_ms)
+        {
+            queueControl(MQTT_PINGREQ);
+            ping_pending = true;
+        }
+        else
+            break;
+        if (idle)
+            waiting_ms = now_ms;
+    }
+}
+
+void MqttPublisher::fail(uint32_t now_ms)
+{
+    // Everything unacknowledged stays queued and goes out again in the next session
+    transport.close();
+    counters.failures++;
+    current = MQTT_DISCONNECTED;
+    backoff = true;
+    retry_ms = now_ms + retry_delay_ms;
+    retry_delay_ms = retry_delay_ms * 2 < config.retry_max_ms ? retry_delay_ms * 2 : config.retry_max_ms;
+    inflight = 0;
+    ping_pending = false;
+    tx_length = 0;
+    tx_done = 0;
+    rx_stage = 0;
+}
+
+void MqttPublisher::online(uint32_t now_ms)
+{
+    current = MQTT_CONNECTED;
+    counters.connects++;
+    retry_delay_ms = config.retry_min_ms;
+    backoff = false;
+    inflight = 0;
+    ping_pending = false;
+    sent_ms = now_ms;
+}
+
+bool MqttPublisher::sendPending(uint32_t now_ms)
+{
+    // Returns true once the packet is out, false while the transport still has to take some of it
+    while (tx_done < tx_length)
+    {
+        size_t written = transport.write(tx + tx_done, tx_length - tx_done);
+        if (written == 0)
+            return false;
+        tx_done += written;
+        counters.bytes += written;
+        sent_ms = now_ms;
+    }
+    tx_length = 0;
+    tx_done = 0;
+    return true;
+}
+
+void MqttPublisher::receive(uint8_t byte, uint32_t now_ms)
+{
+    switch (rx_stage)
+    {
+    case 0:
+        rx_type = byte & 0xF0;
+        rx_remaining = 0;
+        rx_shift = 0;
+        rx_read = 0;
+        rx_stage = 1;
+        return;
+    case 1:
+        // Seven bits per byte, least significant first, at most four bytes
+        rx_remaining |= (uint32_t)(byte & 0x7F) << rx_shift;
+        rx_shift += 7;
+        if ((byte & 0x80) && rx_shift < 28)
+            return;
+        if (rx_remaining > 0)
+        {
+            rx_stage = 2;
+            return;
+        }
+        break;
+    default:
+        if (rx_read < sizeof(rx_body))
+            rx_body[rx_read] = byte;
+        if (++rx_read < rx_remaining)
+            return;
+        break;
+    }
+    rx_stage = 0;
+    handlePacket(rx_type, rx_body, rx_remaining < sizeof(rx_body) ? rx_remaining : sizeof(rx_body), now_ms);
+}
+
+void MqttPublisher::handlePacket(uint8_t type, const uint8_t *body, size_t length, uint32_t now_ms)
+{
+    switch (type)
+    {
+    case MQTT_CONNACK:
+        if (current != MQTT_HANDSHAKE)
+            break;
+        if (length >= 2 && body[1] == 0)
+            online(now_ms);
+        else
+            fail(now_ms);
+        break;
+    case MQTT_PUBACK:
+        // The broker acknowledges in the order it received, so only the oldest message can match
+        if (length >= 2 && inflight > 0 && (uint16_t)(body[0] << 8 | body[1]) == queue[head].packet_id)
+        {
+            counters.published++;
+            head = (head + 1) % MQTT_QUEUE_MESSAGES;
+            count--;
+            inflight--;
+            waiting_ms = now_ms;
+        }
+        break;
+    case MQTT_PINGRESP:
+        ping_pending = false;
+        waiting_ms = now_ms;
+        break;
+    default:
+        break;
+    }
+}
+
+size_t MqttPublisher::putHeader(uint8_t type, size_t remaining)
+{
+    size_t length = 0;
+    tx[length++] = type;
+    do
+    {
+        uint8_t byte = remaining & 0x7F;
+        remaining >>= 7;
+        tx[length++] = remaining > 0 ? byte | 0x80 : byte;
+    } while (remaining > 0);
+    return length;
+}
+
+void MqttPublisher::queueConnect()
+{
+    size_t id_length = strnlen(config.client_id, MQTT_CLIENT_ID_MAX);
+    size_t p = putHeader(MQTT_CONNECT, sizeof(MQTT_CONNECT_HEADER) + 2 + 2 + id_length);
+    memcpy(tx + p, MQTT_CONNECT_HEADER, sizeof(MQTT_CONNECT_HEADER));
+    p += sizeof(MQTT_CONNECT_HEADER);
+    tx[p++] = config.keepalive_s >> 8;
+    tx[p++] = config.keepalive_s & 0xFF;
+    tx[p++] = id_length >> 8;
+    tx[p++] = id_length & 0xFF;
+    memcpy(tx + p, config.client_id, id_length);
+    tx_length = p + id_length;
+    tx_done = 0;
+}
+
+void MqttPublisher::queuePublish(Message &message)
+{
+    size_t topic_length = strnlen(config.topic, MQTT_TOPIC_MAX);
+    size_t p = putHeader(MQTT_PUBLISH | MQTT_QOS1 | (message.sent ? MQTT_DUP : 0), 2 + topic_length + 2 + message.length);
+    tx[p++] = topic_length >> 8;
+    tx[p++] = topic_length & 0xFF;
+    memcpy(tx + p, config.topic, topic_length);
+    p += topic_length;
+    tx[p++] = message.packet_id >> 8;
+    tx[p++] = message.packet_id & 0xFF;
+    memcpy(tx + p, message.payload, message.length);
+    tx_length = p + message.length;
+    tx_done = 0;
+    if (message.sent)
+        counters.resent++;
+    message.sent = true;
+}
+
+void MqttPublisher::queueControl(uint8_t type)
+{
+    tx[0] = type;
+    tx[1] = 0;
+    tx_length = 2;
+    tx_done = 0;
+}
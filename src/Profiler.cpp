@@ -0,0 +1,79 @@
+#include "Profiler.h"
+
+#if PROFILING
+
+#include <stdio.h>
+
+// Zero initialised before any constructor runs, so stages in every file can link themselves in
+ProfileStage *ProfileStage::stages = NULL;
+
+ProfileStage::ProfileStage(const char *name) : label(name), following(NULL)
+{
+    clear();
+
+    // Append, the list then reads in construction order
+    ProfileStage **link = &stages;
+    while (*link != NULL)
+        link = &(*link)->following;
+    *link = this;
+}
+
+void ProfileStage::clear()
+{
+    reset_requested = false;
+    runs = 0;
+    longest = 0;
+    total = 0;
+    for (uint8_t i = 0; i < PROFILE_BUCKETS; i++)
+        histogram[i] = 0;
+}
+
+uint8_t ProfileStage::bucket(uint32_t cycles)
+{
+    // Below 2 * PROFILE_SUB_BUCKETS every duration has its own bucket, above that the top three bits pick it
+    if (cycles < 2 * PROFILE_SUB_BUCKETS)
+        return cycles;
+    uint8_t top = 31 - __builtin_clz(cycles);
+    uint32_t index = (top - 1) * PROFILE_SUB_BUCKETS + ((cycles >> (top - 2)) & (PROFILE_SUB_BUCKETS - 1));
+    return index < PROFILE_BUCKETS ? index : PROFILE_BUCKETS - 1;
+}
+
+uint32_t ProfileStage::bucketEnd(uint8_t index)
+{
+    if (index < 2 * PROFILE_SUB_BUCKETS)
+        return index + 1;
+    uint8_t top = index / PROFILE_SUB_BUCKETS + 1;
+    uint32_t width = 1UL << (top - 2);
+    return (PROFILE_SUB_BUCKETS + index % PROFILE_SUB_BUCKETS) * width + width;
+}
+
+uint32_t ProfileStage::percentile(uint8_t percent) const
+{
+    if (runs == 0)
+        return 0;
+    uint64_t wanted = ((uint64_t)runs * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (uint8_t index = 0; index < PROFILE_BUCKETS - 1; index++)
+    {
+        seen += histogram[index];
+        if (seen >= wanted)
+        {
+            // Never report more than the longest run
+            uint32_t end = bucketEnd(index);
+            return end < longest ? end : longest;
+        }
+    }
+    return longest;
+}
+
+size_t profileFormat(const ProfileStage &stage, char *buffer, size_t size)
+{
+    float per_us = halCyclesPerUs();
+    uint32_t runs = stage.count();
+    int length = snprintf(buffer, size, "%-10s runs %8u us: avg %9.2f p50 <%9.2f p99 <%9.2f max %9.2f", stage.name(), (unsigned)runs,
+                          runs ? (float)stage.sum() / runs / per_us : 0.0f, stage.percentile(50) / per_us, stage.percentile(99) / per_us,
+                          stage.maximum() / per_us);
+    return length < 0 ? 0 : (size_t)length;
+}
+
+#endif
@@ -0,0 +1,225 @@
+#include "RawTrace.h"
+#include <math.h>
+#include <string.h>
+
+// Event tag: the type in the high nibble, the channel in the low one
+#define RAW_TRACE_TAG(type, channel) ((type) << 4 | ((channel) & 0x0F))
+
+static uint32_t zigzag(int32_t value) { return (uint32_t)value << 1 ^ (uint32_t)(value >> 31); }
+static int32_t unzigzag(uint32_t value) { return (int32_t)(value >> 1) ^ -(int32_t)(value & 1); }
+
+// LEB128, seven bits a byte, the high bit set on all but the last
+static uint8_t *putVarint(uint8_t *p, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        *p++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+static bool getVarint(const uint8_t *data, size_t length, size_t &position, uint32_t &value)
+{
+    value = 0;
+    for (uint8_t shift = 0; shift < 35 && position < length; shift += 7)
+    {
+        uint8_t byte = data[position++];
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+RawTraceEncoder::RawTraceEncoder() : buffer(NULL), capacity(0), length(0), events(0), first_us(0), previous_us(0)
+{
+}
+
+void RawTraceEncoder::begin(uint8_t *buffer, size_t capacity)
+{
+    this->buffer = buffer;
+    this->capacity = capacity;
+    length = 0;
+    events = 0;
+}
+
+bool RawTraceEncoder::append(const RawTraceEvent &event)
+{
+    // Built apart and copied in whole, an event that does not fit leaves the chunk as it was
+    uint8_t encoded[RAW_TRACE_EVENT_MAX];
+    uint8_t *p = encoded;
+    *p++ = RAW_TRACE_TAG(event.type, event.channel);
+    p = putVarint(p, events == 0 ? event.time_us : zigzag((int32_t)(event.time_us - previous_us)));
+    switch (event.type)
+    {
+    case TRACE_ADC_BLOCK:
+    {
+        uint16_t count = event.block.count > ADC_BLOCK_SIZE ? ADC_BLOCK_SIZE : event.block.count;
+        *p++ = count;
+        uint16_t previous = 0;
+        for (uint16_t i = 0; i < count; i++)
+        {
+            uint16_t sample = event.block.samples[i];
+            p = putVarint(p, i == 0 ? sample : zigzag((int32_t)sample - previous));
+            previous = sample;
+        }
+        break;
+    }
+    case TRACE_TEMPERATURE:
+        p = putVarint(p, zigzag((int32_t)lroundf(event.value * 16.0f)));
+        break;
+    case TRACE_TEMPERATURE_MISSING:
+        break;
+    case TRACE_REFERENCE:
+        memcpy(p, &event.value, sizeof(float));
+        p += sizeof(float);
+        break;
+    }
+
+    size_t size = p - encoded;
+    if (length + size > capacity)
+        return false;
+    memcpy(buffer + length, encoded, size);
+    length += size;
+    if (events++ == 0)
+        first_us = event.time_us;
+    previous_us = event.time_us;
+    return true;
+}
+
+RawTraceDecoder::RawTraceDecoder(const uint8_t *data, size_t length, uint16_t count)
+    : data(data), length(length), position(0), count(count), first(true), previous_us(0)
+{
+}
+
+bool RawTraceDecoder::next(RawTraceEvent &event)
+{
+    if (count == 0 || position >= length)
+        return false;
+
+    uint8_t tag = data[position++];
+    event.type = (RawTraceEventType)(tag >> 4);
+    event.channel = tag & 0x0F;
+    uint32_t time;
+    if (event.type > TRACE_REFERENCE || !getVarint(data, length, position, time))
+        return false;
+    event.time_us = first ? time : previous_us + unzigzag(time);
+    event.value = 0;
+    event.block.count = 0;
+
+    uint32_t value;
+    switch (event.type)
+    {
+    case TRACE_ADC_BLOCK:
+    {
+        if (position >= length || data[position] > ADC_BLOCK_SIZE)
+            return false;
+        event.block.count = data[position++];
+        event.block.timestamp_us = event.time_us;
+        int32_t sample = 0;
+        for (uint16_t i = 0; i < event.block.count; i++)
+        {
+            if (!getVarint(data, length, position, value))
+                return false;
+            sample = i == 0 ? (int32_t)value : sample + unzigzag(value);
+            event.block.samples[i] = sample;
+        }
+        break;
+    }
+    case TRACE_TEMPERATURE:
+        if (!getVarint(data, length, position, value))
+            return false;
+        event.value = unzigzag(value) / 16.0f;
+        break;
+    case TRACE_TEMPERATURE_MISSING:
+        break;
+    case TRACE_REFERENCE:
+        if (position + sizeof(float) > length)
+            return false;
+        memcpy(&event.value, data + position, sizeof(float));
+        position += sizeof(float);
+        break;
+    }
+    first = false;
+    previous_us = event.time_us;
+    count--;
+    return true;
+}
+
+RawTraceRecorder::RawTraceRecorder() : recording(false), event_count(0), dropped_chunks(0)
+{
+    encoder.begin(filling.data, sizeof(filling.data));
+}
+
+bool RawTraceRecorder::reference(ReadingChannel channel, float value, uint32_t now_us)
+{
+    Reference reference = {channel, value, now_us};
+    return recording && references.push(reference);
+}
+
+void RawTraceRecorder::block(uint8_t channel, const AdcBlock &block)
+{
+    if (!recording)
+    {
+        // The rest of the capture goes out once it is switched off
+        if (encoder.count() > 0)
+            finish();
+        return;
+    }
+    RawTraceEvent event;
+    event.type = TRACE_ADC_BLOCK;
+    event.channel = channel;
+    event.time_us = block.timestamp_us;
+    event.value = 0;
+    event.block = block;
+    record(event);
+}
+
+void RawTraceRecorder::temperature(uint8_t probe, float celsius, bool valid, uint32_t now_us)
+{
+    if (!recording)
+        return;
+    RawTraceEvent event;
+    event.type = valid ? TRACE_TEMPERATURE : TRACE_TEMPERATURE_MISSING;
+    event.channel = probe;
+    event.time_us = now_us;
+    event.value = celsius;
+    event.block.count = 0;
+    record(event);
+}
+
+void RawTraceRecorder::record(const RawTraceEvent &event)
+{
+    // The references typed in since the last event go first
+    Reference reference;
+    while (references.pop(reference))
+    {
+        RawTraceEvent typed;
+        typed.type = TRACE_REFERENCE;
+        typed.channel = reference.channel;
+        typed.time_us = reference.time_us;
+        typed.value = reference.value;
+        typed.block.count = 0;
+        record(typed);
+    }
+
+    if (encoder.count() > 0 && (int32_t)(event.time_us - encoder.firstUs()) > (int32_t)RAW_TRACE_FLUSH_US)
+        finish();
+    if (!encoder.append(event))
+    {
+        finish();
+        encoder.append(event);
+    }
+    event_count++;
+}
+
+void RawTraceRecorder::finish()
+{
+    filling.count = encoder.count();
+    filling.length = encoder.size();
+    if (!finished.push(filling))
+        dropped_chunks++;
+    encoder.begin(filling.data, sizeof(filling.data));
+}
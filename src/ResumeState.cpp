@@ -0,0 +1,31 @@
+#include "ResumeState.h"
+#include "Telemetry.h"
+#include <stddef.h>
+#include <string.h>
+
+#define RESUME_STATE_MAGIC 0x52534D45UL // "EMSR"
+
+// The CRC covers every byte behind the header fields
+static uint16_t resumeStateCrc(const ResumeState &state)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&state);
+    size_t start = offsetof(ResumeState, power_mode);
+    return crc16Ccitt(bytes + start, sizeof(ResumeState) - start);
+}
+
+void resumeStateSeal(ResumeState &state)
+{
+    state.magic = RESUME_STATE_MAGIC;
+    state.version = RESUME_STATE_VERSION;
+    state.crc = resumeStateCrc(state);
+}
+
+bool resumeStateValid(const ResumeState &state)
+{
+    return state.magic == RESUME_STATE_MAGIC && state.version == RESUME_STATE_VERSION && state.crc == resumeStateCrc(state);
+}
+
+void resumeStateClear(ResumeState &state)
+{
+    memset(&state, 0, sizeof(state));
+}
@@ -0,0 +1,112 @@
+#include "Scheduler.h"
+
+Scheduler::Scheduler(SchedulerClock clock) : clock(clock), task_count(0)
+{
+    resetStats();
+}
+
+int8_t Scheduler::addTask(const char *name, SchedulerStep step, void *context, uint32_t first_delay_us)
+{
+    // The table is fixed size so we never allocate at runtime
+    if (task_count >= MAX_TASKS)
+    {
+        return -1;
+    }
+
+    Task &task = tasks[task_count];
+    task.name = name;
+    task.step = step;
+    task.context = context;
+    task.due_us = clock() + first_delay_us;
+    task.stats = SchedulerTaskStats();
+    task.stats.lateness_min_us = UINT32_MAX;
+    return task_count++;
+}
+
+uint32_t Scheduler::runOnce()
+{
+    uint32_t cycle_start = clock();
+    bool ran_any = false;
+
+    for (uint8_t i = 0; i < task_count; i++)
+    {
+        Task &task = tasks[i];
+        uint32_t start = clock();
+
+        // Compare with a signed difference so the micros() wrap after ~71 minutes is harmless
+        if ((int32_t)(start - task.due_us) < 0)
+        {
+            continue;
+        }
+
+        // Run one step of the state machine
+        uint32_t delay_us = task.step(task.context, start);
+        uint32_t end = clock();
+        ran_any = true;
+
+        // Update lateness (jitter) and run time statistics
+        uint32_t lateness = start - task.due_us;
+        uint32_t run_time = end - start;
+        SchedulerTaskStats &stats = task.stats;
+        stats.runs++;
+        if (lateness < stats.lateness_min_us)
+            stats.lateness_min_us = lateness;
+        if (lateness > stats.lateness_max_us)
+            stats.lateness_max_us = lateness;
+        stats.lateness_sum_us += lateness;
+        if (run_time > stats.run_time_max_us)
+            stats.run_time_max_us = run_time;
+        stats.run_time_sum_us += run_time;
+
+        // Schedule relative to the due time so periodic tasks do not drift,
+        // but resynchronise if we fell behind by more than a whole period
+        if (lateness > delay_us)
+        {
+            task.due_us = start + delay_us;
+        }
+        else
+        {
+            task.due_us += delay_us;
+        }
+    }
+
+    // Only passes that did work count as a cycle, idle polling would skew the numbers
+    if (ran_any)
+    {
+        uint32_t cycle_time = clock() - cycle_start;
+        cycle_stats.cycles++;
+        if (cycle_time < cycle_stats.cycle_min_us)
+            cycle_stats.cycle_min_us = cycle_time;
+        if (cycle_time > cycle_stats.cycle_max_us)
+            cycle_stats.cycle_max_us = cycle_time;
+        cycle_stats.cycle_sum_us += cycle_time;
+    }
+
+    // Work out how long the caller may idle before the next task is due
+    uint32_t now = clock();
+    uint32_t next_us = UINT32_MAX;
+    for (uint8_t i = 0; i < task_count; i++)
+    {
+        int32_t remaining = (int32_t)(tasks[i].due_us - now);
+        if (remaining <= 0)
+        {
+            return 0;
+        }
+        if ((uint32_t)remaining < next_us)
+        {
+            next_us = remaining;
+        }
+    }
+    return next_us;
+}
+
+void Scheduler::resetStats()
+{
+    for (uint8_t i = 0; i < task_count; i++)
+    {
+        tasks[i].stats = SchedulerTaskStats();
+        tasks[i].stats.lateness_min_us = UINT32_MAX;
+    }
+    cycle_stats = SchedulerCycleStats();
+    cycle_stats.cycle_min_us = UINT32_MAX;
+}
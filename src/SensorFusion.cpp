@@ -0,0 +1,193 @@
+#include "SensorFusion.h"
+#include <math.h>
+
+// Model and probe noise of a reservoir. The walks are what a dose moves the
+// values by while it mixes in, the measurement noise is what the filters give
+// for one block on a working probe with the 12-bit ADC
+static const SensorFusionConfig FUSION_DEFAULTS = {
+    0.0002f, 0.002f,    // Temperature acceleration and starting rate, a heater cycles in tens of minutes
+    0.002f,             // pH walk
+    0.0005f,            // TDS walk, volts, about 0.2 ppm
+    0.03f,              // Temperature read, noise and the 1/16 C step of 12 bits
+    0.004f,             // pH of one trimmed mean
+    0.001f,             // TDS volts of one median
+    5.0f, 4,            // Gate in standard deviations, outliers in a row before a restart
+};
+
+// Compensation of the TDS probe, the same as SensorMath's
+static const float FUSION_REFERENCE_CELSIUS = 25.0f;
+static const float FUSION_TEMPERATURE_SPAN = 50.0f;
+
+SensorFusion::SensorFusion()
+{
+    configure(FUSION_DEFAULTS);
+}
+
+void SensorFusion::configure(const SensorFusionConfig &config)
+{
+    settings = config;
+    reset();
+}
+
+void SensorFusion::reset()
+{
+    // Until the first temperature the TDS is compensated at the reference temperature, as the pipeline does
+    filter.reset();
+    filter.x[FUSION_TEMPERATURE] = FUSION_REFERENCE_CELSIUS;
+    started = false;
+    last_us = 0;
+    for (uint8_t i = 0; i < MEASUREMENTS; i++)
+    {
+        measured[i] = false;
+        outliers[i] = 0;
+    }
+    update_count = 0;
+    reject_count = 0;
+}
+
+float SensorFusion::tdsCoefficient() const
+{
+    return 1.0f + (filter.x[FUSION_TEMPERATURE] - FUSION_REFERENCE_CELSIUS) / FUSION_TEMPERATURE_SPAN;
+}
+
+void SensorFusion::predict(uint32_t time_us)
+{
+    if (!started)
+    {
+        started = true;
+        last_us = time_us;
+        return;
+    }
+    float dt = (int32_t)(time_us - last_us) / 1e6f;
+    if (dt <= 0)
+        return; // Older than the state, taken as now
+    last_us = time_us;
+
+    // The temperature ramps, pH and TDS stay put. Process noise is white acceleration and white drift, a state
+    // that was never measured stays where it is with no uncertainty
+    typedef KalmanFilter<FUSION_STATES>::Matrix Matrix;
+    Matrix F = {}, Q = {};
+    for (uint8_t i = 0; i < FUSION_STATES; i++)
+        F[i][i] = 1;
+    if (measured[MEASURE_TEMPERATURE])
+    {
+        float accel = settings.temp_accel * settings.temp_accel;
+        F[FUSION_TEMPERATURE][FUSION_TEMPERATURE_RATE] = dt;
+        Q[FUSION_TEMPERATURE][FUSION_TEMPERATURE] = accel * dt * dt * dt / 3;
+        Q[FUSION_TEMPERATURE][FUSION_TEMPERATURE_RATE] = Q[FUSION_TEMPERATURE_RATE][FUSION_TEMPERATURE] = accel * dt * dt / 2;
+        Q[FUSION_TEMPERATURE_RATE][FUSION_TEMPERATURE_RATE] = accel * dt;
+    }
+    if (measured[MEASURE_PH])
+        Q[FUSION_PH][FUSION_PH] = settings.ph_walk * settings.ph_walk * dt;
+    if (measured[MEASURE_TDS])
+        Q[FUSION_TDS_VOLTS][FUSION_TDS_VOLTS] = settings.tds_walk * settings.tds_walk * dt;
+    filter.predict(F, Q);
+}
+
+void SensorFusion::restart(State state, float value, float variance)
+{
+    for (uint8_t i = 0; i < FUSION_STATES; i++)
+        filter.P[state][i] = filter.P[i][state] = 0;
+    filter.x[state] = value;
+    filter.P[state][state] = variance;
+}
+
+bool SensorFusion::update(Measurement measurement, const KalmanFilter<FUSION_STATES>::Vector &h, float innovation, float sd)
+{
+    float gate = settings.gate_sd * settings.gate_sd;
+    if (filter.update(h, innovation, sd * sd, gate))
+    {
+        outliers[measurement] = 0;
+        update_count++;
+        return true;
+    }
+    reject_count++;
+    if (++outliers[measurement] < settings.max_rejects)
+        return false;
+
+    // Consistently off, the value moved in a way the model does not allow. Start over from the measurement
+    outliers[measurement] = 0;
+    measured[measurement] = false;
+    return true;
+}
+
+bool SensorFusion::temperature(float celsius, uint32_t time_us)
+{
+    predict(time_us);
+    if (measured[MEASURE_TEMPERATURE])
+    {
+        KalmanFilter<FUSION_STATES>::Vector h = {};
+        h[FUSION_TEMPERATURE] = 1;
+        if (!update(MEASURE_TEMPERATURE, h, celsius - filter.x[FUSION_TEMPERATURE], settings.temp_sd))
+            return false;
+        if (measured[MEASURE_TEMPERATURE])
+            return true;
+    }
+
+    // First read, or a restart. The TDS state was compensated at the old temperature, keep the voltage it predicts
+    float coefficient = tdsCoefficient();
+    restart(FUSION_TEMPERATURE, celsius, settings.temp_sd * settings.temp_sd);
+    restart(FUSION_TEMPERATURE_RATE, 0, settings.temp_rate * settings.temp_rate);
+    if (measured[MEASURE_TDS])
+    {
+        float scale = coefficient / tdsCoefficient();
+        for (uint8_t i = 0; i < FUSION_STATES; i++)
+        {
+            if (i != FUSION_TDS_VOLTS)
+                filter.P[FUSION_TDS_VOLTS][i] = filter.P[i][FUSION_TDS_VOLTS] *= scale;
+        }
+        filter.P[FUSION_TDS_VOLTS][FUSION_TDS_VOLTS] *= scale * scale;
+        filter.x[FUSION_TDS_VOLTS] *= scale;
+    }
+    measured[MEASURE_TEMPERATURE] = true;
+    update_count++;
+    return true;
+}
+
+bool SensorFusion::ph(float ph, uint32_t time_us)
+{
+    predict(time_us);
+    if (measured[MEASURE_PH])
+    {
+        KalmanFilter<FUSION_STATES>::Vector h = {};
+        h[FUSION_PH] = 1;
+        if (!update(MEASURE_PH, h, ph - filter.x[FUSION_PH], settings.ph_sd))
+            return false;
+        if (measured[MEASURE_PH])
+            return true;
+    }
+    restart(FUSION_PH, ph, settings.ph_sd * settings.ph_sd);
+    measured[MEASURE_PH] = true;
+    update_count++;
+    return true;
+}
+
+bool SensorFusion::tdsVolts(float volts, uint32_t time_us)
+{
+    predict(time_us);
+    float coefficient = tdsCoefficient();
+    if (measured[MEASURE_TDS])
+    {
+        // Linearised around the estimate: d/dT of V25 * coefficient and d/dV25. Before the first temperature its
+        // row and column are zero, so the reading moves the TDS alone
+        KalmanFilter<FUSION_STATES>::Vector h = {};
+        h[FUSION_TEMPERATURE] = filter.x[FUSION_TDS_VOLTS] / FUSION_TEMPERATURE_SPAN;
+        h[FUSION_TDS_VOLTS] = coefficient;
+        if (!update(MEASURE_TDS, h, volts - filter.x[FUSION_TDS_VOLTS] * coefficient, settings.tds_sd))
+            return false;
+        if (measured[MEASURE_TDS])
+            return true;
+    }
+    float sd = settings.tds_sd / coefficient;
+    restart(FUSION_TDS_VOLTS, volts / coefficient, sd * sd);
+    measured[MEASURE_TDS] = true;
+    update_count++;
+    return true;
+}
+
+FusedValue SensorFusion::estimate(State state) const
+{
+    static const Measurement source[FUSION_STATES] = {MEASURE_TEMPERATURE, MEASURE_TEMPERATURE, MEASURE_PH, MEASURE_TDS};
+    float variance = filter.P[state][state];
+    return {filter.x[state], variance > 0 ? sqrtf(variance) : 0, measured[source[state]]};
+}
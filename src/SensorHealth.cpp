@@ -0,0 +1,148 @@
+#include "SensorHealth.h"
+#include <math.h>
+
+SensorHealth::SensorHealth()
+{
+    configure(SensorHealthConfig());
+}
+
+void SensorHealth::configure(const SensorHealthConfig &config)
+{
+    settings = config;
+    totals = SensorHealthStats();
+    current = FAULT_NONE;
+    window_fault = FAULT_NONE;
+    clean = 0;
+    steady = config.slew_confirm; // The first value has nothing to jump from
+    misses = 0;
+    have_previous = false;
+    previous_value = 0;
+    previous_us = 0;
+    unchanged_value = NAN;        // Differs from every value, the first one starts the stuck timer
+    unchanged_us = 0;
+}
+
+void SensorHealth::checkWindow(uint16_t lower_quartile, uint16_t median, uint16_t upper_quartile)
+{
+    // A dead or unpowered input reads low, a floating one picks up noise over the whole range. A step between
+    // two levels inside the window is wide too, but its median sits on one of them right next to a quartile
+    uint16_t margin = settings.floating_spread / 8;
+    if (median <= settings.rail_low)
+        window_fault = FAULT_DISCONNECTED;
+    else if (median >= settings.rail_high)
+        window_fault = FAULT_SATURATED;
+    else if (upper_quartile - lower_quartile > settings.floating_spread && median - lower_quartile > margin &&
+             upper_quartile - median > margin)
+        window_fault = FAULT_DISCONNECTED;
+    else
+        window_fault = FAULT_NONE;
+}
+
+SensorQuality SensorHealth::update(float value, uint32_t now_us)
+{
+    totals.evaluations++;
+    misses = 0;
+    SensorFault found = window_fault;
+    window_fault = FAULT_NONE;
+    if (found == FAULT_NONE && !(value >= settings.min_value && value <= settings.max_value))
+        found = FAULT_SATURATED; // Also catches NaN
+
+    // Any change at all restarts the stuck timer, noise alone keeps a live probe moving
+    if (value != unchanged_value)
+    {
+        unchanged_value = value;
+        unchanged_us = 0;
+    }
+    else
+    {
+        unchanged_us += now_us - previous_us;
+        if (found == FAULT_NONE && settings.stuck_s != 0 && unchanged_us >= settings.stuck_s * 1000000ULL)
+            found = FAULT_STUCK;
+    }
+
+    // A jump only counts once the new level has held for slew_confirm values, a single wild value never does
+    if (found == FAULT_NONE && have_previous)
+    {
+        float allowed = settings.slew_floor + settings.slew_per_s * ((int32_t)(now_us - previous_us) / 1e6f);
+        if (fabsf(value - previous_value) > allowed)
+        {
+            if (steady >= settings.slew_confirm)
+                totals.detections[FAULT_SLEW]++;
+            steady = 0;
+        }
+        else if (steady < settings.slew_confirm)
+        {
+            steady++;
+        }
+    }
+
+    // A faulty value is no reference for the next jump, after a fault the first clean value starts over
+    have_previous = found == FAULT_NONE;
+    previous_value = value;
+    previous_us = now_us;
+
+    if (found != FAULT_NONE)
+        raise(found);
+    else if (current != FAULT_NONE && current != FAULT_SLEW && ++clean >= settings.clear_count)
+        current = FAULT_NONE;
+    if (current == FAULT_NONE || current == FAULT_SLEW)
+        current = steady < settings.slew_confirm ? FAULT_SLEW : FAULT_NONE;
+
+    SensorQuality result = quality();
+    if (result == QUALITY_SUSPECT)
+        totals.suspect++;
+    else if (result == QUALITY_FAULT)
+        totals.faulted++;
+    return result;
+}
+
+SensorQuality SensorHealth::missing()
+{
+    // A probe that does not answer is not stuck, the next value starts the timer over
+    totals.missing++;
+    unchanged_value = NAN;
+    if (misses < UINT8_MAX)
+        misses++;
+    if (settings.missing_limit != 0 && misses >= settings.missing_limit)
+    {
+        raise(FAULT_DISCONNECTED);
+        have_previous = false;
+    }
+    return quality();
+}
+
+SensorQuality SensorHealth::quality() const
+{
+    if (current == FAULT_NONE)
+        return QUALITY_GOOD;
+    return current == FAULT_SLEW ? QUALITY_SUSPECT : QUALITY_FAULT;
+}
+
+void SensorHealth::raise(SensorFault fault)
+{
+    clean = 0;
+    if (current != fault)
+    {
+        totals.detections[fault]++;
+        current = fault;
+    }
+}
+
+const char *sensorFaultName(SensorFault fault)
+{
+    switch (fault)
+    {
+    case FAULT_NONE:
+        return "ok";
+    case FAULT_DISCONNECTED:
+        return "disconnected";
+    case FAULT_STUCK:
+        return "stuck";
+    case FAULT_SATURATED:
+        return "saturated";
+    case FAULT_SLEW:
+        return "slew";
+    default:
+        return "unknown";
+    }
+}
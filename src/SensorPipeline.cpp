@@ -0,0 +1,517 @@
+#include "SensorPipeline.h"
+#include "SensorMath.h"
+#include "Profiler.h"
+#include <math.h>
+
+// Profiling - OneWire work of the temperature engine, the two filters and the derived values
+PROFILE_STAGE(profile_onewire, "onewire");
+PROFILE_STAGE(profile_ph, "ph filter");
+PROFILE_STAGE(profile_tds, "tds filter");
+PROFILE_STAGE(profile_derive, "derive");
+PROFILE_STAGE(profile_probes, "probes");
+
+// Health - fault limits of every probe, rails and spread in raw 12-bit counts.
+// A live analog input never repeats the same filtered value for two minutes,
+// a DS18B20 at 9 bits can sit on one step for a while, so it gets six hours
+static const SensorHealthConfig PH_HEALTH = {
+    8, 4087, 400,       // Rails and floating spread
+    0.0f, 14.0f,        // pH
+    0.2f, 0.1f, 8,      // Slew per second, floor, values to confirm a jump
+    0, 8, 120,          // Missing limit (never missing, the ADC always delivers), clear count, stuck seconds
+};
+static const SensorHealthConfig TDS_HEALTH = {
+    8, 4087, 400,
+    0.0f, 2300.0f,      // Millivolts, the probe board tops out at 2.3 V
+    100.0f, 30.0f, 8,
+    0, 8, 120,
+};
+static const SensorHealthConfig TEMP_HEALTH = {
+    0, 0, 0,            // No raw window
+    -5.0f, 50.0f,       // C, the 85 C power-on value of the scratchpad is out of range
+    0.5f, 0.5f, 3,
+    2, 2, 6 * 3600,
+};
+
+// Adaptive sampling - a channel halves its rate after every hold time it stays
+// quiet, and goes back to full rate as soon as it moves or gets noisy. The
+// limits are in the units of the value, TDS is watched in millivolts
+static const AdaptiveRateConfig PH_RATE = {
+    0, 3,               // Full rate down to an eighth
+    5.0f, 30.0f,        // Fast and slow time constants
+    0.01f, 0.05f,       // Quiet and busy deviation, pH
+    0.001f, 0.005f,     // Quiet and busy slope, pH per second
+    30.0f,              // Quiet seconds before the next halving
+};
+static const AdaptiveRateConfig TDS_RATE = {
+    0, 3,
+    5.0f, 30.0f,
+    3.0f, 10.0f,        // mV
+    0.2f, 1.0f,         // mV per second
+    30.0f,
+};
+static const AdaptiveRateConfig TEMP_RATE = {
+    0, 4,               // Full period down to a sixteenth
+    20.0f, 120.0f,
+    0.05f, 0.2f,        // C
+    0.0005f, 0.003f,    // C per second
+    120.0f,
+};
+
+SensorPipeline::SensorPipeline(AdcBlockSource &adc, TemperatureEngine &temperatures,
+                               const AdcCalibration &tds_calibration, const AdcCalibration &ph_calibration)
+    : adc(adc), temperatures(temperatures), tds_calibration(tds_calibration), ph_calibration(ph_calibration),
+      sink(NULL), recorder(NULL), fusion(NULL), block_period_us(0), calibration_pending(false), ph_volts(0), tds_volts(0), ph_shift(0), tds_shift(0),
+      oversampling(0), adaptive(false), boost_requested(false), sampling(), probe_count(0), tds_published_updates(0), ec_published_updates(0)
+{
+    configureHealth(READING_PH, PH_HEALTH);
+    configureHealth(READING_TDS, TDS_HEALTH);
+    configureHealth(READING_TEMPERATURE, TEMP_HEALTH);
+    configureRate(READING_PH, PH_RATE);
+    configureRate(READING_TDS, TDS_RATE);
+    configureRate(READING_TEMPERATURE, TEMP_RATE);
+}
+
+void SensorPipeline::configureHealth(ReadingChannel channel, const SensorHealthConfig &config)
+{
+    switch (channel)
+    {
+    case READING_PH:
+        ph_health.configure(config);
+        break;
+    case READING_TDS:
+        tds_health.configure(config);
+        break;
+    case READING_TEMPERATURE:
+        for (uint8_t i = 0; i < TemperatureEngine::MAX_PROBES; i++)
+            temp_health[i].configure(config);
+        break;
+    default:
+        break; // EC is derived, its quality follows TDS
+    }
+}
+
+const SensorHealth &SensorPipeline::health(ReadingChannel channel, uint8_t index) const
+{
+    if (channel == READING_TEMPERATURE && index < TemperatureEngine::MAX_PROBES)
+        return temp_health[index];
+    return channel == READING_PH ? ph_health : tds_health;
+}
+
+void SensorPipeline::configureRate(ReadingChannel channel, const AdaptiveRateConfig &config)
+{
+    switch (channel)
+    {
+    case READING_PH:
+        ph_rate.configure(config);
+        break;
+    case READING_TDS:
+        tds_rate.configure(config);
+        break;
+    case READING_TEMPERATURE:
+        for (uint8_t i = 0; i < TemperatureEngine::MAX_PROBES; i++)
+            temp_rate[i].configure(config);
+        break;
+    default:
+        break; // EC is derived, it comes with TDS
+    }
+}
+
+const AdaptiveRate &SensorPipeline::rate(ReadingChannel channel, uint8_t index) const
+{
+    if (channel == READING_TEMPERATURE && index < TemperatureEngine::MAX_PROBES)
+        return temp_rate[index];
+    return channel == READING_PH ? ph_rate : tds_rate;
+}
+
+void SensorPipeline::begin(Scheduler &scheduler, ReadingSink sink, uint32_t block_period_us, uint32_t temp_max_age_us)
+{
+    this->sink = sink;
+    this->block_period_us = block_period_us;
+
+    // TDS follows the voltage and the temperature, EC follows TDS
+    sensor_state.setMaxAge(SENSOR_TEMPERATURE, temp_max_age_us);
+    sensor_state.addDerived(SENSOR_TDS_PPM, deriveTdsPpm, this, SENSOR_TDS_MV, SENSOR_TEMPERATURE);
+    sensor_state.addDerived(SENSOR_EC, deriveEc, this, SENSOR_TDS_PPM);
+
+    // Oversampling is for pH, everything else keeps sampling at the base rate
+    tds_shift = oversampling;
+    adc.setRateShift(ADC_CHANNEL_TDS, oversampling);
+    for (uint8_t i = 0; i < probe_count; i++)
+        adc.setRateShift(probes[i].adc_channel, oversampling);
+
+    // Register the sensor state machines, the offsets spread the first runs out
+    scheduler.addTask("temp", temperatureTask, this);
+    scheduler.addTask("ph", phTask, this, 5000);
+    scheduler.addTask("tds", tdsTask, this, 10000);
+    if (probe_count > 0)
+        scheduler.addTask("probes", probeTask, this, 15000);
+}
+
+bool SensorPipeline::addProbe(ReadingChannel kind, uint8_t adc_channel)
+{
+    if (probe_count == PIPELINE_MAX_PROBES || (kind != READING_PH && kind != READING_TDS))
+        return false;
+
+    // Index 0 of each kind is the first pair
+    uint8_t index = 1;
+    for (uint8_t i = 0; i < probe_count; i++)
+        if (probes[i].kind == kind)
+            index++;
+    Probe &probe = probes[probe_count++];
+    probe.kind = kind;
+    probe.adc_channel = adc_channel;
+    probe.index = index;
+    return true;
+}
+
+bool SensorPipeline::setCalibration(const CalibrationCoefficients &coefficients)
+{
+    if (calibration_pending)
+        return false;
+    pending_coefficients = coefficients;
+    calibration_pending = true;
+    return true;
+}
+
+void SensorPipeline::applyCalibration()
+{
+    // Only this task reads the curves, so they are rebuilt in place between two conversions
+    curves.build(pending_coefficients);
+    calibration_pending = false;
+
+    // The next refresh converts the current voltage again
+    sensor_state.invalidate(SENSOR_TDS_MV);
+}
+
+void SensorPipeline::applyBoost()
+{
+    // Taken by whichever step runs first, they all run in the same task
+    boost_requested = false;
+    ph_rate.boost();
+    tds_rate.boost();
+    for (uint8_t i = 0; i < TemperatureEngine::MAX_PROBES; i++)
+        temp_rate[i].boost();
+    ph_shift = 0;
+    tds_shift = oversampling;
+    adc.setRateShift(ADC_CHANNEL_PH, 0);
+    adc.setRateShift(ADC_CHANNEL_TDS, oversampling);
+    for (uint8_t i = 0; i < temperatures.probeCount(); i++)
+        temperatures.setPeriodShift(i, 0);
+}
+
+uint8_t SensorPipeline::adapt(AdaptiveRate &rate, float value, uint32_t now_us)
+{
+    // The rates follow the signal either way, so switching on starts from what they learned
+    uint8_t shift = rate.update(value, now_us);
+    return adaptive ? shift : 0;
+}
+
+void SensorPipeline::save(Snapshot &snapshot) const
+{
+    snapshot.ph_count = ph_filter.copyTo(snapshot.ph_samples);
+    snapshot.tds_count = tds_filter.copyTo(snapshot.tds_samples);
+}
+
+void SensorPipeline::resume(const Snapshot &snapshot)
+{
+    ph_filter.reset();
+    ph_filter.pushBlock(snapshot.ph_samples, snapshot.ph_count);
+    tds_filter.reset();
+    tds_filter.pushBlock(snapshot.tds_samples, snapshot.tds_count);
+    ph_decimator.reset(); // Its state is not kept, the first pH after a wake waits until it has settled again
+}
+
+uint32_t SensorPipeline::temperatureStep(uint32_t now_us)
+{
+    if (boost_requested)
+        applyBoost();
+
+    // Remember how many reads and failures every probe had so we can publish the new ones
+    uint32_t reads_before[TemperatureEngine::MAX_PROBES];
+    uint32_t failures_before[TemperatureEngine::MAX_PROBES];
+    for (uint8_t i = 0; i < temperatures.probeCount(); i++)
+    {
+        reads_before[i] = temperatures.probe(i).reads;
+        failures_before[i] = temperatures.probe(i).failures;
+    }
+
+    uint32_t delay_us;
+    {
+        PROFILE_SCOPE(profile_onewire);
+        delay_us = temperatures.step(now_us);
+    }
+
+    for (uint8_t i = 0; i < temperatures.probeCount(); i++)
+    {
+        const TemperatureEngine::Probe &probe = temperatures.probe(i);
+        bool read = probe.reads != reads_before[i] && probe.valid;
+        if (recorder && (read || probe.failures != failures_before[i]))
+            recorder->temperature(i, probe.celsius, read, read ? probe.timestamp_us : now_us);
+
+        SensorQuality quality;
+        if (read)
+        {
+            // A read is a start and a read transaction, the base period would have done 2^shift of them meanwhile
+            sampling.onewire += 2;
+            sampling.onewire_fixed += 2UL << probe.period_shift;
+            quality = temp_health[i].update(probe.celsius, probe.timestamp_us);
+            temperatures.setPeriodShift(i, adapt(temp_rate[i], probe.celsius, probe.timestamp_us));
+        }
+        else if (probe.failures != failures_before[i] && temp_health[i].missing() == QUALITY_FAULT)
+            quality = QUALITY_FAULT; // Disconnected, the last value goes out again marked as such
+        else
+            continue;
+
+        sink(READING_TEMPERATURE, i, probe.celsius, quality);
+        if (i == TDS_TEMP_PROBE)
+        {
+            sensor_state.publish(SENSOR_TEMPERATURE, probe.celsius, probe.timestamp_us, quality);
+            if (fusion && read && quality < QUALITY_FAULT)
+                fusion->temperature(probe.celsius, probe.timestamp_us);
+        }
+    }
+
+    // A new temperature changes the compensated TDS
+    refreshDerived(now_us);
+    return delay_us;
+}
+
+uint32_t SensorPipeline::phStep(uint32_t now_us)
+{
+    // Feed every block the sampler finished since the last run into the window
+    if (calibration_pending)
+        applyCalibration();
+    if (boost_requested)
+        applyBoost();
+
+    PROFILE_SCOPE(profile_ph);
+    AdcBlock block;
+    bool fresh = false;
+    bool decimated = false;
+    while (takeBlock(ADC_CHANNEL_PH, block))
+    {
+        if (oversampling == 0)
+        {
+            ph_filter.pushBlock(block.samples, block.count);
+        }
+        else
+        {
+            // The health window keeps the base rate, so it spans the time it always did for the same cost
+            for (uint16_t i = 0; i < block.count; i += 1U << oversampling)
+                ph_filter.push(block.samples[i]);
+            if (ph_decimator.pushBlock(block.samples, block.count))
+                decimated = true;
+        }
+        sampling.adc_conversions += block.count;
+        sampling.adc_fixed += (uint64_t)block.count << ph_shift;
+        fresh = true;
+    }
+    if (oversampling > 0)
+        fresh = decimated && ph_decimator.settled(); // A value per decimator output, not per block
+    if (!fresh || ph_filter.keptCount() == 0)
+    {
+        return block_period_us << ph_shift; // Nothing new, come back when the next block should be done
+    }
+
+    SensorNum ph_volt;
+    if (oversampling > 0)
+    {
+        // The decimated average keeps bits below the count, interpolate the table rather than round them away
+        ph_volt = SensorMath::value(ph_calibration.volts(ph_decimator.value(), PhDecimator::FRACTION_BITS));
+    }
+    else
+    {
+        uint16_t kept = ph_filter.keptCount();        // Number of samples in the trimmed mean
+        int64_t ph_avg_val = ph_filter.trimmedSum();  // Sum of the middle elements of the window
+        ph_volt = SensorMath::volts(ph_calibration.millivolts((ph_avg_val + kept / 2) / kept)); // Convert the rounded average to voltage with the calibrated 12-bit table
+    }
+    float ph_act = SensorMath::toFloat(curves.ph(ph_volt)); // Calculate the actual pH value with the probe's calibration
+    ph_volts = SensorMath::toFloat(ph_volt);
+    ph_health.window(ph_filter);                            // Rails and a floating input show in the raw window
+    SensorQuality quality = ph_health.update(ph_act, now_us);
+    sensor_state.publish(SENSOR_PH, ph_act, now_us, quality);
+    sink(READING_PH, 0, ph_act, quality);
+    if (fusion && quality < QUALITY_FAULT)
+        fusion->ph(ph_act, now_us);
+
+    // A new rate starts with the next block, the window keeps its sample count and so widens in time. The decimator
+    // and the health stride are built for the oversampled clock, so while oversampling pH keeps it
+    uint8_t shift = adapt(ph_rate, ph_act, now_us);
+    if (oversampling > 0)
+        shift = 0;
+    if (shift != ph_shift && adc.setRateShift(ADC_CHANNEL_PH, shift))
+        ph_shift = shift;
+    return block_period_us << ph_shift;
+}
+
+uint32_t SensorPipeline::tdsStep(uint32_t now_us)
+{
+    // 1,807 = Read Value Raw
+    // 1,620 = Read Value, temp adusted
+    // 1,760 = Reading from meter
+    // TDS Target is 750 to 1500
+
+    if (calibration_pending)
+        applyCalibration();
+    if (boost_requested)
+        applyBoost();
+
+    // read every finished block of the sensor into the median window
+    AdcBlock block;
+    bool fresh = false;
+    {
+        PROFILE_SCOPE(profile_tds);
+        while (takeBlock(ADC_CHANNEL_TDS, block))
+        {
+            tds_filter.pushBlock(block.samples, block.count);
+            sampling.adc_conversions += block.count;
+            sampling.adc_fixed += (uint64_t)block.count << (tds_shift - oversampling);
+            fresh = true;
+        }
+        if (!fresh)
+        {
+            return block_period_us << tds_shift;
+        }
+        // calibrated voltage of the median of the last SCOUNT samples, the conversion to ppm happens in the state
+        float millivolts = tds_calibration.millivolts(tds_filter.value());
+        tds_health.window(tds_filter);
+        SensorQuality quality = tds_health.update(millivolts, now_us);
+        sensor_state.publish(SENSOR_TDS_MV, millivolts, now_us, quality);
+        if (fusion && quality < QUALITY_FAULT)
+            fusion->tdsVolts(millivolts * 0.001f, now_us); // Uncompensated, the fusion has its own temperature
+
+        uint8_t shift = oversampling + adapt(tds_rate, millivolts, now_us);
+        if (shift != tds_shift && adc.setRateShift(ADC_CHANNEL_TDS, shift))
+            tds_shift = shift;
+    }
+    refreshDerived(now_us);
+    return block_period_us << tds_shift;
+}
+
+bool SensorPipeline::takeBlock(uint8_t channel, AdcBlock &block)
+{
+    if (!adc.readBlock(channel, block))
+        return false;
+    if (recorder)
+        recorder->block(channel, block);
+    return true;
+}
+
+uint32_t SensorPipeline::probeStep(uint32_t now_us)
+{
+    if (calibration_pending)
+        applyCalibration();
+
+    // The TDS probes are compensated with the temperature the first one uses, or not at all without a good one
+    PROFILE_SCOPE(profile_probes);
+    const SensorValue &temperature = sensor_state.get(SENSOR_TEMPERATURE);
+    SensorNum celsius = SensorMath::value(temperature.quality >= QUALITY_FAULT ? 25.0f : temperature.value);
+    for (uint8_t i = 0; i < probe_count; i++)
+    {
+        Probe &probe = probes[i];
+        AdcBlock block;
+        bool fresh = false;
+        while (takeBlock(probe.adc_channel, block))
+        {
+            probe.filter.pushBlock(block.samples, block.count);
+            sampling.adc_conversions += block.count;
+            sampling.adc_fixed += block.count;
+            fresh = true;
+        }
+        uint16_t kept = probe.filter.keptCount();
+        if (!fresh || kept == 0)
+            continue;
+
+        // The same calibrated conversions as the first pair
+        int raw = (probe.filter.trimmedSum() + kept / 2) / kept;
+        float value;
+        if (probe.kind == READING_PH)
+            value = SensorMath::toFloat(curves.ph(SensorMath::volts(ph_calibration.millivolts(raw))));
+        else
+            value = SensorMath::toFloat(curves.tdsPpm(SensorMath::tdsCompensate(SensorMath::volts(tds_calibration.millivolts(raw)), celsius)));
+        sink(probe.kind, probe.index, value, QUALITY_GOOD);
+    }
+    return block_period_us << oversampling;
+}
+
+bool SensorPipeline::fused(FusedReadings &readings) const
+{
+    if (fusion == NULL)
+        return false;
+    readings.temperature = fusion->estimate(SensorFusion::FUSION_TEMPERATURE);
+    readings.ph = fusion->estimate(SensorFusion::FUSION_PH);
+
+    // TDS through the calibrated curve, its bound is half the span of the curve over one sigma either side
+    FusedValue volts = fusion->estimate(SensorFusion::FUSION_TDS_VOLTS);
+    float ppm = SensorMath::toFloat(curves.tdsPpm(SensorMath::value(volts.value)));
+    float low = SensorMath::toFloat(curves.tdsPpm(SensorMath::value(fmaxf(volts.value - volts.sigma, 0))));
+    float high = SensorMath::toFloat(curves.tdsPpm(SensorMath::value(volts.value + volts.sigma)));
+    readings.tds_ppm = {ppm, (high - low) / 2, volts.valid};
+    readings.ec = {ppm / TDS_EC_FACTOR, readings.tds_ppm.sigma / TDS_EC_FACTOR, volts.valid};
+    return true;
+}
+
+void SensorPipeline::refreshDerived(uint32_t now_us)
+{
+    {
+        PROFILE_SCOPE(profile_derive);
+        sensor_state.refresh(now_us);
+    }
+
+    // Every new measurement goes out, an unchanged one too: the dosing loop needs to see that the probe still reads
+    const SensorValue &tds = sensor_state.get(SENSOR_TDS_PPM);
+    if (tds.updates != tds_published_updates)
+    {
+        tds_published_updates = tds.updates;
+        sink(READING_TDS, 0, tds.value, tds.quality);
+    }
+    const SensorValue &ec = sensor_state.get(SENSOR_EC);
+    if (ec.updates != ec_published_updates)
+    {
+        ec_published_updates = ec.updates;
+        sink(READING_EC, 0, ec.value, ec.quality);
+    }
+}
+
+float SensorPipeline::deriveTdsPpm(const SensorValue *const *inputs, void *context)
+{
+    SensorPipeline *pipeline = static_cast<SensorPipeline *>(context);
+
+    // Without any temperature yet, or with a faulty probe, use the reference temperature so no compensation is applied
+    const SensorValue &millivolts = *inputs[0];
+    const SensorValue &temperature = *inputs[1];
+    float celsius = temperature.quality >= QUALITY_FAULT ? 25.0f : temperature.value;
+
+    // Apply the temperature compensation (0.02 per °C around 25 °C) to the voltage
+    SensorNum tds_voltage_normalised = SensorMath::tdsCompensate(SensorMath::volts(millivolts.value), SensorMath::value(celsius));
+
+    // Calculate the TDS value (ppm) from the compensated voltage with the probe's calibrated cubic
+    pipeline->tds_volts = SensorMath::toFloat(tds_voltage_normalised);
+    return SensorMath::toFloat(pipeline->curves.tdsPpm(tds_voltage_normalised));
+}
+
+float SensorPipeline::deriveEc(const SensorValue *const *inputs, void *context)
+{
+    // EC in uS/cm from TDS in ppm
+    return inputs[0]->value / TDS_EC_FACTOR;
+}
+
+uint32_t SensorPipeline::temperatureTask(void *context, uint32_t now_us)
+{
+    return static_cast<SensorPipeline *>(context)->temperatureStep(now_us);
+}
+
+uint32_t SensorPipeline::phTask(void *context, uint32_t now_us)
+{
+    return static_cast<SensorPipeline *>(context)->phStep(now_us);
+}
+
+uint32_t SensorPipeline::tdsTask(void *context, uint32_t now_us)
+{
+    return static_cast<SensorPipeline *>(context)->tdsStep(now_us);
+}
+
+uint32_t SensorPipeline::probeTask(void *context, uint32_t now_us)
+{
+    return static_cast<SensorPipeline *>(context)->probeStep(now_us);
+}
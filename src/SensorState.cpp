@@ -0,0 +1,132 @@
+#include "SensorState.h"
+
+SensorState::SensorState() : derived_count(0), recompute_count(0), skip_count(0)
+{
+    for (uint8_t i = 0; i < SENSOR_KEY_COUNT; i++)
+    {
+        values[i] = SensorValue();
+        values[i].quality = QUALITY_NONE;
+        max_age[i] = 0;
+    }
+}
+
+void SensorState::publish(SensorKey key, float value, uint32_t timestamp_us, SensorQuality quality)
+{
+    store(key, value, timestamp_us, quality);
+}
+
+void SensorState::store(SensorKey key, float value, uint32_t timestamp_us, SensorQuality quality)
+{
+    SensorValue &entry = values[key];
+    bool changed = entry.version == 0 || entry.value != value || entry.quality != quality;
+    entry.value = value;
+    entry.timestamp_us = timestamp_us;
+    entry.quality = quality;
+    entry.updates++;
+    if (changed)
+        entry.version++;
+}
+
+bool SensorState::addDerived(SensorKey key, SensorDerive derive, void *context, SensorKey input_a, SensorKey input_b)
+{
+    if (!addDerived(key, derive, context, input_a))
+        return false;
+    Derived &entry = derived[derived_count - 1];
+    entry.inputs[1] = input_b;
+    entry.seen[1] = 0;
+    entry.touched[1] = 0;
+    entry.input_count = 2;
+    return true;
+}
+
+bool SensorState::addDerived(SensorKey key, SensorDerive derive, void *context, SensorKey input)
+{
+    if (derived_count >= MAX_DERIVED)
+        return false;
+    Derived &entry = derived[derived_count++];
+    entry.key = key;
+    entry.derive = derive;
+    entry.context = context;
+    entry.inputs[0] = input;
+    entry.seen[0] = 0;
+    entry.touched[0] = 0;
+    entry.input_count = 1;
+    return true;
+}
+
+void SensorState::invalidate(SensorKey key)
+{
+    // A version that moved is all a derived entry looks at
+    if (values[key].version != 0)
+        values[key].version++;
+}
+
+uint8_t SensorState::refresh(uint32_t now_us)
+{
+    // Measured values that have not been updated in time lose their good quality
+    for (uint8_t i = 0; i < SENSOR_KEY_COUNT; i++)
+    {
+        SensorValue &entry = values[i];
+        if (max_age[i] != 0 && entry.quality < QUALITY_STALE && now_us - entry.timestamp_us > max_age[i])
+        {
+            entry.quality = QUALITY_STALE;
+            entry.version++;
+        }
+    }
+
+    uint8_t count = 0;
+    for (uint8_t d = 0; d < derived_count; d++)
+    {
+        Derived &entry = derived[d];
+        const SensorValue *inputs[MAX_INPUTS];
+        bool changed = false;
+        bool updated = false;
+        bool available = true;
+        SensorQuality quality = QUALITY_GOOD;
+        uint32_t timestamp = 0;
+
+        for (uint8_t i = 0; i < entry.input_count; i++)
+        {
+            inputs[i] = &values[entry.inputs[i]];
+            changed |= inputs[i]->version != entry.seen[i];
+            updated |= inputs[i]->updates != entry.touched[i];
+            available &= inputs[i]->version != 0;
+
+            // The result is only as good as its worst input and as new as its newest one. Later inputs only
+            // refine the first, derive falls back without them, so their fault makes the result suspect
+            SensorQuality input = inputs[i]->quality;
+            if (i > 0 && input == QUALITY_FAULT)
+                input = QUALITY_SUSPECT;
+            if (input > quality)
+                quality = input;
+            if ((int32_t)(inputs[i]->timestamp_us - timestamp) > 0 || i == 0)
+                timestamp = inputs[i]->timestamp_us;
+        }
+
+        // Nothing to do if no input moved, the first input must exist before anything can be derived
+        if (!changed || values[entry.inputs[0]].version == 0)
+        {
+            // The same inputs measured again give the same value, it is only newer
+            SensorValue &result = values[entry.key];
+            if (updated && result.version != 0)
+            {
+                result.timestamp_us = timestamp;
+                result.updates++;
+                for (uint8_t i = 0; i < entry.input_count; i++)
+                    entry.touched[i] = inputs[i]->updates;
+            }
+            skip_count++;
+            continue;
+        }
+
+        store(entry.key, entry.derive(inputs, entry.context), timestamp, available ? quality : QUALITY_STALE);
+        for (uint8_t i = 0; i < entry.input_count; i++)
+        {
+            entry.seen[i] = inputs[i]->version;
+            entry.touched[i] = inputs[i]->updates;
+        }
+        recompute_count++;
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,210 @@
+#include "SeriesCodec.h"
+#include <math.h>
+
+// Bit widths behind the prefixes 10, 110, 1110 and 1111 (a single 0 is no change).
+// The timestamp buckets are Gorilla's, a report period jitters by a few milliseconds
+static const uint8_t TIME_WIDTHS[4] = {7, 9, 12, 32};
+static const uint8_t VALUE_WIDTHS[4] = {6, 12, 20, 32};
+static const uint8_t PREFIXES[4] = {0x2, 0x6, 0xE, 0xF};
+static const uint8_t PREFIX_WIDTHS[4] = {2, 3, 4, 4};
+
+// Quantised value of something that is not a number, no real value gets there
+#define SERIES_NAN INT32_MIN
+
+static const int32_t SCALES[3] = {SERIES_TDS_SCALE, SERIES_PH_SCALE, SERIES_TEMP_SCALE};
+
+static inline uint32_t zigzag(int32_t value) { return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31); }
+static inline int32_t unzigzag(uint32_t value) { return (int32_t)(value >> 1) ^ -(int32_t)(value & 1); }
+
+int32_t seriesQuantise(float value, int32_t scale)
+{
+    if (!(value == value))
+        return SERIES_NAN;
+    double steps = round((double)value * scale);
+    if (steps > INT32_MAX)
+        return INT32_MAX;
+    if (steps <= INT32_MIN)
+        return INT32_MIN + 1;
+    return (int32_t)steps;
+}
+
+float seriesValue(int32_t steps, int32_t scale)
+{
+    return steps == SERIES_NAN ? NAN : (float)((double)steps / scale);
+}
+
+SeriesEncoder::SeriesEncoder() : buffer(NULL), capacity(0), bits(0), overflow(false), records(0), first_ms(0), previous()
+{
+}
+
+void SeriesEncoder::begin(uint8_t *buffer, size_t capacity)
+{
+    this->buffer = buffer;
+    this->capacity = capacity;
+    bits = 0;
+    overflow = false;
+    records = 0;
+    first_ms = 0;
+    previous = State();
+}
+
+void SeriesEncoder::put(uint32_t value, uint8_t width)
+{
+    // Most significant bit first, into bytes that were cleared when the stream reached them
+    for (uint8_t i = width; i > 0; i--)
+    {
+        if (bits >= capacity * 8)
+        {
+            overflow = true;
+            return;
+        }
+        if ((bits & 7) == 0)
+            buffer[bits >> 3] = 0;
+        if (value >> (i - 1) & 1)
+            buffer[bits >> 3] |= 0x80 >> (bits & 7);
+        bits++;
+    }
+}
+
+void SeriesEncoder::putDelta(uint32_t zigzag, const uint8_t *widths)
+{
+    if (zigzag == 0)
+    {
+        put(0, 1);
+        return;
+    }
+    uint8_t bucket = 0;
+    while (bucket < 3 && zigzag >> widths[bucket] != 0)
+        bucket++;
+    put(PREFIXES[bucket], PREFIX_WIDTHS[bucket]);
+    put(zigzag, widths[bucket]);
+}
+
+bool SeriesEncoder::append(const TelemetryRecord &record)
+{
+    if (records == UINT16_MAX)
+        return false;
+    size_t start_bits = bits;
+    State next;
+    next.sequence = record.sequence;
+    next.timestamp_ms = record.timestamp_ms;
+    next.values[0] = seriesQuantise(record.tds_ppm, SERIES_TDS_SCALE);
+    next.values[1] = seriesQuantise(record.ph, SERIES_PH_SCALE);
+    next.values[2] = seriesQuantise(record.temperature_c, SERIES_TEMP_SCALE);
+    next.status = record.status;
+
+    if (records == 0)
+    {
+        next.delta_ms = 0;
+        put(next.sequence, 16);
+        put(next.timestamp_ms, 32);
+        for (uint8_t i = 0; i < 3; i++)
+            put(next.values[i], 32);
+        put(next.status, 16);
+    }
+    else
+    {
+        // Differences wrap around like the values, the decoder adds them back the same way
+        next.delta_ms = next.timestamp_ms - previous.timestamp_ms;
+        if (next.sequence == (uint16_t)(previous.sequence + 1))
+            put(0, 1);
+        else
+        {
+            put(1, 1);
+            put(next.sequence, 16);
+        }
+        putDelta(zigzag((int32_t)(next.delta_ms - previous.delta_ms)), TIME_WIDTHS);
+        for (uint8_t i = 0; i < 3; i++)
+            putDelta(zigzag((int32_t)((uint32_t)next.values[i] - (uint32_t)previous.values[i])), VALUE_WIDTHS);
+        if (next.status == previous.status)
+            put(0, 1);
+        else
+        {
+            put(1, 1);
+            put(next.status, 16);
+        }
+    }
+
+    // A record that did not fit is taken back, whole bytes behind it are cleared again when the stream reaches them
+    if (overflow)
+    {
+        if (start_bits & 7)
+            buffer[start_bits >> 3] &= 0xFF << (8 - (start_bits & 7));
+        bits = start_bits;
+        overflow = false;
+        return false;
+    }
+    if (records == 0)
+        first_ms = next.timestamp_ms;
+    previous = next;
+    records++;
+    return true;
+}
+
+SeriesDecoder::SeriesDecoder(const uint8_t *data, size_t length, uint16_t count)
+    : data(data), length(length), bits(0), overflow(false), count(count), records(0), sequence(0), timestamp_ms(0),
+      delta_ms(0), values(), status(0)
+{
+}
+
+uint32_t SeriesDecoder::get(uint8_t width)
+{
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < width; i++)
+    {
+        if (bits >= length * 8)
+        {
+            overflow = true;
+            return 0;
+        }
+        value = value << 1 | (data[bits >> 3] >> (7 - (bits & 7)) & 1);
+        bits++;
+    }
+    return value;
+}
+
+uint32_t SeriesDecoder::getDelta(const uint8_t *widths)
+{
+    uint8_t bucket = 0;
+    while (bucket < 4 && get(1) == 1)
+        bucket++;
+    if (bucket == 0)
+        return 0;
+    return get(widths[bucket - 1]);
+}
+
+bool SeriesDecoder::next(TelemetryRecord &record)
+{
+    if (records >= count || overflow)
+        return false;
+
+    if (records == 0)
+    {
+        sequence = get(16);
+        timestamp_ms = get(32);
+        for (uint8_t i = 0; i < 3; i++)
+            values[i] = get(32);
+        status = get(16);
+    }
+    else
+    {
+        sequence = get(1) ? get(16) : sequence + 1;
+        delta_ms += unzigzag(getDelta(TIME_WIDTHS));
+        timestamp_ms += delta_ms;
+        for (uint8_t i = 0; i < 3; i++)
+            values[i] = (int32_t)((uint32_t)values[i] + (uint32_t)unzigzag(getDelta(VALUE_WIDTHS)));
+        if (get(1))
+            status = get(16);
+    }
+    if (overflow)
+        return false;
+
+    record.sequence = sequence;
+    record.timestamp_ms = timestamp_ms;
+    record.tds_ppm = seriesValue(values[0], SCALES[0]);
+    record.ph = seriesValue(values[1], SCALES[1]);
+    record.temperature_c = seriesValue(values[2], SCALES[2]);
+    record.status = status;
+    records++;
+    return true;
+}
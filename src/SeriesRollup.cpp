@@ -0,0 +1,78 @@
+#include "SeriesRollup.h"
+#include <math.h>
+
+static const int32_t SCALES[ROLLUP_CHANNELS] = {ROLLUP_TDS_SCALE, ROLLUP_PH_SCALE, ROLLUP_TEMP_SCALE};
+static const uint16_t VALID[ROLLUP_CHANNELS] = {TELEMETRY_TDS_VALID, TELEMETRY_PH_VALID, TELEMETRY_TEMP_VALID};
+static const uint16_t FAULT[ROLLUP_CHANNELS] = {TELEMETRY_TDS_FAULT, TELEMETRY_PH_FAULT, TELEMETRY_TEMP_FAULT};
+
+// Steps of a value, clamped to what a bucket can hold
+static int16_t rollupSteps(float value, RollupChannel channel)
+{
+    float steps = roundf(value * SCALES[channel]);
+    if (steps > INT16_MAX)
+        return INT16_MAX;
+    if (steps < INT16_MIN)
+        return INT16_MIN;
+    return (int16_t)steps;
+}
+
+float RollupBucket::minimum(RollupChannel channel) const { return (float)min[channel] / SCALES[channel]; }
+float RollupBucket::maximum(RollupChannel channel) const { return (float)max[channel] / SCALES[channel]; }
+float RollupBucket::average(RollupChannel channel) const { return (float)mean[channel] / SCALES[channel]; }
+
+void RollupAccumulator::reset(uint32_t start_ms)
+{
+    this->start_ms = start_ms;
+    records = 0;
+    status = 0;
+    for (uint8_t i = 0; i < ROLLUP_CHANNELS; i++)
+    {
+        counts[i] = 0;
+        min[i] = INFINITY;
+        max[i] = -INFINITY;
+        sum[i] = 0;
+        base[i] = 0;
+    }
+}
+
+void RollupAccumulator::add(const TelemetryRecord &record)
+{
+    if (records < UINT16_MAX)
+        records++;
+    status |= record.status & ~(TELEMETRY_TDS_VALID | TELEMETRY_PH_VALID | TELEMETRY_TEMP_VALID);
+
+    const float values[ROLLUP_CHANNELS] = {record.tds_ppm, record.ph, record.temperature_c};
+    for (uint8_t i = 0; i < ROLLUP_CHANNELS; i++)
+    {
+        if ((record.status & (VALID[i] | FAULT[i])) != VALID[i] || !isfinite(values[i]))
+            continue;
+        // Summed around the first value, a float sum of an hour of 1000 ppm values would lose the decimals
+        if (counts[i]++ == 0)
+            base[i] = values[i];
+        sum[i] += values[i] - base[i];
+        if (values[i] < min[i])
+            min[i] = values[i];
+        if (values[i] > max[i])
+            max[i] = values[i];
+    }
+}
+
+void RollupAccumulator::summarise(RollupBucket &bucket) const
+{
+    bucket.start_ms = start_ms;
+    bucket.count = records;
+    bucket.status = status;
+    for (uint8_t i = 0; i < ROLLUP_CHANNELS; i++)
+    {
+        RollupChannel channel = (RollupChannel)i;
+        if (counts[i] == 0)
+        {
+            bucket.min[i] = bucket.max[i] = bucket.mean[i] = 0;
+            continue;
+        }
+        bucket.status |= VALID[i];
+        bucket.min[i] = rollupSteps(min[i], channel);
+        bucket.max[i] = rollupSteps(max[i], channel);
+        bucket.mean[i] = rollupSteps(base[i] + sum[i] / counts[i], channel);
+    }
+}
@@ -0,0 +1,103 @@
+#include "SocketTransport.h"
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+// lwIP has no SIGPIPE to suppress
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+bool SocketTransport::connect(const char *host, uint16_t port)
+{
+    close();
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &address.sin_addr) != 1)
+        return false;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+    int flags = fcntl(fd, F_GETFL, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // A batch goes out as one message, nothing to wait for
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        close();
+        return false;
+    }
+
+    // Loopback may finish at once, anything else is still in progress
+    if (::connect(fd, (sockaddr *)&address, sizeof(address)) == 0)
+        current = TRANSPORT_OPEN;
+    else if (errno == EINPROGRESS)
+        current = TRANSPORT_CONNECTING;
+    else
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+TransportState SocketTransport::state()
+{
+    if (current != TRANSPORT_CONNECTING)
+        return current;
+
+    // The connect is done once the socket is writable, SO_ERROR tells how it went
+    fd_set writable;
+    FD_ZERO(&writable);
+    FD_SET(fd, &writable);
+    timeval now = {0, 0};
+    if (select(fd + 1, NULL, &writable, NULL, &now) <= 0)
+        return current;
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0)
+        close();
+    else
+        current = TRANSPORT_OPEN;
+    return current;
+}
+
+size_t SocketTransport::write(const uint8_t *data, size_t length)
+{
+    if (current != TRANSPORT_OPEN)
+        return 0;
+    ssize_t sent = send(fd, data, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent >= 0)
+        return sent;
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+        close();
+    return 0;
+}
+
+size_t SocketTransport::read(uint8_t *data, size_t length)
+{
+    if (current != TRANSPORT_OPEN)
+        return 0;
+    ssize_t received = recv(fd, data, length, MSG_DONTWAIT);
+    if (received > 0)
+        return received;
+    if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        close();
+    return 0;
+}
+
+void SocketTransport::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    current = TRANSPORT_CLOSED;
+}
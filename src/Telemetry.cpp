@@ -0,0 +1,166 @@
+#include "Telemetry.h"
+#include "ByteOrder.h"
+
+uint16_t crc16Ccitt(const uint8_t *data, size_t length, uint16_t crc)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+size_t cobsEncode(const uint8_t *in, size_t length, uint8_t *out)
+{
+    size_t code_index = 0; // Where the length code of the current run goes
+    size_t write = 1;      // Next output byte
+    uint8_t code = 1;      // Length of the current run plus one
+
+    for (size_t i = 0; i < length; i++)
+    {
+        if (in[i] == 0)
+        {
+            // A zero ends the run, its position is implied by the code
+            out[code_index] = code;
+            code_index = write++;
+            code = 1;
+            continue;
+        }
+        out[write++] = in[i];
+        if (++code == 0xFF)
+        {
+            // Maximum run length, start a new run without an implied zero
+            out[code_index] = code;
+            code_index = write++;
+            code = 1;
+        }
+    }
+    out[code_index] = code;
+    return write;
+}
+
+size_t cobsDecode(const uint8_t *in, size_t length, uint8_t *out)
+{
+    size_t read = 0;
+    size_t write = 0;
+
+    while (read < length)
+    {
+        uint8_t code = in[read++];
+        if (code == 0 || read + code - 1 > length)
+            return 0; // Zero inside a frame or a run past the end
+        for (uint8_t i = 1; i < code; i++)
+        {
+            if (in[read] == 0)
+                return 0;
+            out[write++] = in[read++];
+        }
+        // Every short run except the last one stands for a zero
+        if (code < 0xFF && read < length)
+            out[write++] = 0;
+    }
+    return write;
+}
+
+size_t telemetryEncode(const TelemetryRecord &record, uint8_t *frame, size_t capacity)
+{
+    if (capacity < TELEMETRY_FRAME_SIZE)
+        return 0;
+
+    // Serialise and append the CRC
+    uint8_t raw[TELEMETRY_RAW_SIZE];
+    uint8_t *p = raw;
+    *p++ = TELEMETRY_VERSION;
+    p = put16(p, record.sequence);
+    p = put32(p, record.timestamp_ms);
+    p = putFloat(p, record.tds_ppm);
+    p = putFloat(p, record.ph);
+    p = putFloat(p, record.temperature_c);
+    p = put16(p, record.status);
+    put16(p, crc16Ccitt(raw, TELEMETRY_PAYLOAD_SIZE));
+
+    // Delimiter, COBS body, delimiter
+    frame[0] = 0;
+    size_t length = 1 + cobsEncode(raw, TELEMETRY_RAW_SIZE, frame + 1);
+    frame[length++] = 0;
+    return length;
+}
+
+bool telemetryDecode(const uint8_t *frame, size_t length, TelemetryRecord &record)
+{
+    // Anything longer can not be one of our frames, and is not worth decoding
+    if (length == 0 || length > TELEMETRY_FRAME_SIZE - 2)
+        return false;
+
+    uint8_t raw[TELEMETRY_FRAME_SIZE];
+    if (cobsDecode(frame, length, raw) != TELEMETRY_RAW_SIZE)
+        return false;
+    if (get16(raw + TELEMETRY_PAYLOAD_SIZE) != crc16Ccitt(raw, TELEMETRY_PAYLOAD_SIZE) || raw[0] != TELEMETRY_VERSION)
+        return false;
+
+    record.sequence = get16(raw + 1);
+    record.timestamp_ms = get32(raw + 3);
+    record.tds_ppm = getFloat(raw + 7);
+    record.ph = getFloat(raw + 11);
+    record.temperature_c = getFloat(raw + 15);
+    record.status = get16(raw + 19);
+    return true;
+}
+
+// Frame around a block with a version byte of its own and a count, shared by the batch and trace frames
+static size_t encodeBlockFrame(uint8_t version, const uint8_t *block, size_t length, uint16_t count, uint8_t *frame, size_t capacity)
+{
+    if (length > TELEMETRY_BATCH_MAX || capacity < telemetryBatchFrameSize(length))
+        return 0;
+
+    uint8_t raw[TELEMETRY_BATCH_RAW_SIZE];
+    uint8_t *p = raw;
+    *p++ = version;
+    p = put16(p, count);
+    memcpy(p, block, length);
+    p += length;
+    put16(p, crc16Ccitt(raw, p - raw));
+
+    frame[0] = 0;
+    size_t framed = 1 + cobsEncode(raw, p - raw + 2, frame + 1);
+    frame[framed++] = 0;
+    return framed;
+}
+
+static bool decodeBlockFrame(uint8_t version, const uint8_t *frame, size_t length, uint8_t *block, size_t &block_length, uint16_t &count)
+{
+    if (length == 0 || length > TELEMETRY_BATCH_FRAME_SIZE - 2)
+        return false;
+
+    uint8_t raw[TELEMETRY_BATCH_FRAME_SIZE];
+    size_t decoded = cobsDecode(frame, length, raw);
+    if (decoded < 1 + 2 + 2 || decoded > TELEMETRY_BATCH_RAW_SIZE || raw[0] != version || get16(raw + decoded - 2) != crc16Ccitt(raw, decoded - 2))
+        return false;
+
+    count = get16(raw + 1);
+    block_length = decoded - 1 - 2 - 2;
+    memcpy(block, raw + 3, block_length);
+    return true;
+}
+
+size_t telemetryEncodeBatch(const uint8_t *block, size_t length, uint16_t count, uint8_t *frame, size_t capacity)
+{
+    return encodeBlockFrame(TELEMETRY_BATCH_VERSION, block, length, count, frame, capacity);
+}
+
+bool telemetryDecodeBatch(const uint8_t *frame, size_t length, uint8_t *block, size_t &block_length, uint16_t &count)
+{
+    return decodeBlockFrame(TELEMETRY_BATCH_VERSION, frame, length, block, block_length, count);
+}
+
+size_t telemetryEncodeTrace(const uint8_t *block, size_t length, uint16_t count, uint8_t *frame, size_t capacity)
+{
+    return encodeBlockFrame(TELEMETRY_TRACE_VERSION, block, length, count, frame, capacity);
+}
+
+bool telemetryDecodeTrace(const uint8_t *frame, size_t length, uint8_t *block, size_t &block_length, uint16_t &count)
+{
+    return decodeBlockFrame(TELEMETRY_TRACE_VERSION, frame, length, block, block_length, count);
+}
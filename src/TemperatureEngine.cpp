@@ -0,0 +1,158 @@
+#include "TemperatureEngine.h"
+#include <string.h>
+
+TemperatureEngine::TemperatureEngine(TemperatureBus &bus, SchedulerClock clock) : bus(bus), clock(clock), probe_count(0)
+{
+}
+
+uint8_t TemperatureEngine::begin(uint32_t now_us, uint8_t resolution, uint32_t period_ms)
+{
+    // Scan once and remember every address, the bus is never searched again
+    uint8_t found = bus.scan();
+    probe_count = 0;
+    for (uint8_t i = 0; i < found && probe_count < MAX_PROBES; i++)
+    {
+        Probe &probe = probes[probe_count];
+        memset(&probe, 0, sizeof(probe));
+        if (!bus.address(i, probe.address))
+            continue;
+        probe.due_us = now_us;
+        probe_count++;
+        configureProbe(probe_count - 1, resolution, period_ms);
+    }
+    return probe_count;
+}
+
+bool TemperatureEngine::configureProbe(uint8_t index, uint8_t resolution, uint32_t period_ms)
+{
+    if (index >= probe_count || resolution < 9 || resolution > 12)
+        return false;
+
+    Probe &probe = probes[index];
+    probe.resolution = resolution;
+    probe.period_us = period_ms * 1000UL;
+
+    // The period can not be shorter than the conversion itself
+    if (probe.period_us < probeConversionTimeUs(resolution))
+        probe.period_us = probeConversionTimeUs(resolution);
+
+    return bus.setResolution(probe.address, resolution);
+}
+
+bool TemperatureEngine::setPeriodShift(uint8_t index, uint8_t shift)
+{
+    // The due times are compared with signed differences, the period must stay below half the clock range
+    if (index >= probe_count || shift > 31 || ((uint64_t)probes[index].period_us << shift) > INT32_MAX)
+        return false;
+
+    // A failing probe keeps its backoff
+    Probe &probe = probes[index];
+    probe.period_shift = shift;
+    uint32_t due_us = probe.started_us + (probe.period_us << shift);
+    if (!probe.converting && probe.missed == 0 && probe.reads > 0 && (int32_t)(due_us - probe.due_us) < 0)
+        probe.due_us = due_us;
+    return true;
+}
+
+void TemperatureEngine::save(Snapshot &snapshot) const
+{
+    snapshot.probe_count = probe_count;
+    for (uint8_t i = 0; i < probe_count; i++)
+    {
+        memcpy(snapshot.addresses[i], probes[i].address, sizeof(ProbeAddress));
+        snapshot.resolutions[i] = probes[i].resolution;
+        snapshot.periods_us[i] = probes[i].period_us;
+    }
+}
+
+uint8_t TemperatureEngine::resume(const Snapshot &snapshot, uint32_t now_us)
+{
+    // The probes stay powered through the sleep and keep their resolution, only the table is rebuilt
+    probe_count = 0;
+    for (uint8_t i = 0; i < snapshot.probe_count && probe_count < MAX_PROBES; i++)
+    {
+        Probe &probe = probes[probe_count++];
+        memset(&probe, 0, sizeof(probe));
+        memcpy(probe.address, snapshot.addresses[i], sizeof(ProbeAddress));
+        probe.resolution = snapshot.resolutions[i];
+        probe.period_us = snapshot.periods_us[i];
+        probe.due_us = now_us;
+    }
+    return probe_count;
+}
+
+uint32_t TemperatureEngine::step(uint32_t now_us)
+{
+    uint32_t next_us = UINT32_MAX;
+
+    for (uint8_t i = 0; i < probe_count; i++)
+    {
+        Probe &probe = probes[i];
+
+        // Compare with a signed difference so the clock wrap is harmless
+        if ((int32_t)(now_us - probe.due_us) >= 0)
+        {
+            if (!probe.converting)
+            {
+                // Kick off the conversion and come back once it has had time to finish,
+                // the device only starts converting once the command is on the wire
+                probe.started_us = now_us;
+                probe.converting = bus.startConversion(probe.address);
+                if (probe.converting)
+                    probe.due_us = clock() + probeConversionTimeUs(probe.resolution);
+                else
+                    failed(probe, now_us);
+            }
+            else
+            {
+                // Conversion time is up, read the scratchpad by its cached address
+                float celsius = bus.readCelsius(probe.address);
+                probe.converting = false;
+                probe.reads++;
+                probe.valid = celsius != PROBE_DISCONNECTED_C;
+                if (probe.valid)
+                {
+                    probe.celsius = celsius;
+                    probe.timestamp_us = now_us;
+                    probe.missed = 0;
+                    probe.due_us = probe.started_us + (probe.period_us << probe.period_shift);
+                    if ((int32_t)(probe.due_us - now_us) < 0)
+                        probe.due_us = now_us;
+                }
+                else
+                {
+                    failed(probe, now_us);
+                }
+            }
+        }
+
+        // Track the earliest event so the scheduler can sleep until then
+        uint32_t remaining = (int32_t)(probe.due_us - now_us) > 0 ? probe.due_us - now_us : 0;
+        if (remaining < next_us)
+            next_us = remaining;
+    }
+
+    // Without probes there is nothing to do, check back in a second
+    return probe_count > 0 ? next_us : 1000000UL;
+}
+
+void TemperatureEngine::failed(Probe &probe, uint32_t now_us)
+{
+    probe.valid = false;
+    probe.failures++;
+    if (probe.missed < UINT8_MAX)
+        probe.missed++;
+
+    // One period after the first failure, then twice as long for every further one
+    uint8_t doublings = probe.missed - 1 < BACKOFF_DOUBLINGS ? probe.missed - 1 : BACKOFF_DOUBLINGS;
+    uint64_t delay_us = (uint64_t)probe.period_us << doublings;
+    uint32_t limit_us = probe.period_us > BACKOFF_MAX_US ? probe.period_us : BACKOFF_MAX_US;
+    probe.due_us = probe.started_us + (delay_us < limit_us ? (uint32_t)delay_us : limit_us);
+    if ((int32_t)(probe.due_us - now_us) < 0)
+        probe.due_us = now_us;
+}
+
+uint32_t TemperatureEngine::schedulerStep(void *context, uint32_t now_us)
+{
+    return static_cast<TemperatureEngine *>(context)->step(now_us);
+}
@@ -0,0 +1,14 @@
+#include <Arduino.h>
+#include "Hal.h"
+
+uint32_t IRAM_ATTR halMicros() { return micros(); }
+
+uint32_t halMillis() { return millis(); }
+
+uint32_t IRAM_ATTR halCycles() { return ESP.getCycleCount(); }
+
+uint32_t halCyclesPerUs() { return ESP.getCpuFreqMHz(); }
+
+uint16_t halAnalogRead(uint8_t pin) { return analogRead(pin); }
+
+void halDelay(uint32_t ms) { delay(ms); }
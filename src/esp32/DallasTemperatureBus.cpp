@@ -0,0 +1,31 @@
+#include "DallasTemperatureBus.h"
+
+uint8_t DallasTemperatureBus::scan()
+{
+    // Search the bus once and switch the library to non-blocking conversions
+    sensors.begin();
+    sensors.setWaitForConversion(false);
+    return sensors.getDeviceCount();
+}
+
+bool DallasTemperatureBus::address(uint8_t index, ProbeAddress address)
+{
+    return sensors.getAddress(address, index);
+}
+
+bool DallasTemperatureBus::setResolution(const ProbeAddress address, uint8_t bits)
+{
+    // Skip the global resolution bookkeeping, every probe keeps its own
+    return sensors.setResolution(address, bits, true);
+}
+
+bool DallasTemperatureBus::startConversion(const ProbeAddress address)
+{
+    return sensors.requestTemperaturesByAddress(address);
+}
+
+float DallasTemperatureBus::readCelsius(const ProbeAddress address)
+{
+    float celsius = sensors.getTempC(address);
+    return celsius == DEVICE_DISCONNECTED_C ? PROBE_DISCONNECTED_C : celsius;
+}
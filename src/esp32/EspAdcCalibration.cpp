@@ -0,0 +1,29 @@
+#include "EspAdcCalibration.h"
+
+// Calibration curve backed by esp_adc_cal, only evaluated while the table is built
+static uint32_t espAdcCurve(uint16_t raw, const void *context)
+{
+    return esp_adc_cal_raw_to_voltage(raw, static_cast<const esp_adc_cal_characteristics_t *>(context));
+}
+
+esp_adc_cal_value_t calibrateAdc(AdcCalibration &calibration, adc_unit_t unit)
+{
+    // The characteristics are only needed while the table is built, keep them on the stack
+    esp_adc_cal_characteristics_t characteristics;
+    esp_adc_cal_value_t source = esp_adc_cal_characterize(unit, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, ADC_DEFAULT_VREF_MV, &characteristics);
+    calibration.build(espAdcCurve, &characteristics);
+    return source;
+}
+
+const char *adcCalibrationName(esp_adc_cal_value_t source)
+{
+    switch (source)
+    {
+    case ESP_ADC_CAL_VAL_EFUSE_TP:
+        return "eFuse two point";
+    case ESP_ADC_CAL_VAL_EFUSE_VREF:
+        return "eFuse Vref";
+    default:
+        return "default Vref";
+    }
+}
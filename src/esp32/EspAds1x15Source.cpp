@@ -0,0 +1,57 @@
+#include "EspAds1x15Source.h"
+#include "Hal.h"
+
+// Priority of the sampling task, as for the on-chip ADC's
+#define ADS_TASK_PRIORITY (configMAX_PRIORITIES - 2)
+#define ADS_TASK_STACK_SIZE 2048
+
+EspAds1x15Source::EspAds1x15Source(I2cBus &bus, const uint8_t *addresses, const uint8_t *alert_pins, uint8_t device_count,
+                                   Ads1x15Model model, uint8_t core)
+    : Ads1x15Source(bus, addresses, device_count, model), core(core), task(NULL)
+{
+    for (uint8_t i = 0; i < device_count && i < ADS1X15_MAX_DEVICES; i++)
+    {
+        this->alert_pins[i] = alert_pins[i];
+        alerts[i] = {this, i};
+    }
+}
+
+bool EspAds1x15Source::begin(const uint8_t *pins, uint8_t channel_count, uint32_t sample_rate_hz)
+{
+    // The task and the interrupts must exist before the first conversion finishes
+    if (task == NULL)
+        xTaskCreatePinnedToCore(samplingTask, "ads", ADS_TASK_STACK_SIZE, this, ADS_TASK_PRIORITY, &task, core);
+    for (uint8_t device = 0; device < ADS1X15_MAX_DEVICES; device++)
+    {
+        bool used = false;
+        for (uint8_t i = 0; i < channel_count; i++)
+            used |= pins[i] / ADS1X15_INPUTS == device;
+        if (!used)
+            continue;
+        // ALERT/RDY is open drain, active low
+        pinMode(alert_pins[device], INPUT_PULLUP);
+        attachInterruptArg(alert_pins[device], onAlert, &alerts[device], FALLING);
+    }
+    return Ads1x15Source::begin(pins, channel_count, sample_rate_hz);
+}
+
+void IRAM_ATTR EspAds1x15Source::onAlert(void *context)
+{
+    Alert *alert = static_cast<Alert *>(context);
+    if (!alert->source->ready(alert->device))
+        return;
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(alert->source->task, &woken);
+    if (woken)
+        portYIELD_FROM_ISR();
+}
+
+void EspAds1x15Source::samplingTask(void *context)
+{
+    EspAds1x15Source *source = static_cast<EspAds1x15Source *>(context);
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        source->service(halMicros());
+    }
+}
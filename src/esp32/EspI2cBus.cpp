@@ -0,0 +1,51 @@
+#include "EspI2cBus.h"
+
+// Longest a batch may hold the bus, a stuck slave fails the transaction instead of the task
+#define ESP_I2C_TIMEOUT_MS 20
+
+EspI2cBus::EspI2cBus(i2c_port_t port) : port(port)
+{
+}
+
+bool EspI2cBus::begin(uint8_t sda_pin, uint8_t scl_pin, uint32_t frequency_hz)
+{
+    i2c_config_t config = {};
+    config.mode = I2C_MODE_MASTER;
+    config.sda_io_num = sda_pin;
+    config.scl_io_num = scl_pin;
+    config.sda_pullup_en = GPIO_PULLUP_ENABLE;
+    config.scl_pullup_en = GPIO_PULLUP_ENABLE;
+    config.master.clk_speed = frequency_hz;
+    if (i2c_param_config(port, &config) != ESP_OK)
+        return false;
+    return i2c_driver_install(port, I2C_MODE_MASTER, 0, 0, 0) == ESP_OK;
+}
+
+bool EspI2cBus::transfer(const I2cTransfer *transfers, uint8_t count)
+{
+    if (count > ESP_I2C_MAX_TRANSFERS)
+        return false;
+
+    // A repeated start before every part, one stop after the last
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(link, sizeof(link));
+    for (uint8_t i = 0; i < count; i++)
+    {
+        const I2cTransfer &transfer = transfers[i];
+        if (transfer.write_length > 0)
+        {
+            i2c_master_start(cmd);
+            i2c_master_write_byte(cmd, transfer.address << 1 | I2C_MASTER_WRITE, true);
+            i2c_master_write(cmd, transfer.write, transfer.write_length, true);
+        }
+        if (transfer.read_length > 0)
+        {
+            i2c_master_start(cmd);
+            i2c_master_write_byte(cmd, transfer.address << 1 | I2C_MASTER_READ, true);
+            i2c_master_read(cmd, transfer.read, transfer.read_length, I2C_MASTER_LAST_NACK);
+        }
+    }
+    i2c_master_stop(cmd);
+    esp_err_t result = i2c_master_cmd_begin(port, cmd, pdMS_TO_TICKS(ESP_I2C_TIMEOUT_MS));
+    i2c_cmd_link_delete_static(cmd);
+    return result == ESP_OK;
+}
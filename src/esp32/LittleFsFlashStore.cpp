@@ -0,0 +1,77 @@
+#include "LittleFsFlashStore.h"
+
+bool LittleFsFlashStore::begin()
+{
+    if (!LittleFS.begin(true))
+        return false;
+    if (!LittleFS.exists(directory))
+        LittleFS.mkdir(directory);
+    return true;
+}
+
+void LittleFsFlashStore::path(uint8_t slot, char *buffer, size_t size) const
+{
+    snprintf(buffer, size, "%s/seg%02u.bin", directory, slot);
+}
+
+File &LittleFsFlashStore::openForReading(uint8_t slot)
+{
+    if (reading_slot == slot)
+        return reading;
+    closeReading();
+
+    // Check first, opening a missing file for reading logs an error
+    char name[32];
+    path(slot, name, sizeof(name));
+    if (LittleFS.exists(name))
+    {
+        reading = LittleFS.open(name, FILE_READ);
+        reading_slot = slot;
+    }
+    return reading;
+}
+
+void LittleFsFlashStore::closeReading()
+{
+    if (reading_slot >= 0)
+        reading.close();
+    reading_slot = -1;
+}
+
+uint32_t LittleFsFlashStore::size(uint8_t slot)
+{
+    File &file = openForReading(slot);
+    return reading_slot >= 0 && file ? file.size() : 0;
+}
+
+size_t LittleFsFlashStore::read(uint8_t slot, uint32_t offset, uint8_t *data, size_t length)
+{
+    File &file = openForReading(slot);
+    if (reading_slot < 0 || !file || !file.seek(offset))
+        return 0;
+    return file.read(data, length);
+}
+
+bool LittleFsFlashStore::append(uint8_t slot, const uint8_t *data, size_t length)
+{
+    // A reader open on the same file would not see the new size
+    if (reading_slot == slot)
+        closeReading();
+    char name[32];
+    path(slot, name, sizeof(name));
+    File file = LittleFS.open(name, FILE_APPEND);
+    if (!file)
+        return false;
+    size_t written = file.write(data, length);
+    file.close();
+    return written == length;
+}
+
+bool LittleFsFlashStore::erase(uint8_t slot)
+{
+    if (reading_slot == slot)
+        closeReading();
+    char name[32];
+    path(slot, name, sizeof(name));
+    return !LittleFS.exists(name) || LittleFS.remove(name);
+}
@@ -0,0 +1,31 @@
+#include "NvsCalibrationStore.h"
+
+// Key of the blob inside the namespace
+#define NVS_CALIBRATION_KEY "coeffs"
+
+bool NvsCalibrationStore::begin()
+{
+    ready = preferences.begin(name, false);
+    return ready;
+}
+
+size_t NvsCalibrationStore::read(uint8_t *data, size_t capacity)
+{
+    // Checked first, reading a missing key logs an error
+    if (!ready || !preferences.isKey(NVS_CALIBRATION_KEY))
+        return 0;
+    size_t length = preferences.getBytesLength(NVS_CALIBRATION_KEY);
+    if (length <= capacity)
+        preferences.getBytes(NVS_CALIBRATION_KEY, data, length);
+    return length;
+}
+
+bool NvsCalibrationStore::write(const uint8_t *data, size_t length)
+{
+    return ready && preferences.putBytes(NVS_CALIBRATION_KEY, data, length) == length;
+}
+
+bool NvsCalibrationStore::erase()
+{
+    return ready && (!preferences.isKey(NVS_CALIBRATION_KEY) || preferences.remove(NVS_CALIBRATION_KEY));
+}
@@ -0,0 +1,123 @@
+#include "TimerAdcSource.h"
+#include "Hal.h"
+#include "Profiler.h"
+
+// Priority of the sampling task, above the acquisition scheduler so the sample clock wins
+#define ADC_TASK_PRIORITY (configMAX_PRIORITIES - 2)
+#define ADC_TASK_STACK_SIZE 2048
+
+// Profiling - One conversion of every pin, the analog reads take most of it
+PROFILE_STAGE(profile_adc, "adc");
+
+TimerAdcSource *TimerAdcSource::active = NULL;
+
+TimerAdcSource::TimerAdcSource(uint8_t timer_index, uint8_t core)
+    : timer_index(timer_index), core(core), timer(NULL), task(NULL), channel_count(0), tick(0), overflow_count(0), missed_ticks(0)
+{
+}
+
+bool TimerAdcSource::begin(const uint8_t *pins, uint8_t channel_count, uint32_t sample_rate_hz)
+{
+    // Only one instance can own the timer interrupt
+    if (active != NULL || channel_count == 0 || channel_count > MAX_CHANNELS || sample_rate_hz == 0)
+        return false;
+
+    this->channel_count = channel_count;
+    for (uint8_t i = 0; i < channel_count; i++)
+    {
+        this->pins[i] = pins[i];
+        filling[i].count = 0;
+        requested_shift[i] = 0;
+        block_shift[i] = 0;
+        pinMode(pins[i], INPUT);
+    }
+    active = this;
+
+    // The sampling task must exist before the first interrupt tries to notify it
+    xTaskCreatePinnedToCore(samplingTask, "adc", ADC_TASK_STACK_SIZE, this, ADC_TASK_PRIORITY, &task, core);
+
+    // 80 MHz APB clock divided by 80 gives a 1 MHz timer, the alarm sets the sample period
+    timer = timerBegin(timer_index, 80, true);
+    timerAttachInterrupt(timer, &TimerAdcSource::onTimer, true);
+    timerAlarmWrite(timer, 1000000UL / sample_rate_hz, true);
+    timerAlarmEnable(timer);
+    return true;
+}
+
+bool TimerAdcSource::setRateShift(uint8_t channel, uint8_t shift)
+{
+    if (channel >= channel_count || shift > 15)
+        return false;
+    requested_shift[channel] = shift; // One byte, picked up by the sampling task at the next block
+    return true;
+}
+
+void TimerAdcSource::pause()
+{
+    timerAlarmDisable(timer);
+}
+
+void TimerAdcSource::resume()
+{
+    // The sampling task only runs on a tick, with the alarm off it is idle and the blocks are ours.
+    // Samples from before the sleep would share a block with ones from after it, start afresh
+    for (uint8_t i = 0; i < channel_count; i++)
+        filling[i].count = 0;
+    timerAlarmEnable(timer);
+}
+
+bool TimerAdcSource::readBlock(uint8_t channel, AdcBlock &block)
+{
+    if (channel >= channel_count)
+        return false;
+    return finished[channel].pop(block);
+}
+
+void IRAM_ATTR TimerAdcSource::onTimer()
+{
+    // A notification count above zero means the task has not finished the previous tick
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(active->task, &woken);
+    if (woken)
+        portYIELD_FROM_ISR();
+}
+
+void TimerAdcSource::samplingTask(void *context)
+{
+    TimerAdcSource *source = static_cast<TimerAdcSource *>(context);
+    for (;;)
+    {
+        // Every pending tick is one sample period, more than one means we fell behind
+        uint32_t ticks = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (ticks > 1)
+            source->missed_ticks += ticks - 1;
+        source->sampleOnce();
+    }
+}
+
+void TimerAdcSource::sampleOnce()
+{
+    PROFILE_SCOPE(profile_adc);
+    uint32_t now = halMicros();
+    tick++;
+    for (uint8_t i = 0; i < channel_count; i++)
+    {
+        // A block keeps one spacing throughout, a new shift waits for the next one
+        AdcBlock &block = filling[i];
+        if (block.count == 0)
+            block_shift[i] = requested_shift[i];
+        if (tick & ((1UL << block_shift[i]) - 1))
+            continue;
+        if (block.count == 0)
+            block.timestamp_us = now;
+        block.samples[block.count++] = halAnalogRead(pins[i]);
+
+        // Hand the block over once it is full, a full ring costs the whole block
+        if (block.count == ADC_BLOCK_SIZE)
+        {
+            if (!finished[i].push(block))
+                overflow_count++;
+            block.count = 0;
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#include "TimerControlLoop.h"
+#include "Hal.h"
+
+// Priority of the control task, level with the ADC sampling task so nothing on the loop core delays a tick
+#define CONTROL_TASK_PRIORITY (configMAX_PRIORITIES - 2)
+#define CONTROL_TASK_STACK_SIZE 3072
+
+TimerControlLoop *TimerControlLoop::active = NULL;
+
+TimerControlLoop::TimerControlLoop(uint8_t timer_index, uint8_t core)
+    : timer_index(timer_index), core(core), timer(NULL), task(NULL), period_us(0), step(NULL), context(NULL),
+      tick_us(0), reset_requested(false), restarted(true)
+{
+}
+
+bool TimerControlLoop::begin(uint32_t period_us, ControlStep step, void *context)
+{
+    // Only one instance can own the timer interrupt
+    if (active != NULL || period_us == 0 || step == NULL)
+        return false;
+
+    this->period_us = period_us;
+    this->step = step;
+    this->context = context;
+    active = this;
+
+    // The control task must exist before the first interrupt tries to notify it
+    xTaskCreatePinnedToCore(controlTask, "control", CONTROL_TASK_STACK_SIZE, this, CONTROL_TASK_PRIORITY, &task, core);
+
+    // 1 MHz timer like the ADC pacing, the alarm sets the control period
+    timer = timerBegin(timer_index, 80, true);
+    timerAttachInterrupt(timer, &TimerControlLoop::onTimer, true);
+    timerAlarmWrite(timer, period_us, true);
+    timerAlarmEnable(timer);
+    return true;
+}
+
+void TimerControlLoop::pause()
+{
+    timerAlarmDisable(timer);
+}
+
+void TimerControlLoop::resume()
+{
+    // The time asleep is not lateness, measure against a fresh grid
+    restarted = true;
+    timerAlarmEnable(timer);
+}
+
+void IRAM_ATTR TimerControlLoop::onTimer()
+{
+    BaseType_t woken = pdFALSE;
+    active->tick_us = halMicros();
+    vTaskNotifyGiveFromISR(active->task, &woken);
+    if (woken)
+        portYIELD_FROM_ISR();
+}
+
+void TimerControlLoop::controlTask(void *context)
+{
+    TimerControlLoop *loop = static_cast<TimerControlLoop *>(context);
+    uint32_t ideal_us = 0;
+    for (;;)
+    {
+        // More than one pending tick means the previous step overran
+        uint32_t pending = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        uint32_t start = halMicros();
+        if (loop->reset_requested)
+        {
+            loop->ticks.reset();
+            loop->reset_requested = false;
+        }
+
+        // The first interrupt after a (re)start anchors the grid, every later tick is a period after the last
+        if (loop->restarted)
+        {
+            ideal_us = loop->tick_us;
+            loop->restarted = false;
+        }
+        else
+        {
+            ideal_us += pending * loop->period_us;
+        }
+
+        // The timer and the microsecond clock share a crystal, a tick can still look a few us early
+        if ((int32_t)(start - ideal_us) < 0)
+            ideal_us = start;
+
+        loop->step(loop->context, start);
+        loop->ticks.record(start - ideal_us, halMicros() - start, pending - 1);
+    }
+}
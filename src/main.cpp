@@ -2,12 +2,195 @@
 #include <Arduino.h> // Arduino core library, provides core functions like delay(), digitalRead(), digitalWrite(), etc.
 #include <OneWire.h>
 #include <DallasTemperature.h>
-#include <algorithm>
+#include "Scheduler.h" // Cooperative scheduler that runs each sensor as its own state machine
+#include "TemperatureEngine.h"    // Asynchronous DS18B20 conversions
+#include "DallasTemperatureBus.h" // TemperatureBus on top of DallasTemperature
+#include "SpscRing.h"             // Lock-free handoff between the two cores
+#include "Reading.h"              // Timestamped measurement passed through the ring
+#include "TimerAdcSource.h"       // Hardware timer paced continuous ADC sampling
+#include "EspAds1x15Source.h"     // ADS1115 / ADS1015 chain paced by its ALERT/RDY pins
+#include "EspI2cBus.h"            // Batched I2C transactions for the chain
+#include "EspAdcCalibration.h"    // eFuse calibrated raw to millivolt tables
+#include "Telemetry.h"            // COBS framed binary telemetry records
+#include "RawTrace.h"             // Capture of the raw sensor input for the host replay
+#include "CommandLine.h"          // Serial command console
+#include "FlashLog.h"             // History of the report records in flash
+#include "SeriesRollup.h"         // Per-minute and per-hour summaries of the history
+#include "LittleFsFlashStore.h"   // Flash log segments as LittleFS files
+#include "SensorPipeline.h"       // Filters, conversions and derived values of every sensor
+#include "SensorFusion.h"         // Kalman fusion of temperature, pH and TDS
+#include "PipelineLayout.h"       // Compile-time list of the analog probes
+#include "Hal.h"                  // Clock and analog reads behind the hardware abstraction
+#include "DutyCycle.h"            // Acquisition windows of the sleeping power modes
+#include "ResumeState.h"          // Pipeline state kept in RTC memory through deep sleep
+#include "DosingController.h"     // PID dosing of the pH down and nutrient pumps
+#include "TimerControlLoop.h"     // Hardware timer paced control task
+#include "NvsCalibrationStore.h"  // Probe calibration kept in NVS
+#include "Profiler.h"             // Cycle counter timing of the hot path stages
+#include "MqttPublisher.h"        // Batched telemetry to an MQTT broker with an offline queue
+#include "SocketTransport.h"      // Non-blocking TCP for the publisher
+#include <esp_sleep.h>
+#include <WiFi.h> // Station mode for the MQTT telemetry
 
 // Define PINs
 #define ESP32_PIN_TEMP 32 // Define the pin number where the temperature sensor is connected
-#define ESP32_PIN_PH 25   // Define the pin number where the pH sensor is connected
+#ifndef ESP32_PIN_PH
+#define ESP32_PIN_PH 25   // Define the pin number where the pH sensor is connected (ADC2, see MQTT below)
+#endif
 #define ESP32_PIN_TDS 34  // Define the pin number where the TDS sensor is connected
+#define ESP32_PIN_PUMP_PH 26       // Driver of the pH down pump
+#define ESP32_PIN_PUMP_NUTRIENT 27 // Driver of the nutrient concentrate pump
+
+// Define sample periods (milliseconds)
+#define TEMP_PERIOD_MS 1000    // Start a new temperature conversion every second
+#define TEMP_RESOLUTION 12     // Default DS18B20 resolution in bits (9 to 12)
+#define TEMP_MAX_AGE_MS 10000  // A temperature older than this is stale for the TDS compensation
+#define DRAIN_PERIOD_MS 10     // Empty the reading ring every 10 milliseconds
+#define CONSOLE_PERIOD_MS 20   // Check for serial commands every 20 milliseconds
+#define REPORT_PERIOD_MS 1000  // Print the current values every second
+#define STATS_PERIOD_MS 60000  // Print the scheduler statistics every minute
+
+// Define the continuous ADC sampling, override with -D build flags
+#ifndef ADC_SAMPLE_RATE_HZ
+#define ADC_SAMPLE_RATE_HZ 250 // Samples per second on every analog channel
+#endif
+#ifndef ADC_OVERSAMPLING
+#define ADC_OVERSAMPLING 0     // Sample clock 2^n times faster, pH decimated down for extra bits (4: 4 kHz, see "bench-decimate")
+#endif
+#define ADC_CLOCK_HZ (ADC_SAMPLE_RATE_HZ << ADC_OVERSAMPLING)                  // Rate of the sample clock
+#define ADC_BLOCK_PERIOD_US (1000000ULL * ADC_BLOCK_SIZE / ADC_CLOCK_HZ)       // Time to fill one block
+#ifndef ADAPTIVE_SAMPLING
+#define ADAPTIVE_SAMPLING 1    // Slow quiet channels down while sampling continuously (see "bench-adaptive")
+#endif
+#ifndef SENSOR_FUSION
+#define SENSOR_FUSION 0        // Kalman fusion of the three sensors, printed with 2 sigma bounds in the text report (see "bench-fusion")
+#endif
+
+// Define the acquisition task
+#define ACQ_CORE 0             // Acquisition runs on the protocol core, the Arduino loop stays on core 1
+#define ACQ_PRIORITY 2         // Above the Arduino loop task so sampling wins over output
+#define ACQ_STACK_SIZE 4096    // Stack of the acquisition task in bytes
+#define ACQ_OVERRUN_US 20000   // A pass longer than this counts as an overrun (shorter than the pH sample gap)
+#define READING_RING_SIZE 64   // Readings buffered between the cores, must be a power of two
+
+// Define the flash history, 16 segments of 64 KB hold about two and a half days of compressed records, one per second (see "bench-series")
+#define LOG_SEGMENT_COUNT 16   // Segments rotated round-robin
+#define LOG_SEGMENT_SIZE 65536 // Bytes per segment
+#define HISTORY_MAX_LINES 120  // Longest "history" and "rollup" answer, printing more would hold up the loop task
+#define EXPORT_PERIOD_MS 100   // One batch frame of an "export" per run, 512 bytes take 45 ms at 115200 baud
+#define CAPTURE_PERIOD_MS 100  // One trace frame of a "capture" per run, a second of raw input is about 600 bytes
+
+// Define the power management, override with -D build flags
+#ifndef POWER_MODE
+#define POWER_MODE POWER_ALWAYS_ON // POWER_LIGHT_SLEEP or POWER_DEEP_SLEEP sleep between acquisition windows
+#endif
+#define POWER_PERIOD_MS 10000  // A window starts every 10 seconds in the sleeping modes
+#define POWER_WINDOW_MS 3000   // Longest window, a dead sensor must not keep the chip awake
+#define POWER_CHECK_MS 10      // Check whether the window is complete every 10 milliseconds
+#define POWER_STOP_US 1000     // Poll the acquisition task this often while it parks
+
+// Define the dosing, the figures assume a 100 L tank without circulation and 1 mL/s pumps (see "sim-dose")
+#ifndef DOSING_ENABLED
+#define DOSING_ENABLED 0       // Pumps stay off until "dose on", override with -D build flags
+#endif
+#define CONTROL_TICK_US 10000  // Control step every 10 ms, the resolution of the pump run times
+#define CONTROL_TIMER 1        // Hardware timer 0 paces the ADC
+#define CONTROL_CORE 1         // Next to loop(), the sensor I/O keeps core 0
+#define TDS_SETPOINT 1100      // Middle of the 750 to 1500 ppm target
+#define PH_SETPOINT 6.0        // Middle of the usual 5.5 to 6.5 range
+
+// Define the MQTT telemetry, override with -D build flags. Off by default: WiFi takes ADC2 over, so the pH probe
+// has to move from GPIO25 to an ADC1 pin first (e.g. -D ESP32_PIN_PH=35) or to the ADS1x15 chain below
+#ifndef MQTT_ENABLED
+#define MQTT_ENABLED 0
+#endif
+#ifndef MQTT_WIFI_SSID
+#define MQTT_WIFI_SSID ""
+#endif
+#ifndef MQTT_WIFI_PASSWORD
+#define MQTT_WIFI_PASSWORD ""
+#endif
+#ifndef MQTT_BROKER
+#define MQTT_BROKER "192.168.1.10" // Numeric, a DNS lookup would block the loop task
+#endif
+#ifndef MQTT_PORT
+#define MQTT_PORT 1883
+#endif
+#ifndef MQTT_TOPIC
+#define MQTT_TOPIC "hydroponics/telemetry"
+#endif
+#define MQTT_CLIENT_ID "hydroponics-esp32"
+#define MQTT_POLL_MS 10          // Move the connection on every 10 milliseconds
+#define MQTT_BATCH_RECORDS 10    // Records per message, 9.6 instead of 55 bytes per record on the wire (see "bench-mqtt")
+#define MQTT_BATCH_AGE_MS 10000  // Longest a record waits for its batch, also in the sleeping modes
+
+// Define the external ADC chain, override with -D build flags. Off by default. With it on, TDS and pH are read by
+// ADS1115s (or ADS1015s) on I2C instead of GPIO34 and GPIO25, which frees ADC2 for WiFi, and more probes go on
+// the other inputs. The channels go round the devices so they convert in parallel (see "bench-ads")
+#ifndef ADS1X15_ENABLED
+#define ADS1X15_ENABLED 0
+#endif
+#ifndef ADS1X15_DEVICES
+#define ADS1X15_DEVICES 1      // Devices at 0x48 upwards, ADDR to GND, VDD, SDA and SCL
+#endif
+#ifndef ADS1X15_MODEL
+#define ADS1X15_MODEL ADS1115
+#endif
+#ifndef ADS1X15_EXTRA_PH
+#define ADS1X15_EXTRA_PH 0     // pH probes after the first, reported as "PH 2" and up
+#endif
+#ifndef ADS1X15_EXTRA_TDS
+#define ADS1X15_EXTRA_TDS 0    // TDS probes after the first
+#endif
+#define ADS1X15_CHANNELS (2 + ADS1X15_EXTRA_PH + ADS1X15_EXTRA_TDS)
+#define ESP32_PIN_SDA 21
+#define ESP32_PIN_SCL 22
+#define ESP32_PIN_ADS_ALERT {16, 17, 18, 19} // ALERT/RDY of every device, in address order
+#if ADS1X15_ENABLED && (ADS1X15_DEVICES < 1 || ADS1X15_DEVICES > ADS1X15_MAX_DEVICES)
+#error "ADS1X15_DEVICES is 1 to 4"
+#endif
+
+// Define the memory budget of the acquisition side: pipeline, ADC source, reading ring and capture buffers. Override with -D build flags
+#ifndef ACQ_RAM_BUDGET
+#define ACQ_RAM_BUDGET 24576
+#endif
+
+//-------------------- Layout --------------------
+
+// Layout - Analog probes in ADC channel order, TDS and pH first. Checked at compile time below
+#if ADS1X15_ENABLED
+constexpr PipelineLayout<ADS1X15_CHANNELS> pipeline_layout = ads1x15Layout<ADS1X15_CHANNELS>(ADS1X15_DEVICES, ADS1X15_EXTRA_PH);
+#else
+constexpr PipelineLayout<2> pipeline_layout = {{{READING_TDS, SOURCE_GPIO, ESP32_PIN_TDS}, {READING_PH, SOURCE_GPIO, ESP32_PIN_PH}}};
+#endif
+static_assert(layoutFitsPipeline(pipeline_layout, PIPELINE_MAX_PROBES), "TDS and pH first, then at most PIPELINE_MAX_PROBES extra probes");
+static_assert(layoutPinsValid(pipeline_layout, ADS1X15_ENABLED ? ADS1X15_DEVICES : 0),
+              "A probe on a pin that is no ADC input or is taken, add ADS1x15 devices or lower ADS1X15_EXTRA_PH / ADS1X15_EXTRA_TDS");
+static_assert(layoutFitsWifi(pipeline_layout, MQTT_ENABLED),
+              "WiFi takes ADC2 over, move the pH probe to an ADC1 pin (GPIO32 to GPIO39) and set ESP32_PIN_PH, or use the ADS1x15 chain");
+static_assert(layoutLeavesFree(pipeline_layout, ESP32_PIN_TEMP) && layoutLeavesFree(pipeline_layout, ESP32_PIN_PUMP_PH) &&
+                  layoutLeavesFree(pipeline_layout, ESP32_PIN_PUMP_NUTRIENT),
+              "A probe on the OneWire or a pump pin");
+static_assert(!ADS1X15_ENABLED || ADC_OVERSAMPLING == 0, "The ADS1x15 chain converts too slowly to oversample, and has the bits already");
+
+//-------------------- Scheduler --------------------
+
+// Scheduler - Runs the sensor state machines inside the acquisition task on core 0
+Scheduler acquisition(halMicros);
+
+// Scheduler - Runs the draining, reporting and statistics on the Arduino loop task
+Scheduler scheduler(halMicros);
+
+//-------------------- Acquisition --------------------
+
+// Acquisition - Readings travel from the acquisition task to loop() through this ring
+SpscRing<Reading, READING_RING_SIZE> readings;
+
+// Acquisition - Counters, only written by the acquisition task
+volatile uint32_t acquisition_published = 0;   // Readings pushed into the ring
+volatile uint32_t acquisition_drops = 0;       // Readings lost because the ring was full
+volatile uint32_t acquisition_overruns = 0;    // Passes that took longer than ACQ_OVERRUN_US
+volatile bool acquisition_reset_stats = false; // Set by loop(), the acquisition task clears its own statistics
 
 //-------------------- Temperature --------------------
 
@@ -17,101 +200,1201 @@ OneWire oneWire(ESP32_PIN_TEMP);
 // Temperature - Pass our oneWire reference to Dallas Temperature.
 DallasTemperature sensors(&oneWire);
 
-//-------------------- PH --------------------
+// Temperature - Engine that runs the conversions of every probe on the bus in the background
+DallasTemperatureBus temperature_bus(sensors);
+TemperatureEngine temperatures(temperature_bus, halMicros);
+
+//-------------------- ADC --------------------
+
+// ADC - Pins or chain inputs of the layout, in channel order
+constexpr PipelineLayout<pipeline_layout.COUNT>::Pins adc_pins = pipeline_layout.pins();
+
+#if ADS1X15_ENABLED
+// ADC - The chain on the first I2C controller, its sampling task runs next to acquisition on core 0
+const uint8_t ads_addresses[] = {0x48, 0x49, 0x4A, 0x4B};
+const uint8_t ads_alert_pins[] = ESP32_PIN_ADS_ALERT;
+EspI2cBus i2c_bus(I2C_NUM_0);
+EspAds1x15Source adc(i2c_bus, ads_addresses, ads_alert_pins, ADS1X15_DEVICES, ADS1X15_MODEL, ACQ_CORE);
+#else
+// ADC - Hardware timer 0 paces the conversions, the sampling task runs next to acquisition on core 0
+TimerAdcSource adc(0, ACQ_CORE);
+#endif
+
+// ADC - Raw to millivolt tables, built once at boot: ADC1 serves the TDS pin (GPIO34), ADC2 the pH pin (GPIO25, ADC1 with MQTT).
+// The chain delivers millivolts, its tables pass them through
+AdcCalibration adc1_calibration;
+AdcCalibration adc2_calibration;
+
+//-------------------- Sensors --------------------
+
+// Sensors - pH, TDS and temperature filtering and conversion, runs on the acquisition scheduler
+SensorPipeline sensor_pipeline(adc, temperatures, adc1_calibration, adc2_calibration);
+
+#if SENSOR_FUSION
+// Sensors - Kalman fusion of the measurements, its estimates go to loop() once per report through a ring of their own
+SensorFusion sensor_fusion;
+SpscRing<FusedReadings, 2> fused_readings;
+#endif
+
+//-------------------- Report --------------------
+
+// Report - Latest values received from the acquisition task
+float report_tds = 0;                                   // Latest TDS
+float report_ec = 0;                                    // Latest EC
+float report_ph = 0;                                    // Latest pH
+float report_temp[TemperatureEngine::MAX_PROBES] = {0}; // Latest temperature of each probe
+uint16_t report_valid = 0;                              // TELEMETRY_*_VALID flags of the channels seen so far
+SensorQuality report_tds_quality = QUALITY_GOOD;        // Quality of the latest value of each channel, nothing is flagged before the first
+SensorQuality report_ph_quality = QUALITY_GOOD;
+SensorQuality report_temp_quality[TemperatureEngine::MAX_PROBES] = {QUALITY_GOOD};
+float report_ph_extra[PIPELINE_MAX_PROBES] = {0};       // Latest value of the extra probes, the second one first
+float report_tds_extra[PIPELINE_MAX_PROBES] = {0};
+uint8_t report_ph_extra_count = 0;                      // Extra probes seen so far
+uint8_t report_tds_extra_count = 0;
+#if SENSOR_FUSION
+FusedReadings report_fused = {};                        // Latest fused estimates, not valid before the first
+#endif
+
+// Report - Binary telemetry, switched at runtime with "mode binary" / "mode text"
+bool telemetry_binary = false;                   // Send COBS frames instead of text lines
+RTC_DATA_ATTR uint16_t telemetry_sequence = 0;   // Sequence number of the next record, kept through deep sleep
+uint8_t telemetry_frame[TELEMETRY_FRAME_SIZE];   // Static frame buffer, the report never allocates
+uint32_t telemetry_last_drops = 0;               // acquisition_drops at the previous record
+uint32_t telemetry_last_overflows = 0;           // adc.overflows() at the previous record
+
+//-------------------- History --------------------
+
+// History - Every report record is kept in flash, written a chunk at a time from the loop task so sampling on core 0 never waits
+LittleFsFlashStore history_store;
+FlashLog history(history_store, LOG_SEGMENT_COUNT, LOG_SEGMENT_SIZE);
+bool history_ready = false; // The file system mounted
+
+// History - Minute and hour summaries in RAM, rebuilt from the flash history at a cold boot
+SeriesRollup history_rollup;
+
+// History - Bulk export in binary mode, one compressed batch frame per run of the export task
+SeriesEncoder export_encoder;
+uint8_t export_block[TELEMETRY_BATCH_MAX];
+uint8_t export_frame[TELEMETRY_BATCH_FRAME_SIZE];
+bool export_active = false;  // An "export" is running
+bool export_full = false;    // The last scan stopped because the block was full
+uint32_t export_next_ms = 0; // Log time the next batch starts at
+uint32_t export_to_ms = 0;   // Log time the export ends at
+
+//-------------------- Capture --------------------
+
+// Capture - Raw ADC blocks and DS18B20 reads as trace frames in binary mode, for "bench-replay" on the host
+RawTraceRecorder trace_recorder;
+uint8_t capture_frame[TELEMETRY_BATCH_FRAME_SIZE];
+
+// Budget of the acquisition side, every buffer of it is static and sized at compile time
+static_assert(sizeof(sensor_pipeline) + sizeof(adc) + sizeof(readings) + sizeof(trace_recorder) <= ACQ_RAM_BUDGET,
+              "The pipeline, ADC and capture buffers exceed ACQ_RAM_BUDGET, lower SCOUNT, PIPELINE_MAX_PROBES or raise the budget");
+
+//-------------------- Power --------------------
+
+// Power - Mode, switched at runtime with "power on|light|deep"
+PowerMode power_mode = POWER_MODE;
+
+// Power - Acquisition windows and how long every sensor takes after a wake
+DutyCycle duty(POWER_PERIOD_MS, POWER_WINDOW_MS);
 
-// PH - Calibration value for the pH sensor
-float ph_calibration_value = 21.34; // This value is used to calibrate the pH sensor, it may vary for different sensors
+// Power - Probe addresses and filter windows, kept in RTC memory through deep sleep
+RTC_DATA_ATTR ResumeState resume_state;
 
-// PH - Variable to store the pH value
-int ph_value = 0; // This variable will hold the pH value read from the sensor
+// Power - Handshake with the acquisition task, it parks between two passes so no OneWire transaction is cut by a sleep
+volatile bool acquisition_park = false;   // Set by loop(), asks the acquisition task to stop
+volatile bool acquisition_parked = false; // Set by the acquisition task while it is stopped
+bool power_stopping = false;              // The window is closed, waiting for the acquisition task to park
 
-// PH - Variable to store the average value
-unsigned long int ph_avg_val; // This variable will hold the average of the pH values read from the sensor
+//-------------------- Dosing --------------------
 
-// PH - Array to store the buffer values
-int ph_buffer_arr[10], temp; // This array will hold the pH values read in a loop, temp is used for swapping during sorting
+// Dosing - PID settings of the two pumps, one evaluation every 30 s and a 10 minute hold while a dose mixes in
+const DosingConfig nutrient_dosing_config = {
+    TDS_SETPOINT, 10.0f,       // setpoint, deadband ppm
+    0.6f, 0.002f, 0.0f, 0.0f,  // kp, ki, kd, feed-forward
+    3.3f,                      // ppm per mL of concentrate
+    20.0f, 300.0f, 1.0f,       // largest dose mL, mL per hour, pump mL/s
+    30000, 600000, 5000, true, // period, mixing hold, measurement age ms, anti-windup
+};
+const DosingConfig ph_dosing_config = {
+    PH_SETPOINT, 0.03f,        // setpoint, deadband pH
+    0.6f, 0.002f, 0.0f, 0.0f,  // kp, ki, kd, feed-forward
+    -0.012f,                   // pH per mL of pH down
+    10.0f, 90.0f, 1.0f,        // largest dose mL, mL per hour, pump mL/s
+    30000, 600000, 5000, true, // period, mixing hold, measurement age ms, anti-windup
+};
+DosingController nutrient_dosing(nutrient_dosing_config);
+DosingController ph_dosing(ph_dosing_config);
+
+// Dosing - Hardware timer 1 runs the pumps from a high priority task on the loop core. It can preempt loop() between
+// any two stores, so everything loop() writes into the controllers (measurements, on/off, setpoints) and the tick()
+// of the step hold this lock, the step never sees a measurement without its timestamp
+TimerControlLoop control(CONTROL_TIMER, CONTROL_CORE);
+portMUX_TYPE dosing_lock = portMUX_INITIALIZER_UNLOCKED;
+
+//-------------------- Calibration --------------------
+
+// Calibration - Probe coefficients in NVS, loaded once at boot, the pipeline precomputes its curves from them
+NvsCalibrationStore calibration_store;
+CalibrationCoefficients calibration;                            // What the pipeline converts with
+CalibrationPoint calibration_ph_points[CALIBRATION_MAX_POINTS];  // Buffers captured since the last save
+uint8_t calibration_ph_count = 0;
+CalibrationPoint calibration_tds_points[CALIBRATION_MAX_POINTS]; // Standards captured since the last save
+uint8_t calibration_tds_count = 0;
+
+//-------------------- MQTT --------------------
+
+#if MQTT_ENABLED
+// MQTT - Batches of report records to the broker, about 10 minutes of them wait in RAM while the link is down.
+// A longer outage loses the oldest batches, the flash history still has them for an "export"
+const MqttConfig mqtt_config = {
+    MQTT_BROKER, MQTT_PORT, MQTT_CLIENT_ID, MQTT_TOPIC,
+    30,                                    // keepalive s
+    MQTT_BATCH_RECORDS, MQTT_BATCH_AGE_MS, // batch records, batch age ms
+    5000, 1000, 60000,                     // connect timeout, first and longest retry delay ms
+};
+SocketTransport mqtt_transport;
+MqttPublisher mqtt(mqtt_transport, mqtt_config);
+#endif
+
+//-------------------- Profiling --------------------
+
+// Profiling - Stages of the loop core, the sensor stages live in the pipeline and the ADC source. "prof" prints them all
+PROFILE_STAGE(profile_history, "history");  // Record into the flash log and the rollups, a chunk write every FLASH_LOG_CHUNK_BYTES
+PROFILE_STAGE(profile_print, "print");      // Report lines or frame onto the serial port
+PROFILE_STAGE(profile_console, "console");  // Reading and running console commands
+PROFILE_STAGE(profile_control, "control");  // Dosing control step
+#if MQTT_ENABLED
+PROFILE_STAGE(profile_mqtt, "mqtt");        // Publisher poll, never waits for the network
+#endif
+
+//-------------------- Console --------------------
+
+// Console - Command handlers
+void myModeCommand(const char *args);
+void myHistoryCommand(const char *args);
+void myRollupCommand(const char *args);
+void myExportCommand(const char *args);
+void myPowerCommand(const char *args);
+void myDoseCommand(const char *args);
+void myCalibrationCommand(const char *args);
+void myProfileCommand(const char *args);
+void myHealthCommand(const char *args);
+void myRateCommand(const char *args);
+void myMqttCommand(const char *args);
+void myCaptureCommand(const char *args);
+void myReferenceCommand(const char *args);
+void myHelpCommand(const char *args);
+
+// Console - Command table
+const Command console_commands[] = {
+    {"mode", myModeCommand, "mode text|binary - switch the report format"},
+    {"history", myHistoryCommand, "history <seconds> - print the logged records of the last seconds"},
+    {"rollup", myRollupCommand, "rollup minute|hour [count] - min, mean and max of the last minutes or hours"},
+    {"export", myExportCommand, "export <seconds> - send the logged records of the last seconds as batch frames (binary mode)"},
+    {"power", myPowerCommand, "power on|light|deep - sample continuously or sleep between windows"},
+    {"dose", myDoseCommand, "dose on|off|status|ph <target>|tds <target> - closed-loop pH down and nutrient dosing"},
+    {"cal", myCalibrationCommand, "cal show|clear|reset|ph <buffer pH>|tds <standard ppm>|ph save|tds save - probe calibration"},
+    {"prof", myProfileCommand, "prof [reset] - run time p50 / p99 / max of the profiled stages"},
+    {"health", myHealthCommand, "health - fault state and detections of every probe"},
+    {"rate", myRateCommand, "rate [on|off] - adaptive sampling, the rate of every channel and the work saved"},
+    {"capture", myCaptureCommand, "capture on|off - stream the raw sensor input as trace frames (binary mode)"},
+    {"ref", myReferenceCommand, "ref ph|tds|temp <value> - a reading of a reference meter into the capture"},
+#if MQTT_ENABLED
+    {"mqtt", myMqttCommand, "mqtt - connection, queue and counters of the MQTT telemetry"},
+#endif
+    {"help", myHelpCommand, "help - list the commands"},
+};
+CommandLine console(console_commands, sizeof(console_commands) / sizeof(console_commands[0]));
 
 // put interger function declarations here:
-int myTemperatureFuction();
-int myPhFuction();
-int myTdsFuction();
+void acquisitionTask(void *parameter);
+void publishReading(ReadingChannel channel, uint8_t index, float value, SensorQuality quality);
+uint32_t myFusionFuction(void *context, uint32_t now_us);
+uint32_t myDrainFuction(void *context, uint32_t now_us);
+uint32_t myConsoleFuction(void *context, uint32_t now_us);
+uint32_t myReportFuction(void *context, uint32_t now_us);
+void sendReport();
+uint32_t myPowerFuction(void *context, uint32_t now_us);
+void enterDeepSleep(uint32_t sleep_us);
+void myControlStep(void *context, uint32_t now_us);
+void stopPumps();
+void printDosing(const char *name, const DosingController &dosing);
+void printHealth(const char *name, const SensorHealth &health);
+void printRate(const char *name, const AdaptiveRate &rate);
+const char *qualitySuffix(SensorQuality quality);
+void saveCalibration(const char *name, CalibrationFit fit);
+void printCalibration();
+bool printHistoryRecord(const TelemetryRecord &record, void *context);
+bool rollupHistoryRecord(const TelemetryRecord &record, void *context);
+void printRollupBucket(const RollupBucket &bucket);
+bool exportHistoryRecord(const TelemetryRecord &record, void *context);
+uint32_t myExportFuction(void *context, uint32_t now_us);
+uint32_t myCaptureFuction(void *context, uint32_t now_us);
+uint32_t myMqttFuction(void *context, uint32_t now_us);
+uint32_t myStatsFuction(void *context, uint32_t now_us);
+void printSchedulerStats(const char *title, const Scheduler &stats_scheduler);
 
 void setup()
 {
     // Begin serial communication at 115200 baud
     Serial.begin(115200);
 
-    // Set the TDS sensor pin as an input
-    pinMode(ESP32_PIN_TDS, INPUT);
+#if ADS1X15_ENABLED
+    // The chain's samples are millivolts already. TDS and pH take the first inputs, the extra pH probes the next ones
+    adc1_calibration.build(ads1x15Millivolts, NULL);
+    adc2_calibration.build(ads1x15Millivolts, NULL);
+    if (!i2c_bus.begin(ESP32_PIN_SDA, ESP32_PIN_SCL, ADS1X15_BUS_HZ))
+        Serial.println("I2C: driver not installed");
+    sensor_pipeline.addProbes(pipeline_layout);
+#else
+    // Both analog pins use the full 0-3.3 V range, the calibration tables are built for 11 dB
+    analogReadResolution(12);
+    analogSetPinAttenuation(ESP32_PIN_TDS, ADC_11db);
+    analogSetPinAttenuation(ESP32_PIN_PH, ADC_11db);
+    esp_adc_cal_value_t adc1_source = calibrateAdc(adc1_calibration, ADC_UNIT_1);
+    esp_adc_cal_value_t adc2_source = calibrateAdc(adc2_calibration, ESP32_PIN_PH >= 32 ? ADC_UNIT_1 : ADC_UNIT_2);
+    Serial.printf("ADC1 calibration: %s, ADC2 calibration: %s\r\n", adcCalibrationName(adc1_source), adcCalibrationName(adc2_source));
+#endif
+
+    // Start continuous sampling of the TDS and pH pins, this also sets them as inputs
+    adc.begin(adc_pins.pin, pipeline_layout.COUNT, ADC_CLOCK_HZ);
+
+    // A timer wake with an intact RTC state resumes where the last window stopped: no bus scan, primed filters
+    bool resumed = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER && resumeStateValid(resume_state);
+    if (resumed)
+    {
+        temperatures.resume(resume_state.temperatures, halMicros());
+        power_mode = (PowerMode)resume_state.power_mode;
+        duty.restoreStats(resume_state.duty);
+    }
+    else
+    {
+        // Start up the sensors library for Temperature, the probe addresses are cached here
+        resumeStateClear(resume_state);
+        temperatures.begin(halMicros(), TEMP_RESOLUTION, TEMP_PERIOD_MS);
+    }
+
+    // Probe calibration, a missing or damaged one leaves the built-in pH line and TDS cubic
+    bool calibration_ready = calibration_store.begin();
+    CalibrationLoad calibration_load = calibrationLoad(calibration_store, calibration);
+    sensor_pipeline.setCalibration(calibration);
+    Serial.printf("Calibration: %s\r\n", calibration_ready ? calibrationLoadName(calibration_load) : "NVS unavailable");
+
+    // Register the sensor state machines, every new value goes into the ring
+    sensor_pipeline.setRecorder(&trace_recorder);
+    sensor_pipeline.setOversampling(ADC_OVERSAMPLING);
+#if SENSOR_FUSION
+    sensor_pipeline.setFusion(&sensor_fusion);
+#endif
+    sensor_pipeline.begin(acquisition, publishReading, ADC_BLOCK_PERIOD_US, TEMP_MAX_AGE_MS * 1000UL);
+#if SENSOR_FUSION
+    acquisition.addTask("fusion", myFusionFuction, NULL, REPORT_PERIOD_MS * 1000UL);
+#endif
+    sensor_pipeline.setAdaptive(ADAPTIVE_SAMPLING && power_mode == POWER_ALWAYS_ON);
+    if (resumed)
+        sensor_pipeline.resume(resume_state.pipeline);
 
-    // Start up the sensors library for Temperature
-    sensors.begin();
+    // Mount the history, the log time continues from the last record in flash
+    history_ready = history_store.begin() && history.begin(halMillis());
+    Serial.printf("History: %s, %u records\r\n", history_ready ? "mounted" : "unavailable", (unsigned)history.storedRecords());
+
+    // The summaries of everything on flash, a timer wake keeps the raw history only instead of reading it all every window
+    if (history_ready && !resumed)
+    {
+        uint32_t to_ms = history.logTime(halMillis());
+        history.scan(to_ms - INT32_MAX, to_ms, rollupHistoryRecord, NULL);
+    }
+
+    // Register the consumer side on the loop task
+    scheduler.addTask("drain", myDrainFuction, NULL, DRAIN_PERIOD_MS * 1000UL);
+    scheduler.addTask("console", myConsoleFuction, NULL, CONSOLE_PERIOD_MS * 1000UL);
+    scheduler.addTask("report", myReportFuction, NULL, REPORT_PERIOD_MS * 1000UL);
+    scheduler.addTask("stats", myStatsFuction, NULL, STATS_PERIOD_MS * 1000UL);
+    scheduler.addTask("power", myPowerFuction, NULL, POWER_CHECK_MS * 1000UL);
+    scheduler.addTask("export", myExportFuction, NULL, EXPORT_PERIOD_MS * 1000UL);
+    scheduler.addTask("capture", myCaptureFuction, NULL, CAPTURE_PERIOD_MS * 1000UL);
+
+#if MQTT_ENABLED
+    // WiFi connects and reconnects in the background, the publisher just fails its attempts until it is up
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(true);
+    WiFi.begin(MQTT_WIFI_SSID, MQTT_WIFI_PASSWORD);
+    scheduler.addTask("mqtt", myMqttFuction, NULL, MQTT_POLL_MS * 1000UL);
+#endif
+
+    // Pumps off before anything else can run, then the fixed-rate control task
+    pinMode(ESP32_PIN_PUMP_PH, OUTPUT);
+    pinMode(ESP32_PIN_PUMP_NUTRIENT, OUTPUT);
+    stopPumps();
+    nutrient_dosing.enable(DOSING_ENABLED);
+    ph_dosing.enable(DOSING_ENABLED);
+    control.begin(CONTROL_TICK_US, myControlStep, NULL);
+
+    // The first window starts at the reset, after a deep sleep the boot counts towards the wake latency
+    duty.wake(resumed ? 0 : halMicros());
+
+    // Start sampling on its own core
+    xTaskCreatePinnedToCore(acquisitionTask, "acquisition", ACQ_STACK_SIZE, NULL, ACQ_PRIORITY, NULL, ACQ_CORE);
 }
 
 void loop()
 {
-    // Get Values
-    int currentTds = myTdsFuction();
-    int currentPh = myPhFuction();
-    int currentTemp = myTemperatureFuction();
-    // Print Values
-    Serial.print("TDS is: " + String(currentTds) + "\r\n");
-    Serial.print("PH is: " + String(currentPh) + "\r\n");
-    Serial.print("Temperature is: " + String(currentTemp) + "\r\n");
+    // Run whatever is due, every task returns straight away so nothing blocks here
+    scheduler.runOnce();
+}
+
+void acquisitionTask(void *parameter)
+{
+    for (;;)
+    {
+        // Statistics are only touched from this task, loop() just asks for a reset
+        if (acquisition_reset_stats)
+        {
+            acquisition.resetStats();
+            acquisition_reset_stats = false;
+        }
+
+        // Stop between two passes while the chip sleeps, never in the middle of a bus transaction
+        if (acquisition_park)
+        {
+            acquisition_parked = true;
+            while (acquisition_park)
+                vTaskDelay(1);
+            acquisition_parked = false;
+        }
+
+        // Run the sensor steps that are due and count passes that ran too long
+        uint32_t start = halMicros();
+        uint32_t idle_us = acquisition.runOnce();
+        if (halMicros() - start > ACQ_OVERRUN_US)
+        {
+            acquisition_overruns++;
+        }
+
+        // Always give up at least one tick so the idle task on this core keeps the watchdog fed
+        TickType_t ticks = pdMS_TO_TICKS(idle_us / 1000);
+        vTaskDelay(ticks > 0 ? ticks : 1);
+    }
+}
+
+void publishReading(ReadingChannel channel, uint8_t index, float value, SensorQuality quality)
+{
+    // Never wait for the consumer, a full ring just costs this reading
+    Reading reading = {halMicros(), channel, index, quality, value};
+    if (readings.push(reading))
+        acquisition_published++;
+    else
+        acquisition_drops++;
+}
+
+uint32_t myFusionFuction(void *context, uint32_t now_us)
+{
+    // The fusion lives in the acquisition task, its estimates are handed over like the readings. A full ring
+    // means loop() has not taken the last one yet, it gets the next
+#if SENSOR_FUSION
+    FusedReadings fused;
+    if (sensor_pipeline.fused(fused))
+        fused_readings.push(fused);
+#endif
+    return REPORT_PERIOD_MS * 1000UL;
+}
+
+uint32_t myDrainFuction(void *context, uint32_t now_us)
+{
+    // Take everything the acquisition task published and keep the latest value of each channel
+    Reading reading;
+    while (readings.pop(reading))
+    {
+        duty.reading(reading.channel, reading.index, halMicros());
+        switch (reading.channel)
+        {
+        case READING_TDS:
+            // The extra probes are reported next to the first one, the controllers only follow the first
+            if (reading.index > 0 && reading.index <= PIPELINE_MAX_PROBES)
+            {
+                report_tds_extra[reading.index - 1] = reading.value;
+                if (reading.index > report_tds_extra_count)
+                    report_tds_extra_count = reading.index;
+                break;
+            }
+            // Only good values reach the controllers, without them dosing stops once the last one is stale
+            if (reading.quality == QUALITY_GOOD)
+            {
+                portENTER_CRITICAL(&dosing_lock);
+                nutrient_dosing.measure(reading.value, halMillis());
+                portEXIT_CRITICAL(&dosing_lock);
+            }
+            report_tds = reading.value;
+            report_tds_quality = reading.quality;
+            report_valid |= TELEMETRY_TDS_VALID;
+            break;
+        case READING_EC:
+            report_ec = reading.value;
+            break;
+        case READING_PH:
+            if (reading.index > 0 && reading.index <= PIPELINE_MAX_PROBES)
+            {
+                report_ph_extra[reading.index - 1] = reading.value;
+                if (reading.index > report_ph_extra_count)
+                    report_ph_extra_count = reading.index;
+                break;
+            }
+            if (reading.quality == QUALITY_GOOD)
+            {
+                portENTER_CRITICAL(&dosing_lock);
+                ph_dosing.measure(reading.value, halMillis());
+                portEXIT_CRITICAL(&dosing_lock);
+            }
+            report_ph = reading.value;
+            report_ph_quality = reading.quality;
+            report_valid |= TELEMETRY_PH_VALID;
+            break;
+        case READING_TEMPERATURE:
+            if (reading.index < TemperatureEngine::MAX_PROBES)
+            {
+                report_temp[reading.index] = reading.value;
+                report_temp_quality[reading.index] = reading.quality;
+            }
+            if (reading.index == 0)
+                report_valid |= TELEMETRY_TEMP_VALID;
+            break;
+        }
+    }
+#if SENSOR_FUSION
+    while (fused_readings.pop(report_fused))
+        ;
+#endif
+    return DRAIN_PERIOD_MS * 1000UL;
+}
+
+uint32_t myConsoleFuction(void *context, uint32_t now_us)
+{
+    // Feed whatever arrived into the console, complete lines are dispatched from feed().
+    // Unknown commands are ignored silently so binary mode stays clean
+    PROFILE_SCOPE(profile_console);
+    while (Serial.available() > 0)
+        console.feed(Serial.read());
+    return CONSOLE_PERIOD_MS * 1000UL;
+}
+
+void myModeCommand(const char *args)
+{
+    if (strcmp(args, "binary") == 0)
+        telemetry_binary = true;
+    else if (strcmp(args, "text") == 0)
+        telemetry_binary = false;
+    else if (!telemetry_binary)
+        Serial.println("usage: mode text|binary");
+}
+
+void myHelpCommand(const char *args)
+{
+    for (uint8_t i = 0; i < console.commandCount(); i++)
+        Serial.println(console.command(i).help);
+}
+
+uint32_t myReportFuction(void *context, uint32_t now_us)
+{
+    // In the sleeping modes every window ends with one report instead
+    if (power_mode == POWER_ALWAYS_ON)
+        sendReport();
+    return REPORT_PERIOD_MS * 1000UL;
+}
+
+void sendReport()
+{
+    // One fixed layout record per period, for the binary frame and the history
+    TelemetryRecord record;
+    record.sequence = telemetry_sequence++;
+    record.timestamp_ms = halMillis();
+    record.tds_ppm = report_tds;
+    record.ph = report_ph;
+    record.temperature_c = report_temp[0];
+    record.status = report_valid;
+    if (report_tds_quality == QUALITY_FAULT)
+        record.status |= TELEMETRY_TDS_FAULT;
+    if (report_ph_quality == QUALITY_FAULT)
+        record.status |= TELEMETRY_PH_FAULT;
+    if (report_temp_quality[0] == QUALITY_FAULT)
+        record.status |= TELEMETRY_TEMP_FAULT;
+
+    // Flag losses since the previous record
+    uint32_t drops = acquisition_drops;
+    uint32_t overflows = adc.overflows();
+    if (drops != telemetry_last_drops)
+        record.status |= TELEMETRY_RING_DROPS;
+    if (overflows != telemetry_last_overflows)
+        record.status |= TELEMETRY_ADC_OVERFLOW;
+    telemetry_last_drops = drops;
+    telemetry_last_overflows = overflows;
+
+    // Compressed in RAM, every FLASH_LOG_CHUNK_BYTES go to flash as one chunk. The rollups take the log time too
+    {
+        PROFILE_SCOPE(profile_history);
+        if (history_ready)
+            history.append(record, record.timestamp_ms);
+        TelemetryRecord logged = record;
+        logged.timestamp_ms = history.logTime(record.timestamp_ms);
+        history_rollup.add(logged);
+    }
+
+#if MQTT_ENABLED
+    // Into the open batch, the mqtt task sends it
+    mqtt.add(record, record.timestamp_ms);
+#endif
+
+    PROFILE_SCOPE(profile_print);
+    if (telemetry_binary)
+    {
+        // Built in the static frame buffer
+        size_t length = telemetryEncode(record, telemetry_frame, sizeof(telemetry_frame));
+        Serial.write(telemetry_frame, length);
+        return;
+    }
+
+    // Print Values, printf formats into a stack buffer so no String is built on the heap
+    Serial.printf("TDS is: %d%s\r\n", (int)report_tds, qualitySuffix(report_tds_quality));
+    Serial.printf("EC is: %d%s\r\n", (int)report_ec, qualitySuffix(report_tds_quality));
+    Serial.printf("PH is: %d%s\r\n", (int)report_ph, qualitySuffix(report_ph_quality));
+    for (uint8_t i = 0; i < report_tds_extra_count; i++) // Extra probes numbered from 2, the first keeps the old label
+        Serial.printf("TDS %u is: %d\r\n", (unsigned)(i + 2), (int)report_tds_extra[i]);
+    for (uint8_t i = 0; i < report_ph_extra_count; i++)
+        Serial.printf("PH %u is: %d\r\n", (unsigned)(i + 2), (int)report_ph_extra[i]);
+    for (uint8_t i = 0; i < temperatures.probeCount(); i++) // One line per probe, the first keeps the old label
+    {
+        if (i == 0)
+            Serial.printf("Temperature is: %d%s\r\n", (int)report_temp[i], qualitySuffix(report_temp_quality[i]));
+        else
+            Serial.printf("Temperature %u is: %d%s\r\n", (unsigned)(i + 1), (int)report_temp[i], qualitySuffix(report_temp_quality[i]));
+    }
+#if SENSOR_FUSION
+    // Fused estimates with 2 sigma bounds
+    if (report_fused.tds_ppm.valid)
+        Serial.printf("Fused TDS is: %.1f +- %.1f\r\n", report_fused.tds_ppm.value, 2 * report_fused.tds_ppm.sigma);
+    if (report_fused.ec.valid)
+        Serial.printf("Fused EC is: %.1f +- %.1f\r\n", report_fused.ec.value, 2 * report_fused.ec.sigma);
+    if (report_fused.ph.valid)
+        Serial.printf("Fused PH is: %.3f +- %.3f\r\n", report_fused.ph.value, 2 * report_fused.ph.sigma);
+    if (report_fused.temperature.valid)
+        Serial.printf("Fused Temperature is: %.2f +- %.2f\r\n", report_fused.temperature.value, 2 * report_fused.temperature.sigma);
+#endif
     // Line Break with dashes
     Serial.println("----------------------------------------");
 }
 
-int myTemperatureFuction()
+void myHistoryCommand(const char *args)
+{
+    // Text only, the lines would land in the middle of the binary stream
+    if (telemetry_binary)
+        return;
+    uint32_t seconds = strtoul(args, NULL, 10);
+    if (seconds == 0 || !history_ready)
+    {
+        Serial.println(history_ready ? "usage: history <seconds>" : "history unavailable");
+        return;
+    }
+
+    // Same columns as the host decoder, oldest first
+    uint32_t to_ms = history.logTime(halMillis());
+    uint32_t lines = 0;
+    Serial.println("sequence,timestamp_ms,tds_ppm,ph,temperature_c,status");
+    history.scan(to_ms - seconds * 1000UL, to_ms, printHistoryRecord, &lines);
+}
+
+void myPowerCommand(const char *args)
+{
+    if (strcmp(args, "on") == 0)
+        power_mode = POWER_ALWAYS_ON;
+    else if (strcmp(args, "light") == 0)
+        power_mode = POWER_LIGHT_SLEEP;
+    else if (strcmp(args, "deep") == 0)
+        power_mode = POWER_DEEP_SLEEP;
+    else
+    {
+        if (!telemetry_binary)
+            Serial.println("usage: power on|light|deep");
+        return;
+    }
+
+    // A window is too short to slow anything down, the rates only adapt while sampling continuously
+    sensor_pipeline.setAdaptive(ADAPTIVE_SAMPLING && power_mode == POWER_ALWAYS_ON);
+
+    // A full window before the first sleep
+    duty.wake(halMicros());
+}
+
+uint32_t myPowerFuction(void *context, uint32_t now_us)
+{
+    if (power_mode == POWER_ALWAYS_ON || !duty.windowDone(now_us))
+        return POWER_CHECK_MS * 1000UL;
+
+    if (!power_stopping)
+    {
+        // Close the window with its report, then stop the sample clock and the pumps and ask the acquisition task to park
+        sendReport();
+        adc.pause();
+        control.pause();
+        stopPumps();
+        acquisition_park = true;
+        power_stopping = true;
+        return POWER_STOP_US;
+    }
+    if (!acquisition_parked)
+        return POWER_STOP_US;
+
+    // Nothing runs on core 0 now, let the output drain and sleep out the rest of the period
+    power_stopping = false;
+    uint32_t sleep_us = duty.sleepUs(halMicros());
+    Serial.flush();
+    if (power_mode == POWER_DEEP_SLEEP)
+        enterDeepSleep(sleep_us);
+    esp_sleep_enable_timer_wakeup(sleep_us);
+    esp_light_sleep_start();
+
+    // Light sleep kept everything, restart sampling and open the next window
+    adc.resume();
+    control.resume();
+    acquisition_park = false;
+    duty.wake(halMicros());
+    return POWER_CHECK_MS * 1000UL;
+}
+
+void enterDeepSleep(uint32_t sleep_us)
+{
+    // RAM is lost: the buffered history goes to flash, the pipeline to RTC memory.
+    // The fields are written in place so the CRC sees exactly the bytes that stay behind
+    if (history_ready)
+        history.flush();
+    uint32_t wakes = resume_state.wakes + 1;
+    resumeStateClear(resume_state);
+    resume_state.power_mode = POWER_DEEP_SLEEP;
+    resume_state.wakes = wakes;
+    temperatures.save(resume_state.temperatures);
+    sensor_pipeline.save(resume_state.pipeline);
+    resume_state.duty = duty.stats();
+    resumeStateSeal(resume_state);
+    esp_deep_sleep(sleep_us);
+}
+
+void myControlStep(void *context, uint32_t now_us)
+{
+    PROFILE_SCOPE(profile_control);
+
+    // Dosing needs a reservoir that is watched all the time, the sleeping modes only measure
+    if (power_mode != POWER_ALWAYS_ON)
+    {
+        stopPumps();
+        return;
+    }
+    uint32_t now_ms = halMillis();
+    portENTER_CRITICAL(&dosing_lock);
+    bool ph_pump = ph_dosing.tick(now_ms);
+    bool nutrient_pump = nutrient_dosing.tick(now_ms);
+    portEXIT_CRITICAL(&dosing_lock);
+    digitalWrite(ESP32_PIN_PUMP_PH, ph_pump ? HIGH : LOW);
+    digitalWrite(ESP32_PIN_PUMP_NUTRIENT, nutrient_pump ? HIGH : LOW);
+
+    // A dose is about to move the readings, watch it mix in at the full rate
+    static bool pumps_running = false;
+    if ((ph_pump || nutrient_pump) && !pumps_running)
+        sensor_pipeline.boost();
+    pumps_running = ph_pump || nutrient_pump;
+}
+
+void stopPumps()
+{
+    portENTER_CRITICAL(&dosing_lock);
+    ph_dosing.stop();
+    nutrient_dosing.stop();
+    portEXIT_CRITICAL(&dosing_lock);
+    digitalWrite(ESP32_PIN_PUMP_PH, LOW);
+    digitalWrite(ESP32_PIN_PUMP_NUTRIENT, LOW);
+}
+
+void myDoseCommand(const char *args)
+{
+    if (strcmp(args, "on") == 0 || strcmp(args, "off") == 0)
+    {
+        bool on = strcmp(args, "on") == 0;
+        portENTER_CRITICAL(&dosing_lock);
+        nutrient_dosing.enable(on);
+        ph_dosing.enable(on);
+        portEXIT_CRITICAL(&dosing_lock);
+        stopPumps();
+    }
+    else if (strncmp(args, "ph ", 3) == 0)
+    {
+        float setpoint = strtof(args + 3, NULL);
+        portENTER_CRITICAL(&dosing_lock);
+        ph_dosing.setSetpoint(setpoint);
+        portEXIT_CRITICAL(&dosing_lock);
+    }
+    else if (strncmp(args, "tds ", 4) == 0)
+    {
+        float setpoint = strtof(args + 4, NULL);
+        portENTER_CRITICAL(&dosing_lock);
+        nutrient_dosing.setSetpoint(setpoint);
+        portEXIT_CRITICAL(&dosing_lock);
+    }
+    else if (strcmp(args, "status") != 0)
+    {
+        if (!telemetry_binary)
+            Serial.println("usage: dose on|off|status|ph <target>|tds <target>");
+        return;
+    }
+
+    if (!telemetry_binary)
+    {
+        printDosing("ph", ph_dosing);
+        printDosing("tds", nutrient_dosing);
+    }
+}
+
+void printDosing(const char *name, const DosingController &dosing)
+{
+    const DosingStats &stats = dosing.stats();
+    Serial.printf("dose %-3s %s target %.2f, last %.1f mL, integral %.1f mL, %.1f mL in %u doses, %u held, %u stale, %u limited\r\n",
+                  name, dosing.enabled() ? "on " : "off", dosing.config().setpoint, dosing.lastDose(), dosing.integral(),
+                  stats.dosed_ml, (unsigned)stats.doses, (unsigned)stats.held, (unsigned)stats.stale,
+                  (unsigned)(stats.saturated + stats.rate_limited));
+}
+
+const char *qualitySuffix(SensorQuality quality)
+{
+    // Good values keep the old line, anything else says so
+    switch (quality)
+    {
+    case QUALITY_SUSPECT:
+        return " (suspect)";
+    case QUALITY_FAULT:
+        return " (fault)";
+    default:
+        return "";
+    }
+}
+
+void printHealth(const char *name, const SensorHealth &health)
 {
-    sensors.requestTemperatures();
-    return sensors.getTempCByIndex(0);
+    const SensorHealthStats &stats = health.stats();
+    Serial.printf("%-6s %-12s %u values, %u missed, %u suspect, %u faulty, detected: %u disconnected %u stuck %u saturated %u slew\r\n",
+                  name, sensorFaultName(health.fault()), (unsigned)stats.evaluations, (unsigned)stats.missing,
+                  (unsigned)stats.suspect, (unsigned)stats.faulted, (unsigned)stats.detections[FAULT_DISCONNECTED],
+                  (unsigned)stats.detections[FAULT_STUCK], (unsigned)stats.detections[FAULT_SATURATED],
+                  (unsigned)stats.detections[FAULT_SLEW]);
 }
 
-int myPhFuction()
+void myHealthCommand(const char *args)
 {
-    // Read the analog value from pin ESP32_PIN_PH 10 times and store it in the buffer array
-    for (int i = 0; i < 10; i++) // Loop 10 times
+    if (telemetry_binary)
+        return;
+    if (args[0] != '\0')
     {
-        ph_buffer_arr[i] = analogRead(ESP32_PIN_PH); // Read the analog value from the pH sensor and store it in the buffer array
-        delay(30);                                   // Wait for 30 milliseconds before the next reading
+        Serial.println("usage: health");
+        return;
     }
 
-    // Sort the buffer array in ascending order
-    for (int i = 0; i < 9; i++) // Loop through the array elements
+    // Read across the cores like the other statistics, a line may mix two updates
+    printHealth("tds", sensor_pipeline.health(READING_TDS));
+    printHealth("ph", sensor_pipeline.health(READING_PH));
+    for (uint8_t i = 0; i < temperatures.probeCount(); i++)
     {
-        for (int j = i + 1; j < 10; j++) // Loop through the next elements
+        char name[8];
+        snprintf(name, sizeof(name), "temp%u", i);
+        printHealth(name, sensor_pipeline.health(READING_TEMPERATURE, i));
+
+        // A probe that keeps failing is retried less and less often
+        const TemperatureEngine::Probe &probe = temperatures.probe(i);
+        if (probe.missed > 0)
+            Serial.printf("       %u failed reads in a row, %u in total\r\n", (unsigned)probe.missed, (unsigned)probe.failures);
+    }
+}
+
+void printRate(const char *name, const AdaptiveRate &rate)
+{
+    Serial.printf("%-6s 1/%-3u sd %.4f slope %.5f/s\r\n", name, 1U << rate.shift(), rate.deviation(), rate.slope());
+}
+
+void myRateCommand(const char *args)
+{
+    if (telemetry_binary)
+        return;
+    if (strcmp(args, "on") == 0 || strcmp(args, "off") == 0)
+        sensor_pipeline.setAdaptive(strcmp(args, "on") == 0);
+    else if (args[0] != '\0')
+    {
+        Serial.println("usage: rate [on|off]");
+        return;
+    }
+
+    // The shifts are what the rates ask for, with adaptive sampling off every channel runs at 1/1 anyway
+    Serial.printf("adaptive sampling %s\r\n", sensor_pipeline.adaptiveSampling() ? "on" : "off");
+    printRate("tds", sensor_pipeline.rate(READING_TDS));
+    printRate("ph", sensor_pipeline.rate(READING_PH));
+    for (uint8_t i = 0; i < temperatures.probeCount(); i++)
+    {
+        char name[8];
+        snprintf(name, sizeof(name), "temp%u", i);
+        printRate(name, sensor_pipeline.rate(READING_TEMPERATURE, i));
+    }
+
+    // Read across the cores, the counters may be one block apart
+    const SamplingStats &stats = sensor_pipeline.samplingStats();
+    Serial.printf("adc %llu of %llu conversions (%.1f%% saved), onewire %u of %u transactions (%.1f%% saved)\r\n",
+                  (unsigned long long)stats.adc_conversions, (unsigned long long)stats.adc_fixed,
+                  stats.adc_fixed ? 100.0 * (stats.adc_fixed - stats.adc_conversions) / stats.adc_fixed : 0.0,
+                  (unsigned)stats.onewire, (unsigned)stats.onewire_fixed,
+                  stats.onewire_fixed ? 100.0 * (stats.onewire_fixed - stats.onewire) / stats.onewire_fixed : 0.0);
+}
+
+void myProfileCommand(const char *args)
+{
+    if (telemetry_binary)
+        return;
+#if PROFILING
+    // Each stage clears itself on its own task, the next "prof" shows the fresh numbers
+    bool reset = strcmp(args, "reset") == 0;
+    char line[120];
+    for (ProfileStage *stage = ProfileStage::first(); stage != NULL; stage = stage->next())
+    {
+        if (reset)
         {
-            if (ph_buffer_arr[i] > ph_buffer_arr[j]) // If the current element is greater than the next element
-            {
-                // Swap the elements
-                temp = ph_buffer_arr[i];             // Store the current element in temp
-                ph_buffer_arr[i] = ph_buffer_arr[j]; // Replace the current element with the next element
-                ph_buffer_arr[j] = temp;             // Replace the next element with the value from temp (the original current element)
-            }
+            stage->reset();
+            continue;
+        }
+        profileFormat(*stage, line, sizeof(line));
+        Serial.println(line);
+    }
+    if (reset)
+        Serial.println("prof: cleared");
+#else
+    Serial.println("profiling is compiled out, build with -D PROFILING=1");
+#endif
+}
+
+void myCalibrationCommand(const char *args)
+{
+    if (telemetry_binary)
+        return;
+
+    // Points are captured from the live reading, the probe has to sit in the solution until it is stable
+    if (strcmp(args, "ph save") == 0 || strcmp(args, "tds save") == 0)
+    {
+        bool ph = args[0] == 'p';
+        CalibrationCoefficients updated = calibration;
+        CalibrationFit fit = ph ? calibrationFitPh(calibration_ph_points, calibration_ph_count, updated)
+                                : calibrationFitTds(calibration_tds_points, calibration_tds_count, updated);
+        if (fit == CALIBRATION_FIT_OK)
+        {
+            calibration = updated;
+            (ph ? calibration_ph_count : calibration_tds_count) = 0;
+        }
+        saveCalibration(ph ? "ph" : "tds", fit);
+        return;
+    }
+    if (strncmp(args, "ph ", 3) == 0 || strncmp(args, "tds ", 4) == 0)
+    {
+        bool ph = args[0] == 'p';
+        CalibrationPoint *points = ph ? calibration_ph_points : calibration_tds_points;
+        uint8_t &count = ph ? calibration_ph_count : calibration_tds_count;
+        float measured = ph ? sensor_pipeline.phVolts() : SensorMathPolicy<float>::tdsPpm(sensor_pipeline.tdsVolts());
+        if (count >= CALIBRATION_MAX_POINTS || measured <= 0)
+        {
+            Serial.println(measured <= 0 ? "cal: no reading yet" : "cal: all points captured, save or clear");
+            return;
         }
+        points[count].measured = measured;
+        points[count].actual = strtof(args + (ph ? 3 : 4), NULL);
+        Serial.printf("cal %s point %u: %.4f %s = %.2f\r\n", ph ? "ph" : "tds", (unsigned)count + 1, measured, ph ? "V" : "ppm uncorrected",
+                      points[count].actual);
+        count++;
+        return;
     }
 
-    ph_avg_val = 0;                                        // Reset the average value
-    for (int i = 2; i < 8; i++)                            // Loop through the middle 6 elements of the sorted array (ignoring the 2 smallest and 2 largest values)
-        ph_avg_val += ph_buffer_arr[i];                    // Add the current element to the average value
-    float ph_volt = (float)ph_avg_val * 5.0 / 1024 / 6;    // Convert the average value to voltage (assuming a 5V reference and 10-bit ADC)
-    float ph_act = -5.70 * ph_volt + ph_calibration_value; // Calculate the actual pH value using the calibration value
-    return ph_act;
+    if (strcmp(args, "clear") == 0)
+    {
+        calibration_ph_count = 0;
+        calibration_tds_count = 0;
+    }
+    else if (strcmp(args, "reset") == 0)
+    {
+        calibrationDefaults(calibration);
+        calibration_store.erase();
+        sensor_pipeline.setCalibration(calibration);
+    }
+    else if (strcmp(args, "show") != 0 && args[0] != 0)
+    {
+        Serial.println("usage: cal show|clear|reset|ph <buffer pH>|tds <standard ppm>|ph save|tds save");
+        return;
+    }
+    printCalibration();
+}
+
+void saveCalibration(const char *name, CalibrationFit fit)
+{
+    // A refused fit keeps the calibration the probe has and the captured points, "cal clear" starts over
+    if (fit != CALIBRATION_FIT_OK)
+    {
+        Serial.printf("cal %s: %s, nothing changed\r\n", name, calibrationFitName(fit));
+        return;
+    }
+    bool stored = calibrationSave(calibration_store, calibration);
+    bool applied = sensor_pipeline.setCalibration(calibration);
+    Serial.printf("cal %s: %s, %s\r\n", name, stored ? "saved" : "not saved", applied ? "applied" : "busy, save again");
+    printCalibration();
+}
+
+void printCalibration()
+{
+    Serial.printf("cal ph  %u points: %.3f pH/V + %.3f", (unsigned)calibration.ph_points, calibration.ph_slope[0], calibration.ph_offset[0]);
+    if (calibration.ph_points == 3)
+        Serial.printf(" below %.3f V, %.3f pH/V + %.3f above", calibration.ph_break_volts, calibration.ph_slope[1], calibration.ph_offset[1]);
+    Serial.printf(", %u captured\r\n", (unsigned)calibration_ph_count);
+    Serial.printf("cal tds %u points:", (unsigned)calibration.tds_points);
+    for (uint8_t i = 0; i < calibration.tds_points; i++)
+        Serial.printf(" %.0f->%.0f", calibration.tds_measured[i], calibration.tds_actual[i]);
+    Serial.printf("%s, %u captured\r\n", calibration.tds_points == 0 ? " cubic only" : " ppm", (unsigned)calibration_tds_count);
+}
+
+void myRollupCommand(const char *args)
+{
+    if (telemetry_binary)
+        return;
+    char tier[8];
+    unsigned count = 10;
+    if (sscanf(args, "%7s %u", tier, &count) < 1 || (strcmp(tier, "minute") != 0 && strcmp(tier, "hour") != 0))
+    {
+        Serial.println("usage: rollup minute|hour [count]");
+        return;
+    }
+    if (count > HISTORY_MAX_LINES)
+        count = HISTORY_MAX_LINES;
+
+    // Oldest first, then the period still being collected
+    bool minutes = strcmp(tier, "minute") == 0;
+    uint16_t stored = minutes ? history_rollup.minutes.size() : history_rollup.hours.size();
+    uint16_t shown = count < stored ? count : stored;
+    Serial.println("start_ms,records,tds_min,tds_mean,tds_max,ph_min,ph_mean,ph_max,temp_min,temp_mean,temp_max,status");
+    for (uint16_t age = shown; age > 0; age--)
+        printRollupBucket(minutes ? history_rollup.minutes.bucket(age - 1) : history_rollup.hours.bucket(age - 1));
+    RollupBucket open;
+    if (minutes ? history_rollup.minutes.current(open) : history_rollup.hours.current(open))
+        printRollupBucket(open);
+}
+
+void printRollupBucket(const RollupBucket &bucket)
+{
+    Serial.printf("%lu,%u,%.1f,%.1f,%.1f,%.3f,%.3f,%.3f,%.2f,%.2f,%.2f,0x%04x\r\n", (unsigned long)bucket.start_ms,
+                  (unsigned)bucket.count, bucket.minimum(ROLLUP_TDS), bucket.average(ROLLUP_TDS), bucket.maximum(ROLLUP_TDS),
+                  bucket.minimum(ROLLUP_PH), bucket.average(ROLLUP_PH), bucket.maximum(ROLLUP_PH),
+                  bucket.minimum(ROLLUP_TEMPERATURE), bucket.average(ROLLUP_TEMPERATURE), bucket.maximum(ROLLUP_TEMPERATURE),
+                  bucket.status);
+}
+
+bool rollupHistoryRecord(const TelemetryRecord &record, void *context)
+{
+    history_rollup.add(record);
+    return true;
+}
+
+void myExportCommand(const char *args)
+{
+    // The frames only make sense to the host decoder
+    uint32_t seconds = strtoul(args, NULL, 10);
+    if (!telemetry_binary || seconds == 0 || !history_ready)
+    {
+        if (!telemetry_binary)
+            Serial.println(history_ready ? "usage: mode binary, then export <seconds>" : "history unavailable");
+        return;
+    }
+
+    // The export task sends it a batch at a time, a new export replaces a running one
+    export_to_ms = history.logTime(halMillis());
+    export_next_ms = export_to_ms - seconds * 1000UL;
+    export_active = true;
+}
+
+uint32_t myExportFuction(void *context, uint32_t now_us)
+{
+    if (!export_active)
+        return EXPORT_PERIOD_MS * 1000UL;
+
+    // Fill one block from where the last one stopped, timestamps in the log always increase
+    PROFILE_SCOPE(profile_print);
+    export_encoder.begin(export_block, sizeof(export_block));
+    export_full = false;
+    history.scan(export_next_ms, export_to_ms, exportHistoryRecord, NULL);
+    if (export_encoder.count() > 0 && telemetry_binary)
+    {
+        size_t length = telemetryEncodeBatch(export_block, export_encoder.size(), export_encoder.count(), export_frame,
+                                             sizeof(export_frame));
+        Serial.write(export_frame, length);
+    }
+    export_next_ms = export_encoder.lastMs() + 1;
+    export_active = export_full && telemetry_binary;
+    return EXPORT_PERIOD_MS * 1000UL;
+}
+
+bool exportHistoryRecord(const TelemetryRecord &record, void *context)
+{
+    if (export_encoder.append(record))
+        return true;
+    export_full = true;
+    return false;
+}
+
+void myCaptureCommand(const char *args)
+{
+    // The frames only make sense to the host replay
+    if (strcmp(args, "on") == 0 && telemetry_binary)
+        trace_recorder.start();
+    else if (strcmp(args, "off") == 0)
+        trace_recorder.stop();
+    else if (!telemetry_binary)
+        Serial.println("usage: mode binary, then capture on|off");
+}
+
+void myReferenceCommand(const char *args)
+{
+    // Goes into the trace next to the raw input of the same moment, ignored while no capture runs
+    char kind[8];
+    float value;
+    if (sscanf(args, "%7s %f", kind, &value) != 2)
+        return;
+    if (strcmp(kind, "ph") == 0)
+        trace_recorder.reference(READING_PH, value, halMicros());
+    else if (strcmp(kind, "tds") == 0)
+        trace_recorder.reference(READING_TDS, value, halMicros());
+    else if (strcmp(kind, "temp") == 0)
+        trace_recorder.reference(READING_TEMPERATURE, value, halMicros());
+}
+
+uint32_t myCaptureFuction(void *context, uint32_t now_us)
+{
+    // The acquisition task fills the chunks, a switch back to text mode ends the capture
+    if (trace_recorder.active() && !telemetry_binary)
+        trace_recorder.stop();
+    RawTraceChunk chunk;
+    if (trace_recorder.take(chunk) && telemetry_binary)
+    {
+        PROFILE_SCOPE(profile_print);
+        size_t length = telemetryEncodeTrace(chunk.data, chunk.length, chunk.count, capture_frame, sizeof(capture_frame));
+        Serial.write(capture_frame, length);
+    }
+    return CAPTURE_PERIOD_MS * 1000UL;
+}
+
+uint32_t myMqttFuction(void *context, uint32_t now_us)
+{
+#if MQTT_ENABLED
+    PROFILE_SCOPE(profile_mqtt);
+    mqtt.poll(halMillis());
+#endif
+    return MQTT_POLL_MS * 1000UL;
+}
+
+void myMqttCommand(const char *args)
+{
+#if MQTT_ENABLED
+    if (telemetry_binary)
+        return;
+    static const char *const states[] = {"disconnected", "connecting", "handshake", "connected"};
+    const MqttStats &stats = mqtt.stats();
+    Serial.printf("mqtt: %s, wifi %s, broker %s:%u topic %s\r\n", states[mqtt.state()], WiFi.status() == WL_CONNECTED ? "up" : "down",
+                  MQTT_BROKER, (unsigned)MQTT_PORT, MQTT_TOPIC);
+    Serial.printf("queue: %u of %u messages, %u records batched, deepest %u\r\n", (unsigned)mqtt.queued(), (unsigned)MQTT_QUEUE_MESSAGES,
+                  (unsigned)mqtt.batched(), (unsigned)stats.queue_max);
+    Serial.printf("sent: %u records in %u messages, %u acknowledged, %u resent, %u dropped (%u records), %u bytes\r\n",
+                  (unsigned)stats.records, (unsigned)stats.messages, (unsigned)stats.published, (unsigned)stats.resent,
+                  (unsigned)stats.dropped, (unsigned)stats.dropped_records, (unsigned)stats.bytes);
+    Serial.printf("sessions: %u, %u failed attempts\r\n", (unsigned)stats.connects, (unsigned)stats.failures);
+#endif
 }
 
-int myTdsFuction()
+bool printHistoryRecord(const TelemetryRecord &record, void *context)
 {
-    // 1,807 = Read Value Raw
-    // 1,620 = Read Value, temp adusted
-    // 1,760 = Reading from meter
-    // TDS Target is 750 to 1500
+    uint32_t &lines = *static_cast<uint32_t *>(context);
+    Serial.printf("%u,%lu,%.2f,%.3f,%.3f,0x%04x\r\n", record.sequence, (unsigned long)record.timestamp_ms,
+                  record.tds_ppm, record.ph, record.temperature_c, record.status);
+    return ++lines < HISTORY_MAX_LINES;
+}
+
+uint32_t myStatsFuction(void *context, uint32_t now_us)
+{
+    printSchedulerStats("acquisition", acquisition);
+    printSchedulerStats("loop", scheduler);
+
+    // Print the handoff counters between the cores
+    Serial.printf("ring: %u published, %u dropped, %u overruns, %u queued\r\n", (unsigned)acquisition_published,
+                  (unsigned)acquisition_drops, (unsigned)acquisition_overruns, (unsigned)readings.size());
+    Serial.printf("adc: %u blocks lost, %u ticks missed\r\n", (unsigned)adc.overflows(), (unsigned)adc.missedTicks());
+#if ADS1X15_ENABLED
+    Serial.printf("ads1x15: %u SPS, %u rounds, %u transactions, %u bus errors\r\n", (unsigned)adc.dataRate(), (unsigned)adc.stats().rounds,
+                  (unsigned)adc.stats().transactions, (unsigned)adc.stats().bus_errors);
+#endif
+    if (trace_recorder.events() > 0)
+        Serial.printf("capture: %s, %u events, %u chunks dropped\r\n", trace_recorder.active() ? "on" : "off",
+                      (unsigned)trace_recorder.events(), (unsigned)trace_recorder.dropped());
+    Serial.printf("history: %u records, %u chunks %u bytes written, %u failed writes\r\n", (unsigned)history.storedRecords(),
+                  (unsigned)history.chunksWritten(), (unsigned)history.bytesWritten(), (unsigned)history.writeFailures());
+#if MQTT_ENABLED
+    Serial.printf("mqtt: %u messages acknowledged, %u queued, %u dropped, %u failed attempts\r\n", (unsigned)mqtt.stats().published,
+                  (unsigned)mqtt.queued(), (unsigned)mqtt.stats().dropped, (unsigned)mqtt.stats().failures);
+#endif
+    const DutyCycleStats &windows = duty.stats();
+    if (windows.windows > 0)
+    {
+        Serial.printf("power: %u windows, %u timed out, awake %u%%, %u deep sleep wakes\r\n", (unsigned)windows.windows,
+                      (unsigned)windows.timeouts, (unsigned)(100 * windows.awake_us / (windows.awake_us + windows.asleep_us)),
+                      (unsigned)resume_state.wakes);
+        const WakeLatency *latency = windows.latency;
+        Serial.printf("wake to first reading ms: tds %u/%u, ph %u/%u, temp %u/%u (last/max)\r\n",
+                      (unsigned)(latency[READING_TDS].last_us / 1000), (unsigned)(latency[READING_TDS].max_us / 1000),
+                      (unsigned)(latency[READING_PH].last_us / 1000), (unsigned)(latency[READING_PH].max_us / 1000),
+                      (unsigned)(latency[READING_TEMPERATURE].last_us / 1000), (unsigned)(latency[READING_TEMPERATURE].max_us / 1000));
+    }
+    const ControlTiming &timing = control.timing();
+    const ControlTimingStats &ticks = timing.stats();
+    if (ticks.ticks > 0)
+    {
+        Serial.printf("control jitter us: min %u avg %u p99 <%u max %u, run us max %u, %u missed of %u ticks\r\n",
+                      (unsigned)ticks.lateness_min_us, (unsigned)(ticks.lateness_sum_us / ticks.ticks), (unsigned)timing.percentile(99),
+                      (unsigned)ticks.lateness_max_us, (unsigned)ticks.run_max_us, (unsigned)ticks.missed, (unsigned)ticks.ticks);
+    }
+    if (ph_dosing.enabled() || nutrient_dosing.enabled())
+    {
+        printDosing("ph", ph_dosing);
+        printDosing("tds", nutrient_dosing);
+    }
+    Serial.printf("state: %u derived values recomputed, %u skipped\r\n", (unsigned)sensor_pipeline.state().recomputed(), (unsigned)sensor_pipeline.state().skipped());
+    Serial.println("----------------------------------------");
 
-    double tds_temperature_coefficient = 0.02;    // temperature coefficient. 0.02°C^-1 is a commonly used coefficient,
-    double tds_refference_temperature = 25;       // reference temperature in °C
-    double tds_value = analogRead(ESP32_PIN_TDS); // read the analog value from the sensor
+    scheduler.resetStats();
+    acquisition_reset_stats = true;
+    control.resetTiming();
+    return STATS_PERIOD_MS * 1000UL;
+}
 
-    double tds_value_normalised = tds_value * (1 + tds_temperature_coefficient * (tds_temperature - tds_refference_temperature));
+void printSchedulerStats(const char *title, const Scheduler &stats_scheduler)
+{
+    // Print the cycle time of the scheduler passes
+    const SchedulerCycleStats &cycle = stats_scheduler.cycleStats();
+    if (cycle.cycles > 0)
+    {
+        Serial.printf("%s cycle us: min %u avg %u max %u (%u passes)\r\n", title,
+                      (unsigned)cycle.cycle_min_us, (unsigned)(cycle.cycle_sum_us / cycle.cycles),
+                      (unsigned)cycle.cycle_max_us, (unsigned)cycle.cycles);
+    }
 
-    return tds_value_normalised;
-}
\ No newline at end of file
+    // Print the start jitter and run time of every task
+    for (uint8_t i = 0; i < stats_scheduler.taskCount(); i++)
+    {
+        const SchedulerTaskStats &stats = stats_scheduler.taskStats(i);
+        if (stats.runs == 0)
+            continue;
+        Serial.printf("%-7s jitter us: min %u avg %u max %u, run us: avg %u max %u\r\n", stats_scheduler.taskName(i),
+                      (unsigned)stats.lateness_min_us, (unsigned)(stats.lateness_sum_us / stats.runs), (unsigned)stats.lateness_max_us,
+                      (unsigned)(stats.run_time_sum_us / stats.runs), (unsigned)stats.run_time_max_us);
+    }
+}
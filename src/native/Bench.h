@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Helpers shared by the host benchmarks
+
+// Cycle counter of the host CPU, falls back to nanoseconds where there is no TSC
+inline uint64_t benchCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Monotonic nanoseconds
+inline uint64_t benchNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Keep the optimiser from throwing away a result that is otherwise unused
+template <typename T>
+inline void benchKeep(const T &value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// Repeatable pseudo random ADC counts (xorshift32)
+inline uint32_t benchRandom(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// The original double TDS and pH math (BenchMath.cpp), what the benches hold the firmware's math against
+double referenceTds(uint16_t millivolts, double celsius);
+double referencePh(uint16_t millivolts, double offset);
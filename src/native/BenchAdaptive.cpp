@@ -0,0 +1,352 @@
+// Host benchmark of the adaptive sampling.
+// Replays a trace of the reservoir through the firmware's pipeline twice, at
+// the fixed base rates and with adaptive sampling on, and compares what each
+// reported once a second against the trace. The trace is a CSV from "decode"
+// or "history" (timestamp_ms,tds_ppm,ph,temperature_c in the columns after the
+// sequence), or without a file six built-in hours of a slowly warming tank
+// with a pH down and a nutrient dose every hour. The values are turned back
+// into raw ADC counts through the default calibration and noise is added, so
+// the filters see what the probes would give them.
+//
+// The work is counted in ADC conversions and OneWire transactions. The busy
+// time and the charge are rough models, not measurements: the OneWire figures
+// are the mock bus costs, a conversion is a guess at analogRead() plus the
+// sampling task around it. What adaptive sampling must save and keep is
+// covered by the unit tests (pio test -e native).
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "NativeCommands.h"
+#include "Scheduler.h"
+#include "TemperatureEngine.h"
+#include "SensorPipeline.h"
+#include "Calibration.h"
+#include "SensorMath.h"
+#include "Hal.h"
+#include "FakeClock.h"
+#include "MockTemperatureBus.h"
+#include "SimulatedAdcSource.h"
+#include "AdcCalibration.h"
+#include "ReferenceAdcCurve.h"
+#include "Bench.h"
+
+#define ADAPT_PIN_PH 25
+#define ADAPT_PIN_TDS 34
+#define ADAPT_ADC_RATE_HZ 250
+#define ADAPT_BLOCK_PERIOD_US (1000000UL * ADC_BLOCK_SIZE / ADAPT_ADC_RATE_HZ)
+#define ADAPT_HOURS 6                // Length of the built-in trace
+#define ADAPT_DOSE_PERIOD_S 3600     // A dose every hour, the first after half an hour
+#define ADAPT_MIX_TAU_S 180.0f       // Mixing time constant of a dose
+#define ADAPT_WARMUP_S 60            // Not compared, the filters and the TDS compensation fill up
+#define ADAPT_PH_NOISE 4.0f          // Raw counts, like the simulated sensors
+#define ADAPT_TDS_NOISE 6.0f
+#define ADAPT_TEMP_NOISE 0.02f       // C
+
+// Cost model, rough figures for an ESP32 at 240 MHz
+#define ADAPT_CONVERSION_US 15.0     // One analogRead() with the sampling task around it
+#define ADAPT_ACTIVE_MA 30.0         // CPU awake over idle
+#define ADAPT_PROBE_MA 1.0           // DS18B20 converting
+
+// One line of the trace
+struct TracePoint
+{
+    uint64_t time_ms;
+    float tds_ppm;
+    float ph;
+    float celsius;
+};
+
+// Error of one channel against the trace
+struct TraceError
+{
+    double sum_squares;
+    float max;
+    uint32_t count;
+
+    void add(float error)
+    {
+        sum_squares += (double)error * error;
+        if (fabsf(error) > max)
+            max = fabsf(error);
+        count++;
+    }
+    float rms() const { return count ? sqrt(sum_squares / count) : 0; }
+};
+
+// What one replay saw and cost
+struct TraceRun
+{
+    TraceError ph, tds, temperature;
+    SamplingStats sampling;
+    uint32_t steps;              // Pipeline step runs
+    uint32_t conversions;        // DS18B20 conversions started
+    uint32_t bus_transactions;
+    double busy_ms;              // Modelled CPU time
+    double charge_mah;           // Modelled charge over idle
+};
+
+static std::vector<TracePoint> trace;
+static std::vector<uint64_t> trace_doses;     // Dose times of the built-in trace in ms
+static AdcCalibration adapt_tds_calibration, adapt_ph_calibration;
+static CalibrationCurves adapt_curves;
+static uint64_t adapt_now_us;                 // Fake clock without the wrap, a replay runs for hours
+static uint32_t adapt_random;
+static float adapt_latest[READING_EC + 1];    // Last value the pipeline reported of every channel
+
+// Standard normal sample, Box-Muller on xorshift32
+static float adaptNoise()
+{
+    float u1 = (benchRandom(adapt_random) + 1.0f) / 4294967296.0f;
+    float u2 = benchRandom(adapt_random) / 4294967296.0f;
+    return sqrtf(-2.0f * logf(u1)) * cosf(6.2831853f * u2);
+}
+
+// Trace at a time, linear between two lines
+static TracePoint traceAt(uint64_t time_ms)
+{
+    size_t low = 0, high = trace.size() - 1;
+    if (time_ms <= trace[low].time_ms)
+        return trace[low];
+    if (time_ms >= trace[high].time_ms)
+        return trace[high];
+    while (high - low > 1)
+    {
+        size_t middle = (low + high) / 2;
+        if (trace[middle].time_ms <= time_ms)
+            low = middle;
+        else
+            high = middle;
+    }
+    const TracePoint &a = trace[low], &b = trace[high];
+    float f = (float)(time_ms - a.time_ms) / (float)(b.time_ms - a.time_ms);
+    return {time_ms, a.tds_ppm + f * (b.tds_ppm - a.tds_ppm), a.ph + f * (b.ph - a.ph), a.celsius + f * (b.celsius - a.celsius)};
+}
+
+// Fractional raw count that reads as these millivolts, the table rises with the count
+static float rawFor(const AdcCalibration &calibration, float millivolts)
+{
+    uint16_t low = 0, high = ADC_RAW_MAX;
+    if (millivolts <= calibration.millivolts(low))
+        return low;
+    if (millivolts >= calibration.millivolts(high))
+        return high;
+    while (high - low > 1)
+    {
+        uint16_t middle = (low + high) / 2;
+        if (calibration.millivolts(middle) <= millivolts)
+            low = middle;
+        else
+            high = middle;
+    }
+    float span = calibration.millivolts(high) - calibration.millivolts(low);
+    return low + (span > 0 ? (millivolts - calibration.millivolts(low)) / span : 0);
+}
+
+// Probe voltage that gives this value, for a curve that only rises or only falls
+static float voltsFor(float target, float (*curve)(float volts))
+{
+    float low = 0, high = 3.3f;
+    bool rising = curve(high) > curve(low);
+    for (uint8_t i = 0; i < 40; i++)
+    {
+        float middle = (low + high) / 2;
+        if ((curve(middle) < target) == rising)
+            low = middle;
+        else
+            high = middle;
+    }
+    return (low + high) / 2;
+}
+
+static float curvePh(float volts) { return SensorMath::toFloat(adapt_curves.ph(SensorMath::value(volts))); }
+static float curveTds(float volts) { return SensorMath::toFloat(adapt_curves.tdsPpm(SensorMath::value(volts))); }
+
+// Raw counts of the probes at a point of the trace, what the pipeline turns back into it
+static uint16_t adaptSignal(uint8_t pin, uint32_t time_us)
+{
+    // The sample may be a little older than now
+    uint64_t at_us = adapt_now_us - (uint32_t)(fake_now_us - time_us);
+    TracePoint point = traceAt(at_us / 1000);
+    float raw;
+    if (pin == ADAPT_PIN_PH)
+        raw = rawFor(adapt_ph_calibration, voltsFor(point.ph, curvePh) * 1000.0f) + ADAPT_PH_NOISE * adaptNoise();
+    else
+    {
+        // The probe voltage rises with the temperature, the pipeline compensates it
+        float compensated = voltsFor(point.tds_ppm, curveTds);
+        float volts = compensated * (1.0f + (point.celsius - 25.0f) / 50.0f);
+        raw = rawFor(adapt_tds_calibration, volts * 1000.0f) + ADAPT_TDS_NOISE * adaptNoise();
+    }
+    if (raw < 0)
+        raw = 0;
+    return raw > ADC_RAW_MAX ? ADC_RAW_MAX : (uint16_t)lroundf(raw);
+}
+
+static void adaptSink(ReadingChannel channel, uint8_t index, float value, SensorQuality quality)
+{
+    if (index == 0)
+        adapt_latest[channel] = value;
+}
+
+// Six hours of a tank: warming through the day, uptake raising the pH and lowering the TDS, a dose every hour
+static void builtInTrace()
+{
+    float ph_mixing = 0, tds_mixing = 0;   // Dosed, not mixed in yet
+    float ph_dosed = 0, tds_dosed = 0;     // Mixed in so far
+    float mixed = 1.0f - expf(-1.0f / ADAPT_MIX_TAU_S);
+    for (uint32_t second = 0; second <= ADAPT_HOURS * 3600UL; second++)
+    {
+        if (second % ADAPT_DOSE_PERIOD_S == ADAPT_DOSE_PERIOD_S / 2)
+        {
+            ph_mixing -= 0.1f;
+            tds_mixing += 40.0f;
+            trace_doses.push_back(second * 1000ULL);
+        }
+        ph_dosed += ph_mixing * mixed;
+        ph_mixing -= ph_mixing * mixed;
+        tds_dosed += tds_mixing * mixed;
+        tds_mixing -= tds_mixing * mixed;
+
+        float hours = second / 3600.0f;
+        trace.push_back({second * 1000ULL, 1100.0f - 40.0f * hours + tds_dosed, 6.0f + 0.1f * hours + ph_dosed,
+                         21.0f + 1.5f * sinf(6.2831853f * hours / 24.0f)});
+    }
+}
+
+// Read the decoded CSV, returns false if nothing usable is in it
+static bool loadTrace(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    char line[160];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        unsigned sequence;
+        unsigned long long time_ms;
+        TracePoint point;
+        if (sscanf(line, "%u,%llu,%f,%f,%f", &sequence, &time_ms, &point.tds_ppm, &point.ph, &point.celsius) != 5)
+            continue; // The header and anything else
+        point.time_ms = time_ms;
+        if (!trace.empty() && point.time_ms <= trace.back().time_ms)
+            continue; // Out of order, a restarted node
+        trace.push_back(point);
+    }
+    fclose(file);
+
+    // Start at zero like the built-in trace
+    if (trace.size() < 2)
+        return false;
+    uint64_t start_ms = trace[0].time_ms;
+    for (TracePoint &point : trace)
+        point.time_ms -= start_ms;
+    return true;
+}
+
+// Replay the whole trace once
+static void replay(bool adaptive, TraceRun &run)
+{
+    fake_now_us = 0;
+    adapt_now_us = 0;
+    adapt_random = 2463534242UL;
+    memset(adapt_latest, 0, sizeof(adapt_latest));
+
+    MockTemperatureBus bus;
+    bus.addProbe(trace[0].celsius);
+    TemperatureEngine temperatures(bus, halMicros);
+    temperatures.begin(halMicros());
+    SimulatedAdcSource adc(adaptSignal);
+    const uint8_t adc_pins[] = {ADAPT_PIN_TDS, ADAPT_PIN_PH};
+    adc.begin(adc_pins, 2, ADAPT_ADC_RATE_HZ);
+
+    Scheduler scheduler(halMicros);
+    SensorPipeline pipeline(adc, temperatures, adapt_tds_calibration, adapt_ph_calibration);
+    pipeline.begin(scheduler, adaptSink, ADAPT_BLOCK_PERIOD_US, 10000000UL);
+    pipeline.setAdaptive(adaptive);
+
+    uint64_t end_ms = trace.back().time_ms;
+    uint64_t next_check_ms = ADAPT_WARMUP_S * 1000ULL;
+    size_t next_dose = 0;
+    while (adapt_now_us / 1000 < end_ms)
+    {
+        // The firmware boosts when a pump starts
+        if (next_dose < trace_doses.size() && adapt_now_us / 1000 >= trace_doses[next_dose])
+        {
+            pipeline.boost();
+            next_dose++;
+        }
+        bus.setTemperature(0, traceAt(adapt_now_us / 1000).celsius + ADAPT_TEMP_NOISE * adaptNoise());
+
+        uint32_t before_us = fake_now_us;
+        uint32_t idle_us = scheduler.runOnce();
+        run.steps++;
+        fakeSpend(idle_us);
+        adapt_now_us += fake_now_us - before_us;
+
+        // Once a second, what the node would report against the trace
+        while (next_check_ms <= adapt_now_us / 1000 && next_check_ms <= end_ms)
+        {
+            TracePoint truth = traceAt(next_check_ms);
+            run.ph.add(adapt_latest[READING_PH] - truth.ph);
+            run.tds.add(adapt_latest[READING_TDS] - truth.tds_ppm);
+            run.temperature.add(adapt_latest[READING_TEMPERATURE] - truth.celsius);
+            next_check_ms += 1000;
+        }
+    }
+
+    run.sampling = pipeline.samplingStats();
+    run.conversions = run.sampling.onewire / 2;
+    run.bus_transactions = bus.transactions;
+    double onewire_us = run.conversions * (double)(MockTemperatureBus::COMMAND_US + MockTemperatureBus::READ_US);
+    run.busy_ms = (run.sampling.adc_conversions * ADAPT_CONVERSION_US + onewire_us) / 1000.0;
+    double converting_s = run.conversions * probeConversionTimeUs(12) / 1e6;
+    run.charge_mah = (run.busy_ms / 1000.0 * ADAPT_ACTIVE_MA + converting_s * ADAPT_PROBE_MA) / 3600.0;
+}
+
+static void printRun(const char *name, const TraceRun &run)
+{
+    printf("%-9s pH rms %.4f max %.4f | tds rms %6.2f max %6.2f ppm | temp rms %.3f max %.3f C\n", name, run.ph.rms(),
+           run.ph.max, run.tds.rms(), run.tds.max, run.temperature.rms(), run.temperature.max);
+    printf("          %llu adc conversions, %u onewire transactions, %u steps, busy %.0f ms, %.3f mAh\n",
+           (unsigned long long)run.sampling.adc_conversions, (unsigned)run.sampling.onewire, (unsigned)run.steps, run.busy_ms,
+           run.charge_mah);
+}
+
+int benchAdaptive(int argc, char **argv)
+{
+    trace.clear();
+    trace_doses.clear();
+    bool built_in = argc < 1;
+    if (built_in)
+        builtInTrace();
+    else if (!loadTrace(argv[0]))
+    {
+        fprintf(stderr, "%s: no trace lines\n", argv[0]);
+        return 1;
+    }
+
+    adapt_tds_calibration.build(referenceAdcMillivolts, &REFERENCE_ADC1);
+    adapt_ph_calibration.build(referenceAdcMillivolts, &REFERENCE_ADC2);
+    printf("%s trace, %.1f hours, %u lines, %u doses\n", built_in ? "built-in" : argv[0], trace.back().time_ms / 3600000.0,
+           (unsigned)trace.size(), (unsigned)trace_doses.size());
+
+    TraceRun fixed = {}, adaptive = {};
+    replay(false, fixed);
+    replay(true, adaptive);
+    printRun("fixed", fixed);
+    printRun("adaptive", adaptive);
+
+    // The fixed run did every conversion at the base rate, the adaptive one counts what that would have been
+    double adc_saved = 1.0 - (double)adaptive.sampling.adc_conversions / fixed.sampling.adc_conversions;
+    double onewire_saved = 1.0 - (double)adaptive.sampling.onewire / fixed.sampling.onewire;
+    printf("saved     %.1f%% adc conversions, %.1f%% onewire transactions, %.1f%% busy time, %.1f%% charge\n",
+           100.0 * adc_saved, 100.0 * onewire_saved, 100.0 * (1.0 - adaptive.busy_ms / fixed.busy_ms),
+           100.0 * (1.0 - adaptive.charge_mah / fixed.charge_mah));
+    printf("          the adaptive run's own count at the base rates: %llu conversions, %u transactions\n",
+           (unsigned long long)adaptive.sampling.adc_fixed, (unsigned)adaptive.sampling.onewire_fixed);
+    return 0;
+}
@@ -0,0 +1,280 @@
+// Host benchmark of the ADS1x15 chain.
+// Runs the chain source against the mock bus on the fake clock for a few
+// layouts of channels over devices, three ways: batched rounds paced by
+// ALERT/RDY, the same rounds with every transfer as its own transaction, and
+// the usual library loop that starts one single-shot conversion at a time and
+// polls the OS bit. Prints the samples per second of every channel, the time
+// between two samples of a channel (scan latency), the bus load and the
+// transactions. Then the firmware's pipeline runs on a chain with extra pH
+// and TDS probes and prints what each of them reports. The pacing, the
+// channel order and the extra probes are covered by the unit tests
+// (pio test -e native).
+#include <initializer_list>
+#include <stdio.h>
+#include <string.h>
+#include "NativeCommands.h"
+#include "Ads1x15Source.h"
+#include "Scheduler.h"
+#include "TemperatureEngine.h"
+#include "SensorPipeline.h"
+#include "AdcCalibration.h"
+#include "Hal.h"
+#include "FakeClock.h"
+#include "MockTemperatureBus.h"
+#include "MockAds1x15Bus.h"
+
+#define ADS_BENCH_SECONDS 10
+#define ADS_BENCH_RATE_HZ 10000       // More than any data rate, the chain runs flat out
+#define ADS_BENCH_RATE_CODE 7         // What that picks, for the polled loop
+#define ADS_BENCH_WAKE_US 20          // Pin interrupt to sampling task running
+#define ADS_PIPELINE_SECONDS 30
+
+static const uint8_t ads_bench_addresses[ADS1X15_MAX_DEVICES] = {0x48, 0x49, 0x4A, 0x4B};
+static const float ads_bench_clock_errors[ADS1X15_MAX_DEVICES] = {0.03f, -0.02f, 0.05f, -0.04f};
+
+// One layout of the chain
+struct AdsBenchLayout
+{
+    const char *name;
+    uint8_t channels;
+    uint8_t devices;
+    Ads1x15Model model;
+};
+
+// How the samples are taken
+enum AdsBenchMode
+{
+    ADS_BATCHED,  // One transaction per round, paced by ALERT/RDY
+    ADS_SPLIT,    // The same with a transaction per transfer
+    ADS_POLLED,   // One single-shot conversion at a time, OS bit polled
+};
+
+static const char *const ads_bench_mode_names[] = {"batched", "unbatched", "polled"};
+
+// Every input has its own voltage
+static float adsBenchVolts(uint8_t device, uint8_t input)
+{
+    return 0.15f + 0.2f * (device * ADS1X15_INPUTS + input);
+}
+
+static float adsBenchSignal(uint8_t device, uint8_t input, uint32_t time_us, void *context)
+{
+    if (context)
+        return ((const float *)context)[device * ADS1X15_INPUTS + input];
+    return adsBenchVolts(device, input);
+}
+
+// Hands every transfer to the bus as its own transaction
+class SplitBus : public I2cBus
+{
+public:
+    explicit SplitBus(I2cBus &bus) : bus(bus) {}
+
+    bool transfer(const I2cTransfer *transfers, uint8_t count) override
+    {
+        bool ok = true;
+        for (uint8_t i = 0; i < count; i++)
+            ok &= bus.transfer(&transfers[i], 1);
+        return ok;
+    }
+
+private:
+    I2cBus &bus;
+};
+
+// Deliver the pulses up to a time as the pin interrupts would, and take the rounds they complete
+static void adsBenchAdvance(MockAds1x15Bus &mock, Ads1x15Source &source, uint32_t until_us)
+{
+    uint8_t device;
+    uint32_t at;
+    while ((at = mock.nextAlert(device)) != UINT32_MAX && (int32_t)(at - until_us) <= 0)
+    {
+        if ((int32_t)(at - fake_now_us) > 0)
+            fake_now_us = at;
+        mock.takeAlert(device);
+        if (source.ready(device))
+        {
+            fakeSpend(ADS_BENCH_WAKE_US);
+            source.service(fake_now_us);
+        }
+    }
+    if ((int32_t)(until_us - fake_now_us) > 0)
+        fake_now_us = until_us;
+}
+
+// Chain input of channel i, the channels go round the devices
+static uint8_t adsBenchPin(uint8_t channel, uint8_t devices)
+{
+    return ADS1X15_INPUT(channel % devices, channel / devices);
+}
+
+// The polled loop of the common libraries: start one conversion, poll the OS bit, read the result
+static void adsBenchPolled(MockAds1x15Bus &mock, const AdsBenchLayout &layout, uint32_t end_us)
+{
+    for (uint8_t channel = 0; (int32_t)(end_us - fake_now_us) > 0; channel = (channel + 1) % layout.channels)
+    {
+        uint8_t pin = adsBenchPin(channel, layout.devices);
+        uint8_t address = ads_bench_addresses[pin / ADS1X15_INPUTS];
+        uint16_t config = 0x8000 | 0x4000 | (pin % ADS1X15_INPUTS) << 12 | 0x0200 | 0x0100 | ADS_BENCH_RATE_CODE << 5;
+        const uint8_t start[] = {0x01, (uint8_t)(config >> 8), (uint8_t)(config & 0xFF)};
+        const I2cTransfer write = {address, start, sizeof(start), NULL, 0};
+        mock.transfer(&write, 1);
+
+        static const uint8_t config_pointer[] = {0x01};
+        uint8_t status[2] = {0, 0};
+        const I2cTransfer poll = {address, config_pointer, 1, status, 2};
+        do
+            mock.transfer(&poll, 1);
+        while (!(status[0] & 0x80));
+
+        static const uint8_t conversion_pointer[] = {0x00};
+        uint8_t result[2];
+        const I2cTransfer read = {address, conversion_pointer, 1, result, 2};
+        mock.transfer(&read, 1);
+    }
+}
+
+static void adsBenchRun(const AdsBenchLayout &layout, AdsBenchMode mode)
+{
+    MockAds1x15Bus mock(adsBenchSignal, NULL, layout.model == ADS1015);
+    for (uint8_t i = 0; i < layout.devices; i++)
+        mock.addDevice(ads_bench_addresses[i], ads_bench_clock_errors[i]);
+    SplitBus split(mock);
+    Ads1x15Source source(mode == ADS_SPLIT ? (I2cBus &)split : mock, ads_bench_addresses, layout.devices, layout.model);
+
+    uint8_t pins[ADS1X15_MAX_CHANNELS];
+    for (uint8_t i = 0; i < layout.channels; i++)
+        pins[i] = adsBenchPin(i, layout.devices);
+
+    uint32_t start_us = fake_now_us;
+    uint32_t end_us = start_us + ADS_BENCH_SECONDS * 1000000UL;
+    if (mode == ADS_POLLED)
+        adsBenchPolled(mock, layout, end_us);
+    else
+    {
+        if (!source.begin(pins, layout.channels, ADS_BENCH_RATE_HZ))
+        {
+            printf("%s: begin failed\n", layout.name);
+            return;
+        }
+        while ((int32_t)(end_us - fake_now_us) > 0)
+        {
+            adsBenchAdvance(mock, source, fake_now_us + 1000);
+
+            // Take the blocks as the pipeline would, so none overflows
+            AdcBlock block;
+            for (uint8_t i = 0; i < layout.channels; i++)
+            {
+                while (source.readBlock(i, block))
+                {
+                }
+            }
+        }
+    }
+    double seconds = (fake_now_us - start_us) / 1e6;
+
+    // Per channel from what the bus handed out
+    uint32_t reads = 0, max_gap_us = 0;
+    uint64_t gap_sum_us = 0, gaps = 0;
+    for (uint8_t i = 0; i < layout.channels; i++)
+    {
+        const MockAds1x15Bus::InputStats &input = mock.inputs[pins[i] / ADS1X15_INPUTS][pins[i] % ADS1X15_INPUTS];
+        reads += input.reads;
+        gap_sum_us += input.gap_sum_us;
+        gaps += input.reads > 0 ? input.reads - 1 : 0;
+        if (input.gap_max_us > max_gap_us)
+            max_gap_us = input.gap_max_us;
+    }
+    printf("  %-9s %7.1f samples/s per channel, scan %6.2f ms avg %6.2f ms max, bus %5.1f%%, %6.0f transactions/s\n",
+           ads_bench_mode_names[mode], reads / seconds / layout.channels, gaps ? gap_sum_us / 1e3 / gaps : 0.0, max_gap_us / 1e3,
+           100.0 * mock.busy_us / (fake_now_us - start_us), mock.transactions / seconds);
+}
+
+// What the pipeline reported last, by kind and index
+static float ads_pipeline_values[READING_EC + 1][1 + PIPELINE_MAX_PROBES];
+static uint32_t ads_pipeline_counts[READING_EC + 1][1 + PIPELINE_MAX_PROBES];
+
+static void adsPipelineSink(ReadingChannel channel, uint8_t index, float value, SensorQuality quality)
+{
+    if (index > PIPELINE_MAX_PROBES)
+        return;
+    ads_pipeline_values[channel][index] = value;
+    ads_pipeline_counts[channel][index]++;
+}
+
+static void adsPipelineRun()
+{
+    // Two devices: TDS and pH first as the firmware has them, then the extra probes
+    static const ReadingChannel kinds[] = {READING_TDS, READING_PH, READING_PH, READING_PH, READING_TDS, READING_TDS, READING_PH, READING_TDS};
+    const uint8_t channel_count = sizeof(kinds) / sizeof(kinds[0]);
+    const uint8_t devices = 2;
+    float volts[ADS1X15_MAX_CHANNELS] = {};
+    uint8_t pins[ADS1X15_MAX_CHANNELS];
+    for (uint8_t i = 0; i < channel_count; i++)
+    {
+        pins[i] = adsBenchPin(i, devices);
+        volts[pins[i]] = kinds[i] == READING_PH ? 1.5f : 0.8f;
+    }
+
+    MockAds1x15Bus mock(adsBenchSignal, volts, false);
+    for (uint8_t i = 0; i < devices; i++)
+        mock.addDevice(ads_bench_addresses[i], ads_bench_clock_errors[i]);
+    Ads1x15Source source(mock, ads_bench_addresses, devices, ADS1115);
+    MockTemperatureBus bus;
+    bus.addProbe(21.5f);
+    TemperatureEngine temperatures(bus, halMicros);
+    Scheduler scheduler(halMicros);
+    AdcCalibration calibration;
+    calibration.build(ads1x15Millivolts, NULL);
+    SensorPipeline pipeline(source, temperatures, calibration, calibration);
+    for (uint8_t i = 2; i < channel_count; i++)
+        pipeline.addProbe(kinds[i], i);
+
+    source.begin(pins, channel_count, 250);
+    temperatures.begin(halMicros());
+    uint32_t per_channel_hz = source.dataRate() / 4;
+    pipeline.begin(scheduler, adsPipelineSink, 1000000UL * ADC_BLOCK_SIZE / per_channel_hz, 10000000UL);
+    memset(ads_pipeline_counts, 0, sizeof(ads_pipeline_counts));
+
+    uint32_t end_us = fake_now_us + ADS_PIPELINE_SECONDS * 1000000UL;
+    while ((int32_t)(end_us - fake_now_us) > 0)
+    {
+        uint32_t idle_us = scheduler.runOnce();
+        adsBenchAdvance(mock, source, fake_now_us + idle_us);
+    }
+
+    for (ReadingChannel kind : {READING_PH, READING_TDS})
+    {
+        uint8_t probes = 0;
+        for (uint8_t i = 0; i < channel_count; i++)
+            probes += kinds[i] == kind;
+        printf("  %-3s", kind == READING_PH ? "ph" : "tds");
+        for (uint8_t index = 0; index < probes; index++)
+        {
+            float value = ads_pipeline_values[kind][index];
+            printf(" [%u] %.3f x%u", index, value, (unsigned)ads_pipeline_counts[kind][index]);
+        }
+        printf("\n");
+    }
+}
+
+int benchAds(int argc, char **argv)
+{
+    static const AdsBenchLayout layouts[] = {
+        {"ADS1115, 4 channels on 1 device", 4, 1, ADS1115},
+        {"ADS1115, 4 channels on 4 devices", 4, 4, ADS1115},
+        {"ADS1115, 8 channels on 2 devices", 8, 2, ADS1115},
+        {"ADS1115, 8 channels on 4 devices", 8, 4, ADS1115},
+        {"ADS1115, 16 channels on 4 devices", 16, 4, ADS1115},
+        {"ADS1015, 8 channels on 4 devices", 8, 4, ADS1015},
+    };
+    for (const AdsBenchLayout &layout : layouts)
+    {
+        printf("%s\n", layout.name);
+        for (AdsBenchMode mode : {ADS_BATCHED, ADS_SPLIT, ADS_POLLED})
+            adsBenchRun(layout, mode);
+    }
+    printf("pipeline, %u extra probes on 2 devices\n", 6);
+    adsPipelineRun();
+    return 0;
+}
@@ -0,0 +1,308 @@
+// Collector throughput and ingest latency against the load generator.
+//
+// The collector runs on its own thread like the daemon would, the load
+// generator plays a few hundred nodes over loopback UDP at rising paced
+// rates and then unpaced. Every record's send time is kept per node and
+// sequence number so the collector hook can take the latency from send() to
+// the record being in its columns. A second run pushes frames through ptys in
+// odd sized writes so frames are split between reads. Last, queries and
+// downsampling are timed over the filled store. bench-collect [nodes]
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "NativeCommands.h"
+#include "Collector.h"
+#include "LoadGenerator.h"
+#include "Bench.h"
+
+#define BENCH_NODES 500
+#define BENCH_CAPACITY 4096
+#define BENCH_SEND_WINDOW 256       // Send times kept per node, a record later than this has no latency
+#define BENCH_STEP_MS 1000          // Length of every paced step
+#define BENCH_PTY_NODES 16
+#define BENCH_PTY_RECORDS 5000      // Per pty
+#define BENCH_PTY_CHUNK 37          // Odd write size, most frames straddle two writes
+
+static const uint32_t bench_rates[] = {50000, 100000, 200000, 400000, 0}; // Records per second, 0 is unpaced
+
+// Send times shared between the generator and the collector hook
+struct BenchLatency
+{
+    std::atomic<uint64_t> *sent_ns;   // [node * BENCH_SEND_WINDOW + sequence % BENCH_SEND_WINDOW]
+    std::vector<uint32_t> samples;    // Latency of every stored record in nanoseconds
+    uint64_t mismatched;              // Records whose send time was already overwritten
+};
+
+static void benchCollectorHook(uint16_t node, const TelemetryRecord &record, void *context)
+{
+    BenchLatency &latency = *static_cast<BenchLatency *>(context);
+    uint64_t sent = latency.sent_ns[node * BENCH_SEND_WINDOW + record.sequence % BENCH_SEND_WINDOW].load(std::memory_order_acquire);
+    uint64_t now = benchNanos();
+    if (sent == 0 || now - sent > 10000000000ULL)
+    {
+        latency.mismatched++;
+        return;
+    }
+    latency.samples.push_back(now - sent);
+}
+
+static void benchMarkSent(BenchLatency &latency, LoadGenerator &load, uint16_t node)
+{
+    latency.sent_ns[node * BENCH_SEND_WINDOW + load.sequence(node) % BENCH_SEND_WINDOW].store(benchNanos(), std::memory_order_release);
+}
+
+// Runs the collector until stopped, then drains whatever is still queued
+struct BenchCollectorThread
+{
+    Collector &collector;
+    std::atomic<bool> stop;
+    uint64_t cpu_ns;       // Thread CPU time spent in the collector
+
+    explicit BenchCollectorThread(Collector &collector) : collector(collector), stop(false), cpu_ns(0) {}
+
+    void run()
+    {
+        timespec start, end;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+        while (!stop.load(std::memory_order_relaxed))
+            collector.poll(1);
+        while (collector.poll(20) > 0)
+        {
+        }
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+        cpu_ns = (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+    }
+};
+
+// Percentile of sorted samples in microseconds
+static double benchPercentile(const std::vector<uint32_t> &sorted, double fraction)
+{
+    if (sorted.empty())
+        return 0;
+    size_t index = (size_t)(fraction * (sorted.size() - 1));
+    return sorted[index] / 1000.0;
+}
+
+static void benchReportLatency(const char *label, double offered, uint64_t sent, uint64_t stored, uint64_t elapsed_ns,
+                               uint64_t cpu_ns, BenchLatency &latency)
+{
+    std::sort(latency.samples.begin(), latency.samples.end());
+    char rate[16];
+    if (offered > 0)
+        snprintf(rate, sizeof(rate), "%8.0f", offered);
+    else
+        snprintf(rate, sizeof(rate), "%8s", "max");
+    printf("%-6s %s %10.0f %10.0f %6.2f%% %8.1f %8.1f %9.1f\n", label, rate, stored * 1e9 / elapsed_ns,
+           cpu_ns ? stored * 1e9 / cpu_ns : 0.0, sent ? 100.0 * (sent - stored) / sent : 0.0,
+           benchPercentile(latency.samples, 0.5), benchPercentile(latency.samples, 0.99),
+           benchPercentile(latency.samples, 1.0));
+}
+
+// Make collector node i the same as generator node i: one record each, in order
+static bool benchRegister(Collector &collector, LoadGenerator &load, BenchLatency &latency)
+{
+    for (uint16_t node = 0; node < load.nodeCount(); node++)
+    {
+        benchMarkSent(latency, load, node);
+        load.send(node);
+        uint64_t deadline = benchNanos() + 1000000000ULL;
+        while (collector.nodeCount() <= node)
+        {
+            collector.poll(1);
+            if (benchNanos() > deadline)
+                return false;
+        }
+    }
+    return true;
+}
+
+static void benchUdp(uint16_t node_count, ColumnStore &store)
+{
+    Collector collector(store);
+    uint16_t port = collector.listenUdp(0);
+    LoadGenerator load(node_count, 7);
+    BenchLatency latency;
+    latency.sent_ns = new std::atomic<uint64_t>[node_count * BENCH_SEND_WINDOW]();
+    latency.mismatched = 0;
+    if (port == 0 || !load.openUdp(port) || !benchRegister(collector, load, latency))
+    {
+        printf("udp: can not set up %u nodes\n", node_count);
+        delete[] latency.sent_ns;
+        return;
+    }
+    collector.setHook(benchCollectorHook, &latency);
+
+    printf("%u nodes over loopback UDP, %u ms per step\n", node_count, BENCH_STEP_MS);
+    printf("%-6s %8s %10s %10s %7s %8s %8s %9s\n", "source", "offered", "stored/s", "per cpu s", "lost", "p50 us",
+           "p99 us", "max us");
+    for (uint32_t rate : bench_rates)
+    {
+        // Unpaced sends as many records as the fastest paced step
+        uint64_t rounds = (uint64_t)(rate ? rate : bench_rates[0] * 8) * BENCH_STEP_MS / 1000 / node_count;
+        uint64_t round_ns = rate ? 1000000000ULL * node_count / rate : 0;
+        latency.samples.clear();
+        latency.samples.reserve(rounds * node_count);
+        uint64_t stored_before = collector.stats().records;
+
+        BenchCollectorThread thread(collector);
+        std::thread worker(&BenchCollectorThread::run, &thread);
+        uint64_t start = benchNanos();
+        uint64_t sent = 0;
+        for (uint64_t round = 0; round < rounds; round++)
+        {
+            for (uint16_t node = 0; node < node_count; node++)
+            {
+                benchMarkSent(latency, load, node);
+                sent += load.send(node);
+            }
+            // Sleep most of the way to the next round, spin the rest
+            uint64_t due = start + (round + 1) * round_ns;
+            while (rate && benchNanos() < due)
+            {
+                int64_t remaining = due - benchNanos();
+                if (remaining > 200000)
+                {
+                    timespec pause = {0, remaining - 100000};
+                    nanosleep(&pause, NULL);
+                }
+            }
+        }
+        uint64_t elapsed = benchNanos() - start;
+        thread.stop = true;
+        worker.join();
+
+        uint64_t stored = collector.stats().records - stored_before;
+        benchReportLatency("udp", rate, sent, stored, elapsed, thread.cpu_ns, latency);
+    }
+
+    const CollectorStats &stats = collector.stats();
+    printf("udp: %llu records, %llu bad frames, %llu missing by sequence, %.1f datagrams per wakeup, %llu without a send time\n",
+           (unsigned long long)stats.records, (unsigned long long)stats.bad_frames, (unsigned long long)stats.gaps,
+           stats.wakeups ? (double)stats.datagrams / stats.wakeups : 0.0, (unsigned long long)latency.mismatched);
+    delete[] latency.sent_ns;
+}
+
+static void benchPty(ColumnStore &store)
+{
+    Collector collector(store);
+    LoadGenerator load(BENCH_PTY_NODES, 11);
+    int slaves[BENCH_PTY_NODES];
+    for (uint16_t i = 0; i < BENCH_PTY_NODES; i++)
+    {
+        // The master side is the collector's serial port, the generator writes into the slave side
+        int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+        {
+            printf("pty: can not open pty %u\n", i);
+            return;
+        }
+        slaves[i] = open(ptsname(master), O_WRONLY | O_NOCTTY | O_CLOEXEC);
+        termios settings;
+        tcgetattr(slaves[i], &settings);
+        cfmakeraw(&settings);
+        tcsetattr(slaves[i], TCSANOW, &settings);
+        char name[16];
+        snprintf(name, sizeof(name), "pty%u", i);
+        collector.addStream(master, name);
+    }
+    load.useStreams(slaves);
+
+    BenchLatency latency;
+    latency.sent_ns = new std::atomic<uint64_t>[BENCH_PTY_NODES * BENCH_SEND_WINDOW]();
+    latency.mismatched = 0;
+    latency.samples.reserve(BENCH_PTY_NODES * BENCH_PTY_RECORDS);
+    collector.setHook(benchCollectorHook, &latency);
+
+    BenchCollectorThread thread(collector);
+    std::thread worker(&BenchCollectorThread::run, &thread);
+    uint64_t start = benchNanos();
+
+    // A few frames per node at a time, cut into odd sized writes
+    uint8_t buffer[8 * TELEMETRY_FRAME_SIZE];
+    for (uint32_t record = 0; record < BENCH_PTY_RECORDS; record += 8)
+    {
+        for (uint16_t node = 0; node < BENCH_PTY_NODES; node++)
+        {
+            size_t length = 0;
+            for (uint8_t i = 0; i < 8; i++)
+            {
+                benchMarkSent(latency, load, node);
+                length += load.nextFrame(node, buffer + length);
+            }
+            for (size_t offset = 0; offset < length; offset += BENCH_PTY_CHUNK)
+            {
+                size_t chunk = std::min((size_t)BENCH_PTY_CHUNK, length - offset);
+                if (write(load.fd(node), buffer + offset, chunk) != (ssize_t)chunk)
+                    printf("pty: short write\n");
+            }
+        }
+    }
+    uint64_t elapsed = benchNanos() - start;
+    usleep(50000);
+    thread.stop = true;
+    worker.join();
+
+    const CollectorStats &stats = collector.stats();
+    uint64_t sent = (uint64_t)BENCH_PTY_NODES * BENCH_PTY_RECORDS;
+    benchReportLatency("pty", 0, sent, stats.records, elapsed, thread.cpu_ns, latency);
+    printf("pty: %u nodes, %llu of %llu records, %llu bad frames, %llu missing by sequence\n", BENCH_PTY_NODES,
+           (unsigned long long)stats.records, (unsigned long long)sent, (unsigned long long)stats.bad_frames,
+           (unsigned long long)stats.gaps);
+    delete[] latency.sent_ns;
+}
+
+static void benchQueries(ColumnStore &store, uint16_t node_count)
+{
+    // Whole history of every node, one field at a time, then 60 buckets per node
+    uint64_t scanned = 0;
+    uint64_t start = benchNanos();
+    for (uint16_t node = 0; node < node_count; node++)
+    {
+        for (uint8_t field = 0; field < COLUMN_FIELDS; field++)
+        {
+            ColumnSummary summary = store.summarize(node, (ColumnField)field, 0, UINT32_MAX / 2);
+            benchKeep(summary);
+            scanned += store.records(node);
+        }
+    }
+    uint64_t summarize_ns = benchNanos() - start;
+
+    ColumnBucket buckets[60];
+    uint64_t downsampled = 0;
+    start = benchNanos();
+    for (uint16_t node = 0; node < node_count; node++)
+    {
+        uint16_t count = store.downsample(node, 0, 60000, 1000, buckets, 60);
+        benchKeep(buckets[0]);
+        downsampled += count ? store.records(node) : 0;
+    }
+    uint64_t downsample_ns = benchNanos() - start;
+
+    printf("queries: summarize %.0f M values/s, downsample %.0f M records/s over %.1f MB of columns\n",
+           scanned * 1000.0 / summarize_ns, downsampled * 1000.0 / downsample_ns, store.footprint() / 1048576.0);
+}
+
+int benchCollector(int argc, char **argv)
+{
+    uint16_t node_count = argc > 0 ? atoi(argv[0]) : BENCH_NODES;
+    if (node_count == 0 || node_count > 1000)
+    {
+        fprintf(stderr, "usage: bench-collect [nodes up to 1000]\n");
+        return 2;
+    }
+
+    ColumnStore store(node_count, BENCH_CAPACITY);
+    benchUdp(node_count, store);
+    benchQueries(store, node_count);
+
+    ColumnStore pty_store(BENCH_PTY_NODES, BENCH_CAPACITY);
+    benchPty(pty_store);
+    return 0;
+}
@@ -0,0 +1,391 @@
+// Host bench of the oversampling decimator.
+// First what the kernel costs in host cycles per sample, next to a
+// loop-per-stage integer version without the unrolling and the folded taps
+// and a plain double reference (the CIC as cascaded moving sums over the
+// whole history, the FIR as a straight convolution). Then a sweep of DC
+// levels through a converter with gaussian noise, where every method's error
+// against the true level gives its effective number of bits (ENOB) and its
+// pH resolution, next to what it costs per second of signal. Last, the
+// firmware's pipeline at the base rate and oversampled, its pH noise, rates
+// and conversions. The kernel, its gain and settling and the ENOB it gains
+// are covered by the unit tests (pio test -e native).
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "NativeCommands.h"
+#include "Bench.h"
+#include "Decimator.h"
+#include "Filters.h"
+#include "SensorPipeline.h"
+#include "Scheduler.h"
+#include "TemperatureEngine.h"
+#include "AdcCalibration.h"
+#include "Hal.h"
+#include "FakeClock.h"
+#include "MockTemperatureBus.h"
+#include "SimulatedAdcSource.h"
+#include "ReferenceAdcCurve.h"
+
+#define DECIMATE_SAMPLES 262144     // Samples of the cost runs
+#define DECIMATE_NOISE_LSB 5.0f     // Gaussian noise of the converter in counts rms, about what ADC2 shows at 11 dB
+#define DECIMATE_LEVELS 100         // DC levels of the ENOB sweep
+#define DECIMATE_OUTPUTS 16         // Settled outputs measured per level
+#define DECIMATE_BASE_HZ 250        // The firmware's base rate
+#define DECIMATE_SHIFT 4            // and its oversampling, 4 kHz
+#define DECIMATE_PH_SLOPE 5.70f     // pH per volt of the probe
+#define DECIMATE_SECONDS 60         // Pipeline run
+#define DECIMATE_PH_RAW 2048.37f    // Level on the pH pin of the pipeline run
+
+typedef PhDecimator::Cic BenchCic;
+
+static uint32_t decimate_random;
+static uint16_t decimate_input[DECIMATE_SAMPLES];
+static AdcCalibration decimate_adc1, decimate_adc2;
+
+// Standard normal sample, Box-Muller on xorshift32
+static float decimateNoise()
+{
+    float u1 = (benchRandom(decimate_random) + 1.0f) / 4294967296.0f;
+    float u2 = benchRandom(decimate_random) / 4294967296.0f;
+    return sqrtf(-2.0f * logf(u1)) * cosf(6.2831853f * u2);
+}
+
+// One conversion of a level, noise and quantisation
+static uint16_t decimateSample(float level)
+{
+    float raw = roundf(level + DECIMATE_NOISE_LSB * decimateNoise());
+    return raw < 0 ? 0 : raw > ADC_RAW_MAX ? ADC_RAW_MAX : (uint16_t)raw;
+}
+
+// Effective bits of a 12-bit converter whose error has this rms in counts
+static double enob(double rms_counts) { return 12 - log2(rms_counts * sqrt(12.0)); }
+
+// The taps the decimator uses
+static void decimateTaps(int16_t *taps)
+{
+    decimatorLowpass(taps, PhDecimator::TAPS, 0.5f / PhDecimator::FIR_RATIO);
+}
+
+// Double reference of the chain, outputs in counts
+static uint32_t referenceDecimate(const uint16_t *input, uint32_t count, double *out)
+{
+    static double stage[DECIMATE_SAMPLES];
+    static double cic[DECIMATE_SAMPLES / PhDecimator::CIC_RATIO];
+    int16_t taps[PhDecimator::TAPS];
+    decimateTaps(taps);
+
+    // Stages moving sums of CIC_RATIO samples, zeros before the start, kept at the end of every CIC_RATIO
+    for (uint32_t i = 0; i < count; i++)
+        stage[i] = input[i];
+    for (uint8_t s = 0; s < PhDecimator::STAGES; s++)
+    {
+        double sum = 0;
+        double previous[PhDecimator::CIC_RATIO] = {};
+        for (uint32_t i = 0; i < count; i++)
+        {
+            sum += stage[i] - previous[i % PhDecimator::CIC_RATIO];
+            previous[i % PhDecimator::CIC_RATIO] = stage[i];
+            stage[i] = sum;
+        }
+    }
+    uint32_t cic_count = count / PhDecimator::CIC_RATIO;
+    for (uint32_t k = 0; k < cic_count; k++)
+        cic[k] = stage[k * PhDecimator::CIC_RATIO + PhDecimator::CIC_RATIO - 1] / pow(2.0, PhDecimator::GAIN_BITS);
+
+    // Convolution with the same taps, every FIR_RATIO-th output
+    uint32_t written = 0;
+    for (uint32_t m = PhDecimator::FIR_RATIO - 1; m < cic_count; m += PhDecimator::FIR_RATIO)
+    {
+        double sum = 0;
+        for (uint8_t j = 0; j < PhDecimator::TAPS && j <= m; j++)
+            sum += taps[j] / 32768.0 * cic[m - j];
+        out[written++] = sum;
+    }
+    return written;
+}
+
+// The chain written plainly: one loop over the stages per sample, every tap multiplied on its own, modulo indexing
+struct PlainDecimator
+{
+    uint32_t integrator[PhDecimator::STAGES];
+    uint32_t comb[PhDecimator::STAGES];
+    int32_t history[PhDecimator::TAPS];
+    int16_t taps[PhDecimator::TAPS];
+    uint32_t phase, fir_phase, head;
+    uint32_t latest;
+
+    PlainDecimator() : integrator(), comb(), history(), phase(0), fir_phase(0), head(0), latest(0) { decimateTaps(taps); }
+
+    bool push(uint16_t sample)
+    {
+        integrator[0] += sample;
+        for (uint8_t s = 1; s < PhDecimator::STAGES; s++)
+            integrator[s] += integrator[s - 1];
+        if (++phase < PhDecimator::CIC_RATIO)
+            return false;
+        phase = 0;
+        uint32_t value = integrator[PhDecimator::STAGES - 1];
+        for (uint8_t s = 0; s < PhDecimator::STAGES; s++)
+        {
+            uint32_t delayed = comb[s];
+            comb[s] = value;
+            value -= delayed;
+        }
+        history[head] = (int32_t)value;
+        head = (head + 1) % PhDecimator::TAPS;
+        if (++fir_phase < PhDecimator::FIR_RATIO)
+            return false;
+        fir_phase = 0;
+        int64_t sum = 0;
+        for (uint8_t j = 0; j < PhDecimator::TAPS; j++)
+            sum += (int64_t)taps[j] * history[(head + PhDecimator::TAPS - 1 - j) % PhDecimator::TAPS];
+        const uint8_t shift = PhDecimator::GAIN_BITS - PhDecimator::FRACTION_BITS + 15;
+        int64_t rounded = (sum + ((int64_t)1 << (shift - 1))) >> shift;
+        latest = rounded < 0 ? 0 : (uint32_t)rounded;
+        return true;
+    }
+};
+
+// A noisy slow sine over most of the range, the input of the cost runs
+static void fillInput()
+{
+    decimate_random = 7;
+    for (uint32_t i = 0; i < DECIMATE_SAMPLES; i++)
+        decimate_input[i] = decimateSample(2000 + 1500 * sinf(i * 0.0005f));
+}
+
+// What a method costs per input sample, the input is ready in decimate_input
+struct DecimateCost
+{
+    double trimmed, decimator, cic, plain, reference;
+};
+
+static DecimateCost measureCosts()
+{
+    DecimateCost cost;
+    uint64_t start;
+
+    // The firmware's pH filter today: a block into the window, then the trimmed sum
+    ChannelFilter<PIPELINE_PH_FILTER> trimmed;
+    int64_t trimmed_keep = 0;
+    start = benchCycles();
+    for (uint32_t i = 0; i < DECIMATE_SAMPLES; i += ADC_BLOCK_SIZE)
+    {
+        trimmed.pushBlock(&decimate_input[i], ADC_BLOCK_SIZE);
+        trimmed_keep += trimmed.trimmedSum() / trimmed.keptCount();
+    }
+    cost.trimmed = (double)(benchCycles() - start) / DECIMATE_SAMPLES;
+    benchKeep(trimmed_keep);
+
+    PhDecimator decimator;
+    uint32_t keep = 0;
+    start = benchCycles();
+    for (uint32_t i = 0; i < DECIMATE_SAMPLES; i += ADC_BLOCK_SIZE)
+    {
+        if (decimator.pushBlock(&decimate_input[i], ADC_BLOCK_SIZE))
+            keep += decimator.value();
+    }
+    cost.decimator = (double)(benchCycles() - start) / DECIMATE_SAMPLES;
+    benchKeep(keep);
+
+    BenchCic cic;
+    int32_t cic_out[ADC_BLOCK_SIZE];
+    start = benchCycles();
+    for (uint32_t i = 0; i < DECIMATE_SAMPLES; i += ADC_BLOCK_SIZE)
+    {
+        if (cic.push(&decimate_input[i], ADC_BLOCK_SIZE, cic_out))
+            keep += cic_out[0];
+    }
+    cost.cic = (double)(benchCycles() - start) / DECIMATE_SAMPLES;
+    benchKeep(keep);
+
+    PlainDecimator plain;
+    start = benchCycles();
+    for (uint32_t i = 0; i < DECIMATE_SAMPLES; i++)
+    {
+        if (plain.push(decimate_input[i]))
+            keep += plain.latest;
+    }
+    cost.plain = (double)(benchCycles() - start) / DECIMATE_SAMPLES;
+    benchKeep(keep);
+
+    static double reference[DECIMATE_SAMPLES / PhDecimator::RATIO];
+    start = benchCycles();
+    referenceDecimate(decimate_input, DECIMATE_SAMPLES, reference);
+    cost.reference = (double)(benchCycles() - start) / DECIMATE_SAMPLES;
+    benchKeep(reference[0]);
+    return cost;
+}
+
+// Error of one method over the sweep
+struct DecimateError
+{
+    double counts; // rms, counts
+    double ph;     // rms, pH through the ADC2 table
+    void add(double count_error, double ph_error)
+    {
+        counts += count_error * count_error;
+        ph += ph_error * ph_error;
+    }
+};
+
+// DC levels over most of the range, each through a single conversion, the trimmed mean of a block at the
+// base rate with its rounded conversion, and the decimator at the oversampled rate with the interpolated one
+static void sweepLevels(const DecimateCost &cost)
+{
+    DecimateError single = {}, trimmed = {}, decimated = {};
+    uint32_t measured = 0;
+    decimate_random = 11;
+    for (uint16_t level_index = 0; level_index < DECIMATE_LEVELS; level_index++)
+    {
+        float level = 200 + (ADC_RAW_MAX - 400) * (level_index + (benchRandom(decimate_random) & 0xFFFF) / 65536.0f) / DECIMATE_LEVELS;
+        float truth_volts = decimate_adc2.volts((uint32_t)lroundf(level * 65536), 16);
+
+        PhDecimator decimator;
+        ChannelFilter<PIPELINE_PH_FILTER> filter;
+        uint16_t block[ADC_BLOCK_SIZE];
+        uint32_t taken = 0;
+        while (taken < DECIMATE_OUTPUTS)
+        {
+            for (uint16_t i = 0; i < ADC_BLOCK_SIZE; i++)
+                block[i] = decimateSample(level);
+            if (!decimator.pushBlock(block, ADC_BLOCK_SIZE) || !decimator.settled())
+                continue;
+            taken++;
+            decimated.add(decimator.value() / (double)(1 << PhDecimator::FRACTION_BITS) - level,
+                          DECIMATE_PH_SLOPE * (decimate_adc2.volts(decimator.value(), PhDecimator::FRACTION_BITS) - truth_volts));
+
+            // One block of the base rate for each output, and its first sample on its own
+            for (uint16_t i = 0; i < ADC_BLOCK_SIZE; i++)
+                block[i] = decimateSample(level);
+            filter.pushBlock(block, ADC_BLOCK_SIZE);
+            uint16_t kept = filter.keptCount();
+            uint16_t rounded = (filter.trimmedSum() + kept / 2) / kept;
+            trimmed.add(rounded - level, DECIMATE_PH_SLOPE * (decimate_adc2.volts(rounded) - truth_volts));
+            single.add(block[0] - level, DECIMATE_PH_SLOPE * (decimate_adc2.volts(block[0]) - truth_volts));
+            measured++;
+        }
+    }
+
+    // Cycles per second of signal: the base rate for one sample and the trimmed mean, the oversampled rate for the
+    // decimator, where the pipeline also keeps the trimmed mean going at the base rate for the health checks
+    const uint32_t fast_hz = DECIMATE_BASE_HZ << DECIMATE_SHIFT;
+    struct Row
+    {
+        const char *name;
+        const DecimateError &error;
+        uint32_t rate_hz;
+        double cycles;
+        double pipeline_cycles; // a second
+    } rows[] = {
+        {"single sample", single, DECIMATE_BASE_HZ, 0, 0},
+        {"trimmed mean", trimmed, DECIMATE_BASE_HZ, cost.trimmed, cost.trimmed * DECIMATE_BASE_HZ},
+        {"cic+fir", decimated, fast_hz, cost.decimator, cost.decimator * fast_hz + cost.trimmed * DECIMATE_BASE_HZ},
+    };
+    printf("sweep: %u levels, %u values each, noise %.1f counts rms\n", (unsigned)DECIMATE_LEVELS, (unsigned)DECIMATE_OUTPUTS,
+           DECIMATE_NOISE_LSB);
+    printf("  %-14s %7s %9s %6s %7s %12s %14s\n", "method", "rate", "rms cnt", "enob", "rms pH", "cycles/smp", "pipeline cyc/s");
+    double base_enob = 0, gained_enob = 0;
+    for (const Row &row : rows)
+    {
+        double rms = sqrt(row.error.counts / measured);
+        printf("  %-14s %5uHz %9.3f %6.2f %7.4f %12.2f %14.0f\n", row.name, (unsigned)row.rate_hz, rms, enob(rms),
+               sqrt(row.error.ph / measured), row.cycles, row.pipeline_cycles);
+        if (&row.error == &trimmed)
+            base_enob = enob(rms);
+        if (&row.error == &decimated)
+            gained_enob = enob(rms) - base_enob;
+    }
+    printf("  %.2f bits over the trimmed mean, for %.0f more host cycles a second\n", gained_enob,
+           cost.decimator * fast_hz);
+    printf("cost per sample: cic %.2f, cic+fir %.2f, plain loops %.2f, double reference %.2f host cycles\n", cost.cic,
+           cost.decimator, cost.plain, cost.reference);
+}
+
+// What the pipeline reported over a run
+struct DecimateRun
+{
+    uint32_t ph_count, tds_count;
+    double ph_sum, ph_squares;
+    uint64_t conversions;
+};
+
+static DecimateRun decimate_run;
+static uint32_t decimate_settle_us;
+
+static void decimateSink(ReadingChannel channel, uint8_t index, float value, SensorQuality quality)
+{
+    if (index != 0 || (int32_t)(fake_now_us - decimate_settle_us) < 0)
+        return;
+    if (channel == READING_PH)
+    {
+        decimate_run.ph_count++;
+        decimate_run.ph_sum += value;
+        decimate_run.ph_squares += (double)value * value;
+    }
+    else if (channel == READING_TDS)
+        decimate_run.tds_count++;
+}
+
+// pH on GPIO25 at a level between two counts, TDS on GPIO34 steady
+static uint16_t decimateSignal(uint8_t pin, uint32_t time_us)
+{
+    return decimateSample(pin == 25 ? DECIMATE_PH_RAW : 1200);
+}
+
+static DecimateRun runPipeline(uint8_t shift)
+{
+    static const uint8_t pins[] = {34, 25};
+    decimate_random = 13;
+    memset(&decimate_run, 0, sizeof(decimate_run));
+
+    SimulatedAdcSource adc(decimateSignal);
+    MockTemperatureBus bus;
+    bus.addProbe(21.5f);
+    TemperatureEngine temperatures(bus, halMicros);
+    Scheduler scheduler(halMicros);
+    SensorPipeline pipeline(adc, temperatures, decimate_adc1, decimate_adc2);
+    adc.begin(pins, 2, DECIMATE_BASE_HZ << shift);
+    temperatures.begin(halMicros());
+    pipeline.setOversampling(shift);
+    pipeline.begin(scheduler, decimateSink, 1000000UL * ADC_BLOCK_SIZE / (DECIMATE_BASE_HZ << shift), 10000000UL);
+
+    decimate_settle_us = fake_now_us + 2000000UL;
+    uint32_t end_us = decimate_settle_us + DECIMATE_SECONDS * 1000000UL;
+    while ((int32_t)(end_us - fake_now_us) > 0)
+        fakeSpend(scheduler.runOnce());
+    decimate_run.conversions = pipeline.samplingStats().adc_conversions;
+    return decimate_run;
+}
+
+// The firmware's pipeline at the base rate and oversampled on one noisy pH level
+static void comparePipeline()
+{
+    const DecimateRun base = runPipeline(0);
+    const DecimateRun fast = runPipeline(DECIMATE_SHIFT);
+    printf("pipeline: pH at %.2f counts with %.1f counts of noise, %u s\n", DECIMATE_PH_RAW, DECIMATE_NOISE_LSB, DECIMATE_SECONDS);
+    double stddev[2];
+    const DecimateRun *runs[] = {&base, &fast};
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        const DecimateRun &run = *runs[i];
+        double mean = run.ph_sum / (run.ph_count ? run.ph_count : 1);
+        stddev[i] = sqrt(fmax(run.ph_squares / (run.ph_count ? run.ph_count : 1) - mean * mean, 0));
+        printf("  %-12s %5uHz  pH %.4f sd %.5f, %.2f pH/s %.2f TDS/s, %llu conversions\n", i ? "oversampled" : "base",
+               (unsigned)(DECIMATE_BASE_HZ << (i ? DECIMATE_SHIFT : 0)), mean, stddev[i], (double)run.ph_count / DECIMATE_SECONDS,
+               (double)run.tds_count / DECIMATE_SECONDS, (unsigned long long)run.conversions);
+    }
+}
+
+int benchDecimate(int argc, char **argv)
+{
+    decimate_adc1.build(referenceAdcMillivolts, &REFERENCE_ADC1);
+    decimate_adc2.build(referenceAdcMillivolts, &REFERENCE_ADC2);
+    fake_now_us = 0;
+
+    fillInput();
+    DecimateCost cost = measureCosts();
+    sweepLevels(cost);
+    comparePipeline();
+    return 0;
+}
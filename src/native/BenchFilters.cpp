@@ -0,0 +1,132 @@
+// Host micro-benchmark: streaming filters against the sort based code they replaced.
+// Every filter gets the same pseudo random ADC stream, the results are checked to
+// agree, and the cost is reported in host cycles per new sample.
+#include <stdio.h>
+#include "NativeCommands.h"
+#include "Bench.h"
+#include "Filters.h"
+
+// Samples pushed through every filter
+#define BENCH_FILTER_SAMPLES 200000
+
+// getMedianNum() from backup/mainCombined.cpp: copy the window and bubble sort it
+int referenceMedian(const int *window, int length)
+{
+    int sorted[length];
+    for (int i = 0; i < length; i++)
+        sorted[i] = window[i];
+    for (int j = 0; j < length - 1; j++)
+    {
+        for (int i = 0; i < length - j - 1; i++)
+        {
+            if (sorted[i] > sorted[i + 1])
+            {
+                int swap = sorted[i];
+                sorted[i] = sorted[i + 1];
+                sorted[i + 1] = swap;
+            }
+        }
+    }
+    if (length & 1)
+        return sorted[(length - 1) / 2];
+    return (sorted[length / 2] + sorted[length / 2 - 1]) / 2;
+}
+
+// The old myPhFuction(): exchange sort the window and sum everything but the trim at each end
+long referenceTrimmedSum(const int *window, int length, int trim)
+{
+    int sorted[length];
+    for (int i = 0; i < length; i++)
+        sorted[i] = window[i];
+    for (int i = 0; i < length - 1; i++)
+    {
+        for (int j = i + 1; j < length; j++)
+        {
+            if (sorted[i] > sorted[j])
+            {
+                int swap = sorted[i];
+                sorted[i] = sorted[j];
+                sorted[j] = swap;
+            }
+        }
+    }
+    long sum = 0;
+    for (int i = trim; i < length - trim; i++)
+        sum += sorted[i];
+    return sum;
+}
+
+template <uint16_t N>
+void benchWindow()
+{
+    const uint16_t trim = N / 5; // Same 20 % trim as the pH filter
+    static int window[N];
+    uint32_t random;
+    uint64_t start;
+    long long reference_median_sum = 0, reference_trimmed_sum = 0, median_sum = 0, trimmed_sum = 0;
+
+    // Reference median, one full sort per new sample once the window is full
+    random = 1;
+    start = benchCycles();
+    for (int i = 0; i < BENCH_FILTER_SAMPLES; i++)
+    {
+        window[i % N] = benchRandom(random) & 4095;
+        if (i >= N - 1)
+            reference_median_sum += referenceMedian(window, N);
+    }
+    double reference_median_cycles = (double)(benchCycles() - start) / BENCH_FILTER_SAMPLES;
+
+    // Reference trimmed mean
+    random = 1;
+    start = benchCycles();
+    for (int i = 0; i < BENCH_FILTER_SAMPLES; i++)
+    {
+        window[i % N] = benchRandom(random) & 4095;
+        if (i >= N - 1)
+            reference_trimmed_sum += referenceTrimmedSum(window, N, trim);
+    }
+    double reference_trimmed_cycles = (double)(benchCycles() - start) / BENCH_FILTER_SAMPLES;
+
+    // Streaming median
+    static RollingMedian<int, N> median;
+    median.reset();
+    random = 1;
+    start = benchCycles();
+    for (int i = 0; i < BENCH_FILTER_SAMPLES; i++)
+    {
+        median.push(benchRandom(random) & 4095);
+        if (median.full())
+            median_sum += median.value();
+    }
+    double median_cycles = (double)(benchCycles() - start) / BENCH_FILTER_SAMPLES;
+
+    // Streaming trimmed mean
+    static RollingTrimmedMean<int, N, N / 5> trimmed;
+    trimmed.reset();
+    random = 1;
+    start = benchCycles();
+    for (int i = 0; i < BENCH_FILTER_SAMPLES; i++)
+    {
+        trimmed.push(benchRandom(random) & 4095);
+        if (trimmed.full())
+            trimmed_sum += trimmed.trimmedSum();
+    }
+    double trimmed_cycles = (double)(benchCycles() - start) / BENCH_FILTER_SAMPLES;
+
+    benchKeep(reference_median_sum);
+    benchKeep(reference_trimmed_sum);
+    printf("window %3u  median: sort %8.1f  stream %6.1f  (x%5.1f) %s   trimmed: sort %8.1f  stream %6.1f  (x%5.1f) %s\n",
+           N, reference_median_cycles, median_cycles, reference_median_cycles / median_cycles,
+           reference_median_sum == median_sum ? "match" : "MISMATCH",
+           reference_trimmed_cycles, trimmed_cycles, reference_trimmed_cycles / trimmed_cycles,
+           reference_trimmed_sum == trimmed_sum ? "match" : "MISMATCH");
+}
+
+int benchFilters(int argc, char **argv)
+{
+    printf("cycles per update, %d samples\n", BENCH_FILTER_SAMPLES);
+    benchWindow<10>();
+    benchWindow<30>();
+    benchWindow<101>();
+    return 0;
+}
@@ -0,0 +1,86 @@
+// Host benchmark of the flash log against the file-backed flash emulator.
+// Measures append and scan throughput and the bytes that reach the flash.
+// Power cuts and wear are covered by the unit tests (pio test -e native).
+#include <stdio.h>
+#include <stdlib.h>
+#include "NativeCommands.h"
+#include "FlashLog.h"
+#include "FileFlashStore.h"
+#include "Bench.h"
+
+#define LOG_SEGMENT_COUNT 16        // The firmware geometry, 1 MB of history
+#define LOG_SEGMENT_SIZE 65536
+#define THROUGHPUT_RECORDS 500000   // About six days of one record per second
+
+// Record number i, the sequence carries the full number across the 16-bit wrap in the status field
+static TelemetryRecord benchLogRecord(uint32_t i)
+{
+    TelemetryRecord record;
+    record.sequence = i;
+    record.timestamp_ms = 0;
+    record.tds_ppm = 800.0f + (i % 97);
+    record.ph = 6.0f + (i % 13) * 0.01f;
+    record.temperature_c = 21.0f + (i % 7) * 0.1f;
+    record.status = i >> 16;
+    return record;
+}
+
+// Counts the records of a scan
+static bool benchLogVisit(const TelemetryRecord &record, void *context)
+{
+    (*static_cast<uint32_t *>(context))++;
+    return true;
+}
+
+static uint32_t benchLogScan(FlashLog &log, uint32_t from_ms, uint32_t to_ms)
+{
+    uint32_t count = 0;
+    log.scan(from_ms, to_ms, benchLogVisit, &count);
+    return count;
+}
+
+static void benchLogThroughput(FileFlashStore &store)
+{
+    store.wipe();
+    static FlashLog log(store, LOG_SEGMENT_COUNT, LOG_SEGMENT_SIZE);
+    log.begin(0);
+
+    uint64_t start = benchNanos();
+    for (uint32_t i = 0; i < THROUGHPUT_RECORDS; i++)
+        log.append(benchLogRecord(i), i * 1000);
+    uint64_t append_ns = benchNanos() - start;
+
+    start = benchNanos();
+    uint32_t all = benchLogScan(log, 0, UINT32_MAX / 2);
+    uint64_t scan_ns = benchNanos() - start;
+
+    // The last minute, the index should skip straight to the newest chunks
+    uint32_t end_ms = log.logTime((THROUGHPUT_RECORDS - 1) * 1000);
+    start = benchNanos();
+    uint32_t minute = benchLogScan(log, end_ms - 59999, end_ms);
+    uint64_t minute_ns = benchNanos() - start;
+
+    uint32_t kept = log.storedRecords() + log.bufferedRecords();
+    printf("append: %u records in %.1f ms, %.0f ns per record, %u chunks\n", THROUGHPUT_RECORDS, append_ns / 1e6,
+           (double)append_ns / THROUGHPUT_RECORDS, (unsigned)log.chunksWritten());
+    printf("flash: %u bytes written, %.2f bytes per %u byte record, %u records kept\n", (unsigned)log.bytesWritten(),
+           (double)log.bytesWritten() / THROUGHPUT_RECORDS, SERIES_RECORD_SIZE, (unsigned)kept);
+    printf("scan: all %u records in %.2f ms, last minute %u records in %.1f us\n", (unsigned)all, scan_ns / 1e6,
+           (unsigned)minute, minute_ns / 1e3);
+}
+
+int benchFlashLog(int argc, char **argv)
+{
+    char directory[] = "/tmp/flashlog.XXXXXX";
+    if (!mkdtemp(directory))
+    {
+        perror("mkdtemp");
+        return 2;
+    }
+    FileFlashStore store(directory);
+
+    benchLogThroughput(store);
+    store.wipe();
+    remove(directory);
+    return 0;
+}
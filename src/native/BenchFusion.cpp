@@ -0,0 +1,312 @@
+// Host bench of the Kalman sensor fusion.
+// Runs the firmware's pipeline with a SensorFusion attached over two built-in
+// hours of a reservoir: a heater cycling the temperature around a slow
+// warm-up, uptake moving pH and TDS, and a pH down and nutrient dose every
+// forty minutes that mix in over a few minutes. The TDS probe voltage rises
+// with the temperature, the temperature probe reads in 1/16 C steps. Once a
+// second the filters' latest values and the fused estimates are compared
+// with the truth, at the base ADC rate and with a quarter of the raw samples,
+// with how often the fused values were inside their 2 sigma bounds. Last, the
+// cost of one fusion update against one block through the filters, in host
+// cycles. The error, the bounds and the outlier gating are covered by the
+// unit tests (pio test -e native).
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "NativeCommands.h"
+#include "Scheduler.h"
+#include "TemperatureEngine.h"
+#include "SensorPipeline.h"
+#include "SensorFusion.h"
+#include "Calibration.h"
+#include "SensorMath.h"
+#include "Hal.h"
+#include "FakeClock.h"
+#include "MockTemperatureBus.h"
+#include "SimulatedAdcSource.h"
+#include "AdcCalibration.h"
+#include "ReferenceAdcCurve.h"
+#include "Bench.h"
+
+#define FUSION_PIN_PH 25
+#define FUSION_PIN_TDS 34
+#define FUSION_ADC_RATE_HZ 250       // The firmware's base rate
+#define FUSION_CUT_SHIFT 2           // The reduced run samples at a quarter of it
+#define FUSION_HOURS 2               // Length of the built-in trace
+#define FUSION_DOSE_PERIOD_S 2400    // A dose every forty minutes, the first after twenty
+#define FUSION_MIX_TAU_S 180.0f      // Mixing time constant of a dose
+#define FUSION_HEATER_PERIOD_S 1200  // The heater cycles every twenty minutes
+#define FUSION_WARMUP_S 60           // Not compared, the filters fill up and the fusion settles
+#define FUSION_PH_NOISE 4.0f         // Raw counts, like the simulated sensors
+#define FUSION_TDS_NOISE 6.0f
+#define FUSION_TEMP_NOISE 0.02f      // C, before the 12-bit step
+#define FUSION_COST_UPDATES 100000   // Updates of the cost runs
+
+// Truth of the reservoir at a time
+struct FusionTruth
+{
+    float ph;
+    float tds_ppm;
+    float celsius;
+};
+
+// Error of one channel against the truth, and how often the truth was within the bounds
+struct FusionError
+{
+    double sum_squares;
+    uint32_t count;
+    uint32_t covered;
+
+    void add(float error, float sigma)
+    {
+        sum_squares += (double)error * error;
+        count++;
+        if (fabsf(error) <= 2 * sigma)
+            covered++;
+    }
+    float rms() const { return count ? sqrt(sum_squares / count) : 0; }
+    float coverage() const { return count ? (float)covered / count : 0; }
+};
+
+// What one run saw of the filters and of the fusion
+struct FusionRun
+{
+    FusionError filter_ph, filter_tds, filter_temp;
+    FusionError fused_ph, fused_tds, fused_temp;
+    uint64_t adc_conversions;
+    uint32_t updates;
+    uint32_t rejects;
+};
+
+static AdcCalibration fusion_tds_calibration, fusion_ph_calibration;
+static CalibrationCurves fusion_curves;
+static uint64_t fusion_now_us;                // Fake clock without the wrap, a run lasts hours
+static uint32_t fusion_random;
+static float fusion_latest[READING_EC + 1];   // Last value the pipeline reported of every channel
+
+// Standard normal sample, Box-Muller on xorshift32
+static float fusionNoise()
+{
+    float u1 = (benchRandom(fusion_random) + 1.0f) / 4294967296.0f;
+    float u2 = benchRandom(fusion_random) / 4294967296.0f;
+    return sqrtf(-2.0f * logf(u1)) * cosf(6.2831853f * u2);
+}
+
+// The reservoir, closed form: uptake ramps, the doses mixed in so far and the heater on a warm-up
+static FusionTruth truthAt(double seconds)
+{
+    float hours = seconds / 3600.0;
+    FusionTruth truth = {6.0f + 0.05f * hours, 1100.0f - 20.0f * hours,
+                         22.0f + 0.5f * hours + 0.4f * sinf(6.2831853f * seconds / FUSION_HEATER_PERIOD_S)};
+    for (double dose = FUSION_DOSE_PERIOD_S / 2; dose < seconds; dose += FUSION_DOSE_PERIOD_S)
+    {
+        float mixed = 1.0f - expf(-(seconds - dose) / FUSION_MIX_TAU_S);
+        truth.ph -= 0.1f * mixed;
+        truth.tds_ppm += 40.0f * mixed;
+    }
+    return truth;
+}
+
+// Fractional raw count that reads as these millivolts, the table rises with the count
+static float rawFor(const AdcCalibration &calibration, float millivolts)
+{
+    uint16_t low = 0, high = ADC_RAW_MAX;
+    if (millivolts <= calibration.millivolts(low))
+        return low;
+    if (millivolts >= calibration.millivolts(high))
+        return high;
+    while (high - low > 1)
+    {
+        uint16_t middle = (low + high) / 2;
+        if (calibration.millivolts(middle) <= millivolts)
+            low = middle;
+        else
+            high = middle;
+    }
+    float span = calibration.millivolts(high) - calibration.millivolts(low);
+    return low + (span > 0 ? (millivolts - calibration.millivolts(low)) / span : 0);
+}
+
+// Probe voltage that gives this value, for a curve that only rises or only falls
+static float voltsFor(float target, float (*curve)(float volts))
+{
+    float low = 0, high = 3.3f;
+    bool rising = curve(high) > curve(low);
+    for (uint8_t i = 0; i < 40; i++)
+    {
+        float middle = (low + high) / 2;
+        if ((curve(middle) < target) == rising)
+            low = middle;
+        else
+            high = middle;
+    }
+    return (low + high) / 2;
+}
+
+static float curvePh(float volts) { return SensorMath::toFloat(fusion_curves.ph(SensorMath::value(volts))); }
+static float curveTds(float volts) { return SensorMath::toFloat(fusion_curves.tdsPpm(SensorMath::value(volts))); }
+
+// Raw counts of the probes, what the pipeline turns back into the truth
+static uint16_t fusionSignal(uint8_t pin, uint32_t time_us)
+{
+    // The sample may be a little older than now
+    uint64_t at_us = fusion_now_us - (uint32_t)(fake_now_us - time_us);
+    FusionTruth truth = truthAt(at_us / 1e6);
+    float raw;
+    if (pin == FUSION_PIN_PH)
+        raw = rawFor(fusion_ph_calibration, voltsFor(truth.ph, curvePh) * 1000.0f) + FUSION_PH_NOISE * fusionNoise();
+    else
+    {
+        // The probe voltage rises with the temperature, the pipeline compensates it
+        float volts = voltsFor(truth.tds_ppm, curveTds) * (1.0f + (truth.celsius - 25.0f) / 50.0f);
+        raw = rawFor(fusion_tds_calibration, volts * 1000.0f) + FUSION_TDS_NOISE * fusionNoise();
+    }
+    if (raw < 0)
+        raw = 0;
+    return raw > ADC_RAW_MAX ? ADC_RAW_MAX : (uint16_t)lroundf(raw);
+}
+
+static void fusionSink(ReadingChannel channel, uint8_t index, float value, SensorQuality quality)
+{
+    if (index == 0)
+        fusion_latest[channel] = value;
+}
+
+// One run over the trace at the base rate >> shift
+static void run(uint8_t shift, FusionRun &result)
+{
+    fake_now_us = 0;
+    fusion_now_us = 0;
+    fusion_random = 2463534242UL;
+    memset(fusion_latest, 0, sizeof(fusion_latest));
+
+    MockTemperatureBus bus;
+    bus.addProbe(truthAt(0).celsius);
+    TemperatureEngine temperatures(bus, halMicros);
+    temperatures.begin(halMicros());
+    SimulatedAdcSource adc(fusionSignal);
+    const uint8_t adc_pins[] = {FUSION_PIN_TDS, FUSION_PIN_PH};
+    uint32_t rate_hz = FUSION_ADC_RATE_HZ >> shift;
+    adc.begin(adc_pins, 2, rate_hz);
+
+    Scheduler scheduler(halMicros);
+    SensorFusion fusion;
+    SensorPipeline pipeline(adc, temperatures, fusion_tds_calibration, fusion_ph_calibration);
+    pipeline.setFusion(&fusion);
+    pipeline.begin(scheduler, fusionSink, 1000000UL * ADC_BLOCK_SIZE / rate_hz, 10000000UL);
+
+    uint64_t end_s = FUSION_HOURS * 3600ULL;
+    uint64_t next_check_s = FUSION_WARMUP_S;
+    while (fusion_now_us / 1000000 < end_s)
+    {
+        // A DS18B20 at 12 bits reads in 1/16 C steps
+        float celsius = truthAt(fusion_now_us / 1e6).celsius + FUSION_TEMP_NOISE * fusionNoise();
+        bus.setTemperature(0, roundf(celsius * 16) / 16);
+
+        uint32_t before_us = fake_now_us;
+        fakeSpend(scheduler.runOnce());
+        fusion_now_us += fake_now_us - before_us;
+
+        // Once a second, both against the truth. The filters have no bound, they count as covered when exact
+        while (next_check_s <= fusion_now_us / 1000000 && next_check_s <= end_s)
+        {
+            FusionTruth truth = truthAt(next_check_s);
+            FusedReadings fused;
+            pipeline.fused(fused);
+            result.filter_ph.add(fusion_latest[READING_PH] - truth.ph, 0);
+            result.filter_tds.add(fusion_latest[READING_TDS] - truth.tds_ppm, 0);
+            result.filter_temp.add(fusion_latest[READING_TEMPERATURE] - truth.celsius, 0);
+            result.fused_ph.add(fused.ph.value - truth.ph, fused.ph.sigma);
+            result.fused_tds.add(fused.tds_ppm.value - truth.tds_ppm, fused.tds_ppm.sigma);
+            result.fused_temp.add(fused.temperature.value - truth.celsius, fused.temperature.sigma);
+            next_check_s++;
+        }
+    }
+    result.adc_conversions = pipeline.samplingStats().adc_conversions;
+    result.updates = fusion.updates();
+    result.rejects = fusion.rejects();
+}
+
+static void printRow(const char *name, uint32_t rate_hz, const FusionError &ph, const FusionError &tds, const FusionError &temp,
+                     bool bounds, uint64_t conversions)
+{
+    printf("%-7s %3u Hz  pH %.4f  tds %5.2f ppm  temp %.4f C", name, (unsigned)rate_hz, ph.rms(), tds.rms(), temp.rms());
+    if (bounds)
+        printf("  | 2 sigma %4.1f%% %4.1f%% %4.1f%%", 100.0f * ph.coverage(), 100.0f * tds.coverage(), 100.0f * temp.coverage());
+    else
+        printf("  |                       ");
+    printf("  | %llu conversions\n", (unsigned long long)conversions);
+}
+
+// Cycles of one block through each filter and of one fusion update, on noise around a slowly moving level
+static void measureCost()
+{
+    uint16_t samples[ADC_BLOCK_SIZE];
+    ChannelFilter<PIPELINE_PH_FILTER> ph_filter;
+    ChannelFilter<PIPELINE_TDS_FILTER> tds_filter;
+    fusion_random = 88172645UL;
+
+    uint64_t ph_cycles = 0, tds_cycles = 0;
+    for (uint32_t n = 0; n < FUSION_COST_UPDATES; n++)
+    {
+        for (uint16_t i = 0; i < ADC_BLOCK_SIZE; i++)
+            samples[i] = 2048 + (uint16_t)(n / 1000) + benchRandom(fusion_random) % 9;
+        uint64_t start = benchCycles();
+        ph_filter.pushBlock(samples, ADC_BLOCK_SIZE);
+        benchKeep(ph_filter.trimmedSum());
+        uint64_t middle = benchCycles();
+        tds_filter.pushBlock(samples, ADC_BLOCK_SIZE);
+        benchKeep(tds_filter.value());
+        tds_cycles += benchCycles() - middle;
+        ph_cycles += middle - start;
+    }
+
+    // A measurement of each kind in turn, 128 ms apart like the blocks at the base rate
+    SensorFusion fusion;
+    uint64_t fusion_cycles = 0;
+    uint32_t time_us = 0;
+    for (uint32_t n = 0; n < FUSION_COST_UPDATES; n++)
+    {
+        float noise = fusionNoise();
+        time_us += 128000;
+        uint64_t start = benchCycles();
+        switch (n % 3)
+        {
+        case 0:
+            fusion.temperature(22.0f + 0.03f * noise, time_us);
+            break;
+        case 1:
+            fusion.ph(6.0f + 0.004f * noise, time_us);
+            break;
+        default:
+            fusion.tdsVolts(1.2f + 0.001f * noise, time_us);
+            break;
+        }
+        fusion_cycles += benchCycles() - start;
+    }
+    benchKeep(fusion);
+    printf("cost    trimmed mean %.0f, median %.0f cycles per block | fusion %.0f cycles per update, %u bytes of state\n",
+           (double)ph_cycles / FUSION_COST_UPDATES, (double)tds_cycles / FUSION_COST_UPDATES,
+           (double)fusion_cycles / FUSION_COST_UPDATES, (unsigned)sizeof(SensorFusion));
+}
+
+int benchFusion(int argc, char **argv)
+{
+    fusion_tds_calibration.build(referenceAdcMillivolts, &REFERENCE_ADC1);
+    fusion_ph_calibration.build(referenceAdcMillivolts, &REFERENCE_ADC2);
+    printf("built-in trace, %u hours, a dose every %u minutes, heater period %u minutes\n", (unsigned)FUSION_HOURS,
+           (unsigned)(FUSION_DOSE_PERIOD_S / 60), (unsigned)(FUSION_HEATER_PERIOD_S / 60));
+
+    FusionRun full = {}, cut = {};
+    run(0, full);
+    run(FUSION_CUT_SHIFT, cut);
+    uint32_t cut_hz = FUSION_ADC_RATE_HZ >> FUSION_CUT_SHIFT;
+    printRow("filters", FUSION_ADC_RATE_HZ, full.filter_ph, full.filter_tds, full.filter_temp, false, full.adc_conversions);
+    printRow("fusion", FUSION_ADC_RATE_HZ, full.fused_ph, full.fused_tds, full.fused_temp, true, full.adc_conversions);
+    printRow("filters", cut_hz, cut.filter_ph, cut.filter_tds, cut.filter_temp, false, cut.adc_conversions);
+    printRow("fusion", cut_hz, cut.fused_ph, cut.fused_tds, cut.fused_temp, true, cut.adc_conversions);
+    printf("        %u and %u fusion updates, %u and %u rejected as outliers\n", (unsigned)full.updates, (unsigned)cut.updates,
+           (unsigned)full.rejects, (unsigned)cut.rejects);
+    measureCost();
+    return 0;
+}
@@ -0,0 +1,94 @@
+// Host benchmark for the sensor math policies.
+// Sweeps every calibrated millivolt value the ADC can produce and a range of
+// water temperatures through the double code the firmware used to run, the
+// float policy and the fixed-point policy, then reports the worst error of
+// each policy against double and the host cycles per conversion.
+#include <stdio.h>
+#include <math.h>
+#include "NativeCommands.h"
+#include "Bench.h"
+#include "SensorMath.h"
+
+// The sweep: 0 to 3300 mV, 5 to 35 C in half degrees
+#define BENCH_MATH_MV_MAX 3300
+#define BENCH_MATH_TEMP_STEPS 61
+
+// The original double precision TDS chain
+double referenceTds(uint16_t millivolts, double celsius)
+{
+    double voltage = millivolts / 1000.0;
+    double compensation = 1.0 + 0.02 * (celsius - 25.0);
+    double compensated = voltage / compensation;
+    return (133.42 * compensated * compensated * compensated - 255.86 * compensated * compensated + 857.39 * compensated) * 0.5;
+}
+
+// The original pH line
+double referencePh(uint16_t millivolts, double offset)
+{
+    return -5.70 * (millivolts / 1000.0) + offset;
+}
+
+template <typename Policy>
+void benchPolicy(const char *name)
+{
+    typedef typename Policy::value_type Num;
+    const float ph_offset = 21.34f;
+    double tds_error = 0, ph_error = 0;
+
+    // Accuracy against double over the whole sweep
+    for (int t = 0; t < BENCH_MATH_TEMP_STEPS; t++)
+    {
+        float celsius = 5.0f + t * 0.5f;
+        Num temperature = Policy::value(celsius);
+        for (uint16_t mv = 0; mv <= BENCH_MATH_MV_MAX; mv++)
+        {
+            float tds = Policy::toFloat(Policy::tdsPpm(Policy::tdsCompensate(Policy::volts(mv), temperature)));
+            tds_error = fmax(tds_error, fabs(tds - referenceTds(mv, celsius)));
+        }
+    }
+    Num offset = Policy::value(ph_offset);
+    for (uint16_t mv = 0; mv <= BENCH_MATH_MV_MAX; mv++)
+    {
+        float ph = Policy::toFloat(Policy::ph(Policy::volts(mv), offset));
+        ph_error = fmax(ph_error, fabs(ph - referencePh(mv, ph_offset)));
+    }
+
+    // Cost of one complete TDS and one pH conversion
+    const int rounds = 200;
+    Num temperature = Policy::value(21.5f);
+    float sink = 0;
+    uint64_t start = benchCycles();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (uint16_t mv = 0; mv <= BENCH_MATH_MV_MAX; mv++)
+        {
+            sink += Policy::toFloat(Policy::tdsPpm(Policy::tdsCompensate(Policy::volts(mv), temperature)));
+            sink += Policy::toFloat(Policy::ph(Policy::volts(mv), offset));
+        }
+    }
+    double cycles = (double)(benchCycles() - start) / (rounds * (BENCH_MATH_MV_MAX + 1));
+    benchKeep(sink);
+
+    printf("%-6s max error: tds %.4f ppm, ph %.6f   cycles per tds+ph conversion %.1f\n", name, tds_error, ph_error, cycles);
+}
+
+int benchMath(int argc, char **argv)
+{
+    // Double reference cost for comparison
+    const int rounds = 200;
+    double sink = 0;
+    uint64_t start = benchCycles();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (uint16_t mv = 0; mv <= BENCH_MATH_MV_MAX; mv++)
+            sink += referenceTds(mv, 21.5) + referencePh(mv, 21.34);
+    }
+    double cycles = (double)(benchCycles() - start) / (rounds * (BENCH_MATH_MV_MAX + 1));
+    benchKeep(sink);
+    printf("double reference                                     cycles per tds+ph conversion %.1f\n", cycles);
+
+    benchPolicy<SensorMathPolicy<float>>("float");
+    benchPolicy<SensorMathPolicy<Q16>>("Q16");
+    printf("note: host cycles, the ESP32 has no double FPU so the double and fixed gap is far larger on the board\n");
+    return 0;
+}
@@ -0,0 +1,218 @@
+// Host benchmark of the batched MQTT publisher.
+// Throughput: records go through the publisher into an in-process broker as
+// fast as it takes them, for a few batch sizes, then over a real socket to a
+// broker stand-in on a localhost port. Outages: three hours of one record
+// per second on the fake clock with the link dropped, silently dead or gone
+// for longer than the queue holds. The records that arrived, the queue
+// depth, reconnects, delivery delay and the longest poll are printed. The
+// offline queue replay is covered by the unit tests (pio test -e native).
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "NativeCommands.h"
+#include "MqttPublisher.h"
+#include "SocketTransport.h"
+#include "MqttBrokerStandIn.h"
+#include "Bench.h"
+
+#define MQTT_BENCH_RECORDS 200000   // Throughput runs
+#define MQTT_BENCH_TCP_RECORDS 50000
+#define MQTT_BENCH_HOURS 3          // Outage runs
+#define MQTT_BENCH_POLL_MS 10       // Period of the firmware's mqtt task
+
+static MqttConfig mqttBenchConfig(uint16_t batch_records)
+{
+    MqttConfig config = {"127.0.0.1", 1883, "hydro-bench", "hydro/bench/telemetry", 30, batch_records, 10000, 5000, 1000, 30000};
+    return config;
+}
+
+static TelemetryRecord mqttBenchRecord(uint32_t i, uint32_t now_ms)
+{
+    TelemetryRecord record;
+    record.sequence = i;
+    record.timestamp_ms = now_ms;
+    record.tds_ppm = 1100.0f + (i % 7) * 0.1f;
+    record.ph = 6.0f + (i % 5) * 0.001f;
+    record.temperature_c = 21.0f + (i % 3) * 0.0625f;
+    record.status = TELEMETRY_TDS_VALID | TELEMETRY_PH_VALID | TELEMETRY_TEMP_VALID;
+    return record;
+}
+
+// What arrived at the broker, by record index
+struct MqttDelivery
+{
+    std::vector<uint8_t> seen;
+    uint32_t unique = 0;
+    const uint32_t *now_ms = NULL;   // Fake clock of the outage runs
+    std::vector<uint32_t> delays_ms; // Record to broker, first arrivals
+};
+
+static void mqttBenchHook(const TelemetryRecord &record, bool duplicate, void *context)
+{
+    MqttDelivery &delivery = *(MqttDelivery *)context;
+    if (record.sequence >= delivery.seen.size() || delivery.seen[record.sequence]++)
+        return;
+    delivery.unique++;
+    if (delivery.now_ms)
+        delivery.delays_ms.push_back(*delivery.now_ms - record.timestamp_ms);
+}
+
+static void mqttThroughput(uint16_t batch_records)
+{
+    BrokerStats broker = {};
+    BrokerSession session(broker, NULL, NULL);
+    LoopbackTransport transport(session);
+    MqttPublisher publisher(transport, mqttBenchConfig(batch_records));
+
+    uint64_t start = benchNanos();
+    for (uint32_t i = 0; i < MQTT_BENCH_RECORDS; i++)
+    {
+        publisher.add(mqttBenchRecord(i, i), 0);
+        publisher.poll(0);
+    }
+    publisher.flush();
+    while (publisher.queued() > 0)
+        publisher.poll(0);
+    double seconds = (benchNanos() - start) / 1e9;
+
+    const MqttStats &stats = publisher.stats();
+    printf("batch %2u: %8.0f messages/s, %9.0f records/s, %5.2f bytes per record on the wire, %llu records at the broker\n",
+           batch_records, stats.published / seconds, MQTT_BENCH_RECORDS / seconds, (double)stats.bytes / MQTT_BENCH_RECORDS,
+           (unsigned long long)broker.records);
+}
+
+static void mqttTcp()
+{
+    MqttDelivery delivery;
+    delivery.seen.assign(MQTT_BENCH_TCP_RECORDS, 0);
+    TcpBrokerStandIn broker(mqttBenchHook, &delivery);
+    uint16_t port = broker.start();
+    if (port == 0)
+    {
+        printf("tcp: no localhost port, skipped\n");
+        return;
+    }
+    MqttConfig config = mqttBenchConfig(10);
+    config.port = port;
+    SocketTransport transport;
+    MqttPublisher publisher(transport, config);
+
+    // On the host clock, records are only held back while half the queue waits for the broker
+    uint64_t start = benchNanos();
+    uint64_t longest_ns = 0;
+    uint32_t added = 0;
+    uint32_t now_ms = 0;
+    while ((added < MQTT_BENCH_TCP_RECORDS || publisher.queued() > 0) && now_ms < 60000)
+    {
+        now_ms = (benchNanos() - start) / 1000000;
+        if (added < MQTT_BENCH_TCP_RECORDS && publisher.queued() < MQTT_QUEUE_MESSAGES / 2)
+        {
+            publisher.add(mqttBenchRecord(added, now_ms), now_ms);
+            if (++added == MQTT_BENCH_TCP_RECORDS)
+                publisher.flush();
+        }
+        uint64_t before = benchNanos();
+        publisher.poll(now_ms);
+        uint64_t took = benchNanos() - before;
+        if (took > longest_ns)
+            longest_ns = took;
+    }
+    double seconds = (benchNanos() - start) / 1e9;
+    const MqttStats stats = publisher.stats();
+    transport.close();
+    broker.stop();
+
+    printf("tcp localhost: %.0f messages/s, %.0f records/s, longest poll %.1f us, %u of %u records at the broker\n",
+           stats.published / seconds, MQTT_BENCH_TCP_RECORDS / seconds, longest_ns / 1000.0, (unsigned)delivery.unique,
+           MQTT_BENCH_TCP_RECORDS);
+}
+
+// One outage in the middle of the run
+enum MqttOutage
+{
+    OUTAGE_DROPPED,  // Connection reset, connects refused
+    OUTAGE_SILENT,   // Nothing gets through and nothing tells, only the keepalive notices
+};
+
+static void mqttOutage(const char *name, MqttOutage kind, uint32_t outage_s)
+{
+    const uint32_t records = MQTT_BENCH_HOURS * 3600;
+    const uint32_t outage_from_ms = 3600 * 1000UL;
+    const uint32_t outage_to_ms = outage_from_ms + outage_s * 1000UL;
+    uint32_t now_ms = 0;
+    MqttDelivery delivery;
+    delivery.seen.assign(records, 0);
+    delivery.now_ms = &now_ms;
+    BrokerStats broker = {};
+    BrokerSession session(broker, mqttBenchHook, &delivery);
+    LoopbackTransport transport(session);
+    transport.setConnectPolls(2);
+    MqttPublisher publisher(transport, mqttBenchConfig(10));
+
+    uint32_t added = 0;
+    uint16_t queue_in_outage = 0;
+    uint64_t longest_ns = 0;
+    for (; added < records || publisher.queued() > 0 || publisher.batched() > 0; now_ms += MQTT_BENCH_POLL_MS)
+    {
+        if (now_ms == outage_from_ms)
+        {
+            if (kind == OUTAGE_DROPPED)
+                transport.setReachable(false);
+            else
+            {
+                session.silent = true;
+                transport.setConnectPolls(UINT32_MAX);
+            }
+        }
+        if (now_ms == outage_to_ms)
+        {
+            transport.setReachable(true);
+            session.silent = false;
+            transport.setConnectPolls(2);
+        }
+        if (now_ms % 1000 == 0 && added < records)
+            publisher.add(mqttBenchRecord(added++, now_ms), now_ms);
+        if (added == records)
+            publisher.flush();
+
+        // A link of about 100 kbit/s
+        transport.setBudget(125);
+        uint64_t before = benchNanos();
+        publisher.poll(now_ms);
+        uint64_t took = benchNanos() - before;
+        if (took > longest_ns)
+            longest_ns = took;
+        if (now_ms >= outage_from_ms && now_ms < outage_to_ms && publisher.queued() > queue_in_outage)
+            queue_in_outage = publisher.queued();
+        if (now_ms > (MQTT_BENCH_HOURS + 1) * 3600000UL)
+            break;
+    }
+
+    const MqttStats &stats = publisher.stats();
+    uint32_t missing = records - delivery.unique;
+
+    std::vector<uint32_t> delays = delivery.delays_ms;
+    std::sort(delays.begin(), delays.end());
+    uint32_t p50 = delays.empty() ? 0 : delays[delays.size() / 2];
+    uint32_t worst = delays.empty() ? 0 : delays.back();
+
+    printf("%s (%u s): %u of %u records, %u missing, %u duplicates, queue %u of %u, %u reconnects after %u failures\n", name,
+           (unsigned)outage_s, (unsigned)delivery.unique, (unsigned)records, (unsigned)missing, (unsigned)(broker.records - delivery.unique),
+           (unsigned)queue_in_outage, MQTT_QUEUE_MESSAGES, (unsigned)(stats.connects - 1), (unsigned)stats.failures);
+    printf("  delay p50 %.1f s, max %.1f s, longest poll %.1f us with the broker's work, %u pings\n", p50 / 1000.0, worst / 1000.0, longest_ns / 1000.0,
+           (unsigned)broker.pings);
+}
+
+int benchMqtt(int argc, char **argv)
+{
+    for (uint16_t batch : {1, 10, 60})
+        mqttThroughput(batch);
+    mqttTcp();
+    printf("queue: %u messages of up to %u bytes, %u bytes of RAM for the publisher\n", MQTT_QUEUE_MESSAGES, MQTT_MESSAGE_MAX,
+           (unsigned)sizeof(MqttPublisher));
+    mqttOutage("dropped link", OUTAGE_DROPPED, 60);
+    mqttOutage("silent link", OUTAGE_SILENT, 300);
+    mqttOutage("long outage", OUTAGE_DROPPED, 1800);
+    return 0;
+}
@@ -0,0 +1,89 @@
+// Host benchmark of the profiler itself.
+// Measures what one scope costs, then uses the same stages the firmware uses
+// on the pipeline's filters and math. The bucket edges and the percentiles
+// are covered by the unit tests (pio test -e native).
+#include <stdio.h>
+#include "NativeCommands.h"
+#include "Bench.h"
+#include "Profiler.h"
+#include "Filters.h"
+#include "SensorMath.h"
+
+#if PROFILING
+
+// Stages for the benchmark, they show up in the list after the pipeline's own
+PROFILE_STAGE(bench_empty, "empty");
+PROFILE_STAGE(bench_median, "median");
+PROFILE_STAGE(bench_trimmed, "trimmed");
+PROFILE_STAGE(bench_tds, "tds math");
+
+int benchProfiler(int argc, char **argv)
+{
+    // Cost of a scope around nothing, against the same loop without it
+    const int rounds = 1000000;
+    uint32_t sink = 0;
+    uint64_t start = benchNanos();
+    for (int i = 0; i < rounds; i++)
+    {
+        benchKeep(sink);
+        sink++;
+    }
+    uint64_t bare = benchNanos() - start;
+    start = benchNanos();
+    for (int i = 0; i < rounds; i++)
+    {
+        PROFILE_SCOPE(bench_empty);
+        benchKeep(sink);
+        sink++;
+    }
+    uint64_t scoped = benchNanos() - start;
+    printf("scope overhead: %.1f ns (two clock reads and a histogram update)\n", (double)(scoped - bare) / rounds);
+
+    // The stages on real work, one ADC block at a time like the pipeline
+    RollingMedian<int, 30> median;
+    RollingTrimmedMean<int, 64, 64 / 5> trimmed;
+    uint32_t seed = 0xadc;
+    uint16_t block[64];
+    SensorNum celsius = SensorMath::value(21.5f);
+    for (int round = 0; round < 20000; round++)
+    {
+        for (int i = 0; i < 64; i++)
+            block[i] = 1500 + benchRandom(seed) % 200;
+        {
+            PROFILE_SCOPE(bench_median);
+            median.pushBlock(block, 64);
+            sink += median.value();
+        }
+        {
+            PROFILE_SCOPE(bench_trimmed);
+            trimmed.pushBlock(block, 64);
+            sink += trimmed.trimmedSum();
+        }
+        {
+            PROFILE_SCOPE(bench_tds);
+            sink += SensorMath::toFloat(SensorMath::tdsPpm(SensorMath::tdsCompensate(SensorMath::volts(block[0]), celsius)));
+        }
+    }
+    benchKeep(sink);
+
+    // Every stage that ran
+    char line[120];
+    for (ProfileStage *stage = ProfileStage::first(); stage != NULL; stage = stage->next())
+    {
+        if (stage->count() == 0)
+            continue;
+        profileFormat(*stage, line, sizeof(line));
+        printf("%s\n", line);
+    }
+    return 0;
+}
+
+#else
+
+int benchProfiler(int argc, char **argv)
+{
+    printf("profiling is compiled out, build with -D PROFILING=1\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,407 @@
+// Host replay of raw sensor traces.
+// A trace is what a board captured with "capture on": every ADC block and
+// DS18B20 read the pipeline took, and the values of a handheld meter typed in
+// with "ref". bench-replay plays it into the firmware's pipeline on the fake
+// clock, as fast as the host goes, and reports the pipeline's error at every
+// reference, the samples per second it got through and what each profiled
+// stage cost. Without a file it records a built-in trace first: fifteen
+// minutes of the simulated sensors with steps, spikes and drift, and a
+// reference every second from their noise free level.
+//
+// With a baseline file the run is compared against it, or written to it if
+// there is none yet, so a change to a filter or the math shows up as lost
+// accuracy or throughput on the same trace. The replay uses the host's
+// reference ADC curves, not the eFuse data of the board that captured it.
+// The trace format, the recorder and the replay are covered by the unit
+// tests (pio test -e native).
+// bench-replay, exits non-zero if the run fell behind its baseline.
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "NativeCommands.h"
+#include "Scheduler.h"
+#include "TemperatureEngine.h"
+#include "SensorPipeline.h"
+#include "Calibration.h"
+#include "RawTrace.h"
+#include "Telemetry.h"
+#include "Profiler.h"
+#include "Hal.h"
+#include "FakeClock.h"
+#include "MockTemperatureBus.h"
+#include "SimulatedAdcSource.h"
+#include "NativeHal.h"
+#include "AdcCalibration.h"
+#include "ReferenceAdcCurve.h"
+#include "TraceReplay.h"
+#include "Bench.h"
+
+#define REPLAY_PIN_TDS 34
+#define REPLAY_PIN_PH 25
+#define REPLAY_ADC_RATE_HZ 250
+#define REPLAY_BLOCK_PERIOD_US (1000000UL * ADC_BLOCK_SIZE / REPLAY_ADC_RATE_HZ)
+#define REPLAY_TEMP_MAX_AGE_US 10000000UL
+#define REPLAY_SECONDS 900           // Length of the built-in trace
+#define REPLAY_WARMUP_S 30           // References before this are not compared, the filters fill up
+
+// Baseline limits
+#define REPLAY_ERROR_RATIO 1.05      // RMS error against the baseline
+#define REPLAY_SLACK_PH 0.002        // Errors this much above the baseline always pass
+#define REPLAY_SLACK_TDS 0.5
+#define REPLAY_SLACK_TEMP 0.01
+#define REPLAY_MIN_SPEED_RATIO 0.7   // Samples per second against the baseline, wall time is noisy
+#define REPLAY_STAGE_RATIO 1.5       // Mean time of a stage against the baseline
+#define REPLAY_STAGE_SLACK_NS 50.0
+
+// The simulated tank of the built-in trace
+static const char REPLAY_SCRIPT[] = "60 ph level=3000\n"
+                                    "120 tds spikes=0.3 spike=500\n"
+                                    "180 temp0 drift=0.003\n"
+                                    "300 tds level=2100\n"
+                                    "420 ph spikes=0.2 spike=300\n"
+                                    "540 ph drift=-0.4\n"
+                                    "660 tds drift=0.5 spikes=0\n"
+                                    "780 temp0 drift=-0.002\n";
+
+// Error of one channel against the references
+struct ReplayError
+{
+    double sum_squares;
+    double max;
+    uint32_t count;
+
+    void add(double error)
+    {
+        sum_squares += error * error;
+        if (fabs(error) > max)
+            max = fabs(error);
+        count++;
+    }
+    double rms() const { return count ? sqrt(sum_squares / count) : 0; }
+};
+
+// What one replay got
+struct ReplayRun
+{
+    ReplayError ph, tds, temperature;
+    uint64_t samples;       // ADC samples through the pipeline
+    double wall_s;
+    double trace_s;         // Time span of the trace
+    double samplesPerSecond() const { return wall_s > 0 ? samples / wall_s : 0; }
+};
+
+static AdcCalibration replay_tds_calibration, replay_ph_calibration;
+static float replay_latest[READING_EC + 1]; // Last index 0 value of every channel
+
+static uint16_t replaySignal(uint8_t pin, uint32_t time_us) { return simulated_sensors.analogRead(pin, time_us); }
+
+static void replaySink(ReadingChannel channel, uint8_t index, float value, SensorQuality quality)
+{
+    if (index == 0)
+        replay_latest[channel] = value;
+}
+
+// Millivolts of a fractional raw count on a calibration table
+static uint16_t truthMillivolts(const AdcCalibration &calibration, float raw)
+{
+    if (raw < 0)
+        raw = 0;
+    return calibration.millivolts(raw > ADC_RAW_MAX ? ADC_RAW_MAX : (uint16_t)lroundf(raw));
+}
+
+// Run the pipeline on the simulated sensors with the capture on, the frames go to capture as a board would send them
+static bool recordBuiltIn(std::vector<uint8_t> &capture)
+{
+    CalibrationCoefficients defaults;
+    calibrationDefaults(defaults);
+
+    simulated_sensors.add("tds", REPLAY_PIN_TDS, 1807, 6);
+    simulated_sensors.add("ph", REPLAY_PIN_PH, 3300, 4);
+    int8_t probe = simulated_sensors.add("temp0", SimulatedSensors::NO_PIN, 21.3f, 0.02f);
+    if (simulated_sensors.load(REPLAY_SCRIPT) != 0)
+        return false;
+
+    fake_now_us = 0;
+    MockTemperatureBus bus;
+    bus.addProbe(simulated_sensors.sensor(probe).level);
+    TemperatureEngine temperatures(bus, halMicros);
+    temperatures.begin(halMicros());
+    SimulatedAdcSource adc(replaySignal);
+    const uint8_t adc_pins[] = {REPLAY_PIN_TDS, REPLAY_PIN_PH};
+    adc.begin(adc_pins, 2, REPLAY_ADC_RATE_HZ);
+
+    RawTraceRecorder recorder;
+    Scheduler scheduler(halMicros);
+    SensorPipeline pipeline(adc, temperatures, replay_tds_calibration, replay_ph_calibration);
+    pipeline.setRecorder(&recorder);
+    pipeline.begin(scheduler, replaySink, REPLAY_BLOCK_PERIOD_US, REPLAY_TEMP_MAX_AGE_US);
+    recorder.start();
+
+    uint8_t frame[TELEMETRY_BATCH_FRAME_SIZE];
+    RawTraceChunk chunk;
+    const uint32_t end_us = REPLAY_SECONDS * 1000000UL;
+    uint32_t next_reference_us = 1000000UL;
+    bool stopping = false;
+    uint32_t stop_us = 0;
+    while (!stopping || (int32_t)(fake_now_us - stop_us) < 0)
+    {
+        simulated_sensors.update(fake_now_us);
+        float celsius;
+        bool connected = simulated_sensors.sample(probe, fake_now_us, celsius);
+        bus.setConnected(0, connected);
+        if (connected)
+            bus.setTemperature(0, celsius);
+
+        // The meter in the tank, what the pipeline should make of the noise free level
+        if (!stopping && (int32_t)(fake_now_us - next_reference_us) >= 0)
+        {
+            float truth_celsius = simulated_sensors.truth(probe, fake_now_us);
+            uint16_t ph_mv = truthMillivolts(replay_ph_calibration, simulated_sensors.truth(1, fake_now_us));
+            uint16_t tds_mv = truthMillivolts(replay_tds_calibration, simulated_sensors.truth(0, fake_now_us));
+            recorder.reference(READING_PH, referencePh(ph_mv, defaults.ph_offset[0]), fake_now_us);
+            recorder.reference(READING_TDS, referenceTds(tds_mv, truth_celsius), fake_now_us);
+            recorder.reference(READING_TEMPERATURE, truth_celsius, fake_now_us);
+            next_reference_us += 1000000UL;
+        }
+        if (!stopping && (int32_t)(fake_now_us - end_us) >= 0)
+        {
+            // The chunk in progress goes out with the next block after the stop
+            recorder.stop();
+            stopping = true;
+            stop_us = fake_now_us + REPLAY_BLOCK_PERIOD_US;
+        }
+
+        fakeSpend(scheduler.runOnce());
+        while (recorder.take(chunk))
+        {
+            size_t length = telemetryEncodeTrace(chunk.data, chunk.length, chunk.count, frame, sizeof(frame));
+            capture.insert(capture.end(), frame, frame + length);
+        }
+    }
+    printf("recorded  %u events, %u chunks dropped, %.1f kB, %.0f bytes/s\n", (unsigned)recorder.events(),
+           (unsigned)recorder.dropped(), capture.size() / 1024.0, capture.size() / (double)REPLAY_SECONDS);
+    return recorder.dropped() == 0;
+}
+
+// Play the trace through a fresh pipeline and compare it at every reference
+static void replay(const std::vector<RawTraceEvent> &events, ReplayRun &run)
+{
+    // References in time order, the trace has them in the order they were written
+    std::vector<const RawTraceEvent *> references;
+    uint32_t first_us = 0, last_us = 0;
+    bool have_time = false;
+    for (const RawTraceEvent &event : events)
+    {
+        if (event.type == TRACE_REFERENCE)
+            references.push_back(&event);
+        if (!have_time || (int32_t)(event.time_us - first_us) < 0)
+            first_us = event.time_us;
+        if (!have_time || (int32_t)(event.time_us - last_us) > 0)
+            last_us = event.time_us;
+        have_time = true;
+    }
+
+    // The clock starts where the trace does, so its timestamps mean the same
+    fake_now_us = first_us;
+    memset(replay_latest, 0, sizeof(replay_latest));
+    ReplayAdcSource adc(events);
+    ReplayTemperatureBus bus(events);
+    TemperatureEngine temperatures(bus, halMicros);
+    temperatures.begin(halMicros());
+    Scheduler scheduler(halMicros);
+    SensorPipeline pipeline(adc, temperatures, replay_tds_calibration, replay_ph_calibration);
+    pipeline.begin(scheduler, replaySink, adc.blockPeriodUs(), REPLAY_TEMP_MAX_AGE_US);
+
+#if PROFILING
+    for (ProfileStage *stage = ProfileStage::first(); stage != NULL; stage = stage->next())
+        stage->reset();
+#endif
+
+    const uint32_t warmup_us = first_us + REPLAY_WARMUP_S * 1000000UL;
+    size_t next_reference = 0;
+    uint64_t start_ns = benchNanos();
+    while ((int32_t)(fake_now_us - last_us) <= 0)
+    {
+        fakeSpend(scheduler.runOnce());
+        while (next_reference < references.size() && (int32_t)(references[next_reference]->time_us - fake_now_us) <= 0)
+        {
+            const RawTraceEvent &reference = *references[next_reference++];
+            if ((int32_t)(reference.time_us - warmup_us) < 0)
+                continue;
+            double error = replay_latest[reference.channel] - reference.value;
+            if (reference.channel == READING_PH)
+                run.ph.add(error);
+            else if (reference.channel == READING_TDS)
+                run.tds.add(error);
+            else if (reference.channel == READING_TEMPERATURE)
+                run.temperature.add(error);
+        }
+    }
+    run.wall_s = (benchNanos() - start_ns) / 1e9;
+    run.samples = adc.samples();
+    run.trace_s = (uint32_t)(last_us - first_us) / 1e6;
+}
+
+// A baseline file, one "name value" line each
+struct ReplayBaseline
+{
+    std::vector<std::pair<std::string, double>> values;
+
+    bool find(const char *name, double &value) const
+    {
+        for (const auto &entry : values)
+        {
+            if (entry.first == name)
+            {
+                value = entry.second;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+static bool loadBaseline(const char *path, ReplayBaseline &baseline)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return false;
+    char name[64];
+    double value;
+    while (fscanf(file, "%63s %lf", name, &value) == 2)
+        baseline.values.push_back({name, value});
+    fclose(file);
+    return true;
+}
+
+// Within the baseline's value times ratio plus slack, a value the baseline does not have passes
+static bool notWorse(const ReplayBaseline &baseline, const char *name, double value, double ratio, double slack)
+{
+    double base;
+    if (!baseline.find(name, base) || value <= base * ratio + slack)
+        return true;
+    printf("  %s %.4f, baseline %.4f\n", name, value, base);
+    return false;
+}
+
+int benchReplay(int argc, char **argv)
+{
+    replay_tds_calibration.build(referenceAdcMillivolts, &REFERENCE_ADC1);
+    replay_ph_calibration.build(referenceAdcMillivolts, &REFERENCE_ADC2);
+
+    std::vector<uint8_t> capture;
+    bool built_in = argc < 1 || strcmp(argv[0], "-") == 0;
+    if (built_in)
+    {
+        if (!recordBuiltIn(capture))
+            return 1;
+    }
+    else if (!traceLoad(argv[0], capture))
+    {
+        fprintf(stderr, "cannot open %s\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<RawTraceEvent> events;
+    TraceParseStats parsed = traceParse(capture.data(), capture.size(), events);
+    printf("%s trace, %u frames, %u events, %u other frames, %u damaged\n", built_in ? "built-in" : argv[0],
+           (unsigned)parsed.frames, (unsigned)parsed.events, (unsigned)parsed.skipped, (unsigned)parsed.damaged);
+    if (parsed.events == 0)
+    {
+        fprintf(stderr, "no trace frames\n");
+        return 1;
+    }
+    ReplayRun run = {};
+    replay(events, run);
+    printf("accuracy  pH rms %.4f max %.4f (%u refs) | tds rms %.2f max %.2f ppm (%u) | temp rms %.3f max %.3f C (%u)\n",
+           run.ph.rms(), run.ph.max, (unsigned)run.ph.count, run.tds.rms(), run.tds.max, (unsigned)run.tds.count,
+           run.temperature.rms(), run.temperature.max, (unsigned)run.temperature.count);
+    printf("speed     %.1f s of trace in %.3f s, %.0fx real time, %.2f M samples/s\n", run.trace_s, run.wall_s,
+           run.wall_s > 0 ? run.trace_s / run.wall_s : 0, run.samplesPerSecond() / 1e6);
+
+    ReplayBaseline measured;
+    measured.values.push_back({"ph_rms", run.ph.rms()});
+    measured.values.push_back({"tds_rms", run.tds.rms()});
+    measured.values.push_back({"temp_rms", run.temperature.rms()});
+    measured.values.push_back({"samples_per_s", run.samplesPerSecond()});
+#if PROFILING
+    char line[120];
+    for (ProfileStage *stage = ProfileStage::first(); stage != NULL; stage = stage->next())
+    {
+        if (stage->count() == 0)
+            continue;
+        profileFormat(*stage, line, sizeof(line));
+        printf("%s\n", line);
+        // One word per name in the baseline file
+        std::string name = std::string("stage_ns.") + stage->name();
+        for (char &c : name)
+            c = c == ' ' ? '_' : c;
+        measured.values.push_back({name, (double)stage->sum() / stage->count()});
+    }
+#endif
+
+    bool kept = true;
+    if (argc >= 2)
+    {
+        ReplayBaseline baseline;
+        if (loadBaseline(argv[1], baseline))
+        {
+            kept = notWorse(baseline, "ph_rms", run.ph.rms(), REPLAY_ERROR_RATIO, REPLAY_SLACK_PH) &
+                        notWorse(baseline, "tds_rms", run.tds.rms(), REPLAY_ERROR_RATIO, REPLAY_SLACK_TDS) &
+                        notWorse(baseline, "temp_rms", run.temperature.rms(), REPLAY_ERROR_RATIO, REPLAY_SLACK_TEMP);
+            double base_speed;
+            if (baseline.find("samples_per_s", base_speed) && run.samplesPerSecond() < base_speed * REPLAY_MIN_SPEED_RATIO)
+            {
+                printf("  samples_per_s %.0f, baseline %.0f\n", run.samplesPerSecond(), base_speed);
+                kept = false;
+            }
+            for (const auto &entry : measured.values)
+            {
+                if (entry.first.compare(0, 9, "stage_ns.") == 0)
+                    kept = notWorse(baseline, entry.first.c_str(), entry.second, REPLAY_STAGE_RATIO, REPLAY_STAGE_SLACK_NS) && kept;
+            }
+            printf("baseline  %s %s\n", argv[1], kept ? "kept" : "NOT kept");
+        }
+        else
+        {
+            FILE *file = fopen(argv[1], "w");
+            if (!file)
+            {
+                fprintf(stderr, "cannot write %s\n", argv[1]);
+                return 1;
+            }
+            for (const auto &entry : measured.values)
+                fprintf(file, "%s %.6g\n", entry.first.c_str(), entry.second);
+            fclose(file);
+            printf("baseline  written to %s\n", argv[1]);
+        }
+    }
+
+    return kept ? 0 : 1;
+}
+
+int recordTrace(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "usage: record-trace <file>\n");
+        return 2;
+    }
+    replay_tds_calibration.build(referenceAdcMillivolts, &REFERENCE_ADC1);
+    replay_ph_calibration.build(referenceAdcMillivolts, &REFERENCE_ADC2);
+    std::vector<uint8_t> capture;
+    if (!recordBuiltIn(capture))
+        return 1;
+    FILE *file = fopen(argv[0], "wb");
+    if (!file || fwrite(capture.data(), 1, capture.size(), file) != capture.size())
+    {
+        fprintf(stderr, "cannot write %s\n", argv[0]);
+        if (file)
+            fclose(file);
+        return 1;
+    }
+    fclose(file);
+    return 0;
+}
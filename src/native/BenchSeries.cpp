@@ -0,0 +1,224 @@
+// Host checks of the compressed history.
+// Three days of report records shaped like the firmware's (one per second
+// with a few milliseconds of jitter, probe noise, DS18B20 steps, the odd
+// gap and status change) go through the series codec in log sized blocks.
+// The sizes are compared with the uncompressed record, the telemetry frame,
+// a CSV line and Gorilla's XOR coding of the raw floats, and encode, decode
+// and the rollup tiers are timed. Round trips, edge records and the rollup
+// summaries are covered by the unit tests (pio test -e native).
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "NativeCommands.h"
+#include "SeriesCodec.h"
+#include "SeriesRollup.h"
+#include "FlashLog.h"
+#include "Bench.h"
+
+#define SERIES_DAYS 3
+#define SERIES_RECORDS (SERIES_DAYS * 86400UL)
+#define SERIES_BLOCK FLASH_LOG_CHUNK_BYTES
+#define SERIES_FLASH_BYTES (16UL * 65536)   // History of the firmware, 16 segments of 64 KB
+
+// Standard normal sample, Box-Muller on xorshift32
+static float seriesNoise(uint32_t &state)
+{
+    float u1 = (benchRandom(state) + 1.0f) / 4294967296.0f;
+    float u2 = benchRandom(state) / 4294967296.0f;
+    return sqrtf(-2.0f * logf(u1)) * cosf(6.2831853f * u2);
+}
+
+// Report records of a tank, noise scales the probe noise
+static std::vector<TelemetryRecord> seriesRecords(float noise, uint32_t seed)
+{
+    std::vector<TelemetryRecord> records;
+    uint32_t state = seed;
+    uint32_t time_ms = 5000;
+    uint16_t sequence = 0;
+    for (uint32_t i = 0; i < SERIES_RECORDS; i++)
+    {
+        // The report task runs every second give or take a tick, now and then a record is lost
+        time_ms += 1000 + benchRandom(state) % 5 - 2;
+        if (benchRandom(state) % 5000 == 0)
+        {
+            time_ms += 1000;
+            sequence++;
+        }
+        float hours = time_ms / 3600000.0f;
+        float celsius = 21.0f + 1.5f * sinf(6.2831853f * hours / 24.0f) + 0.01f * noise * seriesNoise(state);
+
+        TelemetryRecord record;
+        record.sequence = sequence++;
+        record.timestamp_ms = time_ms;
+        record.tds_ppm = 1100.0f - 5.0f * fmodf(hours, 12.0f) + 0.8f * noise * seriesNoise(state);
+        record.ph = 6.0f + 0.02f * fmodf(hours, 12.0f) + 0.003f * noise * seriesNoise(state);
+        record.temperature_c = roundf(celsius * 16.0f) / 16.0f; // 12-bit DS18B20
+        record.status = TELEMETRY_TDS_VALID | TELEMETRY_PH_VALID | TELEMETRY_TEMP_VALID;
+        if (benchRandom(state) % 20000 == 0)
+            record.status |= TELEMETRY_RING_DROPS;
+        records.push_back(record);
+    }
+    return records;
+}
+
+// Bits of Gorilla's XOR coding of a float: 1 if unchanged, the meaningful bits inside the last window, or a new window
+struct GorillaValue
+{
+    uint32_t previous;
+    uint8_t leading;
+    uint8_t trailing;
+    bool started;
+
+    uint32_t bits(float value)
+    {
+        uint32_t raw;
+        memcpy(&raw, &value, sizeof(raw));
+        if (!started)
+        {
+            started = true;
+            previous = raw;
+            return 32;
+        }
+        uint32_t x = raw ^ previous;
+        previous = raw;
+        if (x == 0)
+            return 1;
+        uint8_t lead = __builtin_clz(x), trail = __builtin_ctz(x);
+        if (lead > 31)
+            lead = 31;
+        if (leading != 0xFF && lead >= leading && trail >= trailing)
+            return 2 + (32 - leading - trailing);
+        leading = lead;
+        trailing = trail;
+        return 2 + 5 + 6 + (32 - lead - trail);
+    }
+};
+
+// One trace through the codec
+struct SeriesResult
+{
+    uint64_t bytes;          // Compressed blocks with their chunk headers
+    uint32_t blocks;
+    uint64_t gorilla_bits;   // The values coded as XOR instead
+    uint64_t value_bits;     // The values as coded here
+    uint64_t csv_bytes;
+    double encode_ns;        // Per record
+    double decode_ns;
+};
+
+// Value bits of the block codec for one delta, to set against Gorilla's
+static uint32_t deltaBits(int32_t delta)
+{
+    uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+    if (zigzag == 0)
+        return 1;
+    if (zigzag >> 6 == 0)
+        return 2 + 6;
+    if (zigzag >> 12 == 0)
+        return 3 + 12;
+    return zigzag >> 20 == 0 ? 4 + 20 : 4 + 32;
+}
+
+static SeriesResult seriesRun(const std::vector<TelemetryRecord> &records)
+{
+    SeriesResult result = {};
+    std::vector<uint8_t> stream;            // Blocks one after the other, each behind its length and count
+    static uint8_t block[SERIES_BLOCK];
+    SeriesEncoder encoder;
+
+    uint64_t start = benchNanos();
+    encoder.begin(block, sizeof(block));
+    for (size_t i = 0; i <= records.size(); i++)
+    {
+        if (i < records.size() && encoder.append(records[i]))
+            continue;
+        uint16_t length = encoder.size(), count = encoder.count();
+        stream.push_back(length & 0xFF);
+        stream.push_back(length >> 8);
+        stream.push_back(count & 0xFF);
+        stream.push_back(count >> 8);
+        stream.insert(stream.end(), block, block + length);
+        result.bytes += FLASH_LOG_CHUNK_HEADER_SIZE + length;
+        result.blocks++;
+        encoder.begin(block, sizeof(block));
+        if (i < records.size())
+            encoder.append(records[i]);
+    }
+    result.encode_ns = (double)(benchNanos() - start) / records.size();
+
+    size_t decoded = 0;
+    start = benchNanos();
+    for (size_t offset = 0; offset < stream.size();)
+    {
+        uint16_t length = stream[offset] | stream[offset + 1] << 8;
+        uint16_t count = stream[offset + 2] | stream[offset + 3] << 8;
+        SeriesDecoder decoder(&stream[offset + 4], length, count);
+        TelemetryRecord record;
+        while (decoder.next(record))
+            decoded++;
+        offset += 4 + length;
+    }
+    result.decode_ns = (double)(benchNanos() - start) / decoded;
+
+    // The sizes of the alternatives
+    GorillaValue gorilla[3] = {{0, 0xFF, 0, false}, {0, 0xFF, 0, false}, {0, 0xFF, 0, false}};
+    char line[96];
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const TelemetryRecord &record = records[i];
+        result.gorilla_bits += gorilla[0].bits(record.tds_ppm) + gorilla[1].bits(record.ph) + gorilla[2].bits(record.temperature_c);
+        if (i > 0)
+        {
+            const TelemetryRecord &last = records[i - 1];
+            result.value_bits += deltaBits(seriesQuantise(record.tds_ppm, SERIES_TDS_SCALE) - seriesQuantise(last.tds_ppm, SERIES_TDS_SCALE)) +
+                                 deltaBits(seriesQuantise(record.ph, SERIES_PH_SCALE) - seriesQuantise(last.ph, SERIES_PH_SCALE)) +
+                                 deltaBits(seriesQuantise(record.temperature_c, SERIES_TEMP_SCALE) -
+                                           seriesQuantise(last.temperature_c, SERIES_TEMP_SCALE));
+        }
+        result.csv_bytes += snprintf(line, sizeof(line), "%u,%lu,%.2f,%.3f,%.3f,0x%04x\r\n", record.sequence,
+                                     (unsigned long)record.timestamp_ms, record.tds_ppm, record.ph, record.temperature_c, record.status);
+    }
+    return result;
+}
+
+static void seriesReport(const char *name, const std::vector<TelemetryRecord> &records)
+{
+    SeriesResult result = seriesRun(records);
+    double per_record = (double)result.bytes / records.size();
+    double ratio = SERIES_RECORD_SIZE / per_record;
+    printf("%s: %u records in %u blocks, %.2f bytes per record with the chunk headers, %.1fx\n", name,
+           (unsigned)records.size(), (unsigned)result.blocks, per_record, ratio);
+    printf("  against: %u byte record, %u byte frame %.1fx, %.1f byte CSV line %.1fx\n", SERIES_RECORD_SIZE,
+           TELEMETRY_FRAME_SIZE, TELEMETRY_FRAME_SIZE / per_record, (double)result.csv_bytes / records.size(),
+           result.csv_bytes / (double)result.bytes);
+    printf("  values: %.1f bits per record as quantised deltas, %.1f as XOR of the floats\n",
+           (double)result.value_bits / records.size(), (double)result.gorilla_bits / records.size());
+    printf("  encode %.1f ns, decode %.1f ns per record\n", result.encode_ns, result.decode_ns);
+    printf("  1 MB of flash holds %.1f days of one record per second\n", SERIES_FLASH_BYTES / per_record / 86400.0);
+}
+
+// Time the tiers on the same records
+static void seriesRollup(const std::vector<TelemetryRecord> &records)
+{
+    static SeriesRollup rollup;
+    rollup.clear();
+    uint64_t start = benchNanos();
+    for (const TelemetryRecord &record : records)
+        rollup.add(record);
+    double add_ns = (double)(benchNanos() - start) / records.size();
+
+    printf("rollup: %u minutes and %u hours kept in %u bytes of RAM, %.1f ns per record\n", (unsigned)rollup.minutes.size(),
+           (unsigned)rollup.hours.size(), (unsigned)sizeof(SeriesRollup), add_ns);
+}
+
+int benchSeries(int argc, char **argv)
+{
+    std::vector<TelemetryRecord> report = seriesRecords(1.0f, 12345);
+    std::vector<TelemetryRecord> noisy = seriesRecords(10.0f, 54321);
+
+    seriesReport("report", report);
+    seriesReport("10x probe noise", noisy);
+    seriesRollup(report);
+    return 0;
+}
@@ -0,0 +1,63 @@
+// Host timing of the probe calibration.
+// Compares the cost of a conversion through the precomputed curves with the
+// old line and cubic, and the cost of rebuilding them. The fits, the curves
+// and recovery from a damaged stored blob are covered by the unit tests
+// (pio test -e native).
+#include <stdio.h>
+#include <math.h>
+#include "NativeCommands.h"
+#include "Bench.h"
+#include "Calibration.h"
+
+// Host cycles of one conversion over every millivolt value, one at a time as the pipeline runs them
+template <typename Convert>
+static double cyclesPerConversion(Convert convert)
+{
+    const int rounds = 200;
+    SensorNum sink = SensorNum();
+    uint64_t start = benchCycles();
+    for (int round = 0; round < rounds; round++)
+    {
+        for (uint16_t mv = 0; mv <= 3300; mv++)
+        {
+            SensorNum volts = SensorMath::volts(mv);
+            benchKeep(volts);
+            sink += convert(volts);
+        }
+    }
+    uint64_t cycles = benchCycles() - start;
+    benchKeep(sink);
+    return cycles / (rounds * 3301.0);
+}
+
+static void benchConversions()
+{
+    printf("cost per conversion (host cycles)\n");
+    CalibrationCoefficients coefficients;
+    calibrationDefaults(coefficients);
+    CalibrationPoint ph_points[] = {{2.50f, 6.86f}, {2.97f, 4.01f}, {2.05f, 9.18f}};
+    CalibrationPoint tds_points[] = {{480.0f, 500.0f}, {1050.0f, 1000.0f}, {1900.0f, 2000.0f}};
+    calibrationFitPh(ph_points, 3, coefficients);
+    calibrationFitTds(tds_points, 3, coefficients);
+    CalibrationCurves curves;
+    curves.build(coefficients);
+
+    SensorNum offset = SensorMath::value(21.34f);
+    printf("  pH:  line %.1f, calibrated lines %.1f\n",
+           cyclesPerConversion([&](SensorNum volts) { return SensorMath::ph(volts, offset); }),
+           cyclesPerConversion([&](SensorNum volts) { return curves.ph(volts); }));
+    printf("  TDS: cubic %.1f, calibrated table %.1f\n",
+           cyclesPerConversion([](SensorNum volts) { return SensorMath::tdsPpm(volts); }),
+           cyclesPerConversion([&](SensorNum volts) { return curves.tdsPpm(volts); }));
+
+    uint64_t start = benchCycles();
+    for (int round = 0; round < 1000; round++)
+        curves.build(coefficients);
+    printf("  rebuilding the curves %.0f, once at boot and per calibration\n", (benchCycles() - start) / 1000.0);
+}
+
+int checkCalibration(int argc, char **argv)
+{
+    benchConversions();
+    return 0;
+}
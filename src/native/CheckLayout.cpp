@@ -0,0 +1,192 @@
+// Host run of the compile-time pipeline layouts.
+// Every layout of the firmware's build options runs the firmware's pipeline
+// on the fake clock, on the simulated ADC or the mock ADS1x15 chain, with all
+// pH inputs at one voltage and all TDS inputs at another. Prints the pins and
+// the static RAM of every layout and what each probe reported. The layout
+// checks and the reports are covered by the unit tests (pio test -e native).
+#include <initializer_list>
+#include <stdio.h>
+#include <string.h>
+#include "NativeCommands.h"
+#include "PipelineLayout.h"
+#include "SensorPipeline.h"
+#include "Scheduler.h"
+#include "TemperatureEngine.h"
+#include "Ads1x15Source.h"
+#include "AdcCalibration.h"
+#include "Hal.h"
+#include "FakeClock.h"
+#include "MockTemperatureBus.h"
+#include "MockAds1x15Bus.h"
+#include "SimulatedAdcSource.h"
+#include "ReferenceAdcCurve.h"
+
+#define LAYOUT_SECONDS 5
+#define LAYOUT_ADC_RATE_HZ 250
+#define LAYOUT_PH_VOLTS 1.5f
+#define LAYOUT_TDS_VOLTS 0.8f
+
+// The firmware's layouts: GPIO34 / GPIO25, pH on ADC1 for WiFi, and chains with extra probes
+constexpr PipelineLayout<2> LAYOUT_GPIO = {{{READING_TDS, SOURCE_GPIO, 34}, {READING_PH, SOURCE_GPIO, 25}}};
+constexpr PipelineLayout<2> LAYOUT_GPIO_WIFI = {{{READING_TDS, SOURCE_GPIO, 34}, {READING_PH, SOURCE_GPIO, 35}}};
+constexpr PipelineLayout<2> LAYOUT_ADS_PAIR = ads1x15Layout<2>(1, 0);
+constexpr PipelineLayout<8> LAYOUT_ADS_8 = ads1x15Layout<8>(2, 3);
+constexpr PipelineLayout<16> LAYOUT_ADS_16 = ads1x15Layout<16>(4, 7);
+
+static const uint8_t layout_addresses[] = {0x48, 0x49, 0x4A, 0x4B};
+static const uint8_t *layout_pins;       // Pins of the layout that runs
+static const ChannelSpec *layout_specs;
+static uint8_t layout_count;
+static AdcCalibration layout_adc1, layout_adc2;
+
+// What the pipeline reported last, by kind and index
+static float layout_values[READING_EC + 1][1 + PIPELINE_MAX_PROBES];
+static uint32_t layout_counts[READING_EC + 1][1 + PIPELINE_MAX_PROBES];
+
+static void layoutSink(ReadingChannel channel, uint8_t index, float value, SensorQuality quality)
+{
+    if (index > PIPELINE_MAX_PROBES)
+        return;
+    layout_values[channel][index] = value;
+    layout_counts[channel][index]++;
+}
+
+// Volts of a probe by its kind
+static float layoutVolts(ReadingChannel kind) { return kind == READING_PH ? LAYOUT_PH_VOLTS : LAYOUT_TDS_VOLTS; }
+
+// The simulated GPIOs, raw counts of the reference curve
+static uint16_t layoutSignal(uint8_t pin, uint32_t time_us)
+{
+    for (uint8_t i = 0; i < layout_count; i++)
+    {
+        if (layout_pins[i] == pin)
+            return (uint16_t)(layoutVolts(layout_specs[i].kind) * 4095 / 3.3f);
+    }
+    return 0;
+}
+
+// The chain inputs
+static float layoutChainSignal(uint8_t device, uint8_t input, uint32_t time_us, void *context)
+{
+    for (uint8_t i = 0; i < layout_count; i++)
+    {
+        if (layout_pins[i] == ADS1X15_INPUT(device, input))
+            return layoutVolts(layout_specs[i].kind);
+    }
+    return 0;
+}
+
+// What every probe reported last
+static void layoutReported(const ChannelSpec *channels, uint8_t count)
+{
+    for (ReadingChannel kind : {READING_TDS, READING_PH})
+    {
+        uint8_t probes = 0;
+        for (uint8_t i = 0; i < count; i++)
+            probes += channels[i].kind == kind;
+        printf("  %-3s", kind == READING_PH ? "ph" : "tds");
+        for (uint8_t index = 0; index < probes; index++)
+            printf(" %.2f (%u)", layout_values[kind][index], (unsigned)layout_counts[kind][index]);
+        printf("\n");
+    }
+}
+
+template <uint8_t N>
+static void printLayout(const char *name, const PipelineLayout<N> &layout, size_t source_bytes)
+{
+    printf("%s, %u probes, %u bytes static (pipeline %u, source %u), pins", name, (unsigned)N,
+           (unsigned)(sizeof(SensorPipeline) + source_bytes), (unsigned)sizeof(SensorPipeline), (unsigned)source_bytes);
+    for (uint8_t i = 0; i < N; i++)
+        printf(" %s%u", layout.channels[i].kind == READING_PH ? "ph:" : "tds:", (unsigned)layout.channels[i].pin);
+    printf("\n");
+}
+
+// Run the pipeline on the simulated on-chip ADC
+template <uint8_t N>
+static void runGpio(const char *name, const PipelineLayout<N> &layout)
+{
+    const typename PipelineLayout<N>::Pins pins = layout.pins();
+    printLayout(name, layout, sizeof(SimulatedAdcSource));
+    layout_pins = pins.pin;
+    layout_specs = layout.channels;
+    layout_count = N;
+    memset(layout_counts, 0, sizeof(layout_counts));
+
+    SimulatedAdcSource adc(layoutSignal);
+    MockTemperatureBus bus;
+    bus.addProbe(21.5f);
+    TemperatureEngine temperatures(bus, halMicros);
+    Scheduler scheduler(halMicros);
+    SensorPipeline pipeline(adc, temperatures, layout_adc1, layout_adc2);
+    pipeline.addProbes(layout);
+    adc.begin(pins.pin, N, LAYOUT_ADC_RATE_HZ);
+    temperatures.begin(halMicros());
+    pipeline.begin(scheduler, layoutSink, 1000000UL * ADC_BLOCK_SIZE / LAYOUT_ADC_RATE_HZ, 10000000UL);
+
+    uint32_t end_us = fake_now_us + LAYOUT_SECONDS * 1000000UL;
+    while ((int32_t)(end_us - fake_now_us) > 0)
+        fakeSpend(scheduler.runOnce());
+    layoutReported(layout.channels, N);
+}
+
+// Run the pipeline on the mock chain, the pulses go to the source as the pin interrupts would
+template <uint8_t N>
+static void runChain(const char *name, const PipelineLayout<N> &layout, uint8_t devices)
+{
+    const typename PipelineLayout<N>::Pins pins = layout.pins();
+    printLayout(name, layout, sizeof(Ads1x15Source));
+    layout_pins = pins.pin;
+    layout_specs = layout.channels;
+    layout_count = N;
+    memset(layout_counts, 0, sizeof(layout_counts));
+
+    MockAds1x15Bus mock(layoutChainSignal, NULL, false);
+    for (uint8_t i = 0; i < devices; i++)
+        mock.addDevice(layout_addresses[i], 0);
+    Ads1x15Source source(mock, layout_addresses, devices, ADS1115);
+    MockTemperatureBus bus;
+    bus.addProbe(21.5f);
+    TemperatureEngine temperatures(bus, halMicros);
+    Scheduler scheduler(halMicros);
+    AdcCalibration calibration;
+    calibration.build(ads1x15Millivolts, NULL);
+    SensorPipeline pipeline(source, temperatures, calibration, calibration);
+    pipeline.addProbes(layout);
+    source.begin(pins.pin, N, LAYOUT_ADC_RATE_HZ);
+    temperatures.begin(halMicros());
+    uint32_t per_channel_hz = source.dataRate() * devices / N;
+    pipeline.begin(scheduler, layoutSink, 1000000UL * ADC_BLOCK_SIZE / (per_channel_hz ? per_channel_hz : 1), 10000000UL);
+
+    uint32_t end_us = fake_now_us + LAYOUT_SECONDS * 1000000UL;
+    while ((int32_t)(end_us - fake_now_us) > 0)
+    {
+        uint32_t until_us = fake_now_us + scheduler.runOnce();
+        uint8_t device;
+        uint32_t at;
+        while ((at = mock.nextAlert(device)) != UINT32_MAX && (int32_t)(at - until_us) <= 0)
+        {
+            if ((int32_t)(at - fake_now_us) > 0)
+                fake_now_us = at;
+            mock.takeAlert(device);
+            if (source.ready(device))
+                source.service(fake_now_us);
+        }
+        if ((int32_t)(until_us - fake_now_us) > 0)
+            fake_now_us = until_us;
+    }
+    layoutReported(layout.channels, N);
+}
+
+int checkLayout(int argc, char **argv)
+{
+    layout_adc1.build(referenceAdcMillivolts, &REFERENCE_ADC1);
+    layout_adc2.build(referenceAdcMillivolts, &REFERENCE_ADC2);
+    fake_now_us = 0;
+
+    runGpio("gpio", LAYOUT_GPIO);
+    runGpio("gpio, wifi", LAYOUT_GPIO_WIFI);
+    runChain("ads1115 pair", LAYOUT_ADS_PAIR, 1);
+    runChain("ads1115 2 devices", LAYOUT_ADS_8, 2);
+    runChain("ads1115 4 devices", LAYOUT_ADS_16, 4);
+    return 0;
+}
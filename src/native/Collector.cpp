@@ -0,0 +1,320 @@
+#include "Collector.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define COLLECTOR_UDP_TAG 0xFFFFFFFFu   // epoll data of the UDP socket, streams use their index
+#define COLLECTOR_READ_SIZE 65536       // Stream bytes taken per read()
+#define COLLECTOR_MAX_EVENTS 64
+
+static uint64_t collectorNanos()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+Collector::Collector(ColumnStore &store)
+    : store(store), udp_fd(-1), node_count(0), stream_count(0), hook(NULL), hook_context(NULL)
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    start_ns = collectorNanos();
+    memset(&counters, 0, sizeof(counters));
+    memset(streams, 0, sizeof(streams));
+
+    nodes = (Node *)calloc(store.maxNodes(), sizeof(Node));
+
+    // Keep the sender table at most half full so probe runs stay short
+    uint32_t size = 2;
+    while (size < 2u * store.maxNodes())
+        size <<= 1;
+    sender_mask = size - 1;
+    sender_table = (int32_t *)malloc(size * sizeof(int32_t));
+    memset(sender_table, 0xFF, size * sizeof(int32_t));
+
+    datagrams = (uint8_t(*)[DATAGRAM_SIZE])malloc(BATCH * DATAGRAM_SIZE);
+    messages = (mmsghdr *)calloc(BATCH, sizeof(mmsghdr));
+    vectors = (iovec *)calloc(BATCH, sizeof(iovec));
+    senders = (sockaddr_in *)calloc(BATCH, sizeof(sockaddr_in));
+}
+
+Collector::~Collector()
+{
+    for (uint16_t i = 0; i < stream_count; i++)
+    {
+        close(streams[i]->fd);
+        delete streams[i];
+    }
+    if (udp_fd >= 0)
+        close(udp_fd);
+    close(epoll_fd);
+    free(senders);
+    free(vectors);
+    free(messages);
+    free(datagrams);
+    free(sender_table);
+    free(nodes);
+}
+
+uint32_t Collector::nowMs() const
+{
+    return (collectorNanos() - start_ns) / 1000000;
+}
+
+uint16_t Collector::listenUdp(uint16_t port)
+{
+    udp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (udp_fd < 0)
+        return 0;
+
+    // A large receive buffer rides out bursts while the loop is busy storing
+    int buffer = 8 << 20;
+    setsockopt(udp_fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    socklen_t length = sizeof(address);
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = COLLECTOR_UDP_TAG;
+    if (bind(udp_fd, (sockaddr *)&address, sizeof(address)) < 0 ||
+        getsockname(udp_fd, (sockaddr *)&address, &length) < 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, udp_fd, &event) < 0)
+    {
+        close(udp_fd);
+        udp_fd = -1;
+        return 0;
+    }
+
+    // The message headers point at the fixed buffers for good
+    for (uint16_t i = 0; i < BATCH; i++)
+    {
+        vectors[i].iov_base = datagrams[i];
+        vectors[i].iov_len = DATAGRAM_SIZE;
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_name = &senders[i];
+    }
+    return ntohs(address.sin_port);
+}
+
+int32_t Collector::addStream(int fd, const char *name)
+{
+    if (stream_count >= MAX_STREAMS)
+        return -1;
+    int32_t node = newNode((uint64_t)fd, true);
+    if (node < 0)
+        return -1;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = stream_count;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+        return -1;
+
+    Stream *stream = new Stream();
+    stream->fd = fd;
+    stream->node = node;
+    stream->length = 0;
+    stream->overlong = false;
+    snprintf(stream->name, sizeof(stream->name), "%s", name);
+    streams[stream_count++] = stream;
+    return node;
+}
+
+int32_t Collector::newNode(uint64_t address, bool is_stream)
+{
+    if (node_count >= store.maxNodes())
+        return -1;
+    Node &node = nodes[node_count];
+    node.address = address;
+    node.is_stream = is_stream;
+    node.have_sequence = false;
+    node.expected = 0;
+    return node_count++;
+}
+
+int32_t Collector::findSender(const sockaddr_in &sender)
+{
+    uint64_t address = (uint64_t)ntohl(sender.sin_addr.s_addr) << 16 | ntohs(sender.sin_port);
+    uint32_t slot = (uint32_t)((address * 0x9E3779B97F4A7C15ULL) >> 32) & sender_mask;
+    while (true)
+    {
+        int32_t node = sender_table[slot];
+        if (node < 0)
+        {
+            // First datagram of this sender
+            node = newNode(address, false);
+            if (node >= 0)
+                sender_table[slot] = node;
+            return node;
+        }
+        if (!nodes[node].is_stream && nodes[node].address == address)
+            return node;
+        slot = (slot + 1) & sender_mask;
+    }
+}
+
+void Collector::nodeName(uint16_t node, char *buffer, size_t size) const
+{
+    const Node &entry = nodes[node];
+    if (entry.is_stream)
+    {
+        for (uint16_t i = 0; i < stream_count; i++)
+        {
+            if (streams[i]->node == node)
+            {
+                snprintf(buffer, size, "%s", streams[i]->name);
+                return;
+            }
+        }
+    }
+    uint32_t ip = entry.address >> 16;
+    snprintf(buffer, size, "%u.%u.%u.%u:%u", ip >> 24, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF,
+             (unsigned)(entry.address & 0xFFFF));
+}
+
+uint32_t Collector::poll(int timeout_ms)
+{
+    epoll_event events[COLLECTOR_MAX_EVENTS];
+    int ready = epoll_wait(epoll_fd, events, COLLECTOR_MAX_EVENTS, timeout_ms);
+    if (ready <= 0)
+        return 0;
+    counters.wakeups++;
+
+    uint64_t before = counters.records;
+    for (int i = 0; i < ready; i++)
+    {
+        if (events[i].data.u32 == COLLECTOR_UDP_TAG)
+            readUdp();
+        else
+            readStream(*streams[events[i].data.u32]);
+    }
+    return counters.records - before;
+}
+
+void Collector::readUdp()
+{
+    while (true)
+    {
+        for (uint16_t i = 0; i < BATCH; i++)
+            messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        int received = recvmmsg(udp_fd, messages, BATCH, MSG_DONTWAIT, NULL);
+        if (received <= 0)
+            return;
+
+        // One clock read per batch, the records of a batch arrived together
+        uint32_t now_ms = nowMs();
+        counters.datagrams += received;
+        for (int i = 0; i < received; i++)
+        {
+            size_t length = messages[i].msg_len;
+            counters.bytes += length;
+            int32_t node = findSender(senders[i]);
+            if (node < 0)
+            {
+                counters.unknown_nodes++;
+                continue;
+            }
+
+            // A datagram holds whole frames, anything after the last delimiter is damaged
+            if (splitFrames(node, datagrams[i], length, now_ms) < length)
+                counters.bad_frames++;
+        }
+        if (received < BATCH)
+            return;
+    }
+}
+
+void Collector::readStream(Stream &stream)
+{
+    uint8_t buffer[COLLECTOR_READ_SIZE];
+    while (true)
+    {
+        ssize_t length = read(stream.fd, buffer, sizeof(buffer));
+        if (length <= 0)
+            return;
+        counters.bytes += length;
+        uint32_t now_ms = nowMs();
+
+        // Finish the frame the previous read stopped in
+        const uint8_t *end = (const uint8_t *)memchr(buffer, 0, length);
+        size_t head = end ? end - buffer : length;
+        if (stream.length + head > sizeof(stream.partial))
+            stream.overlong = true;
+        else
+        {
+            memcpy(stream.partial + stream.length, buffer, head);
+            stream.length += head;
+        }
+        if (!end)
+            continue;
+        if (stream.overlong)
+            counters.bad_frames++;
+        else if (stream.length > 0)
+            storeFrame(stream.node, stream.partial, stream.length, now_ms);
+        stream.length = 0;
+        stream.overlong = false;
+
+        // Whole frames are decoded where they lie, only the unfinished tail is kept
+        size_t tail = head + 1 + splitFrames(stream.node, end + 1, length - head - 1, now_ms);
+        size_t rest = length - tail;
+        if (rest > sizeof(stream.partial))
+            stream.overlong = true;
+        else
+        {
+            memcpy(stream.partial, buffer + tail, rest);
+            stream.length = rest;
+        }
+    }
+}
+
+size_t Collector::splitFrames(uint16_t node, const uint8_t *data, size_t length, uint32_t now_ms)
+{
+    size_t start = 0;
+    while (start < length)
+    {
+        const uint8_t *end = (const uint8_t *)memchr(data + start, 0, length - start);
+        if (!end)
+            break;
+        size_t frame_length = end - (data + start);
+        if (frame_length > 0)
+            storeFrame(node, data + start, frame_length, now_ms);
+        start += frame_length + 1;
+    }
+    return start;
+}
+
+void Collector::storeFrame(uint16_t node, const uint8_t *frame, size_t length, uint32_t now_ms)
+{
+    TelemetryRecord record;
+    if (!telemetryDecode(frame, length, record))
+    {
+        counters.bad_frames++;
+        return;
+    }
+
+    Node &entry = nodes[node];
+    // Count the missing records, a jump backwards is a node that started over
+    uint16_t missing = record.sequence - entry.expected;
+    if (entry.have_sequence && missing < 0x8000)
+        counters.gaps += missing;
+    entry.expected = record.sequence + 1;
+    entry.have_sequence = true;
+
+    store.append(node, now_ms, record);
+    counters.records++;
+    if (hook)
+        hook(node, record, hook_context);
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include "ColumnStore.h"
+
+// Linux collector for the binary telemetry of many nodes.
+//
+// One epoll loop serves every source: a UDP socket that all nodes send to
+// (each sender address is a node) and any number of byte streams such as
+// serial ports or ptys (each stream is a node). Datagrams are fetched in
+// batches with recvmmsg() into buffers allocated once, frames are split on
+// the zero delimiters where they lie and decoded straight into the columns
+// of the node. Only the unfinished tail of a stream read is carried over to
+// the next one. The boards have to be switched to "mode binary", text lines
+// between frames are counted as bad frames and skipped.
+
+// Called for every stored record, e.g. to measure the ingest latency
+typedef void (*CollectorHook)(uint16_t node, const TelemetryRecord &record, void *context);
+
+// Counters of the collector
+struct CollectorStats
+{
+    uint64_t datagrams;       // UDP datagrams received
+    uint64_t bytes;           // Bytes received over every source
+    uint64_t records;         // Records stored
+    uint64_t bad_frames;      // Frames that failed COBS, the CRC or the version
+    uint64_t gaps;            // Records missing between two records of a node, by sequence number
+    uint64_t wakeups;         // epoll_wait() calls that returned events
+    uint32_t unknown_nodes;   // Datagrams from new senders dropped because the node table was full
+};
+
+class Collector
+{
+public:
+    static const uint16_t MAX_STREAMS = 64;
+    static const uint16_t BATCH = 64;           // Datagrams per recvmmsg() call
+    static const size_t DATAGRAM_SIZE = 512;    // Largest datagram taken, several frames may share one
+
+    Collector(ColumnStore &store);
+    ~Collector();
+
+    // Listen on a UDP port of the loopback interface, 0 picks a free one. Returns the port, 0 on failure
+    uint16_t listenUdp(uint16_t port);
+
+    // Read frames from a byte stream, the collector owns the descriptor from now on. Returns the node, -1 on failure
+    int32_t addStream(int fd, const char *name);
+
+    // Wait up to timeout_ms for data and store every complete frame. Returns the number of records stored
+    uint32_t poll(int timeout_ms);
+
+    void setHook(CollectorHook hook, void *context)
+    {
+        this->hook = hook;
+        hook_context = context;
+    }
+
+    const CollectorStats &stats() const { return counters; }
+    uint16_t nodeCount() const { return node_count; }
+
+    // Name of a node: the stream name or the sender address
+    void nodeName(uint16_t node, char *buffer, size_t size) const;
+
+    // Host time the collector stores records with, milliseconds since it was made
+    uint32_t nowMs() const;
+
+private:
+    // Per node state besides the columns
+    struct Node
+    {
+        uint64_t address;       // Sender address and port, or the stream descriptor
+        bool is_stream;
+        bool have_sequence;
+        uint16_t expected;      // Sequence number of the next record
+    };
+
+    // A byte stream and the frame it is in the middle of
+    struct Stream
+    {
+        int fd;
+        uint16_t node;
+        uint16_t length;        // Bytes of the unfinished frame
+        bool overlong;          // The unfinished frame is already too long to be ours
+        uint8_t partial[TELEMETRY_FRAME_SIZE];
+        char name[32];
+    };
+
+    int32_t newNode(uint64_t address, bool is_stream);
+    int32_t findSender(const sockaddr_in &sender);
+    void readUdp();
+    void readStream(Stream &stream);
+
+    // Decode every delimited frame of a buffer for a node, returns the bytes after the last delimiter
+    size_t splitFrames(uint16_t node, const uint8_t *data, size_t length, uint32_t now_ms);
+    void storeFrame(uint16_t node, const uint8_t *frame, size_t length, uint32_t now_ms);
+
+    ColumnStore &store;
+    int epoll_fd;
+    int udp_fd;
+    uint64_t start_ns;
+
+    Node *nodes;                // One per store node
+    uint16_t node_count;
+    int32_t *sender_table;      // Open addressing table from sender address to node, -1 is empty
+    uint32_t sender_mask;
+
+    Stream *streams[MAX_STREAMS];
+    uint16_t stream_count;
+
+    // recvmmsg() buffers, allocated once
+    uint8_t (*datagrams)[DATAGRAM_SIZE];
+    struct mmsghdr *messages;
+    struct iovec *vectors;
+    sockaddr_in *senders;
+
+    CollectorHook hook;
+    void *hook_context;
+    CollectorStats counters;
+};
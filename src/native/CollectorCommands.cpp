@@ -0,0 +1,184 @@
+// Collector daemon and load generator for a fleet of nodes.
+//
+// collect [port] [seconds] [tty ...] listens for telemetry frames on a
+// loopback UDP port and on any serial ports or ptys given, prints fleet wide
+// numbers every few seconds and a per node CSV summary when it stops (after
+// the given seconds, 0 runs until Ctrl-C).
+// loadgen [nodes] [records per second] [seconds] [port] plays a fleet of
+// simulated nodes against it, each node from its own UDP source port.
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "NativeCommands.h"
+#include "Collector.h"
+#include "LoadGenerator.h"
+
+#define COLLECT_PORT 5515          // Default UDP port of the collector
+#define COLLECT_MAX_NODES 1024
+#define COLLECT_CAPACITY 4096      // Records per node, over an hour at one record per second
+#define COLLECT_REPORT_MS 5000     // Fleet numbers this often
+#define COLLECT_BUCKETS 12         // Downsampled history printed per node at the end
+
+static volatile sig_atomic_t collect_stop = 0;
+
+static void collectSignal(int signal)
+{
+    collect_stop = 1;
+}
+
+// Open a serial port or pty raw at the firmware's baud rate
+static int collectOpenTty(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    termios settings;
+    if (tcgetattr(fd, &settings) == 0)
+    {
+        cfmakeraw(&settings);
+        cfsetispeed(&settings, B115200);
+        cfsetospeed(&settings, B115200);
+        tcsetattr(fd, TCSANOW, &settings);
+    }
+    return fd;
+}
+
+// Fleet wide mean of every field over the nodes that had a reading in the range
+static void collectFleet(const Collector &collector, const ColumnStore &store, uint32_t from_ms, uint32_t to_ms)
+{
+    static const char *const names[COLUMN_FIELDS] = {"tds", "ph", "temp"};
+    printf("  fleet over the last %u s:", (unsigned)((to_ms - from_ms) / 1000));
+    for (uint8_t field = 0; field < COLUMN_FIELDS; field++)
+    {
+        float min = INFINITY, max = -INFINITY;
+        double sum = 0;
+        uint32_t count = 0;
+        for (uint16_t node = 0; node < collector.nodeCount(); node++)
+        {
+            ColumnSummary summary = store.summarize(node, (ColumnField)field, from_ms, to_ms);
+            if (summary.count == 0)
+                continue;
+            min = fminf(min, summary.min);
+            max = fmaxf(max, summary.max);
+            sum += (double)summary.mean * summary.count;
+            count += summary.count;
+        }
+        if (count > 0)
+            printf(" %s %.2f..%.2f mean %.2f", names[field], min, max, sum / count);
+    }
+    printf("\n");
+}
+
+int collectTelemetry(int argc, char **argv)
+{
+    uint16_t port = argc > 0 ? atoi(argv[0]) : COLLECT_PORT;
+    uint32_t seconds = argc > 1 ? atoi(argv[1]) : 0;
+
+    ColumnStore store(COLLECT_MAX_NODES, COLLECT_CAPACITY);
+    Collector collector(store);
+    uint16_t bound = collector.listenUdp(port);
+    if (bound == 0)
+    {
+        fprintf(stderr, "collect: can not listen on udp port %u\n", port);
+        return 1;
+    }
+    for (int i = 2; i < argc; i++)
+    {
+        int fd = collectOpenTty(argv[i]);
+        if (fd < 0 || collector.addStream(fd, argv[i]) < 0)
+        {
+            fprintf(stderr, "collect: can not read %s\n", argv[i]);
+            return 1;
+        }
+    }
+    fprintf(stderr, "collect: udp 127.0.0.1:%u, %d serial ports, %.1f MB of columns\n", bound, argc > 2 ? argc - 2 : 0,
+            store.footprint() / 1048576.0);
+
+    signal(SIGINT, collectSignal);
+    signal(SIGTERM, collectSignal);
+    uint32_t report_ms = COLLECT_REPORT_MS;
+    uint64_t last_records = 0;
+    while (!collect_stop && (seconds == 0 || collector.nowMs() < seconds * 1000))
+    {
+        collector.poll(100);
+        uint32_t now_ms = collector.nowMs();
+        if ((int32_t)(now_ms - report_ms) < 0)
+            continue;
+
+        const CollectorStats &stats = collector.stats();
+        printf("%u s: %u nodes, %.0f records/s, %llu records, %llu bad frames, %llu missing\n", now_ms / 1000,
+               collector.nodeCount(), (stats.records - last_records) * 1000.0 / COLLECT_REPORT_MS,
+               (unsigned long long)stats.records, (unsigned long long)stats.bad_frames,
+               (unsigned long long)stats.gaps);
+        collectFleet(collector, store, now_ms - COLLECT_REPORT_MS, now_ms);
+        fflush(stdout);
+        last_records = stats.records;
+        report_ms += COLLECT_REPORT_MS;
+    }
+
+    // Per node summary over the whole run, and its history downsampled into a few buckets
+    uint32_t end_ms = collector.nowMs() + 1;
+    uint32_t bucket_ms = end_ms / COLLECT_BUCKETS + 1;
+    printf("node,name,records,tds_mean,ph_mean,temperature_mean,tds_per_%u_ms\n", (unsigned)bucket_ms);
+    for (uint16_t node = 0; node < collector.nodeCount(); node++)
+    {
+        char name[48];
+        collector.nodeName(node, name, sizeof(name));
+        ColumnSummary tds = store.summarize(node, COLUMN_TDS, 0, end_ms);
+        ColumnSummary ph = store.summarize(node, COLUMN_PH, 0, end_ms);
+        ColumnSummary temperature = store.summarize(node, COLUMN_TEMPERATURE, 0, end_ms);
+        printf("%u,%s,%u,%.2f,%.3f,%.2f,", node, name, (unsigned)store.records(node), tds.mean, ph.mean,
+               temperature.mean);
+
+        ColumnBucket buckets[COLLECT_BUCKETS];
+        uint16_t count = store.downsample(node, 0, end_ms, bucket_ms, buckets, COLLECT_BUCKETS);
+        for (uint16_t i = 0; i < count; i++)
+            printf("%s%.1f", i ? " " : "", buckets[i].mean[COLUMN_TDS]);
+        printf("\n");
+    }
+    return 0;
+}
+
+int generateLoad(int argc, char **argv)
+{
+    uint16_t node_count = argc > 0 ? atoi(argv[0]) : 200;
+    uint32_t rate = argc > 1 ? atoi(argv[1]) : 1;
+    uint32_t seconds = argc > 2 ? atoi(argv[2]) : 10;
+    uint16_t port = argc > 3 ? atoi(argv[3]) : COLLECT_PORT;
+    if (node_count == 0 || rate == 0)
+    {
+        fprintf(stderr, "usage: loadgen [nodes] [records per second] [seconds] [port]\n");
+        return 2;
+    }
+
+    LoadGenerator load(node_count, 1);
+    if (!load.openUdp(port))
+    {
+        fprintf(stderr, "loadgen: can not open %u sockets\n", node_count);
+        return 1;
+    }
+
+    // Every node sends once per round, rounds are paced against the monotonic clock so they do not drift
+    timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    uint64_t round_ns = 1000000000ULL / rate;
+    uint64_t rounds = (uint64_t)rate * seconds;
+    for (uint64_t round = 0; round < rounds; round++)
+    {
+        for (uint16_t node = 0; node < node_count; node++)
+            load.send(node);
+        uint64_t due = next.tv_nsec + round_ns;
+        next.tv_sec += due / 1000000000ULL;
+        next.tv_nsec = due % 1000000000ULL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+    fprintf(stderr, "loadgen: %llu records from %u nodes, %llu not sent\n", (unsigned long long)rounds * node_count,
+            node_count, (unsigned long long)load.sendFailures());
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include "ColumnStore.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Valid flag of every field, in ColumnField order
+static const uint16_t column_valid[COLUMN_FIELDS] = {TELEMETRY_TDS_VALID, TELEMETRY_PH_VALID, TELEMETRY_TEMP_VALID};
+
+// Bytes one record takes over all columns
+static const size_t column_record_size = 2 * sizeof(uint32_t) + 2 * sizeof(uint16_t) + COLUMN_FIELDS * sizeof(float);
+
+ColumnStore::ColumnStore(uint16_t max_nodes, uint32_t capacity) : max_nodes(max_nodes)
+{
+    uint32_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+    mask = size - 1;
+
+    // One allocation for everything, the widest columns first so every slice stays aligned
+    block = (uint8_t *)calloc((size_t)max_nodes * size, column_record_size);
+    nodes = (NodeColumns *)calloc(max_nodes, sizeof(NodeColumns));
+    uint8_t *p = block;
+    for (uint16_t node = 0; node < max_nodes; node++)
+    {
+        NodeColumns &columns = nodes[node];
+        columns.received_ms = (uint32_t *)p;
+        p += size * sizeof(uint32_t);
+        columns.device_ms = (uint32_t *)p;
+        p += size * sizeof(uint32_t);
+        for (uint8_t field = 0; field < COLUMN_FIELDS; field++)
+        {
+            columns.value[field] = (float *)p;
+            p += size * sizeof(float);
+        }
+        columns.sequence = (uint16_t *)p;
+        p += size * sizeof(uint16_t);
+        columns.status = (uint16_t *)p;
+        p += size * sizeof(uint16_t);
+    }
+}
+
+ColumnStore::~ColumnStore()
+{
+    free(nodes);
+    free(block);
+}
+
+uint64_t ColumnStore::footprint() const
+{
+    return (uint64_t)max_nodes * (mask + 1) * column_record_size;
+}
+
+void ColumnStore::append(uint16_t node, uint32_t received_ms, const TelemetryRecord &record)
+{
+    NodeColumns &columns = nodes[node];
+    uint32_t index;
+    if (columns.count > mask)
+    {
+        // Full, the new record takes the place of the oldest
+        index = columns.head;
+        columns.head = (columns.head + 1) & mask;
+        columns.overwritten++;
+    }
+    else
+    {
+        index = (columns.head + columns.count++) & mask;
+    }
+
+    columns.received_ms[index] = received_ms;
+    columns.device_ms[index] = record.timestamp_ms;
+    columns.sequence[index] = record.sequence;
+    columns.status[index] = record.status;
+    columns.value[COLUMN_TDS][index] = record.tds_ppm;
+    columns.value[COLUMN_PH][index] = record.ph;
+    columns.value[COLUMN_TEMPERATURE][index] = record.temperature_c;
+}
+
+uint32_t ColumnStore::lowerBound(const NodeColumns &columns, uint32_t received_ms) const
+{
+    // Arrival order is time order, binary search over the ring positions
+    uint32_t low = 0, high = columns.count;
+    while (low < high)
+    {
+        uint32_t mid = (low + high) / 2;
+        if ((int32_t)(columns.received_ms[(columns.head + mid) & mask] - received_ms) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+ColumnSummary ColumnStore::summarize(uint16_t node, ColumnField field, uint32_t from_ms, uint32_t to_ms) const
+{
+    const NodeColumns &columns = nodes[node];
+    const float *values = columns.value[field];
+    uint16_t valid = column_valid[field];
+
+    ColumnSummary summary = {0, NAN, NAN, NAN};
+    float min = INFINITY, max = -INFINITY;
+    double sum = 0;
+    for (uint32_t i = lowerBound(columns, from_ms); i < columns.count; i++)
+    {
+        uint32_t index = (columns.head + i) & mask;
+        if ((int32_t)(columns.received_ms[index] - to_ms) >= 0)
+            break;
+        if (!(columns.status[index] & valid))
+            continue;
+        float value = values[index];
+        if (value < min)
+            min = value;
+        if (value > max)
+            max = value;
+        sum += value;
+        summary.count++;
+    }
+
+    if (summary.count > 0)
+    {
+        summary.min = min;
+        summary.max = max;
+        summary.mean = sum / summary.count;
+    }
+    return summary;
+}
+
+uint16_t ColumnStore::downsample(uint16_t node, uint32_t from_ms, uint32_t to_ms, uint32_t bucket_ms,
+                                 ColumnBucket *buckets, uint16_t max_buckets) const
+{
+    if (bucket_ms == 0 || max_buckets == 0)
+        return 0;
+
+    const NodeColumns &columns = nodes[node];
+    uint16_t written = 0;
+    double sum[COLUMN_FIELDS];
+    uint32_t counted[COLUMN_FIELDS];
+    ColumnBucket *bucket = NULL;
+
+    for (uint32_t i = lowerBound(columns, from_ms); i < columns.count; i++)
+    {
+        uint32_t index = (columns.head + i) & mask;
+        uint32_t received_ms = columns.received_ms[index];
+        if ((int32_t)(received_ms - to_ms) >= 0)
+            break;
+
+        uint32_t start_ms = from_ms + (received_ms - from_ms) / bucket_ms * bucket_ms;
+        if (!bucket || bucket->start_ms != start_ms)
+        {
+            // Close the current bucket and open the one this record falls into
+            if (bucket)
+            {
+                for (uint8_t field = 0; field < COLUMN_FIELDS; field++)
+                    bucket->mean[field] = counted[field] ? sum[field] / counted[field] : NAN;
+            }
+            if (written == max_buckets)
+                return written;
+            bucket = &buckets[written++];
+            bucket->start_ms = start_ms;
+            bucket->records = 0;
+            memset(sum, 0, sizeof(sum));
+            memset(counted, 0, sizeof(counted));
+        }
+
+        bucket->records++;
+        for (uint8_t field = 0; field < COLUMN_FIELDS; field++)
+        {
+            if (columns.status[index] & column_valid[field])
+            {
+                sum[field] += columns.value[field][index];
+                counted[field]++;
+            }
+        }
+    }
+
+    if (bucket)
+    {
+        for (uint8_t field = 0; field < COLUMN_FIELDS; field++)
+            bucket->mean[field] = counted[field] ? sum[field] / counted[field] : NAN;
+    }
+    return written;
+}
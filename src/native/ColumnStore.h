@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include "Telemetry.h"
+
+// Columnar in-memory store of the telemetry of many nodes, for the collector.
+//
+// Every node gets a ring of a fixed number of records, kept as one array per
+// field rather than an array of records: a query over one field walks a
+// single contiguous column. All columns are allocated in one block when the
+// store is made, appending never allocates. Records are ordered by the host
+// time they arrived at, which is what queries select on; the device timestamp
+// restarts with every reboot of a node and is only kept alongside.
+
+// Fields a query can ask for
+enum ColumnField : uint8_t
+{
+    COLUMN_TDS,
+    COLUMN_PH,
+    COLUMN_TEMPERATURE,
+};
+
+#define COLUMN_FIELDS (COLUMN_TEMPERATURE + 1)
+
+// Count, range and mean of one field over a time range, only valid readings count
+struct ColumnSummary
+{
+    uint32_t count;
+    float min;
+    float max;
+    float mean;
+};
+
+// One downsampling bucket, means of the valid readings that arrived in it
+struct ColumnBucket
+{
+    uint32_t start_ms;            // Host time the bucket starts at
+    uint16_t records;             // Records in the bucket
+    float mean[COLUMN_FIELDS];    // Mean of every field, NAN if it had no valid reading
+};
+
+class ColumnStore
+{
+public:
+    // capacity is rounded up to a power of two
+    ColumnStore(uint16_t max_nodes, uint32_t capacity);
+    ~ColumnStore();
+
+    // Store a record of a node that arrived at the given host time, the oldest record of the node goes once it is full
+    void append(uint16_t node, uint32_t received_ms, const TelemetryRecord &record);
+
+    // Summary of one field of a node over [from_ms, to_ms)
+    ColumnSummary summarize(uint16_t node, ColumnField field, uint32_t from_ms, uint32_t to_ms) const;
+
+    // Means over buckets of bucket_ms starting at from_ms up to to_ms, empty buckets are left out.
+    // Returns the number of buckets written, at most max_buckets
+    uint16_t downsample(uint16_t node, uint32_t from_ms, uint32_t to_ms, uint32_t bucket_ms, ColumnBucket *buckets,
+                        uint16_t max_buckets) const;
+
+    // Records of a node currently held, and how many were pushed out by newer ones
+    uint32_t records(uint16_t node) const { return nodes[node].count; }
+    uint32_t overwritten(uint16_t node) const { return nodes[node].overwritten; }
+
+    uint16_t maxNodes() const { return max_nodes; }
+    uint32_t capacity() const { return mask + 1; }
+
+    // Bytes held by the columns
+    uint64_t footprint() const;
+
+private:
+    // Column layout of one node, every pointer is a slice of the shared block
+    struct NodeColumns
+    {
+        uint32_t *received_ms;
+        uint32_t *device_ms;
+        uint16_t *sequence;
+        uint16_t *status;
+        float *value[COLUMN_FIELDS];
+        uint32_t head;        // Ring index of the oldest record
+        uint32_t count;       // Records held
+        uint32_t overwritten; // Records pushed out of the ring
+    };
+
+    // Position of the first record that arrived at or after the given time, count if there is none
+    uint32_t lowerBound(const NodeColumns &columns, uint32_t received_ms) const;
+
+    uint16_t max_nodes;
+    uint32_t mask;           // Capacity minus one
+    uint8_t *block;          // Every column of every node
+    NodeColumns *nodes;
+};
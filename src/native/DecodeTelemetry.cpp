@@ -0,0 +1,87 @@
+// Host decoder for the binary telemetry stream.
+// Reads a raw capture (or a serial port) on stdin, splits it on the zero
+// delimiters and prints every valid record as a CSV line. Frames that fail
+// COBS or the CRC, including text lines printed between frames, are counted
+// and skipped. Batch frames of an "export" give all their records, in the
+// same columns, trace frames of a "capture" are counted and left to
+// bench-replay. Example: cat /dev/ttyUSB0 | program decode
+#include <stdio.h>
+#include "NativeCommands.h"
+#include "Telemetry.h"
+#include "SeriesCodec.h"
+
+static void printRecord(const TelemetryRecord &record)
+{
+    printf("%u,%lu,%.2f,%.3f,%.3f,0x%04x\n", record.sequence, (unsigned long)record.timestamp_ms, record.tds_ppm, record.ph,
+           record.temperature_c, record.status);
+}
+
+int decodeTelemetry(int argc, char **argv)
+{
+    uint8_t frame[TELEMETRY_BATCH_FRAME_SIZE];
+    uint8_t block[TELEMETRY_BATCH_MAX];
+    size_t length = 0;
+    bool overlong = false;
+    unsigned long good = 0, bad = 0, gaps = 0, batches = 0, traces = 0;
+    bool have_sequence = false;
+    uint16_t expected = 0;
+
+    printf("sequence,timestamp_ms,tds_ppm,ph,temperature_c,status\n");
+    int c;
+    while ((c = getchar()) != EOF)
+    {
+        if (c != 0)
+        {
+            // Collect the frame body, anything too long is not ours
+            if (length < sizeof(frame))
+                frame[length++] = c;
+            else
+                overlong = true;
+            continue;
+        }
+
+        // Delimiter: decode whatever was collected since the previous one
+        if (length > 0)
+        {
+            TelemetryRecord record;
+            size_t block_length;
+            uint16_t count;
+            if (!overlong && telemetryDecode(frame, length, record))
+            {
+                if (have_sequence && record.sequence != expected)
+                    gaps++;
+                expected = record.sequence + 1;
+                have_sequence = true;
+                good++;
+                printRecord(record);
+            }
+            else if (!overlong && telemetryDecodeBatch(frame, length, block, block_length, count))
+            {
+                // History, its sequence numbers have nothing to do with the live ones
+                SeriesDecoder decoder(block, block_length, count);
+                while (decoder.next(record))
+                {
+                    good++;
+                    printRecord(record);
+                }
+                if (decoder.remaining() > 0)
+                    bad++;
+                batches++;
+            }
+            else if (!overlong && telemetryDecodeTrace(frame, length, block, block_length, count))
+            {
+                traces++;
+            }
+            else
+            {
+                bad++;
+            }
+        }
+        length = 0;
+        overlong = false;
+    }
+
+    fprintf(stderr, "%lu records, %lu batch frames, %lu trace frames, %lu skipped frames, %lu sequence gaps\n", good, batches,
+            traces, bad, gaps);
+    return 0;
+}
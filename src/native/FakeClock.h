@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+// Simulated microsecond counter for the host build, it only moves when advanced
+extern uint32_t fake_now_us;
+
+// Clock function with the Scheduler signature
+inline uint32_t fakeClock() { return fake_now_us; }
+
+// Spend simulated time, used to model how long an operation takes
+inline void fakeSpend(uint32_t us) { fake_now_us += us; }
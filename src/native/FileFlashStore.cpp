@@ -0,0 +1,114 @@
+#include "FileFlashStore.h"
+#include <string.h>
+
+FileFlashStore::FileFlashStore(const char *directory) : powered(true), bytes_written(0), limited(false), budget(0)
+{
+    snprintf(this->directory, sizeof(this->directory), "%s", directory);
+    memset(erases, 0, sizeof(erases));
+    memset(files, 0, sizeof(files));
+}
+
+FileFlashStore::~FileFlashStore()
+{
+    for (uint8_t slot = 0; slot < MAX_SLOTS; slot++)
+    {
+        if (files[slot])
+            fclose(files[slot]);
+    }
+}
+
+void FileFlashStore::path(uint8_t slot, char *buffer, size_t size) const
+{
+    snprintf(buffer, size, "%s/seg%02u.bin", directory, slot);
+}
+
+FILE *FileFlashStore::open(uint8_t slot)
+{
+    if (slot >= MAX_SLOTS)
+        return NULL;
+    if (!files[slot])
+    {
+        // Appending mode: writes always go to the end, reads can seek anywhere
+        char name[160];
+        path(slot, name, sizeof(name));
+        files[slot] = fopen(name, "a+b");
+    }
+    return files[slot];
+}
+
+uint32_t FileFlashStore::size(uint8_t slot)
+{
+    FILE *file = powered ? open(slot) : NULL;
+    if (!file)
+        return 0;
+    fseek(file, 0, SEEK_END);
+    return ftell(file);
+}
+
+size_t FileFlashStore::read(uint8_t slot, uint32_t offset, uint8_t *data, size_t length)
+{
+    FILE *file = powered ? open(slot) : NULL;
+    if (!file || fseek(file, offset, SEEK_SET) != 0)
+        return 0;
+    return fread(data, 1, length, file);
+}
+
+bool FileFlashStore::append(uint8_t slot, const uint8_t *data, size_t length)
+{
+    FILE *file = powered ? open(slot) : NULL;
+    if (!file)
+        return false;
+
+    // With a cut armed only part of the write makes it, then the power is gone
+    size_t allowed = length;
+    if (limited && budget < length)
+        allowed = budget;
+    size_t written = fwrite(data, 1, allowed, file);
+    fflush(file);
+    bytes_written += written;
+    if (limited)
+    {
+        budget -= written;
+        if (written < length)
+            powered = false;
+    }
+    return written == length;
+}
+
+bool FileFlashStore::erase(uint8_t slot)
+{
+    // Erasing is a write too, it does not happen without power
+    if (!powered || slot >= MAX_SLOTS || (limited && budget == 0))
+    {
+        powered = false;
+        return false;
+    }
+    if (files[slot])
+    {
+        fclose(files[slot]);
+        files[slot] = NULL;
+    }
+    char name[160];
+    path(slot, name, sizeof(name));
+    remove(name);
+    erases[slot]++;
+    return true;
+}
+
+void FileFlashStore::wipe()
+{
+    for (uint8_t slot = 0; slot < MAX_SLOTS; slot++)
+    {
+        if (files[slot])
+        {
+            fclose(files[slot]);
+            files[slot] = NULL;
+        }
+        char name[160];
+        path(slot, name, sizeof(name));
+        remove(name);
+    }
+    memset(erases, 0, sizeof(erases));
+    bytes_written = 0;
+    restorePower();
+}
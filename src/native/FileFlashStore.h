@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdio.h>
+#include "FlashStore.h"
+
+// File-backed flash emulator for the host build.
+//
+// Every slot is a file in a directory. Besides counting bytes and erases per
+// slot it can cut the power: after a byte budget runs out the write in
+// progress stops half way and every further operation fails until the power
+// is restored, which is what a brown-out in the middle of a flush looks like.
+class FileFlashStore : public FlashStore
+{
+public:
+    static const uint8_t MAX_SLOTS = 16;
+
+    explicit FileFlashStore(const char *directory);
+    ~FileFlashStore();
+
+    uint32_t size(uint8_t slot) override;
+    size_t read(uint8_t slot, uint32_t offset, uint8_t *data, size_t length) override;
+    bool append(uint8_t slot, const uint8_t *data, size_t length) override;
+    bool erase(uint8_t slot) override;
+
+    // Let only this many more bytes reach the flash, then lose power
+    void cutPowerAfter(uint32_t bytes) { budget = bytes; limited = true; }
+
+    // Power back on, like a reboot the files keep whatever was written
+    void restorePower() { limited = false; powered = true; }
+
+    // Delete every slot file and clear the counters
+    void wipe();
+
+    bool powered;                     // False after a simulated power cut
+    uint64_t bytes_written;           // Bytes that reached the files
+    uint32_t erases[MAX_SLOTS];       // Erases per slot
+
+private:
+    FILE *open(uint8_t slot);
+    void path(uint8_t slot, char *buffer, size_t size) const;
+
+    char directory[128];
+    FILE *files[MAX_SLOTS];  // Open slot files, opened on first use
+    bool limited;            // A power cut is armed
+    uint32_t budget;         // Bytes left before the cut
+};
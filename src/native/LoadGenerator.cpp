@@ -0,0 +1,108 @@
+#include "LoadGenerator.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+LoadGenerator::LoadGenerator(uint16_t node_count, uint32_t seed)
+    : node_count(node_count), random(seed ? seed : 1), send_failures(0)
+{
+    nodes = (Node *)calloc(node_count, sizeof(Node));
+    for (uint16_t i = 0; i < node_count; i++)
+    {
+        Node &node = nodes[i];
+        node.fd = -1;
+        node.sequence = 0;
+        node.timestamp_ms = 0;
+        node.tds_ppm = 600.0f + (i * 37) % 400;
+        node.ph = 5.5f + (i % 11) * 0.1f;
+        node.temperature_c = 18.0f + (i % 9);
+    }
+}
+
+LoadGenerator::~LoadGenerator()
+{
+    closeAll();
+    free(nodes);
+}
+
+void LoadGenerator::closeAll()
+{
+    for (uint16_t i = 0; i < node_count; i++)
+    {
+        if (nodes[i].fd >= 0)
+            close(nodes[i].fd);
+        nodes[i].fd = -1;
+    }
+}
+
+bool LoadGenerator::openUdp(uint16_t port)
+{
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+
+    for (uint16_t i = 0; i < node_count; i++)
+    {
+        int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || connect(fd, (sockaddr *)&address, sizeof(address)) < 0)
+        {
+            if (fd >= 0)
+                close(fd);
+            closeAll();
+            return false;
+        }
+        nodes[i].fd = fd;
+    }
+    return true;
+}
+
+void LoadGenerator::useStreams(const int *fds)
+{
+    for (uint16_t i = 0; i < node_count; i++)
+        nodes[i].fd = fds[i];
+}
+
+float LoadGenerator::wander(float value, float step, float low, float high)
+{
+    // Random walk kept inside its band
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    value += ((int32_t)(random & 0xFF) - 128) * (step / 128);
+    return value < low ? low : value > high ? high : value;
+}
+
+size_t LoadGenerator::nextFrame(uint16_t index, uint8_t *frame)
+{
+    Node &node = nodes[index];
+    node.tds_ppm = wander(node.tds_ppm, 2.0f, 100.0f, 2000.0f);
+    node.ph = wander(node.ph, 0.01f, 4.0f, 8.0f);
+    node.temperature_c = wander(node.temperature_c, 0.02f, 10.0f, 35.0f);
+    node.timestamp_ms += 1000;
+
+    TelemetryRecord record;
+    record.sequence = node.sequence++;
+    record.timestamp_ms = node.timestamp_ms;
+    record.tds_ppm = node.tds_ppm;
+    record.ph = node.ph;
+    record.temperature_c = node.temperature_c;
+    record.status = TELEMETRY_TDS_VALID | TELEMETRY_PH_VALID | TELEMETRY_TEMP_VALID;
+    return telemetryEncode(record, frame, TELEMETRY_FRAME_SIZE);
+}
+
+bool LoadGenerator::send(uint16_t index)
+{
+    uint8_t frame[TELEMETRY_FRAME_SIZE];
+    size_t length = nextFrame(index, frame);
+    if (write(nodes[index].fd, frame, length) != (ssize_t)length)
+    {
+        send_failures++;
+        return false;
+    }
+    return true;
+}
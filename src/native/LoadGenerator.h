@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Telemetry.h"
+
+// Simulated fleet of nodes sending binary telemetry, for the collector.
+//
+// Every node has its own descriptor, a UDP socket connected to the collector
+// (so its source port tells it apart) or the slave side of a pty standing in
+// for a serial port. Records carry a sequence number and readings that
+// wander slowly around a level of their own per node, like real tanks.
+class LoadGenerator
+{
+public:
+    LoadGenerator(uint16_t node_count, uint32_t seed);
+    ~LoadGenerator();
+
+    // One loopback UDP socket per node connected to the port, false if any fails
+    bool openUdp(uint16_t port);
+
+    // Use the given descriptors, one per node, e.g. pty slaves. The generator closes them
+    void useStreams(const int *fds);
+
+    // Encode the next record of a node into frame, returns the frame length
+    size_t nextFrame(uint16_t node, uint8_t *frame);
+
+    // Send the next record of a node as one datagram or write, false if the kernel did not take it
+    bool send(uint16_t node);
+
+    // Sequence number the next record of a node gets
+    uint16_t sequence(uint16_t node) const { return nodes[node].sequence; }
+
+    int fd(uint16_t node) const { return nodes[node].fd; }
+    uint16_t nodeCount() const { return node_count; }
+    uint64_t sendFailures() const { return send_failures; }
+
+private:
+    struct Node
+    {
+        int fd;
+        uint16_t sequence;
+        uint32_t timestamp_ms;
+        float tds_ppm;
+        float ph;
+        float temperature_c;
+    };
+
+    float wander(float value, float step, float low, float high);
+    void closeAll();
+
+    Node *nodes;
+    uint16_t node_count;
+    uint32_t random;         // xorshift32 state
+    uint64_t send_failures;
+};
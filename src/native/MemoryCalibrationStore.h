@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string.h>
+#include "Calibration.h"
+
+// CalibrationStore in RAM for the host build. The blob is open to the
+// tests, which damage it the ways NVS can: bit flips, a cut write, an old
+// or foreign layout.
+class MemoryCalibrationStore : public CalibrationStore
+{
+public:
+    static const size_t CAPACITY = 256;
+
+    MemoryCalibrationStore() : length(0), writes(0) {}
+
+    size_t read(uint8_t *data, size_t capacity) override
+    {
+        if (length <= capacity)
+            memcpy(data, blob, length);
+        return length;
+    }
+
+    bool write(const uint8_t *data, size_t size) override
+    {
+        if (size > CAPACITY)
+            return false;
+        memcpy(blob, data, size);
+        length = size;
+        writes++;
+        return true;
+    }
+
+    bool erase() override
+    {
+        length = 0;
+        return true;
+    }
+
+    uint8_t blob[CAPACITY]; // Stored bytes
+    size_t length;          // Bytes in blob, 0 when empty
+    uint32_t writes;        // Successful writes
+};
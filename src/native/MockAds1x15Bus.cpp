@@ -0,0 +1,179 @@
+#include "MockAds1x15Bus.h"
+#include <math.h>
+#include <string.h>
+
+// Conversions per second of the DR codes
+static const uint16_t MOCK_ADS1115_RATES[8] = {8, 16, 32, 64, 128, 250, 475, 860};
+static const uint16_t MOCK_ADS1015_RATES[8] = {128, 250, 490, 920, 1600, 2400, 3300, 3300};
+
+// Full scale of the PGA codes in volts
+static const float MOCK_ADS_RANGES[8] = {6.144f, 4.096f, 2.048f, 1.024f, 0.512f, 0.256f, 0.256f, 0.256f};
+
+MockAds1x15Bus::MockAds1x15Bus(Signal signal, void *context, bool ads1015)
+    : transactions(0), busy_us(0), conversions(0), signal(signal), context(context), ads1015(ads1015), device_count(0)
+{
+    memset(inputs, 0, sizeof(inputs));
+}
+
+void MockAds1x15Bus::addDevice(uint8_t address, float clock_error)
+{
+    if (device_count == MAX_DEVICES)
+        return;
+    Device &device = devices[device_count++];
+    memset(&device, 0, sizeof(device));
+    device.address = address;
+    device.clock_error = clock_error;
+    // Power-on config: single-shot and powered down, nothing converting
+    configure(device, 0x0583, fake_now_us);
+}
+
+MockAds1x15Bus::Device *MockAds1x15Bus::find(uint8_t address)
+{
+    for (uint8_t i = 0; i < device_count; i++)
+        if (devices[i].address == address)
+            return &devices[i];
+    return NULL;
+}
+
+void MockAds1x15Bus::configure(Device &device, uint16_t config, uint32_t now_us)
+{
+    // Any config write restarts the conversion, in single-shot mode only with the OS bit set
+    bool single = config & 0x0100;
+    uint8_t rate = config >> 5 & 7;
+    uint16_t sps = ads1015 ? MOCK_ADS1015_RATES[rate] : MOCK_ADS1115_RATES[rate];
+    device.period_us = (uint32_t)(1e6 / sps * (1.0f + device.clock_error));
+    if (!single || (config & 0x8000))
+    {
+        device.converting = true;
+        device.done_us = now_us + device.period_us;
+    }
+    device.config = config & 0x7FFF;
+}
+
+void MockAds1x15Bus::settle(Device &device, uint32_t now_us)
+{
+    while (device.converting && (int32_t)(now_us - device.done_us) >= 0)
+    {
+        // Sampled at the end of the conversion, the signals the bench uses hold still over one
+        uint8_t input = device.config >> 12 & 3;
+        float range = MOCK_ADS_RANGES[device.config >> 9 & 7];
+        float code = roundf(signal(&device - devices, input, device.done_us, context) / range * 32768.0f);
+        code = code > 32767 ? 32767 : code < -32768 ? -32768 : code;
+        device.conversion = ads1015 ? (int16_t)code & ~0xF : (int16_t)code;
+        device.result_input = input;
+        conversions++;
+
+        // ALERT/RDY pulses in both modes, as if the comparator thresholds were set for conversion ready
+        if (device.pending++ == 0)
+            device.pending_us = device.done_us;
+        if (device.config & 0x0100)
+            device.converting = false;
+        else
+            device.done_us += device.period_us;
+    }
+}
+
+void MockAds1x15Bus::writeRegister(Device &device, const uint8_t *data, uint8_t length, uint32_t now_us)
+{
+    device.pointer = data[0] & 3;
+    if (length == 3 && device.pointer == 1)
+        configure(device, data[1] << 8 | data[2], now_us);
+}
+
+uint16_t MockAds1x15Bus::readRegister(Device &device, uint32_t now_us)
+{
+    if (device.pointer == 1)
+        return device.config | (device.converting ? 0 : 0x8000);
+    if (device.pointer != 0)
+        return 0;
+
+    InputStats &stats = inputs[&device - devices][device.result_input];
+    if (stats.reads++ > 0)
+    {
+        uint32_t gap = now_us - stats.last_us;
+        stats.gap_sum_us += gap;
+        if (gap > stats.gap_max_us)
+            stats.gap_max_us = gap;
+    }
+    stats.last_us = now_us;
+    return device.conversion;
+}
+
+bool MockAds1x15Bus::transfer(const I2cTransfer *transfers, uint8_t count)
+{
+    // Every part takes its address byte, its data and the acknowledges, at the time the bus gets to it
+    transactions++;
+    uint32_t start_us = fake_now_us;
+    uint64_t elapsed_ns = TRANSACTION_US * 1000ULL;
+    bool ok = true;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        const I2cTransfer &transfer = transfers[i];
+        Device *device = find(transfer.address);
+        if (transfer.write_length > 0)
+        {
+            elapsed_ns += (1 + transfer.write_length) * 9 * BIT_NS;
+            uint32_t at_us = start_us + elapsed_ns / 1000;
+            if (device)
+            {
+                settle(*device, at_us);
+                writeRegister(*device, transfer.write, transfer.write_length, at_us);
+            }
+        }
+        if (transfer.read_length > 0)
+        {
+            elapsed_ns += (1 + transfer.read_length) * 9 * BIT_NS;
+            uint32_t at_us = start_us + elapsed_ns / 1000;
+            if (device)
+            {
+                settle(*device, at_us);
+                uint16_t value = readRegister(*device, at_us);
+                for (uint8_t b = 0; b < transfer.read_length; b++)
+                    transfer.read[b] = b == 0 ? value >> 8 : b == 1 ? value & 0xFF : 0;
+            }
+        }
+        // A missing device does not acknowledge its address, the rest of the batch is aborted
+        if (!device)
+        {
+            ok = false;
+            break;
+        }
+    }
+    uint32_t took_us = (elapsed_ns + 999) / 1000;
+    busy_us += took_us;
+    fakeSpend(took_us);
+    return ok;
+}
+
+uint32_t MockAds1x15Bus::nextAlert(uint8_t &device)
+{
+    uint32_t earliest = UINT32_MAX;
+    for (uint8_t i = 0; i < device_count; i++)
+    {
+        Device &d = devices[i];
+        uint32_t at;
+        if (d.pending > 0)
+            at = d.pending_us;
+        else if (d.converting)
+            at = d.done_us;
+        else
+            continue;
+        if (earliest == UINT32_MAX || (int32_t)(at - earliest) < 0)
+        {
+            earliest = at;
+            device = i;
+        }
+    }
+    return earliest;
+}
+
+void MockAds1x15Bus::takeAlert(uint8_t device)
+{
+    Device &d = devices[device];
+    settle(d, fake_now_us);
+    if (d.pending == 0)
+        return;
+    // The newer pulses are one period apart
+    if (--d.pending > 0)
+        d.pending_us += d.period_us;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "I2cBus.h"
+#include "FakeClock.h"
+
+// Host stand-in for an I2C bus with a chain of ADS1115 / ADS1015 converters.
+// Transactions cost fake time like the real bus at 400 kHz plus the driver's
+// setup, and the devices convert on their own clocks in the background: a
+// config write restarts the conversion, continuous mode latches a result and
+// pulses ALERT/RDY at the end of every conversion, single-shot mode clears
+// the OS bit until its one conversion is done. The bench delivers the pulses
+// to the source as the pin interrupts would.
+class MockAds1x15Bus : public I2cBus
+{
+public:
+    static const uint8_t MAX_DEVICES = 4;
+
+    // Bus timing in microseconds
+    static const uint32_t BIT_NS = 2500;         // 400 kHz
+    static const uint32_t TRANSACTION_US = 40;   // Driver and controller setup of one transaction
+
+    // Volts on a device input at a time
+    typedef float (*Signal)(uint8_t device, uint8_t input, uint32_t time_us, void *context);
+
+    MockAds1x15Bus(Signal signal, void *context, bool ads1015);
+
+    // Put a device on the bus, clock_error is how far its oscillator is off, e.g. 0.05 for 5% slow
+    void addDevice(uint8_t address, float clock_error);
+
+    bool transfer(const I2cTransfer *transfers, uint8_t count) override;
+
+    // The earliest ALERT/RDY pulse not delivered yet and its device, UINT32_MAX time without a running device
+    uint32_t nextAlert(uint8_t &device);
+
+    // Take the earliest pulse of a device, the conversion behind it has finished by now
+    void takeAlert(uint8_t device);
+
+    uint32_t transactions;   // Bus transactions
+    uint64_t busy_us;        // Time the bus was held
+    uint64_t conversions;    // Conversions the devices finished
+
+    // Per input: results read back, the time between two of them
+    struct InputStats
+    {
+        uint32_t reads;
+        uint32_t last_us;
+        uint64_t gap_sum_us;
+        uint32_t gap_max_us;
+    };
+    InputStats inputs[MAX_DEVICES][4];
+
+private:
+    struct Device
+    {
+        uint8_t address;
+        uint32_t period_us;     // One conversion at the configured rate and this device's clock
+        float clock_error;
+        uint8_t pointer;
+        uint16_t config;
+        int16_t conversion;     // Latched result
+        uint8_t result_input;   // Input the latched result was converted from
+        bool converting;
+        uint32_t done_us;       // End of the running conversion
+        uint8_t pending;        // ALERT/RDY pulses not delivered yet
+        uint32_t pending_us;    // Time of the oldest of them
+    };
+
+    Device *find(uint8_t address);
+    void configure(Device &device, uint16_t config, uint32_t now_us);
+    void settle(Device &device, uint32_t now_us);   // Finish the conversions due by now
+    void writeRegister(Device &device, const uint8_t *data, uint8_t length, uint32_t now_us);
+    uint16_t readRegister(Device &device, uint32_t now_us);
+
+    Signal signal;
+    void *context;
+    bool ads1015;
+    Device devices[MAX_DEVICES];
+    uint8_t device_count;
+};
@@ -0,0 +1,93 @@
+#include "MockTemperatureBus.h"
+#include <string.h>
+
+uint8_t MockTemperatureBus::addProbe(float celsius)
+{
+    Probe &probe = probes[probe_count];
+    memset(&probe, 0, sizeof(probe));
+
+    // DS18B20 family code followed by a made up serial number
+    probe.address[0] = 0x28;
+    probe.address[1] = probe_count + 1;
+    probe.celsius = celsius;
+    probe.connected = true;
+    probe.resolution = 12;
+    probe.scratchpad = 85.0f;
+    return probe_count++;
+}
+
+uint8_t MockTemperatureBus::scan()
+{
+    // A search takes one transaction per device found
+    scans++;
+    for (uint8_t i = 0; i < probe_count; i++)
+        spend(COMMAND_US);
+    return probe_count;
+}
+
+bool MockTemperatureBus::address(uint8_t index, ProbeAddress address)
+{
+    if (index >= probe_count)
+        return false;
+    memcpy(address, probes[index].address, sizeof(ProbeAddress));
+    return true;
+}
+
+bool MockTemperatureBus::setResolution(const ProbeAddress address, uint8_t bits)
+{
+    spend(COMMAND_US);
+    int index = find(address);
+    if (index < 0)
+        return false;
+    probes[index].resolution = bits;
+    return true;
+}
+
+bool MockTemperatureBus::startConversion(const ProbeAddress address)
+{
+    spend(COMMAND_US);
+    int index = find(address);
+    if (index < 0)
+        return false;
+    probes[index].ready_us = fake_now_us + probeConversionTimeUs(probes[index].resolution);
+    return true;
+}
+
+float MockTemperatureBus::readCelsius(const ProbeAddress address)
+{
+    spend(READ_US);
+    int index = find(address);
+    if (index < 0)
+        return PROBE_DISCONNECTED_C;
+
+    // Reading too early returns whatever is still in the scratchpad
+    Probe &probe = probes[index];
+    if ((int32_t)(fake_now_us - probe.ready_us) < 0)
+    {
+        early_reads++;
+        return probe.scratchpad;
+    }
+
+    // Quantise to the configured resolution like the real part
+    float step = 0.0625f * (1 << (12 - probe.resolution));
+    probe.scratchpad = (int)(probe.celsius / step) * step;
+    return probe.scratchpad;
+}
+
+int MockTemperatureBus::find(const ProbeAddress address)
+{
+    for (uint8_t i = 0; i < probe_count; i++)
+    {
+        if (probes[i].connected && memcmp(probes[i].address, address, sizeof(ProbeAddress)) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void MockTemperatureBus::spend(uint32_t us)
+{
+    transactions++;
+    fakeSpend(us);
+    if (us > longest_call_us)
+        longest_call_us = us;
+}
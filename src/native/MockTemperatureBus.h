@@ -0,0 +1,56 @@
+#pragma once
+
+#include "TemperatureBus.h"
+#include "FakeClock.h"
+
+// Host stand-in for a OneWire bus with DS18B20 probes.
+// Bus transactions cost fake time like the real ones, conversions run in the
+// background, and reading a probe before its conversion is done returns the
+// 85 C power-on value like the real part. The counters let the simulation
+// check that the engine never waits on a conversion.
+class MockTemperatureBus : public TemperatureBus
+{
+public:
+    static const uint8_t MAX_PROBES = 8;
+
+    // Cost of the bus transactions in microseconds
+    static const uint32_t COMMAND_US = 1100; // Reset, match ROM and one command byte
+    static const uint32_t READ_US = 5500;    // Reset, match ROM and a 9 byte scratchpad read
+
+    MockTemperatureBus() : early_reads(0), longest_call_us(0), transactions(0), scans(0), probe_count(0) {}
+
+    // Put a probe on the bus, returns its index
+    uint8_t addProbe(float celsius);
+
+    // Change the temperature a probe will measure, or unplug it
+    void setTemperature(uint8_t index, float celsius) { probes[index].celsius = celsius; }
+    void setConnected(uint8_t index, bool connected) { probes[index].connected = connected; }
+
+    uint8_t scan() override;
+    bool address(uint8_t index, ProbeAddress address) override;
+    bool setResolution(const ProbeAddress address, uint8_t bits) override;
+    bool startConversion(const ProbeAddress address) override;
+    float readCelsius(const ProbeAddress address) override;
+
+    uint32_t early_reads;     // Reads that happened before the conversion finished
+    uint32_t longest_call_us; // Longest time a single call kept the caller busy
+    uint32_t transactions;    // Number of bus transactions
+    uint32_t scans;           // Number of bus searches
+
+private:
+    struct Probe
+    {
+        ProbeAddress address; // Simulated ROM address
+        float celsius;        // Temperature the probe will measure
+        bool connected;       // Unplugged probes do not answer
+        uint8_t resolution;   // Configured resolution
+        uint32_t ready_us;    // When the running conversion finishes
+        float scratchpad;     // Value in the scratchpad, 85 C after power-on
+    };
+
+    int find(const ProbeAddress address);
+    void spend(uint32_t us);
+
+    Probe probes[MAX_PROBES];
+    uint8_t probe_count;
+};
@@ -0,0 +1,230 @@
+#include "MqttBrokerStandIn.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "SeriesCodec.h"
+
+BrokerSession::BrokerSession(BrokerStats &stats, BrokerHook hook, void *context)
+    : silent(false), stats(stats), hook(hook), context(context)
+{
+}
+
+void BrokerSession::reset()
+{
+    in.clear();
+    out.clear();
+}
+
+void BrokerSession::feed(const uint8_t *data, size_t length)
+{
+    stats.bytes += length;
+    if (silent)
+        return;
+    in.insert(in.end(), data, data + length);
+
+    // Every complete packet: type byte, remaining length of up to four bytes, body
+    for (;;)
+    {
+        size_t remaining = 0, header = 1;
+        bool complete = false;
+        for (uint8_t shift = 0; header < in.size() && header <= 4; shift += 7)
+        {
+            uint8_t byte = in[header++];
+            remaining |= (size_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+            {
+                complete = true;
+                break;
+            }
+        }
+        if (!complete || in.size() < header + remaining)
+            return;
+        handlePacket(in[0], in.data() + header, remaining);
+        in.erase(in.begin(), in.begin() + header + remaining);
+    }
+}
+
+size_t BrokerSession::take(uint8_t *data, size_t length)
+{
+    size_t taken = out.size() < length ? out.size() : length;
+    memcpy(data, out.data(), taken);
+    out.erase(out.begin(), out.begin() + taken);
+    return taken;
+}
+
+void BrokerSession::handlePacket(uint8_t header, const uint8_t *body, size_t length)
+{
+    switch (header & 0xF0)
+    {
+    case 0x10:
+    {
+        static const uint8_t accepted[] = {0, 0};
+        stats.connects++;
+        answer(0x20, accepted, sizeof(accepted));
+        break;
+    }
+    case 0x30:
+    {
+        // Topic, the packet id at QoS 1, then the batch frame with its delimiters
+        if (length < 2)
+            return;
+        size_t position = 2 + (body[0] << 8 | body[1]);
+        bool qos = (header & 0x06) != 0;
+        uint8_t id[2] = {0, 0};
+        if (qos && position + 2 <= length)
+        {
+            memcpy(id, body + position, 2);
+            position += 2;
+        }
+        bool duplicate = (header & 0x08) != 0;
+        stats.publishes++;
+        if (duplicate)
+            stats.duplicates++;
+
+        uint8_t block[TELEMETRY_BATCH_MAX];
+        size_t block_length = 0;
+        uint16_t count = 0;
+        if (position + 2 > length || !telemetryDecodeBatch(body + position + 1, length - position - 2, block, block_length, count))
+            stats.bad_payloads++;
+        else
+        {
+            SeriesDecoder decoder(block, block_length, count);
+            TelemetryRecord record;
+            while (decoder.next(record))
+            {
+                stats.records++;
+                if (hook)
+                    hook(record, duplicate, context);
+            }
+        }
+        if (qos)
+            answer(0x40, id, sizeof(id));
+        break;
+    }
+    case 0xC0:
+        stats.pings++;
+        answer(0xD0, NULL, 0);
+        break;
+    default:
+        break;
+    }
+}
+
+void BrokerSession::answer(uint8_t type, const uint8_t *body, size_t length)
+{
+    out.push_back(type);
+    out.push_back((uint8_t)length);
+    out.insert(out.end(), body, body + length);
+}
+
+bool LoopbackTransport::connect(const char *host, uint16_t port)
+{
+    connects++;
+    current = TRANSPORT_CLOSED;
+    if (!reachable)
+        return false;
+    session.reset();
+    pending_polls = connect_polls;
+    current = connect_polls > 0 ? TRANSPORT_CONNECTING : TRANSPORT_OPEN;
+    return true;
+}
+
+TransportState LoopbackTransport::state()
+{
+    if (current == TRANSPORT_CONNECTING && --pending_polls == 0)
+        current = TRANSPORT_OPEN;
+    return current;
+}
+
+size_t LoopbackTransport::write(const uint8_t *data, size_t length)
+{
+    if (current != TRANSPORT_OPEN)
+        return 0;
+    if (budget >= 0 && (int64_t)length > budget)
+        length = budget;
+    if (budget >= 0)
+        budget -= length;
+    session.feed(data, length);
+    return length;
+}
+
+size_t LoopbackTransport::read(uint8_t *data, size_t length)
+{
+    return current == TRANSPORT_OPEN ? session.take(data, length) : 0;
+}
+
+void LoopbackTransport::setReachable(bool reachable)
+{
+    this->reachable = reachable;
+    if (!reachable)
+        current = TRANSPORT_CLOSED;
+}
+
+uint16_t TcpBrokerStandIn::start()
+{
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0)
+        return 0;
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(listener, (sockaddr *)&address, sizeof(address)) < 0 || listen(listener, 4) < 0 ||
+        getsockname(listener, (sockaddr *)&address, &length) < 0)
+    {
+        close(listener);
+        listener = -1;
+        return 0;
+    }
+    running = true;
+    thread = std::thread(&TcpBrokerStandIn::serve, this);
+    return ntohs(address.sin_port);
+}
+
+void TcpBrokerStandIn::stop()
+{
+    if (!running)
+        return;
+    running = false;
+    thread.join();
+    close(listener);
+    listener = -1;
+}
+
+void TcpBrokerStandIn::serve()
+{
+    BrokerSession session(counters, hook, context);
+    uint8_t buffer[4096];
+    while (running)
+    {
+        pollfd waiting = {listener, POLLIN, 0};
+        if (poll(&waiting, 1, 50) <= 0)
+            continue;
+        int client = accept(listener, NULL, NULL);
+        if (client < 0)
+            continue;
+        session.reset();
+
+        // One client until it goes away, answers are written out straight after every read
+        while (running)
+        {
+            pollfd readable = {client, POLLIN, 0};
+            if (poll(&readable, 1, 50) <= 0)
+                continue;
+            ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+            if (received <= 0)
+                break;
+            session.feed(buffer, received);
+            size_t answers;
+            while ((answers = session.take(buffer, sizeof(buffer))) > 0)
+                send(client, buffer, answers, MSG_NOSIGNAL);
+        }
+        close(client);
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "NetworkTransport.h"
+#include "Telemetry.h"
+
+// Broker stand-ins for the MQTT publisher on the host.
+//
+// A BrokerSession speaks the broker side of what the publisher sends
+// (CONNECT, QoS 1 PUBLISH, PINGREQ) and decodes every payload back into
+// records. LoopbackTransport connects the publisher to a session in the same
+// process and can take the link away in the ways a board sees it: refused
+// connects, a dropped connection, a slow link and a broker that silently
+// stops answering. TcpBrokerStandIn serves sessions on a localhost port for
+// the real SocketTransport.
+
+// Called for every record of every accepted PUBLISH, duplicates included
+typedef void (*BrokerHook)(const TelemetryRecord &record, bool duplicate, void *context);
+
+// Counters over all sessions
+struct BrokerStats
+{
+    uint64_t connects;      // CONNECT packets answered
+    uint64_t publishes;     // PUBLISH packets acknowledged
+    uint64_t duplicates;    // Of them with the DUP flag
+    uint64_t records;       // Records decoded from the payloads
+    uint64_t bad_payloads;  // Payloads that were not a valid batch frame
+    uint64_t pings;
+    uint64_t bytes;         // Bytes received
+};
+
+class BrokerSession
+{
+public:
+    BrokerSession(BrokerStats &stats, BrokerHook hook, void *context);
+
+    // New connection, forgets any partial packet and unsent answers
+    void reset();
+
+    // Bytes from the client, answers collect until take()
+    void feed(const uint8_t *data, size_t length);
+    size_t take(uint8_t *data, size_t length);
+
+    // Swallow everything without answering, like a broker behind a dead link
+    bool silent;
+
+private:
+    void handlePacket(uint8_t header, const uint8_t *body, size_t length);
+    void answer(uint8_t type, const uint8_t *body, size_t length);
+
+    BrokerStats &stats;
+    BrokerHook hook;
+    void *context;
+    std::vector<uint8_t> in;   // Unfinished packet
+    std::vector<uint8_t> out;  // Answers not taken yet
+};
+
+// NetworkTransport straight into a session
+class LoopbackTransport : public NetworkTransport
+{
+public:
+    explicit LoopbackTransport(BrokerSession &session) : session(session), current(TRANSPORT_CLOSED), reachable(true),
+        connect_polls(0), pending_polls(0), budget(-1) {}
+
+    bool connect(const char *host, uint16_t port) override;
+    TransportState state() override;
+    size_t write(const uint8_t *data, size_t length) override;
+    size_t read(uint8_t *data, size_t length) override;
+    void close() override { current = TRANSPORT_CLOSED; }
+
+    // Outage: connects fail and an open connection is reset
+    void setReachable(bool reachable);
+
+    // A connect finishes after this many state() calls
+    void setConnectPolls(uint32_t polls) { connect_polls = polls; }
+
+    // Bytes the link takes until the next call, -1 for no limit
+    void setBudget(int64_t bytes) { budget = bytes; }
+
+    uint32_t connects = 0;  // Connects started
+
+private:
+    BrokerSession &session;
+    TransportState current;
+    bool reachable;
+    uint32_t connect_polls;
+    uint32_t pending_polls;
+    int64_t budget;
+};
+
+// Sessions on a localhost TCP port, one client at a time on a thread of its own
+class TcpBrokerStandIn
+{
+public:
+    TcpBrokerStandIn(BrokerHook hook, void *context) : hook(hook), context(context), listener(-1), running(false), counters() {}
+    ~TcpBrokerStandIn() { stop(); }
+
+    // Listen on 127.0.0.1, returns the port or 0 on failure
+    uint16_t start();
+    void stop();
+
+    // Read after stop(), the thread owns them while it runs
+    const BrokerStats &stats() const { return counters; }
+
+private:
+    void serve();
+
+    BrokerHook hook;
+    void *context;
+    int listener;
+    std::atomic<bool> running;
+    std::thread thread;
+    BrokerStats counters;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+// Entry points of the native program, picked by the first command line argument.
+// Each gets the arguments after the command name and returns the process exit code.
+
+// Run the full sensor pipeline against the fake clock and the simulated sensors (default).
+// Arguments: [script file] [seconds]
+int simulateScheduler(int argc, char **argv);
+
+// Compare the streaming filters against the old sort based code
+int benchFilters(int argc, char **argv);
+
+// Compare the float and fixed-point sensor math against the old double code
+int benchMath(int argc, char **argv);
+
+// Decode a binary telemetry capture from stdin into CSV
+int decodeTelemetry(int argc, char **argv);
+
+// Flash log append and scan throughput on the file-backed emulator
+int benchFlashLog(int argc, char **argv);
+
+// Light and deep sleep duty cycles, wake latency and the RTC resume state
+int simulateSleep(int argc, char **argv);
+
+// Collect the telemetry of many nodes over UDP and serial ports into a columnar store.
+// Arguments: [port] [seconds] [tty ...]
+int collectTelemetry(int argc, char **argv);
+
+// Play a fleet of simulated nodes against the collector.
+// Arguments: [nodes] [records per second] [seconds] [port]
+int generateLoad(int argc, char **argv);
+
+// Collector throughput, ingest latency and query speed
+int benchCollector(int argc, char **argv);
+
+// PID dosing against a reservoir model, and the control tick jitter on the host
+int simulateDosing(int argc, char **argv);
+
+// Cost of a calibrated conversion against the old line and cubic, and of rebuilding the curves
+int checkCalibration(int argc, char **argv);
+
+// Profiler scope overhead and the pipeline stages it times
+int benchProfiler(int argc, char **argv);
+
+// Injected probe faults over many seeds: detection, classification, latency, false alarms and recovery
+int simulateFaults(int argc, char **argv);
+
+// Adaptive sampling against the fixed rates on a replayed trace: accuracy, conversions, bus time and charge.
+// Arguments: [trace csv from decode or history]
+int benchAdaptive(int argc, char **argv);
+
+// Compressed history: ratio against the other formats, encode and decode speed and the rollup tiers
+int benchSeries(int argc, char **argv);
+
+// Batched MQTT publishing: messages per second in process and over localhost TCP, the offline queue through outages
+int benchMqtt(int argc, char **argv);
+
+// ADS1x15 chain on the mock bus: samples per second, scan latency and bus load batched, unbatched and polled,
+// and extra probes through the pipeline
+int benchAds(int argc, char **argv);
+
+// Compile-time pipeline layouts: the pins, the static RAM and what every probe reports through the pipeline
+int checkLayout(int argc, char **argv);
+
+// Replay a raw trace through the pipeline at full speed: accuracy at the references, samples per second and the
+// stage costs, checked against a baseline file or written to it. Arguments: [trace file or -] [baseline file]
+int benchReplay(int argc, char **argv);
+
+// Record the built-in trace of bench-replay to a file, as a board's capture would be. Arguments: <file>
+int recordTrace(int argc, char **argv);
+
+// Oversampling decimator: the kernel's cost against plain loops and a double reference, effective bits gained
+// against the cycles spent, and the pipeline oversampled against the base rate
+int benchDecimate(int argc, char **argv);
+
+// Kalman fusion of the three sensors on a simulated reservoir: error and bound coverage against the filters at the
+// base rate and on a quarter of the samples, and the cost of an update
+int benchFusion(int argc, char **argv);
@@ -0,0 +1,25 @@
+#include <chrono>
+#include "Hal.h"
+#include "FakeClock.h"
+#include "NativeHal.h"
+
+// Fake clock - Simulated microsecond counter, only moves when we advance it
+uint32_t fake_now_us = 0;
+
+// Sensors behind halAnalogRead(), set up by the simulation
+SimulatedSensors simulated_sensors;
+
+uint32_t halMicros() { return fake_now_us; }
+
+uint32_t halMillis() { return fake_now_us / 1000; }
+
+uint32_t halCycles()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t halCyclesPerUs() { return 1000; }
+
+uint16_t halAnalogRead(uint8_t pin) { return simulated_sensors.analogRead(pin, fake_now_us); }
+
+void halDelay(uint32_t ms) { fakeSpend(ms * 1000); }
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "SimulatedSensors.h"
+
+// Sensors the native HAL reads from, halAnalogRead() samples the one bound to the pin at the fake time
+extern SimulatedSensors simulated_sensors;
@@ -0,0 +1,14 @@
+#include "ReferenceAdcCurve.h"
+
+#define REFERENCE_VREF_MV 1100
+#define REFERENCE_COEFF_SCALE 65536
+
+const ReferenceAdcUnit REFERENCE_ADC1 = {196602, 142};
+const ReferenceAdcUnit REFERENCE_ADC2 = {197436, 128};
+
+uint32_t referenceAdcMillivolts(uint16_t raw, const void *context)
+{
+    const ReferenceAdcUnit *unit = static_cast<const ReferenceAdcUnit *>(context);
+    uint32_t coeff_a = REFERENCE_VREF_MV * unit->atten_scale / 4096;
+    return (coeff_a * raw + REFERENCE_COEFF_SCALE / 2) / REFERENCE_COEFF_SCALE + unit->atten_offset;
+}
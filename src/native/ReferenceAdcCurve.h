@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+// Linear characterisation esp_adc_cal falls back to for an uncalibrated chip
+// (default 1100 mV Vref, 11 dB attenuation, 12-bit width). The host build
+// uses it wherever the board would use the eFuse data.
+struct ReferenceAdcUnit
+{
+    uint32_t atten_scale;  // Per unit scale for 11 dB
+    uint32_t atten_offset; // Per unit offset in millivolts for 11 dB
+};
+
+extern const ReferenceAdcUnit REFERENCE_ADC1;
+extern const ReferenceAdcUnit REFERENCE_ADC2;
+
+// AdcCalibration::Curve, context is a ReferenceAdcUnit
+uint32_t referenceAdcMillivolts(uint16_t raw, const void *context);
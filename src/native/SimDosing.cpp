@@ -0,0 +1,368 @@
+// Host simulation of the dosing loop against a reservoir model.
+//
+// The reservoir: nutrient uptake lowers the TDS and the pH creeps up over
+// the hours, a dose first sits in a mixing stage it leaves with a time
+// constant, and the probes see the tank through a transport delay and some
+// noise. Concentrate also pulls the pH down a little, and acid works harder
+// the lower the pH already is, so the controller's response figures are
+// only approximately right. Every scenario runs six simulated hours on the
+// fake clock at the firmware's control tick: the tuned loop, then with one
+// feature at a time taken out, or for the feed-forward (off by default)
+// switched on.
+//
+// The second half runs the control step for real on Linux: once from its own
+// absolute-time paced thread as the hardware timer task does, once at the
+// end of a loop that also does variable length sensor I/O, and reports the
+// lateness of both through ControlTiming.
+// sim-dose, exits non-zero if the tuned loop does not settle.
+#include <math.h>
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <time.h>
+#include "NativeCommands.h"
+#include "DosingController.h"
+#include "ControlTiming.h"
+#include "Bench.h"
+
+#define SIM_TICK_MS 10              // Control tick of the firmware
+#define SIM_HOURS 6
+#define SIM_SENSE_MS 1000           // A filtered reading per second reaches the controller
+#define SIM_DEAD_TIME_S 30          // Pump outlet to probe transport delay
+#define SIM_MIX_TAU_S 240.0f        // Mixing stage time constant, a tank without a circulation pump
+#define SIM_TDS_SETPOINT 1100.0f    // Middle of the 750 to 1500 ppm target
+#define SIM_PH_SETPOINT 6.0f
+#define SIM_TDS_BAND 30.0f          // Settled once inside this band for good
+#define SIM_PH_BAND 0.1f
+#define SIM_TIMING_TICKS 1000
+#define SIM_TIMING_PERIOD_US 2000
+
+// Reservoir chemistry, 100 L of nutrient solution
+struct Reservoir
+{
+    float tds_ppm;
+    float ph;
+    float nutrient_mixing_ml;   // Dosed but not mixed in yet
+    float acid_mixing_ml;
+    float sensed_tds[SIM_DEAD_TIME_S];  // What the probes see, one entry per second of transport delay
+    float sensed_ph[SIM_DEAD_TIME_S];
+    uint32_t random;
+
+    Reservoir(float tds_ppm, float ph) : tds_ppm(tds_ppm), ph(ph), nutrient_mixing_ml(0), acid_mixing_ml(0), random(12345)
+    {
+        for (uint8_t i = 0; i < SIM_DEAD_TIME_S; i++)
+        {
+            sensed_tds[i] = tds_ppm;
+            sensed_ph[i] = ph;
+        }
+    }
+
+    // Standard normal sample, Box-Muller on xorshift32
+    float noise()
+    {
+        float u1 = (benchRandom(random) + 1.0f) / 4294967296.0f;
+        float u2 = benchRandom(random) / 4294967296.0f;
+        return sqrtf(-2.0f * logf(u1)) * cosf(6.2831853f * u2);
+    }
+
+    void step(float dt_s, bool nutrient_pump, bool acid_pump)
+    {
+        const float pump_ml_per_s = 1.0f;
+        if (nutrient_pump)
+            nutrient_mixing_ml += pump_ml_per_s * dt_s;
+        if (acid_pump)
+            acid_mixing_ml += pump_ml_per_s * dt_s;
+
+        // First order mixing, concentrate is 3 ppm per mL and slightly acidic
+        float nutrient = nutrient_mixing_ml * dt_s / SIM_MIX_TAU_S;
+        float acid = acid_mixing_ml * dt_s / SIM_MIX_TAU_S;
+        nutrient_mixing_ml -= nutrient;
+        acid_mixing_ml -= acid;
+        tds_ppm += nutrient * 3.0f;
+        ph -= nutrient * 0.0015f;
+        ph -= acid * 0.012f * (1.0f + fmaxf(0.0f, 6.2f - ph));
+
+        // Uptake of 40 ppm and a pH rise of 0.1 per hour
+        tds_ppm -= 40.0f * dt_s / 3600.0f;
+        ph += 0.1f * dt_s / 3600.0f;
+    }
+
+    // Once per second: the probes see the tank as it was SIM_DEAD_TIME_S ago
+    void sense(float &tds_out, float &ph_out)
+    {
+        tds_out = sensed_tds[0] + 3.0f * noise();
+        ph_out = sensed_ph[0] + 0.01f * noise();
+        for (uint8_t i = 0; i + 1 < SIM_DEAD_TIME_S; i++)
+        {
+            sensed_tds[i] = sensed_tds[i + 1];
+            sensed_ph[i] = sensed_ph[i + 1];
+        }
+        sensed_tds[SIM_DEAD_TIME_S - 1] = tds_ppm;
+        sensed_ph[SIM_DEAD_TIME_S - 1] = ph;
+    }
+};
+
+// The firmware's defaults, the response figures are the nominal ones the plant only roughly follows
+static DosingConfig simNutrientConfig()
+{
+    DosingConfig config;
+    config.setpoint = SIM_TDS_SETPOINT;
+    config.deadband = 10.0f;
+    config.kp = 0.6f;
+    config.ki = 0.002f;
+    config.kd = 0.0f;
+    config.kff = 0.0f;
+    config.response_per_ml = 3.3f;
+    config.max_dose_ml = 20.0f;
+    config.max_ml_per_hour = 300.0f;
+    config.pump_ml_per_s = 1.0f;
+    config.period_ms = 30000;
+    config.mixing_ms = 600000;
+    config.max_age_ms = 5000;
+    config.anti_windup = true;
+    return config;
+}
+
+static DosingConfig simAcidConfig()
+{
+    DosingConfig config = simNutrientConfig();
+    config.setpoint = SIM_PH_SETPOINT;
+    config.deadband = 0.03f;
+    config.response_per_ml = -0.012f;
+    config.max_dose_ml = 10.0f;
+    config.max_ml_per_hour = 90.0f;
+    return config;
+}
+
+// How one channel did over a run
+struct SimOutcome
+{
+    float settle_min;     // Last time it entered the band for good, minutes
+    float overshoot;      // Furthest past the setpoint on the side the pump can not correct
+    float rms;            // Error after settling
+    float dosed_ml;
+    uint32_t doses;
+};
+
+struct SimTracker
+{
+    float setpoint, band;
+    int8_t direction;     // +1 the pump raises the value, -1 it lowers it
+    uint32_t last_outside_ms;
+    float overshoot;
+    double squares;
+    uint32_t samples;
+
+    SimTracker(float setpoint, float band, int8_t direction)
+        : setpoint(setpoint), band(band), direction(direction), last_outside_ms(0), overshoot(0), squares(0), samples(0)
+    {
+    }
+
+    void sample(float value, uint32_t now_ms)
+    {
+        float error = value - setpoint;
+        if (fabsf(error) > band)
+        {
+            last_outside_ms = now_ms;
+            squares = 0;
+            samples = 0;
+        }
+        else
+        {
+            squares += error * error;
+            samples++;
+        }
+        float past = error * direction;
+        if (past > overshoot)
+            overshoot = past;
+    }
+
+    SimOutcome outcome(const DosingController &controller) const
+    {
+        SimOutcome result;
+        result.settle_min = last_outside_ms / 60000.0f;
+        result.overshoot = overshoot;
+        result.rms = samples ? sqrt(squares / samples) : NAN;
+        result.dosed_ml = controller.stats().dosed_ml;
+        result.doses = controller.stats().doses;
+        return result;
+    }
+};
+
+static void simDoseRun(const char *label, DosingConfig nutrient_config, DosingConfig acid_config, float start_tds,
+                       float start_ph, SimOutcome &tds_out, SimOutcome &ph_out)
+{
+    Reservoir tank(start_tds, start_ph);
+    DosingController nutrient(nutrient_config);
+    DosingController acid(acid_config);
+    nutrient.enable(true);
+    acid.enable(true);
+    SimTracker tds_track(SIM_TDS_SETPOINT, SIM_TDS_BAND, 1);
+    SimTracker ph_track(SIM_PH_SETPOINT, SIM_PH_BAND, -1);
+
+    bool nutrient_pump = false, acid_pump = false;
+    for (uint32_t now_ms = 0; now_ms < SIM_HOURS * 3600000UL; now_ms += SIM_TICK_MS)
+    {
+        tank.step(SIM_TICK_MS / 1000.0f, nutrient_pump, acid_pump);
+        if (now_ms % SIM_SENSE_MS == 0)
+        {
+            float tds, ph;
+            tank.sense(tds, ph);
+            nutrient.measure(tds, now_ms);
+            acid.measure(ph, now_ms);
+            tds_track.sample(tank.tds_ppm, now_ms);
+            ph_track.sample(tank.ph, now_ms);
+        }
+        nutrient_pump = nutrient.tick(now_ms);
+        acid_pump = acid.tick(now_ms);
+    }
+
+    tds_out = tds_track.outcome(nutrient);
+    ph_out = ph_track.outcome(acid);
+    printf("%-16s %7.1f %7.1f %6.1f %7.1f %4u | %7.1f %6.2f %6.3f %6.1f %4u\n", label, tds_out.settle_min,
+           tds_out.overshoot, tds_out.rms, tds_out.dosed_ml, (unsigned)tds_out.doses, ph_out.settle_min, ph_out.overshoot,
+           ph_out.rms, ph_out.dosed_ml, (unsigned)ph_out.doses);
+}
+
+// Control step of the timing runs, one tick of both loops on a fixed measurement
+struct SimTimingStep
+{
+    DosingController nutrient;
+    DosingController acid;
+    uint32_t now_ms;
+
+    SimTimingStep() : nutrient(simNutrientConfig()), acid(simAcidConfig()), now_ms(0)
+    {
+        nutrient.enable(true);
+        acid.enable(true);
+    }
+
+    void run()
+    {
+        nutrient.measure(1000.0f, now_ms);
+        acid.measure(6.3f, now_ms);
+        benchKeep(nutrient.tick(now_ms));
+        benchKeep(acid.tick(now_ms));
+        now_ms += SIM_TICK_MS;
+    }
+};
+
+// Busy wait standing in for a OneWire conversion, a flash write or a long print
+static void simSensorIo(uint32_t &random)
+{
+    uint64_t until = benchNanos() + 200000 + benchRandom(random) % 3000000;
+    while (benchNanos() < until)
+    {
+    }
+}
+
+static void simTimingReport(const char *label, const ControlTiming &timing)
+{
+    const ControlTimingStats &stats = timing.stats();
+    printf("%-22s lateness us: min %u avg %u p50 <%u p99 <%u max %u, %u missed of %u\n", label,
+           (unsigned)stats.lateness_min_us, (unsigned)(stats.lateness_sum_us / stats.ticks), (unsigned)timing.percentile(50),
+           (unsigned)timing.percentile(99), (unsigned)stats.lateness_max_us, (unsigned)stats.missed, (unsigned)stats.ticks);
+}
+
+static void simDoseTiming()
+{
+    // Dedicated thread paced on absolute deadlines, sensor I/O busy on another thread
+    std::atomic<bool> io_running(true);
+    std::thread io([&io_running]() {
+        uint32_t random = 99;
+        while (io_running.load(std::memory_order_relaxed))
+            simSensorIo(random);
+    });
+
+    ControlTiming paced;
+    SimTimingStep paced_step;
+    timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    uint64_t ideal = (uint64_t)next.tv_sec * 1000000000ULL + next.tv_nsec;
+    for (uint32_t tick = 0; tick < SIM_TIMING_TICKS; tick++)
+    {
+        ideal += SIM_TIMING_PERIOD_US * 1000ULL;
+        next.tv_sec = ideal / 1000000000ULL;
+        next.tv_nsec = ideal % 1000000000ULL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        uint64_t start = benchNanos();
+        uint32_t missed = 0;
+        while (start > ideal + SIM_TIMING_PERIOD_US * 1000ULL)
+        {
+            ideal += SIM_TIMING_PERIOD_US * 1000ULL;
+            missed++;
+        }
+        paced_step.run();
+        paced.record((start - ideal) / 1000, (benchNanos() - start) / 1000, missed);
+    }
+    io_running = false;
+    io.join();
+
+    // The same step at the end of a loop pass that does the sensor I/O itself
+    ControlTiming looped;
+    SimTimingStep looped_step;
+    uint32_t random = 99;
+    uint64_t due = benchNanos() + SIM_TIMING_PERIOD_US * 1000ULL;
+    for (uint32_t tick = 0; tick < SIM_TIMING_TICKS; tick++)
+    {
+        simSensorIo(random);
+        while (benchNanos() < due)
+        {
+        }
+        uint64_t start = benchNanos();
+        uint32_t missed = 0;
+        while (start > due + SIM_TIMING_PERIOD_US * 1000ULL)
+        {
+            due += SIM_TIMING_PERIOD_US * 1000ULL;
+            missed++;
+        }
+        looped_step.run();
+        looped.record((start - due) / 1000, (benchNanos() - start) / 1000, missed);
+        due += SIM_TIMING_PERIOD_US * 1000ULL;
+    }
+
+    printf("\ncontrol tick %u us, %u ticks, sensor I/O bursts of 0.2-3.2 ms\n", SIM_TIMING_PERIOD_US, SIM_TIMING_TICKS);
+    simTimingReport("own paced thread", paced);
+    simTimingReport("after sensor I/O", looped);
+}
+
+int simulateDosing(int argc, char **argv)
+{
+    printf("%u h per run, TDS %.0f ppm and pH %.1f targets, %u s transport delay, %.0f s mixing\n", SIM_HOURS,
+           SIM_TDS_SETPOINT, SIM_PH_SETPOINT, SIM_DEAD_TIME_S, SIM_MIX_TAU_S);
+    printf("%-16s %7s %7s %6s %7s %4s | %7s %6s %6s %6s %4s\n", "", "tds min", "over", "rms", "mL", "n", "ph min", "over",
+           "rms", "mL", "n");
+
+    SimOutcome tds, ph;
+    DosingConfig nutrient = simNutrientConfig();
+    DosingConfig acid = simAcidConfig();
+    simDoseRun("tuned", nutrient, acid, 850.0f, 6.6f, tds, ph);
+    bool ok = tds.settle_min < 120 && tds.overshoot < 2 * SIM_TDS_BAND && ph.settle_min < 120 && ph.overshoot < 2 * SIM_PH_BAND;
+
+    SimOutcome ignored_tds, ignored_ph;
+    DosingConfig no_hold_nutrient = nutrient, no_hold_acid = acid;
+    no_hold_nutrient.mixing_ms = 0;
+    no_hold_acid.mixing_ms = 0;
+    simDoseRun("no mixing hold", no_hold_nutrient, no_hold_acid, 850.0f, 6.6f, ignored_tds, ignored_ph);
+
+    DosingConfig windup_nutrient = nutrient, windup_acid = acid;
+    windup_nutrient.anti_windup = false;
+    windup_acid.anti_windup = false;
+    simDoseRun("no anti-windup", windup_nutrient, windup_acid, 850.0f, 6.6f, ignored_tds, ignored_ph);
+
+    DosingConfig ff_nutrient = nutrient, ff_acid = acid;
+    ff_nutrient.kff = 1.0f;
+    ff_acid.kff = 1.0f;
+    simDoseRun("feed-forward on", ff_nutrient, ff_acid, 850.0f, 6.6f, ignored_tds, ignored_ph);
+
+    DosingConfig unlimited_nutrient = nutrient, unlimited_acid = acid;
+    unlimited_nutrient.max_ml_per_hour = 1e6f;
+    unlimited_acid.max_ml_per_hour = 1e6f;
+    simDoseRun("no rate limit", unlimited_nutrient, unlimited_acid, 850.0f, 6.6f, ignored_tds, ignored_ph);
+
+    simDoseTiming();
+
+    printf("%s\n", ok ? "dosing ok" : "dosing FAILED to settle");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+// Host simulation of the probe fault detection.
+// Injects one kind of fault at a time into the simulated sensors, over many
+// seeds, runs the firmware's pipeline on them and reports the detection
+// rates and latencies, the false alarms, the recoveries and whether the other
+// probes kept delivering. A dead DS18B20 is also counted against the bus time
+// it would take without the retry backoff. The same scenarios are held to
+// their limits by the unit tests (pio test -e native).
+#include <stdio.h>
+#include <stdlib.h>
+#include "NativeCommands.h"
+#include "Scheduler.h"
+#include "TemperatureEngine.h"
+#include "SensorPipeline.h"
+#include "SensorHealth.h"
+#include "Hal.h"
+#include "FakeClock.h"
+#include "MockTemperatureBus.h"
+#include "SimulatedAdcSource.h"
+#include "SimulatedSensors.h"
+#include "AdcCalibration.h"
+#include "ReferenceAdcCurve.h"
+
+#define FAULT_PIN_PH 25
+#define FAULT_PIN_TDS 34
+#define FAULT_ADC_RATE_HZ 250
+#define FAULT_BLOCK_PERIOD_US (1000000UL * ADC_BLOCK_SIZE / FAULT_ADC_RATE_HZ)
+#define FAULT_SEEDS 20           // Runs of every scenario
+#define FAULT_START_S 60         // Every script injects its fault here
+#define FAULT_END_S 300          // and takes it away here
+#define FAULT_SETTLE_S 70        // After the end the probe has this long to come back, a dead DS18B20 is retried a minute apart
+#define FAULT_RUN_S 420          // Length of a run
+#define FAULT_TEMP_STUCK_S 60    // Stuck limit of the DS18B20 in the check, the firmware waits six hours
+
+// One injected fault and what the pipeline must make of it
+struct FaultScenario
+{
+    const char *name;
+    const char *script;       // Injects at FAULT_START_S, removes at FAULT_END_S
+    ReadingChannel channel;   // Channel that must notice, probe 0 for temperatures
+    SensorFault fault;        // How it must be classified, FAULT_NONE for the clean run
+};
+
+static const FaultScenario FAULT_SCENARIOS[] = {
+    {"clean", "0 tds spikes=2 spike=900\n0 ph spikes=2 spike=700\n0 temp0 drift=0.002\n", READING_TDS, FAULT_NONE},
+    {"tds unplugged", "60 tds level=0\n300 tds level=1807\n", READING_TDS, FAULT_DISCONNECTED},
+    {"tds frozen", "60 tds stuck=1\n300 tds stuck=0\n", READING_TDS, FAULT_STUCK},
+    {"ph floating", "60 ph floating=1\n300 ph floating=0\n", READING_PH, FAULT_DISCONNECTED},
+    {"ph rail", "60 ph level=4095\n300 ph level=3300\n", READING_PH, FAULT_SATURATED},
+    {"ph jump", "60 ph level=2300\n300 ph level=3300\n", READING_PH, FAULT_SLEW},
+    {"temp unplugged", "60 temp0 dropouts=1000 dropout_ms=240000\n61 temp0 dropouts=0\n", READING_TEMPERATURE, FAULT_DISCONNECTED},
+    {"temp -127", "60 temp0 level=-127 noise=0\n300 temp0 level=21.3 noise=0.02\n", READING_TEMPERATURE, FAULT_DISCONNECTED},
+    {"temp 85", "60 temp0 level=85\n300 temp0 level=21.3\n", READING_TEMPERATURE, FAULT_SATURATED},
+    {"temp frozen", "60 temp0 stuck=1\n300 temp0 stuck=0\n", READING_TEMPERATURE, FAULT_STUCK},
+};
+
+// What one run saw
+struct FaultRun
+{
+    const FaultScenario *scenario;
+    uint32_t first_fault_us;     // First reading of the target channel after the start that was not good
+    bool detected;
+    uint32_t false_positives;    // Readings that were not good in the clean periods
+    uint32_t ph_during;          // pH readings while the fault was in
+    uint32_t temp_failures;      // Failed reads of probe 0 while the fault was in
+};
+
+static SimulatedSensors *fault_sensors;
+static FaultRun *fault_run;
+
+static uint16_t faultSignal(uint8_t pin, uint32_t time_us) { return fault_sensors->analogRead(pin, time_us); }
+
+static void faultSink(ReadingChannel channel, uint8_t index, float value, SensorQuality quality)
+{
+    FaultRun &run = *fault_run;
+    const FaultScenario &scenario = *run.scenario;
+    bool during = fake_now_us >= FAULT_START_S * 1000000UL && fake_now_us < FAULT_END_S * 1000000UL;
+    bool clean = fake_now_us < FAULT_START_S * 1000000UL || fake_now_us >= (FAULT_END_S + FAULT_SETTLE_S) * 1000000UL ||
+                 scenario.fault == FAULT_NONE;
+    if (during && channel == READING_PH)
+        run.ph_during++;
+
+    // Stale values are not the probe's fault, a TDS before the first temperature is one
+    if (quality != QUALITY_SUSPECT && quality != QUALITY_FAULT)
+        return;
+    if (clean)
+        run.false_positives++;
+    else if (channel == scenario.channel && index == 0 && !run.detected && fake_now_us >= FAULT_START_S * 1000000UL)
+    {
+        run.detected = true;
+        run.first_fault_us = fake_now_us;
+    }
+}
+
+// Run the pipeline through one scenario with one seed, returns false if something outside the fault went wrong
+static bool faultRun(FaultRun &run, uint32_t seed, SensorHealthStats &stats, uint32_t &overflows)
+{
+    fake_now_us = 0;
+    SimulatedSensors sensors(seed);
+    sensors.add("tds", FAULT_PIN_TDS, 1807, 6);
+    sensors.add("ph", FAULT_PIN_PH, 3300, 4);
+    int8_t probe = sensors.add("temp0", SimulatedSensors::NO_PIN, 21.3f, 0.02f);
+    if (sensors.load(run.scenario->script) != 0)
+    {
+        fprintf(stderr, "%s: cannot parse the script\n", run.scenario->name);
+        return false;
+    }
+    fault_sensors = &sensors;
+    fault_run = &run;
+
+    MockTemperatureBus bus;
+    bus.addProbe(sensors.sensor(probe).level);
+    TemperatureEngine temperatures(bus, halMicros);
+    temperatures.begin(halMicros());
+
+    static AdcCalibration adc1_calibration, adc2_calibration;
+    adc1_calibration.build(referenceAdcMillivolts, &REFERENCE_ADC1);
+    adc2_calibration.build(referenceAdcMillivolts, &REFERENCE_ADC2);
+    SimulatedAdcSource adc(faultSignal);
+    const uint8_t adc_pins[] = {FAULT_PIN_TDS, FAULT_PIN_PH};
+    adc.begin(adc_pins, 2, FAULT_ADC_RATE_HZ);
+
+    // The firmware limits, except a stuck DS18B20 that would take six hours
+    Scheduler scheduler(halMicros);
+    SensorPipeline pipeline(adc, temperatures, adc1_calibration, adc2_calibration);
+    SensorHealthConfig temp_config = pipeline.health(READING_TEMPERATURE).config();
+    temp_config.stuck_s = FAULT_TEMP_STUCK_S;
+    pipeline.configureHealth(READING_TEMPERATURE, temp_config);
+    pipeline.begin(scheduler, faultSink, FAULT_BLOCK_PERIOD_US, 10000000UL);
+
+    uint32_t failures_at_start = 0;
+    while (fake_now_us < FAULT_RUN_S * 1000000UL)
+    {
+        float celsius;
+        bool connected = sensors.sample(probe, fake_now_us, celsius);
+        bus.setConnected(0, connected);
+        if (connected)
+            bus.setTemperature(0, celsius);
+        if (fake_now_us < FAULT_START_S * 1000000UL)
+            failures_at_start = temperatures.probe(0).failures;
+        else if (fake_now_us < FAULT_END_S * 1000000UL)
+            run.temp_failures = temperatures.probe(0).failures - failures_at_start;
+        fakeSpend(scheduler.runOnce());
+    }
+
+    // The probe is back to good once the fault is gone
+    const SensorHealth &health = pipeline.health(run.scenario->channel);
+    stats = health.stats();
+    overflows = adc.overflows();
+    bool recovered = health.fault() == FAULT_NONE;
+    return recovered && bus.early_reads == 0;
+}
+
+int simulateFaults(int argc, char **argv)
+{
+    const uint32_t blocks_during = (FAULT_END_S - FAULT_START_S) * 1000000UL / FAULT_BLOCK_PERIOD_US;
+    printf("%u seeds, fault from %u s to %u s, clean before and from %u s\n", FAULT_SEEDS, FAULT_START_S, FAULT_END_S,
+           FAULT_END_S + FAULT_SETTLE_S);
+
+    for (const FaultScenario &scenario : FAULT_SCENARIOS)
+    {
+        uint32_t detected = 0, classified = 0, recovered = 0, false_positives = 0, misclassified = 0, stalled = 0;
+        uint32_t latency_max_ms = 0, temp_failures = 0;
+        uint64_t latency_sum_ms = 0;
+        for (uint32_t seed = 1; seed <= FAULT_SEEDS; seed++)
+        {
+            FaultRun run = {&scenario, 0, false, 0, 0, 0};
+            SensorHealthStats stats;
+            uint32_t overflows;
+            if (faultRun(run, seed * 7919, stats, overflows))
+                recovered++;
+
+            // Raised as the right fault and nothing else, in time
+            false_positives += run.false_positives;
+            if (run.detected)
+            {
+                uint32_t latency_ms = (run.first_fault_us - FAULT_START_S * 1000000UL) / 1000;
+                detected++;
+                latency_sum_ms += latency_ms;
+                if (latency_ms > latency_max_ms)
+                    latency_max_ms = latency_ms;
+            }
+            if (scenario.fault != FAULT_NONE && stats.detections[scenario.fault] > 0)
+                classified++;
+            for (uint8_t fault = FAULT_DISCONNECTED; fault < FAULT_COUNT; fault++)
+            {
+                if (fault != scenario.fault && fault != FAULT_SLEW && stats.detections[fault] > 0)
+                    misclassified++;
+            }
+
+            // pH keeps its block rate whatever the fault, unless it is the pH probe that went
+            if (overflows > 0 || (scenario.channel != READING_PH && run.ph_during < blocks_during * 9 / 10))
+                stalled++;
+            temp_failures += run.temp_failures;
+        }
+
+        printf("%-15s %-12s detected %2u/%u classified %2u/%u latency ms avg %6u max %6u, %u false, %u wrong, %u stalled, recovered %2u/%u\n",
+               scenario.name, sensorFaultName(scenario.fault), (unsigned)detected, FAULT_SEEDS, (unsigned)classified, FAULT_SEEDS,
+               (unsigned)(detected ? latency_sum_ms / detected : 0), (unsigned)latency_max_ms, (unsigned)false_positives,
+               (unsigned)misclassified, (unsigned)stalled, (unsigned)recovered, FAULT_SEEDS);
+
+        // Without the backoff a dead probe is tried once a period (a second), every try is bus time
+        if (scenario.channel == READING_TEMPERATURE && scenario.fault == FAULT_DISCONNECTED)
+        {
+            uint32_t dead_s = FAULT_END_S - FAULT_START_S;
+            printf("  dead probe for %u s: %u tries on the bus, %u without the backoff\n", (unsigned)dead_s,
+                   (unsigned)(temp_failures / FAULT_SEEDS), (unsigned)dead_s);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,220 @@
+// Host simulation of the sensor pipeline.
+// Runs the firmware's SensorPipeline, Scheduler and TemperatureEngine against
+// the fake clock, a mock OneWire bus and the scriptable simulated sensors,
+// then prints the scheduler timing and what the pipeline made of the signals.
+// Example: program sim scenario.txt 900
+#include <stdio.h>
+#include <stdlib.h>
+#include "NativeCommands.h"
+#include "Profiler.h"
+#include "Scheduler.h"
+#include "TemperatureEngine.h"
+#include "SensorPipeline.h"
+#include "Hal.h"
+#include "FakeClock.h"
+#include "NativeHal.h"
+#include "MockTemperatureBus.h"
+#include "SimulatedAdcSource.h"
+#include "AdcCalibration.h"
+#include "ReferenceAdcCurve.h"
+
+// Costs of the individual operations in microseconds, measured on the devkit
+#define SIM_REPORT_US 900          // Formatting and queueing the report lines
+
+// Continuous ADC settings, the same as the firmware defaults
+#define SIM_PIN_PH 25
+#define SIM_PIN_TDS 34
+#define SIM_ADC_RATE_HZ 250
+#define SIM_BLOCK_PERIOD_US (1000000UL * ADC_BLOCK_SIZE / SIM_ADC_RATE_HZ)
+#define SIM_SECONDS 600            // Default length of a run
+#define SIM_SCRIPT_SIZE 4096       // Largest script file
+
+// Quiet start, then every kind of disturbance in turn
+static const char DEFAULT_SCRIPT[] =
+    "60  tds   spikes=2 spike=900\n"
+    "120 ph    spikes=2 spike=700\n"
+    "180 temp0 drift=0.01\n"
+    "240 temp0 drift=0\n"
+    "300 tds   dropouts=0.01 dropout_ms=3000\n"
+    "300 temp1 dropouts=0.02 dropout_ms=5000\n"
+    "420 tds   dropouts=0\n";
+
+//-------------------- Output --------------------
+
+// Summary of everything the pipeline published on one channel
+struct SimChannel
+{
+    uint32_t count;
+    float min;
+    float max;
+    double sum;
+    float last;
+    uint32_t degraded; // Values that came with less than good quality
+};
+
+SimChannel sim_channels[READING_EC + 1][TemperatureEngine::MAX_PROBES];
+
+void simSink(ReadingChannel channel, uint8_t index, float value, SensorQuality quality)
+{
+    SimChannel &summary = sim_channels[channel][index];
+    if (summary.count == 0 || value < summary.min)
+        summary.min = value;
+    if (summary.count == 0 || value > summary.max)
+        summary.max = value;
+    summary.count++;
+    summary.sum += value;
+    summary.last = value;
+    if (quality != QUALITY_GOOD)
+        summary.degraded++;
+}
+
+void simPrintChannel(const char *name, const SimChannel &summary)
+{
+    if (summary.count == 0)
+        return;
+    printf("%-7s %6u values: min %8.3f avg %8.3f max %8.3f last %8.3f, %u not good\n", name, (unsigned)summary.count,
+           summary.min, summary.sum / summary.count, summary.max, summary.last, (unsigned)summary.degraded);
+}
+
+uint32_t simReport(void *context, uint32_t now_us)
+{
+    fakeSpend(SIM_REPORT_US);
+    return 1000000;
+}
+
+//-------------------- Simulation --------------------
+
+// The simulated ADC samples the same sensors as halAnalogRead()
+uint16_t simSignal(uint8_t pin, uint32_t time_us) { return simulated_sensors.analogRead(pin, time_us); }
+
+// Read a script file into a static buffer
+const char *simReadScript(const char *path)
+{
+    static char script[SIM_SCRIPT_SIZE];
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return NULL;
+    size_t length = fread(script, 1, sizeof(script) - 1, file);
+    fclose(file);
+    script[length] = '\0';
+    return script;
+}
+
+int simulateScheduler(int argc, char **argv)
+{
+    const char *script = DEFAULT_SCRIPT;
+    if (argc > 0 && (script = simReadScript(argv[0])) == NULL)
+    {
+        fprintf(stderr, "cannot read %s\n", argv[0]);
+        return 2;
+    }
+    uint32_t seconds = argc > 1 ? strtoul(argv[1], NULL, 10) : SIM_SECONDS;
+
+    // The probes as they sit in the reservoir, the temperatures are bound to the mock bus by index
+    const uint8_t probe_count = 3;
+    simulated_sensors.add("tds", SIM_PIN_TDS, 1807, 6);
+    simulated_sensors.add("ph", SIM_PIN_PH, 3300, 4);
+    int8_t first_probe = simulated_sensors.add("temp0", SimulatedSensors::NO_PIN, 21.3f, 0.02f);
+    simulated_sensors.add("temp1", SimulatedSensors::NO_PIN, 19.8f, 0.02f);
+    simulated_sensors.add("temp2", SimulatedSensors::NO_PIN, 24.1f, 0.02f);
+    int error_line = simulated_sensors.load(script);
+    if (error_line)
+    {
+        fprintf(stderr, "script line %d: cannot parse\n", error_line);
+        return 2;
+    }
+
+    // Three probes on the mock bus, each with its own resolution and period
+    MockTemperatureBus bus;
+    for (uint8_t i = 0; i < probe_count; i++)
+        bus.addProbe(simulated_sensors.sensor(first_probe + i).level);
+    TemperatureEngine temperatures(bus, halMicros);
+    temperatures.begin(halMicros());
+    temperatures.configureProbe(1, 9, 250);
+    temperatures.configureProbe(2, 11, 2000);
+
+    // Raw to millivolt tables from the reference curve, built once like at boot
+    static AdcCalibration adc1_calibration, adc2_calibration;
+    adc1_calibration.build(referenceAdcMillivolts, &REFERENCE_ADC1);
+    adc2_calibration.build(referenceAdcMillivolts, &REFERENCE_ADC2);
+
+    // Both analog probes are sampled continuously, in the pipeline's channel order
+    static SimulatedAdcSource adc(simSignal);
+    const uint8_t adc_pins[] = {SIM_PIN_TDS, SIM_PIN_PH};
+    adc.begin(adc_pins, 2, SIM_ADC_RATE_HZ);
+
+    // The firmware's pipeline, with a report task standing in for the consumer side
+    Scheduler scheduler(halMicros);
+    static SensorPipeline pipeline(adc, temperatures, adc1_calibration, adc2_calibration);
+    pipeline.begin(scheduler, simSink, SIM_BLOCK_PERIOD_US, 10000000UL);
+    scheduler.addTask("report", simReport, NULL, 1000000);
+
+    // Jump the clock straight to the next due task, the probes follow the script on every pass
+    const uint32_t end_us = seconds * 1000000UL;
+    while (fake_now_us < end_us)
+    {
+        for (uint8_t i = 0; i < probe_count; i++)
+        {
+            float celsius;
+            bool connected = simulated_sensors.sample(first_probe + i, fake_now_us, celsius);
+            bus.setConnected(i, connected);
+            if (connected)
+                bus.setTemperature(i, celsius);
+        }
+        uint32_t idle_us = scheduler.runOnce();
+        fakeSpend(idle_us);
+    }
+
+    const SchedulerCycleStats &cycle = scheduler.cycleStats();
+    printf("cycle us: min %u avg %u max %u (%u passes)\n", (unsigned)cycle.cycle_min_us,
+           (unsigned)(cycle.cycle_sum_us / cycle.cycles), (unsigned)cycle.cycle_max_us, (unsigned)cycle.cycles);
+    for (uint8_t i = 0; i < scheduler.taskCount(); i++)
+    {
+        const SchedulerTaskStats &stats = scheduler.taskStats(i);
+        printf("%-7s runs %6u jitter us: min %u avg %u max %u, run us: avg %u max %u\n", scheduler.taskName(i),
+               (unsigned)stats.runs, (unsigned)stats.lateness_min_us, (unsigned)(stats.lateness_sum_us / stats.runs),
+               (unsigned)stats.lateness_max_us, (unsigned)(stats.run_time_sum_us / stats.runs), (unsigned)stats.run_time_max_us);
+    }
+
+    // What the pipeline published, next to what the sensors did
+    simPrintChannel("tds", sim_channels[READING_TDS][0]);
+    simPrintChannel("ec", sim_channels[READING_EC][0]);
+    simPrintChannel("ph", sim_channels[READING_PH][0]);
+    for (uint8_t i = 0; i < temperatures.probeCount(); i++)
+    {
+        char name[8];
+        snprintf(name, sizeof(name), "temp%u", i);
+        simPrintChannel(name, sim_channels[READING_TEMPERATURE][i]);
+    }
+    for (uint8_t i = 0; i < simulated_sensors.count(); i++)
+    {
+        const SimulatedSensors::Sensor &sensor = simulated_sensors.sensor(i);
+        printf("sensor %-6s level %8.3f, %u spikes, %u dropouts\n", sensor.name, simulated_sensors.truth(i, fake_now_us),
+               (unsigned)sensor.spikes, (unsigned)sensor.dropouts);
+    }
+    printf("adc: %u blocks lost\n", (unsigned)adc.overflows());
+    printf("state: %u derived values recomputed, %u skipped\n", (unsigned)pipeline.state().recomputed(),
+           (unsigned)pipeline.state().skipped());
+#if PROFILING
+    // Host time of the profiled pipeline stages, real time although the scheduler runs on the fake clock
+    char line[120];
+    for (ProfileStage *stage = ProfileStage::first(); stage != NULL; stage = stage->next())
+    {
+        if (stage->count() == 0)
+            continue;
+        profileFormat(*stage, line, sizeof(line));
+        printf("%s\n", line);
+    }
+#endif
+
+    // A conversion must never be waited on: the longest bus call is one scratchpad read, and no probe is read early
+    for (uint8_t i = 0; i < temperatures.probeCount(); i++)
+    {
+        const TemperatureEngine::Probe &probe = temperatures.probe(i);
+        printf("probe %u: %u bits, %u reads, %u failures, %.4f C\n", i, probe.resolution, (unsigned)probe.reads,
+               (unsigned)probe.failures, probe.celsius);
+    }
+    printf("onewire: %u transactions, longest call %u us, %u early reads\n", (unsigned)bus.transactions,
+           (unsigned)bus.longest_call_us, (unsigned)bus.early_reads);
+    return bus.early_reads == 0 && bus.longest_call_us <= MockTemperatureBus::READ_US ? 0 : 1;
+}
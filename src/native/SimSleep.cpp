@@ -0,0 +1,230 @@
+// Host simulation of the power-managed modes.
+// Runs the firmware's pipeline in acquisition windows against the fake clock:
+// light sleep keeps every object between windows, deep sleep rebuilds them on
+// every wake like a reset does and resumes from the RTC state, and a cold
+// series rebuilds them without it. Prints the wake to first reading latency,
+// the awake fraction and an estimate of the average current. The duty cycle
+// and the resume state have their unit tests (pio test -e native).
+#include <stdio.h>
+#include <string.h>
+#include "NativeCommands.h"
+#include "Scheduler.h"
+#include "TemperatureEngine.h"
+#include "SensorPipeline.h"
+#include "DutyCycle.h"
+#include "ResumeState.h"
+#include "Hal.h"
+#include "FakeClock.h"
+#include "NativeHal.h"
+#include "MockTemperatureBus.h"
+#include "SimulatedAdcSource.h"
+#include "AdcCalibration.h"
+#include "ReferenceAdcCurve.h"
+
+#define SIM_PIN_PH 25
+#define SIM_PIN_TDS 34
+#define SIM_ADC_RATE_HZ 250
+#define SIM_BLOCK_PERIOD_US (1000000UL * ADC_BLOCK_SIZE / SIM_ADC_RATE_HZ)
+#define SIM_PERIOD_MS 10000        // A window every 10 seconds
+#define SIM_WINDOW_MS 3000         // Longest window
+#define SIM_WINDOWS 360            // One simulated hour per mode
+#define SIM_BOOT_US 120000         // Reset to setup() after a deep sleep, ROM and bootloader
+
+// Chip supply current in each state (datasheet figures, mA), the devkit's regulator and USB bridge come on top
+#define SIM_ACTIVE_MA 40.0
+#define SIM_LIGHT_SLEEP_MA 0.8
+#define SIM_DEEP_SLEEP_MA 0.01
+
+// Everything outside the chip, it keeps running through every sleep
+static AdcCalibration sim_adc1, sim_adc2;
+static MockTemperatureBus sim_bus;
+
+// RTC memory, the only thing that survives a deep sleep
+static ResumeState sim_rtc;
+
+// Window of the pipeline that is currently awake
+static DutyCycle *sim_duty;
+
+static uint16_t simSleepSignal(uint8_t pin, uint32_t time_us) { return simulated_sensors.analogRead(pin, time_us); }
+
+static void simSleepSink(ReadingChannel channel, uint8_t index, float value, SensorQuality quality)
+{
+    sim_duty->reading(channel, index, halMicros());
+}
+
+// Everything the firmware builds in setup()
+struct SimChip
+{
+    SimulatedAdcSource adc;
+    TemperatureEngine temperatures;
+    Scheduler scheduler;
+    SensorPipeline pipeline;
+    DutyCycle duty;
+
+    SimChip()
+        : adc(simSleepSignal), temperatures(sim_bus, halMicros), scheduler(halMicros),
+          pipeline(adc, temperatures, sim_adc1, sim_adc2), duty(SIM_PERIOD_MS, SIM_WINDOW_MS)
+    {
+        const uint8_t pins[] = {SIM_PIN_TDS, SIM_PIN_PH};
+        adc.begin(pins, 2, SIM_ADC_RATE_HZ);
+    }
+
+    // Run the schedulers until the window is complete, returns the sleep time
+    uint32_t window()
+    {
+        sim_duty = &duty;
+        while (!duty.windowDone(halMicros()))
+        {
+            uint32_t idle_us = scheduler.runOnce();
+            // Idle in small steps so the window closes as soon as it is done
+            fakeSpend(idle_us < 1000 ? idle_us : 1000);
+        }
+        return duty.sleepUs(halMicros());
+    }
+};
+
+// Summary of one mode
+struct SimModeResult
+{
+    DutyCycleStats stats;
+    double average_ma;
+    uint32_t scans;
+    uint32_t resumes;
+    uint32_t restore_mismatches;
+};
+
+static void simSleepPrint(const char *name, const SimModeResult &result)
+{
+    const DutyCycleStats &stats = result.stats;
+    double awake = (double)stats.awake_us / (stats.awake_us + stats.asleep_us);
+    printf("%-12s %3u windows, %u timeouts, awake %5.2f%%, ~%.3f mA, %u bus scans, %u resumes\n", name,
+           (unsigned)stats.windows, (unsigned)stats.timeouts, awake * 100.0, result.average_ma, (unsigned)result.scans,
+           (unsigned)result.resumes);
+    static const char *const channel_names[DUTY_CHANNELS] = {"tds", "ph", "temp"};
+    for (uint8_t i = 0; i < DUTY_CHANNELS; i++)
+    {
+        const WakeLatency &latency = stats.latency[i];
+        if (latency.count == 0)
+            continue;
+        printf("  %-5s wake to first reading ms: min %.1f avg %.1f max %.1f\n", channel_names[i], latency.min_us / 1e3,
+               (double)latency.sum_us / latency.count / 1e3, latency.max_us / 1e3);
+    }
+}
+
+static SimModeResult simLightSleep()
+{
+    SimModeResult result = {};
+    uint32_t scans_before = sim_bus.scans;
+    SimChip chip;
+    chip.temperatures.begin(halMicros());
+    chip.pipeline.begin(chip.scheduler, simSleepSink, SIM_BLOCK_PERIOD_US, 10000000UL);
+    chip.duty.wake(halMicros());
+
+    double charge = 0; // mA us
+    for (uint32_t i = 0; i < SIM_WINDOWS; i++)
+    {
+        uint32_t start = halMicros();
+        uint32_t sleep_us = chip.window();
+        charge += SIM_ACTIVE_MA * (halMicros() - start) + SIM_LIGHT_SLEEP_MA * sleep_us;
+
+        // RAM and the tasks stay, only the sample clock stops
+        chip.adc.pause();
+        fakeSpend(sleep_us);
+        chip.adc.resume();
+        chip.duty.wake(halMicros());
+    }
+    result.stats = chip.duty.stats();
+    result.average_ma = charge / (result.stats.awake_us + result.stats.asleep_us);
+    result.scans = sim_bus.scans - scans_before;
+    return result;
+}
+
+static SimModeResult simDeepSleep(bool keep_rtc)
+{
+    SimModeResult result = {};
+    uint32_t scans_before = sim_bus.scans;
+    resumeStateClear(sim_rtc);
+    DutyCycleStats totals = DutyCycle(SIM_PERIOD_MS, SIM_WINDOW_MS).stats();
+
+    double charge = 0;
+    for (uint32_t i = 0; i < SIM_WINDOWS; i++)
+    {
+        // Reset: the boot runs before setup(), the latency counts from the reset
+        uint32_t reset_us = halMicros();
+        fakeSpend(SIM_BOOT_US);
+        if (!keep_rtc)
+            resumeStateClear(sim_rtc);
+
+        SimChip chip;
+        bool resumed = resumeStateValid(sim_rtc);
+        if (resumed)
+        {
+            chip.temperatures.resume(sim_rtc.temperatures, halMicros());
+            chip.duty.restoreStats(sim_rtc.duty);
+            result.resumes++;
+        }
+        else
+        {
+            chip.temperatures.begin(halMicros());
+            chip.duty.restoreStats(totals);
+        }
+        chip.pipeline.begin(chip.scheduler, simSleepSink, SIM_BLOCK_PERIOD_US, 10000000UL);
+        if (resumed)
+        {
+            // The windows must come back exactly as they were saved
+            chip.pipeline.resume(sim_rtc.pipeline);
+            SensorPipeline::Snapshot check;
+            chip.pipeline.save(check);
+            const SensorPipeline::Snapshot &saved = sim_rtc.pipeline;
+            if (check.ph_count != saved.ph_count || check.tds_count != saved.tds_count ||
+                memcmp(check.ph_samples, saved.ph_samples, saved.ph_count * sizeof(uint16_t)) != 0 ||
+                memcmp(check.tds_samples, saved.tds_samples, saved.tds_count * sizeof(uint16_t)) != 0)
+                result.restore_mismatches++;
+        }
+        chip.duty.wake(reset_us);
+
+        uint32_t sleep_us = chip.window();
+        charge += SIM_ACTIVE_MA * (halMicros() - reset_us) + SIM_DEEP_SLEEP_MA * sleep_us;
+
+        // Save into RTC memory field by field, then seal; everything else is lost with the sleep
+        chip.adc.pause();
+        resumeStateClear(sim_rtc);
+        sim_rtc.power_mode = POWER_DEEP_SLEEP;
+        sim_rtc.wakes = i + 1;
+        chip.temperatures.save(sim_rtc.temperatures);
+        chip.pipeline.save(sim_rtc.pipeline);
+        sim_rtc.duty = chip.duty.stats();
+        resumeStateSeal(sim_rtc);
+        totals = chip.duty.stats();
+        fakeSpend(sleep_us);
+    }
+    result.stats = totals;
+    // The boot time is awake time that the window statistics do not see
+    result.stats.awake_us += (uint64_t)SIM_BOOT_US * SIM_WINDOWS;
+    result.average_ma = charge / (result.stats.awake_us + result.stats.asleep_us);
+    result.scans = sim_bus.scans - scans_before;
+    return result;
+}
+
+int simulateSleep(int argc, char **argv)
+{
+    simulated_sensors.add("tds", SIM_PIN_TDS, 1807, 6);
+    simulated_sensors.add("ph", SIM_PIN_PH, 3300, 4);
+    sim_bus.addProbe(21.3f);
+    sim_bus.addProbe(19.8f);
+    sim_adc1.build(referenceAdcMillivolts, &REFERENCE_ADC1);
+    sim_adc2.build(referenceAdcMillivolts, &REFERENCE_ADC2);
+
+    printf("period %u ms, window at most %u ms, %u windows per mode, always on ~%.3f mA\n", SIM_PERIOD_MS,
+           SIM_WINDOW_MS, SIM_WINDOWS, SIM_ACTIVE_MA);
+    SimModeResult light = simLightSleep();
+    simSleepPrint("light sleep", light);
+    SimModeResult deep = simDeepSleep(true);
+    simSleepPrint("deep resume", deep);
+    SimModeResult cold = simDeepSleep(false);
+    simSleepPrint("deep cold", cold);
+
+    printf("resume: %u filter mismatches, %u scans after the first boot, early reads %u\n",
+           (unsigned)deep.restore_mismatches, (unsigned)(deep.scans - 1), (unsigned)sim_bus.early_reads);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "SimulatedAdcSource.h"
+
+bool SimulatedAdcSource::begin(const uint8_t *pins, uint8_t channel_count, uint32_t sample_rate_hz)
+{
+    if (channel_count == 0 || channel_count > MAX_CHANNELS || sample_rate_hz == 0)
+        return false;
+
+    this->channel_count = channel_count;
+    period_us = 1000000UL / sample_rate_hz;
+    for (uint8_t i = 0; i < channel_count; i++)
+    {
+        this->pins[i] = pins[i];
+        next_block_us[i] = fake_now_us;
+        shift[i] = 0;
+    }
+    return true;
+}
+
+bool SimulatedAdcSource::setRateShift(uint8_t channel, uint8_t shift)
+{
+    if (channel >= channel_count || shift > 15)
+        return false;
+    this->shift[channel] = shift;
+    return true;
+}
+
+void SimulatedAdcSource::pause()
+{
+    paused = true;
+    paused_us = fake_now_us;
+}
+
+void SimulatedAdcSource::resume()
+{
+    // Blocks restart at the wake, whatever was half done or left unread before the sleep is gone
+    paused = false;
+    for (uint8_t i = 0; i < channel_count; i++)
+        next_block_us[i] = fake_now_us;
+}
+
+bool SimulatedAdcSource::readBlock(uint8_t channel, AdcBlock &block)
+{
+    if (channel >= channel_count)
+        return false;
+
+    // A block is complete once the time of its last sample has passed, while paused no sample is taken
+    uint32_t now_us = paused ? paused_us : fake_now_us;
+    uint32_t sample_us = period_us << shift[channel];
+    uint32_t block_us = sample_us * ADC_BLOCK_SIZE;
+    uint32_t &start = next_block_us[channel];
+    if ((int32_t)(now_us - (start + block_us - sample_us)) < 0)
+        return false;
+
+    // Anything older than the ring on the board could hold is lost
+    uint32_t ready = (now_us - start + sample_us) / block_us;
+    if (ready > BLOCKS_PER_CHANNEL)
+    {
+        overflow_count += ready - BLOCKS_PER_CHANNEL;
+        start += (ready - BLOCKS_PER_CHANNEL) * block_us;
+    }
+
+    block.timestamp_us = start;
+    block.count = ADC_BLOCK_SIZE;
+    for (uint16_t i = 0; i < ADC_BLOCK_SIZE; i++)
+        block.samples[i] = signal(pins[channel], start + i * sample_us);
+    start += block_us;
+    return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "AdcBlockSource.h"
+#include "FakeClock.h"
+
+// Signal a simulated pin produces, raw 12-bit counts at a point in fake time
+typedef uint16_t (*SimulatedSignal)(uint8_t pin, uint32_t time_us);
+
+// Host stand-in for the timer paced ADC. Blocks are produced lazily from the
+// fake clock: whenever the consumer asks, every block whose last sample time
+// has passed is generated from the signal function. Blocks the consumer left
+// lying around for longer than the board could buffer them are dropped and
+// counted as overflows, just like a full ring on the board.
+class SimulatedAdcSource : public AdcBlockSource
+{
+public:
+    static const uint8_t BLOCKS_PER_CHANNEL = 4; // Same buffering as TimerAdcSource
+
+    explicit SimulatedAdcSource(SimulatedSignal signal)
+        : signal(signal), channel_count(0), period_us(0), overflow_count(0), paused(false), paused_us(0) {}
+
+    bool begin(const uint8_t *pins, uint8_t channel_count, uint32_t sample_rate_hz) override;
+    bool readBlock(uint8_t channel, AdcBlock &block) override;
+    bool setRateShift(uint8_t channel, uint8_t shift) override;
+    uint32_t overflows() const override { return overflow_count; }
+    void pause() override;
+    void resume() override;
+
+private:
+    SimulatedSignal signal;                  // Where the samples come from
+    uint8_t pins[MAX_CHANNELS];              // Pin of every channel, handed to the signal
+    uint8_t channel_count;                   // Number of channels
+    uint32_t period_us;                      // Time between two samples
+    uint32_t next_block_us[MAX_CHANNELS];    // Time of the first sample of the next block per channel
+    uint8_t shift[MAX_CHANNELS];             // Rate shift of every channel
+    uint32_t overflow_count;                 // Blocks dropped because the consumer was too slow
+    bool paused;                             // The sample clock is stopped
+    uint32_t paused_us;                      // When it stopped, no sample is taken after this
+};
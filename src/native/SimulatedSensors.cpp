@@ -0,0 +1,237 @@
+#include "SimulatedSensors.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Script keys, in the order of SimulatedSensors::Key
+static const char *const SCRIPT_KEYS[] = {"level", "noise", "drift", "spikes", "spike", "dropouts", "dropout_ms", "stuck", "floating"};
+
+SimulatedSensors::SimulatedSensors(uint32_t seed) : sensor_count(0), event_count(0), next_event(0), random_state(seed ? seed : 1)
+{
+}
+
+int8_t SimulatedSensors::add(const char *name, uint8_t pin, float level, float noise)
+{
+    if (sensor_count >= MAX_SENSORS)
+        return -1;
+
+    Sensor &sensor = sensors[sensor_count];
+    memset(&sensor, 0, sizeof(sensor));
+    sensor.name = name;
+    sensor.pin = pin;
+    sensor.level = level;
+    sensor.noise = noise;
+    sensor.dropout_us = 1000000;
+    return sensor_count++;
+}
+
+int8_t SimulatedSensors::find(const char *name) const
+{
+    for (uint8_t i = 0; i < sensor_count; i++)
+    {
+        if (strcmp(sensors[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int8_t SimulatedSensors::findPin(uint8_t pin) const
+{
+    for (uint8_t i = 0; i < sensor_count; i++)
+    {
+        if (sensors[i].pin == pin)
+            return i;
+    }
+    return -1;
+}
+
+int SimulatedSensors::load(const char *script)
+{
+    int line_number = 0;
+    while (*script)
+    {
+        // Copy one line so it can be cut into words, comments run to the end of the line
+        char line[128];
+        size_t length = strcspn(script, "\n");
+        line_number++;
+        if (length >= sizeof(line))
+            return line_number;
+        memcpy(line, script, length);
+        line[length] = '\0';
+        script += length + (script[length] == '\n');
+        char *comment = strchr(line, '#');
+        if (comment)
+            *comment = '\0';
+
+        char *save;
+        char *word = strtok_r(line, " \t\r", &save);
+        if (!word)
+            continue; // Empty or comment only
+
+        // Time in seconds, then the sensor, then any number of key=value pairs
+        char *end;
+        double seconds = strtod(word, &end);
+        if (*end || seconds < 0)
+            return line_number;
+        char *name = strtok_r(NULL, " \t\r", &save);
+        int8_t index = name ? find(name) : -1;
+        if (index < 0)
+            return line_number;
+
+        while ((word = strtok_r(NULL, " \t\r", &save)) != NULL)
+        {
+            char *equals = strchr(word, '=');
+            if (!equals || event_count >= MAX_EVENTS)
+                return line_number;
+            *equals = '\0';
+
+            Event event;
+            event.time_us = (uint32_t)(seconds * 1000000.0);
+            event.sensor = index;
+            event.value = strtof(equals + 1, &end);
+            if (*end)
+                return line_number;
+            uint8_t key = 0;
+            while (key < sizeof(SCRIPT_KEYS) / sizeof(SCRIPT_KEYS[0]) && strcmp(SCRIPT_KEYS[key], word) != 0)
+                key++;
+            if (key == sizeof(SCRIPT_KEYS) / sizeof(SCRIPT_KEYS[0]))
+                return line_number;
+            event.key = (Key)key;
+
+            // Keep the table sorted by time, changes at the same time stay in script order
+            uint8_t pos = event_count;
+            while (pos > 0 && events[pos - 1].time_us > event.time_us)
+            {
+                events[pos] = events[pos - 1];
+                pos--;
+            }
+            events[pos] = event;
+            event_count++;
+        }
+    }
+    return 0;
+}
+
+void SimulatedSensors::update(uint32_t now_us)
+{
+    while (next_event < event_count && (int32_t)(now_us - events[next_event].time_us) >= 0)
+        apply(events[next_event++]);
+}
+
+void SimulatedSensors::apply(const Event &event)
+{
+    Sensor &sensor = sensors[event.sensor];
+
+    // Fold the drift so far into the level, then the new parameters run from here
+    sensor.level = truth(event.sensor, event.time_us);
+    sensor.origin_us = event.time_us;
+
+    switch (event.key)
+    {
+    case KEY_LEVEL:
+        sensor.level = event.value;
+        break;
+    case KEY_NOISE:
+        sensor.noise = event.value;
+        break;
+    case KEY_DRIFT:
+        sensor.drift = event.value;
+        break;
+    case KEY_SPIKES:
+        sensor.spike_rate = event.value;
+        break;
+    case KEY_SPIKE:
+        sensor.spike_size = event.value;
+        break;
+    case KEY_DROPOUTS:
+        sensor.dropout_rate = event.value;
+        break;
+    case KEY_DROPOUT_MS:
+        sensor.dropout_us = (uint32_t)(event.value * 1000.0f);
+        break;
+    case KEY_STUCK:
+        sensor.stuck = event.value != 0;
+        sensor.stuck_held = false;
+        break;
+    case KEY_FLOATING:
+        sensor.floating = event.value != 0;
+        break;
+    }
+}
+
+float SimulatedSensors::truth(uint8_t index, uint32_t time_us) const
+{
+    const Sensor &sensor = sensors[index];
+    return sensor.level + sensor.drift * (int32_t)(time_us - sensor.origin_us) / 1e6f;
+}
+
+bool SimulatedSensors::sample(uint8_t index, uint32_t time_us, float &value)
+{
+    update(time_us);
+    Sensor &sensor = sensors[index];
+    float elapsed_s = (int32_t)(time_us - sensor.last_us) / 1e6f;
+    sensor.last_us = time_us;
+
+    // A running dropout hides the sensor until it ends, a new one starts with the scripted rate
+    if (sensor.dropped && (int32_t)(time_us - sensor.dropped_until) >= 0)
+        sensor.dropped = false;
+    if (!sensor.dropped && elapsed_s > 0 && uniform() < sensor.dropout_rate * elapsed_s)
+    {
+        sensor.dropped = true;
+        sensor.dropped_until = time_us + sensor.dropout_us;
+        sensor.dropouts++;
+    }
+    if (sensor.dropped)
+        return false;
+    if (sensor.floating)
+    {
+        value = uniform() * 4096.0f;
+        return true;
+    }
+
+    value = truth(index, time_us) + sensor.noise * gaussian();
+    if (elapsed_s > 0 && uniform() < sensor.spike_rate * elapsed_s)
+    {
+        value += uniform() < 0.5f ? sensor.spike_size : -sensor.spike_size;
+        sensor.spikes++;
+    }
+
+    // A frozen sensor keeps giving the first value it produced after the freeze
+    if (sensor.stuck)
+    {
+        if (!sensor.stuck_held)
+            sensor.stuck_value = value;
+        sensor.stuck_held = true;
+        value = sensor.stuck_value;
+    }
+    return true;
+}
+
+uint16_t SimulatedSensors::analogRead(uint8_t pin, uint32_t time_us)
+{
+    int8_t index = findPin(pin);
+    float value;
+    if (index < 0 || !sample(index, time_us, value))
+        return 0;
+
+    // Quantise and clip like the 12-bit converter
+    long counts = lroundf(value);
+    return counts < 0 ? 0 : counts > 4095 ? 4095 : counts;
+}
+
+float SimulatedSensors::uniform()
+{
+    // xorshift32, uniform in [0, 1)
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return (random_state >> 8) * (1.0f / 16777216.0f);
+}
+
+float SimulatedSensors::gaussian()
+{
+    // Box-Muller, one of the pair is enough
+    float u1 = uniform();
+    float u2 = uniform();
+    return sqrtf(-2.0f * logf(u1 + 1e-12f)) * cosf(6.2831853f * u2);
+}
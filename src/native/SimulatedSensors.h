@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdint.h>
+
+// Scriptable simulated sensors for the native build.
+//
+// Every sensor is a level with gaussian noise, a linear drift, random spikes
+// and random dropouts. Analog sensors are in raw 12-bit counts and are bound
+// to a pin, so the simulated ADC and halAnalogRead() can sample them; other
+// sensors (the DS18B20 probes) are read by the simulation by index. A script
+// changes the parameters while the simulation runs, one line per change:
+//
+//   # seconds  sensor  key=value ...
+//   0    tds   level=1807 noise=6
+//   120  temp0 drift=0.002
+//   300  ph    spikes=0.5 spike=600
+//   400  tds   dropouts=0.01 dropout_ms=2000
+//   500  ph    floating=1
+//
+// Keys: level, noise (standard deviation), drift (per second), spikes (per
+// second), spike (size, the sign is random), dropouts (per second),
+// dropout_ms, stuck (1 freezes the output at its current value, 0 lets it go)
+// and floating (1 turns an analog input into noise over the whole 12-bit
+// range, like an open pin). Everything is driven by a seeded generator, so a
+// run repeats exactly.
+class SimulatedSensors
+{
+public:
+    static const uint8_t MAX_SENSORS = 8;
+    static const uint8_t MAX_EVENTS = 64;
+    static const uint8_t NO_PIN = 0xFF;
+
+    // Current parameters and counters of one sensor
+    struct Sensor
+    {
+        const char *name;       // Name used in scripts
+        uint8_t pin;            // Analog pin, NO_PIN for sensors read by index
+        float level;            // Value at origin_us
+        float noise;            // Standard deviation of the noise
+        float drift;            // Change of the level per second
+        float spike_rate;       // Spikes per second
+        float spike_size;       // Height of a spike
+        float dropout_rate;     // Dropouts per second
+        uint32_t dropout_us;    // Length of a dropout
+        uint32_t origin_us;     // Time the level was last set, drift runs from here
+        uint32_t last_us;       // Time of the previous sample
+        uint32_t dropped_until; // End of the running dropout
+        bool dropped;           // A dropout is running
+        bool stuck;             // The output is frozen
+        bool stuck_held;        // stuck_value holds the frozen output
+        float stuck_value;
+        bool floating;          // The output is noise over the whole range
+        uint32_t spikes;        // Spikes produced so far
+        uint32_t dropouts;      // Dropouts started so far
+    };
+
+    explicit SimulatedSensors(uint32_t seed = 1);
+
+    // Add a sensor, returns its index or -1 if the table is full
+    int8_t add(const char *name, uint8_t pin, float level, float noise = 0);
+
+    // Index of a sensor by name or pin, -1 if there is none
+    int8_t find(const char *name) const;
+    int8_t findPin(uint8_t pin) const;
+
+    // Parse a script, returns 0 or the number of the first line that could not be parsed
+    int load(const char *script);
+
+    // Apply every scripted change that is due
+    void update(uint32_t now_us);
+
+    // Value of a sensor at a time, samples of one sensor must come in time order. False during a dropout
+    bool sample(uint8_t index, uint32_t time_us, float &value);
+
+    // Raw counts of the sensor on a pin, 0 during a dropout or for an unknown pin (a floating input reads low)
+    uint16_t analogRead(uint8_t pin, uint32_t time_us);
+
+    uint8_t count() const { return sensor_count; }
+    const Sensor &sensor(uint8_t index) const { return sensors[index]; }
+
+    // Level without noise, spikes or dropouts, what a perfect filter would report
+    float truth(uint8_t index, uint32_t time_us) const;
+
+private:
+    enum Key : uint8_t
+    {
+        KEY_LEVEL,
+        KEY_NOISE,
+        KEY_DRIFT,
+        KEY_SPIKES,
+        KEY_SPIKE,
+        KEY_DROPOUTS,
+        KEY_DROPOUT_MS,
+        KEY_STUCK,
+        KEY_FLOATING,
+    };
+
+    struct Event
+    {
+        uint32_t time_us; // When the change applies
+        uint8_t sensor;   // Sensor index
+        Key key;          // Parameter that changes
+        float value;      // New value
+    };
+
+    void apply(const Event &event);
+    float uniform();
+    float gaussian();
+
+    Sensor sensors[MAX_SENSORS];
+    uint8_t sensor_count;
+    Event events[MAX_EVENTS]; // Sorted by time
+    uint8_t event_count;
+    uint8_t next_event;       // First event not applied yet
+    uint32_t random_state;    // xorshift32 state
+};
@@ -0,0 +1,141 @@
+#include "TraceReplay.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+TraceParseStats traceParse(const uint8_t *data, size_t length, std::vector<RawTraceEvent> &events)
+{
+    TraceParseStats stats = {};
+    uint8_t chunk[TELEMETRY_BATCH_MAX];
+    size_t start = 0;
+    for (size_t i = 0; i <= length; i++)
+    {
+        if (i < length && data[i] != 0)
+            continue;
+        size_t frame_length = i - start;
+        const uint8_t *frame = data + start;
+        start = i + 1;
+        if (frame_length == 0)
+            continue;
+
+        size_t chunk_length;
+        uint16_t count;
+        if (frame_length > TELEMETRY_BATCH_FRAME_SIZE - 2 || !telemetryDecodeTrace(frame, frame_length, chunk, chunk_length, count))
+        {
+            stats.skipped++;
+            continue;
+        }
+        stats.frames++;
+        RawTraceDecoder decoder(chunk, chunk_length, count);
+        RawTraceEvent event;
+        while (decoder.next(event))
+        {
+            events.push_back(event);
+            stats.events++;
+        }
+        if (decoder.remaining() > 0)
+            stats.damaged++;
+    }
+    return stats;
+}
+
+bool traceLoad(const char *path, std::vector<uint8_t> &data)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+    uint8_t buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer + length);
+    fclose(file);
+    return true;
+}
+
+ReplayAdcSource::ReplayAdcSource(const std::vector<RawTraceEvent> &events) : channel_count(0), sample_count(0)
+{
+    for (const RawTraceEvent &event : events)
+    {
+        if (event.type != TRACE_ADC_BLOCK || event.channel >= MAX_CHANNELS)
+            continue;
+        std::vector<Entry> &queue = queues[event.channel];
+        // The block before this one was complete when this one started
+        if (!queue.empty())
+            queue.back().ready_us = event.block.timestamp_us;
+        queue.push_back({&event.block, event.block.timestamp_us});
+        if (event.channel >= channel_count)
+            channel_count = event.channel + 1;
+    }
+    for (uint8_t channel = 0; channel < MAX_CHANNELS; channel++)
+    {
+        // The last block takes as long as the one before it
+        std::vector<Entry> &queue = queues[channel];
+        size_t count = queue.size();
+        if (count >= 2)
+            queue[count - 1].ready_us = queue[count - 1].block->timestamp_us + (queue[count - 1].block->timestamp_us - queue[count - 2].block->timestamp_us);
+        next[channel] = 0;
+    }
+}
+
+bool ReplayAdcSource::readBlock(uint8_t channel, AdcBlock &block)
+{
+    if (channel >= MAX_CHANNELS || next[channel] == queues[channel].size())
+        return false;
+    const Entry &entry = queues[channel][next[channel]];
+    if ((int32_t)(entry.ready_us - fake_now_us) > 0)
+        return false;
+    block = *entry.block;
+    sample_count += block.count;
+    next[channel]++;
+    return true;
+}
+
+uint32_t ReplayAdcSource::blockPeriodUs() const
+{
+    const std::vector<Entry> &queue = queues[0];
+    if (queue.size() < 2)
+        return 1000000UL;
+    std::vector<uint32_t> gaps;
+    for (size_t i = 1; i < queue.size(); i++)
+        gaps.push_back(queue[i].block->timestamp_us - queue[i - 1].block->timestamp_us);
+    std::nth_element(gaps.begin(), gaps.begin() + gaps.size() / 2, gaps.end());
+    return gaps[gaps.size() / 2];
+}
+
+ReplayTemperatureBus::ReplayTemperatureBus(const std::vector<RawTraceEvent> &events) : probe_count(0)
+{
+    for (const RawTraceEvent &event : events)
+    {
+        if (event.type != TRACE_TEMPERATURE && event.type != TRACE_TEMPERATURE_MISSING)
+            continue;
+        reads[event.channel].push_back(&event);
+        if (event.channel >= probe_count)
+            probe_count = event.channel + 1;
+    }
+    memset(next, 0, sizeof(next));
+}
+
+bool ReplayTemperatureBus::address(uint8_t index, ProbeAddress address)
+{
+    if (index >= probe_count)
+        return false;
+    // A DS18B20 family code and the probe's index in the trace
+    memset(address, 0, sizeof(ProbeAddress));
+    address[0] = 0x28;
+    address[1] = index;
+    return true;
+}
+
+float ReplayTemperatureBus::readCelsius(const ProbeAddress address)
+{
+    uint8_t probe = address[1];
+    if (probe >= probe_count)
+        return PROBE_DISCONNECTED_C;
+    std::vector<const RawTraceEvent *> &list = reads[probe];
+    while (next[probe] < list.size() && (int32_t)(list[next[probe]]->time_us - fake_now_us) <= 0)
+        next[probe]++;
+    if (next[probe] == 0)
+        return PROBE_DISCONNECTED_C;
+    const RawTraceEvent &latest = *list[next[probe] - 1];
+    return latest.type == TRACE_TEMPERATURE ? latest.value : PROBE_DISCONNECTED_C;
+}
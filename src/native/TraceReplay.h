@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "RawTrace.h"
+#include "AdcBlockSource.h"
+#include "TemperatureBus.h"
+#include "FakeClock.h"
+
+// Host side of the raw traces: reading a capture back and playing it into
+// the firmware's pipeline in place of the ADC and the OneWire bus.
+
+// What a capture held besides the trace
+struct TraceParseStats
+{
+    uint32_t frames;     // Trace frames
+    uint32_t events;
+    uint32_t skipped;    // Other frames, report records and text lines
+    uint32_t damaged;    // Trace frames whose chunk did not decode to the end
+};
+
+// Split a capture on the zero delimiters and decode every trace frame in it, events are appended in capture order
+TraceParseStats traceParse(const uint8_t *data, size_t length, std::vector<RawTraceEvent> &events);
+
+// A capture file, false if it cannot be read
+bool traceLoad(const char *path, std::vector<uint8_t> &data);
+
+// ADC blocks of the trace. A block is handed out once the fake clock passes
+// the time it was complete, taken as the start of the next block of its
+// channel. Rate shifts are ignored, the trace has the rates of the capture.
+class ReplayAdcSource : public AdcBlockSource
+{
+public:
+    explicit ReplayAdcSource(const std::vector<RawTraceEvent> &events);
+
+    bool begin(const uint8_t *pins, uint8_t channel_count, uint32_t sample_rate_hz) override { return true; }
+    bool readBlock(uint8_t channel, AdcBlock &block) override;
+    bool setRateShift(uint8_t channel, uint8_t shift) override { return true; }
+    uint32_t overflows() const override { return 0; }
+    void pause() override {}
+    void resume() override {}
+
+    // Median time between two blocks of the first channel, what the pipeline polls at
+    uint32_t blockPeriodUs() const;
+
+    uint64_t samples() const { return sample_count; } // Samples handed out so far
+    uint8_t channelCount() const { return channel_count; }
+
+private:
+    struct Entry
+    {
+        const AdcBlock *block;
+        uint32_t ready_us;
+    };
+
+    std::vector<Entry> queues[MAX_CHANNELS];
+    size_t next[MAX_CHANNELS];
+    uint8_t channel_count;
+    uint64_t sample_count;
+};
+
+// DS18B20 reads of the trace. The bus has a probe for every probe in the
+// trace; a read returns the latest value the trace has for it by now, and a
+// probe that did not answer then does not answer now.
+class ReplayTemperatureBus : public TemperatureBus
+{
+public:
+    explicit ReplayTemperatureBus(const std::vector<RawTraceEvent> &events);
+
+    uint8_t scan() override { return probe_count; }
+    bool address(uint8_t index, ProbeAddress address) override;
+    bool setResolution(const ProbeAddress address, uint8_t bits) override { return true; }
+    bool startConversion(const ProbeAddress address) override { return address[1] < probe_count; }
+    float readCelsius(const ProbeAddress address) override;
+
+private:
+    std::vector<const RawTraceEvent *> reads[16];
+    size_t next[16];
+    uint8_t probe_count;
+};
@@ -0,0 +1,57 @@
+// Entry point of the native PlatformIO env.
+// pio run -e native && .pio/build/native/program [command]
+#include <stdio.h>
+#include <string.h>
+#include "NativeCommands.h"
+
+// Commands the native program understands
+struct NativeCommand
+{
+    const char *name;                  // Name given on the command line
+    int (*run)(int argc, char **argv); // Entry point, gets the arguments after the name
+    const char *summary;               // One line of help
+};
+
+const NativeCommand native_commands[] = {
+    {"sim", simulateScheduler, "[script] [seconds] run the sensor pipeline on simulated sensors"},
+    {"sim-sleep", simulateSleep, "duty-cycled light and deep sleep, wake latency and RTC resume"},
+    {"sim-dose", simulateDosing, "pH and nutrient dosing loops on a reservoir model, control tick jitter"},
+    {"sim-faults", simulateFaults, "injected probe faults, detection rate, latency, false alarms and recovery"},
+    {"bench-adaptive", benchAdaptive, "[trace.csv] adaptive sampling against fixed rates, accuracy and cost"},
+    {"bench-filters", benchFilters, "streaming filters against the old sorts, cycles per update"},
+    {"check-cal", checkCalibration, "calibrated conversion cost"},
+    {"bench-math", benchMath, "float and fixed-point sensor math against double, error and cycles"},
+    {"bench-profile", benchProfiler, "profiler scope overhead and stage timings"},
+    {"bench-series", benchSeries, "compressed history ratio, codec speed and rollup tiers"},
+    {"bench-mqtt", benchMqtt, "batched MQTT throughput and the offline queue through link outages"},
+    {"bench-ads", benchAds, "ADS1x15 chain rates, scan latency and bus load, batched against polled"},
+    {"check-layout", checkLayout, "compile-time probe layouts, their RAM and every one through the pipeline"},
+    {"bench-replay", benchReplay, "[trace] [baseline] replay a raw trace, accuracy, samples/s and stage costs"},
+    {"record-trace", recordTrace, "<file> record the built-in raw trace of bench-replay"},
+    {"bench-decimate", benchDecimate, "oversampling decimator, effective bits against cycles and through the pipeline"},
+    {"bench-fusion", benchFusion, "kalman fusion of the sensors against the filters, error, bounds and cost"},
+    {"decode", decodeTelemetry, "decode a binary telemetry capture from stdin into CSV"},
+    {"bench-log", benchFlashLog, "flash log append and scan throughput, bytes written"},
+    {"collect", collectTelemetry, "[port] [seconds] [tty ...] collect the telemetry of many nodes"},
+    {"loadgen", generateLoad, "[nodes] [rate] [seconds] [port] simulated nodes sending to the collector"},
+    {"bench-collect", benchCollector, "[nodes] collector records/s, ingest latency and query speed"},
+};
+
+// The test runner of "pio test -e native" links the same sources and brings its own main()
+#ifndef PIO_UNIT_TESTING
+int main(int argc, char **argv)
+{
+    // Without arguments run the simulation, that is what the env was made for
+    const char *name = argc > 1 ? argv[1] : "sim";
+    for (const NativeCommand &command : native_commands)
+    {
+        if (strcmp(command.name, name) == 0)
+            return command.run(argc > 2 ? argc - 2 : 0, argv + 2);
+    }
+
+    fprintf(stderr, "usage: %s [command]\n", argv[0]);
+    for (const NativeCommand &command : native_commands)
+        fprintf(stderr, "  %-16s %s\n", command.name, command.summary);
+    return 2;
+}
+#endif
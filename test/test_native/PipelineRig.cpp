@@ -0,0 +1,52 @@
+#include "PipelineRig.h"
+#include <string.h>
+#include "Hal.h"
+#include "native/FakeClock.h"
+#include "native/ReferenceAdcCurve.h"
+
+RigChannel rig_channels[READING_EC + 1];
+
+static void rigSink(ReadingChannel channel, uint8_t index, float value, SensorQuality quality)
+{
+    if (index != 0)
+        return;
+    rig_channels[channel].value = value;
+    rig_channels[channel].quality = quality;
+    rig_channels[channel].count++;
+}
+
+PipelineRig::PipelineRig(SimulatedSignal signal, float celsius)
+    : temperatures(bus, halMicros), adc(signal), scheduler(halMicros),
+      pipeline(adc, temperatures, tds_calibration, ph_calibration)
+{
+    // None of the members reads the clock before begin()
+    fake_now_us = 0;
+    memset(rig_channels, 0, sizeof(rig_channels));
+    tds_calibration.build(referenceAdcMillivolts, &REFERENCE_ADC1);
+    ph_calibration.build(referenceAdcMillivolts, &REFERENCE_ADC2);
+    bus.addProbe(celsius);
+}
+
+void PipelineRig::begin(uint32_t rate_hz)
+{
+    const uint8_t pins[] = {RIG_PIN_TDS, RIG_PIN_PH};
+    temperatures.begin(halMicros());
+    adc.begin(pins, 2, rate_hz);
+    pipeline.begin(scheduler, rigSink, 1000000UL * ADC_BLOCK_SIZE / rate_hz, 10000000UL);
+}
+
+void PipelineRig::resume(const TemperatureEngine::Snapshot &probes, const SensorPipeline::Snapshot &filters)
+{
+    const uint8_t pins[] = {RIG_PIN_TDS, RIG_PIN_PH};
+    temperatures.resume(probes, halMicros());
+    adc.begin(pins, 2, RIG_ADC_RATE_HZ);
+    pipeline.begin(scheduler, rigSink, 1000000UL * ADC_BLOCK_SIZE / RIG_ADC_RATE_HZ, 10000000UL);
+    pipeline.resume(filters);
+}
+
+void PipelineRig::run(uint32_t ms)
+{
+    uint32_t end_us = fake_now_us + ms * 1000;
+    while ((int32_t)(fake_now_us - end_us) < 0)
+        fakeSpend(scheduler.runOnce());
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "SensorPipeline.h"
+#include "Scheduler.h"
+#include "TemperatureEngine.h"
+#include "AdcCalibration.h"
+#include "native/MockTemperatureBus.h"
+#include "native/SimulatedAdcSource.h"
+
+#define RIG_PIN_PH 25
+#define RIG_PIN_TDS 34
+#define RIG_ADC_RATE_HZ 250
+
+// What the sink received on a channel, probe 0 only
+struct RigChannel
+{
+    float value;           // Latest value
+    SensorQuality quality; // and its quality
+    uint32_t count;        // Values received
+};
+
+extern RigChannel rig_channels[READING_EC + 1];
+
+// The firmware's pipeline on the fake clock: a mock OneWire bus with one
+// probe, the simulated ADC on the TDS and pH pins and the reference ADC
+// tables. Every constructor starts the clock and the sink over at zero.
+struct PipelineRig
+{
+    PipelineRig(SimulatedSignal signal, float celsius);
+
+    // Start the engine, the ADC and the pipeline at a sample rate
+    void begin(uint32_t rate_hz = RIG_ADC_RATE_HZ);
+
+    // Start the same way from what a deep sleep kept, without a bus scan
+    void resume(const TemperatureEngine::Snapshot &probes, const SensorPipeline::Snapshot &filters);
+
+    // Run the scheduler for a while of fake time
+    void run(uint32_t ms);
+
+    MockTemperatureBus bus;
+    TemperatureEngine temperatures;
+    SimulatedAdcSource adc;
+    Scheduler scheduler;
+    AdcCalibration tds_calibration;
+    AdcCalibration ph_calibration;
+    SensorPipeline pipeline;
+};
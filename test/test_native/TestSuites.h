@@ -0,0 +1,30 @@
+#pragma once
+
+// Host unit tests, run with: pio test -e native
+//
+// One file per module, each registers its cases with Unity through its run
+// function. The suite links the firmware sources and the native HAL, so the
+// tests drive the same code the board runs, on the fake clock.
+
+void runSchedulerTests();
+void runHalTests();
+void runPipelineTests();
+void runAdcCalibrationTests();
+void runTelemetryTests();
+void runSensorMathTests();
+void runSensorStateTests();
+void runFlashLogTests();
+void runDutyCycleTests();
+void runCollectorTests();
+void runCalibrationTests();
+void runProfilerTests();
+void runSensorHealthTests();
+void runAdaptiveRateTests();
+void runSeriesTests();
+void runMqttTests();
+void runAds1x15Tests();
+void runRawTraceTests();
+void runLayoutTests();
+void runDecimatorTests();
+void runFusionTests();
+void runFiltersTests();
@@ -0,0 +1,218 @@
+#include <unity.h>
+#include <math.h>
+#include "TestSuites.h"
+#include "AdaptiveRate.h"
+#include "PipelineRig.h"
+#include "native/FakeClock.h"
+
+// The pipeline's pH limits
+static const AdaptiveRateConfig PH_LIMITS = {
+    0, 3,
+    5.0f, 30.0f,
+    0.01f, 0.05f,
+    0.001f, 0.005f,
+    30.0f,
+};
+
+// One value every 256 ms, the pipeline's block period at 250 Hz
+#define RATE_PERIOD_US 256000UL
+
+// Standard normal sample, Box-Muller on xorshift32
+static float normalNoise(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    float u1 = (state + 1.0f) / 4294967296.0f;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    float u2 = state / 4294967296.0f;
+    return sqrtf(-2.0f * logf(u1)) * cosf(6.2831853f * u2);
+}
+
+// Feed a constant value up to a time, returns the time reached
+static uint32_t feedConstant(AdaptiveRate &rate, float value, uint32_t now, uint32_t until)
+{
+    while ((int32_t)(until - now) > 0)
+        rate.update(value, now += RATE_PERIOD_US);
+    return now;
+}
+
+static void test_rate_quiet_channel_halves_once_per_hold()
+{
+    AdaptiveRate rate;
+    rate.configure(PH_LIMITS);
+    TEST_ASSERT_EQUAL_UINT8(0, rate.update(6.5f, 0));
+
+    uint32_t now = feedConstant(rate, 6.5f, 0, 29000000);
+    TEST_ASSERT_EQUAL_UINT8(0, rate.shift());
+    now = feedConstant(rate, 6.5f, now, 31000000);
+    TEST_ASSERT_EQUAL_UINT8(1, rate.shift());
+    now = feedConstant(rate, 6.5f, now, 59000000);
+    TEST_ASSERT_EQUAL_UINT8(1, rate.shift());
+    now = feedConstant(rate, 6.5f, now, 62000000);
+    TEST_ASSERT_EQUAL_UINT8(2, rate.shift());
+
+    // Never slower than max_shift
+    feedConstant(rate, 6.5f, now, 600000000);
+    TEST_ASSERT_EQUAL_UINT8(PH_LIMITS.max_shift, rate.shift());
+}
+
+static void test_rate_step_goes_straight_back_to_full_rate()
+{
+    AdaptiveRate rate;
+    rate.configure(PH_LIMITS);
+    rate.update(6.5f, 0);
+    uint32_t now = feedConstant(rate, 6.5f, 0, 300000000);
+    TEST_ASSERT_EQUAL_UINT8(3, rate.shift());
+
+    // A dose moves the pH, one value is enough
+    TEST_ASSERT_EQUAL_UINT8(0, rate.update(6.0f, now + 8 * RATE_PERIOD_US));
+    TEST_ASSERT_GREATER_THAN_FLOAT(PH_LIMITS.busy_sd, rate.deviation());
+}
+
+static void test_rate_slope_of_a_ramp()
+{
+    AdaptiveRate rate;
+    rate.configure(PH_LIMITS);
+    uint32_t now = 0;
+    for (uint32_t i = 0; i < 2000; i++)
+    {
+        now += RATE_PERIOD_US;
+        rate.update(6.0f + 0.01f * now / 1e6f, now);
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.0002f, 0.01f, rate.slope());
+    TEST_ASSERT_EQUAL_UINT8(0, rate.shift()); // Above busy_slope
+
+    // A ramp below quiet_slope is quiet
+    AdaptiveRate slow;
+    slow.configure(PH_LIMITS);
+    now = 0;
+    for (uint32_t i = 0; i < 2000; i++)
+    {
+        now += RATE_PERIOD_US;
+        slow.update(6.0f + 0.0002f * now / 1e6f, now);
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.00002f, 0.0002f, slow.slope());
+    TEST_ASSERT_GREATER_THAN(0, slow.shift());
+}
+
+static void test_rate_deviation_does_not_depend_on_the_rate()
+{
+    // The same noise seen at the fastest and at the slowest rate
+    const uint32_t periods[] = {RATE_PERIOD_US, RATE_PERIOD_US << 3};
+    for (uint32_t period : periods)
+    {
+        AdaptiveRate rate;
+        rate.configure(PH_LIMITS);
+        uint32_t seed = 0x9e3779b9;
+        uint32_t now = 0;
+        float sum = 0;
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < 20000; i++)
+        {
+            rate.update(6.5f + 0.02f * normalNoise(seed), now += period);
+            if (i >= 1000)
+            {
+                sum += rate.deviation();
+                count++;
+            }
+        }
+        TEST_ASSERT_FLOAT_WITHIN(0.004f, 0.021f, sum / count);
+    }
+}
+
+static void test_rate_boost_and_clock_wrap()
+{
+    AdaptiveRate rate;
+    rate.configure(PH_LIMITS);
+    uint32_t start = 0xFFFFFFFFUL - 100000000UL; // Wraps after 100 s
+    rate.update(6.5f, start);
+    uint32_t now = feedConstant(rate, 6.5f, start, start + 200000000UL);
+    TEST_ASSERT_EQUAL_UINT8(3, rate.shift());
+
+    // A boost is full rate until the next hold has passed
+    rate.boost();
+    TEST_ASSERT_EQUAL_UINT8(0, rate.shift());
+    now = feedConstant(rate, 6.5f, now, now + 29000000);
+    TEST_ASSERT_EQUAL_UINT8(0, rate.shift());
+
+    // A value at the same time changes nothing
+    TEST_ASSERT_EQUAL_UINT8(0, rate.update(9.0f, now));
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, 0.0f, rate.deviation());
+}
+
+// Pipeline runs of the same tank at the base rates and adaptive
+#define RATE_RUN_S 2400
+#define RATE_DOSE_S 1200         // A pH down dose here, mixed in with a 3 minute time constant
+#define RATE_WARMUP_S 60         // Not compared, the filters fill up
+
+// Raw pH counts of the tank, with a few counts of noise that depend on the sample time only
+static uint16_t tankSignal(uint8_t pin, uint32_t time_us)
+{
+    uint32_t noise = (time_us / 4000) * 2654435761UL >> 29;
+    if (pin != RIG_PIN_PH)
+        return 1807 + noise % 3;
+    float dosed = time_us < RATE_DOSE_S * 1000000UL ? 0 : 1.0f - expf(-(time_us / 1e6f - RATE_DOSE_S) / 180.0f);
+    return (uint16_t)(3300 + 120 * dosed) + noise % 5;
+}
+
+// The pH the node reports once a second
+static void runTank(bool adaptive, float *reported, SamplingStats &stats)
+{
+    PipelineRig rig(tankSignal, 21.3f);
+    rig.begin();
+    rig.pipeline.setAdaptive(adaptive);
+    for (uint32_t second = 0; second < RATE_RUN_S; second++)
+    {
+        // The firmware boosts when the pump starts
+        if (second == RATE_DOSE_S)
+            rig.pipeline.boost();
+        // Up to the second, the slow steps of the adaptive run overshoot it and must not add up
+        uint32_t end_us = (second + 1) * 1000000UL;
+        if ((int32_t)(end_us - fake_now_us) > 0)
+            rig.run((end_us - fake_now_us + 999) / 1000);
+        reported[second] = rig_channels[READING_PH].value;
+        if (adaptive && second == RATE_DOSE_S - 1)
+            TEST_ASSERT_EQUAL_UINT8(PH_LIMITS.max_shift, rig.pipeline.rate(READING_PH).shift());
+        if (adaptive && second == RATE_DOSE_S)
+            TEST_ASSERT_EQUAL_UINT8(0, rig.pipeline.rate(READING_PH).shift());
+    }
+    stats = rig.pipeline.samplingStats();
+}
+
+static void test_pipeline_adaptive_saves_work_and_keeps_accuracy()
+{
+    static float fixed[RATE_RUN_S], adaptive[RATE_RUN_S];
+    SamplingStats fixed_stats, adaptive_stats;
+    runTank(false, fixed, fixed_stats);
+    runTank(true, adaptive, adaptive_stats);
+
+    // At the base rates every conversion is one the fixed count has too
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)fixed_stats.adc_fixed, (uint32_t)fixed_stats.adc_conversions);
+    TEST_ASSERT_EQUAL_UINT32(fixed_stats.onewire_fixed, fixed_stats.onewire);
+
+    // A quiet tank with one dose needs well under half the conversions and transactions
+    TEST_ASSERT_LESS_THAN_UINT32((uint32_t)adaptive_stats.adc_fixed / 2, (uint32_t)adaptive_stats.adc_conversions);
+    TEST_ASSERT_LESS_THAN_UINT32(adaptive_stats.onewire_fixed / 2, adaptive_stats.onewire);
+    TEST_ASSERT_LESS_THAN_UINT32((uint32_t)fixed_stats.adc_conversions / 2, (uint32_t)adaptive_stats.adc_conversions);
+
+    // And reports what the base rates report, through the dose as well
+    double sum_squares = 0;
+    for (uint32_t second = RATE_WARMUP_S; second < RATE_RUN_S; second++)
+        sum_squares += (adaptive[second] - fixed[second]) * (adaptive[second] - fixed[second]);
+    TEST_ASSERT_LESS_THAN_FLOAT(0.01f, (float)sqrt(sum_squares / (RATE_RUN_S - RATE_WARMUP_S)));
+    TEST_ASSERT_FLOAT_WITHIN(0.02f, fixed[RATE_RUN_S - 1], adaptive[RATE_RUN_S - 1]);
+    TEST_ASSERT_GREATER_THAN_FLOAT(0.2f, fixed[RATE_DOSE_S - 1] - fixed[RATE_RUN_S - 1]);
+}
+
+void runAdaptiveRateTests()
+{
+    RUN_TEST(test_rate_quiet_channel_halves_once_per_hold);
+    RUN_TEST(test_rate_step_goes_straight_back_to_full_rate);
+    RUN_TEST(test_rate_slope_of_a_ramp);
+    RUN_TEST(test_rate_deviation_does_not_depend_on_the_rate);
+    RUN_TEST(test_rate_boost_and_clock_wrap);
+    RUN_TEST(test_pipeline_adaptive_saves_work_and_keeps_accuracy);
+}
@@ -0,0 +1,77 @@
+#include <unity.h>
+#include "TestSuites.h"
+#include "AdcCalibration.h"
+#include "native/ReferenceAdcCurve.h"
+
+// esp_adc_cal's linear default-Vref characterisation for 11 dB, in float
+static float referenceFloat(const ReferenceAdcUnit &unit, float raw)
+{
+    return 1100.0f * unit.atten_scale / 4096.0f * raw / 65536.0f + unit.atten_offset;
+}
+
+static void checkTable(const ReferenceAdcUnit &unit, float full_scale_mv)
+{
+    static AdcCalibration calibration;
+    calibration.build(referenceAdcMillivolts, &unit);
+    TEST_ASSERT_TRUE(calibration.ready());
+
+    // Every entry within a millivolt of the float curve, rising with the count
+    for (uint16_t raw = 0; raw <= ADC_RAW_MAX; raw++)
+    {
+        TEST_ASSERT_FLOAT_WITHIN(1.0f, referenceFloat(unit, raw), calibration.millivolts(raw));
+        if (raw > 0)
+            TEST_ASSERT_GREATER_OR_EQUAL(calibration.millivolts(raw - 1), calibration.millivolts(raw));
+    }
+
+    // The ends: the offset at zero, the full 11 dB range at the top, and anything above it clamps
+    TEST_ASSERT_EQUAL_UINT16(unit.atten_offset, calibration.millivolts(0));
+    TEST_ASSERT_FLOAT_WITHIN(1.0f, full_scale_mv, calibration.millivolts(ADC_RAW_MAX));
+    TEST_ASSERT_EQUAL_UINT16(calibration.millivolts(ADC_RAW_MAX), calibration.millivolts(ADC_RAW_MAX + 100));
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, calibration.millivolts(ADC_RAW_MAX) * 0.001f, calibration.volts(ADC_RAW_MAX));
+}
+
+static void test_adc_table_matches_adc1_reference()
+{
+    checkTable(REFERENCE_ADC1, 3441.0f);
+}
+
+static void test_adc_table_matches_adc2_reference()
+{
+    checkTable(REFERENCE_ADC2, 3441.0f);
+}
+
+static void test_adc_fractional_counts_follow_the_curve()
+{
+    // A decimated average with 8 bits below the count: within a millivolt of the float curve and never going back
+    static AdcCalibration calibration;
+    calibration.build(referenceAdcMillivolts, &REFERENCE_ADC2);
+    float previous = 0;
+    for (uint32_t raw = 0; raw <= (uint32_t)ADC_RAW_MAX << 8; raw += 37)
+    {
+        float millivolts = calibration.millivolts(raw, 8);
+        TEST_ASSERT_FLOAT_WITHIN(1.0f, referenceFloat(REFERENCE_ADC2, raw / 256.0f), millivolts);
+        TEST_ASSERT_GREATER_OR_EQUAL_FLOAT(previous - 0.001f, millivolts);
+        previous = millivolts;
+    }
+}
+
+static uint32_t overRange(uint16_t raw, const void *context)
+{
+    return raw * 20UL;
+}
+
+static void test_adc_table_saturates()
+{
+    static AdcCalibration calibration;
+    calibration.build(overRange, NULL);
+    TEST_ASSERT_EQUAL_UINT16(40000, calibration.millivolts(2000));
+    TEST_ASSERT_EQUAL_UINT16(UINT16_MAX, calibration.millivolts(4000));
+}
+
+void runAdcCalibrationTests()
+{
+    RUN_TEST(test_adc_table_matches_adc1_reference);
+    RUN_TEST(test_adc_table_matches_adc2_reference);
+    RUN_TEST(test_adc_fractional_counts_follow_the_curve);
+    RUN_TEST(test_adc_table_saturates);
+}
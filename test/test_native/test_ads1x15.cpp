@@ -0,0 +1,293 @@
+#include <unity.h>
+#include <math.h>
+#include <string.h>
+#include "TestSuites.h"
+#include "Ads1x15Source.h"
+#include "Scheduler.h"
+#include "TemperatureEngine.h"
+#include "SensorPipeline.h"
+#include "AdcCalibration.h"
+#include "Hal.h"
+#include "native/FakeClock.h"
+#include "native/MockTemperatureBus.h"
+#include "native/MockAds1x15Bus.h"
+
+#define ADS_TEST_WAKE_US 20   // Pin interrupt to sampling task running
+
+static const uint8_t ads_addresses[ADS1X15_MAX_DEVICES] = {0x48, 0x49, 0x4A, 0x4B};
+static const float ads_clock_errors[ADS1X15_MAX_DEVICES] = {0.03f, -0.02f, 0.05f, -0.04f};
+
+// Every input has its own voltage unless the context gives them
+static float adsVolts(uint8_t device, uint8_t input)
+{
+    return 0.15f + 0.2f * (device * ADS1X15_INPUTS + input);
+}
+
+static float adsSignal(uint8_t device, uint8_t input, uint32_t time_us, void *context)
+{
+    if (context)
+        return ((const float *)context)[device * ADS1X15_INPUTS + input];
+    return adsVolts(device, input);
+}
+
+// Chain input of channel i, the channels go round the devices
+static uint8_t adsPin(uint8_t channel, uint8_t devices)
+{
+    return ADS1X15_INPUT(channel % devices, channel / devices);
+}
+
+// Deliver the pulses up to a time as the pin interrupts would, and take the rounds they complete
+static void adsAdvance(MockAds1x15Bus &mock, Ads1x15Source &source, uint32_t until_us)
+{
+    uint8_t device;
+    uint32_t at;
+    while ((at = mock.nextAlert(device)) != UINT32_MAX && (int32_t)(at - until_us) <= 0)
+    {
+        if ((int32_t)(at - fake_now_us) > 0)
+            fake_now_us = at;
+        mock.takeAlert(device);
+        if (source.ready(device))
+        {
+            fakeSpend(ADS_TEST_WAKE_US);
+            source.service(fake_now_us);
+        }
+    }
+    if ((int32_t)(until_us - fake_now_us) > 0)
+        fake_now_us = until_us;
+}
+
+// A chain of devices on the mock bus
+struct AdsChain
+{
+    MockAds1x15Bus mock;
+    Ads1x15Source source;
+    uint8_t pins[ADS1X15_MAX_CHANNELS];
+
+    AdsChain(uint8_t devices, Ads1x15Model model, const float *volts = NULL)
+        : mock(adsSignal, (void *)volts, model == ADS1015), source(mock, ads_addresses, devices, model)
+    {
+        for (uint8_t i = 0; i < devices; i++)
+            mock.addDevice(ads_addresses[i], ads_clock_errors[i]);
+    }
+
+    bool begin(uint8_t channels, uint8_t devices, uint32_t rate_hz)
+    {
+        for (uint8_t i = 0; i < channels; i++)
+            pins[i] = adsPin(i, devices);
+        return source.begin(pins, channels, rate_hz);
+    }
+};
+
+static void test_ads_data_rate_is_the_slowest_that_keeps_up()
+{
+    fake_now_us = 0;
+
+    // One input per device at 100 Hz: 128 conversions per second
+    AdsChain spread(4, ADS1115);
+    TEST_ASSERT_TRUE(spread.begin(4, 4, 100));
+    TEST_ASSERT_EQUAL_UINT16(128, spread.source.dataRate());
+    TEST_ASSERT_EQUAL_HEX8(0x0F, spread.source.activeMask());
+
+    // Four inputs on one device at 250 Hz ask for more than the fastest rate
+    AdsChain single(1, ADS1115);
+    TEST_ASSERT_TRUE(single.begin(4, 1, 250));
+    TEST_ASSERT_EQUAL_UINT16(860, single.source.dataRate());
+
+    // Four ADS1015 share the bus, a round of all four has to fit in a conversion
+    AdsChain fast(4, ADS1015);
+    TEST_ASSERT_TRUE(fast.begin(8, 4, 10000));
+    TEST_ASSERT_EQUAL_UINT16(920, fast.source.dataRate());
+    TEST_ASSERT_GREATER_OR_EQUAL(9 * 9 * 1000000UL * 4 / ADS1X15_BUS_HZ, 1000000UL / fast.source.dataRate());
+}
+
+static void test_ads_begin_refuses_a_bad_layout()
+{
+    fake_now_us = 0;
+    AdsChain chain(2, ADS1115);
+    uint8_t pins[] = {ADS1X15_INPUT(0, 0), ADS1X15_INPUT(2, 0)};
+    TEST_ASSERT_FALSE(chain.source.begin(pins, 2, 100));   // No third device
+    TEST_ASSERT_FALSE(chain.source.begin(pins, 0, 100));
+    TEST_ASSERT_FALSE(chain.source.begin(pins, 1, 0));
+
+    // A device that is not on the bus does not acknowledge
+    Ads1x15Source missing(chain.mock, ads_addresses, 3, ADS1115);
+    uint8_t third[] = {ADS1X15_INPUT(2, 0)};
+    TEST_ASSERT_FALSE(missing.begin(third, 1, 100));
+}
+
+static void test_ads_round_waits_for_every_device()
+{
+    fake_now_us = 0;
+    AdsChain chain(3, ADS1115);
+    uint8_t pins[] = {ADS1X15_INPUT(0, 0), ADS1X15_INPUT(2, 0)};  // The second device has no input in use
+    TEST_ASSERT_TRUE(chain.source.begin(pins, 2, 100));
+    TEST_ASSERT_EQUAL_HEX8(0x05, chain.source.activeMask());
+
+    TEST_ASSERT_FALSE(chain.source.ready(0));
+    TEST_ASSERT_FALSE(chain.source.ready(1));
+    TEST_ASSERT_TRUE(chain.source.ready(2));
+    TEST_ASSERT_TRUE(chain.source.service(fake_now_us));
+    TEST_ASSERT_EQUAL_UINT32(1, chain.source.stats().rounds);
+
+    // Signalling twice before the round is taken is a missed conversion
+    TEST_ASSERT_FALSE(chain.source.ready(0));
+    TEST_ASSERT_FALSE(chain.source.ready(0));
+    TEST_ASSERT_EQUAL_UINT32(1, chain.source.missedTicks());
+
+    // After a pause the last conversions must not start a round
+    chain.source.pause();
+    TEST_ASSERT_FALSE(chain.source.ready(2));
+    TEST_ASSERT_FALSE(chain.source.service(fake_now_us));
+    chain.source.resume();
+    TEST_ASSERT_FALSE(chain.source.ready(0));
+    TEST_ASSERT_TRUE(chain.source.ready(2));
+}
+
+// Run a layout flat out for a while, the samples must land in their channels
+static void runLayout(uint8_t channels, uint8_t devices, Ads1x15Model model)
+{
+    fake_now_us = 0;
+    AdsChain chain(devices, model);
+    TEST_ASSERT_TRUE(chain.begin(channels, devices, 10000));
+    uint32_t transactions = chain.mock.transactions;
+    const uint32_t run_us = 5000000;
+    uint32_t samples[ADS1X15_MAX_CHANNELS] = {};
+    while ((int32_t)(run_us - fake_now_us) > 0)
+    {
+        adsAdvance(chain.mock, chain.source, fake_now_us + 1000);
+        AdcBlock block;
+        for (uint8_t i = 0; i < channels; i++)
+        {
+            while (chain.source.readBlock(i, block))
+            {
+                samples[i] += block.count;
+                float expected = adsVolts(chain.pins[i] / ADS1X15_INPUTS, chain.pins[i] % ADS1X15_INPUTS) * 1000.0f;
+                for (uint16_t s = 0; s < block.count; s++)
+                    TEST_ASSERT_FLOAT_WITHIN(model == ADS1115 ? 1.0f : 2.0f, expected, block.samples[s]);
+            }
+        }
+    }
+    const Ads1x15Stats &stats = chain.source.stats();
+    TEST_ASSERT_EQUAL_UINT32(0, stats.missed);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.bus_errors);
+    TEST_ASSERT_EQUAL_UINT32(0, chain.source.overflows());
+
+    // One transaction per round, no polling
+    TEST_ASSERT_EQUAL_UINT32(stats.rounds, chain.mock.transactions - transactions);
+
+    // The devices convert in parallel: a round is the slowest device's conversion, at most the transaction and the wake-up longer
+    uint8_t per_device = (channels + devices - 1) / devices;
+    float slowest = 0;
+    for (uint8_t i = 0; i < devices; i++)
+        slowest = fmaxf(slowest, ads_clock_errors[i]);
+    float slowest_us = 1e6f / chain.source.dataRate() * (1.0f + slowest);
+    float round_us = (float)run_us / stats.rounds;
+    TEST_ASSERT_GREATER_OR_EQUAL_FLOAT(slowest_us * 0.999f, round_us);
+    float transaction_us = MockAds1x15Bus::TRANSACTION_US + 9 * 9 * MockAds1x15Bus::BIT_NS / 1000.0f * devices + ADS_TEST_WAKE_US;
+    TEST_ASSERT_LESS_OR_EQUAL_FLOAT(slowest_us + transaction_us, round_us);
+
+    // Every input gets its share of the rounds, a sample every per_device rounds
+    for (uint8_t i = 0; i < channels; i++)
+    {
+        const MockAds1x15Bus::InputStats &input = chain.mock.inputs[chain.pins[i] / ADS1X15_INPUTS][chain.pins[i] % ADS1X15_INPUTS];
+        TEST_ASSERT_UINT32_WITHIN(1, stats.rounds / per_device, input.reads);
+        TEST_ASSERT_FLOAT_WITHIN(per_device * round_us * 0.02f, per_device * round_us, (float)input.gap_sum_us / (input.reads - 1));
+        TEST_ASSERT_GREATER_OR_EQUAL(ADC_BLOCK_SIZE * (stats.rounds / per_device / ADC_BLOCK_SIZE), samples[i]);
+    }
+}
+
+static void test_ads_rounds_paced_by_alert_rdy()
+{
+    runLayout(4, 1, ADS1115);
+    runLayout(4, 4, ADS1115);
+    runLayout(8, 2, ADS1115);
+    runLayout(16, 4, ADS1115);
+    runLayout(8, 4, ADS1015);
+}
+
+static void test_ads_rate_shift_skips_an_input()
+{
+    fake_now_us = 0;
+    AdsChain chain(1, ADS1115);
+    TEST_ASSERT_TRUE(chain.begin(2, 1, 10000));
+    TEST_ASSERT_TRUE(chain.source.setRateShift(1, 2));
+    TEST_ASSERT_FALSE(chain.source.setRateShift(2, 1));
+    TEST_ASSERT_FALSE(chain.source.setRateShift(0, 16));
+
+    // The shifted input takes part in every fourth scan, the other input gets the time
+    adsAdvance(chain.mock, chain.source, 5000000);
+    uint32_t fast = chain.mock.inputs[0][0].reads, slow = chain.mock.inputs[0][1].reads;
+    TEST_ASSERT_UINT32_WITHIN(2, chain.source.stats().rounds, fast + slow);
+    TEST_ASSERT_UINT32_WITHIN(2, fast / 4, slow);
+}
+
+// What the pipeline reported last, by kind and index
+static float ads_values[READING_EC + 1][1 + PIPELINE_MAX_PROBES];
+static uint32_t ads_counts[READING_EC + 1][1 + PIPELINE_MAX_PROBES];
+
+static void adsSink(ReadingChannel channel, uint8_t index, float value, SensorQuality quality)
+{
+    if (index > PIPELINE_MAX_PROBES)
+        return;
+    ads_values[channel][index] = value;
+    ads_counts[channel][index]++;
+}
+
+static void test_ads_pipeline_extra_probes_report_alike()
+{
+    // Two devices: TDS and pH first as the firmware has them, then the extra probes, all of a kind at one voltage
+    static const ReadingChannel kinds[] = {READING_TDS, READING_PH, READING_PH, READING_PH, READING_TDS, READING_TDS, READING_PH, READING_TDS};
+    const uint8_t channel_count = sizeof(kinds) / sizeof(kinds[0]);
+    const uint8_t devices = 2;
+    float volts[ADS1X15_MAX_CHANNELS] = {};
+    for (uint8_t i = 0; i < channel_count; i++)
+        volts[adsPin(i, devices)] = kinds[i] == READING_PH ? 1.5f : 0.8f;
+
+    fake_now_us = 0;
+    AdsChain chain(devices, ADS1115, volts);
+    MockTemperatureBus bus;
+    bus.addProbe(21.5f);
+    TemperatureEngine temperatures(bus, halMicros);
+    Scheduler scheduler(halMicros);
+    AdcCalibration calibration;
+    calibration.build(ads1x15Millivolts, NULL);
+    SensorPipeline pipeline(chain.source, temperatures, calibration, calibration);
+    for (uint8_t i = 2; i < channel_count; i++)
+        TEST_ASSERT_TRUE(pipeline.addProbe(kinds[i], i));
+    TEST_ASSERT_EQUAL_UINT8(channel_count - 2, pipeline.probeCount());
+
+    TEST_ASSERT_TRUE(chain.begin(channel_count, devices, 250));
+    temperatures.begin(halMicros());
+    uint32_t per_channel_hz = chain.source.dataRate() / 4;
+    pipeline.begin(scheduler, adsSink, 1000000UL * ADC_BLOCK_SIZE / per_channel_hz, 10000000UL);
+    memset(ads_counts, 0, sizeof(ads_counts));
+
+    while ((int32_t)(30000000UL - fake_now_us) > 0)
+    {
+        uint32_t idle_us = scheduler.runOnce();
+        adsAdvance(chain.mock, chain.source, fake_now_us + idle_us);
+    }
+
+    const ReadingChannel checked[] = {READING_PH, READING_TDS};
+    for (ReadingChannel kind : checked)
+    {
+        uint8_t probes = 0;
+        for (uint8_t i = 0; i < channel_count; i++)
+            probes += kinds[i] == kind;
+        for (uint8_t index = 0; index < probes; index++)
+        {
+            TEST_ASSERT_GREATER_THAN(0, ads_counts[kind][index]);
+            TEST_ASSERT_FLOAT_WITHIN(1e-3f, ads_values[kind][0], ads_values[kind][index]);
+        }
+    }
+}
+
+void runAds1x15Tests()
+{
+    RUN_TEST(test_ads_data_rate_is_the_slowest_that_keeps_up);
+    RUN_TEST(test_ads_begin_refuses_a_bad_layout);
+    RUN_TEST(test_ads_round_waits_for_every_device);
+    RUN_TEST(test_ads_rounds_paced_by_alert_rdy);
+    RUN_TEST(test_ads_rate_shift_skips_an_input);
+    RUN_TEST(test_ads_pipeline_extra_probes_report_alike);
+}
@@ -0,0 +1,294 @@
+#include <unity.h>
+#include <math.h>
+#include <string.h>
+#include "TestSuites.h"
+#include "Calibration.h"
+#include "ByteOrder.h"
+#include "Telemetry.h"
+#include "native/MemoryCalibrationStore.h"
+
+// The fits are exact in float, the curves carry the Q16 rounding and the table
+#define FIT_TOLERANCE 1e-4f
+#define CURVE_PH_TOLERANCE 0.002f
+#define CURVE_TDS_TOLERANCE 1.0f
+
+// Probe line of a buffer set, volts where the probe reads each pH
+static float phVoltsOn(float slope, float offset, float ph)
+{
+    return (ph - offset) / slope;
+}
+
+static bool isDefault(const CalibrationCoefficients &coefficients)
+{
+    return coefficients.ph_points == 0 && coefficients.tds_points == 0 && coefficients.ph_offset[1] == 21.34f;
+}
+
+static void test_ph_fit_one_point_moves_the_offset()
+{
+    CalibrationCoefficients coefficients;
+    calibrationDefaults(coefficients);
+    CalibrationPoint one[] = {{2.48f, 6.86f}};
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_FIT_OK, calibrationFitPh(one, 1, coefficients));
+    TEST_ASSERT_FLOAT_WITHIN(FIT_TOLERANCE, 6.86f, calibrationPh(coefficients, 2.48f));
+    TEST_ASSERT_FLOAT_WITHIN(0.0f, -5.70f, coefficients.ph_slope[0]);
+}
+
+static void test_ph_fit_two_points_in_either_order()
+{
+    const float slope = -5.9f, offset = 21.7f;
+    CalibrationPoint two[] = {{phVoltsOn(slope, offset, 9.18f), 9.18f}, {phVoltsOn(slope, offset, 4.01f), 4.01f}};
+    for (uint8_t order = 0; order < 2; order++)
+    {
+        CalibrationCoefficients coefficients;
+        calibrationDefaults(coefficients);
+        TEST_ASSERT_EQUAL_UINT8(CALIBRATION_FIT_OK, calibrationFitPh(two, 2, coefficients));
+        TEST_ASSERT_FLOAT_WITHIN(FIT_TOLERANCE, slope, coefficients.ph_slope[0]);
+        TEST_ASSERT_FLOAT_WITHIN(FIT_TOLERANCE, offset, coefficients.ph_offset[0]);
+        CalibrationPoint first = two[0];
+        two[0] = two[1];
+        two[1] = first;
+    }
+}
+
+static void test_ph_fit_three_points_two_segments()
+{
+    // A probe that is flatter on the alkaline side, both halves exact through the middle buffer
+    const float acid_slope = -6.1f, alkaline_slope = -5.2f, neutral_volts = 2.50f;
+    CalibrationPoint three[] = {
+        {neutral_volts, 6.86f},
+        {neutral_volts + (4.01f - 6.86f) / acid_slope, 4.01f},
+        {neutral_volts + (9.18f - 6.86f) / alkaline_slope, 9.18f},
+    };
+    CalibrationCoefficients coefficients;
+    calibrationDefaults(coefficients);
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_FIT_OK, calibrationFitPh(three, 3, coefficients));
+    for (float volts = 1.5f; volts <= 3.5f; volts += 0.01f)
+    {
+        float expected = 6.86f + (volts < neutral_volts ? alkaline_slope : acid_slope) * (volts - neutral_volts);
+        TEST_ASSERT_FLOAT_WITHIN(FIT_TOLERANCE * 10, expected, calibrationPh(coefficients, volts));
+    }
+}
+
+static void test_ph_fit_refuses_careless_points()
+{
+    CalibrationCoefficients coefficients;
+    calibrationDefaults(coefficients);
+    CalibrationPoint one[] = {{2.48f, 6.86f}};
+    CalibrationPoint same[] = {{2.50f, 6.86f}, {2.505f, 4.01f}};
+    CalibrationPoint flipped[] = {{2.0f, 4.01f}, {2.5f, 6.86f}};
+    CalibrationPoint flat[] = {{1.0f, 4.01f}, {2.5f, 6.86f}};
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_FIT_NO_POINTS, calibrationFitPh(one, 0, coefficients));
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_FIT_TOO_CLOSE, calibrationFitPh(same, 2, coefficients));
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_FIT_OUT_OF_RANGE, calibrationFitPh(flipped, 2, coefficients)); // Buffers swapped
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_FIT_OUT_OF_RANGE, calibrationFitPh(flat, 2, coefficients));    // A dead probe
+
+    // A refused fit leaves the calibration alone
+    TEST_ASSERT_EQUAL_UINT8(0, coefficients.ph_points);
+    TEST_ASSERT_FLOAT_WITHIN(0.0f, 21.34f, coefficients.ph_offset[0]);
+}
+
+static void test_tds_fit_one_point_scales_the_curve()
+{
+    CalibrationCoefficients coefficients;
+    calibrationDefaults(coefficients);
+    CalibrationPoint one[] = {{1300.0f, 1413.0f}};
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_FIT_OK, calibrationFitTds(one, 1, coefficients));
+    TEST_ASSERT_FLOAT_WITHIN(FIT_TOLERANCE * 1000, 706.5f, calibrationTdsCorrect(coefficients, 650.0f));
+}
+
+static void test_tds_fit_three_points_extends_above()
+{
+    // Unsorted standards: exact at each, linear between, the last segment continues above
+    CalibrationPoint three[] = {{1900.0f, 2000.0f}, {480.0f, 500.0f}, {1050.0f, 1000.0f}};
+    CalibrationCoefficients coefficients;
+    calibrationDefaults(coefficients);
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_FIT_OK, calibrationFitTds(three, 3, coefficients));
+    for (const CalibrationPoint &point : three)
+        TEST_ASSERT_FLOAT_WITHIN(FIT_TOLERANCE * 1000, point.actual, calibrationTdsCorrect(coefficients, point.measured));
+    float expected_above = 2000.0f + (2800.0f - 1900.0f) * (2000.0f - 1000.0f) / (1900.0f - 1050.0f);
+    TEST_ASSERT_FLOAT_WITHIN(0.1f, expected_above, calibrationTdsCorrect(coefficients, 2800.0f));
+}
+
+static void test_tds_fit_refuses_careless_points()
+{
+    CalibrationCoefficients coefficients;
+    calibrationDefaults(coefficients);
+    CalibrationPoint close[] = {{1000.0f, 1000.0f}, {1005.0f, 1500.0f}};
+    CalibrationPoint wrong[] = {{1000.0f, 3000.0f}};
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_FIT_TOO_CLOSE, calibrationFitTds(close, 2, coefficients));
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_FIT_OUT_OF_RANGE, calibrationFitTds(wrong, 1, coefficients)); // Probe in the wrong solution
+    TEST_ASSERT_EQUAL_UINT8(0, coefficients.tds_points);
+}
+
+static void test_curves_default_to_the_built_in_math()
+{
+    CalibrationCurves curves;
+    for (uint16_t mv = 0; mv <= 3300; mv++)
+    {
+        SensorNum volts = SensorMath::volts(mv);
+        TEST_ASSERT_FLOAT_WITHIN(0.0f, SensorMath::toFloat(SensorMath::ph(volts, SensorMath::value(21.34f))), SensorMath::toFloat(curves.ph(volts)));
+        TEST_ASSERT_FLOAT_WITHIN(CURVE_TDS_TOLERANCE, SensorMathPolicy<float>::tdsPpm(mv / 1000.0f), SensorMath::toFloat(curves.tdsPpm(volts)));
+    }
+}
+
+static void test_curves_follow_a_three_point_calibration()
+{
+    CalibrationCoefficients coefficients;
+    calibrationDefaults(coefficients);
+    CalibrationPoint ph_points[] = {{2.50f, 6.86f}, {2.97f, 4.01f}, {2.05f, 9.18f}};
+    CalibrationPoint tds_points[] = {{480.0f, 500.0f}, {1050.0f, 1000.0f}, {1900.0f, 2000.0f}};
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_FIT_OK, calibrationFitPh(ph_points, 3, coefficients));
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_FIT_OK, calibrationFitTds(tds_points, 3, coefficients));
+    CalibrationCurves curves;
+    curves.build(coefficients);
+    for (uint16_t mv = 0; mv <= 3300; mv++)
+    {
+        float volts = mv / 1000.0f;
+        TEST_ASSERT_FLOAT_WITHIN(CURVE_PH_TOLERANCE, calibrationPh(coefficients, volts), SensorMath::toFloat(curves.ph(SensorMath::volts(mv))));
+        float expected = calibrationTdsCorrect(coefficients, SensorMathPolicy<float>::tdsPpm(volts));
+        TEST_ASSERT_FLOAT_WITHIN(CURVE_TDS_TOLERANCE, expected, SensorMath::toFloat(curves.tdsPpm(SensorMath::volts(mv))));
+    }
+}
+
+// A store holding a three point pH and a one point TDS calibration
+static void savedCalibration(MemoryCalibrationStore &store, CalibrationCoefficients &saved)
+{
+    calibrationDefaults(saved);
+    CalibrationPoint ph_points[] = {{2.50f, 6.86f}, {2.97f, 4.01f}, {2.05f, 9.18f}};
+    CalibrationPoint tds_points[] = {{1300.0f, 1413.0f}};
+    calibrationFitPh(ph_points, 3, saved);
+    calibrationFitTds(tds_points, 1, saved);
+    TEST_ASSERT_TRUE(calibrationSave(store, saved));
+    TEST_ASSERT_EQUAL_size_t(CALIBRATION_BLOB_SIZE, store.length);
+}
+
+static void test_store_round_trip()
+{
+    MemoryCalibrationStore store;
+    CalibrationCoefficients saved, loaded;
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_EMPTY, calibrationLoad(store, loaded));
+    TEST_ASSERT_TRUE(isDefault(loaded));
+
+    savedCalibration(store, saved);
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_LOADED, calibrationLoad(store, loaded));
+    TEST_ASSERT_EQUAL_UINT8(saved.ph_points, loaded.ph_points);
+    TEST_ASSERT_EQUAL_MEMORY(saved.ph_slope, loaded.ph_slope, sizeof(saved.ph_slope));
+    TEST_ASSERT_EQUAL_MEMORY(saved.ph_offset, loaded.ph_offset, sizeof(saved.ph_offset));
+    TEST_ASSERT_FLOAT_WITHIN(0.0f, saved.ph_break_volts, loaded.ph_break_volts);
+    TEST_ASSERT_EQUAL_UINT8(saved.tds_points, loaded.tds_points);
+    TEST_ASSERT_FLOAT_WITHIN(0.0f, saved.tds_actual[0], loaded.tds_actual[0]);
+}
+
+static void test_store_bit_flips_fall_back_to_the_defaults()
+{
+    MemoryCalibrationStore store;
+    CalibrationCoefficients saved, loaded;
+    savedCalibration(store, saved);
+    uint8_t good[MemoryCalibrationStore::CAPACITY];
+    memcpy(good, store.blob, store.length);
+
+    for (size_t bit = 0; bit < store.length * 8; bit++)
+    {
+        memcpy(store.blob, good, store.length);
+        store.blob[bit / 8] ^= 1 << (bit % 8);
+        TEST_ASSERT_TRUE(calibrationLoad(store, loaded) != CALIBRATION_LOADED);
+        TEST_ASSERT_TRUE(isDefault(loaded));
+    }
+}
+
+static void test_store_cut_and_overlong_blobs()
+{
+    MemoryCalibrationStore store;
+    CalibrationCoefficients saved, loaded;
+    savedCalibration(store, saved);
+    size_t good_length = store.length;
+
+    // A write cut short, or grown by garbage
+    for (size_t length = 1; length < good_length; length++)
+    {
+        store.length = length;
+        TEST_ASSERT_EQUAL_UINT8(CALIBRATION_CORRUPT, calibrationLoad(store, loaded));
+        TEST_ASSERT_TRUE(isDefault(loaded));
+    }
+    store.length = good_length + 1;
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_CORRUPT, calibrationLoad(store, loaded));
+    store.length = MemoryCalibrationStore::CAPACITY; // Larger than any layout
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_CORRUPT, calibrationLoad(store, loaded));
+    TEST_ASSERT_TRUE(isDefault(loaded));
+}
+
+static void test_store_valid_crc_over_bad_contents()
+{
+    MemoryCalibrationStore store;
+    CalibrationCoefficients saved, loaded;
+    savedCalibration(store, saved);
+    uint8_t good[MemoryCalibrationStore::CAPACITY];
+    size_t good_length = store.length;
+    memcpy(good, store.blob, good_length);
+
+    // Another layout with a valid CRC of its own
+    put16(store.blob + 4, CALIBRATION_VERSION + 1);
+    put16(store.blob + good_length - 2, crc16Ccitt(store.blob, good_length - 2));
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_UNKNOWN_VERSION, calibrationLoad(store, loaded));
+    TEST_ASSERT_TRUE(isDefault(loaded));
+
+    // Values no fit produces, e.g. written by a buggy build
+    memcpy(store.blob, good, good_length);
+    putFloat(store.blob + 12, 4.0f);
+    put16(store.blob + good_length - 2, crc16Ccitt(store.blob, good_length - 2));
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_CORRUPT, calibrationLoad(store, loaded));
+    TEST_ASSERT_TRUE(isDefault(loaded));
+}
+
+static void test_store_random_blobs_never_load()
+{
+    MemoryCalibrationStore store;
+    store.length = CALIBRATION_BLOB_SIZE;
+    CalibrationCoefficients loaded;
+    uint32_t seed = 0x5eed;
+    for (int trial = 0; trial < 100000; trial++)
+    {
+        for (size_t i = 0; i < store.length; i++)
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            store.blob[i] = seed;
+        }
+        TEST_ASSERT_TRUE(calibrationLoad(store, loaded) != CALIBRATION_LOADED);
+    }
+}
+
+static void test_store_erase_and_save_over_a_corrupt_blob()
+{
+    MemoryCalibrationStore store;
+    CalibrationCoefficients saved, loaded;
+    savedCalibration(store, saved);
+    TEST_ASSERT_TRUE(store.erase());
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_EMPTY, calibrationLoad(store, loaded));
+
+    savedCalibration(store, saved);
+    store.blob[10] ^= 0xFF;
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_CORRUPT, calibrationLoad(store, loaded));
+    TEST_ASSERT_TRUE(calibrationSave(store, saved));
+    TEST_ASSERT_EQUAL_UINT8(CALIBRATION_LOADED, calibrationLoad(store, loaded));
+}
+
+void runCalibrationTests()
+{
+    RUN_TEST(test_ph_fit_one_point_moves_the_offset);
+    RUN_TEST(test_ph_fit_two_points_in_either_order);
+    RUN_TEST(test_ph_fit_three_points_two_segments);
+    RUN_TEST(test_ph_fit_refuses_careless_points);
+    RUN_TEST(test_tds_fit_one_point_scales_the_curve);
+    RUN_TEST(test_tds_fit_three_points_extends_above);
+    RUN_TEST(test_tds_fit_refuses_careless_points);
+    RUN_TEST(test_curves_default_to_the_built_in_math);
+    RUN_TEST(test_curves_follow_a_three_point_calibration);
+    RUN_TEST(test_store_round_trip);
+    RUN_TEST(test_store_bit_flips_fall_back_to_the_defaults);
+    RUN_TEST(test_store_cut_and_overlong_blobs);
+    RUN_TEST(test_store_valid_crc_over_bad_contents);
+    RUN_TEST(test_store_random_blobs_never_load);
+    RUN_TEST(test_store_erase_and_save_over_a_corrupt_blob);
+}
@@ -0,0 +1,189 @@
+#include <unity.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "TestSuites.h"
+#include "native/Collector.h"
+
+static TelemetryRecord nodeRecord(uint16_t sequence, float tds, uint16_t status)
+{
+    TelemetryRecord record;
+    record.sequence = sequence;
+    record.timestamp_ms = sequence * 1000UL;
+    record.tds_ppm = tds;
+    record.ph = 6.0f + sequence * 0.01f;
+    record.temperature_c = 21.0f;
+    record.status = status;
+    return record;
+}
+
+#define ALL_VALID (TELEMETRY_TDS_VALID | TELEMETRY_PH_VALID | TELEMETRY_TEMP_VALID)
+
+static void test_columns_summarize_a_time_range()
+{
+    ColumnStore store(2, 100);
+    TEST_ASSERT_EQUAL_UINT32(128, store.capacity());
+
+    // One record a second, every fourth without a valid TDS
+    for (uint16_t i = 0; i < 20; i++)
+        store.append(1, 10000 + i * 1000, nodeRecord(i, 100.0f + i, i % 4 == 3 ? ALL_VALID & ~TELEMETRY_TDS_VALID : ALL_VALID));
+    TEST_ASSERT_EQUAL_UINT32(20, store.records(1));
+    TEST_ASSERT_EQUAL_UINT32(0, store.records(0));
+
+    // [from, to) on the arrival time, 2 to 9 seconds in, record 3 and 7 do not count for TDS
+    ColumnSummary tds = store.summarize(1, COLUMN_TDS, 12000, 10000 + 10 * 1000);
+    TEST_ASSERT_EQUAL_UINT32(6, tds.count);
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, 102.0f, tds.min);
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, 109.0f, tds.max);
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, (102 + 104 + 105 + 106 + 108 + 109) / 6.0f, tds.mean);
+    TEST_ASSERT_EQUAL_UINT32(8, store.summarize(1, COLUMN_PH, 12000, 20000).count);
+
+    // Nothing in range, or a node without records
+    ColumnSummary none = store.summarize(1, COLUMN_TDS, 50000, 60000);
+    TEST_ASSERT_EQUAL_UINT32(0, none.count);
+    TEST_ASSERT_TRUE(isnan(none.mean));
+    TEST_ASSERT_EQUAL_UINT32(0, store.summarize(0, COLUMN_TDS, 0, UINT32_MAX / 2).count);
+}
+
+static void test_columns_ring_keeps_the_newest()
+{
+    ColumnStore store(1, 16);
+    for (uint16_t i = 0; i < 40; i++)
+        store.append(0, i * 10, nodeRecord(i, i, ALL_VALID));
+    TEST_ASSERT_EQUAL_UINT32(16, store.records(0));
+    TEST_ASSERT_EQUAL_UINT32(24, store.overwritten(0));
+
+    ColumnSummary summary = store.summarize(0, COLUMN_TDS, 0, UINT32_MAX / 2);
+    TEST_ASSERT_EQUAL_UINT32(16, summary.count);
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, 24.0f, summary.min);
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, 39.0f, summary.max);
+
+    // The search over the ring finds a range that starts in its middle
+    TEST_ASSERT_EQUAL_UINT32(5, store.summarize(0, COLUMN_TDS, 300, 350).count);
+}
+
+static void test_columns_downsample_buckets()
+{
+    ColumnStore store(1, 64);
+    // Three seconds of records, none in the fourth, the pH of the fifth second invalid
+    for (uint16_t i = 0; i < 50; i++)
+    {
+        if (i >= 30 && i < 40)
+            continue;
+        uint16_t status = i >= 40 ? ALL_VALID & ~TELEMETRY_PH_VALID : ALL_VALID;
+        store.append(0, 5000 + i * 100, nodeRecord(i, i < 10 ? 100.0f : 200.0f, status));
+    }
+
+    ColumnBucket buckets[8];
+    uint16_t count = store.downsample(0, 5000, 10000, 1000, buckets, 8);
+    TEST_ASSERT_EQUAL_UINT16(4, count);
+    TEST_ASSERT_EQUAL_UINT32(5000, buckets[0].start_ms);
+    TEST_ASSERT_EQUAL_UINT16(10, buckets[0].records);
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, 100.0f, buckets[0].mean[COLUMN_TDS]);
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, 200.0f, buckets[1].mean[COLUMN_TDS]);
+    TEST_ASSERT_EQUAL_UINT32(9000, buckets[3].start_ms); // The empty bucket is left out
+    TEST_ASSERT_TRUE(isnan(buckets[3].mean[COLUMN_PH]));
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, 21.0f, buckets[3].mean[COLUMN_TEMPERATURE]);
+
+    // At most max_buckets, and nothing for a zero bucket width
+    TEST_ASSERT_EQUAL_UINT16(2, store.downsample(0, 5000, 10000, 1000, buckets, 2));
+    TEST_ASSERT_EQUAL_UINT16(0, store.downsample(0, 5000, 10000, 0, buckets, 8));
+}
+
+static void test_collector_stream_split_frames()
+{
+    ColumnStore store(4, 256);
+    Collector collector(store);
+    int fds[2];
+    TEST_ASSERT_EQUAL_INT(0, pipe(fds));
+    TEST_ASSERT_EQUAL_INT(0, collector.addStream(fds[0], "serial0"));
+
+    // Frames in writes of 7 bytes, so most of them straddle two reads, with a text line and a lost record in between
+    static uint8_t stream[64 * TELEMETRY_FRAME_SIZE];
+    size_t length = 0;
+    for (uint16_t i = 0; i < 40; i++)
+    {
+        if (i == 20)
+            continue;
+        length += telemetryEncode(nodeRecord(i, 500.0f, ALL_VALID), stream + length, TELEMETRY_FRAME_SIZE);
+        if (i == 10)
+        {
+            const char *line = "tds 500 ppm\n";
+            memcpy(stream + length, line, strlen(line));
+            length += strlen(line);
+            stream[length++] = 0;
+        }
+    }
+    uint32_t stored = 0;
+    for (size_t offset = 0; offset < length; offset += 7)
+    {
+        size_t chunk = length - offset < 7 ? length - offset : 7;
+        TEST_ASSERT_EQUAL_INT((int)chunk, (int)write(fds[1], stream + offset, chunk));
+        stored += collector.poll(0);
+    }
+
+    const CollectorStats &stats = collector.stats();
+    TEST_ASSERT_EQUAL_UINT32(39, stored);
+    TEST_ASSERT_EQUAL_UINT32(39, store.records(0));
+    TEST_ASSERT_EQUAL_UINT32(1, stats.bad_frames);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.gaps);
+    TEST_ASSERT_EQUAL_UINT32(length, stats.bytes);
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, 500.0f, store.summarize(0, COLUMN_TDS, 0, UINT32_MAX / 2).mean);
+
+    char name[32];
+    collector.nodeName(0, name, sizeof(name));
+    TEST_ASSERT_EQUAL_STRING("serial0", name);
+    close(fds[1]);
+}
+
+static void test_collector_udp_senders_are_nodes()
+{
+    ColumnStore store(4, 256);
+    Collector collector(store);
+    uint16_t port = collector.listenUdp(0);
+    TEST_ASSERT_GREATER_THAN(0, port);
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int senders[2];
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        senders[i] = socket(AF_INET, SOCK_DGRAM, 0);
+        TEST_ASSERT_EQUAL_INT(0, connect(senders[i], (sockaddr *)&address, sizeof(address)));
+    }
+
+    // Two frames in one datagram from the first sender, one from the second, then a damaged datagram
+    uint8_t datagram[2 * TELEMETRY_FRAME_SIZE];
+    size_t length = telemetryEncode(nodeRecord(0, 300.0f, ALL_VALID), datagram, TELEMETRY_FRAME_SIZE);
+    length += telemetryEncode(nodeRecord(1, 300.0f, ALL_VALID), datagram + length, TELEMETRY_FRAME_SIZE);
+    TEST_ASSERT_EQUAL_INT((int)length, (int)send(senders[0], datagram, length, 0));
+    length = telemetryEncode(nodeRecord(5, 700.0f, ALL_VALID), datagram, TELEMETRY_FRAME_SIZE);
+    TEST_ASSERT_EQUAL_INT((int)length, (int)send(senders[1], datagram, length, 0));
+    datagram[length / 2] ^= 0x01;
+    TEST_ASSERT_EQUAL_INT((int)length, (int)send(senders[1], datagram, length, 0));
+
+    uint32_t stored = 0;
+    for (uint8_t attempt = 0; attempt < 50 && collector.stats().datagrams < 3; attempt++)
+        stored += collector.poll(10);
+    TEST_ASSERT_EQUAL_UINT32(3, stored);
+    TEST_ASSERT_EQUAL_UINT16(2, collector.nodeCount());
+    TEST_ASSERT_EQUAL_UINT32(2, store.records(0));
+    TEST_ASSERT_EQUAL_UINT32(1, store.records(1));
+    TEST_ASSERT_EQUAL_UINT32(1, collector.stats().bad_frames);
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, 700.0f, store.summarize(1, COLUMN_TDS, 0, UINT32_MAX / 2).mean);
+    for (uint8_t i = 0; i < 2; i++)
+        close(senders[i]);
+}
+
+void runCollectorTests()
+{
+    RUN_TEST(test_columns_summarize_a_time_range);
+    RUN_TEST(test_columns_ring_keeps_the_newest);
+    RUN_TEST(test_columns_downsample_buckets);
+    RUN_TEST(test_collector_stream_split_frames);
+    RUN_TEST(test_collector_udp_senders_are_nodes);
+}
@@ -0,0 +1,379 @@
+#include <unity.h>
+#include <math.h>
+#include <string.h>
+#include "TestSuites.h"
+#include "Decimator.h"
+#include "Filters.h"
+#include "SensorPipeline.h"
+#include "PipelineRig.h"
+#include "native/FakeClock.h"
+
+#define DECIMATOR_TEST_NOISE_LSB 5.0f // Gaussian noise of the converter in counts rms, about what ADC2 shows at 11 dB
+#define DECIMATOR_TEST_MIN_GAIN 1.5   // Bits the decimator has to gain over the trimmed mean
+#define DECIMATOR_TEST_SHIFT 4        // The firmware's oversampling, 4 kHz
+#define DECIMATOR_TEST_PH_RAW 2048.37f
+
+static const uint32_t SETTLED_CIC_OUTPUTS = PhDecimator::TAPS + PhDecimator::STAGES - 1;
+
+static uint32_t decimator_random;
+
+static uint32_t nextRandom(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Standard normal sample, Box-Muller
+static float nextNoise(uint32_t &state)
+{
+    float u1 = (nextRandom(state) + 1.0f) / 4294967296.0f;
+    float u2 = nextRandom(state) / 4294967296.0f;
+    return sqrtf(-2.0f * logf(u1)) * cosf(6.2831853f * u2);
+}
+
+// One conversion of a level, noise and quantisation
+static uint16_t noisySample(float level)
+{
+    float raw = roundf(level + DECIMATOR_TEST_NOISE_LSB * nextNoise(decimator_random));
+    return raw < 0 ? 0 : raw > ADC_RAW_MAX ? ADC_RAW_MAX : (uint16_t)raw;
+}
+
+// Feed one block of a constant level
+static bool pushLevel(PhDecimator &decimator, uint16_t level, uint16_t count)
+{
+    uint16_t block[PhDecimator::CIC_RATIO];
+    for (uint16_t i = 0; i < count; i++)
+        block[i] = level;
+    return decimator.pushBlock(block, count);
+}
+
+// The chain written plainly, one sample at a time with a loop over the stages and every tap on its own
+struct PlainDecimator
+{
+    uint32_t integrator[PhDecimator::STAGES];
+    uint32_t comb[PhDecimator::STAGES];
+    int32_t history[PhDecimator::TAPS];
+    int16_t taps[PhDecimator::TAPS];
+    uint32_t phase, fir_phase, head, outputs;
+    uint32_t latest;
+
+    PlainDecimator() : integrator(), comb(), history(), phase(0), fir_phase(0), head(0), outputs(0), latest(0)
+    {
+        decimatorLowpass(taps, PhDecimator::TAPS, 0.5f / PhDecimator::FIR_RATIO);
+    }
+
+    void push(uint16_t sample)
+    {
+        integrator[0] += sample;
+        for (uint8_t s = 1; s < PhDecimator::STAGES; s++)
+            integrator[s] += integrator[s - 1];
+        if (++phase < PhDecimator::CIC_RATIO)
+            return;
+        phase = 0;
+        uint32_t value = integrator[PhDecimator::STAGES - 1];
+        for (uint8_t s = 0; s < PhDecimator::STAGES; s++)
+        {
+            uint32_t delayed = comb[s];
+            comb[s] = value;
+            value -= delayed;
+        }
+        history[head] = (int32_t)value;
+        head = (head + 1) % PhDecimator::TAPS;
+        if (++fir_phase < PhDecimator::FIR_RATIO)
+            return;
+        fir_phase = 0;
+        int64_t sum = 0;
+        for (uint8_t j = 0; j < PhDecimator::TAPS; j++)
+            sum += (int64_t)taps[j] * history[(head + PhDecimator::TAPS - 1 - j) % PhDecimator::TAPS];
+        const uint8_t shift = PhDecimator::GAIN_BITS - PhDecimator::FRACTION_BITS + 15;
+        int64_t rounded = (sum + ((int64_t)1 << (shift - 1))) >> shift;
+        latest = rounded < 0 ? 0 : (uint32_t)rounded;
+        outputs++;
+    }
+};
+
+static void test_decimator_lowpass_is_symmetric_with_unit_gain()
+{
+    int16_t taps[PhDecimator::TAPS];
+    decimatorLowpass(taps, PhDecimator::TAPS, 0.5f / PhDecimator::FIR_RATIO);
+    int32_t sum = 0;
+    for (uint8_t i = 0; i < PhDecimator::TAPS; i++)
+    {
+        TEST_ASSERT_EQUAL_INT16(taps[i], taps[PhDecimator::TAPS - 1 - i]);
+        sum += taps[i];
+    }
+    TEST_ASSERT_EQUAL_INT32(32768, sum);
+    // The middle carries the most, the ends the least
+    TEST_ASSERT_GREATER_THAN(taps[0], taps[PhDecimator::TAPS / 2 - 1]);
+}
+
+static void test_decimator_cic_gain_is_exact()
+{
+    // After Stages outputs the integrators hold no more of the zeros before the start
+    const uint16_t levels[] = {0, 1, 2047, ADC_RAW_MAX};
+    for (uint16_t level : levels)
+    {
+        PhDecimator::Cic cic;
+        uint16_t block[PhDecimator::CIC_RATIO];
+        for (uint16_t i = 0; i < PhDecimator::CIC_RATIO; i++)
+            block[i] = level;
+        int32_t out[1];
+        for (uint8_t k = 0; k < 2 * PhDecimator::STAGES; k++)
+        {
+            TEST_ASSERT_EQUAL_UINT16(1, cic.push(block, PhDecimator::CIC_RATIO, out));
+            if (k + 1 >= PhDecimator::STAGES)
+                TEST_ASSERT_EQUAL_INT32((int32_t)level << PhDecimator::GAIN_BITS, out[0]);
+        }
+    }
+}
+
+static void test_decimator_dc_gain_is_exact()
+{
+    // A settled constant comes out as the count with FRACTION_BITS of zeros, not a bit off
+    const uint16_t levels[] = {0, 1, 1000, 2048, ADC_RAW_MAX - 1, ADC_RAW_MAX};
+    for (uint16_t level : levels)
+    {
+        PhDecimator decimator;
+        uint32_t checked = 0;
+        while (checked < 8)
+        {
+            if (pushLevel(decimator, level, ADC_BLOCK_SIZE) && decimator.settled())
+            {
+                TEST_ASSERT_EQUAL_UINT32((uint32_t)level << PhDecimator::FRACTION_BITS, decimator.value());
+                checked++;
+            }
+        }
+    }
+}
+
+static void test_decimator_settles_after_a_clean_window()
+{
+    // One CIC output per block: settled exactly when the FIR window holds no output of the zeros before the start
+    PhDecimator decimator;
+    const uint16_t level = 3000;
+    for (uint32_t k = 1; k <= SETTLED_CIC_OUTPUTS + PhDecimator::FIR_RATIO; k++)
+    {
+        bool fresh = pushLevel(decimator, level, PhDecimator::CIC_RATIO);
+        TEST_ASSERT_EQUAL(k >= SETTLED_CIC_OUTPUTS, decimator.settled());
+        TEST_ASSERT_EQUAL(k % PhDecimator::FIR_RATIO == 0, fresh);
+        TEST_ASSERT_EQUAL_UINT32(k / PhDecimator::FIR_RATIO, decimator.count());
+        // Exact from the first output after
+        if (fresh && decimator.settled())
+            TEST_ASSERT_EQUAL_UINT32((uint32_t)level << PhDecimator::FRACTION_BITS, decimator.value());
+    }
+
+    decimator.reset();
+    TEST_ASSERT_FALSE(decimator.settled());
+    TEST_ASSERT_EQUAL_UINT32(0, decimator.count());
+    TEST_ASSERT_EQUAL_UINT32(0, decimator.value());
+}
+
+static void test_decimator_step_settles_within_the_window()
+{
+    // A step lands exactly once it is a whole window old, at most ceil(SETTLED / FIR_RATIO) outputs after it
+    PhDecimator decimator;
+    while (!decimator.settled() || decimator.count() < 8)
+        pushLevel(decimator, 1000, PhDecimator::CIC_RATIO);
+    const uint32_t step_at = decimator.count();
+    const uint32_t target = 3000u << PhDecimator::FRACTION_BITS;
+    uint32_t landed = 0;
+    while (decimator.count() - step_at < 2 * SETTLED_CIC_OUTPUTS / PhDecimator::FIR_RATIO)
+    {
+        if (!pushLevel(decimator, 3000, PhDecimator::CIC_RATIO))
+            continue;
+        if (landed == 0 && decimator.value() == target)
+            landed = decimator.count() - step_at;
+        if (landed)
+            TEST_ASSERT_EQUAL_UINT32(target, decimator.value());
+    }
+    TEST_ASSERT_GREATER_THAN(1, landed);
+    TEST_ASSERT_LESS_OR_EQUAL((SETTLED_CIC_OUTPUTS + PhDecimator::FIR_RATIO - 1) / PhDecimator::FIR_RATIO, landed);
+}
+
+static void test_decimator_matches_plain_loops_in_any_block_size()
+{
+    // Noisy slow sine in blocks of any length up to one output: the unrolled kernel gives every plain output to the bit
+    PhDecimator decimator;
+    PlainDecimator plain;
+    uint16_t block[PhDecimator::RATIO];
+    uint32_t time = 0, compared = 0;
+    decimator_random = 7;
+    uint32_t chunk_random = 99;
+    while (compared < 400)
+    {
+        uint16_t count = 1 + nextRandom(chunk_random) % (PhDecimator::RATIO - 1);
+        for (uint16_t i = 0; i < count; i++, time++)
+        {
+            block[i] = noisySample(2000 + 1500 * sinf(time * 0.0005f));
+            plain.push(block[i]);
+        }
+        if (!decimator.pushBlock(block, count))
+            continue;
+        TEST_ASSERT_EQUAL_UINT32(plain.outputs, decimator.count());
+        TEST_ASSERT_EQUAL_UINT32(plain.latest, decimator.value());
+        compared++;
+    }
+}
+
+static void test_decimator_gains_bits_over_the_trimmed_mean()
+{
+    // DC levels over the range with the converter's noise: the decimator at the oversampled rate against the
+    // trimmed mean of a block at the base rate, ENOB = 12 - log2(rms * sqrt(12))
+    double decimated_squares = 0, trimmed_squares = 0;
+    uint32_t measured = 0;
+    decimator_random = 11;
+    for (uint16_t level_index = 0; level_index < 20; level_index++)
+    {
+        float level = 200 + (ADC_RAW_MAX - 400) * (level_index + (nextRandom(decimator_random) & 0xFFFF) / 65536.0f) / 20;
+        PhDecimator decimator;
+        ChannelFilter<PIPELINE_PH_FILTER> filter;
+        uint16_t block[ADC_BLOCK_SIZE];
+        uint32_t taken = 0;
+        while (taken < 16)
+        {
+            for (uint16_t i = 0; i < ADC_BLOCK_SIZE; i++)
+                block[i] = noisySample(level);
+            if (!decimator.pushBlock(block, ADC_BLOCK_SIZE) || !decimator.settled())
+                continue;
+            double error = decimator.value() / (double)(1 << PhDecimator::FRACTION_BITS) - level;
+            decimated_squares += error * error;
+
+            for (uint16_t i = 0; i < ADC_BLOCK_SIZE; i++)
+                block[i] = noisySample(level);
+            filter.pushBlock(block, ADC_BLOCK_SIZE);
+            uint16_t kept = filter.keptCount();
+            error = (double)((filter.trimmedSum() + kept / 2) / kept) - level;
+            trimmed_squares += error * error;
+            taken++;
+            measured++;
+        }
+    }
+    double gained_bits = log2(sqrt(trimmed_squares / measured) / sqrt(decimated_squares / measured));
+    TEST_ASSERT_GREATER_OR_EQUAL_FLOAT(DECIMATOR_TEST_MIN_GAIN, (float)gained_bits);
+}
+
+static void test_decimator_rejects_a_tone_above_the_output_band()
+{
+    // 2.25 times the output rate would fold to a quarter of it, the FIR has to keep it out
+    PhDecimator decimator;
+    const float cycles_per_sample = 2.25f / PhDecimator::RATIO;
+    uint16_t block[ADC_BLOCK_SIZE];
+    uint32_t time = 0;
+    float low = 1e9f, high = -1e9f;
+    while (decimator.count() < 200)
+    {
+        for (uint16_t i = 0; i < ADC_BLOCK_SIZE; i++, time++)
+            block[i] = (uint16_t)lroundf(2048 + 1000 * sinf(6.2831853f * cycles_per_sample * time));
+        if (!decimator.pushBlock(block, ADC_BLOCK_SIZE) || !decimator.settled())
+            continue;
+        float value = decimator.value() / (float)(1 << PhDecimator::FRACTION_BITS);
+        low = fminf(low, value);
+        high = fmaxf(high, value);
+    }
+    // 1000 counts of tone leave less than a count, more than 60 dB down
+    TEST_ASSERT_LESS_THAN_FLOAT(1.0f, high - low);
+    TEST_ASSERT_FLOAT_WITHIN(0.5f, 2048.0f, (high + low) / 2);
+}
+
+// pH at a level between two counts, TDS steady
+static uint16_t decimatorRigSignal(uint8_t pin, uint32_t time_us)
+{
+    return noisySample(pin == RIG_PIN_PH ? DECIMATOR_TEST_PH_RAW : 1200);
+}
+
+// What the rig's pipeline reported over a minute after settling
+struct DecimatorRun
+{
+    uint32_t ph_count, tds_count;
+    double ph_sum, ph_squares;
+    uint64_t conversions;
+};
+
+static DecimatorRun runRig(uint8_t shift, bool adaptive = false)
+{
+    decimator_random = 13;
+    PipelineRig rig(decimatorRigSignal, 21.5f);
+    rig.pipeline.setOversampling(shift);
+    rig.pipeline.setAdaptive(adaptive);
+    rig.begin(RIG_ADC_RATE_HZ << shift);
+    // Long enough for a quiet pH to ask for the slowest rate
+    rig.run(adaptive ? 150000 : 2000);
+    if (adaptive)
+        TEST_ASSERT_GREATER_THAN(0, rig.pipeline.rate(READING_PH).shift());
+
+    DecimatorRun run = {};
+    uint32_t ph_seen = rig_channels[READING_PH].count;
+    uint32_t tds_seen = rig_channels[READING_TDS].count;
+    uint64_t conversions = rig.pipeline.samplingStats().adc_conversions;
+    // One task at a time, so no pH value goes by unseen
+    const uint32_t end_us = fake_now_us + 60000000UL;
+    while ((int32_t)(fake_now_us - end_us) < 0)
+    {
+        fakeSpend(rig.scheduler.runOnce());
+        if (rig_channels[READING_PH].count != ph_seen)
+        {
+            double value = rig_channels[READING_PH].value;
+            run.ph_count++;
+            run.ph_sum += value;
+            run.ph_squares += value * value;
+            ph_seen = rig_channels[READING_PH].count;
+        }
+    }
+    run.tds_count = rig_channels[READING_TDS].count - tds_seen;
+    run.conversions = rig.pipeline.samplingStats().adc_conversions - conversions;
+    return run;
+}
+
+static void test_decimator_pipeline_oversampled_is_quieter_at_the_same_rates()
+{
+    const DecimatorRun base = runRig(0);
+    const DecimatorRun fast = runRig(DECIMATOR_TEST_SHIFT);
+    TEST_ASSERT_GREATER_THAN(100, base.ph_count);
+
+    // pH and TDS keep their rates, only the pH pin runs at the oversampled rate
+    TEST_ASSERT_UINT32_WITHIN(base.ph_count / 10, base.ph_count, fast.ph_count);
+    TEST_ASSERT_UINT32_WITHIN(base.tds_count / 10, base.tds_count, fast.tds_count);
+    double expected = base.conversions / 2.0 * ((1 << DECIMATOR_TEST_SHIFT) + 1);
+    TEST_ASSERT_FLOAT_WITHIN((float)(expected * 0.1), (float)expected, (float)fast.conversions);
+
+    // The same pH, with DECIMATOR_TEST_MIN_GAIN bits less noise
+    double base_mean = base.ph_sum / base.ph_count, fast_mean = fast.ph_sum / fast.ph_count;
+    double base_sd = sqrt(fmax(base.ph_squares / base.ph_count - base_mean * base_mean, 0));
+    double fast_sd = sqrt(fmax(fast.ph_squares / fast.ph_count - fast_mean * fast_mean, 0));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, (float)base_mean, (float)fast_mean);
+    TEST_ASSERT_LESS_OR_EQUAL_FLOAT((float)base_sd, (float)(fast_sd * pow(2.0, DECIMATOR_TEST_MIN_GAIN)));
+}
+
+static void test_decimator_pipeline_oversampled_ignores_an_adaptive_slowdown()
+{
+    const DecimatorRun fixed = runRig(DECIMATOR_TEST_SHIFT);
+    const DecimatorRun adaptive = runRig(DECIMATOR_TEST_SHIFT, true);
+
+    // pH keeps the clock its decimator is built for, so the same values come out as often as without adapting
+    TEST_ASSERT_UINT32_WITHIN(fixed.ph_count / 10, fixed.ph_count, adaptive.ph_count);
+    double fixed_mean = fixed.ph_sum / fixed.ph_count, adaptive_mean = adaptive.ph_sum / adaptive.ph_count;
+    double adaptive_sd = sqrt(fmax(adaptive.ph_squares / adaptive.ph_count - adaptive_mean * adaptive_mean, 0));
+    double fixed_sd = sqrt(fmax(fixed.ph_squares / fixed.ph_count - fixed_mean * fixed_mean, 0));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, (float)fixed_mean, (float)adaptive_mean);
+    TEST_ASSERT_LESS_OR_EQUAL_FLOAT((float)(fixed_sd * 1.5), (float)adaptive_sd);
+
+    // TDS still slows down, the conversions saved are all on its channel
+    TEST_ASSERT_LESS_THAN(fixed.tds_count, adaptive.tds_count);
+    TEST_ASSERT_LESS_THAN_UINT32((uint32_t)fixed.conversions, (uint32_t)adaptive.conversions);
+}
+
+void runDecimatorTests()
+{
+    RUN_TEST(test_decimator_lowpass_is_symmetric_with_unit_gain);
+    RUN_TEST(test_decimator_cic_gain_is_exact);
+    RUN_TEST(test_decimator_dc_gain_is_exact);
+    RUN_TEST(test_decimator_settles_after_a_clean_window);
+    RUN_TEST(test_decimator_step_settles_within_the_window);
+    RUN_TEST(test_decimator_matches_plain_loops_in_any_block_size);
+    RUN_TEST(test_decimator_gains_bits_over_the_trimmed_mean);
+    RUN_TEST(test_decimator_rejects_a_tone_above_the_output_band);
+    RUN_TEST(test_decimator_pipeline_oversampled_is_quieter_at_the_same_rates);
+    RUN_TEST(test_decimator_pipeline_oversampled_ignores_an_adaptive_slowdown);
+}
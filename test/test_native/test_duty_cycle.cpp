@@ -0,0 +1,165 @@
+#include <unity.h>
+#include <string.h>
+#include "TestSuites.h"
+#include "DutyCycle.h"
+#include "ResumeState.h"
+#include "PipelineRig.h"
+
+static uint16_t sleepSignal(uint8_t pin, uint32_t time_us)
+{
+    return pin == RIG_PIN_PH ? 3300 + (time_us / 4000) % 5 : 1807 + (time_us / 4000) % 3;
+}
+
+static void test_duty_window_waits_for_every_channel()
+{
+    DutyCycle duty(10000, 3000);
+    duty.wake(1000000);
+    TEST_ASSERT_FALSE(duty.windowDone(1000000));
+
+    // A second probe or a repeat does not count, only the first reading of each channel does
+    duty.reading(READING_TDS, 0, 1200000);
+    duty.reading(READING_PH, 1, 1250000);
+    duty.reading(READING_TDS, 0, 1300000);
+    duty.reading(READING_PH, 0, 1400000);
+    TEST_ASSERT_FALSE(duty.windowDone(1400000));
+    duty.reading(READING_TEMPERATURE, 0, 1900000);
+    TEST_ASSERT_TRUE(duty.windowDone(1900000));
+
+    // The next window starts one period after this one
+    TEST_ASSERT_EQUAL_UINT32(10000000 - 900000, duty.sleepUs(1900000));
+    const DutyCycleStats &stats = duty.stats();
+    TEST_ASSERT_EQUAL_UINT32(1, stats.windows);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.timeouts);
+    TEST_ASSERT_EQUAL_UINT32(900000, stats.awake_us);
+    TEST_ASSERT_EQUAL_UINT32(9100000, stats.asleep_us);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.latency[READING_TDS].count);
+    TEST_ASSERT_EQUAL_UINT32(200000, stats.latency[READING_TDS].last_us);
+    TEST_ASSERT_EQUAL_UINT32(400000, stats.latency[READING_PH].last_us);
+    TEST_ASSERT_EQUAL_UINT32(900000, stats.latency[READING_TEMPERATURE].last_us);
+}
+
+static void test_duty_window_times_out()
+{
+    DutyCycle duty(10000, 3000);
+    const uint32_t wake_us = 0xFFF00000UL; // Across the clock wrap
+    duty.wake(wake_us);
+    duty.reading(READING_TDS, 0, wake_us + 10000);
+    TEST_ASSERT_FALSE(duty.windowDone(wake_us + 2999999));
+    TEST_ASSERT_TRUE(duty.windowDone(wake_us + 3000000));
+    duty.sleepUs(wake_us + 3000000);
+    TEST_ASSERT_EQUAL_UINT32(1, duty.stats().timeouts);
+    TEST_ASSERT_EQUAL_UINT32(0, duty.stats().latency[READING_PH].count);
+
+    // A window that overran the period still sleeps a millisecond
+    duty.wake(0);
+    TEST_ASSERT_EQUAL_UINT32(1000, duty.sleepUs(12000000));
+}
+
+static void test_duty_latency_statistics()
+{
+    DutyCycle duty(1000, 500);
+    const uint32_t latencies[] = {30000, 10000, 20000};
+    uint32_t now = 0;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        duty.wake(now);
+        duty.reading(READING_PH, 0, now + latencies[i]);
+        now += 1000000;
+    }
+    const WakeLatency &ph = duty.stats().latency[READING_PH];
+    TEST_ASSERT_EQUAL_UINT32(3, ph.count);
+    TEST_ASSERT_EQUAL_UINT32(10000, ph.min_us);
+    TEST_ASSERT_EQUAL_UINT32(30000, ph.max_us);
+    TEST_ASSERT_EQUAL_UINT32(20000, ph.last_us);
+    TEST_ASSERT_EQUAL_UINT32(60000, ph.sum_us);
+
+    // The statistics carry over a deep sleep
+    DutyCycleStats kept = duty.stats();
+    DutyCycle after(1000, 500);
+    after.restoreStats(kept);
+    TEST_ASSERT_EQUAL_MEMORY(&kept, &after.stats(), sizeof(kept));
+    after.resetStats();
+    TEST_ASSERT_EQUAL_UINT32(0, after.stats().latency[READING_PH].count);
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, after.stats().latency[READING_PH].min_us);
+}
+
+static void test_resume_state_seal_and_damage()
+{
+    static ResumeState state;
+    resumeStateClear(state);
+    TEST_ASSERT_FALSE(resumeStateValid(state));
+
+    state.power_mode = POWER_DEEP_SLEEP;
+    state.wakes = 7;
+    state.pipeline.ph_count = 3;
+    resumeStateSeal(state);
+    TEST_ASSERT_TRUE(resumeStateValid(state));
+
+    // Any damaged byte, header or payload, makes it a cold boot
+    uint8_t *bytes = reinterpret_cast<uint8_t *>(&state);
+    for (size_t i = 0; i < sizeof(state); i++)
+    {
+        bytes[i] ^= 0x40;
+        TEST_ASSERT_FALSE(resumeStateValid(state));
+        bytes[i] ^= 0x40;
+    }
+    TEST_ASSERT_TRUE(resumeStateValid(state));
+
+    // So does another firmware's layout, even with a good CRC
+    state.version = RESUME_STATE_VERSION + 1;
+    TEST_ASSERT_FALSE(resumeStateValid(state));
+}
+
+static void test_resume_restores_the_pipeline_without_a_scan()
+{
+    static ResumeState rtc;
+    float ph_before;
+    {
+        // Awake for one window, then into deep sleep
+        PipelineRig rig(sleepSignal, 21.3f);
+        rig.begin();
+        rig.run(3000);
+        TEST_ASSERT_EQUAL_UINT32(1, rig.bus.scans);
+        TEST_ASSERT_GREATER_THAN(0, rig_channels[READING_PH].count);
+        ph_before = rig_channels[READING_PH].value;
+
+        resumeStateClear(rtc);
+        rtc.power_mode = POWER_DEEP_SLEEP;
+        rtc.wakes = 1;
+        rig.temperatures.save(rtc.temperatures);
+        rig.pipeline.save(rtc.pipeline);
+        resumeStateSeal(rtc);
+        TEST_ASSERT_GREATER_THAN(0, rtc.pipeline.ph_count);
+        TEST_ASSERT_EQUAL_UINT8(1, rtc.temperatures.probe_count);
+    }
+
+    // Everything is rebuilt after the reset, as setup() does
+    TEST_ASSERT_TRUE(resumeStateValid(rtc));
+    PipelineRig rig(sleepSignal, 21.3f);
+    rig.resume(rtc.temperatures, rtc.pipeline);
+
+    // The filter windows come back exactly as they were saved
+    static SensorPipeline::Snapshot restored;
+    rig.pipeline.save(restored);
+    TEST_ASSERT_EQUAL_UINT16(rtc.pipeline.ph_count, restored.ph_count);
+    TEST_ASSERT_EQUAL_UINT16(rtc.pipeline.tds_count, restored.tds_count);
+    TEST_ASSERT_EQUAL_MEMORY(rtc.pipeline.ph_samples, restored.ph_samples, restored.ph_count * sizeof(uint16_t));
+    TEST_ASSERT_EQUAL_MEMORY(rtc.pipeline.tds_samples, restored.tds_samples, restored.tds_count * sizeof(uint16_t));
+
+    // The probe is read from its cached address, the bus is never searched and never read early
+    rig.run(3000);
+    TEST_ASSERT_EQUAL_UINT32(0, rig.bus.scans);
+    TEST_ASSERT_EQUAL_UINT32(0, rig.bus.early_reads);
+    TEST_ASSERT_GREATER_THAN(0, rig_channels[READING_TEMPERATURE].count);
+    TEST_ASSERT_FLOAT_WITHIN(0.1f, 21.3f, rig_channels[READING_TEMPERATURE].value);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, ph_before, rig_channels[READING_PH].value);
+}
+
+void runDutyCycleTests()
+{
+    RUN_TEST(test_duty_window_waits_for_every_channel);
+    RUN_TEST(test_duty_window_times_out);
+    RUN_TEST(test_duty_latency_statistics);
+    RUN_TEST(test_resume_state_seal_and_damage);
+    RUN_TEST(test_resume_restores_the_pipeline_without_a_scan);
+}
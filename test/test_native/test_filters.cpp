@@ -0,0 +1,104 @@
+#include <unity.h>
+#include <algorithm>
+#include <vector>
+#include "TestSuites.h"
+#include "Filters.h"
+
+#define FILTERS_TEST_SAMPLES 2000
+
+static uint32_t nextRandom(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Last count samples of the stream, sorted, the way the old code computed its results
+static std::vector<int> sortedTail(const std::vector<int> &stream, size_t count)
+{
+    std::vector<int> tail(stream.end() - std::min(count, stream.size()), stream.end());
+    std::sort(tail.begin(), tail.end());
+    return tail;
+}
+
+// The running sum has to follow every boundary case: samples entering and leaving below, inside and above the kept
+// ranks, duplicates of the boundary values, and the partly filled window
+template <uint16_t N, uint16_t Trim>
+static void checkTrimmedSum(uint32_t seed, uint32_t spread)
+{
+    RollingTrimmedMean<int, N, Trim> filter;
+    std::vector<int> stream;
+    uint32_t state = seed;
+    for (uint32_t i = 0; i < FILTERS_TEST_SAMPLES; i++)
+    {
+        int sample = 2000 + (int)(nextRandom(state) % spread);
+        filter.push(sample);
+        stream.push_back(sample);
+
+        std::vector<int> tail = sortedTail(stream, N);
+        int64_t expected = 0;
+        for (size_t k = Trim; k + Trim < tail.size(); k++)
+            expected += tail[k];
+        TEST_ASSERT_EQUAL_INT64(expected, filter.trimmedSum());
+        TEST_ASSERT_EQUAL_UINT16(tail.size() > 2 * Trim ? tail.size() - 2 * Trim : 0, filter.keptCount());
+    }
+}
+
+static void test_filters_trimmed_sum_matches_a_sort()
+{
+    checkTrimmedSum<10, 2>(0x1234567u, 4096);
+    checkTrimmedSum<10, 2>(0x89abcdeu, 3);     // Mostly duplicates
+    checkTrimmedSum<101, 20>(0x2468aceu, 4096);
+    checkTrimmedSum<7, 0>(0x13579bdu, 50);     // Nothing trimmed, the plain sum
+}
+
+static void test_filters_trimmed_sum_survives_reset_and_restore()
+{
+    RollingTrimmedMean<int, 10, 2> filter;
+    std::vector<int> stream;
+    uint32_t state = 0xfeedbeefu;
+    for (int i = 0; i < 25; i++)
+    {
+        int sample = (int)(nextRandom(state) % 1000);
+        filter.push(sample);
+        stream.push_back(sample);
+    }
+    int64_t before = filter.trimmedSum();
+
+    int saved[10];
+    uint16_t length = filter.copyTo(saved);
+    filter.reset();
+    TEST_ASSERT_EQUAL_INT64(0, filter.trimmedSum());
+    TEST_ASSERT_EQUAL_UINT16(0, filter.keptCount());
+    filter.pushBlock(saved, length);
+    TEST_ASSERT_EQUAL_INT64(before, filter.trimmedSum());
+
+    std::vector<int> tail = sortedTail(stream, 10);
+    TEST_ASSERT_EQUAL_FLOAT((tail[2] + tail[3] + tail[4] + tail[5] + tail[6] + tail[7]) / 6.0f, filter.value());
+}
+
+static void test_filters_median_matches_a_sort()
+{
+    RollingMedian<int, 30> filter;
+    std::vector<int> stream;
+    uint32_t state = 0xabcdef1u;
+    for (uint32_t i = 0; i < FILTERS_TEST_SAMPLES; i++)
+    {
+        int sample = (int)(nextRandom(state) % 4096);
+        filter.push(sample);
+        stream.push_back(sample);
+
+        std::vector<int> tail = sortedTail(stream, 30);
+        size_t n = tail.size();
+        int expected = (n & 1) ? tail[(n - 1) / 2] : (tail[n / 2] + tail[n / 2 - 1]) / 2;
+        TEST_ASSERT_EQUAL_INT(expected, filter.value());
+    }
+}
+
+void runFiltersTests()
+{
+    RUN_TEST(test_filters_trimmed_sum_matches_a_sort);
+    RUN_TEST(test_filters_trimmed_sum_survives_reset_and_restore);
+    RUN_TEST(test_filters_median_matches_a_sort);
+}
@@ -0,0 +1,306 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "TestSuites.h"
+#include "FlashLog.h"
+#include "native/FileFlashStore.h"
+
+#define TEST_LOG_SEGMENTS 4
+#define TEST_LOG_SEGMENT_SIZE 1024
+#define TEST_LOG_FLUSH_EVERY 20 // Small chunks so a segment holds several
+
+// Record number i, its values follow from the number
+static TelemetryRecord logRecord(uint32_t i)
+{
+    TelemetryRecord record;
+    record.sequence = i;
+    record.timestamp_ms = 0;
+    record.tds_ppm = 800.0f + (i % 97);
+    record.ph = 6.0f + (i % 13) * 0.01f;
+    record.temperature_c = 21.0f + (i % 7) * 0.1f;
+    record.status = 0;
+    return record;
+}
+
+// What a scan returned: record numbers must follow each other with increasing timestamps
+struct LogScan
+{
+    uint32_t count;
+    uint32_t first;
+    uint32_t last;
+    uint32_t last_ms;
+    bool in_order;
+    bool intact;
+};
+
+static bool visitRecord(const TelemetryRecord &record, void *context)
+{
+    LogScan &scan = *static_cast<LogScan *>(context);
+    TelemetryRecord expected = logRecord(record.sequence);
+    if (fabsf(record.tds_ppm - expected.tds_ppm) > 0.5f / SERIES_TDS_SCALE || fabsf(record.ph - expected.ph) > 0.5f / SERIES_PH_SCALE)
+        scan.intact = false;
+    if (scan.count == 0)
+        scan.first = record.sequence;
+    else if (record.sequence != scan.last + 1 || (int32_t)(record.timestamp_ms - scan.last_ms) <= 0)
+        scan.in_order = false;
+    scan.last = record.sequence;
+    scan.last_ms = record.timestamp_ms;
+    scan.count++;
+    return true;
+}
+
+static LogScan scanAll(FlashLog &log)
+{
+    LogScan scan = {0, 0, 0, 0, true, true};
+    log.scan(0, UINT32_MAX / 2, visitRecord, &scan);
+    return scan;
+}
+
+// Slot files in a directory of their own, removed again at the end of the test
+struct ScratchFlash
+{
+    char directory[64];
+    FileFlashStore *store;
+
+    ScratchFlash()
+    {
+        snprintf(directory, sizeof(directory), "/tmp/test_flash_log.XXXXXX");
+        TEST_ASSERT_NOT_NULL(mkdtemp(directory));
+        store = new FileFlashStore(directory);
+    }
+    ~ScratchFlash()
+    {
+        store->wipe();
+        delete store;
+        remove(directory);
+    }
+};
+
+// Append and flush every TEST_LOG_FLUSH_EVERY records, starting from record first. Returns the records on flash
+static uint32_t fill(FlashLog &log, uint32_t first, uint32_t count)
+{
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        TEST_ASSERT_TRUE(log.append(logRecord(i), i * 1000));
+        if ((i + 1) % TEST_LOG_FLUSH_EVERY == 0)
+            TEST_ASSERT_TRUE(log.flush());
+    }
+    return log.storedRecords();
+}
+
+// Reboot onto the same flash and check the history is exactly records 0 to flushed - 1
+static void checkRemount(FileFlashStore &store, uint32_t flushed)
+{
+    store.restorePower();
+    FlashLog remounted(store, TEST_LOG_SEGMENTS, TEST_LOG_SEGMENT_SIZE);
+    TEST_ASSERT_TRUE(remounted.begin(500));
+    LogScan scan = scanAll(remounted);
+    TEST_ASSERT_TRUE(scan.in_order);
+    TEST_ASSERT_TRUE(scan.intact);
+    TEST_ASSERT_EQUAL_UINT32(flushed, scan.count);
+    TEST_ASSERT_EQUAL_UINT32(0, scan.first);
+    TEST_ASSERT_EQUAL_UINT32(flushed - 1, scan.last);
+
+    // Appending goes on behind them, past the torn write, with later timestamps. A rotation may take the oldest
+    TEST_ASSERT_EQUAL_UINT32(flushed, remounted.storedRecords());
+    for (uint32_t i = flushed; i < flushed + 50; i++)
+        TEST_ASSERT_TRUE(remounted.append(logRecord(i), 1000 + i * 10));
+    TEST_ASSERT_TRUE(remounted.flush());
+    scan = scanAll(remounted);
+    TEST_ASSERT_TRUE(scan.in_order);
+    TEST_ASSERT_TRUE(scan.intact);
+    TEST_ASSERT_EQUAL_UINT32(flushed + 49, scan.last);
+    TEST_ASSERT_EQUAL_UINT32(remounted.storedRecords(), scan.count);
+}
+
+// Lose the power after budget bytes of the next chunk, returns the records flushed before it
+static uint32_t tearNextChunk(FileFlashStore &store, FlashLog &log, uint32_t budget)
+{
+    uint32_t flushed = fill(log, 0, 3 * TEST_LOG_FLUSH_EVERY);
+    TEST_ASSERT_EQUAL_UINT32(3 * TEST_LOG_FLUSH_EVERY, flushed);
+    uint32_t end = log.segment(0).end;
+
+    for (uint32_t i = flushed; i < flushed + 10; i++)
+        log.append(logRecord(i), i * 1000);
+    store.cutPowerAfter(budget);
+    TEST_ASSERT_FALSE(log.flush());
+    TEST_ASSERT_FALSE(store.powered);
+    TEST_ASSERT_EQUAL_UINT32(1, log.writeFailures());
+    TEST_ASSERT_EQUAL_UINT32(10, log.bufferedRecords());
+
+    // Exactly the budget made it behind the last good chunk
+    store.restorePower();
+    TEST_ASSERT_EQUAL_UINT32(end + budget, store.size(0));
+    return flushed;
+}
+
+static void test_flash_log_torn_chunk_header()
+{
+    ScratchFlash scratch;
+    FileFlashStore &store = *scratch.store;
+    FlashLog log(store, TEST_LOG_SEGMENTS, TEST_LOG_SEGMENT_SIZE);
+    TEST_ASSERT_TRUE(log.begin(0));
+    uint32_t flushed = tearNextChunk(store, log, FLASH_LOG_CHUNK_HEADER_SIZE / 2);
+    checkRemount(store, flushed);
+}
+
+static void test_flash_log_torn_payload()
+{
+    ScratchFlash scratch;
+    FileFlashStore &store = *scratch.store;
+    FlashLog log(store, TEST_LOG_SEGMENTS, TEST_LOG_SEGMENT_SIZE);
+    TEST_ASSERT_TRUE(log.begin(0));
+    uint32_t flushed = tearNextChunk(store, log, FLASH_LOG_CHUNK_HEADER_SIZE + 5);
+    checkRemount(store, flushed);
+}
+
+static void test_flash_log_corrupted_payload_is_not_returned()
+{
+    ScratchFlash scratch;
+    FileFlashStore &store = *scratch.store;
+    FlashLog log(store, TEST_LOG_SEGMENTS, TEST_LOG_SEGMENT_SIZE);
+    TEST_ASSERT_TRUE(log.begin(0));
+    fill(log, 0, 3 * TEST_LOG_FLUSH_EVERY);
+    uint32_t bad_chunk = log.segment(0).end; // A full length chunk that went bad later
+    fill(log, 3 * TEST_LOG_FLUSH_EVERY, TEST_LOG_FLUSH_EVERY);
+
+    char name[128];
+    snprintf(name, sizeof(name), "%s/seg00.bin", scratch.directory);
+    FILE *file = fopen(name, "r+b");
+    TEST_ASSERT_NOT_NULL(file);
+    fseek(file, bad_chunk + FLASH_LOG_CHUNK_HEADER_SIZE + 3, SEEK_SET);
+    int byte = fgetc(file);
+    fseek(file, bad_chunk + FLASH_LOG_CHUNK_HEADER_SIZE + 3, SEEK_SET);
+    fputc(byte ^ 0x40, file);
+    fclose(file);
+
+    // The scan stops at the chunk that fails its CRC and hands out only what came before it
+    FlashLog remounted(store, TEST_LOG_SEGMENTS, TEST_LOG_SEGMENT_SIZE);
+    TEST_ASSERT_TRUE(remounted.begin(0));
+    LogScan scan = scanAll(remounted);
+    TEST_ASSERT_TRUE(scan.in_order);
+    TEST_ASSERT_TRUE(scan.intact);
+    TEST_ASSERT_EQUAL_UINT32(3 * TEST_LOG_FLUSH_EVERY, scan.count);
+}
+
+static void test_flash_log_failed_rotate_after_erase()
+{
+    ScratchFlash scratch;
+    FileFlashStore &store = *scratch.store;
+    FlashLog log(store, TEST_LOG_SEGMENTS, TEST_LOG_SEGMENT_SIZE);
+    TEST_ASSERT_TRUE(log.begin(0));
+
+    // Fill until the next chunk needs a new segment
+    uint32_t next = 0;
+    while (true)
+    {
+        for (uint32_t i = 0; i < TEST_LOG_FLUSH_EVERY; i++, next++)
+            TEST_ASSERT_TRUE(log.append(logRecord(next), next * 1000));
+        if (log.segment(0).end + FLASH_LOG_CHUNK_HEADER_SIZE + log.bufferedBytes() > TEST_LOG_SEGMENT_SIZE)
+            break;
+        TEST_ASSERT_TRUE(log.flush());
+    }
+    uint32_t flushed = log.storedRecords();
+    TEST_ASSERT_GREATER_THAN(TEST_LOG_FLUSH_EVERY, flushed);
+
+    // The erase of slot 1 goes through, the power fails in its header
+    store.cutPowerAfter(5);
+    TEST_ASSERT_FALSE(log.flush());
+    TEST_ASSERT_EQUAL_UINT32(1, store.erases[1]);
+    TEST_ASSERT_EQUAL_UINT32(TEST_LOG_FLUSH_EVERY, log.bufferedRecords());
+    TEST_ASSERT_EQUAL_UINT32(0, log.droppedRecords());
+
+    // Without a reboot the buffered records go out with the next attempt
+    store.restorePower();
+    TEST_ASSERT_TRUE(log.flush());
+    TEST_ASSERT_EQUAL_UINT32(2, store.erases[1]);
+    LogScan scan = scanAll(log);
+    TEST_ASSERT_TRUE(scan.in_order);
+    TEST_ASSERT_EQUAL_UINT32(next, scan.count);
+
+    // With a reboot the slot with the torn header is unused and the history ends at the last good chunk
+    store.wipe();
+    FlashLog rebooted(store, TEST_LOG_SEGMENTS, TEST_LOG_SEGMENT_SIZE);
+    TEST_ASSERT_TRUE(rebooted.begin(0));
+    next = 0;
+    while (true)
+    {
+        for (uint32_t i = 0; i < TEST_LOG_FLUSH_EVERY; i++, next++)
+            rebooted.append(logRecord(next), next * 1000);
+        if (rebooted.segment(0).end + FLASH_LOG_CHUNK_HEADER_SIZE + rebooted.bufferedBytes() > TEST_LOG_SEGMENT_SIZE)
+            break;
+        rebooted.flush();
+    }
+    flushed = rebooted.storedRecords();
+    store.cutPowerAfter(5);
+    TEST_ASSERT_FALSE(rebooted.flush());
+    checkRemount(store, flushed);
+}
+
+static void test_flash_log_power_cut_anywhere()
+{
+    // Cut the power at every few bytes of a stretch of writes that crosses several rotations
+    for (uint32_t budget = 0; budget < 3 * TEST_LOG_SEGMENT_SIZE; budget += 29)
+    {
+        ScratchFlash scratch;
+        FileFlashStore &store = *scratch.store;
+        FlashLog log(store, TEST_LOG_SEGMENTS, TEST_LOG_SEGMENT_SIZE);
+        TEST_ASSERT_TRUE(log.begin(0));
+        store.cutPowerAfter(budget);
+        uint32_t flushed = 0;
+        for (uint32_t i = 0; store.powered; i++)
+        {
+            log.append(logRecord(i), i * 1000);
+            if ((i + 1) % TEST_LOG_FLUSH_EVERY == 0 && log.flush())
+                flushed = i + 1;
+        }
+        if (flushed > 0)
+            checkRemount(store, flushed);
+    }
+}
+
+static void test_flash_log_wear_is_even()
+{
+    ScratchFlash scratch;
+    FileFlashStore &store = *scratch.store;
+    FlashLog *log = new FlashLog(store, TEST_LOG_SEGMENTS, TEST_LOG_SEGMENT_SIZE);
+    TEST_ASSERT_TRUE(log->begin(0));
+
+    // Many rotations with reboots at odd points in between, the erase counts live in the segment headers
+    uint32_t boot_ms = 0;
+    for (uint32_t i = 0; i < 20000; i++)
+    {
+        if (i % 1777 == 1776)
+        {
+            log->flush();
+            delete log;
+            log = new FlashLog(store, TEST_LOG_SEGMENTS, TEST_LOG_SEGMENT_SIZE);
+            TEST_ASSERT_TRUE(log->begin(0));
+            boot_ms = i * 1000;
+        }
+        log->append(logRecord(i), i * 1000 - boot_ms);
+    }
+
+    uint32_t least = UINT32_MAX, most = 0;
+    for (uint8_t slot = 0; slot < TEST_LOG_SEGMENTS; slot++)
+    {
+        uint32_t wear = log->segment(slot).wear;
+        TEST_ASSERT_EQUAL_UINT32(store.erases[slot], wear);
+        least = wear < least ? wear : least;
+        most = wear > most ? wear : most;
+    }
+    TEST_ASSERT_GREATER_THAN(10, least);
+    TEST_ASSERT_LESS_OR_EQUAL(1, most - least);
+    delete log;
+}
+
+void runFlashLogTests()
+{
+    RUN_TEST(test_flash_log_torn_chunk_header);
+    RUN_TEST(test_flash_log_torn_payload);
+    RUN_TEST(test_flash_log_corrupted_payload_is_not_returned);
+    RUN_TEST(test_flash_log_failed_rotate_after_erase);
+    RUN_TEST(test_flash_log_power_cut_anywhere);
+    RUN_TEST(test_flash_log_wear_is_even);
+}
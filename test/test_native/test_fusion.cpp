@@ -0,0 +1,363 @@
+#include <unity.h>
+#include <math.h>
+#include <string.h>
+#include "TestSuites.h"
+#include "SensorFusion.h"
+#include "SensorPipeline.h"
+#include "Calibration.h"
+#include "SensorMath.h"
+#include "PipelineRig.h"
+#include "native/FakeClock.h"
+
+#define FUSION_TEST_STEP_US 128000     // One block at the base rate
+#define FUSION_TEST_HOURS 2            // Length of the reservoir trace
+#define FUSION_TEST_DOSE_PERIOD_S 2400 // A dose every forty minutes, the first after twenty
+#define FUSION_TEST_MIX_TAU_S 180.0f   // Mixing time constant of a dose
+#define FUSION_TEST_HEATER_PERIOD_S 1200
+#define FUSION_TEST_WARMUP_S 60        // Not compared, the filters fill up and the fusion settles
+#define FUSION_TEST_PH_NOISE 4.0f      // Raw counts, like the simulated sensors
+#define FUSION_TEST_TDS_NOISE 6.0f
+#define FUSION_TEST_TEMP_NOISE 0.02f   // C, before the 12-bit step
+
+static uint32_t fusion_random;
+
+static uint32_t nextRandom(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Standard normal sample, Box-Muller
+static float nextNoise(uint32_t &state)
+{
+    float u1 = (nextRandom(state) + 1.0f) / 4294967296.0f;
+    float u2 = nextRandom(state) / 4294967296.0f;
+    return sqrtf(-2.0f * logf(u1)) * cosf(6.2831853f * u2);
+}
+
+// Error of one channel against the truth, and how often the truth was within 2 sigma
+struct FusionError
+{
+    double sum_squares;
+    uint32_t count;
+    uint32_t covered;
+
+    void add(float error, float sigma)
+    {
+        sum_squares += (double)error * error;
+        count++;
+        if (fabsf(error) <= 2 * sigma)
+            covered++;
+    }
+    float rms() const { return count ? sqrt(sum_squares / count) : 0; }
+    float coverage() const { return count ? (float)covered / count : 0; }
+};
+
+// A fusion settled on pH 6 and 1.2 V of TDS at 25 C
+static void settle(SensorFusion &fusion, uint32_t &time_us)
+{
+    fusion_random = 5;
+    const SensorFusionConfig &config = fusion.config();
+    for (uint16_t i = 0; i < 200; i++, time_us += FUSION_TEST_STEP_US)
+    {
+        fusion.temperature(25.0f + config.temp_sd * nextNoise(fusion_random), time_us);
+        fusion.ph(6.0f + config.ph_sd * nextNoise(fusion_random), time_us);
+        fusion.tdsVolts(1.2f + config.tds_sd * nextNoise(fusion_random), time_us);
+    }
+}
+
+static void test_fusion_first_measurement_starts_a_state()
+{
+    SensorFusion fusion;
+    TEST_ASSERT_FALSE(fusion.estimate(SensorFusion::FUSION_PH).valid);
+    TEST_ASSERT_FALSE(fusion.estimate(SensorFusion::FUSION_TEMPERATURE).valid);
+
+    TEST_ASSERT_TRUE(fusion.ph(6.5f, 1000));
+    FusedValue ph = fusion.estimate(SensorFusion::FUSION_PH);
+    TEST_ASSERT_TRUE(ph.valid);
+    TEST_ASSERT_EQUAL_FLOAT(6.5f, ph.value);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6f, fusion.config().ph_sd, ph.sigma);
+    TEST_ASSERT_FALSE(fusion.estimate(SensorFusion::FUSION_TDS_VOLTS).valid);
+    TEST_ASSERT_EQUAL_UINT32(1, fusion.updates());
+
+    fusion.reset();
+    TEST_ASSERT_FALSE(fusion.estimate(SensorFusion::FUSION_PH).valid);
+    TEST_ASSERT_EQUAL_UINT32(0, fusion.updates());
+}
+
+static void test_fusion_keeps_the_tds_voltage_when_the_temperature_starts()
+{
+    // Before any temperature the TDS is compensated at 25 C, the first read at 30 C rescales it to the same voltage
+    SensorFusion fusion;
+    TEST_ASSERT_TRUE(fusion.tdsVolts(1.1f, 1000));
+    TEST_ASSERT_FLOAT_WITHIN(1e-6f, 1.1f, fusion.estimate(SensorFusion::FUSION_TDS_VOLTS).value);
+    TEST_ASSERT_TRUE(fusion.temperature(30.0f, 1000));
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, 1.0f, fusion.estimate(SensorFusion::FUSION_TDS_VOLTS).value);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, 30.0f, fusion.estimate(SensorFusion::FUSION_TEMPERATURE).value);
+}
+
+static void test_fusion_bounds_cover_the_truth_of_an_exact_model()
+{
+    // pH and TDS that walk by exactly the configured drift, measured with exactly the configured noise: the
+    // truth is within 2 sigma about 95% of the time, and the fused error is well below the measurement noise
+    SensorFusion fusion;
+    const SensorFusionConfig &config = fusion.config();
+    const float dt = FUSION_TEST_STEP_US / 1e6f;
+    float ph = 6.0f, volts = 1.2f;
+    FusionError fused_ph = {}, fused_tds = {}, measured_ph = {}, measured_tds = {};
+    fusion_random = 17;
+    uint32_t time_us = 0;
+    for (uint32_t i = 0; i < 40000; i++, time_us += FUSION_TEST_STEP_US)
+    {
+        ph += config.ph_walk * sqrtf(dt) * nextNoise(fusion_random);
+        volts += config.tds_walk * sqrtf(dt) * nextNoise(fusion_random);
+        float ph_read = ph + config.ph_sd * nextNoise(fusion_random);
+        float volts_read = volts + config.tds_sd * nextNoise(fusion_random);
+        TEST_ASSERT_TRUE(fusion.ph(ph_read, time_us));
+        TEST_ASSERT_TRUE(fusion.tdsVolts(volts_read, time_us));
+        if (i < 100)
+            continue;
+        FusedValue fused = fusion.estimate(SensorFusion::FUSION_PH);
+        fused_ph.add(fused.value - ph, fused.sigma);
+        measured_ph.add(ph_read - ph, 0);
+        fused = fusion.estimate(SensorFusion::FUSION_TDS_VOLTS);
+        fused_tds.add(fused.value - volts, fused.sigma);
+        measured_tds.add(volts_read - volts, 0);
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.02f, 0.954f, fused_ph.coverage());
+    TEST_ASSERT_FLOAT_WITHIN(0.02f, 0.954f, fused_tds.coverage());
+    TEST_ASSERT_LESS_THAN_FLOAT(measured_ph.rms() / 2, fused_ph.rms());
+    TEST_ASSERT_LESS_THAN_FLOAT(measured_tds.rms() / 2, fused_tds.rms());
+}
+
+static void test_fusion_gates_an_outlier()
+{
+    SensorFusion fusion;
+    uint32_t time_us = 0;
+    settle(fusion, time_us);
+    TEST_ASSERT_EQUAL_UINT32(0, fusion.rejects());
+    FusedValue before = fusion.estimate(SensorFusion::FUSION_PH);
+
+    // A spike the filters let through changes nothing, the next good value goes in
+    TEST_ASSERT_FALSE(fusion.ph(7.0f, time_us));
+    TEST_ASSERT_EQUAL_UINT32(1, fusion.rejects());
+    TEST_ASSERT_EQUAL_FLOAT(before.value, fusion.estimate(SensorFusion::FUSION_PH).value);
+    TEST_ASSERT_TRUE(fusion.ph(6.0f, time_us + FUSION_TEST_STEP_US));
+
+    // Outliers that are not in a row never restart the state
+    for (uint8_t i = 0; i < 3 * fusion.config().max_rejects; i++)
+    {
+        time_us += FUSION_TEST_STEP_US;
+        TEST_ASSERT_FALSE(fusion.ph(7.0f, time_us));
+        TEST_ASSERT_TRUE(fusion.ph(6.0f, time_us));
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 6.0f, fusion.estimate(SensorFusion::FUSION_PH).value);
+
+    // A TDS spike is gated the same way and leaves the temperature alone
+    FusedValue temperature = fusion.estimate(SensorFusion::FUSION_TEMPERATURE);
+    TEST_ASSERT_FALSE(fusion.tdsVolts(1.5f, time_us));
+    TEST_ASSERT_EQUAL_FLOAT(temperature.value, fusion.estimate(SensorFusion::FUSION_TEMPERATURE).value);
+}
+
+static void test_fusion_restarts_after_max_rejects()
+{
+    // A dose stepped the pH: the first max_rejects - 1 readings are outliers, the next one restarts the state from it
+    SensorFusion fusion;
+    uint32_t time_us = 0;
+    settle(fusion, time_us);
+    const SensorFusionConfig &config = fusion.config();
+    for (uint8_t i = 1; i < config.max_rejects; i++, time_us += FUSION_TEST_STEP_US)
+    {
+        TEST_ASSERT_FALSE(fusion.ph(5.5f, time_us));
+        TEST_ASSERT_FLOAT_WITHIN(0.01f, 6.0f, fusion.estimate(SensorFusion::FUSION_PH).value);
+    }
+    uint32_t updates = fusion.updates();
+    TEST_ASSERT_TRUE(fusion.ph(5.5f, time_us));
+    FusedValue ph = fusion.estimate(SensorFusion::FUSION_PH);
+    TEST_ASSERT_EQUAL_FLOAT(5.5f, ph.value);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6f, config.ph_sd, ph.sigma);
+    TEST_ASSERT_EQUAL_UINT32(config.max_rejects, fusion.rejects());
+    TEST_ASSERT_EQUAL_UINT32(updates + 1, fusion.updates());
+
+    // The rest did not restart, and the new level is tracked from there
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 25.0f, fusion.estimate(SensorFusion::FUSION_TEMPERATURE).value);
+    TEST_ASSERT_FLOAT_WITHIN(0.005f, 1.2f, fusion.estimate(SensorFusion::FUSION_TDS_VOLTS).value);
+    time_us += FUSION_TEST_STEP_US;
+    TEST_ASSERT_TRUE(fusion.ph(5.5f, time_us));
+    TEST_ASSERT_LESS_THAN_FLOAT(config.ph_sd, fusion.estimate(SensorFusion::FUSION_PH).sigma);
+}
+
+static void test_fusion_takes_a_late_measurement_as_now()
+{
+    SensorFusion fusion;
+    uint32_t time_us = 0;
+    settle(fusion, time_us);
+    float sigma = fusion.estimate(SensorFusion::FUSION_PH).sigma;
+    // Older than the state: no prediction backwards, the uncertainty only shrinks
+    TEST_ASSERT_TRUE(fusion.ph(6.0f, time_us - 10 * FUSION_TEST_STEP_US));
+    TEST_ASSERT_LESS_THAN_FLOAT(sigma, fusion.estimate(SensorFusion::FUSION_PH).sigma);
+}
+
+// The reservoir trace: uptake ramps, a pH down and nutrient dose every forty minutes that mix in over a few
+// minutes, and a heater cycling the temperature around a slow warm-up
+struct FusionTruth
+{
+    float ph;
+    float tds_ppm;
+    float celsius;
+};
+
+static CalibrationCurves fusion_curves;
+static uint64_t fusion_now_us; // Fake clock without the wrap, the trace lasts hours
+static PipelineRig *fusion_rig;
+
+static FusionTruth truthAt(double seconds)
+{
+    float hours = seconds / 3600.0;
+    FusionTruth truth = {6.0f + 0.05f * hours, 1100.0f - 20.0f * hours,
+                         22.0f + 0.5f * hours + 0.4f * sinf(6.2831853f * seconds / FUSION_TEST_HEATER_PERIOD_S)};
+    for (double dose = FUSION_TEST_DOSE_PERIOD_S / 2; dose < seconds; dose += FUSION_TEST_DOSE_PERIOD_S)
+    {
+        float mixed = 1.0f - expf(-(seconds - dose) / FUSION_TEST_MIX_TAU_S);
+        truth.ph -= 0.1f * mixed;
+        truth.tds_ppm += 40.0f * mixed;
+    }
+    return truth;
+}
+
+// Fractional raw count that reads as these millivolts, the table rises with the count
+static float rawFor(const AdcCalibration &calibration, float millivolts)
+{
+    uint16_t low = 0, high = ADC_RAW_MAX;
+    if (millivolts <= calibration.millivolts(low))
+        return low;
+    if (millivolts >= calibration.millivolts(high))
+        return high;
+    while (high - low > 1)
+    {
+        uint16_t middle = (low + high) / 2;
+        if (calibration.millivolts(middle) <= millivolts)
+            low = middle;
+        else
+            high = middle;
+    }
+    float span = calibration.millivolts(high) - calibration.millivolts(low);
+    return low + (span > 0 ? (millivolts - calibration.millivolts(low)) / span : 0);
+}
+
+// Probe voltage that gives this value, for a curve that only rises or only falls
+static float voltsFor(float target, float (*curve)(float volts))
+{
+    float low = 0, high = 3.3f;
+    bool rising = curve(high) > curve(low);
+    for (uint8_t i = 0; i < 40; i++)
+    {
+        float middle = (low + high) / 2;
+        if ((curve(middle) < target) == rising)
+            low = middle;
+        else
+            high = middle;
+    }
+    return (low + high) / 2;
+}
+
+static float curvePh(float volts) { return SensorMath::toFloat(fusion_curves.ph(SensorMath::value(volts))); }
+static float curveTds(float volts) { return SensorMath::toFloat(fusion_curves.tdsPpm(SensorMath::value(volts))); }
+
+// Raw counts of the probes, what the pipeline turns back into the truth
+static uint16_t fusionSignal(uint8_t pin, uint32_t time_us)
+{
+    uint64_t at_us = fusion_now_us - (uint32_t)(fake_now_us - time_us);
+    FusionTruth truth = truthAt(at_us / 1e6);
+    float raw;
+    if (pin == RIG_PIN_PH)
+        raw = rawFor(fusion_rig->ph_calibration, voltsFor(truth.ph, curvePh) * 1000.0f) + FUSION_TEST_PH_NOISE * nextNoise(fusion_random);
+    else
+    {
+        // The probe voltage rises with the temperature, the pipeline compensates it
+        float volts = voltsFor(truth.tds_ppm, curveTds) * (1.0f + (truth.celsius - 25.0f) / 50.0f);
+        raw = rawFor(fusion_rig->tds_calibration, volts * 1000.0f) + FUSION_TEST_TDS_NOISE * nextNoise(fusion_random);
+    }
+    if (raw < 0)
+        raw = 0;
+    return raw > ADC_RAW_MAX ? ADC_RAW_MAX : (uint16_t)lroundf(raw);
+}
+
+// The filters' latest values and the fused estimates against the truth, once a second over the trace
+struct FusionRun
+{
+    FusionError filter_ph, filter_tds, filter_temp;
+    FusionError fused_ph, fused_tds, fused_temp;
+};
+
+static void runTrace(uint8_t shift, FusionRun &result)
+{
+    fusion_now_us = 0;
+    fusion_random = 2463534242UL;
+    PipelineRig rig(fusionSignal, truthAt(0).celsius);
+    fusion_rig = &rig;
+    SensorFusion fusion;
+    rig.pipeline.setFusion(&fusion);
+    rig.begin(RIG_ADC_RATE_HZ >> shift);
+
+    const uint64_t end_s = FUSION_TEST_HOURS * 3600ULL;
+    uint64_t next_check_s = FUSION_TEST_WARMUP_S;
+    while (fusion_now_us / 1000000 < end_s)
+    {
+        // A DS18B20 at 12 bits reads in 1/16 C steps
+        float celsius = truthAt(fusion_now_us / 1e6).celsius + FUSION_TEST_TEMP_NOISE * nextNoise(fusion_random);
+        rig.bus.setTemperature(0, roundf(celsius * 16) / 16);
+
+        uint32_t before_us = fake_now_us;
+        fakeSpend(rig.scheduler.runOnce());
+        fusion_now_us += fake_now_us - before_us;
+
+        while (next_check_s <= fusion_now_us / 1000000 && next_check_s <= end_s)
+        {
+            FusionTruth truth = truthAt(next_check_s);
+            FusedReadings fused;
+            TEST_ASSERT_TRUE(rig.pipeline.fused(fused));
+            result.filter_ph.add(rig_channels[READING_PH].value - truth.ph, 0);
+            result.filter_tds.add(rig_channels[READING_TDS].value - truth.tds_ppm, 0);
+            result.filter_temp.add(rig_channels[READING_TEMPERATURE].value - truth.celsius, 0);
+            result.fused_ph.add(fused.ph.value - truth.ph, fused.ph.sigma);
+            result.fused_tds.add(fused.tds_ppm.value - truth.tds_ppm, fused.tds_ppm.sigma);
+            result.fused_temp.add(fused.temperature.value - truth.celsius, fused.temperature.sigma);
+            next_check_s++;
+        }
+    }
+    fusion_rig = NULL;
+}
+
+static void test_fusion_beats_the_filters_on_a_reservoir()
+{
+    // The fusion beats every filter at the same rate, and on a quarter of the samples still beats them at the full
+    // one. The model is not exact here, the doses and the heater are no random walk, so the bounds are allowed to
+    // be wider than 2 sigma of a gaussian but never much narrower
+    FusionRun full = {}, cut = {};
+    runTrace(0, full);
+    runTrace(2, cut);
+    const FusionRun *runs[] = {&full, &cut};
+    for (const FusionRun *run : runs)
+    {
+        TEST_ASSERT_LESS_THAN_FLOAT(full.filter_ph.rms(), run->fused_ph.rms());
+        TEST_ASSERT_LESS_THAN_FLOAT(full.filter_tds.rms(), run->fused_tds.rms());
+        TEST_ASSERT_LESS_THAN_FLOAT(full.filter_temp.rms(), run->fused_temp.rms());
+        TEST_ASSERT_GREATER_OR_EQUAL_FLOAT(0.9f, run->fused_ph.coverage());
+        TEST_ASSERT_GREATER_OR_EQUAL_FLOAT(0.9f, run->fused_tds.coverage());
+        TEST_ASSERT_GREATER_OR_EQUAL_FLOAT(0.9f, run->fused_temp.coverage());
+    }
+}
+
+void runFusionTests()
+{
+    RUN_TEST(test_fusion_first_measurement_starts_a_state);
+    RUN_TEST(test_fusion_keeps_the_tds_voltage_when_the_temperature_starts);
+    RUN_TEST(test_fusion_bounds_cover_the_truth_of_an_exact_model);
+    RUN_TEST(test_fusion_gates_an_outlier);
+    RUN_TEST(test_fusion_restarts_after_max_rejects);
+    RUN_TEST(test_fusion_takes_a_late_measurement_as_now);
+    RUN_TEST(test_fusion_beats_the_filters_on_a_reservoir);
+}
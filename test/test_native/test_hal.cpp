@@ -0,0 +1,62 @@
+#include <unity.h>
+#include "TestSuites.h"
+#include "Hal.h"
+#include "native/FakeClock.h"
+#include "native/NativeHal.h"
+
+#define HAL_TEST_PIN 39
+
+static void test_hal_clock_follows_the_fake_clock()
+{
+    fake_now_us = 1234567;
+    TEST_ASSERT_EQUAL_UINT32(1234567, halMicros());
+    TEST_ASSERT_EQUAL_UINT32(1234, halMillis());
+    TEST_ASSERT_EQUAL_UINT32(fakeClock(), halMicros());
+    fakeSpend(433);
+    TEST_ASSERT_EQUAL_UINT32(1235000, halMicros());
+}
+
+static void test_hal_delay_spends_fake_time()
+{
+    fake_now_us = 0;
+    halDelay(25);
+    TEST_ASSERT_EQUAL_UINT32(25000, halMicros());
+}
+
+static void test_hal_clock_wraps_like_micros()
+{
+    fake_now_us = 0xFFFFFF00UL;
+    fakeSpend(0x200);
+    TEST_ASSERT_EQUAL_UINT32(0x100, halMicros());
+}
+
+static void test_hal_cycles_run_in_real_time()
+{
+    // The profiler's counter is real time on the host, the fake clock does not move it
+    fake_now_us = 0;
+    uint32_t start = halCycles();
+    volatile uint32_t sink = 0;
+    for (uint32_t i = 0; i < 100000; i++)
+        sink += i;
+    TEST_ASSERT_GREATER_THAN_UINT32(0, halCycles() - start);
+    TEST_ASSERT_EQUAL_UINT32(0, halMicros());
+    TEST_ASSERT_EQUAL_UINT32(1000, halCyclesPerUs());
+}
+
+static void test_hal_analog_read_samples_the_simulated_sensor()
+{
+    fake_now_us = 0;
+    if (simulated_sensors.findPin(HAL_TEST_PIN) < 0)
+        simulated_sensors.add("haltest", HAL_TEST_PIN, 1234.4f);
+    TEST_ASSERT_EQUAL_UINT16(1234, halAnalogRead(HAL_TEST_PIN));
+    TEST_ASSERT_EQUAL_UINT16(0, halAnalogRead(HAL_TEST_PIN + 1)); // Nothing on the pin reads low
+}
+
+void runHalTests()
+{
+    RUN_TEST(test_hal_clock_follows_the_fake_clock);
+    RUN_TEST(test_hal_delay_spends_fake_time);
+    RUN_TEST(test_hal_clock_wraps_like_micros);
+    RUN_TEST(test_hal_cycles_run_in_real_time);
+    RUN_TEST(test_hal_analog_read_samples_the_simulated_sensor);
+}
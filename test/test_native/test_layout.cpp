@@ -0,0 +1,279 @@
+#include <unity.h>
+#include <math.h>
+#include <string.h>
+#include <type_traits>
+#include "TestSuites.h"
+#include "PipelineLayout.h"
+#include "SensorPipeline.h"
+#include "Scheduler.h"
+#include "TemperatureEngine.h"
+#include "Ads1x15Source.h"
+#include "AdcCalibration.h"
+#include "Hal.h"
+#include "native/FakeClock.h"
+#include "native/MockTemperatureBus.h"
+#include "native/MockAds1x15Bus.h"
+#include "native/SimulatedAdcSource.h"
+#include "native/ReferenceAdcCurve.h"
+
+#define LAYOUT_TEST_SECONDS 5
+#define LAYOUT_TEST_PH_VOLTS 1.5f
+#define LAYOUT_TEST_TDS_VOLTS 0.8f
+#define LAYOUT_TEST_ONEWIRE_PIN 32
+
+// The firmware's layouts: GPIO34 / GPIO25, pH on ADC1 for WiFi, and chains with extra probes
+constexpr PipelineLayout<2> LAYOUT_GPIO = {{{READING_TDS, SOURCE_GPIO, 34}, {READING_PH, SOURCE_GPIO, 25}}};
+constexpr PipelineLayout<2> LAYOUT_GPIO_WIFI = {{{READING_TDS, SOURCE_GPIO, 34}, {READING_PH, SOURCE_GPIO, 35}}};
+constexpr PipelineLayout<2> LAYOUT_ADS_PAIR = ads1x15Layout<2>(1, 0);
+constexpr PipelineLayout<8> LAYOUT_ADS_8 = ads1x15Layout<8>(2, 3);
+constexpr PipelineLayout<16> LAYOUT_ADS_16 = ads1x15Layout<16>(4, 7);
+
+// Broken layouts, each has to fail the check that is about it
+constexpr PipelineLayout<2> BROKEN_SHARED = {{{READING_TDS, SOURCE_GPIO, 34}, {READING_PH, SOURCE_GPIO, 34}}};
+constexpr PipelineLayout<2> BROKEN_NO_ADC = {{{READING_TDS, SOURCE_GPIO, 34}, {READING_PH, SOURCE_GPIO, 5}}};
+constexpr PipelineLayout<2> BROKEN_SWAPPED = {{{READING_PH, SOURCE_GPIO, 25}, {READING_TDS, SOURCE_GPIO, 34}}};
+constexpr PipelineLayout<2> BROKEN_MIXED = {{{READING_TDS, SOURCE_GPIO, 34}, {READING_PH, SOURCE_ADS1X15, 0}}};
+constexpr PipelineLayout<2> BROKEN_ONEWIRE = {{{READING_TDS, SOURCE_GPIO, 34}, {READING_PH, SOURCE_GPIO, 32}}};
+constexpr PipelineLayout<5> BROKEN_GPIO_COUNT = {{{READING_TDS, SOURCE_GPIO, 34}, {READING_PH, SOURCE_GPIO, 35},
+                                                  {READING_PH, SOURCE_GPIO, 36}, {READING_PH, SOURCE_GPIO, 39}, {READING_TDS, SOURCE_GPIO, 33}}};
+constexpr PipelineLayout<9> BROKEN_CHAIN = ads1x15Layout<9>(2, 3);
+
+// A layout valid on a build with WiFi on or off and a chain of ads_devices
+template <uint8_t N>
+constexpr bool layoutValid(const PipelineLayout<N> &layout, bool wifi, uint8_t ads_devices)
+{
+    return layoutFitsPipeline(layout, PIPELINE_MAX_PROBES) && layoutPinsValid(layout, ads_devices) && layoutFitsWifi(layout, wifi) &&
+           layoutLeavesFree(layout, LAYOUT_TEST_ONEWIRE_PIN);
+}
+
+// The checks are constexpr, the firmware runs them in static_asserts
+static_assert(layoutValid(LAYOUT_GPIO, false, 0), "GPIO pair");
+static_assert(!layoutPinsValid(BROKEN_SHARED, 0), "Two probes on one pin");
+
+static const uint8_t layout_addresses[ADS1X15_MAX_DEVICES] = {0x48, 0x49, 0x4A, 0x4B};
+static const uint8_t *layout_pins; // Pins of the layout that runs
+static const ChannelSpec *layout_specs;
+static uint8_t layout_count;
+
+// What the pipeline reported last, by kind and index
+static float layout_values[READING_EC + 1][1 + PIPELINE_MAX_PROBES];
+static uint32_t layout_counts[READING_EC + 1][1 + PIPELINE_MAX_PROBES];
+
+static void layoutSink(ReadingChannel channel, uint8_t index, float value, SensorQuality quality)
+{
+    if (index > PIPELINE_MAX_PROBES)
+        return;
+    layout_values[channel][index] = value;
+    layout_counts[channel][index]++;
+}
+
+static float layoutVolts(ReadingChannel kind) { return kind == READING_PH ? LAYOUT_TEST_PH_VOLTS : LAYOUT_TEST_TDS_VOLTS; }
+
+// The simulated GPIOs, raw counts of the reference curve
+static uint16_t layoutSignal(uint8_t pin, uint32_t time_us)
+{
+    for (uint8_t i = 0; i < layout_count; i++)
+    {
+        if (layout_pins[i] == pin)
+            return (uint16_t)(layoutVolts(layout_specs[i].kind) * 4095 / 3.3f);
+    }
+    return 0;
+}
+
+static float layoutChainSignal(uint8_t device, uint8_t input, uint32_t time_us, void *context)
+{
+    for (uint8_t i = 0; i < layout_count; i++)
+    {
+        if (layout_pins[i] == ADS1X15_INPUT(device, input))
+            return layoutVolts(layout_specs[i].kind);
+    }
+    return 0;
+}
+
+template <uint8_t N>
+static void layoutStart(const PipelineLayout<N> &layout, const typename PipelineLayout<N>::Pins &pins)
+{
+    layout_pins = pins.pin;
+    layout_specs = layout.channels;
+    layout_count = N;
+    memset(layout_counts, 0, sizeof(layout_counts));
+    fake_now_us = 0;
+}
+
+// Every probe reported, the same value as the first of its kind
+static void layoutAssertReported(const ChannelSpec *channels, uint8_t count)
+{
+    const ReadingChannel kinds[] = {READING_TDS, READING_PH};
+    for (ReadingChannel kind : kinds)
+    {
+        uint8_t probes = 0;
+        for (uint8_t i = 0; i < count; i++)
+            probes += channels[i].kind == kind;
+        for (uint8_t index = 0; index < probes; index++)
+        {
+            TEST_ASSERT_GREATER_THAN(0, layout_counts[kind][index]);
+            TEST_ASSERT_FLOAT_WITHIN(1e-3f, layout_values[kind][0], layout_values[kind][index]);
+        }
+    }
+}
+
+// The pipeline on the simulated on-chip ADC
+template <uint8_t N>
+static void runGpio(const PipelineLayout<N> &layout)
+{
+    const typename PipelineLayout<N>::Pins pins = layout.pins();
+    layoutStart(layout, pins);
+
+    AdcCalibration adc1, adc2;
+    adc1.build(referenceAdcMillivolts, &REFERENCE_ADC1);
+    adc2.build(referenceAdcMillivolts, &REFERENCE_ADC2);
+    SimulatedAdcSource adc(layoutSignal);
+    MockTemperatureBus bus;
+    bus.addProbe(21.5f);
+    TemperatureEngine temperatures(bus, halMicros);
+    Scheduler scheduler(halMicros);
+    SensorPipeline pipeline(adc, temperatures, adc1, adc2);
+    TEST_ASSERT_TRUE(pipeline.addProbes(layout));
+    adc.begin(pins.pin, N, 250);
+    temperatures.begin(halMicros());
+    pipeline.begin(scheduler, layoutSink, 1000000UL * ADC_BLOCK_SIZE / 250, 10000000UL);
+
+    while ((int32_t)(LAYOUT_TEST_SECONDS * 1000000UL - fake_now_us) > 0)
+        fakeSpend(scheduler.runOnce());
+    layoutAssertReported(layout.channels, N);
+}
+
+// The pipeline on the mock chain, the pulses go to the source as the pin interrupts would
+template <uint8_t N>
+static void runChain(const PipelineLayout<N> &layout, uint8_t devices)
+{
+    const typename PipelineLayout<N>::Pins pins = layout.pins();
+    layoutStart(layout, pins);
+
+    MockAds1x15Bus mock(layoutChainSignal, NULL, false);
+    for (uint8_t i = 0; i < devices; i++)
+        mock.addDevice(layout_addresses[i], 0);
+    Ads1x15Source source(mock, layout_addresses, devices, ADS1115);
+    MockTemperatureBus bus;
+    bus.addProbe(21.5f);
+    TemperatureEngine temperatures(bus, halMicros);
+    Scheduler scheduler(halMicros);
+    AdcCalibration calibration;
+    calibration.build(ads1x15Millivolts, NULL);
+    SensorPipeline pipeline(source, temperatures, calibration, calibration);
+    TEST_ASSERT_TRUE(pipeline.addProbes(layout));
+    TEST_ASSERT_EQUAL_UINT8(N - 2, pipeline.probeCount());
+    TEST_ASSERT_TRUE(source.begin(pins.pin, N, 250));
+    temperatures.begin(halMicros());
+    uint32_t per_channel_hz = source.dataRate() * devices / N;
+    TEST_ASSERT_GREATER_THAN(0, per_channel_hz);
+    pipeline.begin(scheduler, layoutSink, 1000000UL * ADC_BLOCK_SIZE / per_channel_hz, 10000000UL);
+
+    while ((int32_t)(LAYOUT_TEST_SECONDS * 1000000UL - fake_now_us) > 0)
+    {
+        uint32_t until_us = fake_now_us + scheduler.runOnce();
+        uint8_t device;
+        uint32_t at;
+        while ((at = mock.nextAlert(device)) != UINT32_MAX && (int32_t)(at - until_us) <= 0)
+        {
+            if ((int32_t)(at - fake_now_us) > 0)
+                fake_now_us = at;
+            mock.takeAlert(device);
+            if (source.ready(device))
+                source.service(fake_now_us);
+        }
+        if ((int32_t)(until_us - fake_now_us) > 0)
+            fake_now_us = until_us;
+    }
+    layoutAssertReported(layout.channels, N);
+}
+
+static void test_layout_firmware_layouts_pass_every_check()
+{
+    TEST_ASSERT_TRUE(layoutValid(LAYOUT_GPIO, false, 0));
+    TEST_ASSERT_TRUE(layoutValid(LAYOUT_GPIO_WIFI, true, 0));
+    TEST_ASSERT_TRUE(layoutValid(LAYOUT_ADS_PAIR, true, 1));
+    TEST_ASSERT_TRUE(layoutValid(LAYOUT_ADS_8, true, 2));
+    TEST_ASSERT_TRUE(layoutValid(LAYOUT_ADS_16, true, 4));
+}
+
+static void test_layout_broken_layouts_fail_their_check()
+{
+    // pH on ADC2 with WiFi
+    TEST_ASSERT_FALSE(layoutFitsWifi(LAYOUT_GPIO, true));
+    TEST_ASSERT_FALSE(layoutPinsValid(BROKEN_SHARED, 0));
+    // GPIO5 is no ADC input
+    TEST_ASSERT_FALSE(layoutPinsValid(BROKEN_NO_ADC, 0));
+    // More GPIO probes than the on-chip source samples
+    TEST_ASSERT_FALSE(layoutPinsValid(BROKEN_GPIO_COUNT, 0));
+    // 9 probes on 8 chain inputs, more devices than addresses
+    TEST_ASSERT_FALSE(layoutPinsValid(BROKEN_CHAIN, 2));
+    TEST_ASSERT_FALSE(layoutPinsValid(LAYOUT_ADS_16, ADS1X15_MAX_DEVICES + 1));
+    // pH before TDS, mixed sources, more extra probes than the pipeline holds
+    TEST_ASSERT_FALSE(layoutFitsPipeline(BROKEN_SWAPPED, PIPELINE_MAX_PROBES));
+    TEST_ASSERT_FALSE(layoutFitsPipeline(BROKEN_MIXED, PIPELINE_MAX_PROBES));
+    TEST_ASSERT_FALSE(layoutFitsPipeline(LAYOUT_ADS_16, 13));
+    TEST_ASSERT_FALSE(layoutLeavesFree(BROKEN_ONEWIRE, LAYOUT_TEST_ONEWIRE_PIN));
+
+    // Each one passes the checks that are not about it
+    TEST_ASSERT_TRUE(layoutFitsPipeline(BROKEN_SHARED, PIPELINE_MAX_PROBES));
+    TEST_ASSERT_TRUE(layoutPinsValid(BROKEN_SWAPPED, 0));
+    TEST_ASSERT_TRUE(layoutPinsValid(BROKEN_ONEWIRE, 0));
+    TEST_ASSERT_TRUE(layoutFitsWifi(BROKEN_NO_ADC, true));
+}
+
+static void test_layout_chain_goes_round_the_devices()
+{
+    // TDS, pH, the extra pH probes, then TDS; consecutive channels on consecutive devices
+    const PipelineLayout<8>::Pins pins = LAYOUT_ADS_8.pins();
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        TEST_ASSERT_EQUAL_UINT8(ADS1X15_INPUT(i % 2, i / 2), pins.pin[i]);
+        TEST_ASSERT_EQUAL(SOURCE_ADS1X15, LAYOUT_ADS_8.channels[i].source);
+        TEST_ASSERT_EQUAL(i == 0 || i >= 5 ? READING_TDS : READING_PH, LAYOUT_ADS_8.channels[i].kind);
+    }
+}
+
+static void test_layout_filter_specs_are_the_pipeline_filters()
+{
+    TEST_ASSERT_TRUE((std::is_same<ChannelFilter<PIPELINE_TDS_FILTER>, RollingMedian<int, SCOUNT>>::value));
+    TEST_ASSERT_TRUE((std::is_same<ChannelFilter<PIPELINE_PH_FILTER>, RollingTrimmedMean<int, ADC_BLOCK_SIZE, ADC_BLOCK_SIZE / 5>>::value));
+}
+
+static void test_layout_gpio_pair_reports()
+{
+    runGpio(LAYOUT_GPIO);
+}
+
+static void test_layout_gpio_pair_for_wifi_reports()
+{
+    runGpio(LAYOUT_GPIO_WIFI);
+}
+
+static void test_layout_chain_pair_reports()
+{
+    runChain(LAYOUT_ADS_PAIR, 1);
+}
+
+static void test_layout_two_device_chain_reports_alike()
+{
+    runChain(LAYOUT_ADS_8, 2);
+}
+
+static void test_layout_four_device_chain_reports_alike()
+{
+    runChain(LAYOUT_ADS_16, 4);
+}
+
+void runLayoutTests()
+{
+    RUN_TEST(test_layout_firmware_layouts_pass_every_check);
+    RUN_TEST(test_layout_broken_layouts_fail_their_check);
+    RUN_TEST(test_layout_chain_goes_round_the_devices);
+    RUN_TEST(test_layout_filter_specs_are_the_pipeline_filters);
+    RUN_TEST(test_layout_gpio_pair_reports);
+    RUN_TEST(test_layout_gpio_pair_for_wifi_reports);
+    RUN_TEST(test_layout_chain_pair_reports);
+    RUN_TEST(test_layout_two_device_chain_reports_alike);
+    RUN_TEST(test_layout_four_device_chain_reports_alike);
+}
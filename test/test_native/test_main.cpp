@@ -0,0 +1,34 @@
+#include <unity.h>
+#include "TestSuites.h"
+
+void setUp() {}
+
+void tearDown() {}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    runSchedulerTests();
+    runHalTests();
+    runPipelineTests();
+    runAdcCalibrationTests();
+    runTelemetryTests();
+    runSensorMathTests();
+    runSensorStateTests();
+    runFlashLogTests();
+    runDutyCycleTests();
+    runCollectorTests();
+    runCalibrationTests();
+    runProfilerTests();
+    runSensorHealthTests();
+    runAdaptiveRateTests();
+    runSeriesTests();
+    runMqttTests();
+    runAds1x15Tests();
+    runRawTraceTests();
+    runLayoutTests();
+    runDecimatorTests();
+    runFusionTests();
+    runFiltersTests();
+    return UNITY_END();
+}
@@ -0,0 +1,324 @@
+#include <unity.h>
+#include <chrono>
+#include <vector>
+#include "TestSuites.h"
+#include "MqttPublisher.h"
+#include "SocketTransport.h"
+#include "native/MqttBrokerStandIn.h"
+
+#define MQTT_TEST_POLL_MS 10       // Period of the firmware's mqtt task
+#define MQTT_TEST_HOURS 2          // Outage runs, the outage starts after the first hour
+
+static MqttConfig testConfig(uint16_t batch_records)
+{
+    MqttConfig config = {"127.0.0.1", 1883, "hydro-test", "hydro/test/telemetry", 30, batch_records, 10000, 5000, 1000, 30000};
+    return config;
+}
+
+static TelemetryRecord testRecord(uint32_t i, uint32_t now_ms)
+{
+    TelemetryRecord record;
+    record.sequence = i;
+    record.timestamp_ms = now_ms;
+    record.tds_ppm = 1100.0f + (i % 7) * 0.1f;
+    record.ph = 6.0f + (i % 5) * 0.001f;
+    record.temperature_c = 21.0f + (i % 3) * 0.0625f;
+    record.status = TELEMETRY_TDS_VALID | TELEMETRY_PH_VALID | TELEMETRY_TEMP_VALID;
+    return record;
+}
+
+// What arrived at the broker, by record index
+struct Delivery
+{
+    std::vector<uint8_t> seen;
+    uint32_t unique = 0;
+};
+
+static void deliveryHook(const TelemetryRecord &record, bool duplicate, void *context)
+{
+    Delivery &delivery = *(Delivery *)context;
+    if (record.sequence < delivery.seen.size() && delivery.seen[record.sequence]++ == 0)
+        delivery.unique++;
+}
+
+static void test_mqtt_batch_seals_at_count_age_and_full_block()
+{
+    BrokerStats broker = {};
+    BrokerSession session(broker, NULL, NULL);
+    LoopbackTransport transport(session);
+
+    // Enough records
+    MqttPublisher by_count(transport, testConfig(10));
+    for (uint32_t i = 0; i < 9; i++)
+        by_count.add(testRecord(i, i * 1000), i * 1000);
+    TEST_ASSERT_EQUAL_UINT32(0, by_count.stats().messages);
+    by_count.add(testRecord(9, 9000), 9000);
+    TEST_ASSERT_EQUAL_UINT32(1, by_count.stats().messages);
+    TEST_ASSERT_EQUAL_UINT16(0, by_count.batched());
+
+    // The oldest record waited long enough
+    MqttPublisher by_age(transport, testConfig(60));
+    by_age.add(testRecord(0, 0), 0);
+    by_age.poll(9990);
+    TEST_ASSERT_EQUAL_UINT32(0, by_age.stats().messages);
+    by_age.poll(10000);
+    TEST_ASSERT_EQUAL_UINT32(1, by_age.stats().messages);
+
+    // The block is full, the record that did not fit opens the next one
+    MqttPublisher by_size(transport, testConfig(1000));
+    uint32_t state = 1;
+    uint32_t added = 0;
+    while (by_size.stats().messages == 0)
+    {
+        TelemetryRecord record = testRecord(added, added * 1000);
+        state = state * 1103515245UL + 12345;
+        record.tds_ppm = (state >> 8) % 100000 / 10.0f;
+        by_size.add(record, added * 1000);
+        added++;
+    }
+    TEST_ASSERT_LESS_THAN(1000, added);
+    TEST_ASSERT_EQUAL_UINT16(1, by_size.batched());
+}
+
+static void test_mqtt_every_record_arrives_at_every_batch_size()
+{
+    const uint16_t batches[] = {1, 10, 60};
+    for (uint16_t batch : batches)
+    {
+        const uint32_t records = 20000;
+        Delivery delivery;
+        delivery.seen.assign(records, 0);
+        BrokerStats broker = {};
+        BrokerSession session(broker, deliveryHook, &delivery);
+        LoopbackTransport transport(session);
+        MqttPublisher publisher(transport, testConfig(batch));
+        for (uint32_t i = 0; i < records; i++)
+        {
+            publisher.add(testRecord(i, i), 0);
+            publisher.poll(0);
+        }
+        publisher.flush();
+        for (uint32_t polls = 0; publisher.queued() > 0 && polls < 100000; polls++)
+            publisher.poll(0);
+
+        const MqttStats &stats = publisher.stats();
+        TEST_ASSERT_EQUAL_UINT32(records, delivery.unique);
+        TEST_ASSERT_EQUAL_UINT64(records, broker.records);
+        TEST_ASSERT_EQUAL_UINT64(0, broker.bad_payloads);
+        TEST_ASSERT_EQUAL_UINT32(0, stats.dropped);
+        TEST_ASSERT_EQUAL_UINT32(stats.messages, stats.published);
+        TEST_ASSERT_EQUAL_UINT32(1, stats.connects);
+    }
+}
+
+// One outage in the middle of the run
+enum Outage
+{
+    OUTAGE_DROPPED,  // Connection reset, connects refused
+    OUTAGE_SILENT,   // Nothing gets through and nothing tells, only the keepalive notices
+};
+
+struct OutageRun
+{
+    Delivery delivery;
+    BrokerStats broker;
+    MqttStats stats;
+    uint16_t queue_in_outage;   // Deepest the queue got during the outage
+    uint32_t missing;
+    uint32_t first_missing;
+    uint32_t last_missing;
+};
+
+#define OUTAGE_RECORDS (MQTT_TEST_HOURS * 3600UL)
+#define OUTAGE_FROM_MS 3600000UL
+
+// One record a second on the fake clock over a link of about 100 kbit/s
+static void runOutage(Outage kind, uint32_t outage_s, OutageRun &run)
+{
+    const uint32_t outage_to_ms = OUTAGE_FROM_MS + outage_s * 1000UL;
+    run.delivery.seen.assign(OUTAGE_RECORDS, 0);
+    run.broker = BrokerStats();
+    run.queue_in_outage = 0;
+    BrokerSession session(run.broker, deliveryHook, &run.delivery);
+    LoopbackTransport transport(session);
+    transport.setConnectPolls(2);
+    MqttPublisher publisher(transport, testConfig(10));
+
+    uint32_t added = 0;
+    for (uint32_t now_ms = 0; added < OUTAGE_RECORDS || publisher.queued() > 0 || publisher.batched() > 0;
+         now_ms += MQTT_TEST_POLL_MS)
+    {
+        if (now_ms == OUTAGE_FROM_MS)
+        {
+            if (kind == OUTAGE_DROPPED)
+                transport.setReachable(false);
+            else
+            {
+                session.silent = true;
+                transport.setConnectPolls(UINT32_MAX);
+            }
+        }
+        if (now_ms == outage_to_ms)
+        {
+            transport.setReachable(true);
+            session.silent = false;
+            transport.setConnectPolls(2);
+        }
+        if (now_ms % 1000 == 0 && added < OUTAGE_RECORDS)
+            publisher.add(testRecord(added++, now_ms), now_ms);
+        if (added == OUTAGE_RECORDS)
+            publisher.flush();
+
+        transport.setBudget(125);
+        publisher.poll(now_ms);
+        if (now_ms >= OUTAGE_FROM_MS && now_ms < outage_to_ms && publisher.queued() > run.queue_in_outage)
+            run.queue_in_outage = publisher.queued();
+        TEST_ASSERT_LESS_THAN_UINT32((MQTT_TEST_HOURS + 1) * 3600000UL, now_ms);
+    }
+    run.stats = publisher.stats();
+
+    run.missing = 0;
+    run.first_missing = OUTAGE_RECORDS;
+    run.last_missing = 0;
+    for (uint32_t i = 0; i < OUTAGE_RECORDS; i++)
+    {
+        if (run.delivery.seen[i])
+            continue;
+        run.missing++;
+        if (i < run.first_missing)
+            run.first_missing = i;
+        run.last_missing = i;
+    }
+    TEST_ASSERT_EQUAL_UINT64(0, run.broker.bad_payloads);
+    TEST_ASSERT_EQUAL_UINT32(OUTAGE_RECORDS, run.delivery.unique + run.missing);
+
+    // Every message sent again arrives flagged as a duplicate
+    TEST_ASSERT_EQUAL_UINT64(run.stats.resent, run.broker.duplicates);
+}
+
+static void test_mqtt_dropped_link_replays_the_queue()
+{
+    static OutageRun run;
+    runOutage(OUTAGE_DROPPED, 60, run);
+    TEST_ASSERT_EQUAL_UINT32(0, run.missing);
+    TEST_ASSERT_EQUAL_UINT32(0, run.stats.dropped);
+    TEST_ASSERT_GREATER_THAN(0, run.stats.failures);
+    TEST_ASSERT_EQUAL_UINT32(2, run.stats.connects);
+
+    // The queue held the minute of records, a message per ten of them
+    TEST_ASSERT_GREATER_OR_EQUAL(5, run.queue_in_outage);
+    TEST_ASSERT_LESS_THAN(MQTT_QUEUE_MESSAGES, run.queue_in_outage);
+}
+
+static void test_mqtt_silent_link_is_noticed_by_the_keepalive()
+{
+    static OutageRun run;
+    runOutage(OUTAGE_SILENT, 300, run);
+    TEST_ASSERT_EQUAL_UINT32(0, run.missing);
+    TEST_ASSERT_EQUAL_UINT32(0, run.stats.dropped);
+    TEST_ASSERT_GREATER_THAN(0, run.stats.failures);
+
+    // What went out into the silence goes out again
+    TEST_ASSERT_GREATER_THAN(0, run.stats.resent);
+}
+
+static void test_mqtt_long_outage_drops_only_the_oldest()
+{
+    static OutageRun run;
+    runOutage(OUTAGE_DROPPED, 1800, run);
+    TEST_ASSERT_EQUAL_UINT16(MQTT_QUEUE_MESSAGES, run.queue_in_outage);
+    TEST_ASSERT_EQUAL_UINT16(MQTT_QUEUE_MESSAGES, run.stats.queue_max);
+    TEST_ASSERT_GREATER_THAN(0, run.missing);
+    TEST_ASSERT_EQUAL_UINT32(run.stats.dropped_records, run.missing);
+
+    // One run of records from the start of the outage, the newest of it survived
+    TEST_ASSERT_EQUAL_UINT32(run.missing, run.last_missing - run.first_missing + 1);
+    TEST_ASSERT_GREATER_OR_EQUAL(OUTAGE_FROM_MS / 1000 - 10, run.first_missing);
+    TEST_ASSERT_LESS_THAN((OUTAGE_FROM_MS / 1000) + 1800, run.last_missing);
+}
+
+static void test_mqtt_reconnect_delay_doubles_up_to_the_limit()
+{
+    BrokerStats broker = {};
+    BrokerSession session(broker, NULL, NULL);
+    LoopbackTransport transport(session);
+    transport.setReachable(false);
+    MqttPublisher publisher(transport, testConfig(10));
+
+    // The first attempt at once, then 1, 2, 4, 8, 16 and 30 s apart
+    std::vector<uint32_t> attempts_ms;
+    for (uint32_t now_ms = 0; now_ms < 180000; now_ms += MQTT_TEST_POLL_MS)
+    {
+        uint32_t before = transport.connects;
+        publisher.poll(now_ms);
+        if (transport.connects != before)
+            attempts_ms.push_back(now_ms);
+    }
+    const uint32_t gaps_ms[] = {1000, 2000, 4000, 8000, 16000, 30000, 30000};
+    TEST_ASSERT_EQUAL_UINT32(0, attempts_ms[0]);
+    TEST_ASSERT_GREATER_THAN(sizeof(gaps_ms) / sizeof(gaps_ms[0]), attempts_ms.size());
+    for (uint8_t i = 0; i < sizeof(gaps_ms) / sizeof(gaps_ms[0]); i++)
+        TEST_ASSERT_EQUAL_UINT32(gaps_ms[i], attempts_ms[i + 1] - attempts_ms[i]);
+    TEST_ASSERT_EQUAL_UINT32(attempts_ms.size(), publisher.stats().failures);
+
+    // A session resets the delay
+    transport.setReachable(true);
+    for (uint32_t now_ms = 180000; now_ms < 240000 && publisher.state() != MQTT_CONNECTED; now_ms += MQTT_TEST_POLL_MS)
+        publisher.poll(now_ms);
+    TEST_ASSERT_EQUAL_UINT8(MQTT_CONNECTED, publisher.state());
+    transport.setReachable(false);
+    publisher.poll(240000);
+    uint32_t failed = transport.connects;
+    publisher.poll(240990);
+    TEST_ASSERT_EQUAL_UINT32(failed, transport.connects);
+    transport.setReachable(true);
+    publisher.poll(241000);
+    TEST_ASSERT_EQUAL_UINT32(failed + 1, transport.connects);
+}
+
+static void test_mqtt_over_localhost_tcp()
+{
+    const uint32_t records = 5000;
+    Delivery delivery;
+    delivery.seen.assign(records, 0);
+    TcpBrokerStandIn broker(deliveryHook, &delivery);
+    uint16_t port = broker.start();
+    if (port == 0)
+        TEST_IGNORE();
+    MqttConfig config = testConfig(10);
+    config.port = port;
+    SocketTransport transport;
+    MqttPublisher publisher(transport, config);
+
+    // On the host clock, records are only held back while half the queue waits for the broker
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint32_t added = 0;
+    uint32_t now_ms = 0;
+    while ((added < records || publisher.queued() > 0) && now_ms < 60000)
+    {
+        now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        if (added < records && publisher.queued() < MQTT_QUEUE_MESSAGES / 2)
+        {
+            publisher.add(testRecord(added, now_ms), now_ms);
+            if (++added == records)
+                publisher.flush();
+        }
+        publisher.poll(now_ms);
+    }
+    transport.close();
+    broker.stop();
+    TEST_ASSERT_EQUAL_UINT32(records, delivery.unique);
+    TEST_ASSERT_EQUAL_UINT64(0, broker.stats().bad_payloads);
+    TEST_ASSERT_EQUAL_UINT32(0, publisher.stats().dropped);
+}
+
+void runMqttTests()
+{
+    RUN_TEST(test_mqtt_batch_seals_at_count_age_and_full_block);
+    RUN_TEST(test_mqtt_every_record_arrives_at_every_batch_size);
+    RUN_TEST(test_mqtt_dropped_link_replays_the_queue);
+    RUN_TEST(test_mqtt_silent_link_is_noticed_by_the_keepalive);
+    RUN_TEST(test_mqtt_long_outage_drops_only_the_oldest);
+    RUN_TEST(test_mqtt_reconnect_delay_doubles_up_to_the_limit);
+    RUN_TEST(test_mqtt_over_localhost_tcp);
+}
@@ -0,0 +1,133 @@
+#include <unity.h>
+#include "TestSuites.h"
+#include "PipelineRig.h"
+#include "Calibration.h"
+#include "DosingController.h"
+#include "Hal.h"
+
+#define PIPELINE_PH_RAW 3300
+#define PIPELINE_TDS_RAW 1807
+#define PIPELINE_CELSIUS 21.5f
+
+static uint16_t pipeline_spike;  // Added to every 16th pH sample
+
+static uint16_t steadySignal(uint8_t pin, uint32_t time_us)
+{
+    if (pin != RIG_PIN_PH)
+        return PIPELINE_TDS_RAW;
+    return PIPELINE_PH_RAW + ((time_us / 4000) % 16 == 0 ? pipeline_spike : 0);
+}
+
+// The float reference of the default probe line and cubic, compensated at a temperature
+static float referencePh(const PipelineRig &rig)
+{
+    CalibrationCoefficients defaults;
+    calibrationDefaults(defaults);
+    return calibrationPh(defaults, rig.ph_calibration.millivolts(PIPELINE_PH_RAW) / 1000.0f);
+}
+
+static float referenceTdsPpm(const PipelineRig &rig, float celsius)
+{
+    float volts = rig.tds_calibration.millivolts(PIPELINE_TDS_RAW) / 1000.0f / (1.0f + (celsius - 25.0f) / 50.0f);
+    return (133.42f * volts * volts * volts - 255.86f * volts * volts + 857.39f * volts) * 0.5f;
+}
+
+static void test_pipeline_publishes_every_channel()
+{
+    pipeline_spike = 0;
+    PipelineRig rig(steadySignal, PIPELINE_CELSIUS);
+    rig.begin();
+    rig.run(10000);
+
+    // pH once per block, temperature once a second. TDS and EC with every new voltage or temperature, unchanged or not
+    TEST_ASSERT_GREATER_OR_EQUAL(70, rig_channels[READING_PH].count);
+    TEST_ASSERT_GREATER_OR_EQUAL(8, rig_channels[READING_TDS].count);
+    TEST_ASSERT_GREATER_OR_EQUAL(8, rig_channels[READING_TEMPERATURE].count);
+    TEST_ASSERT_EQUAL_UINT32(rig_channels[READING_TDS].count, rig_channels[READING_EC].count);
+
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, referencePh(rig), rig_channels[READING_PH].value);
+    TEST_ASSERT_FLOAT_WITHIN(1.0f, referenceTdsPpm(rig, PIPELINE_CELSIUS), rig_channels[READING_TDS].value);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, rig_channels[READING_TDS].value / TDS_EC_FACTOR, rig_channels[READING_EC].value);
+    TEST_ASSERT_FLOAT_WITHIN(0.07f, PIPELINE_CELSIUS, rig_channels[READING_TEMPERATURE].value);
+    for (uint8_t channel = 0; channel <= READING_EC; channel++)
+        TEST_ASSERT_EQUAL(QUALITY_GOOD, rig_channels[channel].quality);
+    TEST_ASSERT_EQUAL_UINT32(0, rig.adc.overflows());
+    TEST_ASSERT_EQUAL_UINT32(0, rig.bus.early_reads);
+}
+
+static void test_pipeline_compensates_tds_with_the_live_temperature()
+{
+    pipeline_spike = 0;
+    PipelineRig rig(steadySignal, PIPELINE_CELSIUS);
+    rig.begin();
+    rig.run(5000);
+    float before = rig_channels[READING_TDS].value;
+
+    // Same probe voltage in warmer water reads as less TDS
+    rig.bus.setTemperature(0, 29.0f);
+    rig.run(5000);
+    TEST_ASSERT_FLOAT_WITHIN(1.0f, referenceTdsPpm(rig, 29.0f), rig_channels[READING_TDS].value);
+    TEST_ASSERT_LESS_THAN_FLOAT(before, rig_channels[READING_TDS].value);
+}
+
+static void test_pipeline_trimmed_mean_rejects_spikes()
+{
+    pipeline_spike = 700;
+    PipelineRig rig(steadySignal, PIPELINE_CELSIUS);
+    rig.begin();
+    rig.run(5000);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, referencePh(rig), rig_channels[READING_PH].value);
+}
+
+static void test_pipeline_keeps_up_at_a_lower_rate()
+{
+    // A quarter of the base rate: a block every 512 ms, still one pH per block and nothing lost
+    pipeline_spike = 0;
+    PipelineRig rig(steadySignal, PIPELINE_CELSIUS);
+    rig.begin(RIG_ADC_RATE_HZ / 4);
+    rig.run(10000);
+    TEST_ASSERT_GREATER_OR_EQUAL(18, rig_channels[READING_PH].count);
+    TEST_ASSERT_LESS_OR_EQUAL(20, rig_channels[READING_PH].count);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, referencePh(rig), rig_channels[READING_PH].value);
+    TEST_ASSERT_EQUAL_UINT32(0, rig.adc.overflows());
+}
+
+static void test_pipeline_steady_tds_keeps_dosing_fresh()
+{
+    // A reservoir at the setpoint reads the same TDS over and over, the controller must keep seeing it
+    pipeline_spike = 0;
+    PipelineRig rig(steadySignal, PIPELINE_CELSIUS);
+    rig.begin();
+    rig.run(2000);
+    DosingConfig config = {
+        rig_channels[READING_TDS].value, 10.0f,
+        0.6f, 0.002f, 0.0f, 0.0f,
+        3.3f,
+        20.0f, 300.0f, 1.0f,
+        1000, 600000, 5000, true,
+    };
+    DosingController dosing(config);
+    dosing.enable(true);
+
+    // The way the drain task feeds it: every good TDS it finds, every 100 ms
+    uint32_t seen = rig_channels[READING_TDS].count;
+    for (uint32_t ms = 0; ms < 4 * config.max_age_ms; ms += 100)
+    {
+        rig.run(100);
+        if (rig_channels[READING_TDS].count != seen && rig_channels[READING_TDS].quality == QUALITY_GOOD)
+            dosing.measure(rig_channels[READING_TDS].value, halMillis());
+        seen = rig_channels[READING_TDS].count;
+        TEST_ASSERT_FALSE(dosing.tick(halMillis()));
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, dosing.stats().stale);
+    TEST_ASSERT_GREATER_OR_EQUAL(19, dosing.stats().evaluations);
+}
+
+void runPipelineTests()
+{
+    RUN_TEST(test_pipeline_publishes_every_channel);
+    RUN_TEST(test_pipeline_compensates_tds_with_the_live_temperature);
+    RUN_TEST(test_pipeline_trimmed_mean_rejects_spikes);
+    RUN_TEST(test_pipeline_keeps_up_at_a_lower_rate);
+    RUN_TEST(test_pipeline_steady_tds_keeps_dosing_fresh);
+}
@@ -0,0 +1,147 @@
+#include <unity.h>
+#include <stdlib.h>
+#include <string.h>
+#include "TestSuites.h"
+#include "Profiler.h"
+
+#if PROFILING
+
+// Durations recorded for the percentile test
+#define PROFILE_TEST_SAMPLES 100000
+
+// Stages link themselves into the global list, so they live at namespace scope like the firmware's
+PROFILE_STAGE(test_percentiles, "percentile");
+PROFILE_STAGE(test_reset, "reset");
+PROFILE_STAGE(test_scope, "scope");
+
+static uint32_t nextRandom(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static int compareDurations(const void *a, const void *b)
+{
+    uint32_t left = *static_cast<const uint32_t *>(a), right = *static_cast<const uint32_t *>(b);
+    return left < right ? -1 : left > right;
+}
+
+static void test_profile_bucket_edges_enclose_every_duration()
+{
+    // Every small duration, then random ones over all magnitudes
+    uint32_t seed = 0xb0c4e7;
+    for (uint32_t i = 0; i < 1000000; i++)
+    {
+        uint32_t cycles = i < 70000 ? i : nextRandom(seed) >> (nextRandom(seed) % 32);
+        uint8_t index = ProfileStage::bucket(cycles);
+        TEST_ASSERT_LESS_THAN(PROFILE_BUCKETS, index);
+        if (index < PROFILE_BUCKETS - 1)
+            TEST_ASSERT_LESS_THAN(ProfileStage::bucketEnd(index), cycles);
+        if (index > 0)
+            TEST_ASSERT_GREATER_OR_EQUAL(ProfileStage::bucketEnd(index - 1), cycles);
+    }
+    TEST_ASSERT_EQUAL_UINT8(PROFILE_BUCKETS - 1, ProfileStage::bucket(UINT32_MAX));
+}
+
+static void test_profile_buckets_are_a_quarter_octave_wide()
+{
+    // Exact below 8, then four buckets per power of two
+    for (uint8_t index = 0; index < 2 * PROFILE_SUB_BUCKETS; index++)
+        TEST_ASSERT_EQUAL_UINT32(index + 1, ProfileStage::bucketEnd(index));
+    for (uint8_t index = 2 * PROFILE_SUB_BUCKETS; index < PROFILE_BUCKETS - 1; index++)
+    {
+        uint32_t start = ProfileStage::bucketEnd(index - 1), width = ProfileStage::bucketEnd(index) - start;
+        TEST_ASSERT_LESS_OR_EQUAL(start / 4, width);
+    }
+}
+
+static void test_profile_percentiles_within_a_bucket_of_exact()
+{
+    static uint32_t durations[PROFILE_TEST_SAMPLES];
+    uint32_t seed = 0x51ac;
+    for (uint32_t i = 0; i < PROFILE_TEST_SAMPLES; i++)
+    {
+        // Log-uniform over 2^5 to 2^20 cycles with a few long outliers, like a stage that sometimes waits
+        uint32_t octave = 5 + nextRandom(seed) % 15;
+        uint32_t cycles = (1UL << octave) + nextRandom(seed) % (1UL << octave);
+        if (nextRandom(seed) % 200 == 0)
+            cycles *= 40;
+        durations[i] = cycles;
+        test_percentiles.record(cycles);
+    }
+    qsort(durations, PROFILE_TEST_SAMPLES, sizeof(durations[0]), compareDurations);
+
+    TEST_ASSERT_EQUAL_UINT32(PROFILE_TEST_SAMPLES, test_percentiles.count());
+    TEST_ASSERT_EQUAL_UINT32(durations[PROFILE_TEST_SAMPLES - 1], test_percentiles.maximum());
+
+    // Never below the exact percentile and at most one bucket (25 %) above
+    const uint8_t percents[] = {1, 50, 90, 99, 100};
+    for (uint8_t percent : percents)
+    {
+        uint32_t exact = durations[(PROFILE_TEST_SAMPLES * (uint32_t)percent + 99) / 100 - 1];
+        uint32_t estimate = test_percentiles.percentile(percent);
+        TEST_ASSERT_GREATER_OR_EQUAL(exact, estimate);
+        TEST_ASSERT_LESS_OR_EQUAL(exact + exact / 4 + 1, estimate);
+    }
+    TEST_ASSERT_EQUAL_UINT32(test_percentiles.maximum(), test_percentiles.percentile(100));
+}
+
+static void test_profile_reset_clears_on_the_next_record()
+{
+    TEST_ASSERT_EQUAL_UINT32(0, test_reset.percentile(50));
+    test_reset.record(1000);
+    test_reset.record(3000);
+    TEST_ASSERT_EQUAL_UINT32(2, test_reset.count());
+    TEST_ASSERT_EQUAL_UINT32(4000, (uint32_t)test_reset.sum());
+
+    // The recording task clears it, the stage keeps its numbers until then
+    test_reset.reset();
+    TEST_ASSERT_EQUAL_UINT32(2, test_reset.count());
+    test_reset.record(20);
+    TEST_ASSERT_EQUAL_UINT32(1, test_reset.count());
+    TEST_ASSERT_EQUAL_UINT32(20, test_reset.maximum());
+    TEST_ASSERT_EQUAL_UINT32(20, test_reset.percentile(99));
+}
+
+static void test_profile_stages_list_in_construction_order()
+{
+    ProfileStage *stage = ProfileStage::first();
+    while (stage != NULL && stage != &test_percentiles)
+        stage = stage->next();
+    TEST_ASSERT_TRUE(stage == &test_percentiles);
+    TEST_ASSERT_TRUE(stage->next() == &test_reset);
+    TEST_ASSERT_TRUE(stage->next()->next() == &test_scope);
+}
+
+static void test_profile_scope_records_once()
+{
+    {
+        PROFILE_SCOPE(test_scope);
+        TEST_ASSERT_EQUAL_UINT32(0, test_scope.count());
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, test_scope.count());
+
+    char line[120];
+    size_t length = profileFormat(test_scope, line, sizeof(line));
+    TEST_ASSERT_EQUAL_size_t(strlen(line), length);
+    TEST_ASSERT_TRUE(strncmp(line, "scope ", 6) == 0);
+    TEST_ASSERT_NOT_NULL(strstr(line, "runs        1"));
+}
+
+void runProfilerTests()
+{
+    RUN_TEST(test_profile_bucket_edges_enclose_every_duration);
+    RUN_TEST(test_profile_buckets_are_a_quarter_octave_wide);
+    RUN_TEST(test_profile_percentiles_within_a_bucket_of_exact);
+    RUN_TEST(test_profile_reset_clears_on_the_next_record);
+    RUN_TEST(test_profile_stages_list_in_construction_order);
+    RUN_TEST(test_profile_scope_records_once);
+}
+
+#else
+
+void runProfilerTests() {}
+
+#endif
@@ -0,0 +1,398 @@
+#include <unity.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include "TestSuites.h"
+#include "RawTrace.h"
+#include "Telemetry.h"
+#include "Hal.h"
+#include "PipelineRig.h"
+#include "native/FakeClock.h"
+#include "native/ReferenceAdcCurve.h"
+#include "native/TraceReplay.h"
+
+static uint32_t nextRandom(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Events of every kind, blocks of noise with the odd jump across the whole range
+static std::vector<RawTraceEvent> randomEvents(uint32_t seed, uint32_t count)
+{
+    std::vector<RawTraceEvent> events;
+    uint32_t state = seed;
+    uint32_t time_us = 0xFFFFFFFFUL - 5000000UL; // The clock wraps on the way
+    for (uint32_t i = 0; i < count; i++)
+    {
+        RawTraceEvent event;
+        memset(&event, 0, sizeof(event));
+        event.type = (RawTraceEventType)(nextRandom(state) % 4);
+        event.channel = nextRandom(state) % 16;
+        time_us += nextRandom(state) % 300000;
+        if (nextRandom(state) % 10 == 0)
+            time_us -= nextRandom(state) % 1000; // References are stamped before the block they go out with
+        event.time_us = time_us;
+        switch (event.type)
+        {
+        case TRACE_ADC_BLOCK:
+        {
+            event.block.timestamp_us = time_us;
+            event.block.count = 1 + nextRandom(state) % ADC_BLOCK_SIZE;
+            uint16_t level = nextRandom(state) % (ADC_RAW_MAX + 1);
+            for (uint16_t s = 0; s < event.block.count; s++)
+            {
+                bool jump = nextRandom(state) % 20 == 0;
+                int32_t sample = jump ? nextRandom(state) % (ADC_RAW_MAX + 1) : level + (int32_t)(nextRandom(state) % 9) - 4;
+                event.block.samples[s] = sample < 0 ? 0 : sample > ADC_RAW_MAX ? ADC_RAW_MAX : sample;
+            }
+            break;
+        }
+        case TRACE_TEMPERATURE:
+            event.value = ((int32_t)(nextRandom(state) % 2800) - 880) / 16.0f; // -55 to 120 C in DS18B20 steps
+            break;
+        case TRACE_TEMPERATURE_MISSING:
+            break;
+        case TRACE_REFERENCE:
+            event.value = (nextRandom(state) % 1000000) / 997.0f;
+            break;
+        }
+        events.push_back(event);
+    }
+    return events;
+}
+
+static void assertSameEvent(const RawTraceEvent &expected, const RawTraceEvent &actual)
+{
+    TEST_ASSERT_EQUAL_UINT8(expected.type, actual.type);
+    TEST_ASSERT_EQUAL_UINT8(expected.channel, actual.channel);
+    TEST_ASSERT_EQUAL_UINT32(expected.time_us, actual.time_us);
+    if (expected.type == TRACE_ADC_BLOCK)
+    {
+        TEST_ASSERT_EQUAL_UINT32(expected.block.timestamp_us, actual.block.timestamp_us);
+        TEST_ASSERT_EQUAL_UINT16(expected.block.count, actual.block.count);
+        TEST_ASSERT_EQUAL_MEMORY(expected.block.samples, actual.block.samples, expected.block.count * sizeof(uint16_t));
+    }
+    else if (expected.type != TRACE_TEMPERATURE_MISSING)
+        TEST_ASSERT_FLOAT_WITHIN(0.0f, expected.value, actual.value);
+}
+
+static void test_trace_chunks_round_trip_every_event()
+{
+    std::vector<RawTraceEvent> events = randomEvents(0x7ace, 20000);
+    uint8_t chunk[TELEMETRY_BATCH_MAX], again[TELEMETRY_BATCH_MAX];
+    RawTraceEncoder encoder;
+    size_t index = 0;
+    while (index < events.size())
+    {
+        encoder.begin(chunk, sizeof(chunk));
+        size_t first = index;
+        while (index < events.size() && encoder.append(events[index]))
+            index++;
+        TEST_ASSERT_GREATER_THAN(0, encoder.count());
+        TEST_ASSERT_EQUAL_UINT32(events[first].time_us, encoder.firstUs());
+
+        // Every event comes back, and encodes to the same bytes again
+        RawTraceDecoder decoder(chunk, encoder.size(), encoder.count());
+        RawTraceEncoder reencoder;
+        reencoder.begin(again, sizeof(again));
+        RawTraceEvent event;
+        for (size_t i = first; i < index; i++)
+        {
+            TEST_ASSERT_TRUE(decoder.next(event));
+            assertSameEvent(events[i], event);
+            TEST_ASSERT_TRUE(reencoder.append(event));
+        }
+        TEST_ASSERT_FALSE(decoder.next(event));
+        TEST_ASSERT_EQUAL_UINT16(0, decoder.remaining());
+        TEST_ASSERT_EQUAL_size_t(encoder.size(), reencoder.size());
+        TEST_ASSERT_EQUAL_MEMORY(chunk, again, encoder.size());
+    }
+}
+
+static void test_trace_quiet_samples_cost_a_byte()
+{
+    RawTraceEvent event;
+    memset(&event, 0, sizeof(event));
+    event.type = TRACE_ADC_BLOCK;
+    event.block.count = ADC_BLOCK_SIZE;
+    for (uint16_t s = 0; s < ADC_BLOCK_SIZE; s++)
+        event.block.samples[s] = 3300 + s % 5;
+
+    // Tag, time, count, the first sample in two bytes and a byte for every other one
+    uint8_t chunk[TELEMETRY_BATCH_MAX];
+    RawTraceEncoder encoder;
+    encoder.begin(chunk, sizeof(chunk));
+    TEST_ASSERT_TRUE(encoder.append(event));
+    TEST_ASSERT_EQUAL_size_t(1 + 1 + 1 + 2 + ADC_BLOCK_SIZE - 1, encoder.size());
+}
+
+static void test_trace_event_that_does_not_fit_leaves_the_chunk()
+{
+    std::vector<RawTraceEvent> events = randomEvents(0x51, 200);
+    uint8_t chunk[64];
+    RawTraceEncoder encoder;
+    encoder.begin(chunk, sizeof(chunk));
+    size_t index = 0;
+    while (encoder.append(events[index]))
+        index++;
+    size_t size = encoder.size();
+    uint16_t count = encoder.count();
+    uint8_t before[sizeof(chunk)];
+    memcpy(before, chunk, size);
+
+    TEST_ASSERT_FALSE(encoder.append(events[index]));
+    TEST_ASSERT_EQUAL_size_t(size, encoder.size());
+    TEST_ASSERT_EQUAL_UINT16(count, encoder.count());
+    TEST_ASSERT_EQUAL_MEMORY(before, chunk, size);
+}
+
+static void test_trace_damaged_chunk_stops_the_decoder()
+{
+    std::vector<RawTraceEvent> events = randomEvents(0xda, 400);
+    uint8_t chunk[TELEMETRY_BATCH_MAX];
+    RawTraceEncoder encoder;
+    encoder.begin(chunk, sizeof(chunk));
+    for (size_t i = 0; i < events.size() && encoder.append(events[i]); i++)
+    {
+    }
+
+    // Cut short, the events before the cut come back and the rest is reported missing
+    RawTraceDecoder cut(chunk, encoder.size() / 2, encoder.count());
+    RawTraceEvent event;
+    uint16_t read = 0;
+    while (cut.next(event))
+        assertSameEvent(events[read++], event);
+    TEST_ASSERT_GREATER_THAN(0, read);
+    TEST_ASSERT_EQUAL_UINT16(encoder.count() - read, cut.remaining());
+
+    // An unknown event type
+    uint8_t bad[] = {0x50, 0x01};
+    RawTraceDecoder unknown(bad, sizeof(bad), 1);
+    TEST_ASSERT_FALSE(unknown.next(event));
+    TEST_ASSERT_EQUAL_UINT16(1, unknown.remaining());
+}
+
+static void test_trace_recorder_off_records_nothing()
+{
+    RawTraceRecorder recorder;
+    AdcBlock block = {};
+    block.count = ADC_BLOCK_SIZE;
+    recorder.block(0, block);
+    recorder.temperature(0, 21.0f, true, 0);
+    TEST_ASSERT_FALSE(recorder.reference(READING_PH, 6.5f, 0));
+    TEST_ASSERT_EQUAL_UINT32(0, recorder.events());
+    RawTraceChunk chunk;
+    TEST_ASSERT_FALSE(recorder.take(chunk));
+}
+
+static void test_trace_recorder_flushes_after_a_second()
+{
+    RawTraceRecorder recorder;
+    recorder.start();
+
+    // References go in ahead of the next read of the acquisition task
+    TEST_ASSERT_TRUE(recorder.reference(READING_PH, 6.42f, 100000));
+    const uint32_t reads_us[] = {200000, 450000, 700000, 950000, 1100000};
+    for (uint32_t time_us : reads_us)
+        recorder.temperature(0, 21.5f, time_us != 700000, time_us);
+    RawTraceChunk chunk;
+    TEST_ASSERT_FALSE(recorder.take(chunk));
+
+    // A read more than RAW_TRACE_FLUSH_US after the first event of the chunk sends it
+    recorder.temperature(0, 21.5625f, true, 1100001);
+    TEST_ASSERT_TRUE(recorder.take(chunk));
+    TEST_ASSERT_EQUAL_UINT16(6, chunk.count);
+    TEST_ASSERT_EQUAL_UINT32(7, recorder.events());
+
+    RawTraceDecoder decoder(chunk.data, chunk.length, chunk.count);
+    RawTraceEvent event;
+    TEST_ASSERT_TRUE(decoder.next(event));
+    TEST_ASSERT_EQUAL_UINT8(TRACE_REFERENCE, event.type);
+    TEST_ASSERT_EQUAL_UINT8(READING_PH, event.channel);
+    TEST_ASSERT_FLOAT_WITHIN(0.0f, 6.42f, event.value);
+    TEST_ASSERT_TRUE(decoder.next(event));
+    TEST_ASSERT_EQUAL_UINT8(TRACE_TEMPERATURE, event.type);
+    TEST_ASSERT_FLOAT_WITHIN(0.0f, 21.5f, event.value);
+    TEST_ASSERT_TRUE(decoder.next(event));
+    TEST_ASSERT_TRUE(decoder.next(event));
+    TEST_ASSERT_EQUAL_UINT8(TRACE_TEMPERATURE_MISSING, event.type);
+    TEST_ASSERT_EQUAL_UINT32(700000, event.time_us);
+
+    // After a stop the rest goes out with the next block
+    recorder.stop();
+    TEST_ASSERT_FALSE(recorder.take(chunk));
+    AdcBlock block = {};
+    recorder.block(0, block);
+    TEST_ASSERT_TRUE(recorder.take(chunk));
+    TEST_ASSERT_EQUAL_UINT16(1, chunk.count);
+    TEST_ASSERT_EQUAL_UINT32(0, recorder.dropped());
+}
+
+static void test_trace_recorder_counts_chunks_nobody_took()
+{
+    RawTraceRecorder recorder;
+    recorder.start();
+    for (uint32_t i = 0; i <= RawTraceRecorder::CHUNKS + 3; i++)
+        recorder.temperature(0, 21.0f, true, i * 2000000UL);
+    TEST_ASSERT_EQUAL_UINT32(3, recorder.dropped());
+    RawTraceChunk chunk;
+    uint8_t taken = 0;
+    while (recorder.take(chunk))
+        taken++;
+    TEST_ASSERT_EQUAL_UINT8(RawTraceRecorder::CHUNKS, taken);
+}
+
+static void test_trace_parse_skips_other_frames()
+{
+    std::vector<RawTraceEvent> events = randomEvents(0xfe, 60);
+    uint8_t chunk[TELEMETRY_BATCH_MAX];
+    RawTraceEncoder encoder;
+    encoder.begin(chunk, sizeof(chunk));
+    uint16_t count = 0;
+    while (count < events.size() && encoder.append(events[count]))
+        count++;
+
+    // A trace frame between a report frame and a line of text, then the same frame damaged
+    std::vector<uint8_t> capture;
+    uint8_t frame[TELEMETRY_BATCH_FRAME_SIZE];
+    TelemetryRecord record = {1, 1000, 1100.0f, 6.5f, 21.0f, TELEMETRY_TDS_VALID};
+    size_t length = telemetryEncode(record, frame, sizeof(frame));
+    capture.insert(capture.end(), frame, frame + length);
+    length = telemetryEncodeTrace(chunk, encoder.size(), count, frame, sizeof(frame));
+    capture.insert(capture.end(), frame, frame + length);
+    const char text[] = "capture on\r\n";
+    capture.insert(capture.end(), text, text + sizeof(text) - 1);
+    capture.push_back(0);
+    frame[length / 2] = frame[length / 2] == 0x55 ? 0x56 : 0x55;
+    capture.insert(capture.end(), frame, frame + length);
+
+    std::vector<RawTraceEvent> parsed;
+    TraceParseStats stats = traceParse(capture.data(), capture.size(), parsed);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.frames);
+    TEST_ASSERT_EQUAL_UINT32(count, stats.events);
+    TEST_ASSERT_EQUAL_UINT32(3, stats.skipped);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.damaged);
+    TEST_ASSERT_EQUAL_size_t(count, parsed.size());
+    for (uint16_t i = 0; i < count; i++)
+        assertSameEvent(events[i], parsed[i]);
+}
+
+// Raw counts of a steady tank with a few counts of noise and a pH step after a minute
+static uint16_t traceSignal(uint8_t pin, uint32_t time_us)
+{
+    uint32_t noise = (time_us / 4000) * 2654435761UL >> 29;
+    if (pin != RIG_PIN_PH)
+        return 1807 + noise % 5;
+    return (time_us < 60000000UL ? 3300 : 3150) + noise % 7;
+}
+
+#define TRACE_RUN_S 120
+
+// What the replayed pipeline reported last, probe 0 only
+static float replayed[READING_EC + 1];
+
+static void replaySink(ReadingChannel channel, uint8_t index, float value, SensorQuality quality)
+{
+    if (index == 0)
+        replayed[channel] = value;
+}
+
+static void test_trace_replay_reproduces_the_pipeline()
+{
+    // Record the rig's pipeline and keep what it reported every second
+    static float live[TRACE_RUN_S][3];
+    std::vector<uint8_t> capture;
+    uint32_t recorded_events = 0;
+    {
+        PipelineRig rig(traceSignal, 21.3f);
+        RawTraceRecorder recorder;
+        rig.pipeline.setRecorder(&recorder);
+        rig.begin();
+        recorder.start();
+        uint8_t frame[TELEMETRY_BATCH_FRAME_SIZE];
+        RawTraceChunk chunk;
+        for (uint32_t second = 0; second < TRACE_RUN_S; second++)
+        {
+            rig.run(1000);
+            live[second][0] = rig_channels[READING_PH].value;
+            live[second][1] = rig_channels[READING_TDS].value;
+            live[second][2] = rig_channels[READING_TEMPERATURE].value;
+            if (second == TRACE_RUN_S - 1)
+                recorder.stop();
+            while (recorder.take(chunk))
+            {
+                size_t length = telemetryEncodeTrace(chunk.data, chunk.length, chunk.count, frame, sizeof(frame));
+                capture.insert(capture.end(), frame, frame + length);
+            }
+        }
+        rig.run(1000);
+        while (recorder.take(chunk))
+        {
+            size_t length = telemetryEncodeTrace(chunk.data, chunk.length, chunk.count, frame, sizeof(frame));
+            capture.insert(capture.end(), frame, frame + length);
+        }
+        TEST_ASSERT_EQUAL_UINT32(0, recorder.dropped());
+        recorded_events = recorder.events();
+    }
+
+    std::vector<RawTraceEvent> events;
+    TraceParseStats stats = traceParse(capture.data(), capture.size(), events);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.damaged);
+    TEST_ASSERT_EQUAL_UINT32(recorded_events, stats.events);
+    uint64_t trace_samples = 0;
+    for (const RawTraceEvent &event : events)
+        trace_samples += event.type == TRACE_ADC_BLOCK ? event.block.count : 0;
+
+    // The same pipeline on the trace reports what the live one did, give or take the block it polls at
+    fake_now_us = 0;
+    memset(replayed, 0, sizeof(replayed));
+    AdcCalibration tds_calibration, ph_calibration;
+    tds_calibration.build(referenceAdcMillivolts, &REFERENCE_ADC1);
+    ph_calibration.build(referenceAdcMillivolts, &REFERENCE_ADC2);
+    ReplayAdcSource adc(events);
+    ReplayTemperatureBus bus(events);
+    TemperatureEngine temperatures(bus, halMicros);
+    temperatures.begin(halMicros());
+    Scheduler scheduler(halMicros);
+    SensorPipeline pipeline(adc, temperatures, tds_calibration, ph_calibration);
+    TEST_ASSERT_EQUAL_UINT32(1000000UL * ADC_BLOCK_SIZE / RIG_ADC_RATE_HZ, adc.blockPeriodUs());
+    TEST_ASSERT_EQUAL_UINT8(2, adc.channelCount());
+
+    pipeline.begin(scheduler, replaySink, adc.blockPeriodUs(), 10000000UL);
+    uint32_t compared = 0;
+    for (uint32_t second = 0; second < TRACE_RUN_S; second++)
+    {
+        uint32_t end_us = (second + 1) * 1000000UL;
+        while ((int32_t)(fake_now_us - end_us) < 0)
+            fakeSpend(scheduler.runOnce());
+        if (second < 5 || second == 60)
+            continue;
+        TEST_ASSERT_FLOAT_WITHIN(0.01f, live[second][0], replayed[READING_PH]);
+        TEST_ASSERT_FLOAT_WITHIN(0.5f, live[second][1], replayed[READING_TDS]);
+        TEST_ASSERT_FLOAT_WITHIN(0.01f, live[second][2], replayed[READING_TEMPERATURE]);
+        compared++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(TRACE_RUN_S - 6, compared);
+    TEST_ASSERT_GREATER_THAN_FLOAT(0.5f, fabsf(live[59][0] - live[TRACE_RUN_S - 1][0])); // The step is in the trace
+
+    // Every sample of the trace went through
+    fakeSpend(2 * adc.blockPeriodUs());
+    scheduler.runOnce();
+    TEST_ASSERT_EQUAL_UINT64(trace_samples, adc.samples());
+}
+
+void runRawTraceTests()
+{
+    RUN_TEST(test_trace_chunks_round_trip_every_event);
+    RUN_TEST(test_trace_quiet_samples_cost_a_byte);
+    RUN_TEST(test_trace_event_that_does_not_fit_leaves_the_chunk);
+    RUN_TEST(test_trace_damaged_chunk_stops_the_decoder);
+    RUN_TEST(test_trace_recorder_off_records_nothing);
+    RUN_TEST(test_trace_recorder_flushes_after_a_second);
+    RUN_TEST(test_trace_recorder_counts_chunks_nobody_took);
+    RUN_TEST(test_trace_parse_skips_other_frames);
+    RUN_TEST(test_trace_replay_reproduces_the_pipeline);
+}
@@ -0,0 +1,125 @@
+#include <unity.h>
+#include "TestSuites.h"
+#include "Scheduler.h"
+#include "native/FakeClock.h"
+
+// A task that counts its runs, spends spend_us of fake time and asks for period_us
+struct CountingTask
+{
+    uint32_t period_us;
+    uint32_t spend_us;
+    uint32_t runs;
+    uint32_t last_us;
+};
+
+static uint32_t countingStep(void *context, uint32_t now_us)
+{
+    CountingTask *task = static_cast<CountingTask *>(context);
+    task->runs++;
+    task->last_us = now_us;
+    fakeSpend(task->spend_us);
+    return task->period_us;
+}
+
+// Run the scheduler until the fake clock reaches end_us, jumping to the next due task every pass
+static void runUntil(Scheduler &scheduler, uint32_t end_us)
+{
+    while ((int32_t)(fake_now_us - end_us) < 0)
+        fakeSpend(scheduler.runOnce());
+}
+
+static void test_scheduler_runs_tasks_at_their_periods()
+{
+    fake_now_us = 0;
+    Scheduler scheduler(fakeClock);
+    CountingTask fast = {1000, 0, 0, 0}, slow = {3000, 0, 0, 0};
+    scheduler.addTask("fast", countingStep, &fast);
+    scheduler.addTask("slow", countingStep, &slow);
+    runUntil(scheduler, 12000);
+    TEST_ASSERT_EQUAL_UINT32(12, fast.runs);
+    TEST_ASSERT_EQUAL_UINT32(4, slow.runs);
+    TEST_ASSERT_EQUAL_UINT32(11000, fast.last_us);
+    TEST_ASSERT_EQUAL_UINT32(9000, slow.last_us);
+}
+
+static void test_scheduler_honours_first_delay()
+{
+    fake_now_us = 0;
+    Scheduler scheduler(fakeClock);
+    CountingTask task = {1000, 0, 0, 0};
+    scheduler.addTask("late", countingStep, &task, 5000);
+    TEST_ASSERT_EQUAL_UINT32(5000, scheduler.runOnce());
+    TEST_ASSERT_EQUAL_UINT32(0, task.runs);
+    runUntil(scheduler, 5001);
+    TEST_ASSERT_EQUAL_UINT32(1, task.runs);
+    TEST_ASSERT_EQUAL_UINT32(5000, task.last_us);
+}
+
+static void test_scheduler_table_is_bounded()
+{
+    Scheduler scheduler(fakeClock);
+    CountingTask task = {1000, 0, 0, 0};
+    for (uint8_t i = 0; i < Scheduler::MAX_TASKS; i++)
+        TEST_ASSERT_EQUAL_INT(i, scheduler.addTask("task", countingStep, &task));
+    TEST_ASSERT_EQUAL_INT(-1, scheduler.addTask("extra", countingStep, &task));
+    TEST_ASSERT_EQUAL_UINT8(Scheduler::MAX_TASKS, scheduler.taskCount());
+}
+
+static void test_scheduler_survives_the_clock_wrap()
+{
+    // Start 5 ms before the 32-bit counter wraps and run 10 ms across it
+    fake_now_us = 0xFFFFFFFFUL - 4999;
+    Scheduler scheduler(fakeClock);
+    CountingTask task = {1000, 0, 0, 0};
+    scheduler.addTask("wrap", countingStep, &task);
+    runUntil(scheduler, fake_now_us + 10000);
+    TEST_ASSERT_EQUAL_UINT32(10, task.runs);
+    TEST_ASSERT_EQUAL_UINT32(0, scheduler.taskStats(0).lateness_max_us);
+}
+
+static void test_scheduler_statistics()
+{
+    fake_now_us = 0;
+    Scheduler scheduler(fakeClock);
+    CountingTask task = {1000, 200, 0, 0};
+    scheduler.addTask("busy", countingStep, &task);
+    scheduler.runOnce();
+    fakeSpend(1300); // Due at 1000, runs at 1500
+    scheduler.runOnce();
+    const SchedulerTaskStats &stats = scheduler.taskStats(0);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.runs);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.lateness_min_us);
+    TEST_ASSERT_EQUAL_UINT32(500, stats.lateness_max_us);
+    TEST_ASSERT_EQUAL_UINT32(200, stats.run_time_max_us);
+    TEST_ASSERT_EQUAL_UINT32(2, scheduler.cycleStats().cycles);
+
+    // Periodic tasks keep their phase: the next run is due at 2000, not 2500
+    TEST_ASSERT_EQUAL_UINT32(2000 - fake_now_us, scheduler.runOnce());
+
+    scheduler.resetStats();
+    TEST_ASSERT_EQUAL_UINT32(0, scheduler.taskStats(0).runs);
+    TEST_ASSERT_EQUAL_UINT32(0, scheduler.cycleStats().cycles);
+}
+
+static void test_scheduler_resynchronises_after_falling_behind()
+{
+    fake_now_us = 0;
+    Scheduler scheduler(fakeClock);
+    CountingTask task = {1000, 0, 0, 0};
+    scheduler.addTask("behind", countingStep, &task);
+    scheduler.runOnce();
+    fakeSpend(3500); // More than a whole period late
+    scheduler.runOnce();
+    TEST_ASSERT_EQUAL_UINT32(2, task.runs);
+    TEST_ASSERT_EQUAL_UINT32(1000, scheduler.runOnce()); // Next run a period after the late one, no burst to catch up
+}
+
+void runSchedulerTests()
+{
+    RUN_TEST(test_scheduler_runs_tasks_at_their_periods);
+    RUN_TEST(test_scheduler_honours_first_delay);
+    RUN_TEST(test_scheduler_table_is_bounded);
+    RUN_TEST(test_scheduler_survives_the_clock_wrap);
+    RUN_TEST(test_scheduler_statistics);
+    RUN_TEST(test_scheduler_resynchronises_after_falling_behind);
+}
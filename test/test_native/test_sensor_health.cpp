@@ -0,0 +1,343 @@
+#include <unity.h>
+#include <math.h>
+#include "TestSuites.h"
+#include "SensorHealth.h"
+#include "PipelineRig.h"
+#include "native/FakeClock.h"
+#include "native/SimulatedSensors.h"
+
+// Limits of an analog probe in millivolts, like the pipeline's TDS
+static const SensorHealthConfig ANALOG_HEALTH = {
+    8, 4087, 400,
+    0.0f, 2300.0f,
+    100.0f, 30.0f, 8,
+    0, 8, 120,
+};
+
+// Limits of a DS18B20, two missed reads mean disconnected
+static const SensorHealthConfig PROBE_HEALTH = {
+    0, 0, 0,
+    -5.0f, 50.0f,
+    0.5f, 0.5f, 3,
+    2, 2, 60,
+};
+
+// A sorted raw window with the interface of the filters
+struct RawWindow
+{
+    uint16_t samples[64];
+    uint16_t size() const { return 64; }
+    uint16_t rank(uint16_t index) const { return samples[index]; }
+
+    // Evenly spread from low to high
+    void fill(uint16_t low, uint16_t high)
+    {
+        for (uint16_t i = 0; i < 64; i++)
+            samples[i] = low + (uint32_t)(high - low) * i / 63;
+    }
+};
+
+// One value every 256 ms, the pipeline's block period at 250 Hz
+#define HEALTH_PERIOD_US 256000UL
+
+static void test_health_window_rails_and_floating_input()
+{
+    SensorHealth health;
+    health.configure(ANALOG_HEALTH);
+    RawWindow window;
+
+    window.fill(1790, 1820);
+    health.window(window);
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_GOOD, health.update(800.0f, 0));
+
+    // A dead input at the low rail, a floating one over the whole range, one pinned at the top
+    window.fill(0, 6);
+    health.window(window);
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_FAULT, health.update(0.0f, HEALTH_PERIOD_US));
+    TEST_ASSERT_EQUAL_UINT8(FAULT_DISCONNECTED, health.fault());
+
+    health.configure(ANALOG_HEALTH);
+    window.fill(100, 4000);
+    health.window(window);
+    health.update(1000.0f, 0);
+    TEST_ASSERT_EQUAL_UINT8(FAULT_DISCONNECTED, health.fault());
+
+    health.configure(ANALOG_HEALTH);
+    window.fill(4090, 4095);
+    health.window(window);
+    health.update(2000.0f, 0);
+    TEST_ASSERT_EQUAL_UINT8(FAULT_SATURATED, health.fault());
+}
+
+static void test_health_window_step_is_not_floating()
+{
+    // Half the window before a step and half after is wide, but its median sits on one level
+    SensorHealth health;
+    health.configure(ANALOG_HEALTH);
+    RawWindow window;
+    for (uint16_t i = 0; i < 64; i++)
+        window.samples[i] = i < 32 ? 1000 + i : 3000 + i;
+    health.window(window);
+    health.update(900.0f, 0);
+    TEST_ASSERT_TRUE(health.fault() != FAULT_DISCONNECTED);
+}
+
+static void test_health_out_of_range_and_nan()
+{
+    SensorHealth health;
+    health.configure(PROBE_HEALTH);
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_GOOD, health.update(21.0f, 0));
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_FAULT, health.update(85.0f, 1000000));
+    TEST_ASSERT_EQUAL_UINT8(FAULT_SATURATED, health.fault());
+
+    health.configure(PROBE_HEALTH);
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_FAULT, health.update(NAN, 0));
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_FAULT, health.update(-127.0f, 1000000));
+    TEST_ASSERT_EQUAL_UINT32(1, health.stats().detections[FAULT_SATURATED]);
+}
+
+static void test_health_fault_clears_after_a_clean_run()
+{
+    SensorHealth health;
+    health.configure(PROBE_HEALTH);
+    uint32_t now = 0;
+    health.update(21.0f, now);
+    health.update(85.0f, now += 1000000);
+
+    // One clean value is not enough, clear_count of them are
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_FAULT, health.update(21.0f, now += 1000000));
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_FAULT, health.update(85.0f, now += 1000000));
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_FAULT, health.update(21.0f, now += 1000000));
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_GOOD, health.update(21.1f, now += 1000000));
+    TEST_ASSERT_EQUAL_UINT32(1, health.stats().detections[FAULT_SATURATED]);
+}
+
+static void test_health_slew_is_suspect_until_confirmed()
+{
+    SensorHealth health;
+    health.configure(ANALOG_HEALTH);
+    uint32_t now = 0;
+    for (uint8_t i = 0; i < 10; i++)
+        TEST_ASSERT_EQUAL_UINT8(QUALITY_GOOD, health.update(800.0f + i % 2, now += HEALTH_PERIOD_US));
+
+    // A single wild value is suspect and counts as nothing once it is back
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_SUSPECT, health.update(1500.0f, now += HEALTH_PERIOD_US));
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_SUSPECT, health.update(800.0f, now += HEALTH_PERIOD_US));
+    TEST_ASSERT_EQUAL_UINT32(1, health.stats().detections[FAULT_SLEW]);
+
+    // A new level is believed after slew_confirm values without a jump
+    for (uint8_t i = 1; i < ANALOG_HEALTH.slew_confirm; i++)
+        TEST_ASSERT_EQUAL_UINT8(QUALITY_SUSPECT, health.update(800.0f, now += HEALTH_PERIOD_US));
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_GOOD, health.update(800.0f, now += HEALTH_PERIOD_US));
+
+    // A slow ramp within slew_per_s never is suspect
+    for (uint16_t i = 0; i < 70; i++)
+        TEST_ASSERT_EQUAL_UINT8(QUALITY_GOOD, health.update(800.0f + i * 20.0f, now += HEALTH_PERIOD_US));
+}
+
+static void test_health_stuck_value()
+{
+    SensorHealth health;
+    health.configure(PROBE_HEALTH);
+    uint32_t now = 0xFFFFFFFFUL - 30000000UL; // The timer runs across the clock wrap
+    health.update(21.0f, now);
+    for (uint8_t s = 1; s < 60; s++)
+        TEST_ASSERT_EQUAL_UINT8(QUALITY_GOOD, health.update(21.0f, now += 1000000));
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_FAULT, health.update(21.0f, now += 1000000));
+    TEST_ASSERT_EQUAL_UINT8(FAULT_STUCK, health.fault());
+
+    // It moves again
+    health.update(21.1f, now += 1000000);
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_GOOD, health.update(21.2f, now += 1000000));
+}
+
+static void test_health_missing_reads_mean_disconnected()
+{
+    SensorHealth health;
+    health.configure(PROBE_HEALTH);
+    health.update(21.0f, 0);
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_GOOD, health.missing());
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_FAULT, health.missing());
+    TEST_ASSERT_EQUAL_UINT8(FAULT_DISCONNECTED, health.fault());
+    TEST_ASSERT_EQUAL_UINT32(2, health.stats().missing);
+
+    // A read in between starts the count over
+    health.configure(PROBE_HEALTH);
+    health.missing();
+    health.update(21.0f, 0);
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_GOOD, health.missing());
+}
+
+// Fault injection through the firmware's pipeline, the scenarios of sim-faults on fewer seeds
+#define FAULT_SEEDS 3
+#define FAULT_START_S 60         // Every script injects its fault here
+#define FAULT_END_S 300          // and takes it away here
+#define FAULT_SETTLE_S 70        // After the end the probe has this long to come back, a dead DS18B20 is retried a minute apart
+#define FAULT_RUN_S 420
+#define FAULT_STEP_MS 10         // Polling step, well below the fastest channel's period
+#define FAULT_TEMP_STUCK_S 60    // Stuck limit of the DS18B20 in the test, the firmware waits six hours
+
+struct FaultScenario
+{
+    const char *script;
+    ReadingChannel channel;   // Channel that must notice, probe 0 for temperatures
+    SensorFault fault;        // How it must be classified, FAULT_NONE for the clean run
+    uint32_t max_latency_ms;  // Slowest acceptable detection
+};
+
+static SimulatedSensors *fault_sensors;
+
+static uint16_t faultSignal(uint8_t pin, uint32_t time_us) { return fault_sensors->analogRead(pin, time_us); }
+
+static void runFaultScenario(const FaultScenario &scenario)
+{
+    const ReadingChannel channels[] = {READING_PH, READING_TDS, READING_TEMPERATURE};
+    const uint32_t blocks_during = (FAULT_END_S - FAULT_START_S) * 1000000UL / (1000000UL * ADC_BLOCK_SIZE / RIG_ADC_RATE_HZ);
+    for (uint32_t seed = 1; seed <= FAULT_SEEDS; seed++)
+    {
+        SimulatedSensors sensors(seed * 7919);
+        sensors.add("tds", RIG_PIN_TDS, 1807, 6);
+        sensors.add("ph", RIG_PIN_PH, 3300, 4);
+        int8_t probe = sensors.add("temp0", SimulatedSensors::NO_PIN, 21.3f, 0.02f);
+        TEST_ASSERT_EQUAL_INT(0, sensors.load(scenario.script));
+        fault_sensors = &sensors;
+
+        PipelineRig rig(faultSignal, 21.3f);
+        SensorHealthConfig temp_config = rig.pipeline.health(READING_TEMPERATURE).config();
+        temp_config.stuck_s = FAULT_TEMP_STUCK_S;
+        rig.pipeline.configureHealth(READING_TEMPERATURE, temp_config);
+        rig.begin();
+
+        bool detected = false;
+        uint32_t ph_at_start = 0, ph_during = 0, failures_at_start = 0, failures_during = 0;
+        while (fake_now_us < FAULT_RUN_S * 1000000UL)
+        {
+            float celsius;
+            bool connected = sensors.sample(probe, fake_now_us, celsius);
+            rig.bus.setConnected(0, connected);
+            if (connected)
+                rig.bus.setTemperature(0, celsius);
+            rig.run(FAULT_STEP_MS);
+
+            bool before = fake_now_us < FAULT_START_S * 1000000UL;
+            bool during = !before && fake_now_us < FAULT_END_S * 1000000UL;
+            bool settled = fake_now_us >= (FAULT_END_S + FAULT_SETTLE_S) * 1000000UL;
+            if (before)
+            {
+                ph_at_start = rig_channels[READING_PH].count;
+                failures_at_start = rig.temperatures.probe(0).failures;
+            }
+            else if (during)
+            {
+                ph_during = rig_channels[READING_PH].count - ph_at_start;
+                failures_during = rig.temperatures.probe(0).failures - failures_at_start;
+            }
+
+            // Nothing is raised while the probes are clean, on any channel
+            for (ReadingChannel channel : channels)
+            {
+                if (before || settled || scenario.fault == FAULT_NONE)
+                    TEST_ASSERT_EQUAL_UINT8(FAULT_NONE, rig.pipeline.health(channel).fault());
+            }
+
+            // The injected fault is found in time and named right
+            SensorFault fault = rig.pipeline.health(scenario.channel).fault();
+            if (during && !detected && fault != FAULT_NONE)
+            {
+                detected = true;
+                TEST_ASSERT_EQUAL_UINT8(scenario.fault, fault);
+                TEST_ASSERT_LESS_OR_EQUAL(scenario.max_latency_ms, fake_now_us / 1000 - FAULT_START_S * 1000UL);
+            }
+        }
+        TEST_ASSERT_TRUE(detected == (scenario.fault != FAULT_NONE));
+
+        // Only the injected fault and slews on the way are ever raised
+        const SensorHealthStats &stats = rig.pipeline.health(scenario.channel).stats();
+        for (uint8_t fault = FAULT_DISCONNECTED; fault < FAULT_COUNT; fault++)
+        {
+            if (fault != scenario.fault && fault != FAULT_SLEW)
+                TEST_ASSERT_EQUAL_UINT32(0, stats.detections[fault]);
+        }
+
+        // Acquisition never stalls: pH keeps its block rate unless it is the pH probe that went
+        TEST_ASSERT_EQUAL_UINT32(0, rig.adc.overflows());
+        TEST_ASSERT_EQUAL_UINT32(0, rig.bus.early_reads);
+        if (scenario.channel != READING_PH)
+            TEST_ASSERT_GREATER_OR_EQUAL(blocks_during * 9 / 10, ph_during);
+
+        // A dead DS18B20 is backed off instead of tried every second
+        if (scenario.channel == READING_TEMPERATURE && scenario.fault == FAULT_DISCONNECTED)
+            TEST_ASSERT_LESS_THAN((FAULT_END_S - FAULT_START_S) / 10, failures_during);
+    }
+}
+
+static void test_faults_clean_run_raises_nothing()
+{
+    runFaultScenario({"0 tds spikes=2 spike=900\n0 ph spikes=2 spike=700\n0 temp0 drift=0.002\n", READING_TDS, FAULT_NONE, 0});
+}
+
+static void test_faults_tds_unplugged()
+{
+    runFaultScenario({"60 tds level=0\n300 tds level=1807\n", READING_TDS, FAULT_DISCONNECTED, 500});
+}
+
+static void test_faults_tds_frozen()
+{
+    runFaultScenario({"60 tds stuck=1\n300 tds stuck=0\n", READING_TDS, FAULT_STUCK, 125000});
+}
+
+static void test_faults_ph_floating()
+{
+    runFaultScenario({"60 ph floating=1\n300 ph floating=0\n", READING_PH, FAULT_DISCONNECTED, 500});
+}
+
+static void test_faults_ph_at_the_rail()
+{
+    runFaultScenario({"60 ph level=4095\n300 ph level=3300\n", READING_PH, FAULT_SATURATED, 500});
+}
+
+static void test_faults_ph_jump()
+{
+    runFaultScenario({"60 ph level=2300\n300 ph level=3300\n", READING_PH, FAULT_SLEW, 500});
+}
+
+static void test_faults_temperature_unplugged()
+{
+    runFaultScenario({"60 temp0 dropouts=1000 dropout_ms=240000\n61 temp0 dropouts=0\n", READING_TEMPERATURE, FAULT_DISCONNECTED, 3000});
+}
+
+static void test_faults_temperature_disconnected_value()
+{
+    runFaultScenario({"60 temp0 level=-127 noise=0\n300 temp0 level=21.3 noise=0.02\n", READING_TEMPERATURE, FAULT_DISCONNECTED, 3000});
+}
+
+static void test_faults_temperature_power_on_value()
+{
+    runFaultScenario({"60 temp0 level=85\n300 temp0 level=21.3\n", READING_TEMPERATURE, FAULT_SATURATED, 2000});
+}
+
+static void test_faults_temperature_frozen()
+{
+    runFaultScenario({"60 temp0 stuck=1\n300 temp0 stuck=0\n", READING_TEMPERATURE, FAULT_STUCK, (FAULT_TEMP_STUCK_S + 3) * 1000UL});
+}
+
+void runSensorHealthTests()
+{
+    RUN_TEST(test_health_window_rails_and_floating_input);
+    RUN_TEST(test_health_window_step_is_not_floating);
+    RUN_TEST(test_health_out_of_range_and_nan);
+    RUN_TEST(test_health_fault_clears_after_a_clean_run);
+    RUN_TEST(test_health_slew_is_suspect_until_confirmed);
+    RUN_TEST(test_health_stuck_value);
+    RUN_TEST(test_health_missing_reads_mean_disconnected);
+    RUN_TEST(test_faults_clean_run_raises_nothing);
+    RUN_TEST(test_faults_tds_unplugged);
+    RUN_TEST(test_faults_tds_frozen);
+    RUN_TEST(test_faults_ph_floating);
+    RUN_TEST(test_faults_ph_at_the_rail);
+    RUN_TEST(test_faults_ph_jump);
+    RUN_TEST(test_faults_temperature_unplugged);
+    RUN_TEST(test_faults_temperature_disconnected_value);
+    RUN_TEST(test_faults_temperature_power_on_value);
+    RUN_TEST(test_faults_temperature_frozen);
+}
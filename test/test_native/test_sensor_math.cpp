@@ -0,0 +1,95 @@
+#include <unity.h>
+#include <math.h>
+#include "TestSuites.h"
+#include "SensorMath.h"
+#include "AdcCalibration.h"
+#include "native/ReferenceAdcCurve.h"
+
+typedef SensorMathPolicy<float> FloatMath;
+typedef SensorMathPolicy<Q16> FixedMath;
+
+// The plausible water temperatures of the pipeline's health check, in quarter degrees
+#define MATH_TEMP_MIN_QUARTERS (-5 * 4)
+#define MATH_TEMP_MAX_QUARTERS (50 * 4)
+
+// Every millivolt value the 12-bit ADC produces through the 11 dB table
+static const AdcCalibration &adcTable()
+{
+    static AdcCalibration calibration;
+    if (!calibration.ready())
+        calibration.build(referenceAdcMillivolts, &REFERENCE_ADC1);
+    return calibration;
+}
+
+static void test_q16_tds_tracks_float()
+{
+    const AdcCalibration &calibration = adcTable();
+    float worst = 0;
+    for (int32_t quarter = MATH_TEMP_MIN_QUARTERS; quarter <= MATH_TEMP_MAX_QUARTERS; quarter++)
+    {
+        float celsius = quarter * 0.25f;
+        FixedMath::value_type fixed_celsius = FixedMath::value(celsius);
+        for (uint16_t raw = 0; raw <= ADC_RAW_MAX; raw++)
+        {
+            uint16_t millivolts = calibration.millivolts(raw);
+            float compensated = FloatMath::tdsCompensate(FloatMath::volts(millivolts), celsius);
+            FixedMath::value_type fixed_compensated = FixedMath::tdsCompensate(FixedMath::volts(millivolts), fixed_celsius);
+            TEST_ASSERT_FLOAT_WITHIN(0.0005f, compensated, FixedMath::toFloat(fixed_compensated));
+
+            // A couple of Q16 steps per ppm, relative above 1 ppm, and never the wrapped value of an overflow
+            float expected = FloatMath::tdsPpm(compensated);
+            float actual = FixedMath::toFloat(FixedMath::tdsPpm(fixed_compensated));
+            TEST_ASSERT_FLOAT_WITHIN(0.0002f * fmaxf(1.0f, expected), expected, actual);
+            worst = fmaxf(worst, fabsf(actual - expected));
+        }
+    }
+    TEST_ASSERT_LESS_THAN_FLOAT(1.0f, worst);
+}
+
+static void test_q16_tds_within_half_ppm_on_the_probe_range()
+{
+    // What the probe board can output, 0 to 2.3 V, in water from 5 to 35 C
+    for (int32_t quarter = 5 * 4; quarter <= 35 * 4; quarter++)
+    {
+        float celsius = quarter * 0.25f;
+        for (uint16_t millivolts = 0; millivolts <= 2300; millivolts++)
+        {
+            float expected = FloatMath::tdsPpm(FloatMath::tdsCompensate(FloatMath::volts(millivolts), celsius));
+            float actual = FixedMath::toFloat(FixedMath::tdsPpm(FixedMath::tdsCompensate(FixedMath::volts(millivolts), FixedMath::value(celsius))));
+            TEST_ASSERT_FLOAT_WITHIN(0.5f, expected, actual);
+        }
+    }
+}
+
+static void test_q16_tds_saturates_instead_of_overflowing()
+{
+    // The top of the ADC in water at -5 C compensates to 8.6 V, the cubic stops at its limit in both
+    float cold = FixedMath::toFloat(FixedMath::tdsPpm(FixedMath::tdsCompensate(FixedMath::volts(3441), FixedMath::value(-5.0f))));
+    float limit = FloatMath::tdsPpm(FloatMath::TDS_VOLTS_MAX);
+    TEST_ASSERT_FLOAT_WITHIN(0.0002f * limit, limit, cold);
+    TEST_ASSERT_FLOAT_WITHIN(0.0f, limit, FloatMath::tdsPpm(20.0f));
+    TEST_ASSERT_GREATER_THAN_FLOAT(0.0f, cold);
+}
+
+static void test_q16_ph_tracks_float()
+{
+    const AdcCalibration &calibration = adcTable();
+    for (float offset = 14.0f; offset <= 28.0f; offset += 0.25f)
+    {
+        FixedMath::value_type fixed_offset = FixedMath::value(offset);
+        for (uint16_t raw = 0; raw <= ADC_RAW_MAX; raw++)
+        {
+            uint16_t millivolts = calibration.millivolts(raw);
+            float expected = FloatMath::ph(FloatMath::volts(millivolts), offset);
+            TEST_ASSERT_FLOAT_WITHIN(0.0001f, expected, FixedMath::toFloat(FixedMath::ph(FixedMath::volts(millivolts), fixed_offset)));
+        }
+    }
+}
+
+void runSensorMathTests()
+{
+    RUN_TEST(test_q16_tds_tracks_float);
+    RUN_TEST(test_q16_tds_within_half_ppm_on_the_probe_range);
+    RUN_TEST(test_q16_tds_saturates_instead_of_overflowing);
+    RUN_TEST(test_q16_ph_tracks_float);
+}
@@ -0,0 +1,217 @@
+#include <unity.h>
+#include "TestSuites.h"
+#include "SensorState.h"
+
+// Derived entries that count their calls and remember what they were given
+struct DeriveLog
+{
+    uint32_t tds_calls;
+    uint32_t ec_calls;
+    SensorQuality temperature_quality; // Quality of the temperature the last TDS saw
+};
+
+static float countTds(const SensorValue *const *inputs, void *context)
+{
+    DeriveLog *log = static_cast<DeriveLog *>(context);
+    log->tds_calls++;
+    log->temperature_quality = inputs[1]->quality;
+    float celsius = inputs[1]->quality >= QUALITY_FAULT ? 25.0f : inputs[1]->value;
+    return inputs[0]->value / (1.0f + (celsius - 25.0f) / 50.0f);
+}
+
+static float countEc(const SensorValue *const *inputs, void *context)
+{
+    static_cast<DeriveLog *>(context)->ec_calls++;
+    return inputs[0]->value * 2.0f;
+}
+
+// The pipeline's wiring: TDS from the voltage and the temperature, EC from TDS
+static void wire(SensorState &state, DeriveLog &log)
+{
+    log = DeriveLog();
+    TEST_ASSERT_TRUE(state.addDerived(SENSOR_TDS_PPM, countTds, &log, SENSOR_TDS_MV, SENSOR_TEMPERATURE));
+    TEST_ASSERT_TRUE(state.addDerived(SENSOR_EC, countEc, &log, SENSOR_TDS_PPM));
+}
+
+static void test_state_recomputes_only_on_input_changes()
+{
+    SensorState state;
+    DeriveLog log;
+    wire(state, log);
+
+    state.publish(SENSOR_TEMPERATURE, 21.5f, 1000);
+    state.publish(SENSOR_TDS_MV, 800.0f, 1000);
+    TEST_ASSERT_EQUAL_UINT8(2, state.refresh(1000));
+    TEST_ASSERT_EQUAL_UINT32(1, log.tds_calls);
+    TEST_ASSERT_EQUAL_UINT32(1, log.ec_calls);
+    TEST_ASSERT_EQUAL_UINT32(1, state.get(SENSOR_TDS_PPM).version);
+
+    // Nothing moved, or the same values again at a later time: no work
+    TEST_ASSERT_EQUAL_UINT8(0, state.refresh(2000));
+    state.publish(SENSOR_TEMPERATURE, 21.5f, 3000);
+    state.publish(SENSOR_TDS_MV, 800.0f, 3000);
+    TEST_ASSERT_EQUAL_UINT8(0, state.refresh(3000));
+    TEST_ASSERT_EQUAL_UINT32(1, log.tds_calls);
+    TEST_ASSERT_EQUAL_UINT32(1, state.get(SENSOR_TEMPERATURE).version);
+    TEST_ASSERT_EQUAL_UINT32(4, state.skipped());
+
+    // A new temperature alone recomputes TDS once, and EC through it
+    state.publish(SENSOR_TEMPERATURE, 23.0f, 4000);
+    TEST_ASSERT_EQUAL_UINT8(2, state.refresh(4000));
+    TEST_ASSERT_EQUAL_UINT32(2, log.tds_calls);
+    TEST_ASSERT_EQUAL_UINT32(2, log.ec_calls);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 800.0f / (1.0f - 2.0f / 50.0f), state.get(SENSOR_TDS_PPM).value);
+    TEST_ASSERT_EQUAL_UINT32(4000, state.get(SENSOR_TDS_PPM).timestamp_us);
+
+    // So does a new voltage alone
+    state.publish(SENSOR_TDS_MV, 820.0f, 5000);
+    TEST_ASSERT_EQUAL_UINT8(2, state.refresh(5000));
+    TEST_ASSERT_EQUAL_UINT32(3, log.tds_calls);
+
+    // A change of quality is a change, and invalidate forces the next refresh
+    state.publish(SENSOR_TDS_MV, 820.0f, 6000, QUALITY_SUSPECT);
+    TEST_ASSERT_EQUAL_UINT8(2, state.refresh(6000));
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_SUSPECT, state.get(SENSOR_TDS_PPM).quality);
+    state.invalidate(SENSOR_TDS_MV);
+    TEST_ASSERT_EQUAL_UINT8(1, state.refresh(7000)); // Same TDS value, EC's input did not move
+    TEST_ASSERT_EQUAL_UINT32(5, log.tds_calls);
+    TEST_ASSERT_EQUAL_UINT32(4, log.ec_calls);
+    TEST_ASSERT_EQUAL_UINT32(state.recomputed(), log.tds_calls + log.ec_calls);
+}
+
+static void test_state_unchanged_inputs_still_update()
+{
+    SensorState state;
+    DeriveLog log;
+    wire(state, log);
+
+    state.publish(SENSOR_TEMPERATURE, 21.5f, 1000);
+    state.publish(SENSOR_TDS_MV, 800.0f, 1000);
+    state.refresh(1000);
+    TEST_ASSERT_EQUAL_UINT32(1, state.get(SENSOR_TDS_PPM).updates);
+    TEST_ASSERT_EQUAL_UINT32(1, state.get(SENSOR_EC).updates);
+
+    // The same voltage measured again: no conversion, the same version, but a newer timestamp and one more update
+    state.publish(SENSOR_TDS_MV, 800.0f, 2000);
+    TEST_ASSERT_EQUAL_UINT32(2, state.get(SENSOR_TDS_MV).updates);
+    TEST_ASSERT_EQUAL_UINT32(1, state.get(SENSOR_TDS_MV).version);
+    TEST_ASSERT_EQUAL_UINT8(0, state.refresh(2000));
+    TEST_ASSERT_EQUAL_UINT32(1, log.tds_calls);
+    TEST_ASSERT_EQUAL_UINT32(1, log.ec_calls);
+    const SensorValue &tds = state.get(SENSOR_TDS_PPM);
+    TEST_ASSERT_EQUAL_UINT32(1, tds.version);
+    TEST_ASSERT_EQUAL_UINT32(2, tds.updates);
+    TEST_ASSERT_EQUAL_UINT32(2000, tds.timestamp_us);
+    TEST_ASSERT_EQUAL_UINT32(2, state.get(SENSOR_EC).updates);
+    TEST_ASSERT_EQUAL_UINT32(2000, state.get(SENSOR_EC).timestamp_us);
+
+    // Without any new measurement nothing moves
+    TEST_ASSERT_EQUAL_UINT8(0, state.refresh(3000));
+    TEST_ASSERT_EQUAL_UINT32(2, state.get(SENSOR_TDS_PPM).updates);
+    TEST_ASSERT_EQUAL_UINT32(2, state.get(SENSOR_EC).updates);
+
+    // A real change counts as both
+    state.publish(SENSOR_TEMPERATURE, 22.0f, 4000);
+    TEST_ASSERT_EQUAL_UINT8(2, state.refresh(4000));
+    TEST_ASSERT_EQUAL_UINT32(2, state.get(SENSOR_TDS_PPM).version);
+    TEST_ASSERT_EQUAL_UINT32(3, state.get(SENSOR_TDS_PPM).updates);
+}
+
+static void test_state_stale_aging_bumps_the_version()
+{
+    SensorState state;
+    DeriveLog log;
+    wire(state, log);
+    state.setMaxAge(SENSOR_TEMPERATURE, 10000);
+
+    state.publish(SENSOR_TEMPERATURE, 21.5f, 0);
+    state.publish(SENSOR_TDS_MV, 800.0f, 0);
+    state.refresh(0);
+    uint32_t version = state.get(SENSOR_TEMPERATURE).version;
+
+    // Up to the maximum age it stays good
+    TEST_ASSERT_EQUAL_UINT8(0, state.refresh(10000));
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_GOOD, state.get(SENSOR_TEMPERATURE).quality);
+
+    // Past it the quality drops once, with one version step, and TDS is redone with the stale input
+    TEST_ASSERT_EQUAL_UINT8(2, state.refresh(10001));
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_STALE, state.get(SENSOR_TEMPERATURE).quality);
+    TEST_ASSERT_EQUAL_UINT32(version + 1, state.get(SENSOR_TEMPERATURE).version);
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_STALE, log.temperature_quality);
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_STALE, state.get(SENSOR_TDS_PPM).quality);
+    TEST_ASSERT_EQUAL_UINT8(0, state.refresh(50000));
+    TEST_ASSERT_EQUAL_UINT32(version + 1, state.get(SENSOR_TEMPERATURE).version);
+
+    // A fresh read brings it back
+    state.publish(SENSOR_TEMPERATURE, 21.5f, 60000);
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_GOOD, state.get(SENSOR_TEMPERATURE).quality);
+    TEST_ASSERT_EQUAL_UINT32(version + 2, state.get(SENSOR_TEMPERATURE).version);
+    TEST_ASSERT_EQUAL_UINT8(2, state.refresh(60000));
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_GOOD, state.get(SENSOR_TDS_PPM).quality);
+}
+
+static void test_state_stale_aging_across_the_clock_wrap()
+{
+    SensorState state;
+    state.setMaxAge(SENSOR_TEMPERATURE, 10000);
+    state.publish(SENSOR_TEMPERATURE, 21.5f, 0xFFFFF000UL);
+    state.refresh(0x00000100UL);
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_GOOD, state.get(SENSOR_TEMPERATURE).quality);
+    state.refresh(0x00002000UL);
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_STALE, state.get(SENSOR_TEMPERATURE).quality);
+}
+
+static void test_state_tds_before_the_first_temperature()
+{
+    SensorState state;
+    DeriveLog log;
+    wire(state, log);
+
+    // Nothing is derived before the voltage, a temperature alone does not start it
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_NONE, state.get(SENSOR_TDS_PPM).quality);
+    state.publish(SENSOR_PH, 6.5f, 0);
+    TEST_ASSERT_EQUAL_UINT8(0, state.refresh(0));
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_NONE, state.get(SENSOR_TDS_PPM).quality);
+    TEST_ASSERT_EQUAL_UINT32(0, state.get(SENSOR_TDS_PPM).version);
+
+    // With the voltage but no temperature, TDS is uncompensated and not good
+    state.publish(SENSOR_TDS_MV, 800.0f, 1000);
+    TEST_ASSERT_EQUAL_UINT8(2, state.refresh(1000));
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_NONE, log.temperature_quality);
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_STALE, state.get(SENSOR_TDS_PPM).quality);
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_STALE, state.get(SENSOR_EC).quality);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 800.0f, state.get(SENSOR_TDS_PPM).value);
+
+    // The first temperature makes it good
+    state.publish(SENSOR_TEMPERATURE, 25.0f, 2000);
+    TEST_ASSERT_EQUAL_UINT8(2, state.refresh(2000));
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_GOOD, state.get(SENSOR_TDS_PPM).quality);
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_GOOD, state.get(SENSOR_EC).quality);
+}
+
+static void test_state_fault_of_a_later_input_is_suspect()
+{
+    SensorState state;
+    DeriveLog log;
+    wire(state, log);
+    state.publish(SENSOR_TDS_MV, 800.0f, 0);
+    state.publish(SENSOR_TEMPERATURE, 30.0f, 0, QUALITY_FAULT);
+    state.refresh(0);
+    TEST_ASSERT_EQUAL_UINT8(QUALITY_SUSPECT, state.get(SENSOR_TDS_PPM).quality);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 800.0f, state.get(SENSOR_TDS_PPM).value);
+
+    // A table that is full says so
+    TEST_ASSERT_TRUE(state.addDerived(SENSOR_EC, countEc, &log, SENSOR_TDS_PPM));
+    TEST_ASSERT_TRUE(state.addDerived(SENSOR_EC, countEc, &log, SENSOR_TDS_PPM));
+    TEST_ASSERT_FALSE(state.addDerived(SENSOR_EC, countEc, &log, SENSOR_TDS_PPM));
+}
+
+void runSensorStateTests()
+{
+    RUN_TEST(test_state_recomputes_only_on_input_changes);
+    RUN_TEST(test_state_unchanged_inputs_still_update);
+    RUN_TEST(test_state_stale_aging_bumps_the_version);
+    RUN_TEST(test_state_stale_aging_across_the_clock_wrap);
+    RUN_TEST(test_state_tds_before_the_first_temperature);
+    RUN_TEST(test_state_fault_of_a_later_input_is_suspect);
+}
@@ -0,0 +1,355 @@
+#include <unity.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include "TestSuites.h"
+#include "SeriesCodec.h"
+#include "SeriesRollup.h"
+
+#define ALL_VALID (TELEMETRY_TDS_VALID | TELEMETRY_PH_VALID | TELEMETRY_TEMP_VALID)
+#define SERIES_TEST_RECORDS (6 * 3600UL)   // Six hours of one record a second
+#define SERIES_TEST_BLOCK 4096
+
+static uint32_t nextRandom(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Standard normal sample, Box-Muller on xorshift32
+static float normalNoise(uint32_t &state)
+{
+    float u1 = (nextRandom(state) + 1.0f) / 4294967296.0f;
+    float u2 = nextRandom(state) / 4294967296.0f;
+    return sqrtf(-2.0f * logf(u1)) * cosf(6.2831853f * u2);
+}
+
+// Report records of a tank: a second apart with a few ms of jitter, probe noise, DS18B20 steps, the odd lost record
+static std::vector<TelemetryRecord> tankRecords(uint32_t seed)
+{
+    std::vector<TelemetryRecord> records;
+    uint32_t state = seed;
+    uint32_t time_ms = 5000;
+    uint16_t sequence = 0;
+    for (uint32_t i = 0; i < SERIES_TEST_RECORDS; i++)
+    {
+        time_ms += 1000 + nextRandom(state) % 5 - 2;
+        if (nextRandom(state) % 5000 == 0)
+        {
+            time_ms += 1000;
+            sequence++;
+        }
+        float hours = time_ms / 3600000.0f;
+        float celsius = 21.0f + 1.5f * sinf(6.2831853f * hours / 24.0f) + 0.01f * normalNoise(state);
+
+        TelemetryRecord record;
+        record.sequence = sequence++;
+        record.timestamp_ms = time_ms;
+        record.tds_ppm = 1100.0f - 5.0f * hours + 0.8f * normalNoise(state);
+        record.ph = 6.0f + 0.02f * hours + 0.003f * normalNoise(state);
+        record.temperature_c = roundf(celsius * 16.0f) / 16.0f;
+        record.status = ALL_VALID;
+        if (nextRandom(state) % 2000 == 0)
+            record.status |= TELEMETRY_RING_DROPS;
+        records.push_back(record);
+    }
+    return records;
+}
+
+static TelemetryRecord quantised(const TelemetryRecord &record)
+{
+    TelemetryRecord result = record;
+    result.tds_ppm = seriesValue(seriesQuantise(record.tds_ppm, SERIES_TDS_SCALE), SERIES_TDS_SCALE);
+    result.ph = seriesValue(seriesQuantise(record.ph, SERIES_PH_SCALE), SERIES_PH_SCALE);
+    result.temperature_c = seriesValue(seriesQuantise(record.temperature_c, SERIES_TEMP_SCALE), SERIES_TEMP_SCALE);
+    return result;
+}
+
+// Same record, NaN equal to NaN
+static void assertSameRecord(const TelemetryRecord &expected, const TelemetryRecord &actual)
+{
+    TEST_ASSERT_EQUAL_UINT16(expected.sequence, actual.sequence);
+    TEST_ASSERT_EQUAL_UINT32(expected.timestamp_ms, actual.timestamp_ms);
+    TEST_ASSERT_EQUAL_HEX16(expected.status, actual.status);
+    const float want[3] = {expected.tds_ppm, expected.ph, expected.temperature_c};
+    const float got[3] = {actual.tds_ppm, actual.ph, actual.temperature_c};
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        if (isnan(want[i]))
+            TEST_ASSERT_TRUE(isnan(got[i]));
+        else
+            TEST_ASSERT_FLOAT_WITHIN(0.0f, want[i], got[i]);
+    }
+}
+
+static void test_series_quantise_to_the_printed_steps()
+{
+    TEST_ASSERT_EQUAL_INT32(110012, seriesQuantise(1100.1249f, SERIES_TDS_SCALE));
+    TEST_ASSERT_EQUAL_INT32(-6001, seriesQuantise(-6.0008f, SERIES_PH_SCALE));
+    TEST_ASSERT_FLOAT_WITHIN(1e-6f, 6.25f, seriesValue(seriesQuantise(6.2501f, SERIES_PH_SCALE), SERIES_PH_SCALE));
+
+    // NaN is kept, values beyond 32 bits saturate
+    TEST_ASSERT_TRUE(isnan(seriesValue(seriesQuantise(NAN, SERIES_TEMP_SCALE), SERIES_TEMP_SCALE)));
+    TEST_ASSERT_EQUAL_INT32(INT32_MAX, seriesQuantise(1e30f, SERIES_TDS_SCALE));
+    TEST_ASSERT_TRUE(!isnan(seriesValue(seriesQuantise(-1e30f, SERIES_TDS_SCALE), SERIES_TDS_SCALE)));
+}
+
+static void test_series_round_trip_in_blocks()
+{
+    std::vector<TelemetryRecord> records = tankRecords(12345);
+    static uint8_t block[SERIES_TEST_BLOCK];
+    SeriesEncoder encoder;
+    size_t index = 0, decoded = 0, bytes = 0;
+    while (index < records.size())
+    {
+        encoder.begin(block, sizeof(block));
+        size_t first = index;
+        while (index < records.size() && encoder.append(records[index]))
+            index++;
+        TEST_ASSERT_GREATER_THAN(0, encoder.count());
+        TEST_ASSERT_LESS_OR_EQUAL(SERIES_TEST_BLOCK, encoder.size());
+        TEST_ASSERT_EQUAL_UINT32(records[first].timestamp_ms, encoder.firstMs());
+        TEST_ASSERT_EQUAL_UINT32(records[index - 1].timestamp_ms, encoder.lastMs());
+        bytes += encoder.size();
+
+        // Every record comes back to the step the history prints
+        SeriesDecoder decoder(block, encoder.size(), encoder.count());
+        TelemetryRecord record;
+        for (size_t i = first; i < index; i++)
+        {
+            TEST_ASSERT_TRUE(decoder.next(record));
+            assertSameRecord(quantised(records[i]), record);
+            decoded++;
+        }
+        TEST_ASSERT_FALSE(decoder.next(record));
+        TEST_ASSERT_EQUAL_UINT16(0, decoder.remaining());
+    }
+    TEST_ASSERT_EQUAL_size_t(records.size(), decoded);
+
+    // At least three times smaller than the plain record
+    TEST_ASSERT_LESS_OR_EQUAL(records.size() * SERIES_RECORD_SIZE / 3, bytes);
+}
+
+static void test_series_steady_records_cost_a_few_bits()
+{
+    // A steady period, the same values and status: one bit each for the timestamp, sequence, values and status
+    uint8_t block[512];
+    SeriesEncoder encoder;
+    encoder.begin(block, sizeof(block));
+    TelemetryRecord record = {100, 60000, 1100.0f, 6.5f, 21.25f, ALL_VALID};
+    TEST_ASSERT_TRUE(encoder.append(record));
+    record.sequence++;
+    record.timestamp_ms += 1000;
+    TEST_ASSERT_TRUE(encoder.append(record)); // Sets the period
+    size_t first = encoder.size();
+    for (uint16_t i = 0; i < 400; i++)
+    {
+        record.sequence++;
+        record.timestamp_ms += 1000;
+        TEST_ASSERT_TRUE(encoder.append(record));
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(first + 400 * 6 / 8 + 1, encoder.size());
+}
+
+static void test_series_edge_records()
+{
+    // NaN, the clock and the sequence wrapping, huge jumps and values, time going back, every status bit
+    const TelemetryRecord edges[] = {
+        {65534, 4294965000UL, 1100.0f, 6.0f, 21.0f, 0x0007},
+        {65535, 4294966000UL, NAN, 6.001f, 21.0f, 0x0006},
+        {0, 704UL, 1101.0f, NAN, NAN, 0x0001},
+        {7, 1704UL, -3.0e6f, 14.0f, -55.0f, 0x0300},
+        {8, 50000000UL, 3.0e6f, -14.0f, 125.0f, 0x0000},
+        {9, 49999000UL, 0.0f, 0.0f, 0.0f, 0xFFFF},
+        {10, 49999000UL, 1e30f, -1e30f, 0.0f, 0xFFFF},
+    };
+    const uint8_t count = sizeof(edges) / sizeof(edges[0]);
+    uint8_t block[256];
+    SeriesEncoder encoder;
+    encoder.begin(block, sizeof(block));
+    for (const TelemetryRecord &record : edges)
+        TEST_ASSERT_TRUE(encoder.append(record));
+
+    SeriesDecoder decoder(block, encoder.size(), encoder.count());
+    TelemetryRecord record;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        TEST_ASSERT_TRUE(decoder.next(record));
+        assertSameRecord(quantised(edges[i]), record);
+    }
+    TEST_ASSERT_FALSE(decoder.next(record));
+}
+
+static void test_series_full_block_is_left_as_it_was()
+{
+    uint8_t block[24];
+    SeriesEncoder encoder;
+    encoder.begin(block, sizeof(block));
+    TelemetryRecord steady = {1, 1000, 1100.0f, 6.0f, 21.0f, ALL_VALID};
+    TEST_ASSERT_TRUE(encoder.append(steady));
+    steady.sequence++;
+    steady.timestamp_ms += 1000;
+    TEST_ASSERT_TRUE(encoder.append(steady));
+    size_t size = encoder.size();
+    uint8_t before[sizeof(block)];
+    memcpy(before, block, size);
+
+    // A record of large deltas does not fit the rest
+    TelemetryRecord jump = {7, 1704UL, -3.0e6f, 14.0f, -55.0f, 0x0300};
+    TEST_ASSERT_FALSE(encoder.append(jump));
+    TEST_ASSERT_EQUAL_size_t(size, encoder.size());
+    TEST_ASSERT_EQUAL_UINT16(2, encoder.count());
+    TEST_ASSERT_EQUAL_MEMORY(before, block, size);
+
+    // And the block still decodes to the two records
+    SeriesDecoder decoder(block, encoder.size(), encoder.count());
+    TelemetryRecord record;
+    TEST_ASSERT_TRUE(decoder.next(record));
+    TEST_ASSERT_TRUE(decoder.next(record));
+    assertSameRecord(quantised(steady), record);
+    TEST_ASSERT_FALSE(decoder.next(record));
+}
+
+static void test_series_truncated_block_stops()
+{
+    uint8_t block[512];
+    SeriesEncoder encoder;
+    encoder.begin(block, sizeof(block));
+    std::vector<TelemetryRecord> records = tankRecords(777);
+    for (uint16_t i = 0; i < 50; i++)
+        TEST_ASSERT_TRUE(encoder.append(records[i]));
+
+    // A count larger than the data reads what is there and then reports the end, never past it
+    SeriesDecoder decoder(block, encoder.size() / 2, encoder.count());
+    TelemetryRecord record;
+    uint16_t read = 0;
+    while (decoder.next(record))
+        read++;
+    TEST_ASSERT_GREATER_THAN(0, read);
+    TEST_ASSERT_LESS_THAN(50, read);
+}
+
+static void test_rollup_tiers_match_an_exact_summary()
+{
+    std::vector<TelemetryRecord> records = tankRecords(4242);
+    static SeriesRollup rollup;
+    rollup.clear();
+    for (const TelemetryRecord &record : records)
+        rollup.add(record);
+    // Every period before the last record's is complete
+    uint32_t last_ms = records.back().timestamp_ms;
+    TEST_ASSERT_EQUAL_UINT16(last_ms / 3600000UL, rollup.hours.size());
+    TEST_ASSERT_EQUAL_UINT16(last_ms / 60000UL, rollup.minutes.size());
+
+    const float steps[ROLLUP_CHANNELS] = {1.0f / ROLLUP_TDS_SCALE, 1.0f / ROLLUP_PH_SCALE, 1.0f / ROLLUP_TEMP_SCALE};
+    auto check = [&](const RollupBucket &bucket, uint32_t period_ms) {
+        TEST_ASSERT_EQUAL_UINT32(0, bucket.start_ms % period_ms);
+        double sum[3] = {0, 0, 0};
+        float min[3] = {INFINITY, INFINITY, INFINITY}, max[3] = {-INFINITY, -INFINITY, -INFINITY};
+        uint32_t count = 0;
+        uint16_t status = 0;
+        for (const TelemetryRecord &record : records)
+        {
+            if (record.timestamp_ms < bucket.start_ms || record.timestamp_ms >= bucket.start_ms + period_ms)
+                continue;
+            const float values[3] = {record.tds_ppm, record.ph, record.temperature_c};
+            for (uint8_t c = 0; c < 3; c++)
+            {
+                sum[c] += values[c];
+                min[c] = fminf(min[c], values[c]);
+                max[c] = fmaxf(max[c], values[c]);
+            }
+            status |= record.status;
+            count++;
+        }
+        TEST_ASSERT_EQUAL_UINT32(count, bucket.count);
+        TEST_ASSERT_EQUAL_HEX16(status, bucket.status);
+        for (uint8_t c = 0; c < 3; c++)
+        {
+            RollupChannel channel = (RollupChannel)c;
+            TEST_ASSERT_FLOAT_WITHIN(steps[c], min[c], bucket.minimum(channel));
+            TEST_ASSERT_FLOAT_WITHIN(steps[c], max[c], bucket.maximum(channel));
+            TEST_ASSERT_FLOAT_WITHIN(steps[c], (float)(sum[c] / count), bucket.average(channel));
+        }
+    };
+    for (uint16_t age = 0; age < rollup.hours.size(); age++)
+        check(rollup.hours.bucket(age), rollup.hours.period());
+    for (uint16_t age = 0; age < rollup.minutes.size(); age += 7)
+        check(rollup.minutes.bucket(age), rollup.minutes.period());
+
+    // The newest completed buckets are the ones right before the open period
+    RollupBucket open;
+    TEST_ASSERT_TRUE(rollup.hours.current(open));
+    TEST_ASSERT_EQUAL_UINT32(open.start_ms - 3600000UL, rollup.hours.bucket(0).start_ms);
+}
+
+static void test_rollup_skips_invalid_and_faulty_values()
+{
+    RollupTier<4> tier(60000UL);
+    TelemetryRecord good = {0, 1000, 1000.0f, 6.0f, 20.0f, ALL_VALID};
+    TelemetryRecord faulty = {1, 2000, 5000.0f, 1.0f, 85.0f, ALL_VALID | TELEMETRY_TDS_FAULT | TELEMETRY_TEMP_FAULT};
+    TelemetryRecord invalid = {2, 3000, 0.0f, NAN, 0.0f, TELEMETRY_TDS_VALID};
+    TEST_ASSERT_FALSE(tier.add(good));
+    TEST_ASSERT_FALSE(tier.add(faulty));
+    TEST_ASSERT_FALSE(tier.add(invalid));
+
+    RollupBucket bucket;
+    TEST_ASSERT_TRUE(tier.current(bucket));
+    TEST_ASSERT_EQUAL_UINT16(3, bucket.count);
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, 500.0f, bucket.average(ROLLUP_TDS)); // The invalid record's 0 ppm is marked valid
+    TEST_ASSERT_FLOAT_WITHIN(0.0005f, 3.5f, bucket.average(ROLLUP_PH));  // The faulty record's pH is fine
+    TEST_ASSERT_FLOAT_WITHIN(0.005f, 20.0f, bucket.maximum(ROLLUP_TEMPERATURE));
+    TEST_ASSERT_EQUAL_HEX16(ALL_VALID | TELEMETRY_TDS_FAULT | TELEMETRY_TEMP_FAULT, bucket.status);
+
+    // A period with only faulty temperatures has no valid temperature
+    RollupTier<4> only_faulty(60000UL);
+    only_faulty.add(faulty);
+    only_faulty.current(bucket);
+    TEST_ASSERT_EQUAL_HEX16(TELEMETRY_PH_VALID | TELEMETRY_TDS_FAULT | TELEMETRY_TEMP_FAULT, bucket.status);
+}
+
+static void test_rollup_ring_keeps_the_newest_and_skips_gaps()
+{
+    RollupTier<4> tier(60000UL);
+    TelemetryRecord record = {0, 0, 1000.0f, 6.0f, 20.0f, ALL_VALID};
+    RollupBucket open;
+    TEST_ASSERT_FALSE(tier.current(open));
+
+    // One record a minute for ten minutes, then nothing for an hour, then one more
+    uint32_t completed = 0;
+    for (uint16_t minute = 0; minute < 10; minute++)
+    {
+        record.timestamp_ms = minute * 60000UL + 30000;
+        record.tds_ppm = 1000.0f + minute;
+        completed += tier.add(record);
+    }
+    record.timestamp_ms = 70 * 60000UL + 5;
+    completed += tier.add(record);
+    TEST_ASSERT_EQUAL_UINT32(10, completed);
+
+    TEST_ASSERT_EQUAL_UINT16(4, tier.size());
+    TEST_ASSERT_EQUAL_UINT32(9 * 60000UL, tier.bucket(0).start_ms); // The gap leaves no bucket
+    TEST_ASSERT_EQUAL_UINT32(6 * 60000UL, tier.bucket(3).start_ms);
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, 1009.0f, tier.bucket(0).average(ROLLUP_TDS));
+    TEST_ASSERT_TRUE(tier.current(open));
+    TEST_ASSERT_EQUAL_UINT32(70 * 60000UL, open.start_ms);
+
+    tier.clear();
+    TEST_ASSERT_EQUAL_UINT16(0, tier.size());
+    TEST_ASSERT_FALSE(tier.current(open));
+}
+
+void runSeriesTests()
+{
+    RUN_TEST(test_series_quantise_to_the_printed_steps);
+    RUN_TEST(test_series_round_trip_in_blocks);
+    RUN_TEST(test_series_steady_records_cost_a_few_bits);
+    RUN_TEST(test_series_edge_records);
+    RUN_TEST(test_series_full_block_is_left_as_it_was);
+    RUN_TEST(test_series_truncated_block_stops);
+    RUN_TEST(test_rollup_tiers_match_an_exact_summary);
+    RUN_TEST(test_rollup_skips_invalid_and_faulty_values);
+    RUN_TEST(test_rollup_ring_keeps_the_newest_and_skips_gaps);
+}
@@ -0,0 +1,200 @@
+#include <unity.h>
+#include <string.h>
+#include "TestSuites.h"
+#include "Telemetry.h"
+
+// Encode length bytes, check the encoding holds no zero and fits the stated bound, decode and compare
+static size_t roundTrip(const uint8_t *in, size_t length)
+{
+    static uint8_t encoded[TELEMETRY_BATCH_FRAME_SIZE];
+    static uint8_t decoded[TELEMETRY_BATCH_FRAME_SIZE];
+    size_t encoded_length = cobsEncode(in, length, encoded);
+    TEST_ASSERT_LESS_OR_EQUAL(length + length / 254 + 1, encoded_length);
+    for (size_t i = 0; i < encoded_length; i++)
+        TEST_ASSERT_TRUE(encoded[i] != 0);
+    TEST_ASSERT_EQUAL_size_t(length, cobsDecode(encoded, encoded_length, decoded));
+    TEST_ASSERT_EQUAL_MEMORY(in, decoded, length);
+    return encoded_length;
+}
+
+static TelemetryRecord sampleRecord()
+{
+    TelemetryRecord record;
+    record.sequence = 0x1234;
+    record.timestamp_ms = 0x00BC614E;
+    record.tds_ppm = 512.5f;
+    record.ph = 6.25f;
+    record.temperature_c = 0; // All zero bytes, a run of them in the payload
+    record.status = TELEMETRY_TDS_VALID | TELEMETRY_PH_VALID | TELEMETRY_RING_DROPS;
+    return record;
+}
+
+static void test_crc_check_value()
+{
+    // The catalogued check value of CRC-16/CCITT-FALSE
+    const char *check = "123456789";
+    TEST_ASSERT_EQUAL_HEX16(0x29B1, crc16Ccitt((const uint8_t *)check, strlen(check)));
+    TEST_ASSERT_EQUAL_HEX16(0xFFFF, crc16Ccitt((const uint8_t *)check, 0));
+
+    // Continuing from a partial CRC gives the same as one pass
+    uint16_t partial = crc16Ccitt((const uint8_t *)check, 4);
+    TEST_ASSERT_EQUAL_HEX16(0x29B1, crc16Ccitt((const uint8_t *)check + 4, 5, partial));
+}
+
+static void test_cobs_zero_runs()
+{
+    static const uint8_t vectors[][6] = {
+        {0},
+        {0, 0},
+        {0, 0, 0, 0, 0, 0},
+        {0x11, 0, 0, 0x22},
+        {0, 0x11, 0, 0x22, 0},
+        {0x11, 0x22, 0x33, 0x44, 0x55, 0},
+    };
+    static const uint8_t lengths[] = {1, 2, 6, 4, 5, 6};
+    for (uint8_t i = 0; i < sizeof(lengths); i++)
+        roundTrip(vectors[i], lengths[i]);
+
+    // Zeros alone are a code of one each, one more for the run after the last
+    uint8_t zeros[4] = {};
+    uint8_t encoded[5];
+    TEST_ASSERT_EQUAL_size_t(5, cobsEncode(zeros, sizeof(zeros), encoded));
+    for (uint8_t i = 0; i < sizeof(encoded); i++)
+        TEST_ASSERT_EQUAL_UINT8(1, encoded[i]);
+
+    // Nothing at all is a single code
+    TEST_ASSERT_EQUAL_size_t(1, cobsEncode(zeros, 0, encoded));
+    TEST_ASSERT_EQUAL_UINT8(1, encoded[0]);
+}
+
+static void test_cobs_block_edges()
+{
+    // Runs of non-zero bytes on either side of the 254 byte block, with and without a zero after them
+    static uint8_t data[TELEMETRY_BATCH_MAX];
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)(i % 255 + 1);
+
+    TEST_ASSERT_EQUAL_size_t(254, roundTrip(data, 253));
+    TEST_ASSERT_EQUAL_size_t(256, roundTrip(data, 254)); // 0xFF, the block, and the code of the empty run after it
+    TEST_ASSERT_EQUAL_size_t(257, roundTrip(data, 255));
+    TEST_ASSERT_EQUAL_size_t(511, roundTrip(data, 508));
+    roundTrip(data, sizeof(data));
+
+    uint8_t encoded[260];
+    cobsEncode(data, 254, encoded);
+    TEST_ASSERT_EQUAL_UINT8(0xFF, encoded[0]);
+    TEST_ASSERT_EQUAL_UINT8(1, encoded[255]);
+
+    data[254] = 0;
+    roundTrip(data, 255);
+    roundTrip(data, 256);
+    data[253] = 0;
+    roundTrip(data, 255);
+}
+
+static void test_record_round_trip()
+{
+    TelemetryRecord record = sampleRecord();
+    uint8_t frame[TELEMETRY_FRAME_SIZE];
+    size_t length = telemetryEncode(record, frame, sizeof(frame));
+    TEST_ASSERT_GREATER_THAN(0, length);
+    TEST_ASSERT_LESS_OR_EQUAL(TELEMETRY_FRAME_SIZE, length);
+    TEST_ASSERT_EQUAL_UINT8(0, frame[0]);
+    TEST_ASSERT_EQUAL_UINT8(0, frame[length - 1]);
+    for (size_t i = 1; i < length - 1; i++)
+        TEST_ASSERT_TRUE(frame[i] != 0);
+
+    TelemetryRecord decoded;
+    TEST_ASSERT_TRUE(telemetryDecode(frame + 1, length - 2, decoded));
+    TEST_ASSERT_EQUAL_UINT16(record.sequence, decoded.sequence);
+    TEST_ASSERT_EQUAL_UINT32(record.timestamp_ms, decoded.timestamp_ms);
+    TEST_ASSERT_EQUAL_MEMORY(&record.tds_ppm, &decoded.tds_ppm, sizeof(float));
+    TEST_ASSERT_EQUAL_MEMORY(&record.ph, &decoded.ph, sizeof(float));
+    TEST_ASSERT_EQUAL_MEMORY(&record.temperature_c, &decoded.temperature_c, sizeof(float));
+    TEST_ASSERT_EQUAL_UINT16(record.status, decoded.status);
+
+    // Too small a buffer is refused instead of overrun
+    TEST_ASSERT_EQUAL_size_t(0, telemetryEncode(record, frame, TELEMETRY_FRAME_SIZE - 1));
+}
+
+static void test_corrupted_frames_rejected()
+{
+    uint8_t frame[TELEMETRY_FRAME_SIZE];
+    size_t length = telemetryEncode(sampleRecord(), frame, sizeof(frame));
+    uint8_t *body = frame + 1;
+    size_t body_length = length - 2;
+    TelemetryRecord decoded;
+
+    // Every single bit flip of the body, code bytes included
+    for (size_t i = 0; i < body_length; i++)
+    {
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            body[i] ^= 1 << bit;
+            TEST_ASSERT_FALSE(telemetryDecode(body, body_length, decoded));
+            body[i] ^= 1 << bit;
+        }
+    }
+    TEST_ASSERT_TRUE(telemetryDecode(body, body_length, decoded));
+
+    // Cut short, run on, or empty
+    for (size_t cut = 1; cut < body_length; cut++)
+        TEST_ASSERT_FALSE(telemetryDecode(body, body_length - cut, decoded));
+    TEST_ASSERT_FALSE(telemetryDecode(body, body_length + 1, decoded));
+    TEST_ASSERT_FALSE(telemetryDecode(body, 0, decoded));
+
+    // A stray text line between two delimiters
+    const char *text = "pH 6.25 TDS 512";
+    TEST_ASSERT_FALSE(telemetryDecode((const uint8_t *)text, strlen(text), decoded));
+
+    // A valid CRC under another version
+    uint8_t raw[TELEMETRY_RAW_SIZE];
+    TEST_ASSERT_EQUAL_size_t(TELEMETRY_RAW_SIZE, cobsDecode(body, body_length, raw));
+    raw[0] = TELEMETRY_VERSION + 1;
+    uint16_t crc = crc16Ccitt(raw, TELEMETRY_PAYLOAD_SIZE);
+    raw[TELEMETRY_PAYLOAD_SIZE] = crc & 0xFF;
+    raw[TELEMETRY_PAYLOAD_SIZE + 1] = crc >> 8;
+    uint8_t other[TELEMETRY_FRAME_SIZE];
+    size_t other_length = cobsEncode(raw, sizeof(raw), other);
+    TEST_ASSERT_FALSE(telemetryDecode(other, other_length, decoded));
+}
+
+static void test_batch_round_trip()
+{
+    // A full block with runs of zeros across the 254 byte boundaries
+    static uint8_t block[TELEMETRY_BATCH_MAX];
+    for (size_t i = 0; i < sizeof(block); i++)
+        block[i] = i % 100 < 3 ? 0 : (uint8_t)(i * 7 + 1);
+
+    static uint8_t frame[TELEMETRY_BATCH_FRAME_SIZE];
+    size_t length = telemetryEncodeBatch(block, sizeof(block), 300, frame, sizeof(frame));
+    TEST_ASSERT_GREATER_THAN(0, length);
+    TEST_ASSERT_LESS_OR_EQUAL(TELEMETRY_BATCH_FRAME_SIZE, length);
+
+    static uint8_t decoded[TELEMETRY_BATCH_MAX];
+    size_t decoded_length = 0;
+    uint16_t count = 0;
+    TEST_ASSERT_TRUE(telemetryDecodeBatch(frame + 1, length - 2, decoded, decoded_length, count));
+    TEST_ASSERT_EQUAL_size_t(sizeof(block), decoded_length);
+    TEST_ASSERT_EQUAL_UINT16(300, count);
+    TEST_ASSERT_EQUAL_MEMORY(block, decoded, sizeof(block));
+
+    // The kinds do not mix: a batch is not a trace nor a record, and a block too large is refused
+    TelemetryRecord record;
+    TEST_ASSERT_FALSE(telemetryDecodeTrace(frame + 1, length - 2, decoded, decoded_length, count));
+    TEST_ASSERT_FALSE(telemetryDecode(frame + 1, length - 2, record));
+    TEST_ASSERT_EQUAL_size_t(0, telemetryEncodeBatch(block, sizeof(block) + 1, 300, frame, sizeof(frame)));
+
+    frame[length / 2] ^= 0x10;
+    TEST_ASSERT_FALSE(telemetryDecodeBatch(frame + 1, length - 2, decoded, decoded_length, count));
+}
+
+void runTelemetryTests()
+{
+    RUN_TEST(test_crc_check_value);
+    RUN_TEST(test_cobs_zero_runs);
+    RUN_TEST(test_cobs_block_edges);
+    RUN_TEST(test_record_round_trip);
+    RUN_TEST(test_corrupted_frames_rejected);
+    RUN_TEST(test_batch_round_trip);
+}
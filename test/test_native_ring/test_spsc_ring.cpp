@@ -0,0 +1,169 @@
+// SpscRing from two threads, the way the acquisition task and loop() use it.
+// The native_tsan env runs this suite under ThreadSanitizer as well:
+// pio test -e native_tsan
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "SpscRing.h"
+#include "Reading.h"
+
+#define RING_ITEMS 1000000    // Readings the producer offers per stress run
+#define RING_SIZE 64          // Same ring as the firmware's READING_RING_SIZE
+
+// Producer side of the firmware: never wait, a full ring costs the reading and counts a drop
+struct Producer
+{
+    uint32_t published;
+    uint32_t drops;
+    std::vector<bool> dropped;
+};
+
+// Consumer side: every reading has to come out once, in the order it went in
+struct Consumer
+{
+    uint32_t received;
+    uint32_t out_of_order;
+    uint32_t last;
+    std::vector<bool> seen;
+};
+
+static void produce(SpscRing<Reading, RING_SIZE> &ring, Producer &producer, bool retry)
+{
+    for (uint32_t i = 0; i < RING_ITEMS; i++)
+    {
+        Reading reading = {i, READING_PH, 0, QUALITY_GOOD, (float)i};
+        if (retry)
+        {
+            while (!ring.push(reading))
+                std::this_thread::yield();
+        }
+        else if (!ring.push(reading))
+        {
+            producer.drops++;
+            producer.dropped[i] = true;
+            continue;
+        }
+        producer.published++;
+    }
+}
+
+static void consume(SpscRing<Reading, RING_SIZE> &ring, Consumer &consumer, const std::atomic<bool> &done, uint32_t slow_every)
+{
+    Reading reading;
+    for (;;)
+    {
+        if (!ring.pop(reading))
+        {
+            if (done && ring.size() == 0)
+                return;
+            std::this_thread::yield();
+            continue;
+        }
+        if (consumer.received > 0 && reading.timestamp_us <= consumer.last)
+            consumer.out_of_order++;
+        if (reading.value != (float)reading.timestamp_us || reading.timestamp_us >= RING_ITEMS || consumer.seen[reading.timestamp_us])
+            consumer.out_of_order++; // Torn or duplicated
+        else
+            consumer.seen[reading.timestamp_us] = true;
+        consumer.last = reading.timestamp_us;
+        consumer.received++;
+        if (slow_every && consumer.received % slow_every == 0)
+            std::this_thread::yield();
+    }
+}
+
+// One producer and one consumer thread over the same ring
+static void stress(bool retry, uint32_t slow_every, Producer &producer, Consumer &consumer)
+{
+    static SpscRing<Reading, RING_SIZE> ring;
+    while (ring.size() > 0)
+    {
+        Reading reading;
+        ring.pop(reading);
+    }
+    producer = {0, 0, std::vector<bool>(RING_ITEMS, false)};
+    consumer = {0, 0, 0, std::vector<bool>(RING_ITEMS, false)};
+    std::atomic<bool> done(false);
+    std::thread consumer_thread([&] { consume(ring, consumer, done, slow_every); });
+    std::thread producer_thread([&] { produce(ring, producer, retry); });
+    producer_thread.join();
+    done = true;
+    consumer_thread.join();
+}
+
+static void test_ring_fills_to_capacity_in_order()
+{
+    SpscRing<uint32_t, 8> ring;
+    for (uint32_t i = 0; i < 8; i++)
+        TEST_ASSERT_TRUE(ring.push(i));
+    TEST_ASSERT_FALSE(ring.push(8));
+    TEST_ASSERT_EQUAL_UINT32(8, ring.size());
+    uint32_t value;
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        TEST_ASSERT_TRUE(ring.pop(value));
+        TEST_ASSERT_EQUAL_UINT32(i, value);
+    }
+    TEST_ASSERT_FALSE(ring.pop(value));
+}
+
+static void test_ring_wraps_its_slots()
+{
+    SpscRing<uint32_t, 4> ring;
+    uint32_t value;
+    for (uint32_t i = 0; i < 1000; i++)
+    {
+        TEST_ASSERT_TRUE(ring.push(i));
+        TEST_ASSERT_TRUE(ring.push(i + 1000000));
+        TEST_ASSERT_TRUE(ring.pop(value));
+        TEST_ASSERT_EQUAL_UINT32(i, value);
+        TEST_ASSERT_TRUE(ring.pop(value));
+        TEST_ASSERT_EQUAL_UINT32(i + 1000000, value);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, ring.size());
+}
+
+static void test_ring_two_threads_lose_nothing()
+{
+    // A producer that waits for room: everything arrives, in order, once
+    Producer producer;
+    Consumer consumer;
+    stress(true, 0, producer, consumer);
+    TEST_ASSERT_EQUAL_UINT32(RING_ITEMS, producer.published);
+    TEST_ASSERT_EQUAL_UINT32(0, producer.drops);
+    TEST_ASSERT_EQUAL_UINT32(RING_ITEMS, consumer.received);
+    TEST_ASSERT_EQUAL_UINT32(0, consumer.out_of_order);
+}
+
+static void test_ring_two_threads_count_drops()
+{
+    // The firmware's producer against a slow consumer: what did not fit is counted, the rest arrives in order
+    Producer producer;
+    Consumer consumer;
+    stress(false, 4, producer, consumer);
+    TEST_ASSERT_EQUAL_UINT32(RING_ITEMS, producer.published + producer.drops);
+    TEST_ASSERT_EQUAL_UINT32(producer.published, consumer.received);
+    TEST_ASSERT_EQUAL_UINT32(0, consumer.out_of_order);
+    uint32_t missing = 0;
+    for (uint32_t i = 0; i < RING_ITEMS; i++)
+    {
+        TEST_ASSERT_TRUE(consumer.seen[i] != producer.dropped[i]); // Either it arrived or it was counted as dropped
+        missing += producer.dropped[i];
+    }
+    TEST_ASSERT_EQUAL_UINT32(producer.drops, missing);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_ring_fills_to_capacity_in_order);
+    RUN_TEST(test_ring_wraps_its_slots);
+    RUN_TEST(test_ring_two_threads_lose_nothing);
+    RUN_TEST(test_ring_two_threads_count_drops);
+    return UNITY_END();
+}